@@ -0,0 +1,165 @@
+#!/bin/bash
+# End-to-end loopback benchmark: runs ftbench's microbenchmarks, then sends
+# each generated data set from ftclient to a fresh ftserver over 127.0.0.1
+# and writes one JSON document with the results.
+#
+# usage: bench/bench.sh <build dir>        (normally through `make bench`)
+#
+# Environment:
+#   BENCH_CASES        data sets to send (default: "small 100m text sparse";
+#                      "all" adds 20g): small is 100000 files of 1 KB, 100m and
+#                      20g random data, text 100 MB of compressible text and
+#                      sparse 1 GB holding 16 MB of data
+#   BENCH_OUT          results file (default: <build dir>/bench.json)
+#   BENCH_WORK         generated inputs, kept between runs, and received files
+#                      (default: <build dir>/bench)
+#   BENCH_NETEM        netem parameters applied to lo for the run, e.g.
+#                      "delay 10ms loss 0.1%" (needs root; delay applies per direction)
+#   BENCH_PORT         server port (default: 9400)
+#   BENCH_MICRO        0 skips the microbenchmarks
+#   BENCH_CLIENT_ARGS  extra ftclient options, e.g. "-c 4"
+#   BENCH_SERVER_ARGS  extra ftserver options, e.g. "-s none"
+
+set -u
+
+BUILD=${1:-build}
+OUT=${BENCH_OUT:-$BUILD/bench.json}
+WORK=${BENCH_WORK:-$BUILD/bench}
+PORT=${BENCH_PORT:-9400}
+CASES=${BENCH_CASES:-"small 100m text sparse"}
+NETEM=${BENCH_NETEM:-}
+CLIENT_ARGS=${BENCH_CLIENT_ARGS:-}
+SERVER_ARGS=${BENCH_SERVER_ARGS:-}
+FTBENCH=$BUILD/ftbench
+if [ "$CASES" = "all" ]; then
+    CASES="small 100m text sparse 20g"
+fi
+
+for bin in ftbench ftserver ftclient; do
+    if [ ! -x "$BUILD/$bin" ]; then
+        echo "bench: $BUILD/$bin not built" >&2
+        exit 1
+    fi
+done
+mkdir -p "$WORK/input" || exit 1
+
+# JSON string (paths and options only: no control characters)
+json_str() {
+    printf '"%s"' "$(printf '%s' "$1" | sed 's/\\/\\\\/g; s/"/\\"/g')"
+}
+
+# Shape the loopback interface for the run, and always undo it
+if [ -n "$NETEM" ]; then
+    # shellcheck disable=SC2086
+    if ! tc qdisc add dev lo root netem $NETEM; then
+        echo "bench: cannot apply netem '$NETEM' to lo (needs root and sch_netem)" >&2
+        exit 1
+    fi
+    trap 'tc qdisc del dev lo root 2>/dev/null' EXIT
+fi
+
+# Generate a case's input once; later runs reuse it (contents are seeded)
+prepare() {
+    local name=$1 input=$WORK/input/$1
+    case $name in
+        small)  [ -d "$input" ] || "$FTBENCH" gen tree "$input" 1K 100000 ;;
+        100m)   [ -f "$input" ] || "$FTBENCH" gen random "$input" 100M ;;
+        text)   [ -f "$input" ] || "$FTBENCH" gen text "$input" 100M ;;
+        sparse) [ -f "$input" ] || "$FTBENCH" gen sparse "$input" 1G ;;
+        20g)    [ -f "$input" ] || "$FTBENCH" gen random "$input" 20G ;;
+        *)      echo "bench: unknown case '$name'" >&2; return 1 ;;
+    esac
+}
+
+# Wait for the server to log that it is listening
+wait_listening() {
+    for _ in $(seq 1 100); do
+        grep -q "Server listening" "$1" 2>/dev/null && return 0
+        sleep 0.05
+    done
+    return 1
+}
+
+# Value of a numeric field in one of ftbench run's JSON lines (0 if missing)
+field() {
+    local value
+    value=$(sed -n "s/.*\"$2\": \\([0-9.]*\\).*/\\1/p" "$1" 2>/dev/null)
+    echo "${value:-0}"
+}
+
+# Run one case and print its JSON object
+run_case() {
+    local name=$1 input=$WORK/input/$1 recv=$WORK/recv
+    local bytes files verified spid
+
+    rm -rf "$recv" && mkdir -p "$recv"
+    bytes=$(du -s --apparent-size -B1 "$input" | cut -f1)
+    files=$(find "$input" -type f | wc -l)
+
+    # shellcheck disable=SC2086
+    "$FTBENCH" run -o "$WORK/server.json" -- "$BUILD/ftserver" -p "$PORT" -d "$recv" $SERVER_ARGS \
+        > "$WORK/server.log" 2>&1 &
+    spid=$!
+    if ! wait_listening "$WORK/server.log"; then
+        echo "bench: server did not start, see $WORK/server.log" >&2
+        kill "$spid" 2>/dev/null
+        return 1
+    fi
+    # shellcheck disable=SC2086
+    "$FTBENCH" run -o "$WORK/client.json" -- "$BUILD/ftclient" -h 127.0.0.1 -p "$PORT" -f "$input" $CLIENT_ARGS \
+        > "$WORK/client.log" 2>&1
+    kill -TERM "$spid"
+    wait "$spid"
+
+    verified=false
+    if [ "$(field "$WORK/client.json" exit)" = "0" ] && diff -rq "$input" "$recv/$name" > /dev/null 2>&1; then
+        verified=true
+    fi
+    rm -rf "$recv"
+
+    awk -v name="$name" -v bytes="$bytes" -v files="$files" -v verified="$verified" \
+        -v wall="$(field "$WORK/client.json" wall_s)" \
+        -v cu="$(field "$WORK/client.json" user_s)" -v cs="$(field "$WORK/client.json" sys_s)" \
+        -v su="$(field "$WORK/server.json" user_s)" -v ss="$(field "$WORK/server.json" sys_s)" \
+        -v crss="$(field "$WORK/client.json" max_rss_kb)" -v srss="$(field "$WORK/server.json" max_rss_kb)" \
+        -v csys="$(( $(field "$WORK/client.json" syscr) + $(field "$WORK/client.json" syscw) ))" \
+        -v ssys="$(( $(field "$WORK/server.json" syscr) + $(field "$WORK/server.json" syscw) ))" \
+        'BEGIN {
+            gb = bytes / 1e9; if (gb == 0) gb = 1e-9
+            rate = wall > 0 ? bytes / 1e6 / wall : 0
+            printf "    {\"case\": \"%s\", \"bytes\": %s, \"files\": %s, \"verified\": %s, ", name, bytes, files, verified
+            printf "\"seconds\": %.3f, \"mb_s\": %.1f,\n", wall, rate
+            printf "     \"client\": {\"cpu_s\": %.3f, \"user_s\": %.3f, \"sys_s\": %.3f, \"peak_rss_kb\": %d, \"syscalls_per_gb\": %.0f},\n", \
+                   cu + cs, cu, cs, crss, csys / gb
+            printf "     \"server\": {\"cpu_s\": %.3f, \"user_s\": %.3f, \"sys_s\": %.3f, \"peak_rss_kb\": %d, \"syscalls_per_gb\": %.0f}}", \
+                   su + ss, su, ss, srss, ssys / gb
+        }'
+}
+
+{
+    printf '{\n  "version": %s,\n' "$(json_str "$(git describe --always --dirty 2>/dev/null || echo unknown)")"
+    printf '  "date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    printf '  "host": {"kernel": %s, "cpus": %s, "cpu": %s},\n' \
+        "$(json_str "$(uname -sr)")" "$(getconf _NPROCESSORS_ONLN)" \
+        "$(json_str "$(sed -n 's/^model name[^:]*: //p' /proc/cpuinfo 2>/dev/null | head -1)")"
+    printf '  "config": {"netem": %s, "client_args": %s, "server_args": %s},\n' \
+        "$(json_str "$NETEM")" "$(json_str "$CLIENT_ARGS")" "$(json_str "$SERVER_ARGS")"
+    if [ "${BENCH_MICRO:-1}" != "0" ]; then
+        echo "bench: microbenchmarks" >&2
+        micro=$("$FTBENCH" micro -d "$WORK") || exit 1
+        printf '  "micro": %s,\n' "$(printf '%s\n' "$micro" | sed '2,$s/^/  /')"
+    fi
+    printf '  "loopback": ['
+    sep=
+    for name in $CASES; do
+        echo "bench: $name" >&2
+        prepare "$name" || exit 1
+        printf '%s\n' "$sep"
+        run_case "$name" || exit 1
+        sep=,
+    done
+    printf '\n  ]\n}\n'
+} > "$OUT.tmp" || { rm -f "$OUT.tmp"; exit 1; }
+
+mv "$OUT.tmp" "$OUT"
+echo "bench: results in $OUT" >&2
@@ -0,0 +1,851 @@
+/*
+ * Benchmark tool behind `make bench`:
+ *   ftbench micro [-d <dir>] [-s <MB>] [-t <ms>]   microbenchmarks, as JSON
+ *   ftbench gen <kind> <path> <size> [<count>]     reproducible input files
+ *   ftbench run -o <file> -- <command...>          resource usage of a command, as JSON
+ * bench/bench.sh drives it for the end-to-end loopback runs.
+ */
+#include "../src/common/platform.h"
+#include "../src/common/protocol.h"
+#include "../src/common/checksum.h"
+#include "../src/common/fileio.h"
+#include "../src/common/fec.h"
+#include "../src/common/zeroscan.h"
+#include "../src/common/udp.h"
+#include "../src/common/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef FT_PLATFORM_WINDOWS
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#define BENCH_CHUNK_SIZE     FT_DEFAULT_CHUNK_SIZE
+#define BENCH_MIN_MS         200         /* Each microbenchmark runs for at least this long */
+#define BENCH_FILE_MB        256         /* Size of the file behind the file I/O benchmarks */
+#define BENCH_FILE_PASSES    3           /* File I/O benchmarks report the best of this many passes */
+#define BENCH_SPARSE_STRIDE  (64ULL << 20)  /* A sparse file holds one extent of data per stride */
+#define BENCH_SPARSE_EXTENT  (1ULL << 20)
+#define BENCH_TREE_FANOUT    1000        /* Files per directory of a generated tree */
+#define BENCH_PATH_MAX       1024
+
+static const char *crc32_kernels[] = { "vpclmulqdq", "pclmulqdq", "armv8-crc32", "slice16", "byte" };
+static const size_t crc32_sizes[] = { 64, 4096, BENCH_CHUNK_SIZE };
+static const char *fec_kernels[] = { "avx2", "ssse3", "neon", "table" };
+static const uint32_t fec_codes[][2] = { { 8, 2 }, { 32, 2 }, { 32, 4 }, { FT_FEC_MAX_DATA, FT_FEC_MAX_PARITY } };
+static const char *zero_kernels[] = { "avx2", "sse2", "neon", "word" };
+
+/* Keeps the compiler from discarding benchmarked results */
+static volatile uint64_t sink;
+
+/* Benchmarked operation, run iterations times */
+typedef void (*bench_func)(void *context, uint64_t iterations);
+
+/* Generator state: xorshift64*, seeded so every run produces the same files */
+typedef struct {
+    uint64_t state;
+} Rng;
+
+/* Next pseudo-random value */
+static uint64_t rng_next(Rng *rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Size argument: bytes with an optional K, M or G suffix (powers of 1024) */
+static int parse_size(const char *text, uint64_t *size) {
+    char *end;
+    uint64_t value = strtoull(text, &end, 10);
+
+    switch (*end) {
+        case 'K': case 'k': value <<= 10; end++; break;
+        case 'M': case 'm': value <<= 20; end++; break;
+        case 'G': case 'g': value <<= 30; end++; break;
+        default: break;
+    }
+    if (end == text || *end != '\0') {
+        fprintf(stderr, "Error: Invalid size '%s'\n", text);
+        return -1;
+    }
+    *size = value;
+    return 0;
+}
+
+/* Nanoseconds per iteration of func, run in growing batches until min_ns have passed */
+static double time_per_iteration(bench_func func, void *context, uint64_t min_ns) {
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    uint64_t start_ns = platform_get_monotonic_ns();
+    uint64_t elapsed_ns;
+
+    func(context, 1);   /* Warm up caches and lazily mapped pages */
+    do {
+        func(context, batch);
+        iterations += batch;
+        if (batch < (1u << 20)) {
+            batch *= 2;
+        }
+        elapsed_ns = platform_get_monotonic_ns() - start_ns;
+    } while (elapsed_ns < min_ns);
+    return (double)elapsed_ns / (double)iterations;
+}
+
+/* CRC32 benchmark */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} CrcBench;
+
+static void bench_crc32(void *context, uint64_t iterations) {
+    CrcBench *bench = (CrcBench*)context;
+    uint32_t crc = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        crc ^= crc32_compute(bench->data, bench->size);
+    }
+    sink += crc;
+}
+
+/* FEC benchmarks: one group of FT_UDP_FRAGMENT_SIZE shards; decoding
+ * rebuilds the first m data shards from the parity */
+typedef struct {
+    FecCode code;
+    uint8_t *data[FT_FEC_MAX_DATA];
+    uint8_t *parity[FT_FEC_MAX_PARITY];
+    uint64_t data_present;
+    uint32_t parity_present;
+} FecBench;
+
+static void bench_fec_encode(void *context, uint64_t iterations) {
+    FecBench *bench = (FecBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        fec_encode(&bench->code, bench->code.k, (const uint8_t *const *)bench->data, bench->parity,
+                   FT_UDP_FRAGMENT_SIZE);
+    }
+    sink += bench->parity[0][0];
+}
+
+static void bench_fec_decode(void *context, uint64_t iterations) {
+    FecBench *bench = (FecBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uint64_t)fec_decode(&bench->code, bench->code.k, bench->data, bench->data_present,
+                                     (const uint8_t *const *)bench->parity, bench->parity_present,
+                                     FT_UDP_FRAGMENT_SIZE);
+    }
+}
+
+/* Zero scan benchmark: a chunk of zeros, the case that reads all of it */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} ZeroBench;
+
+static void bench_zero(void *context, uint64_t iterations) {
+    ZeroBench *bench = (ZeroBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uint64_t)zero_check(bench->data, bench->size);
+    }
+}
+
+/* Header benchmarks; buffers are 8-byte aligned as the serializers expect */
+typedef struct {
+    MessageHeader header;
+    ChunkHeader chunk_header;
+    FileInfo file_info;
+    uint64_t buffer[FT_FILE_INFO_MAX_SIZE / sizeof(uint64_t)];
+    size_t size;                  /* Of the v2 FILE_INFO in buffer */
+} HeaderBench;
+
+static void bench_serialize_header(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->header.sequence_num = i;
+        protocol_serialize_header(&bench->header, (uint8_t*)bench->buffer);
+    }
+    sink += bench->buffer[3];
+}
+
+static void bench_deserialize_header(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    MessageHeader header;
+    for (uint64_t i = 0; i < iterations; i++) {
+        protocol_deserialize_header((const uint8_t*)bench->buffer, &header);
+        sink += header.sequence_num;
+    }
+}
+
+static void bench_serialize_header_v2(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->header.sequence_num = i;
+        sink += protocol_serialize_header_v2(&bench->header, (uint8_t*)bench->buffer);
+    }
+}
+
+static void bench_deserialize_header_v2(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    MessageHeader header;
+    for (uint64_t i = 0; i < iterations; i++) {
+        protocol_deserialize_header_v2((const uint8_t*)bench->buffer, &header);
+        sink += header.sequence_num;
+    }
+}
+
+static void bench_serialize_file_info(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->file_info.timestamp = i;
+        protocol_serialize_file_info(&bench->file_info, (uint8_t*)bench->buffer);
+    }
+    sink += bench->buffer[0];
+}
+
+static void bench_deserialize_file_info(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    FileInfo file_info;
+    for (uint64_t i = 0; i < iterations; i++) {
+        protocol_deserialize_file_info((const uint8_t*)bench->buffer, &file_info);
+        sink += file_info.file_size;
+    }
+}
+
+static void bench_serialize_file_info_v2(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->file_info.timestamp = i;
+        sink += protocol_serialize_file_info_v2(&bench->file_info, (uint8_t*)bench->buffer);
+    }
+}
+
+static void bench_deserialize_file_info_v2(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    FileInfo file_info;
+    for (uint64_t i = 0; i < iterations; i++) {
+        protocol_deserialize_file_info_v2((const uint8_t*)bench->buffer, bench->size, &file_info);
+        sink += file_info.file_size;
+    }
+}
+
+static void bench_serialize_chunk_header(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->chunk_header.chunk_id = i;
+        protocol_serialize_chunk_header(&bench->chunk_header, (uint8_t*)bench->buffer);
+    }
+    sink += bench->buffer[0];
+}
+
+static void bench_deserialize_chunk_header(void *context, uint64_t iterations) {
+    HeaderBench *bench = (HeaderBench*)context;
+    ChunkHeader chunk_header;
+    for (uint64_t i = 0; i < iterations; i++) {
+        protocol_deserialize_chunk_header((const uint8_t*)bench->buffer, &chunk_header);
+        sink += chunk_header.chunk_id;
+    }
+}
+
+/* CRC32 throughput of every kernel this CPU supports */
+static void micro_crc32(uint64_t min_ns) {
+    uint8_t *data = file_alloc_buffer(BENCH_CHUNK_SIZE);
+    Rng rng = { 0x9E3779B97F4A7C15ULL };
+    int first = 1;
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < BENCH_CHUNK_SIZE; i++) {
+        data[i] = (uint8_t)rng_next(&rng);
+    }
+
+    printf("  \"crc32_default\": \"%s\",\n  \"crc32\": [", crc32_implementation());
+    for (size_t k = 0; k < sizeof(crc32_kernels) / sizeof(crc32_kernels[0]); k++) {
+        if (crc32_set_implementation(crc32_kernels[k]) != 0) {
+            continue;
+        }
+        for (size_t s = 0; s < sizeof(crc32_sizes) / sizeof(crc32_sizes[0]); s++) {
+            CrcBench bench = { data, crc32_sizes[s] };
+            double ns = time_per_iteration(bench_crc32, &bench, min_ns);
+            printf("%s\n    {\"kernel\": \"%s\", \"bytes\": %zu, \"ns\": %.2f, \"gb_s\": %.3f}",
+                   first ? "" : ",", crc32_kernels[k], crc32_sizes[s], ns, (double)crc32_sizes[s] / ns);
+            first = 0;
+        }
+    }
+    printf("\n  ],\n");
+    crc32_init();
+    file_free_buffer(data);
+}
+
+/* Reed-Solomon encode and decode throughput (data bytes per group) of
+ * every kernel this CPU supports */
+static void micro_fec(uint64_t min_ns) {
+    size_t shards = FT_FEC_MAX_DATA + FT_FEC_MAX_PARITY;
+    uint8_t *memory = file_alloc_buffer(shards * FT_UDP_FRAGMENT_SIZE);
+    const char *chosen = fec_implementation();
+    Rng rng = { 0xD1B54A32D192ED03ULL };
+    FecBench bench;
+    int first = 1;
+
+    if (memory == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < shards * FT_UDP_FRAGMENT_SIZE; i++) {
+        memory[i] = (uint8_t)rng_next(&rng);
+    }
+    memset(&bench, 0, sizeof(bench));
+    for (uint32_t i = 0; i < FT_FEC_MAX_DATA; i++) {
+        bench.data[i] = memory + (size_t)i * FT_UDP_FRAGMENT_SIZE;
+    }
+    for (uint32_t j = 0; j < FT_FEC_MAX_PARITY; j++) {
+        bench.parity[j] = memory + (size_t)(FT_FEC_MAX_DATA + j) * FT_UDP_FRAGMENT_SIZE;
+    }
+
+    printf("  \"fec_default\": \"%s\",\n  \"fec\": [", chosen);
+    for (size_t k = 0; k < sizeof(fec_kernels) / sizeof(fec_kernels[0]); k++) {
+        if (fec_set_implementation(fec_kernels[k]) != 0) {
+            continue;
+        }
+        for (size_t c = 0; c < sizeof(fec_codes) / sizeof(fec_codes[0]); c++) {
+            uint32_t data_shards = fec_codes[c][0];
+            uint32_t parity_shards = fec_codes[c][1];
+            size_t bytes = (size_t)data_shards * FT_UDP_FRAGMENT_SIZE;
+
+            fec_init(&bench.code, data_shards, parity_shards);
+            bench.data_present = (data_shards == 64 ? ~0ULL : (1ULL << data_shards) - 1) &
+                                 ~((1ULL << parity_shards) - 1);
+            bench.parity_present = (1u << parity_shards) - 1;
+            double encode_ns = time_per_iteration(bench_fec_encode, &bench, min_ns);
+            double decode_ns = time_per_iteration(bench_fec_decode, &bench, min_ns);
+            printf("%s\n    {\"kernel\": \"%s\", \"k\": %u, \"m\": %u, \"bytes\": %zu, "
+                   "\"encode_gb_s\": %.3f, \"decode_gb_s\": %.3f}",
+                   first ? "" : ",", fec_kernels[k], data_shards, parity_shards, bytes,
+                   (double)bytes / encode_ns, (double)bytes / decode_ns);
+            first = 0;
+        }
+    }
+    printf("\n  ],\n");
+    fec_set_implementation(chosen);
+    file_free_buffer(memory);
+}
+
+/* Zero scan throughput of every kernel this CPU supports */
+static void micro_zero(uint64_t min_ns) {
+    uint8_t *data = file_alloc_buffer(BENCH_CHUNK_SIZE);
+    const char *chosen = zero_implementation();
+    int first = 1;
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    memset(data, 0, BENCH_CHUNK_SIZE);
+
+    printf("  \"zero_default\": \"%s\",\n  \"zero\": [", chosen);
+    for (size_t k = 0; k < sizeof(zero_kernels) / sizeof(zero_kernels[0]); k++) {
+        if (zero_set_implementation(zero_kernels[k]) != 0) {
+            continue;
+        }
+        ZeroBench bench = { data, BENCH_CHUNK_SIZE };
+        double ns = time_per_iteration(bench_zero, &bench, min_ns);
+        printf("%s\n    {\"kernel\": \"%s\", \"bytes\": %d, \"ns\": %.2f, \"gb_s\": %.3f}",
+               first ? "" : ",", zero_kernels[k], BENCH_CHUNK_SIZE, ns, (double)BENCH_CHUNK_SIZE / ns);
+        first = 0;
+    }
+    printf("\n  ],\n");
+    zero_set_implementation(chosen);
+    file_free_buffer(data);
+}
+
+/* Nanoseconds per header (de)serialization */
+static void micro_protocol(uint64_t min_ns) {
+    HeaderBench bench;
+
+    memset(&bench, 0, sizeof(bench));
+    protocol_init_header(&bench.header, MSG_CHUNK_DATA, 1, BENCH_CHUNK_SIZE + FT_CHUNK_HEADER_SIZE);
+    bench.chunk_header.chunk_offset = 123ULL * BENCH_CHUNK_SIZE;
+    bench.chunk_header.chunk_size = BENCH_CHUNK_SIZE;
+    bench.chunk_header.chunk_crc32 = 0xCBF43926;
+
+    printf("  \"protocol\": {\n");
+    protocol_serialize_header(&bench.header, (uint8_t*)bench.buffer);
+    printf("    \"serialize_header_ns\": %.2f,\n", time_per_iteration(bench_serialize_header, &bench, min_ns));
+    printf("    \"deserialize_header_ns\": %.2f,\n", time_per_iteration(bench_deserialize_header, &bench, min_ns));
+    bench.header.flags = FT_FLAG_HEADER_CRC;
+    printf("    \"header_v2_bytes\": %zu,\n", protocol_serialize_header_v2(&bench.header, (uint8_t*)bench.buffer));
+    printf("    \"serialize_header_v2_ns\": %.2f,\n",
+           time_per_iteration(bench_serialize_header_v2, &bench, min_ns));
+    printf("    \"deserialize_header_v2_ns\": %.2f,\n",
+           time_per_iteration(bench_deserialize_header_v2, &bench, min_ns));
+
+    /* A file of a batch, as the client announces it */
+    strcpy(bench.file_info.filename, "tree/src/common/protocol.c");
+    bench.file_info.filename_len = (uint16_t)strlen(bench.file_info.filename);
+    bench.file_info.file_size = 40000;
+    bench.file_info.total_chunks = 1;
+    bench.file_info.chunk_size = BENCH_CHUNK_SIZE;
+    bench.file_info.checksum_type = CHECKSUM_MERKLE_SHA256;
+    memset(bench.file_info.file_checksum, 0xA5, FT_SHA256_SIZE);
+    bench.file_info.file_mode = 0644;
+    bench.file_info.flags = FT_FILE_ATTRS;
+    protocol_serialize_file_info(&bench.file_info, (uint8_t*)bench.buffer);
+    printf("    \"serialize_file_info_ns\": %.2f,\n",
+           time_per_iteration(bench_serialize_file_info, &bench, min_ns));
+    printf("    \"deserialize_file_info_ns\": %.2f,\n",
+           time_per_iteration(bench_deserialize_file_info, &bench, min_ns));
+    bench.size = protocol_serialize_file_info_v2(&bench.file_info, (uint8_t*)bench.buffer);
+    printf("    \"file_info_v2_bytes\": %zu,\n", bench.size);
+    printf("    \"serialize_file_info_v2_ns\": %.2f,\n",
+           time_per_iteration(bench_serialize_file_info_v2, &bench, min_ns));
+    printf("    \"deserialize_file_info_v2_ns\": %.2f,\n",
+           time_per_iteration(bench_deserialize_file_info_v2, &bench, min_ns));
+    protocol_serialize_chunk_header(&bench.chunk_header, (uint8_t*)bench.buffer);
+    printf("    \"serialize_chunk_header_ns\": %.2f,\n",
+           time_per_iteration(bench_serialize_chunk_header, &bench, min_ns));
+    printf("    \"deserialize_chunk_header_ns\": %.2f\n",
+           time_per_iteration(bench_deserialize_chunk_header, &bench, min_ns));
+    printf("  },\n");
+}
+
+/* Write a size-byte file the way the server does; returns seconds, or < 0 on failure */
+static double time_write(const char *dir, const char *name, uint64_t size, const WritePolicy *policy,
+                         const uint8_t *data, int *direct_io) {
+    OutputFile out;
+    char temp_path[BENCH_PATH_MAX];
+    char final_path[BENCH_PATH_MAX];
+    FTErrorCode error = FT_SUCCESS;
+    uint64_t start_ns = platform_get_monotonic_ns();
+
+    if (file_output_open(&out, dir, name, size, policy, 0, temp_path, sizeof(temp_path), &error) != 0) {
+        return -1.0;
+    }
+    *direct_io = out.direct_io;
+    for (uint64_t offset = 0; offset < size; offset += BENCH_CHUNK_SIZE) {
+        if (file_output_write(&out, offset, data, BENCH_CHUNK_SIZE, &error) != 0) {
+            file_output_close(&out, 0, NULL);
+            file_delete(temp_path);
+            return -1.0;
+        }
+    }
+    if (file_output_close(&out, 1, &error) != 0 ||
+        file_build_path(dir, name, final_path, sizeof(final_path)) != 0 ||
+        file_finalize_write(temp_path, final_path) != 0) {
+        file_delete(temp_path);
+        return -1.0;
+    }
+    return (double)(platform_get_monotonic_ns() - start_ns) / 1e9;
+}
+
+/* Read path with file_read_chunk(); returns seconds */
+static double time_read(const char *path, uint64_t size, uint8_t *buffer) {
+    FTErrorCode error = FT_SUCCESS;
+    FILE *file = file_open_read(path, &error);
+    uint64_t start_ns = platform_get_monotonic_ns();
+    size_t bytes_read;
+
+    if (file == NULL) {
+        return -1.0;
+    }
+    for (uint64_t offset = 0; offset < size; offset += BENCH_CHUNK_SIZE) {
+        if (file_read_chunk(file, offset, buffer, BENCH_CHUNK_SIZE, &bytes_read, &error) != 0) {
+            fclose(file);
+            return -1.0;
+        }
+        sink += buffer[0];
+    }
+    fclose(file);
+    return (double)(platform_get_monotonic_ns() - start_ns) / 1e9;
+}
+
+/* Mapped read path, touching every page of each chunk; returns seconds */
+static double time_map(const char *path, uint64_t size) {
+    MappedFile map;
+    FTErrorCode error = FT_SUCCESS;
+    uint64_t start_ns = platform_get_monotonic_ns();
+
+    if (file_map_open(&map, path, BENCH_CHUNK_SIZE, &error) != 0) {
+        return -1.0;
+    }
+    for (uint64_t offset = 0; offset < size; offset += BENCH_CHUNK_SIZE) {
+        MapWindow *window;
+        uint8_t *data = file_map_chunk(&map, offset, BENCH_CHUNK_SIZE, &window);
+        if (data == NULL) {
+            file_map_close(&map);
+            return -1.0;
+        }
+        for (size_t i = 0; i < BENCH_CHUNK_SIZE; i += 4096) {
+            sink += data[i];
+        }
+        file_map_release(window);
+    }
+    file_map_close(&map);
+    return (double)(platform_get_monotonic_ns() - start_ns) / 1e9;
+}
+
+/* Print the best MB/s of a file I/O benchmark */
+static void print_rate(const char *name, double best_seconds, uint64_t size, int last) {
+    if (best_seconds > 0.0) {
+        printf("    \"%s_mb_s\": %.1f%s\n", name, (double)size / 1e6 / best_seconds, last ? "" : ",");
+    } else {
+        printf("    \"%s_mb_s\": null%s\n", name, last ? "" : ",");
+    }
+}
+
+/* Keep the shorter of two timings, a failed one (< 0) counting as none */
+static double best_of(double best, double seconds) {
+    if (seconds < 0.0) {
+        return best;
+    }
+    return (best < 0.0 || seconds < best) ? seconds : best;
+}
+
+/* Throughput of the write, read, mapped read and copy paths over one file */
+static void micro_fileio(const char *dir, uint64_t size) {
+    static const char *copy_methods[] = { "shared", "kernel", "buffered" };
+    WritePolicy buffered = { DURABILITY_NONE, 0, 0, 0 };
+    WritePolicy finalize = { DURABILITY_FINALIZE, 0, 0, 0 };
+    WritePolicy direct = { DURABILITY_NONE, 0, 1, 0 };
+    double write_best = -1.0, sync_best = -1.0, direct_best = -1.0;
+    double read_best = -1.0, map_best = -1.0, copy_best = -1.0;
+    char path[BENCH_PATH_MAX];
+    char copy_path[BENCH_PATH_MAX];
+    CopyMethod method = COPY_BUFFERED;
+    int direct_io = 0;
+    int unused;
+    uint8_t *data = file_alloc_buffer(BENCH_CHUNK_SIZE);
+    Rng rng = { 0xD1B54A32D192ED03ULL };
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < BENCH_CHUNK_SIZE; i++) {
+        data[i] = (uint8_t)rng_next(&rng);
+    }
+    size = (size + BENCH_CHUNK_SIZE - 1) / BENCH_CHUNK_SIZE * BENCH_CHUNK_SIZE;
+    file_build_path(dir, "ftbench-io.bin", path, sizeof(path));
+    file_build_path(dir, "ftbench-copy.bin", copy_path, sizeof(copy_path));
+
+    for (int pass = 0; pass < BENCH_FILE_PASSES; pass++) {
+        sync_best = best_of(sync_best, time_write(dir, "ftbench-io.bin", size, &finalize, data, &unused));
+        direct_best = best_of(direct_best, time_write(dir, "ftbench-io.bin", size, &direct, data, &direct_io));
+        write_best = best_of(write_best, time_write(dir, "ftbench-io.bin", size, &buffered, data, &unused));
+        read_best = best_of(read_best, time_read(path, size, data));
+        map_best = best_of(map_best, time_map(path, size));
+
+        uint64_t start_ns = platform_get_monotonic_ns();
+        if (file_copy_range(path, 0, (size_t)size, copy_path, 0, &method, NULL) == 0) {
+            copy_best = best_of(copy_best, (double)(platform_get_monotonic_ns() - start_ns) / 1e9);
+        }
+        file_delete(copy_path);
+    }
+    file_delete(path);
+    file_free_buffer(data);
+
+    printf("  \"fileio\": {\n");
+    printf("    \"bytes\": %llu,\n    \"chunk_size\": %u,\n", (unsigned long long)size, BENCH_CHUNK_SIZE);
+    print_rate("write", write_best, size, 0);
+    print_rate("write_sync", sync_best, size, 0);
+    print_rate("write_direct", direct_best, size, 0);
+    printf("    \"direct_io\": %s,\n", direct_io ? "true" : "false");
+    print_rate("read", read_best, size, 0);
+    print_rate("map_read", map_best, size, 0);
+    print_rate("copy", copy_best, size, 0);
+    printf("    \"copy_method\": \"%s\"\n  }\n", copy_methods[method]);
+}
+
+/* ftbench micro */
+static int cmd_micro(int argc, char *argv[]) {
+    const char *dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    uint64_t size = (uint64_t)BENCH_FILE_MB << 20;
+    uint64_t min_ns = (uint64_t)BENCH_MIN_MS * 1000000;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size = strtoull(argv[++i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            min_ns = strtoull(argv[++i], NULL, 10) * 1000000;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+    if (size == 0) {
+        size = BENCH_CHUNK_SIZE;
+    }
+
+    printf("{\n");
+    micro_crc32(min_ns);
+    micro_fec(min_ns);
+    micro_zero(min_ns);
+    micro_protocol(min_ns);
+    micro_fileio(dir, size);
+    printf("}\n");
+    return 0;
+}
+
+/* Fill buffer with one of the generated kinds of data */
+static void fill(uint8_t *buffer, size_t size, int compressible, Rng *rng) {
+    static const char *words[] = {
+        "chunk ", "window ", "offset ", "transfer ", "server ", "client ", "verify ", "bundle ",
+        "sparse ", "commit ", "stripe ", "resume ", "delta ", "socket ", "ring ", "hash "
+    };
+
+    if (!compressible) {
+        for (size_t i = 0; i + 8 <= size; i += 8) {
+            uint64_t value = rng_next(rng);
+            memcpy(buffer + i, &value, 8);
+        }
+        for (size_t i = size & ~(size_t)7; i < size; i++) {
+            buffer[i] = (uint8_t)rng_next(rng);
+        }
+        return;
+    }
+    /* Text over a 16-word vocabulary with numbers mixed in: about 3:1 with LZ4 */
+    size_t length = 0;
+    while (length < size) {
+        uint64_t value = rng_next(rng);
+        char text[32];
+        int n = (value & 7) == 0 ? snprintf(text, sizeof(text), "%u\n", (unsigned)(value >> 40))
+                                 : snprintf(text, sizeof(text), "%s", words[(value >> 8) & 15]);
+        size_t take = (size_t)n < size - length ? (size_t)n : size - length;
+        memcpy(buffer + length, text, take);
+        length += take;
+    }
+}
+
+/* Write a generated file of size bytes; sparse files hold one extent of
+ * data every BENCH_SPARSE_STRIDE, ending with one so the size is written */
+static int generate_file(const char *path, uint64_t size, const char *kind, uint64_t seed) {
+    int compressible = strcmp(kind, "text") == 0;
+    int sparse = strcmp(kind, "sparse") == 0;
+    uint8_t *buffer = (uint8_t*)malloc(BENCH_CHUNK_SIZE);
+    FILE *file = fopen(path, "wb");
+    Rng rng = { seed * 0x9E3779B97F4A7C15ULL + 1 };
+    int result = 0;
+
+    if (buffer == NULL || file == NULL) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        free(buffer);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return -1;
+    }
+    for (uint64_t offset = 0; offset < size && result == 0; ) {
+        size_t length = (size_t)(size - offset < BENCH_CHUNK_SIZE ? size - offset : BENCH_CHUNK_SIZE);
+        if (sparse) {
+            uint64_t in_stride = offset % BENCH_SPARSE_STRIDE;
+            uint64_t last_extent = size > BENCH_SPARSE_EXTENT ? size - BENCH_SPARSE_EXTENT : 0;
+            if (in_stride >= BENCH_SPARSE_EXTENT && offset < last_extent) {
+                uint64_t next = offset - in_stride + BENCH_SPARSE_STRIDE;
+                offset = next < last_extent ? next : last_extent;
+                if (fseeko(file, (off_t)offset, SEEK_SET) != 0) {
+                    result = -1;
+                }
+                continue;
+            }
+            if (length > BENCH_SPARSE_EXTENT - in_stride && offset < last_extent) {
+                length = (size_t)(BENCH_SPARSE_EXTENT - in_stride);
+            }
+        }
+        fill(buffer, length, compressible, &rng);
+        if (fwrite(buffer, 1, length, file) != length) {
+            result = -1;
+        }
+        offset += length;
+    }
+    if (fclose(file) != 0 || result != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        result = -1;
+    }
+    free(buffer);
+    return result;
+}
+
+/* ftbench gen <random|text|sparse> <path> <size>, or gen tree <dir> <size> <count> */
+static int cmd_gen(int argc, char *argv[]) {
+    uint64_t size;
+
+    if (argc < 3 || parse_size(argv[2], &size) != 0) {
+        fprintf(stderr, "Usage: ftbench gen <random|text|sparse> <path> <size>\n"
+                        "       ftbench gen tree <dir> <size> <count>\n");
+        return 2;
+    }
+    if (strcmp(argv[0], "tree") != 0) {
+        if (strcmp(argv[0], "random") != 0 && strcmp(argv[0], "text") != 0 && strcmp(argv[0], "sparse") != 0) {
+            fprintf(stderr, "Error: Unknown kind '%s'\n", argv[0]);
+            return 2;
+        }
+        return generate_file(argv[1], size, argv[0], 1) == 0 ? 0 : 1;
+    }
+
+    /* A tree of count random files, BENCH_TREE_FANOUT per directory */
+    uint64_t count = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    char path[BENCH_PATH_MAX];
+    if (file_create_directory(argv[1]) != 0) {
+        fprintf(stderr, "Error: Cannot create %s\n", argv[1]);
+        return 1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (i % BENCH_TREE_FANOUT == 0) {
+            snprintf(path, sizeof(path), "%s/d%03llu", argv[1], (unsigned long long)(i / BENCH_TREE_FANOUT));
+            if (file_create_directory(path) != 0) {
+                fprintf(stderr, "Error: Cannot create %s\n", path);
+                return 1;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/d%03llu/f%06llu.bin", argv[1],
+                 (unsigned long long)(i / BENCH_TREE_FANOUT), (unsigned long long)i);
+        if (generate_file(path, size, "random", i + 1) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifndef FT_PLATFORM_WINDOWS
+static volatile sig_atomic_t child_pid;
+
+/* Pass SIGINT and SIGTERM on to the command */
+static void forward_signal(int sig) {
+    if (child_pid > 0) {
+        kill((pid_t)child_pid, sig);
+    }
+}
+
+/* Read and write syscalls the kernel counted for an exited, unreaped
+ * process (/proc/<pid>/io; 0 where unavailable) */
+static void read_io_counts(pid_t pid, unsigned long long *syscr, unsigned long long *syscw) {
+    char path[64];
+    char line[128];
+    FILE *file;
+
+    *syscr = 0;
+    *syscw = 0;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        sscanf(line, "syscr: %llu", syscr);
+        sscanf(line, "syscw: %llu", syscw);
+    }
+    fclose(file);
+}
+
+/* ftbench run -o <file> -- <command...> */
+static int cmd_run(int argc, char *argv[]) {
+    const char *output = NULL;
+    int first = 0;
+
+    while (first < argc && strcmp(argv[first], "--") != 0) {
+        if (strcmp(argv[first], "-o") == 0 && first + 1 < argc) {
+            output = argv[++first];
+        }
+        first++;
+    }
+    if (output == NULL || first + 1 >= argc) {
+        fprintf(stderr, "Usage: ftbench run -o <file> -- <command...>\n");
+        return 2;
+    }
+
+    uint64_t start_ns = platform_get_monotonic_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(argv[first + 1], &argv[first + 1]);
+        perror(argv[first + 1]);
+        _exit(127);
+    }
+    child_pid = pid;
+    signal(SIGINT, forward_signal);
+    signal(SIGTERM, forward_signal);
+
+    /* Counters are read while the process is a zombie, before it is reaped */
+    siginfo_t info;
+    while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) != 0) {
+    }
+    double wall = (double)(platform_get_monotonic_ns() - start_ns) / 1e9;
+    unsigned long long syscr, syscw;
+    read_io_counts(pid, &syscr, &syscw);
+
+    struct rusage usage;
+    int status = 0;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+    }
+    int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    FILE *file = fopen(output, "w");
+    if (file == NULL) {
+        perror(output);
+        return 1;
+    }
+    fprintf(file, "{\"exit\": %d, \"wall_s\": %.3f, \"user_s\": %.3f, \"sys_s\": %.3f, "
+                  "\"max_rss_kb\": %ld, \"syscr\": %llu, \"syscw\": %llu}\n",
+            exit_code, wall,
+            (double)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+            (double)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+            usage.ru_maxrss, syscr, syscw);
+    fclose(file);
+    return exit_code;
+}
+#endif
+
+/* Print usage */
+static void print_usage(const char *program) {
+    printf("Usage: %s <command> [options]\n\n", program);
+    printf("Commands:\n");
+    printf("  micro [-d <dir>] [-s <MB>] [-t <ms>]  CRC32, header and file I/O microbenchmarks as JSON\n");
+    printf("                                         (file I/O in <dir>, default $TMPDIR; %d MB file;\n", BENCH_FILE_MB);
+    printf("                                         each timing runs at least %d ms)\n", BENCH_MIN_MS);
+    printf("  gen <random|text|sparse> <path> <size> Generate a file (size takes K, M, G)\n");
+    printf("  gen tree <dir> <size> <count>          Generate count random files of size\n");
+    printf("  run -o <file> -- <command...>          Run command, write its CPU time, peak RSS\n");
+    printf("                                         and syscalls as JSON to file\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    logger_init(LOG_WARN, NULL);
+    if (platform_init() != 0) {
+        fprintf(stderr, "Error: Failed to initialize platform\n");
+        return 1;
+    }
+    crc32_init();
+
+    int result;
+    if (strcmp(argv[1], "micro") == 0) {
+        result = cmd_micro(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "gen") == 0) {
+        result = cmd_gen(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "run") == 0) {
+#ifndef FT_PLATFORM_WINDOWS
+        result = cmd_run(argc - 2, argv + 2);
+#else
+        fprintf(stderr, "Error: run is not supported on Windows\n");
+        result = 2;
+#endif
+    } else {
+        print_usage(argv[0]);
+        result = 2;
+    }
+
+    platform_cleanup();
+    logger_close();
+    return result;
+}
@@ -3,27 +3,248 @@
 #include "../common/network.h"
 #include "../common/logger.h"
 #include "../common/fileio.h"
+#include "../common/checksum.h"
+#include "../common/window.h"
+#include "../common/threadpool.h"
+#include "../common/treehash.h"
+#include "../common/prefetch.h"
+#include "../common/compress.h"
+#include "../common/delta.h"
+#include "../common/tuning.h"
+#include "../common/bundle.h"
+#include "../common/metrics.h"
+#include "../common/bufpool.h"
+#include "../common/udpsend.h"
+#include "../common/zeroscan.h"
+#ifdef FT_HAVE_TLS
+#include "../common/tls.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+
+/* Longest an unchanged stretch of a delta upload goes without a frame */
+#define DELTA_FLUSH_MS 1000
+
+/* Deepest directory a -f walk descends into */
+#define WALK_MAX_DEPTH 64
 
 /* Client configuration */
 typedef struct {
     char host[256];
     uint16_t port;
-    char filepath[1024];
+    const char **paths;      /* Files and directories to send (-f, repeatable) */
+    int path_count;
+    uint32_t bundle_max;     /* Files smaller than this are bundled (0 = never) */
+    uint32_t window_size;    /* Most chunks in flight; the path decides how many up to that */
+    int hash_threads;        /* Leaf hash workers (-1 = one per CPU) */
+    int zero_copy;           /* Send payload with sendfile()/TransmitFile */
+    int map_file;            /* Read chunks through a memory mapping instead of copies */
+    uint32_t prefetch_chunks; /* Maximum read-ahead depth (0 = read inline) */
+    BufferPoolConfig pool;   /* Memory budget of chunk buffers */
+    uint32_t streams;        /* Connections to stripe the file across */
+    int retries;             /* Reconnects to resume an interrupted transfer */
+    int delta;               /* Send differences from a copy the server already has */
+    int compress;            /* LZ4 compress chunks that shrink */
+    int sparse;              /* Send holes and zero chunks as hole records */
+    uint8_t priority;        /* FT_PRIORITY_* class declared to the server */
+    int tls;                 /* Encrypt connections with TLS */
+#ifdef FT_HAVE_TLS
+    TlsConfig tls_config;    /* Server verification */
+#endif
+    int jobs;                /* Read paths from standard input, keeping the session between them */
+    int udp;                 /* Send the chunks over UDP if the server agrees */
+    uint32_t fec_k;          /* ...with fec_m parity fragments per fec_k (0 = no FEC) */
+    uint32_t fec_m;
     int verbose;
     char *log_file;
 } ClientConfig;
 
+/* ACK reader thread context */
+typedef struct {
+    Connection *conn;
+    SendWindow *window;
+    uint64_t total_chunks;   /* Chunks carried by this connection */
+    uint64_t start_time;
+    int use_sack;            /* FT_CAP_SACK negotiated */
+    char label[32];          /* Progress line prefix */
+    PathEstimator path;
+    uint32_t chunk_size;
+    uint32_t min_window;     /* The window is sized between this and its capacity */
+    uint32_t peak_window;
+    size_t   send_buffer;    /* SO_SNDBUF, or what autotuning may grow it to */
+} AckReader;
+
+/* Leaf hash task for one window slot */
+typedef struct {
+    SendWindow *window;
+    WindowSlot *slot;
+    TreeHash *tree;
+} HashJob;
+
+/* Leaf hash task for a chunk read ahead of a chunk store lookup */
+typedef struct {
+    TreeHash  *tree;
+    uint64_t   chunk_id;
+    uint8_t   *data;
+    size_t     size;
+    WaitGroup *group;
+} LookupJob;
+
+struct Transfer;
+
+/* One connection of a transfer, carrying chunks [first_chunk, end_chunk) */
+typedef struct {
+    struct Transfer *transfer;
+    Connection *conn;
+    Connection  own_conn;    /* Storage for connections opened by send_file() */
+    int         own_ready;
+    uint16_t    index;
+    uint64_t    first_chunk;
+    uint64_t    end_chunk;
+    uint64_t    sequence_num;
+    uint8_t    *resumed;     /* Bit i: the server already holds chunk first_chunk + i */
+    uint64_t    resumed_chunks;
+    uint64_t    resumed_bytes;
+    int         delta;       /* The server asked for DELTA_DATA against its copy */
+    int         dedup;       /* The server looks chunks up in its chunk store first */
+    int         udp;         /* The server takes the chunks over UDP */
+    UdpSetup    udp_setup;
+    int         sparse;      /* The server takes zero chunks as hole records */
+    uint64_t    hole_bytes;  /* Sent so */
+    uint8_t     zero_leaf[FT_SHA256_DIGEST_SIZE];  /* Leaf of a full-sized zero chunk... */
+    int         zero_leaf_ready;                   /* ...once hashed */
+    uint64_t    stored_chunks; /* Found there (also set in resumed) */
+    uint64_t    stored_bytes;
+    uint64_t    sent_bytes;  /* Bytes acknowledged */
+    ft_thread_t thread;
+    int         result;
+} Stripe;
+
+/* State shared by the stripes of one file */
+typedef struct Transfer {
+    const ClientConfig *config;
+    const char *path;        /* File being sent */
+    FileInfo    file_info;
+    uint8_t     capabilities;
+    TreeHash   *tree;        /* NULL without tree hashing */
+    ThreadPool *hash_pool;   /* Leaf hashing and compression workers */
+    Compressor *compressor;  /* NULL without FT_CAP_COMPRESS */
+    Stripe     *stripes;
+    uint16_t    stripe_count;
+    uint64_t    start_time;
+    TransferMetrics metrics; /* Of every stripe, logged once the file is sent */
+    ft_mutex_t  lock;
+    int         aborted;
+} Transfer;
+
+/* What the first handshake of a connection agreed to */
+typedef struct {
+    uint8_t  capabilities;
+    uint32_t max_chunk_size;
+    uint64_t rtt_us;
+    uint64_t sequence_num;   /* Next of this connection's messages */
+} Link;
+
+/* Connection to the server. With -j it stays open between jobs where the
+ * server agrees (FT_FLAG_SESSION), and a keepalive thread sends KEEPALIVE
+ * over it while it is idle; the thread and the jobs take turns under
+ * lock. */
+typedef struct {
+    const ClientConfig *config;
+    socket_t    sock;
+    Connection  conn;
+    int         open;
+    int         persistent;    /* Agreed in the handshake */
+    Link        link;
+    uint64_t    sent_units;    /* Committed over this connection, for TRANSFER_COMPLETE */
+    uint64_t    sent_bytes;
+    ft_thread_t keeper;
+    int         keeper_running;
+    int         idle;          /* Between jobs: the keepalive thread owns the connection */
+    int         stopping;
+    uint64_t    last_sent_ms;  /* When the connection last carried a message */
+    ft_mutex_t  lock;
+    ft_cond_t   wake;
+} Session;
+
+/* One file of a batch */
+typedef struct {
+    char    *path;           /* Where it is read from */
+    char    *name;           /* Relative path it is sent as, '/'-separated */
+    uint64_t size;
+    uint32_t mode;
+    uint64_t timestamp;
+    int      attrs;          /* Found by a directory walk: keep mode and timestamp */
+} BatchFile;
+
+/* Files sent together as one file (a bundle) or a file on its own */
+typedef struct {
+    size_t   first;          /* Batch.files[first, first + count) */
+    uint32_t count;
+    int      bundle;
+} SendUnit;
+
+/* Everything to send, and how far the connections so far got */
+typedef struct {
+    BatchFile *files;
+    size_t     file_count;
+    size_t     file_capacity;
+    uint64_t   total_bytes;
+    SendUnit  *units;        /* Planned once the server's capabilities are known */
+    size_t     unit_count;
+    size_t     next_unit;    /* First unit not yet committed */
+    uint32_t   chunk_size;   /* Of the unit being sent, kept by its retries */
+    char       bundle_path[1024]; /* Bundle built for next_unit ("" = none) */
+    char       bundle_name[64];
+    uint64_t   bundle_size;
+} Batch;
+
+/* File being sent: a file of the batch or a bundle of several */
+typedef struct {
+    const char *path;
+    const char *name;
+    uint8_t     flags;       /* FT_FILE_* bits */
+    uint32_t    bundle_entries;
+    uint64_t    file_size;   /* Set by send_file() */
+} SendItem;
+
 /* Parse command-line arguments */
 static int parse_args(int argc, char *argv[], ClientConfig *config) {
     /* Set defaults */
     config->host[0] = '\0';
     config->port = FT_DEFAULT_PORT;
-    config->filepath[0] = '\0';
+    config->paths = (const char**)calloc((size_t)argc, sizeof(*config->paths));
+    config->path_count = 0;
+    config->bundle_max = FT_BUNDLE_FILE_MAX;
+    config->window_size = FT_DEFAULT_MAX_WINDOW;
+    config->hash_threads = -1;
+    config->zero_copy = 1;
+    config->map_file = 0;
+    config->prefetch_chunks = FT_DEFAULT_PREFETCH_CHUNKS;
+    config->pool.budget = (uint64_t)FT_POOL_DEFAULT_MB * 1024 * 1024;
+    config->pool.hugepages = 0;
+    config->streams = 1;
+    config->retries = 5;
+    config->delta = 1;
+    config->compress = 1;
+    config->sparse = 1;
+    config->priority = FT_PRIORITY_NORMAL;
+    config->tls = 0;
+#ifdef FT_HAVE_TLS
+    memset(&config->tls_config, 0, sizeof(config->tls_config));
+#endif
+    config->jobs = 0;
+    config->udp = 0;
+    config->fec_k = 0;
+    config->fec_m = 0;
     config->verbose = 0;
     config->log_file = NULL;
+    if (config->paths == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
@@ -31,19 +252,143 @@ static int parse_args(int argc, char *argv[], ClientConfig *config) {
         } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
             config->port = (uint16_t)atoi(argv[++i]);
         } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
-            strncpy(config->filepath, argv[++i], sizeof(config->filepath) - 1);
+            config->paths[config->path_count++] = argv[++i];
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            int kb = atoi(argv[++i]);
+            if (kb < 0 || kb > FT_BUNDLE_FILE_MAX / 1024) {
+                fprintf(stderr, "Error: Bundle threshold must be between 0 and %d KB\n", FT_BUNDLE_FILE_MAX / 1024);
+                return -1;
+            }
+            config->bundle_max = (uint32_t)kb * 1024;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            int window = atoi(argv[++i]);
+            if (window < 1 || window > FT_MAX_WINDOW_SIZE) {
+                fprintf(stderr, "Error: Window size must be between 1 and %d\n", FT_MAX_WINDOW_SIZE);
+                return -1;
+            }
+            config->window_size = (uint32_t)window;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            config->hash_threads = atoi(argv[++i]);
+            if (config->hash_threads < 0) {
+                fprintf(stderr, "Error: Hash thread count must not be negative\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            int chunks = atoi(argv[++i]);
+            if (chunks < 0 || chunks > FT_MAX_WINDOW_SIZE) {
+                fprintf(stderr, "Error: Read-ahead must be between 0 and %d chunks\n", FT_MAX_WINDOW_SIZE);
+                return -1;
+            }
+            config->prefetch_chunks = (uint32_t)chunks;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            if (mb < FT_POOL_MIN_MB) {
+                fprintf(stderr, "Error: Buffer memory must be at least %d MB\n", FT_POOL_MIN_MB);
+                return -1;
+            }
+            config->pool.budget = (uint64_t)mb * 1024 * 1024;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            config->pool.hugepages = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            int streams = atoi(argv[++i]);
+            if (streams < 1 || streams > FT_MAX_STREAMS) {
+                fprintf(stderr, "Error: Stream count must be between 1 and %d\n", FT_MAX_STREAMS);
+                return -1;
+            }
+            config->streams = (uint32_t)streams;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            config->retries = atoi(argv[++i]);
+            if (config->retries < 0) {
+                fprintf(stderr, "Error: Retry count must not be negative\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            config->zero_copy = 0;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            config->map_file = 1;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            config->delta = 0;
+        } else if (strcmp(argv[i], "-Z") == 0) {
+            config->compress = 0;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            config->sparse = 0;
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            const char *priority = argv[++i];
+            if (strcmp(priority, "bulk") == 0) {
+                config->priority = FT_PRIORITY_BULK;
+            } else if (strcmp(priority, "normal") == 0) {
+                config->priority = FT_PRIORITY_NORMAL;
+            } else if (strcmp(priority, "interactive") == 0) {
+                config->priority = FT_PRIORITY_INTERACTIVE;
+            } else {
+                fprintf(stderr, "Error: Priority must be bulk, normal or interactive\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "-I") == 0 ||
+                   (strcmp(argv[i], "-A") == 0 && i + 1 < argc)) {
+#ifdef FT_HAVE_TLS
+            config->tls = 1;
+            if (strcmp(argv[i], "-I") == 0) {
+                config->tls_config.insecure = 1;
+            } else if (strcmp(argv[i], "-A") == 0) {
+                config->tls_config.ca_file = argv[++i];
+            }
+#else
+            fprintf(stderr, "Error: Built without TLS support (make TLS=1)\n");
+            return -1;
+#endif
+        } else if (strcmp(argv[i], "-j") == 0) {
+            config->jobs = 1;
+        } else if (strcmp(argv[i], "-U") == 0) {
+            config->udp = 1;
+        } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+            unsigned int k, m;
+            if (sscanf(argv[++i], "%u:%u", &k, &m) != 2 || k < 1 || k > FT_FEC_MAX_DATA ||
+                m < 1 || m > FT_FEC_MAX_PARITY) {
+                fprintf(stderr, "Error: FEC must be <data>:<parity> fragments, 1-%d:1-%d\n",
+                        FT_FEC_MAX_DATA, FT_FEC_MAX_PARITY);
+                return -1;
+            }
+            config->fec_k = k;
+            config->fec_m = m;
         } else if (strcmp(argv[i], "-v") == 0) {
             config->verbose = 1;
         } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
             config->log_file = argv[++i];
         } else if (strcmp(argv[i], "--help") == 0) {
             printf("File Transfer Client\n");
-            printf("Usage: %s -h <host> -f <file> [options]\n", argv[0]);
+            printf("Usage: %s -h <host> -f <file> [-f <file>...] [options]\n", argv[0]);
+            printf("       %s -h <host> -j [options] < paths\n", argv[0]);
             printf("\nRequired:\n");
             printf("  -h <host>      Server hostname or IP address\n");
-            printf("  -f <file>      File to transfer\n");
+            printf("  -f <path>      File or directory to transfer; repeat for more\n");
+            printf("  -j             Or send each path read from standard input over one kept-open session,\n"
+                   "                 printing \"OK <path>\" or \"FAIL <path>\" as each finishes\n");
             printf("\nOptions:\n");
             printf("  -p <port>      Server port (default: %d)\n", FT_DEFAULT_PORT);
+            printf("  -w <chunks>    Most unacknowledged chunks in flight (default: %d)\n", FT_DEFAULT_MAX_WINDOW);
+            printf("  -t <threads>   Hash and compression worker threads, 0 = run inline (default: CPU count)\n");
+            printf("  -k <chunks>    Maximum read-ahead depth, 0 = read inline (default: %d)\n", FT_DEFAULT_PREFETCH_CHUNKS);
+            printf("  -b <MB>        Memory for chunk buffers of all streams (default: %d)\n", FT_POOL_DEFAULT_MB);
+            printf("  -H             Back chunk buffers with huge pages\n");
+            printf("  -c <streams>   Parallel connections to stripe the file across (default: 1)\n");
+            printf("  -r <attempts>  Reconnects to resume an interrupted transfer (default: 5)\n");
+            printf("  -n             Copy chunks through user space instead of sendfile()\n");
+            printf("  -m             Read the file through a memory mapping instead of read-ahead copies\n");
+            printf("  -F             Send the whole file even if the server has an older copy\n");
+            printf("  -Z             Do not compress chunks\n");
+            printf("  -S             Send holes and zero-filled chunks as data, not keeping the file sparse\n");
+            printf("  -q <class>     Priority for the server's bandwidth shares: bulk, normal or interactive\n"
+                   "                 (default: normal)\n");
+#ifdef FT_HAVE_TLS
+            printf("  -T             Encrypt with TLS, verifying the server against the system CAs\n");
+            printf("  -A <file>      Encrypt with TLS, verifying the server against these CAs (PEM)\n");
+            printf("  -I             Encrypt with TLS without verifying the server\n");
+#endif
+            printf("  -U             Send chunks over UDP with rate-based congestion control (not with TLS)\n");
+            printf("  -E <k>:<m>     With -U, add m Reed-Solomon parity fragments to every k\n");
+            printf("  -B <KB>        Bundle files smaller than this into shared chunks, 0 = never (default: %d)\n",
+                   FT_BUNDLE_FILE_MAX / 1024);
             printf("  -v             Verbose logging\n");
             printf("  -l <file>      Log to file\n");
             printf("  --help         Show this help message\n");
@@ -55,269 +400,2125 @@ static int parse_args(int argc, char *argv[], ClientConfig *config) {
     }
 
     /* Validate required arguments */
-    if (config->host[0] == '\0' || config->filepath[0] == '\0') {
+    if (config->host[0] == '\0' || (config->path_count == 0 && !config->jobs)) {
         fprintf(stderr, "Error: Host (-h) and file (-f) are required\n");
         fprintf(stderr, "Use --help for usage information\n");
         return -1;
     }
+    if (config->jobs && config->path_count > 0) {
+        fprintf(stderr, "Error: Paths come from -f or from standard input (-j), not both\n");
+        return -1;
+    }
+    if (config->fec_k > 0 && !config->udp) {
+        fprintf(stderr, "Error: FEC (-E) needs the UDP data path (-U)\n");
+        return -1;
+    }
+    if (config->udp && config->tls) {
+        fprintf(stderr, "Error: The UDP data path (-U) is not encrypted, so not with TLS\n");
+        return -1;
+    }
 
     return 0;
 }
 
-/* Send file to server */
-static int send_file(socket_t server_sock, const char *filepath) {
+/* Size the window and the socket send buffer to the path's BDP */
+static void tune_path(AckReader *reader) {
+    SendWindow *window = reader->window;
+    uint64_t bdp = path_estimator_bdp(&reader->path);
+
+    /* Only this thread changes the limit once the window is running */
+    uint32_t limit = path_estimator_window(&reader->path, reader->chunk_size, reader->min_window,
+                                           window->capacity);
+    if (limit != window->limit) {
+        LOG_DEBUG("%s: window %u chunks (RTT %.2f ms, %.2f MB/s, BDP %llu bytes)", reader->label, limit,
+                  reader->path.min_rtt_us / 1000.0, path_estimator_bandwidth(&reader->path) / 1e6,
+                  (unsigned long long)bdp);
+        send_window_set_limit(window, limit);
+        if (limit > reader->peak_window) {
+            reader->peak_window = limit;
+        }
+    }
+
+    /* Setting the buffer stops the kernel from growing it, so only a BDP
+     * out of reach of autotuning takes over */
+    if (2 * bdp > reader->send_buffer) {
+        size_t size;
+        if (socket_set_buffer_size(reader->conn->sock, 1, (size_t)(2 * bdp), NULL) == 0 &&
+            socket_get_buffer_size(reader->conn->sock, 1, &size, NULL) == 0) {
+            LOG_DEBUG("%s: send buffer %zu bytes", reader->label, size);
+            reader->send_buffer = size > (size_t)(2 * bdp) ? size : (size_t)(2 * bdp);
+        }
+    }
+}
+
+/* Receive chunk ACKs and release window slots */
+static void ack_reader_thread(void *arg) {
+    AckReader *reader = (AckReader*)arg;
+    SendWindow *window = reader->window;
+    uint64_t progress_step = (reader->total_chunks / 20) + 1;
+    if (progress_step > 100) {
+        progress_step = 100;
+    }
     FTErrorCode error;
-    FILE *file = NULL;
-    uint8_t *chunk_buffer = NULL;
-    uint64_t sequence_num = 2;
-    int result = -1;
 
-    /* Get file metadata */
-    FileMetadata metadata;
-    if (file_get_metadata(filepath, &metadata, &error) != 0) {
-        LOG_ERROR("Failed to get file metadata: %s", protocol_get_error_string(error));
-        return -1;
+    /* acked_chunks is only modified by this thread, so unlocked reads are safe */
+    while (window->acked_chunks < reader->total_chunks) {
+        uint64_t acked_before = window->acked_chunks;
+        int ack_result;
+
+        if (reader->use_sack) {
+            ChunkSack sack;
+            if (recv_chunk_sack(reader->conn, &sack, &error) != 0) {
+                LOG_ERROR("Failed to receive chunk SACK: %s", protocol_get_error_string(error));
+                send_window_fail(window, error);
+                return;
+            }
+            ack_result = send_window_sack(window, &sack);
+        } else {
+            ChunkAck ack;
+            if (recv_chunk_ack(reader->conn, &ack, &error) != 0) {
+                LOG_ERROR("Failed to receive chunk ACK: %s", protocol_get_error_string(error));
+                send_window_fail(window, error);
+                return;
+            }
+            ack_result = send_window_ack(window, ack.chunk_id, ack.status);
+        }
+        if (ack_result != 0) {
+            return;
+        }
+
+        path_estimator_rtt(&reader->path, window->rtt_us);
+        if (path_estimator_update(&reader->path, window->acked_bytes, platform_get_monotonic_us())) {
+            tune_path(reader);
+        }
+
+        /* Display progress every 5% or every 100 chunks */
+        uint64_t acked_chunks = window->acked_chunks;
+        if (acked_chunks / progress_step != acked_before / progress_step) {
+            uint64_t elapsed_ms = platform_get_monotonic_ms() - reader->start_time;
+            double progress = (double)acked_chunks / reader->total_chunks * 100.0;
+            double speed_mbps = 0.0;
+
+            if (elapsed_ms > 0) {
+                speed_mbps = (double)window->acked_bytes / elapsed_ms / 1000.0;  /* MB/s */
+            }
+
+            LOG_INFO("%s: %.1f%% (%llu/%llu chunks) - %.2f MB/s",
+                     reader->label, progress, (unsigned long long)acked_chunks,
+                     (unsigned long long)reader->total_chunks, speed_mbps);
+        }
     }
+}
 
-    LOG_INFO("File: %s, Size: %llu bytes", metadata.filename, (unsigned long long)metadata.file_size);
+/* Hash one chunk into its tree leaf, then release the slot */
+static void hash_job_run(void *arg) {
+    HashJob *job = (HashJob*)arg;
+    treehash_set_leaf(job->tree, job->slot->chunk_id, job->slot->payload, job->slot->data_size);
+    send_window_release(job->window, job->slot);
+}
 
-    /* Open file */
-    file = file_open_read(filepath, &error);
-    if (file == NULL) {
-        LOG_ERROR("Failed to open file: %s", protocol_get_error_string(error));
+/* Send TRANSFER_COMPLETE and verify the tree root; on mismatch, send the
+ * leaves so the server can name the bad chunks */
+static int verify_transfer(Connection *conn, const FileInfo *file_info, const TreeHash *tree,
+                           uint64_t sent_bytes, uint64_t *sequence_num) {
+    FTErrorCode error;
+    char root_hex[FT_SHA256_DIGEST_SIZE * 2 + 1];
+
+    TransferComplete complete;
+    complete.total_chunks = file_info->total_chunks;
+    complete.total_bytes = sent_bytes;
+    if (send_transfer_complete(conn, &complete, (*sequence_num)++, &error) != 0) {
+        LOG_ERROR("Failed to send TRANSFER_COMPLETE: %s", protocol_get_error_string(error));
         return -1;
     }
 
-    /* Prepare file info */
-    FileInfo file_info;
-    memset(&file_info, 0, sizeof(file_info));
-    file_info.filename_len = (uint16_t)strlen(metadata.filename);
-    strncpy(file_info.filename, metadata.filename, FT_MAX_FILENAME_LEN - 1);
-    file_info.file_size = metadata.file_size;
-    file_info.chunk_size = FT_DEFAULT_CHUNK_SIZE;
-    file_info.total_chunks = (metadata.file_size + file_info.chunk_size - 1) / file_info.chunk_size;
-    file_info.checksum_type = CHECKSUM_SHA256;
-    memset(file_info.file_checksum, 0, FT_SHA256_SIZE);  /* TODO: Compute SHA-256 */
-    file_info.file_mode = metadata.file_mode;
-    file_info.timestamp = metadata.timestamp;
-
-    LOG_INFO("Total chunks: %llu (chunk size: %u bytes)",
-             (unsigned long long)file_info.total_chunks, file_info.chunk_size);
+    VerifyRequest request;
+    memset(&request, 0, sizeof(request));
+    request.checksum_type = CHECKSUM_MERKLE_SHA256;
+    request.mode = VERIFY_MODE_ROOT;
+    request.digest_count = 1;
+    if (send_verify_request(conn, &request, file_info->file_checksum, (*sequence_num)++, &error) != 0) {
+        LOG_ERROR("Failed to send VERIFY_REQUEST: %s", protocol_get_error_string(error));
+        return -1;
+    }
 
-    /* Perform handshake */
-    LOG_INFO("Performing handshake...");
-    if (perform_handshake_client(server_sock, &error) != 0) {
-        LOG_ERROR("Handshake failed: %s", protocol_get_error_string(error));
-        goto cleanup;
+    VerifyResponse response;
+    if (recv_verify_response(conn, &response, &error) != 0) {
+        LOG_ERROR("Failed to receive VERIFY_RESPONSE: %s", protocol_get_error_string(error));
+        return -1;
     }
 
-    /* Send file info */
-    LOG_INFO("Sending file info...");
-    if (send_file_info(server_sock, &file_info, sequence_num++, &error) != 0) {
-        LOG_ERROR("Failed to send file info: %s", protocol_get_error_string(error));
-        goto cleanup;
+    sha256_to_hex(file_info->file_checksum, root_hex);
+    if (response.checksum_match) {
+        LOG_INFO("Checksum verified (tree root %s)", root_hex);
+        return 0;
+    }
+    /* Error codes are negative, sent as their low byte */
+    FTErrorCode reason = (FTErrorCode)(int8_t)response.error_code;
+    if (reason != FT_ERR_CHECKSUM) {
+        /* The file matched but the server failed to sync or rename it */
+        LOG_ERROR("Server failed to commit the file: %s", protocol_get_error_string(reason));
+        return -1;
     }
 
-    /* Receive file ACK */
-    MessageHeader header;
-    uint8_t ack_buf[16];
-    if (recv_message(server_sock, &header, ack_buf, sizeof(ack_buf), &error) != 0) {
-        LOG_ERROR("Failed to receive file ACK: %s", protocol_get_error_string(error));
-        goto cleanup;
+    LOG_ERROR("Checksum mismatch (local tree root %s), comparing chunk hashes...", root_hex);
+    request.mode = VERIFY_MODE_LEAVES;
+    for (uint64_t first = 0; first < tree->num_leaves; first += request.digest_count) {
+        uint64_t remaining = tree->num_leaves - first;
+        request.first_leaf = first;
+        request.digest_count = (uint32_t)(remaining < FT_VERIFY_MAX_DIGESTS ? remaining : FT_VERIFY_MAX_DIGESTS);
+        if (send_verify_request(conn, &request, tree->leaves[first], (*sequence_num)++, &error) != 0) {
+            LOG_ERROR("Failed to send chunk hashes: %s", protocol_get_error_string(error));
+            return -1;
+        }
     }
 
-    if (header.msg_type == MSG_ERROR) {
-        ErrorMessage err_msg;
-        /* Parse error message from ack_buf */
-        err_msg.error_code = ack_buf[0];
-        LOG_ERROR("Server rejected file: %s", protocol_get_error_string((FTErrorCode)err_msg.error_code));
-        goto cleanup;
+    if (recv_verify_response(conn, &response, &error) != 0) {
+        LOG_ERROR("Failed to receive VERIFY_RESPONSE: %s", protocol_get_error_string(error));
+        return -1;
     }
 
-    if (header.msg_type != MSG_FILE_ACK) {
-        LOG_ERROR("Expected FILE_ACK, got message type %d", header.msg_type);
-        goto cleanup;
+    LOG_ERROR("%llu chunk(s) differ on the server", (unsigned long long)response.bad_count);
+    for (uint16_t i = 0; i < response.bad_listed; i++) {
+        LOG_ERROR("  Chunk %llu (offset %llu)", (unsigned long long)response.bad_chunks[i],
+                  (unsigned long long)(response.bad_chunks[i] * file_info->chunk_size));
     }
+    return -1;
+}
 
-    /* Allocate chunk buffer */
-    chunk_buffer = (uint8_t*)malloc(file_info.chunk_size);
-    if (chunk_buffer == NULL) {
-        LOG_ERROR("Failed to allocate chunk buffer");
-        goto cleanup;
+/* Create a socket and connect it to the server */
+static socket_t open_connection(const ClientConfig *config, FTErrorCode *error) {
+    socket_t sock = socket_create(error);
+    if (sock == INVALID_SOCKET_VALUE) {
+        LOG_ERROR("Failed to create socket: %s", protocol_get_error_string(*error));
+        return INVALID_SOCKET_VALUE;
     }
 
-    /* Send chunks */
-    LOG_INFO("Sending file...");
-    uint64_t sent_chunks = 0;
-    uint64_t sent_bytes = 0;
-    uint64_t start_time = platform_get_monotonic_ms();
+    /* Set socket options; with a Fast Open cookie from an earlier
+     * connection the handshake request rides in the SYN */
+    socket_set_timeout(sock, FT_TIMEOUT_SECONDS, NULL);
+    socket_set_nodelay(sock, 1, NULL);
+    socket_set_fastopen(sock, 0, NULL);
 
-    for (uint64_t chunk_id = 0; chunk_id < file_info.total_chunks; chunk_id++) {
-        uint64_t chunk_offset = chunk_id * file_info.chunk_size;
-        size_t bytes_to_read = file_info.chunk_size;
+    /* Connect to server */
+    LOG_INFO("Connecting to %s:%u...", config->host, config->port);
+    if (socket_connect_with_retry(sock, config->host, config->port, 5, error) != 0) {
+        LOG_ERROR("Failed to connect: %s", protocol_get_error_string(*error));
+        close_socket(sock);
+        return INVALID_SOCKET_VALUE;
+    }
+    return sock;
+}
 
-        /* Last chunk may be smaller */
-        if (chunk_offset + bytes_to_read > file_info.file_size) {
-            bytes_to_read = (size_t)(file_info.file_size - chunk_offset);
-        }
+/* Random-enough ID shared by the stripes of a transfer (splitmix64 of the clocks) */
+static uint64_t new_transfer_id(void) {
+    uint64_t x = platform_get_time_ms() ^ (platform_get_monotonic_us() << 21);
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x != 0 ? x : 1;
+}
 
-        /* Read chunk from file */
-        size_t bytes_read;
-        if (file_read_chunk(file, chunk_offset, chunk_buffer, bytes_to_read, &bytes_read, &error) != 0) {
-            LOG_ERROR("Failed to read chunk %llu: %s",
-                      (unsigned long long)chunk_id, protocol_get_error_string(error));
-            goto cleanup;
+/* Stop every stripe: shutting the sockets down fails their blocked sends
+ * and ACK readers */
+static void transfer_abort(Transfer *transfer) {
+    platform_mutex_lock(&transfer->lock);
+    if (!transfer->aborted) {
+        transfer->aborted = 1;
+        for (uint16_t i = 0; i < transfer->stripe_count; i++) {
+            if (transfer->stripes[i].conn != NULL) {
+                socket_shutdown(transfer->stripes[i].conn->sock);
+            }
         }
+    }
+    platform_mutex_unlock(&transfer->lock);
+}
 
-        /* Send chunk (with retry) */
-        int retry_count = 0;
-        while (retry_count < FT_MAX_RETRIES) {
-            if (send_chunk(server_sock, chunk_id, chunk_offset, chunk_buffer, bytes_read, sequence_num++, &error) != 0) {
-                LOG_ERROR("Failed to send chunk %llu: %s",
-                          (unsigned long long)chunk_id, protocol_get_error_string(error));
-                retry_count++;
-                if (retry_count >= FT_MAX_RETRIES) {
-                    goto cleanup;
-                }
-                LOG_WARN("Retrying chunk %llu (%d/%d)", (unsigned long long)chunk_id, retry_count, FT_MAX_RETRIES);
-                continue;
-            }
+/* Announce a stripe's file info and wait for the server to accept it,
+ * learning which of its chunks the server kept from an earlier attempt */
+static int announce_stripe(Stripe *stripe, FTErrorCode *error) {
+    Transfer *transfer = stripe->transfer;
+    const FileInfo *info = &transfer->file_info;
+    uint64_t range = stripe->end_chunk - stripe->first_chunk;
 
-            /* Receive chunk ACK */
-            ChunkAck ack;
-            if (recv_chunk_ack(server_sock, &ack, &error) != 0) {
-                LOG_ERROR("Failed to receive chunk ACK: %s", protocol_get_error_string(error));
-                retry_count++;
-                if (retry_count >= FT_MAX_RETRIES) {
-                    goto cleanup;
-                }
-                continue;
-            }
+    FileInfo file_info = *info;
+    file_info.stripe_index = stripe->index;
+    if (send_file_info(stripe->conn, &file_info, stripe->sequence_num++, error) != 0) {
+        LOG_ERROR("Failed to send file info: %s", protocol_get_error_string(*error));
+        return -1;
+    }
 
-            if (ack.chunk_id != chunk_id) {
-                LOG_WARN("Received ACK for chunk %llu, expected %llu",
-                         (unsigned long long)ack.chunk_id, (unsigned long long)chunk_id);
-            }
+    /* Receive file ACK */
+    stripe->resumed = (uint8_t*)calloc(1, (size_t)(range / 8 + 1));
+    if (stripe->resumed == NULL) {
+        LOG_ERROR("Out of memory");
+        *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    FileAck file_ack;
+    if (recv_file_ack(stripe->conn, &file_ack, stripe->resumed, range, error) != 0) {
+        LOG_ERROR("Server rejected file: %s", protocol_get_error_string(*error));
+        return -1;
+    }
 
-            if (ack.status != 0) {
-                LOG_WARN("Server requested retransmit of chunk %llu", (unsigned long long)chunk_id);
-                retry_count++;
-                if (retry_count >= FT_MAX_RETRIES) {
-                    LOG_ERROR("Max retries exceeded for chunk %llu", (unsigned long long)chunk_id);
-                    goto cleanup;
-                }
-                continue;
-            }
+    stripe->delta = (file_ack.flags & FT_FILE_ACK_DELTA) != 0;
+    if (stripe->delta && ((transfer->capabilities & FT_CAP_DELTA) == 0 || transfer->stripe_count > 1 ||
+                          info->checksum_type != CHECKSUM_MERKLE_SHA256 || file_ack.resume_chunks > 0)) {
+        LOG_ERROR("Server asked for a delta it cannot take");
+        *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    stripe->dedup = (file_ack.flags & FT_FILE_ACK_DEDUP) != 0;
+    if (stripe->dedup && ((transfer->capabilities & FT_CAP_DEDUP) == 0 || stripe->delta ||
+                          info->checksum_type != CHECKSUM_MERKLE_SHA256)) {
+        LOG_ERROR("Server asked for chunk hashes it cannot take");
+        *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    stripe->udp = (file_ack.flags & FT_FILE_ACK_UDP) != 0;
+    if (stripe->udp && ((info->flags & FT_FILE_UDP) == 0 || stripe->delta)) {
+        LOG_ERROR("Server offered a UDP data path that was not asked for");
+        *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    stripe->sparse = (file_ack.flags & FT_FILE_ACK_SPARSE) != 0;
+    if (stripe->sparse && ((info->flags & FT_FILE_SPARSE) == 0 || stripe->delta)) {
+        LOG_ERROR("Server offered to take holes that were not asked for");
+        *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    if (stripe->udp && recv_udp_setup(stripe->conn, &stripe->udp_setup, error) != 0) {
+        LOG_ERROR("Failed to receive UDP setup: %s", protocol_get_error_string(*error));
+        return -1;
+    }
 
-            /* Chunk sent successfully */
-            break;
+    stripe->resumed_chunks = 0;
+    stripe->resumed_bytes = 0;
+    for (uint64_t i = 0; i < range && file_ack.resume_chunks > 0; i++) {
+        if (stripe->resumed[i / 8] & (1u << (i % 8))) {
+            uint64_t offset = (stripe->first_chunk + i) * info->chunk_size;
+            stripe->resumed_chunks++;
+            stripe->resumed_bytes += info->file_size - offset < info->chunk_size ?
+                                     info->file_size - offset : info->chunk_size;
         }
+    }
+    if (stripe->resumed_chunks > 0) {
+        LOG_INFO("Server already holds %llu of %llu chunks%s, resuming",
+                 (unsigned long long)stripe->resumed_chunks, (unsigned long long)range,
+                 transfer->stripe_count > 1 ? " of this stripe" : "");
+    }
+    return 0;
+}
 
-        sent_chunks++;
-        sent_bytes += bytes_read;
+/* Give a zero chunk its leaf; full-sized ones share one hashed once */
+static void stripe_put_zero_leaf(Stripe *stripe, uint64_t chunk_id, size_t size) {
+    Transfer *transfer = stripe->transfer;
+    uint8_t leaf[FT_SHA256_DIGEST_SIZE];
 
-        /* Display progress every 5% or every 100 chunks */
-        if (sent_chunks % ((file_info.total_chunks / 20) + 1) == 0 || sent_chunks % 100 == 0) {
-            uint64_t elapsed_ms = platform_get_monotonic_ms() - start_time;
-            double progress = (double)sent_chunks / file_info.total_chunks * 100.0;
-            double speed_mbps = 0.0;
+    if (size != transfer->file_info.chunk_size) {
+        treehash_zero_leaf(size, leaf);
+        treehash_put_leaf(transfer->tree, chunk_id, leaf);
+        return;
+    }
+    if (!stripe->zero_leaf_ready) {
+        treehash_zero_leaf(size, stripe->zero_leaf);
+        stripe->zero_leaf_ready = 1;
+    }
+    treehash_put_leaf(transfer->tree, chunk_id, stripe->zero_leaf);
+}
 
-            if (elapsed_ms > 0) {
-                speed_mbps = (double)sent_bytes / elapsed_ms / 1000.0;  /* MB/s */
-            }
+/* Hash one chunk into its tree leaf */
+static void lookup_job_run(void *arg) {
+    LookupJob *job = (LookupJob*)arg;
+    treehash_set_leaf(job->tree, job->chunk_id, job->data, job->size);
+    wait_group_done(job->group);
+}
+
+/* Hash the stripe's chunks and ask the server which of them its chunk
+ * store holds, a batch at a time; those are then skipped like resumed
+ * chunks. Reading runs on this thread while the previous group of chunks
+ * is hashed. Chunks in holes are not read. Afterwards every leaf of the
+ * stripe is known. */
+static int dedup_query(Stripe *stripe, FILE *file) {
+    Transfer *transfer = stripe->transfer;
+    const FileInfo *file_info = &transfer->file_info;
+    uint32_t depth = tune_scale_depth(FT_DEFAULT_WINDOW_SIZE, file_info->chunk_size);
+    uint8_t found[FT_DEDUP_MAX_HASHES / 8];
+    WaitGroup groups[2];
+    FileExtents extents;
+    FTErrorCode error;
+    int result = -1;
 
-            LOG_INFO("Progress: %.1f%% (%llu/%llu chunks) - %.2f MB/s",
-                     progress, (unsigned long long)sent_chunks,
-                     (unsigned long long)file_info.total_chunks, speed_mbps);
+    file_extents_init(&extents, file, file_info->file_size);
+
+    uint8_t **buffers = (uint8_t**)calloc(2 * (size_t)depth, sizeof(uint8_t*));
+    LookupJob *jobs = (LookupJob*)calloc(2 * (size_t)depth, sizeof(LookupJob));
+    wait_group_init(&groups[0]);
+    wait_group_init(&groups[1]);
+    for (uint32_t i = 0; buffers != NULL && i < 2 * depth; i++) {
+        buffers[i] = (uint8_t*)malloc(file_info->chunk_size);
+        if (buffers[i] == NULL) {
+            break;
         }
     }
+    if (buffers == NULL || jobs == NULL || buffers[2 * depth - 1] == NULL) {
+        LOG_ERROR("Out of memory");
+        goto cleanup;
+    }
 
-    /* Calculate transfer statistics */
-    uint64_t elapsed_ms = platform_get_monotonic_ms() - start_time;
-    double elapsed_sec = elapsed_ms / 1000.0;
-    double speed_mbps = (elapsed_sec > 0) ? (double)sent_bytes / elapsed_ms / 1000.0 : 0.0;
+    uint64_t chunk_id = stripe->first_chunk;
+    uint32_t slot = 0;
+    for (uint64_t first = stripe->first_chunk; first < stripe->end_chunk; ) {
+        ChunkHashes hashes;
+        uint64_t remaining = stripe->end_chunk - first;
+        hashes.first_chunk = first;
+        hashes.count = (uint32_t)(remaining < FT_DEDUP_MAX_HASHES ? remaining : FT_DEDUP_MAX_HASHES);
+        hashes.found = 0;
 
-    LOG_INFO("All chunks sent successfully");
-    LOG_INFO("Transfer complete: %llu bytes in %.2f seconds (%.2f MB/s)",
-             (unsigned long long)sent_bytes, elapsed_sec, speed_mbps);
+        /* Each half of the buffers is refilled once its hashes are done */
+        for (; chunk_id < first + hashes.count; chunk_id++, slot = (slot + 1) % (2 * depth)) {
+            WaitGroup *group = &groups[slot / depth];
+            if (slot % depth == 0) {
+                wait_group_wait(group);
+            }
+            uint64_t offset = chunk_id * file_info->chunk_size;
+            size_t size = file_info->file_size - offset < file_info->chunk_size ?
+                          (size_t)(file_info->file_size - offset) : file_info->chunk_size;
+            if (stripe->sparse && file_extents_hole(&extents, offset, size)) {
+                stripe_put_zero_leaf(stripe, chunk_id, size);
+                continue;
+            }
+            size_t bytes_read;
+            if (file_read_chunk(file, offset, buffers[slot], size, &bytes_read, &error) != 0 ||
+                bytes_read != size) {
+                LOG_ERROR("Failed to read chunk %llu", (unsigned long long)chunk_id);
+                goto cleanup;
+            }
+            LookupJob *job = &jobs[slot];
+            job->tree = transfer->tree;
+            job->chunk_id = chunk_id;
+            job->data = buffers[slot];
+            job->size = size;
+            job->group = group;
+            wait_group_add(group, 1);
+            if (threadpool_submit(transfer->hash_pool, lookup_job_run, job) != 0) {
+                wait_group_done(group);
+                LOG_ERROR("Failed to queue chunk hash");
+                goto cleanup;
+            }
+        }
+        wait_group_wait(&groups[0]);
+        wait_group_wait(&groups[1]);
 
-    /* TODO: Send TRANSFER_COMPLETE and verify checksums */
-    LOG_WARN("Checksum verification not yet implemented");
+        if (send_chunk_hashes(stripe->conn, &hashes, transfer->tree->leaves[first],
+                              stripe->sequence_num++, &error) != 0) {
+            LOG_ERROR("Failed to send chunk hashes: %s", protocol_get_error_string(error));
+            goto cleanup;
+        }
+        ChunkHashes have;
+        if (recv_chunk_have(stripe->conn, &have, found, &error) != 0) {
+            LOG_ERROR("Failed to receive CHUNK_HAVE: %s", protocol_get_error_string(error));
+            goto cleanup;
+        }
+        if (have.first_chunk != first || have.count != hashes.count) {
+            LOG_ERROR("CHUNK_HAVE for chunks %llu+%u, expected %llu+%u",
+                      (unsigned long long)have.first_chunk, have.count,
+                      (unsigned long long)first, hashes.count);
+            goto cleanup;
+        }
 
+        for (uint32_t i = 0; i < have.count && have.found > 0; i++) {
+            uint64_t index = first + i - stripe->first_chunk;
+            if ((found[i / 8] & (1u << (i % 8))) == 0 || (stripe->resumed[index / 8] & (1u << (index % 8)))) {
+                continue;
+            }
+            uint64_t offset = (first + i) * file_info->chunk_size;
+            stripe->resumed[index / 8] |= (uint8_t)(1u << (index % 8));
+            stripe->stored_chunks++;
+            stripe->stored_bytes += file_info->file_size - offset < file_info->chunk_size ?
+                                    file_info->file_size - offset : file_info->chunk_size;
+        }
+        first += hashes.count;
+    }
     result = 0;
 
 cleanup:
-    if (file != NULL) {
-        fclose(file);
+    /* Jobs may still be reading the buffers after a failure */
+    wait_group_wait(&groups[0]);
+    wait_group_wait(&groups[1]);
+    wait_group_destroy(&groups[0]);
+    wait_group_destroy(&groups[1]);
+    for (uint32_t i = 0; buffers != NULL && i < 2 * depth; i++) {
+        free(buffers[i]);
     }
-    if (chunk_buffer != NULL) {
-        free(chunk_buffer);
-    }
-
+    free(buffers);
+    free(jobs);
     return result;
 }
 
-int main(int argc, char *argv[]) {
-    ClientConfig config;
-    socket_t server_sock = INVALID_SOCKET_VALUE;
-    int exit_code = 1;
+/* Send one stripe's chunks and wait until all are acknowledged */
+static int send_stripe(Stripe *stripe) {
+    Transfer *transfer = stripe->transfer;
+    const ClientConfig *config = transfer->config;
+    const FileInfo *file_info = &transfer->file_info;
+    Connection *conn = stripe->conn;
+    FTErrorCode error;
+    FILE *file = NULL;
+    Prefetcher prefetcher;
+    int prefetching = 0;
+    SendWindow window;
+    int window_ready = 0;
+    HashJob *hash_jobs = NULL;
+    MappedFile map;
+    int mapped = 0;
+    MapWindow **slot_maps = NULL;  /* Window each slot's payload lies in */
+    ft_thread_t ack_thread;
+    int ack_thread_started = 0;
+    UdpSender udp;
+    int udp_started = 0;
+    FileExtents extents;
+    int result = -1;
 
-    /* Parse arguments */
-    if (parse_args(argc, argv, &config) != 0) {
-        return (argc > 1 && strcmp(argv[argc-1], "--help") == 0) ? 0 : 1;
+    /* sendfile() bypasses TLS encryption done in user space; the UDP
+     * path sends from the slots */
+    int zero_copy = config->zero_copy && connection_raw_send(conn) && !stripe->udp;
+
+    /* Each stripe reads through its own handle (TransmitFile moves the file pointer) */
+    file = file_open_read(transfer->path, &error);
+    if (file == NULL) {
+        LOG_ERROR("Failed to open file: %s", protocol_get_error_string(error));
+        return -1;
     }
+    file_extents_init(&extents, file, file_info->file_size);
 
-    /* Initialize logger */
-    logger_init(config.verbose ? LOG_DEBUG : LOG_INFO, config.log_file);
+    /* The chunk store lookup hashes every chunk, so the send loop need not */
+    if (stripe->dedup) {
+        if (dedup_query(stripe, file) != 0) {
+            goto cleanup;
+        }
+        if (stripe->stored_chunks > 0) {
+            LOG_INFO("Server's chunk store holds %llu of %llu chunks%s (%llu bytes), skipping them",
+                     (unsigned long long)stripe->stored_chunks,
+                     (unsigned long long)(stripe->end_chunk - stripe->first_chunk),
+                     transfer->stripe_count > 1 ? " of this stripe" : "",
+                     (unsigned long long)stripe->stored_bytes);
+        }
+    }
 
-    /* Initialize platform */
-    if (platform_init() != 0) {
-        LOG_ERROR("Failed to initialize platform");
+    /* Allocate send window; it starts small and grows to the path. Over
+     * UDP the pump paces the chunks, so the window is only bounded by the
+     * messages the server reassembles at once, with room for stragglers. */
+    uint32_t capacity = config->window_size;
+    uint32_t limit = FT_DEFAULT_WINDOW_SIZE;
+    if (stripe->udp) {
+        if (capacity > stripe->udp_setup.max_messages / 2) {
+            capacity = stripe->udp_setup.max_messages / 2 > 0 ? stripe->udp_setup.max_messages / 2 : 1;
+        }
+        limit = capacity;
+    }
+    if (send_window_init(&window, capacity, limit, file_info->chunk_size,
+                         transfer->compressor != NULL) != FT_SUCCESS) {
+        LOG_ERROR("Failed to allocate send window");
         goto cleanup;
     }
+    window_ready = 1;
+    window.metrics = &transfer->metrics;
 
-    LOG_INFO("File Transfer Client starting...");
+    /* Without an answer on UDP the chunks still go over TCP */
+    if (stripe->udp) {
+        if (udp_sender_start(&udp, conn->sock, &stripe->udp_setup, &window, file_info->chunk_size,
+                             config->fec_k, config->fec_m, &error) == 0) {
+            udp_started = 1;
+            LOG_INFO("Sending chunks over UDP to port %u%s", stripe->udp_setup.port,
+                     config->fec_k > 0 ? " with FEC" : "");
+        } else {
+            LOG_WARN("UDP data path unavailable, sending chunks over TCP");
+            send_window_set_limit(&window, FT_DEFAULT_WINDOW_SIZE);
+        }
+    }
+    /* The UDP path carries the chunk CRC in its datagrams */
+    int need_crc = zero_copy || udp_started;
 
-    /* Validate file exists */
-    if (!file_exists(config.filepath)) {
-        LOG_ERROR("File not found: %s", config.filepath);
-        goto cleanup;
+    int hash_leaves = transfer->tree != NULL && !stripe->dedup;
+    if (hash_leaves) {
+        hash_jobs = (HashJob*)calloc(config->window_size, sizeof(HashJob));
+        if (hash_jobs == NULL) {
+            LOG_ERROR("Failed to allocate tree hash");
+            goto cleanup;
+        }
     }
 
-    /* Create client socket */
-    FTErrorCode error;
-    server_sock = socket_create(&error);
-    if (server_sock == INVALID_SOCKET_VALUE) {
-        LOG_ERROR("Failed to create socket: %s", protocol_get_error_string(error));
-        goto cleanup;
+    /* Chunks are checksummed, hashed, compressed and sent straight from
+     * the mapping, which the OS reads ahead of */
+    if (config->map_file && stripe->end_chunk > stripe->first_chunk) {
+        slot_maps = (MapWindow**)calloc(config->window_size, sizeof(MapWindow*));
+        if (slot_maps != NULL && file_map_open(&map, transfer->path, file_info->chunk_size, &error) == 0) {
+            mapped = 1;
+            LOG_DEBUG("Reading %s through a mapping", transfer->path);
+        } else {
+            LOG_WARN("Cannot map %s, reading it instead", transfer->path);
+        }
     }
 
-    /* Set socket options */
-    socket_set_timeout(server_sock, FT_TIMEOUT_SECONDS, NULL);
-    socket_set_nodelay(server_sock, 1, NULL);
+    /* Otherwise read ahead of the send cursor on a separate thread, which
+     * also hands the chunks to the workers for compression */
+    if (!mapped && config->prefetch_chunks > 0 && stripe->end_chunk > stripe->first_chunk) {
+        PrefetchCompress compress = { transfer->compressor, transfer->hash_pool, stripe->resumed };
+        if (prefetch_start(&prefetcher, transfer->path, file_info->file_size, file_info->chunk_size,
+                           stripe->first_chunk, stripe->end_chunk,
+                           tune_scale_depth(config->prefetch_chunks, file_info->chunk_size), stripe->sparse,
+                           &compress, &transfer->metrics, &error) != 0) {
+            LOG_ERROR("Failed to start read-ahead: %s", protocol_get_error_string(error));
+            goto cleanup;
+        }
+        prefetching = 1;
+    }
 
-    /* Connect to server */
-    LOG_INFO("Connecting to %s:%u...", config.host, config.port);
-    if (socket_connect_with_retry(server_sock, config.host, config.port, 5, &error) != 0) {
-        LOG_ERROR("Failed to connect: %s", protocol_get_error_string(error));
+    /* Start ACK reader */
+    AckReader reader;
+    reader.conn = conn;
+    reader.window = &window;
+    reader.total_chunks = stripe->end_chunk - stripe->first_chunk - stripe->resumed_chunks -
+                          stripe->stored_chunks;
+    reader.start_time = transfer->start_time;
+    reader.use_sack = (transfer->capabilities & FT_CAP_SACK) != 0;
+    if (transfer->stripe_count > 1) {
+        snprintf(reader.label, sizeof(reader.label), "Stripe %u progress", stripe->index + 1);
+    } else {
+        snprintf(reader.label, sizeof(reader.label), "Progress");
+    }
+    path_estimator_init(&reader.path);
+    reader.chunk_size = file_info->chunk_size;
+    reader.min_window = udp_started ? window.capacity : window.limit;
+    reader.peak_window = window.limit;
+    reader.send_buffer = socket_autotune_limit(1);
+    if (reader.send_buffer == 0) {
+        socket_get_buffer_size(conn->sock, 1, &reader.send_buffer, NULL);
+    }
+    if (platform_thread_create(&ack_thread, ack_reader_thread, &reader) != 0) {
+        LOG_ERROR("Failed to start ACK reader thread");
         goto cleanup;
     }
+    ack_thread_started = 1;
 
-    LOG_INFO("Connected to server");
+    uint64_t next_chunk_id = stripe->first_chunk;
+    for (;;) {
+        WindowSlot *slot = NULL;
+        WindowEvent event = send_window_wait(&window, next_chunk_id, stripe->end_chunk, &slot);
 
-    /* Send file */
-    if (send_file(server_sock, config.filepath) == 0) {
-        LOG_INFO("File transfer completed successfully");
-        exit_code = 0;
-    } else {
-        LOG_ERROR("File transfer failed");
-    }
+        if (event == WINDOW_DRAINED) {
+            break;
+        }
+        if (event == WINDOW_FAILED) {
+            LOG_ERROR("Transfer aborted: %s", protocol_get_error_string(window.error));
+            goto cleanup;
+        }
 
-cleanup:
-    if (server_sock != INVALID_SOCKET_VALUE) {
-        close_socket(server_sock);
-    }
+        if (event == WINDOW_SEND_NEW) {
+            uint64_t chunk_offset = next_chunk_id * file_info->chunk_size;
+            size_t bytes_to_read = file_info->chunk_size;
+
+            /* Last chunk may be smaller */
+            if (chunk_offset + bytes_to_read > file_info->file_size) {
+                bytes_to_read = (size_t)(file_info->file_size - chunk_offset);
+            }
+
+            /* A chunk in a hole is not read; read-ahead finds those itself */
+            int zero = stripe->sparse && !prefetching && file_extents_hole(&extents, chunk_offset, bytes_to_read);
+
+            /* The slot's previous chunk is released, so is its window */
+            const uint8_t *view = NULL;
+            if (mapped) {
+                MapWindow **slot_map = &slot_maps[slot - window.slots];
+                file_map_release(*slot_map);
+                *slot_map = NULL;
+                if (!zero) {
+                    view = file_map_chunk(&map, chunk_offset, bytes_to_read, slot_map);
+                }
+            }
 
+            if (zero) {
+                slot->payload = NULL;
+                slot->data_size = bytes_to_read;
+                slot->data_crc = 0;
+            } else if (view != NULL) {
+                slot->payload = view;
+                slot->data_size = bytes_to_read;
+                zero = stripe->sparse && zero_check(view, bytes_to_read);
+                if (need_crc && !zero) {
+                    uint64_t crc_start = platform_get_monotonic_ns();
+                    slot->data_crc = crc32_compute(view, bytes_to_read);
+                    metrics_record_since(&transfer->metrics, FT_PHASE_CHECKSUM, crc_start);
+                }
+            } else if (prefetching) {
+                /* The read-ahead buffer becomes the slot's; it was read and checksummed already */
+                ChunkHeader chunk_hdr;
+                if (prefetch_next(&prefetcher, &slot->data, &slot->packed, &slot->packed_size,
+                                  &chunk_hdr, &zero, &error) != 0) {
+                    LOG_ERROR("Failed to read chunk %llu: %s",
+                              (unsigned long long)next_chunk_id, protocol_get_error_string(error));
+                    send_window_fail(&window, error);
+                    goto cleanup;
+                }
+                slot->payload = slot->data;
+                slot->data_size = chunk_hdr.chunk_size;
+                slot->data_crc = chunk_hdr.chunk_crc32;
+            } else {
+                /* Read chunk into its window slot */
+                size_t bytes_read;
+                if (send_window_alloc(&window, slot) != 0) {
+                    LOG_ERROR("Transfer aborted: %s", protocol_get_error_string(window.error));
+                    goto cleanup;
+                }
+                uint64_t read_start = platform_get_monotonic_ns();
+                if (file_read_chunk(file, chunk_offset, slot->data, bytes_to_read, &bytes_read, &error) != 0) {
+                    LOG_ERROR("Failed to read chunk %llu: %s",
+                              (unsigned long long)next_chunk_id, protocol_get_error_string(error));
+                    send_window_fail(&window, error);
+                    goto cleanup;
+                }
+                metrics_record_since(&transfer->metrics, FT_PHASE_READ, read_start);
+                slot->payload = slot->data;
+                slot->data_size = bytes_read;
+                zero = stripe->sparse && zero_check(slot->data, bytes_read);
+
+                /* The payload itself goes out from the page cache; this read
+                 * only feeds the CRC and the leaf hash */
+                if (need_crc && !zero) {
+                    uint64_t crc_start = platform_get_monotonic_ns();
+                    slot->data_crc = crc32_compute(slot->data, slot->data_size);
+                    metrics_record_since(&transfer->metrics, FT_PHASE_CHECKSUM, crc_start);
+                }
+            }
+
+            slot->chunk_offset = chunk_offset;
+            slot->zero = zero;
+            if (zero) {
+                slot->packed_size = 0;
+            }
+            uint64_t index = next_chunk_id - stripe->first_chunk;
+            next_chunk_id++;
+
+            if (hash_leaves && zero) {
+                stripe_put_zero_leaf(stripe, slot->chunk_id, slot->data_size);
+            } else if (hash_leaves) {
+                HashJob *job = &hash_jobs[slot - window.slots];
+                job->window = &window;
+                job->slot = slot;
+                job->tree = transfer->tree;
+                send_window_hold(&window, slot);
+                if (threadpool_submit(transfer->hash_pool, hash_job_run, job) != 0) {
+                    send_window_release(&window, slot);
+                    send_window_fail(&window, FT_ERR_OUT_OF_MEMORY);
+                    goto cleanup;
+                }
+            }
+
+            /* A chunk the server holds is still read (for its leaf, unless the
+             * lookup pass hashed it), but not sent */
+            if (stripe->resumed_chunks + stripe->stored_chunks > 0 &&
+                (stripe->resumed[index / 8] & (1u << (index % 8)))) {
+                send_window_skip(&window, slot);
+                continue;
+            }
+
+            /* Without read-ahead the chunk is compressed here */
+            if (transfer->compressor != NULL && !prefetching && !zero) {
+                slot->packed_size = 0;
+                if (send_window_alloc_packed(&window, slot) == 0 && compressor_admit(transfer->compressor)) {
+                    slot->packed_size = compressor_pack(transfer->compressor, slot->payload, slot->data_size,
+                                                        slot->packed);
+                }
+                if (slot->packed_size > 0 && !need_crc) {
+                    uint64_t crc_start = platform_get_monotonic_ns();
+                    slot->data_crc = crc32_compute(slot->payload, slot->data_size);
+                    metrics_record_since(&transfer->metrics, FT_PHASE_CHECKSUM, crc_start);
+                }
+            }
+        } else if (udp_started && udp_sender_pending(&udp, slot)) {
+            /* Still being sent: the copy in flight stands */
+            send_window_mark_sent(&window, slot, slot->sent_seq);
+            continue;
+        } else {
+            LOG_DEBUG("Retransmitting chunk %llu", (unsigned long long)slot->chunk_id);
+        }
+
+        /* Holes are only a header, so they always go over TCP */
+        int over_udp = udp_started && !slot->zero;
+        if (over_udp) {
+            /* The message holds the slot until its last fragment is received */
+            send_window_hold(&window, slot);
+        }
+        send_window_mark_sent(&window, slot, stripe->sequence_num);
+        uint64_t send_start = platform_get_monotonic_ns();
+        int send_result;
+        if (slot->zero) {
+            send_result = send_chunk_zero(conn, slot->chunk_id, slot->chunk_offset, slot->data_size,
+                                          stripe->sequence_num++, &error);
+        } else if (over_udp) {
+            send_result = udp_sender_submit(&udp, slot, stripe->sequence_num++, &error);
+            if (send_result != 0) {
+                send_window_release(&window, slot);
+            }
+        } else if (slot->packed_size > 0) {
+            send_result = send_chunk_packed(conn, slot->chunk_id, slot->chunk_offset, slot->packed,
+                                            slot->packed_size, slot->data_size, slot->data_crc,
+                                            stripe->sequence_num++, &error);
+        } else if (zero_copy) {
+            send_result = send_chunk_from_file(conn, slot->chunk_id, slot->chunk_offset, file,
+                                               slot->data_size, slot->data_crc,
+                                               stripe->sequence_num++, &error);
+        } else {
+            send_result = send_chunk(conn, slot->chunk_id, slot->chunk_offset, slot->payload,
+                                     slot->data_size, stripe->sequence_num++, &error);
+        }
+        if (send_result != 0) {
+            LOG_ERROR("Failed to send chunk %llu: %s",
+                      (unsigned long long)slot->chunk_id, protocol_get_error_string(error));
+            send_window_fail(&window, error);
+            goto cleanup;
+        }
+        metrics_record_since(&transfer->metrics, FT_PHASE_SEND, send_start);
+        if (slot->zero) {
+            metrics_count(&transfer->metrics, FT_COUNT_HOLE_BYTES, slot->data_size);
+            stripe->hole_bytes += slot->data_size;
+        } else {
+            metrics_count(&transfer->metrics, FT_COUNT_BYTES, slot->packed_size > 0 ? slot->packed_size : slot->data_size);
+        }
+    }
+
+    platform_thread_join(ack_thread);
+    ack_thread_started = 0;
+    stripe->sent_bytes = window.acked_bytes;
+    if (reader.path.min_rtt_us > 0) {
+        LOG_INFO("Path%s: RTT %.2f ms, %.2f MB/s, window up to %u chunks",
+                 transfer->stripe_count > 1 ? " of this stripe" : "", reader.path.min_rtt_us / 1000.0,
+                 path_estimator_bandwidth(&reader.path) / 1e6, reader.peak_window);
+    }
+    result = 0;
+
+cleanup:
+    if (result != 0) {
+        transfer_abort(transfer);
+    }
+    if (ack_thread_started) {
+        /* Unblock the ACK reader; the connection cannot be reused after a failure */
+        socket_shutdown(conn->sock);
+        platform_thread_join(ack_thread);
+    }
+    if (result != 0 && transfer->hash_pool != NULL) {
+        /* Workers may still be reading window slots */
+        threadpool_wait(transfer->hash_pool);
+    }
+    if (prefetching) {
+        prefetch_stop(&prefetcher);
+    }
+    if (udp_started) {
+        udp_sender_stop(&udp);
+    }
+    free(hash_jobs);
+    if (window_ready) {
+        send_window_destroy(&window);
+    }
+    if (mapped) {
+        file_map_close(&map);
+    }
+    free(slot_maps);
+    fclose(file);
+
+    return result;
+}
+
+/* Instructions of a delta upload being packed into DELTA_DATA frames.
+ * Copies of consecutive blocks are merged into one instruction. */
+typedef struct {
+    Stripe   *stripe;
+    uint8_t  *frame;               /* chunk_size bytes of instructions */
+    size_t    used;
+    uint64_t  frame_id;
+    uint64_t  frame_offset;        /* New-file offset the current frame's output starts at */
+    uint64_t  offset;              /* New-file bytes covered by the instructions packed so far */
+    uint64_t  copy_block;          /* Run of copied blocks not packed yet */
+    uint32_t  copy_count;
+    uint64_t  copy_bytes;
+    uint64_t  sent_ms;             /* When the last frame went out */
+    uint64_t  copied_bytes;
+    uint64_t  literal_bytes;
+    uint64_t  frame_bytes;
+} DeltaEncoder;
+
+/* Send the packed instructions as one frame */
+static int delta_send_frame(DeltaEncoder *enc) {
+    Stripe *stripe = enc->stripe;
+    FTErrorCode error;
+
+    if (send_delta_data(stripe->conn, enc->frame_id, enc->frame_offset, enc->frame, enc->used,
+                        stripe->sequence_num++, &error) != 0) {
+        LOG_ERROR("Failed to send delta frame %llu: %s",
+                  (unsigned long long)enc->frame_id, protocol_get_error_string(error));
+        return -1;
+    }
+    enc->frame_id++;
+    enc->frame_bytes += enc->used;
+    enc->frame_offset = enc->offset;
+    enc->used = 0;
+    enc->sent_ms = platform_get_monotonic_ms();
+    return 0;
+}
+
+/* Pack the pending run of copied blocks */
+static int delta_flush_copy(DeltaEncoder *enc) {
+    if (enc->copy_count == 0) {
+        return 0;
+    }
+    if (enc->stripe->transfer->file_info.chunk_size - enc->used < DELTA_COPY_SIZE &&
+        delta_send_frame(enc) != 0) {
+        return -1;
+    }
+    enc->used += delta_put_copy(enc->frame + enc->used, enc->copy_block, enc->copy_count);
+    enc->offset += enc->copy_bytes;
+    enc->copy_count = 0;
+    enc->copy_bytes = 0;
+    return 0;
+}
+
+/* Copy one block of the server's copy */
+static int delta_add_copy(DeltaEncoder *enc, uint64_t block, size_t length) {
+    if (enc->copy_count > 0 && block == enc->copy_block + enc->copy_count && enc->copy_count < UINT32_MAX) {
+        enc->copy_count++;
+    } else {
+        if (delta_flush_copy(enc) != 0) {
+            return -1;
+        }
+        enc->copy_block = block;
+        enc->copy_count = 1;
+    }
+    enc->copy_bytes += length;
+    enc->copied_bytes += length;
+
+    /* An unchanged stretch packs into a single instruction; send what is
+     * known now and then, so the server keeps writing and does not time out */
+    if (platform_get_monotonic_ms() - enc->sent_ms >= DELTA_FLUSH_MS) {
+        if (delta_flush_copy(enc) != 0 || delta_send_frame(enc) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Send new bytes */
+static int delta_add_literal(DeltaEncoder *enc, const uint8_t *data, uint64_t length) {
+    uint32_t capacity = enc->stripe->transfer->file_info.chunk_size;
+
+    if (length > 0 && delta_flush_copy(enc) != 0) {
+        return -1;
+    }
+    enc->literal_bytes += length;
+    while (length > 0) {
+        if (capacity - enc->used <= DELTA_LITERAL_HEADER && delta_send_frame(enc) != 0) {
+            return -1;
+        }
+        size_t room = capacity - enc->used - DELTA_LITERAL_HEADER;
+        uint32_t n = (uint32_t)(length < room ? length : room);
+        enc->used += delta_put_literal(enc->frame + enc->used, data, n);
+        enc->offset += n;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Receive the signatures of every block of the server's copy */
+static int delta_recv_signatures(Stripe *stripe, SignatureIndex *index) {
+    FTErrorCode error;
+    BlockSignatures sigs;
+    uint64_t received = 0;
+    uint8_t *entries = (uint8_t*)malloc(FT_BLOCK_SIGS_PER_MSG * FT_BLOCK_SIG_SIZE);
+
+    if (entries == NULL) {
+        LOG_ERROR("Out of memory");
+        return -1;
+    }
+    do {
+        if (recv_block_signatures(stripe->conn, &sigs, entries, &error) != 0) {
+            LOG_ERROR("Failed to receive block signatures: %s", protocol_get_error_string(error));
+            goto fail;
+        }
+        if (received == 0 &&
+            (sigs.block_size < FT_DELTA_MIN_BLOCK || sigs.block_size > FT_DELTA_MAX_BLOCK ||
+             signature_index_init(index, sigs.block_count, sigs.block_size, sigs.basis_size) != FT_SUCCESS)) {
+            LOG_ERROR("Invalid block signatures (%llu blocks of %u bytes)",
+                      (unsigned long long)sigs.block_count, sigs.block_size);
+            goto fail;
+        }
+        if (sigs.first_block != received || sigs.count == 0 || sigs.count > index->block_count - received ||
+            sigs.block_count != index->block_count || sigs.block_size != index->block_size ||
+            sigs.basis_size != index->basis_size) {
+            LOG_ERROR("Unexpected block signatures at block %llu", (unsigned long long)sigs.first_block);
+            goto fail;
+        }
+        signature_index_add(index, received, entries, sigs.count);
+        received += sigs.count;
+    } while (received < index->block_count);
+
+    free(entries);
+    return 0;
+
+fail:
+    free(entries);
+    return -1;
+}
+
+/* Send the file as differences from the server's copy: slide a block-sized
+ * window over it, sending a copy instruction wherever the window matches
+ * one of the server's blocks and the bytes in between as literals. The
+ * file is read one chunk at a time, hashing each into its leaf. */
+static int send_delta(Stripe *stripe) {
+    Transfer *transfer = stripe->transfer;
+    const FileInfo *file_info = &transfer->file_info;
+    FTErrorCode error;
+    SignatureIndex index;
+    DeltaEncoder enc;
+    uint8_t *buffer = NULL;
+    FILE *file = NULL;
+    int result = -1;
+
+    memset(&index, 0, sizeof(index));
+    memset(&enc, 0, sizeof(enc));
+    enc.stripe = stripe;
+    enc.sent_ms = platform_get_monotonic_ms();
+
+    if (delta_recv_signatures(stripe, &index) != 0) {
+        goto cleanup;
+    }
+    LOG_INFO("Server copy: %llu bytes in %llu blocks of %u bytes",
+             (unsigned long long)index.basis_size, (unsigned long long)index.block_count, index.block_size);
+
+    file = file_open_read(transfer->path, &error);
+    uint32_t chunk_size = file_info->chunk_size;
+    uint32_t block_size = index.block_size;
+    enc.frame = (uint8_t*)malloc(chunk_size);
+    buffer = (uint8_t*)malloc((size_t)chunk_size + block_size);
+    if (file == NULL || enc.frame == NULL || buffer == NULL) {
+        LOG_ERROR("Failed to start delta: %s", file == NULL ? protocol_get_error_string(error) : "out of memory");
+        goto cleanup;
+    }
+
+    /* buffer holds the file from buf_start to buf_end; literal bytes not
+     * sent yet start at lit, the window at pos */
+    uint64_t size = file_info->file_size;
+    uint64_t buf_start = 0;
+    uint64_t buf_end = 0;
+    uint64_t lit = 0;
+    uint64_t pos = 0;
+    uint64_t next_chunk = 0;
+    uint64_t hint = 0;
+    size_t last_length = signature_index_block_length(&index, index.block_count - 1);
+    RollingSum sum;
+    int have_sum = 0;
+
+    while (pos < size) {
+        /* Keep the window and the byte after it in the buffer, reading whole
+         * chunks; what lies before the window is sent first */
+        while (buf_end < size && buf_end <= pos + block_size) {
+            if (delta_add_literal(&enc, buffer + (lit - buf_start), pos - lit) != 0) {
+                goto cleanup;
+            }
+            lit = pos;
+            memmove(buffer, buffer + (pos - buf_start), (size_t)(buf_end - pos));
+            buf_start = pos;
+
+            uint8_t *tail = buffer + (buf_end - buf_start);
+            size_t length = size - buf_end < chunk_size ? (size_t)(size - buf_end) : chunk_size;
+            size_t bytes_read;
+            if (file_read_chunk(file, buf_end, tail, length, &bytes_read, &error) != 0 || bytes_read != length) {
+                LOG_ERROR("Failed to read chunk %llu", (unsigned long long)next_chunk);
+                goto cleanup;
+            }
+            treehash_set_leaf(transfer->tree, next_chunk++, tail, length);
+            buf_end += length;
+        }
+
+        uint8_t *window = buffer + (pos - buf_start);
+        if (size - pos < block_size) {
+            /* Less than a block left: only a short last block of the server's
+             * copy can still match, at the very end */
+            uint64_t at = size - last_length;
+            if (last_length < block_size && at >= pos) {
+                RollingSum tail_sum;
+                const uint8_t *tail = buffer + (at - buf_start);
+                rolling_init(&tail_sum, tail, last_length);
+                int64_t block = signature_index_find(&index, rolling_digest(&tail_sum), tail, last_length,
+                                                     index.block_count - 1);
+                if (block >= 0) {
+                    if (delta_add_literal(&enc, buffer + (lit - buf_start), at - lit) != 0 ||
+                        delta_add_copy(&enc, (uint64_t)block, last_length) != 0) {
+                        goto cleanup;
+                    }
+                    lit = size;
+                }
+            }
+            break;
+        }
+
+        if (!have_sum) {
+            rolling_init(&sum, window, block_size);
+            have_sum = 1;
+        }
+        int64_t block = signature_index_find(&index, rolling_digest(&sum), window, block_size, hint);
+        if (block >= 0) {
+            if (delta_add_literal(&enc, buffer + (lit - buf_start), pos - lit) != 0 ||
+                delta_add_copy(&enc, (uint64_t)block, block_size) != 0) {
+                goto cleanup;
+            }
+            pos += block_size;
+            lit = pos;
+            hint = (uint64_t)block + 1;
+            have_sum = 0;
+            continue;
+        }
+
+        if (pos + block_size < size) {
+            rolling_rotate(&sum, window[0], window[block_size]);
+        }
+        pos++;
+    }
+
+    /* The rest, then an empty frame to end the delta */
+    if (delta_add_literal(&enc, buffer + (lit - buf_start), size - lit) != 0 || delta_flush_copy(&enc) != 0 ||
+        (enc.used > 0 && delta_send_frame(&enc) != 0) || delta_send_frame(&enc) != 0) {
+        goto cleanup;
+    }
+
+    LOG_INFO("Delta: %llu bytes matched the server's copy, %llu bytes sent as literals (%llu bytes in %llu frames)",
+             (unsigned long long)enc.copied_bytes, (unsigned long long)enc.literal_bytes,
+             (unsigned long long)enc.frame_bytes, (unsigned long long)enc.frame_id - 1);
+    stripe->sent_bytes = size;
+    result = 0;
+
+cleanup:
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(buffer);
+    free(enc.frame);
+    signature_index_free(&index);
+    return result;
+}
+
+/* Stripe sender thread */
+static void stripe_thread(void *arg) {
+    Stripe *stripe = (Stripe*)arg;
+    stripe->result = send_stripe(stripe);
+}
+
+/* Send one file over conn, whose handshake agreed to link, plus the extra
+ * connections of a striped transfer. *retry is set if reconnecting may
+ * pick up where this attempt stopped: the server was busy with the file,
+ * or chunks were lost in flight after it agreed to keep them. The chunk
+ * size is picked on the first attempt (*chunk_size 0) and kept by the
+ * retries, since the chunks the server kept are only of use at that size. */
+static int send_file(Connection *conn, const ClientConfig *config, Link *link, SendItem *item,
+                     uint32_t *chunk_size, int *retry) {
+    FTErrorCode error;
+    Transfer transfer;
+    ThreadPool hash_pool;
+    int hash_pool_ready = 0;
+    Compressor compressor;
+    int compressor_ready = 0;
+    TreeHash tree = {0};
+    uint16_t threads_started = 0;
+    int result = -1;
+
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.config = config;
+    transfer.path = item->path;
+    transfer.capabilities = link->capabilities;
+    platform_mutex_init(&transfer.lock);
+    *retry = 0;
+
+    /* Get file metadata */
+    FileMetadata metadata;
+    if (file_get_metadata(item->path, &metadata, &error) != 0) {
+        LOG_ERROR("Failed to get file metadata: %s", protocol_get_error_string(error));
+        platform_mutex_destroy(&transfer.lock);
+        return -1;
+    }
+
+    if (item->flags & FT_FILE_BUNDLE) {
+        LOG_INFO("Bundle: %s, %u files, Size: %llu bytes", item->name, item->bundle_entries,
+                 (unsigned long long)metadata.file_size);
+    } else {
+        LOG_INFO("File: %s, Size: %llu bytes", item->name, (unsigned long long)metadata.file_size);
+    }
+
+    /* Prepare file info */
+    FileInfo *file_info = &transfer.file_info;
+    file_info->filename_len = (uint16_t)strlen(item->name);
+    strncpy(file_info->filename, item->name, FT_MAX_PATH_LEN - 1);
+    file_info->file_size = metadata.file_size;
+    item->file_size = metadata.file_size;
+    file_info->file_mode = metadata.file_mode;
+    file_info->timestamp = metadata.timestamp;
+    file_info->flags = item->flags;
+    file_info->bundle_entries = item->bundle_entries;
+    if (config->udp && (link->capabilities & FT_CAP_BATCH)) {
+        file_info->flags |= FT_FILE_UDP;
+    }
+    if (config->sparse && (link->capabilities & FT_CAP_BATCH)) {
+        file_info->flags |= FT_FILE_SPARSE;
+    }
+
+    /* Chunks are sized to the file and the path's round trip, up to what
+     * the server takes */
+    uint64_t rtt_us = link->rtt_us;
+    if (*chunk_size == 0 || *chunk_size > link->max_chunk_size) {
+        *chunk_size = tune_chunk_size(metadata.file_size, link->max_chunk_size, rtt_us, config->window_size);
+    }
+    file_info->chunk_size = *chunk_size;
+    file_info->total_chunks = (metadata.file_size + file_info->chunk_size - 1) / file_info->chunk_size;
+    LOG_INFO("Total chunks: %llu (chunk size: %u bytes, handshake RTT %.2f ms)",
+             (unsigned long long)file_info->total_chunks, file_info->chunk_size, rtt_us / 1000.0);
+
+    /* Stripe across as many connections as asked for, but no more than
+     * there are chunks */
+    uint64_t stripe_count = 1;
+    if (transfer.capabilities & FT_CAP_STRIPED) {
+        stripe_count = config->streams;
+        if (stripe_count > file_info->total_chunks) {
+            stripe_count = file_info->total_chunks > 0 ? file_info->total_chunks : 1;
+        }
+    } else if (config->streams > 1) {
+        LOG_WARN("Server does not support striped transfers, using one connection");
+    }
+    if (stripe_count > 1) {
+        file_info->transfer_id = new_transfer_id();
+        file_info->stripe_count = (uint16_t)stripe_count;
+    }
+
+    /* The tree root is only known once every chunk has been read, so it
+     * travels in VERIFY_REQUEST; FILE_INFO announces the checksum type */
+    int use_tree_hash = (transfer.capabilities & FT_CAP_TREE_HASH) != 0;
+    file_info->checksum_type = use_tree_hash ? CHECKSUM_MERKLE_SHA256 : CHECKSUM_CRC32;
+    memset(file_info->file_checksum, 0, FT_SHA256_SIZE);
+
+    transfer.stripes = (Stripe*)calloc((size_t)stripe_count, sizeof(Stripe));
+    if (transfer.stripes == NULL) {
+        LOG_ERROR("Out of memory");
+        goto cleanup;
+    }
+    transfer.stripe_count = (uint16_t)stripe_count;
+
+    /* Open and handshake the extra connections; each must agree to the
+     * same capabilities as the first */
+    for (uint16_t i = 0; i < transfer.stripe_count; i++) {
+        Stripe *stripe = &transfer.stripes[i];
+        stripe->transfer = &transfer;
+        stripe->index = i;
+        stripe->sequence_num = i == 0 ? link->sequence_num : 2;
+        protocol_stripe_range(file_info->total_chunks, transfer.stripe_count, i,
+                              &stripe->first_chunk, &stripe->end_chunk);
+        if (i == 0) {
+            stripe->conn = conn;
+            continue;
+        }
+
+        socket_t sock = open_connection(config, &error);
+        if (sock == INVALID_SOCKET_VALUE) {
+            goto cleanup;
+        }
+        if (connection_init(&stripe->own_conn, sock) != FT_SUCCESS) {
+            LOG_ERROR("Failed to allocate connection buffers");
+            close_socket(sock);
+            goto cleanup;
+        }
+        stripe->own_ready = 1;
+        stripe->conn = &stripe->own_conn;
+#ifdef FT_HAVE_TLS
+        if (config->tls && tls_connect(stripe->conn, config->host, &error) != 0) {
+            goto cleanup;
+        }
+#endif
+
+        uint8_t capabilities = transfer.capabilities;
+        uint32_t chunk_limit = file_info->chunk_size;
+        if (perform_handshake_client(stripe->conn, &capabilities, &chunk_limit, config->priority,
+                                     NULL, NULL, &error) != 0 ||
+            capabilities != transfer.capabilities || chunk_limit != file_info->chunk_size) {
+            LOG_ERROR("Handshake failed on stripe %u", i + 1);
+            goto cleanup;
+        }
+    }
+
+    /* Send file info on every connection */
+    LOG_INFO("Sending file info...");
+    uint64_t resumed_chunks = 0;
+    uint64_t resumed_bytes = 0;
+    for (uint16_t i = 0; i < transfer.stripe_count; i++) {
+        if (announce_stripe(&transfer.stripes[i], &error) != 0) {
+            *retry = (error == FT_ERR_BUSY);
+            goto cleanup;
+        }
+        resumed_chunks += transfer.stripes[i].resumed_chunks;
+        resumed_bytes += transfer.stripes[i].resumed_bytes;
+    }
+    if (resumed_chunks > 0) {
+        LOG_INFO("Resuming transfer: %llu of %llu chunks (%llu bytes) already on the server",
+                 (unsigned long long)resumed_chunks, (unsigned long long)file_info->total_chunks,
+                 (unsigned long long)resumed_bytes);
+    }
+
+    /* Leaf hashes and compressed chunks are computed by workers while
+     * chunks are in flight */
+    if (transfer.capabilities & FT_CAP_COMPRESS) {
+        compressor_init(&compressor);
+        compressor_ready = 1;
+        transfer.compressor = &compressor;
+    }
+    if (use_tree_hash || compressor_ready) {
+        int hash_threads = config->hash_threads >= 0 ? config->hash_threads : platform_cpu_count();
+        if (use_tree_hash && treehash_init(&tree, file_info->total_chunks) != FT_SUCCESS) {
+            LOG_ERROR("Failed to allocate tree hash");
+            goto cleanup;
+        }
+        if (threadpool_init(&hash_pool, hash_threads, config->window_size * transfer.stripe_count) != FT_SUCCESS) {
+            LOG_ERROR("Failed to start hash workers");
+            goto cleanup;
+        }
+        hash_pool_ready = 1;
+        transfer.tree = use_tree_hash ? &tree : NULL;
+        transfer.hash_pool = &hash_pool;
+        LOG_DEBUG("Hash and compression: %d worker thread(s)", hash_threads);
+    }
+
+    /* Send chunks */
+    if (transfer.stripe_count > 1) {
+        LOG_INFO("Sending file over %u connections (transfer %016llx)...", transfer.stripe_count,
+                 (unsigned long long)file_info->transfer_id);
+    }
+    if (transfer.stripes[0].delta) {
+        LOG_INFO("Server has an older copy, sending the differences...");
+    } else {
+        LOG_INFO("Sending file (window: up to %u chunks, %s, read-ahead %s)...", config->window_size,
+                 config->zero_copy && connection_raw_send(transfer.stripes[0].conn) ? "zero-copy" : "buffered",
+                 config->prefetch_chunks > 0 ? "on" : "off");
+    }
+    transfer.start_time = platform_get_monotonic_ms();
+
+    /* Stripe 0 runs on this thread, the others on their own */
+    for (uint16_t i = 1; i < transfer.stripe_count; i++) {
+        if (platform_thread_create(&transfer.stripes[i].thread, stripe_thread, &transfer.stripes[i]) != 0) {
+            LOG_ERROR("Failed to start stripe thread");
+            transfer_abort(&transfer);
+            break;
+        }
+        threads_started++;
+    }
+    int failed = (threads_started + 1 != transfer.stripe_count);
+    if (!failed) {
+        Stripe *first = &transfer.stripes[0];
+        first->result = first->delta ? send_delta(first) : send_stripe(first);
+    }
+
+    uint64_t sent_bytes = 0;
+    uint64_t stored_chunks = 0;
+    uint64_t stored_bytes = 0;
+    uint64_t hole_bytes = 0;
+    for (uint16_t i = 0; i < transfer.stripe_count; i++) {
+        if (i > 0 && i <= threads_started) {
+            platform_thread_join(transfer.stripes[i].thread);
+        }
+        failed |= (transfer.stripes[i].result != 0);
+        sent_bytes += transfer.stripes[i].sent_bytes;
+        stored_chunks += transfer.stripes[i].stored_chunks;
+        stored_bytes += transfer.stripes[i].stored_bytes;
+        hole_bytes += transfer.stripes[i].hole_bytes;
+    }
+    threads_started = 0;
+    if (failed) {
+        *retry = (transfer.capabilities & FT_CAP_RESUME) != 0 && use_tree_hash;
+        goto cleanup;
+    }
+
+    /* Calculate transfer statistics */
+    uint64_t elapsed_ms = platform_get_monotonic_ms() - transfer.start_time;
+    double elapsed_sec = elapsed_ms / 1000.0;
+    double speed_mbps = (elapsed_sec > 0) ? (double)sent_bytes / elapsed_ms / 1000.0 : 0.0;
+
+    LOG_INFO("All chunks sent successfully");
+    LOG_INFO("Transfer complete: %llu bytes in %.2f seconds (%.2f MB/s)",
+             (unsigned long long)sent_bytes, elapsed_sec, speed_mbps);
+    if (resumed_bytes > 0) {
+        LOG_INFO("Skipped %llu bytes the server already held", (unsigned long long)resumed_bytes);
+    }
+    if (compressor_ready) {
+        CompressStats stats;
+        compressor_get_stats(&compressor, &stats);
+        if (stats.chunks > 0) {
+            LOG_INFO("Compressed %llu of %llu chunks, %llu bytes into %llu (%.1f%%), %llu sent raw without a probe",
+                     (unsigned long long)stats.packed, (unsigned long long)stats.chunks,
+                     (unsigned long long)stats.raw_bytes, (unsigned long long)stats.wire_bytes,
+                     stats.raw_bytes > 0 ? 100.0 * stats.wire_bytes / stats.raw_bytes : 0.0,
+                     (unsigned long long)stats.bypassed);
+        }
+    }
+    if (stored_chunks > 0) {
+        LOG_INFO("Server's chunk store held %llu of %llu chunks (%llu bytes), they were not sent",
+                 (unsigned long long)stored_chunks, (unsigned long long)file_info->total_chunks,
+                 (unsigned long long)stored_bytes);
+    }
+    if (hole_bytes > 0) {
+        LOG_INFO("Sent %llu bytes of holes and zeros as hole records", (unsigned long long)hole_bytes);
+    }
+    metrics_log(&transfer.metrics, "Chunk");
+
+    if (use_tree_hash) {
+        /* Drained windows imply every leaf has been hashed */
+        if (treehash_root(&tree, file_info->file_checksum) != FT_SUCCESS) {
+            LOG_ERROR("Failed to compute tree root");
+            goto cleanup;
+        }
+        if (verify_transfer(conn, file_info, &tree, sent_bytes + resumed_bytes + stored_bytes,
+                            &transfer.stripes[0].sequence_num) != 0) {
+            goto cleanup;
+        }
+    } else {
+        LOG_WARN("Server does not support tree hash verification, relying on chunk CRC32 only");
+    }
+
+    result = 0;
+
+cleanup:
+    if (transfer.stripes != NULL) {
+        link->sequence_num = transfer.stripes[0].sequence_num;
+    }
+    if (hash_pool_ready) {
+        threadpool_destroy(&hash_pool);
+    }
+    if (compressor_ready) {
+        compressor_destroy(&compressor);
+    }
+    treehash_free(&tree);
+    for (uint16_t i = 0; transfer.stripes != NULL && i < transfer.stripe_count; i++) {
+        if (transfer.stripes[i].own_ready) {
+            close_socket(transfer.stripes[i].own_conn.sock);
+            connection_free(&transfer.stripes[i].own_conn);
+        }
+        free(transfer.stripes[i].resumed);
+    }
+    free(transfer.stripes);
+    platform_mutex_destroy(&transfer.lock);
+
+    return result;
+}
+
+/* Copy of a string, or NULL out of memory */
+static char* copy_string(const char *text) {
+    size_t length = strlen(text) + 1;
+    char *copy = (char*)malloc(length);
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
+
+/* Add the file at path to the batch, to be sent as name */
+static int batch_add(Batch *batch, const char *path, const char *name, int attrs) {
+    FileMetadata metadata;
+    FTErrorCode error;
+
+    if (strlen(name) >= FT_MAX_PATH_LEN) {
+        LOG_ERROR("Path too long to send: %s", name);
+        return -1;
+    }
+    if (file_get_metadata(path, &metadata, &error) != 0) {
+        if (attrs && error == FT_ERR_INVALID_ARG) {
+            /* Devices, sockets and the like found by a walk */
+            LOG_WARN("Skipping %s", path);
+            return 0;
+        }
+        return -1;
+    }
+
+    if (batch->file_count == batch->file_capacity) {
+        size_t capacity = batch->file_capacity > 0 ? batch->file_capacity * 2 : 64;
+        BatchFile *files = (BatchFile*)realloc(batch->files, capacity * sizeof(BatchFile));
+        if (files == NULL) {
+            LOG_ERROR("Out of memory");
+            return -1;
+        }
+        batch->files = files;
+        batch->file_capacity = capacity;
+    }
+
+    BatchFile *file = &batch->files[batch->file_count];
+    file->path = copy_string(path);
+    file->name = copy_string(name);
+    if (file->path == NULL || file->name == NULL) {
+        LOG_ERROR("Out of memory");
+        free(file->path);
+        free(file->name);
+        return -1;
+    }
+    file->size = metadata.file_size;
+    file->mode = metadata.file_mode;
+    file->timestamp = metadata.timestamp;
+    file->attrs = attrs;
+    batch->file_count++;
+    batch->total_bytes += metadata.file_size;
+    return 0;
+}
+
+/* Entries of one directory */
+typedef struct {
+    char  **names;
+    size_t  count;
+    size_t  capacity;
+    int     failed;
+} NameList;
+
+/* file_list_directory() visitor collecting the names */
+static void name_list_add(const char *name, void *context) {
+    NameList *list = (NameList*)context;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 32;
+        char **names = (char**)realloc(list->names, capacity * sizeof(char*));
+        if (names == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->names = names;
+        list->capacity = capacity;
+    }
+    list->names[list->count] = copy_string(name);
+    if (list->names[list->count] == NULL) {
+        list->failed = 1;
+        return;
+    }
+    list->count++;
+}
+
+/* qsort() order of names */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Add path to the batch as name: the file itself, or every file under
+ * the directory, named by their path below it */
+static int batch_collect(Batch *batch, const char *path, const char *name, int depth) {
+    NameList list;
+    int result = 0;
+
+    if (!file_is_directory(path)) {
+        return batch_add(batch, path, name, depth > 0);
+    }
+    if (depth >= WALK_MAX_DEPTH) {
+        LOG_ERROR("Directory tree too deep at %s", path);
+        return -1;
+    }
+
+    memset(&list, 0, sizeof(list));
+    if (file_list_directory(path, name_list_add, &list) != 0 || list.failed) {
+        LOG_ERROR("Failed to read directory %s", path);
+        result = -1;
+    }
+
+    /* Sorted, so a batch sent again makes the same bundles */
+    if (list.count > 1) {
+        qsort(list.names, list.count, sizeof(char*), compare_names);
+    }
+    for (size_t i = 0; i < list.count && result == 0; i++) {
+        char child_path[1024];
+        char child_name[FT_MAX_PATH_LEN];
+
+        if (file_build_path(path, list.names[i], child_path, sizeof(child_path)) != FT_SUCCESS ||
+            snprintf(child_name, sizeof(child_name), "%s/%s", name, list.names[i]) >= (int)sizeof(child_name)) {
+            LOG_ERROR("Path too long to send: %s/%s", name, list.names[i]);
+            result = -1;
+            break;
+        }
+        result = batch_collect(batch, child_path, child_name, depth + 1);
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.names[i]);
+    }
+    free(list.names);
+    return result;
+}
+
+/* Name a -f argument is sent as: its last component */
+static int path_base_name(const char *path, char *name, size_t size) {
+    size_t end = strlen(path);
+    while (end > 0 && (path[end - 1] == '/' || path[end - 1] == PATH_SEPARATOR)) {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/' && path[start - 1] != PATH_SEPARATOR) {
+        start--;
+    }
+    if (end == start || end - start >= size) {
+        return -1;
+    }
+    memcpy(name, path + start, end - start);
+    name[end - start] = '\0';
+    return 0;
+}
+
+/* Whether a file goes in a bundle: small, and named within a bundle entry */
+static int batch_bundles(const BatchFile *file, uint32_t bundle_max) {
+    return file->size < bundle_max && strlen(file->name) < FT_MAX_FILENAME_LEN;
+}
+
+/* Split the batch into units. Files batch_bundles() takes are moved to
+ * the front, in the order found, and bundled up to FT_BUNDLE_MAX_ENTRIES
+ * files or FT_BUNDLE_MAX_BYTES; the others are sent one by one. */
+static int batch_plan(Batch *batch, uint32_t bundle_max) {
+    BatchFile *ordered = NULL;
+    size_t small = 0;
+
+    batch->units = (SendUnit*)calloc(batch->file_count, sizeof(SendUnit));
+    if (batch->units == NULL) {
+        LOG_ERROR("Out of memory");
+        return -1;
+    }
+
+    if (bundle_max > 0) {
+        ordered = (BatchFile*)malloc(batch->file_count * sizeof(BatchFile));
+        if (ordered == NULL) {
+            LOG_ERROR("Out of memory");
+            return -1;
+        }
+        size_t next = 0;
+        for (size_t i = 0; i < batch->file_count; i++) {
+            if (batch_bundles(&batch->files[i], bundle_max)) {
+                ordered[next++] = batch->files[i];
+            }
+        }
+        small = next;
+        for (size_t i = 0; i < batch->file_count; i++) {
+            if (!batch_bundles(&batch->files[i], bundle_max)) {
+                ordered[next++] = batch->files[i];
+            }
+        }
+        memcpy(batch->files, ordered, batch->file_count * sizeof(BatchFile));
+        free(ordered);
+    }
+
+    size_t bundled = 0;
+    for (size_t i = 0; i < batch->file_count; ) {
+        SendUnit *unit = &batch->units[batch->unit_count++];
+        uint64_t bytes = batch->files[i].size;
+
+        unit->first = i;
+        unit->count = 1;
+        if (i < small) {
+            while (i + unit->count < small && unit->count < FT_BUNDLE_MAX_ENTRIES &&
+                   bytes + batch->files[i + unit->count].size <= FT_BUNDLE_MAX_BYTES) {
+                bytes += batch->files[i + unit->count].size;
+                unit->count++;
+            }
+            /* A bundle of one is just the file with a manifest */
+            unit->bundle = unit->count > 1;
+            bundled += unit->bundle ? unit->count : 0;
+        }
+        i += unit->count;
+    }
+    if (bundled > 0) {
+        LOG_INFO("%zu files smaller than %u KB go in bundles, %zu units to send", bundled,
+                 bundle_max / 1024, batch->unit_count);
+    }
+    return 0;
+}
+
+/* Where bundles are built */
+static const char* bundle_directory(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    const char *dir = getenv("TEMP");
+    return dir != NULL && dir[0] != '\0' ? dir : ".";
+#else
+    const char *dir = getenv("TMPDIR");
+    return dir != NULL && dir[0] != '\0' ? dir : "/tmp";
+#endif
+}
+
+/* Build the bundle of unit in the temp directory */
+static int batch_build_bundle(Batch *batch, const SendUnit *unit) {
+    FTErrorCode error;
+    int result = -1;
+
+    BundleEntry *entries = (BundleEntry*)calloc(unit->count, sizeof(BundleEntry));
+    const char **sources = (const char**)calloc(unit->count, sizeof(char*));
+    if (entries == NULL || sources == NULL) {
+        LOG_ERROR("Out of memory");
+        goto cleanup;
+    }
+    batch->bundle_size = bundle_data_offset(unit->count);
+    for (uint32_t i = 0; i < unit->count; i++) {
+        const BatchFile *file = &batch->files[unit->first + i];
+        entries[i].size = file->size;
+        entries[i].timestamp = file->timestamp;
+        entries[i].mode = file->mode;
+        entries[i].flags = file->attrs ? FT_BUNDLE_ENTRY_ATTRS : 0;
+        strncpy(entries[i].name, file->name, FT_MAX_FILENAME_LEN - 1);
+        sources[i] = file->path;
+        batch->bundle_size += file->size;
+    }
+
+    if (bundle_create(bundle_directory(), entries, sources, unit->count, batch->bundle_name,
+                      sizeof(batch->bundle_name), batch->bundle_path, sizeof(batch->bundle_path), &error) != 0) {
+        LOG_ERROR("Failed to build bundle: %s", protocol_get_error_string(error));
+        batch->bundle_path[0] = '\0';
+        goto cleanup;
+    }
+    LOG_DEBUG("Built %s: %u files, %llu bytes", batch->bundle_path, unit->count,
+              (unsigned long long)batch->bundle_size);
+    result = 0;
+
+cleanup:
+    free(entries);
+    free(sources);
+    return result;
+}
+
+/* Close the session's connection; end tells a batch server that every
+ * file sent over it is committed, so it can close quietly */
+static void session_close(Session *session, int end) {
+    if (!session->open) {
+        return;
+    }
+    if (end && (session->link.capabilities & FT_CAP_BATCH)) {
+        FTErrorCode error;
+        TransferComplete complete;
+        memset(&complete, 0, sizeof(complete));
+        complete.total_chunks = session->sent_units;
+        complete.total_bytes = session->sent_bytes;
+        if (send_transfer_complete(&session->conn, &complete, session->link.sequence_num++, &error) != 0) {
+            LOG_WARN("Failed to end the batch: %s", protocol_get_error_string(error));
+        }
+    }
+    connection_free(&session->conn);
+    close_socket(session->sock);
+    session->sock = INVALID_SOCKET_VALUE;
+    session->open = 0;
+    session->sent_units = 0;
+    session->sent_bytes = 0;
+}
+
+/* Connect and handshake a session's connection. *retry is set if the
+ * server could not be reached in the handshake, which a connection opened
+ * with TCP Fast Open may only notice there. */
+static int session_open(Session *session, int *retry) {
+    const ClientConfig *config = session->config;
+    FTErrorCode error;
+    Link *link = &session->link;
+
+    *retry = 0;
+    session->sock = open_connection(config, &error);
+    if (session->sock == INVALID_SOCKET_VALUE) {
+        return -1;
+    }
+    LOG_INFO("Connected to server");
+    if (connection_init(&session->conn, session->sock) != FT_SUCCESS) {
+        LOG_ERROR("Failed to allocate connection buffers");
+        close_socket(session->sock);
+        session->sock = INVALID_SOCKET_VALUE;
+        return -1;
+    }
+    session->open = 1;
+#ifdef FT_HAVE_TLS
+    if (config->tls && tls_connect(&session->conn, config->host, &error) != 0) {
+        session_close(session, 0);
+        return -1;
+    }
+#endif
+
+    /* Perform handshake */
+    LOG_INFO("Performing handshake...");
+    memset(link, 0, sizeof(*link));
+    link->capabilities = FT_CAP_SUPPORTED;
+    if (config->streams <= 1) {
+        link->capabilities &= (uint8_t)~FT_CAP_STRIPED;
+    }
+    if (!config->delta) {
+        link->capabilities &= (uint8_t)~FT_CAP_DELTA;
+    }
+    if (!config->compress) {
+        link->capabilities &= (uint8_t)~FT_CAP_COMPRESS;
+    }
+    link->max_chunk_size = FT_MAX_CHUNK_SIZE;
+    session->persistent = config->jobs;
+    if (perform_handshake_client(&session->conn, &link->capabilities, &link->max_chunk_size, config->priority,
+                                 &session->persistent, &link->rtt_us, &error) != 0) {
+        LOG_ERROR("Handshake failed: %s", protocol_get_error_string(error));
+        *retry = (error == FT_ERR_SEND || error == FT_ERR_RECV || error == FT_ERR_TIMEOUT);
+        session_close(session, 0);
+        return -1;
+    }
+    link->sequence_num = 2;
+
+    /* Between jobs only keepalives cross the connection */
+    session->persistent = session->persistent && (link->capabilities & FT_CAP_BATCH) != 0;
+    if (session->persistent) {
+        socket_set_keepalive(session->sock, FT_KEEPALIVE_INTERVAL, NULL);
+    }
+    return 0;
+}
+
+/* Send the batch's remaining units over the session. A server that takes
+ * batches gets them all; one that does not gets a single unit, and the
+ * caller reconnects for the next. *retry as send_file() sets it. */
+static int send_files(Session *session, Batch *batch, int *retry) {
+    const ClientConfig *config = session->config;
+
+    *retry = 0;
+    int batched = (session->link.capabilities & FT_CAP_BATCH) != 0;
+    if (batch->units == NULL) {
+        if (!batched && batch->file_count > 1) {
+            LOG_WARN("Server does not support batches, using one connection per file");
+        }
+        if (batch_plan(batch, batched ? config->bundle_max : 0) != 0) {
+            return -1;
+        }
+    }
+
+    while (batch->next_unit < batch->unit_count) {
+        const SendUnit *unit = &batch->units[batch->next_unit];
+        SendItem item;
+
+        memset(&item, 0, sizeof(item));
+        if (unit->bundle) {
+            if (!batched) {
+                LOG_ERROR("Server no longer supports batches");
+                return -1;
+            }
+            /* Kept across retries, so the server can resume it */
+            if (batch->bundle_path[0] == '\0' && batch_build_bundle(batch, unit) != 0) {
+                return -1;
+            }
+            item.path = batch->bundle_path;
+            item.name = batch->bundle_name;
+            item.flags = FT_FILE_BUNDLE;
+            item.bundle_entries = unit->count;
+        } else {
+            const BatchFile *file = &batch->files[unit->first];
+            item.path = file->path;
+            item.name = file->name;
+            item.flags = file->attrs ? FT_FILE_ATTRS : 0;
+        }
+
+        if (send_file(&session->conn, config, &session->link, &item, &batch->chunk_size, retry) != 0) {
+            return -1;
+        }
+        if (unit->bundle) {
+            file_delete(batch->bundle_path);
+            batch->bundle_path[0] = '\0';
+        }
+        batch->chunk_size = 0;
+        batch->next_unit++;
+        session->sent_units++;
+        session->sent_bytes += item.file_size;
+        if (!batched) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/* Send the whole batch, connecting when the session is not open. Reconnecting
+ * after an interruption resumes the transfer: the server lists the chunks
+ * it kept in FILE_ACK. Each file committed earns the next one a fresh set
+ * of attempts. The session is left open after a batch server took the
+ * last unit. */
+static int send_batch(Session *session, Batch *batch) {
+    const ClientConfig *config = session->config;
+    int delay_ms = 1000;
+    int attempt = 0;
+
+    for (;;) {
+        int reused = session->open;
+        size_t committed = batch->next_unit;
+        int retry;
+        int sent = -1;
+        if (session->open || session_open(session, &retry) == 0) {
+            sent = send_files(session, batch, &retry);
+        }
+        if (sent != 0 || (session->link.capabilities & FT_CAP_BATCH) == 0) {
+            session_close(session, 0);
+        }
+
+        if (batch->next_unit > committed) {
+            attempt = 0;
+            delay_ms = 1000;
+        }
+        if (sent == 0 && batch->next_unit == batch->unit_count) {
+            return 0;
+        }
+        if (sent == 0) {
+            /* One unit per connection */
+            continue;
+        }
+        if (reused && batch->next_unit == committed) {
+            /* The server dropped the session while it was idle */
+            LOG_INFO("Idle session failed, reconnecting");
+            continue;
+        }
+        if (!retry || attempt >= config->retries) {
+            return -1;
+        }
+
+        LOG_WARN("Transfer interrupted, resuming in %d ms (attempt %d/%d)",
+                 delay_ms, attempt + 1, config->retries);
+        platform_sleep_ms((uint32_t)delay_ms);
+        delay_ms = (delay_ms * 2 < FT_BACKOFF_MAX_MS) ? delay_ms * 2 : FT_BACKOFF_MAX_MS;
+        attempt++;
+    }
+}
+
+/* Release the batch, removing a bundle left behind */
+static void batch_free(Batch *batch) {
+    if (batch->bundle_path[0] != '\0') {
+        file_delete(batch->bundle_path);
+    }
+    for (size_t i = 0; i < batch->file_count; i++) {
+        free(batch->files[i].path);
+        free(batch->files[i].name);
+    }
+    free(batch->files);
+    free(batch->units);
+}
+
+/* Keepalive thread: while the session sits idle between jobs, send
+ * KEEPALIVE every FT_KEEPALIVE_INTERVAL so the server's idle deadline
+ * (and any NAT or firewall on the way) does not drop it */
+static void session_keeper_thread(void *arg) {
+    Session *session = (Session*)arg;
+
+    platform_mutex_lock(&session->lock);
+    while (!session->stopping) {
+        uint64_t now = platform_get_monotonic_ms();
+        uint64_t due = session->last_sent_ms + FT_KEEPALIVE_INTERVAL * 1000ULL;
+        int active = session->idle && session->open && session->persistent;
+        if (active && now >= due) {
+            FTErrorCode error;
+            if (send_message(&session->conn, MSG_KEEPALIVE, session->link.sequence_num++, NULL, 0,
+                             &error) != 0) {
+                /* The next job reconnects */
+                LOG_WARN("Session keepalive failed: %s", protocol_get_error_string(error));
+                session_close(session, 0);
+            }
+            session->last_sent_ms = now;
+            continue;
+        }
+        platform_cond_timedwait(&session->wake, &session->lock,
+                                active ? (uint32_t)(due - now) : FT_KEEPALIVE_INTERVAL * 1000);
+    }
+    platform_mutex_unlock(&session->lock);
+}
+
+/* Take the session from the keepalive thread for a job, or give it back */
+static void session_set_idle(Session *session, int idle) {
+    platform_mutex_lock(&session->lock);
+    session->idle = idle;
+    session->last_sent_ms = platform_get_monotonic_ms();
+    platform_cond_signal(&session->wake);
+    platform_mutex_unlock(&session->lock);
+}
+
+/* -j: send each path read from standard input as a batch of its own over
+ * the session, reporting each on standard output. Returns the exit code. */
+static int run_jobs(Session *session) {
+    char line[FT_MAX_PATH_LEN + 2];
+    uint64_t jobs = 0;
+    uint64_t failed = 0;
+
+    session->idle = 1;
+    if (platform_thread_create(&session->keeper, session_keeper_thread, session) != 0) {
+        LOG_WARN("Failed to start keepalive thread; idle sessions may time out");
+    } else {
+        session->keeper_running = 1;
+    }
+    LOG_INFO("Reading paths to send from standard input...");
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        int too_long = line[length] == '\0' && !feof(stdin);
+        if (too_long) {
+            /* Skip the rest of the line */
+            int ch;
+            while ((ch = getchar()) != EOF && ch != '\n') {
+            }
+        }
+        line[length] = '\0';
+        if (length == 0) {
+            continue;
+        }
+
+        Batch batch;
+        char name[FT_MAX_PATH_LEN];
+        int result = -1;
+        uint64_t job_start = platform_get_monotonic_ms();
+        memset(&batch, 0, sizeof(batch));
+        if (too_long) {
+            LOG_ERROR("Path longer than %d bytes", FT_MAX_PATH_LEN - 1);
+        } else if (path_base_name(line, name, sizeof(name)) != 0) {
+            LOG_ERROR("Cannot send %s", line);
+        } else if (batch_collect(&batch, line, name, 0) == 0) {
+            if (batch.file_count == 0) {
+                LOG_ERROR("No files to send in %s", line);
+            } else {
+                session_set_idle(session, 0);
+                result = send_batch(session, &batch);
+                if (result == 0 && !session->persistent) {
+                    /* The server did not agree to keep it: reconnect for the next job */
+                    session_close(session, 1);
+                }
+                session_set_idle(session, 1);
+            }
+        }
+
+        jobs++;
+        failed += (result != 0);
+        LOG_INFO("%s %s: %zu files, %llu bytes in %.3f seconds", result == 0 ? "Sent" : "Failed to send",
+                 line, batch.file_count, (unsigned long long)batch.total_bytes,
+                 (platform_get_monotonic_ms() - job_start) / 1000.0);
+        batch_free(&batch);
+        printf("%s %s\n", result == 0 ? "OK" : "FAIL", line);
+        fflush(stdout);
+    }
+
+    if (session->keeper_running) {
+        platform_mutex_lock(&session->lock);
+        session->stopping = 1;
+        platform_cond_signal(&session->wake);
+        platform_mutex_unlock(&session->lock);
+        platform_thread_join(session->keeper);
+        session->keeper_running = 0;
+    }
+    session_close(session, 1);
+    LOG_INFO("Standard input closed after %llu jobs, %llu failed", (unsigned long long)jobs,
+             (unsigned long long)failed);
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    ClientConfig config;
+    Session session;
+    Batch batch;
+    int exit_code = 1;
+
+    memset(&session, 0, sizeof(session));
+    session.config = &config;
+    session.sock = INVALID_SOCKET_VALUE;
+    platform_mutex_init(&session.lock);
+    platform_cond_init(&session.wake);
+    memset(&batch, 0, sizeof(batch));
+
+    /* Parse arguments */
+    if (parse_args(argc, argv, &config) != 0) {
+        free(config.paths);
+        platform_cond_destroy(&session.wake);
+        platform_mutex_destroy(&session.lock);
+        return (argc > 1 && strcmp(argv[argc-1], "--help") == 0) ? 0 : 1;
+    }
+
+    /* Initialize logger */
+    logger_init(config.verbose ? LOG_DEBUG : LOG_INFO, config.log_file);
+
+    /* Initialize platform */
+    if (platform_init() != 0) {
+        LOG_ERROR("Failed to initialize platform");
+        goto cleanup;
+    }
+
+    LOG_INFO("File Transfer Client starting...");
+
+    /* Select CRC32, SHA-256, FEC and zero scan kernels once, before any worker threads exist */
+    crc32_init();
+    sha256_init_dispatch();
+    fec_init_dispatch();
+    zero_init_dispatch();
+    LOG_DEBUG("CRC32 implementation: %s", crc32_implementation());
+    LOG_DEBUG("SHA-256 implementation: %s", sha256_implementation());
+    LOG_DEBUG("Zero scan implementation: %s", zero_implementation());
+    if (config.fec_k > 0) {
+        LOG_DEBUG("FEC implementation: %s", fec_implementation());
+    }
+
+    /* Window slots and read-ahead of every stream share one budget */
+    if (buffer_pool_init(&config.pool, NULL) != 0) {
+        goto cleanup;
+    }
+
+#ifdef FT_HAVE_TLS
+    if (config.tls && tls_init(&config.tls_config, 0, NULL) != 0) {
+        goto cleanup;
+    }
+#endif
+
+    /* A server that went away fails the send, not the process */
+#ifndef FT_PLATFORM_WINDOWS
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (config.jobs) {
+        exit_code = run_jobs(&session);
+        goto cleanup;
+    }
+
+    /* Find the files to send */
+    for (int i = 0; i < config.path_count; i++) {
+        char name[FT_MAX_PATH_LEN];
+        if (path_base_name(config.paths[i], name, sizeof(name)) != 0) {
+            LOG_ERROR("Cannot send %s", config.paths[i]);
+            goto cleanup;
+        }
+        if (batch_collect(&batch, config.paths[i], name, 0) != 0) {
+            goto cleanup;
+        }
+    }
+    if (batch.file_count == 0) {
+        LOG_ERROR("No files to send");
+        goto cleanup;
+    }
+    if (batch.file_count > 1) {
+        LOG_INFO("Sending %zu files, %llu bytes", batch.file_count, (unsigned long long)batch.total_bytes);
+    }
+    uint64_t batch_start = platform_get_monotonic_ms();
+
+    if (send_batch(&session, &batch) != 0) {
+        LOG_ERROR("File transfer failed");
+        goto cleanup;
+    }
+    if (batch.file_count > 1) {
+        uint64_t elapsed_ms = platform_get_monotonic_ms() - batch_start;
+        LOG_INFO("Sent %zu files (%llu bytes) in %.2f seconds (%.0f files/s)", batch.file_count,
+                 (unsigned long long)batch.total_bytes, elapsed_ms / 1000.0,
+                 elapsed_ms > 0 ? batch.file_count * 1000.0 / elapsed_ms : 0.0);
+    }
+    LOG_INFO("File transfer completed successfully");
+    exit_code = 0;
+
+cleanup:
+    /* Each file was committed before its VERIFY_RESPONSE; this only lets the server close quietly */
+    session_close(&session, exit_code == 0);
+    platform_cond_destroy(&session.wake);
+    platform_mutex_destroy(&session.lock);
+
+    BufferPoolStats pool_stats;
+    buffer_pool_get_stats(&pool_stats);
+    if (pool_stats.budget > 0) {
+        LOG_DEBUG("Buffer pool: %llu MB (%s pages), peak %llu MB in use, %llu waits for memory",
+                  (unsigned long long)(pool_stats.budget >> 20), pool_stats.backing,
+                  (unsigned long long)(pool_stats.peak >> 20), (unsigned long long)pool_stats.waits);
+    }
+    batch_free(&batch);
+    free(config.paths);
+#ifdef FT_HAVE_TLS
+    tls_cleanup();
+#endif
     platform_cleanup();
     logger_close();
 
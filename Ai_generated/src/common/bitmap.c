@@ -0,0 +1,73 @@
+#include "bitmap.h"
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocate bitmap */
+int bitmap_init(ChunkBitmap *bitmap, uint64_t num_bits) {
+    size_t num_words = (size_t)((num_bits + 63) / 64);
+    bitmap->num_bits = num_bits;
+    bitmap->num_set = 0;
+    bitmap->words = NULL;
+
+    if (num_words > 0) {
+        bitmap->words = (uint64_t*)calloc(num_words, sizeof(uint64_t));
+        if (bitmap->words == NULL) {
+            return FT_ERR_OUT_OF_MEMORY;
+        }
+    }
+    return FT_SUCCESS;
+}
+
+/* Free bitmap */
+void bitmap_free(ChunkBitmap *bitmap) {
+    free(bitmap->words);
+    bitmap->words = NULL;
+    bitmap->num_bits = 0;
+    bitmap->num_set = 0;
+}
+
+/* Set bit */
+int bitmap_set(ChunkBitmap *bitmap, uint64_t index) {
+    if (index >= bitmap->num_bits) {
+        return 0;
+    }
+    uint64_t mask = 1ULL << (index % 64);
+    uint64_t *word = &bitmap->words[index / 64];
+    if (*word & mask) {
+        return 0;
+    }
+    *word |= mask;
+    bitmap->num_set++;
+    return 1;
+}
+
+/* Test bit */
+int bitmap_test(const ChunkBitmap *bitmap, uint64_t index) {
+    if (index >= bitmap->num_bits) {
+        return 0;
+    }
+    return (bitmap->words[index / 64] >> (index % 64)) & 1;
+}
+
+/* Find next clear bit */
+uint64_t bitmap_next_clear(const ChunkBitmap *bitmap, uint64_t index) {
+    while (index < bitmap->num_bits) {
+        uint64_t word = ~bitmap->words[index / 64] >> (index % 64);
+        if (word != 0) {
+            /* Lowest set bit of the inverted word is the next clear chunk */
+            while ((word & 1) == 0) {
+                word >>= 1;
+                index++;
+            }
+            return (index < bitmap->num_bits) ? index : bitmap->num_bits;
+        }
+        index = (index / 64 + 1) * 64;
+    }
+    return bitmap->num_bits;
+}
+
+/* Check completeness */
+int bitmap_is_complete(const ChunkBitmap *bitmap) {
+    return bitmap->num_set == bitmap->num_bits;
+}
@@ -0,0 +1,32 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Chunk bitmap (one bit per chunk ID) */
+typedef struct {
+    uint64_t *words;       /* Bit storage, 64 chunks per word */
+    uint64_t num_bits;     /* Number of chunks tracked */
+    uint64_t num_set;      /* Number of bits currently set */
+} ChunkBitmap;
+
+/* Allocate bitmap for num_bits chunks (all clear) */
+int bitmap_init(ChunkBitmap *bitmap, uint64_t num_bits);
+
+/* Free bitmap storage */
+void bitmap_free(ChunkBitmap *bitmap);
+
+/* Set bit; returns 1 if it was newly set, 0 if already set or out of range */
+int bitmap_set(ChunkBitmap *bitmap, uint64_t index);
+
+/* Test bit (out-of-range indices read as clear) */
+int bitmap_test(const ChunkBitmap *bitmap, uint64_t index);
+
+/* Find first clear bit at or after index; returns num_bits if none */
+uint64_t bitmap_next_clear(const ChunkBitmap *bitmap, uint64_t index);
+
+/* Check if every bit is set */
+int bitmap_is_complete(const ChunkBitmap *bitmap);
+
+#endif /* BITMAP_H */
@@ -0,0 +1,621 @@
+#include "bufpool.h"
+#include "platform.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FT_PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef FT_PLATFORM_LINUX
+#include <sys/syscall.h>
+#endif
+
+#ifdef FT_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define POOL_BLOCK         FT_MIN_CHUNK_SIZE          /* Smallest buffer */
+#define POOL_MAX_ORDER     8                          /* POOL_BLOCK << 8 = FT_MAX_CHUNK_SIZE */
+#define POOL_SPAN          ((size_t)POOL_BLOCK << POOL_MAX_ORDER)
+#define POOL_SPAN_BLOCKS   (1u << POOL_MAX_ORDER)
+#define POOL_LISTS         (POOL_MAX_ORDER + 2)       /* Free lists by order, then untouched spans */
+#define POOL_UNCOMMITTED   (POOL_MAX_ORDER + 1)
+#define POOL_NONE          UINT32_MAX
+#define POOL_ARENA_ALIGN   (2u * 1024 * 1024)         /* Huge page size */
+#define POOL_KEEP_SPANS    4                          /* Free spans kept committed */
+#define POOL_MAX_NODES     8
+#define POOL_MAX_REGISTER  1024                       /* Spans registered with io_uring */
+
+/* Block states */
+enum {
+    BLOCK_INSIDE = 0,     /* Part of a larger block */
+    BLOCK_FREE = 1,       /* Heads a free block on a list */
+    BLOCK_USED = 2        /* Heads an acquired buffer */
+};
+
+/* The arena and its buddy allocator. Per-block metadata lives outside the
+ * arena so free memory is never touched. */
+typedef struct {
+    uint8_t     *base;
+    size_t       size;
+    uint32_t     blocks;                  /* POOL_BLOCK units */
+    uint32_t     spans;                   /* FT_MAX_CHUNK_SIZE units */
+    uint8_t     *order;                   /* Order of the block a unit heads */
+    uint8_t     *state;
+    uint32_t    *next;                    /* Free list links */
+    uint32_t    *prev;
+    uint32_t    *refs;
+    uint8_t     *committed;               /* Per span: pages may be resident */
+    uint32_t     heads[POOL_MAX_NODES][POOL_LISTS];
+    uint32_t     node_start[POOL_MAX_NODES + 1];  /* First span of each node's region */
+    int          nodes;
+    const char  *backing;
+    uint64_t     in_use;
+    uint64_t     peak;
+    uint64_t     waits;
+    uint32_t     idle_spans;              /* Committed spans wholly free */
+    uint32_t     pins;                    /* io_uring registrations in effect */
+    uint32_t     blocked;                 /* Threads waiting in acquire */
+    uint64_t     generation;              /* Bumped when a span is committed */
+    PoolWaiter  *waiters;
+    ft_mutex_t   lock;
+    ft_cond_t    freed;
+} BufferPool;
+
+/* Pool states */
+enum {
+    POOL_UNSET = 0,
+    POOL_STARTING = 1,
+    POOL_READY = 2,
+    POOL_FAILED = 3
+};
+
+static BufferPool g_pool;
+static int pool_state = POOL_UNSET;
+
+/* Number of NUMA nodes (1 where unknown) */
+static int count_nodes(void) {
+#ifdef FT_PLATFORM_LINUX
+    int nodes = 0;
+    char path[64];
+    while (nodes < POOL_MAX_NODES) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodes);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        nodes++;
+    }
+    return nodes > 0 ? nodes : 1;
+#else
+    return 1;
+#endif
+}
+
+/* NUMA node the calling thread runs on */
+static int current_node(void) {
+#if defined(FT_PLATFORM_LINUX) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (g_pool.nodes > 1 && syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < (unsigned)g_pool.nodes) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
+/* Prefer a node's memory for its region of the arena (best effort) */
+static void bind_region(uint8_t *start, size_t length, int node) {
+#if defined(FT_PLATFORM_LINUX) && defined(SYS_mbind)
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, start, length, 1 /* MPOL_PREFERRED */, &mask, sizeof(mask) * 8 + 1, 0) != 0) {
+        LOG_DEBUG("Cannot bind buffer memory to NUMA node %d", node);
+    }
+#else
+    (void)start;
+    (void)length;
+    (void)node;
+#endif
+}
+
+/* Reserve the address range of the arena */
+static int arena_map(size_t size, int hugepages) {
+#ifdef FT_PLATFORM_WINDOWS
+    (void)hugepages;
+    g_pool.base = (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
+    g_pool.backing = "default";
+    return g_pool.base != NULL ? 0 : -1;
+#else
+#ifdef MAP_HUGETLB
+    /* Huge pages are reserved here, so a shortage fails now rather than
+     * with SIGBUS on first touch */
+    if (hugepages) {
+        void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            g_pool.base = (uint8_t*)base;
+            g_pool.backing = "hugetlb";
+            return 0;
+        }
+        LOG_DEBUG("No huge pages for the buffer pool, trying transparent ones");
+    }
+#endif
+
+    /* Over-map so the arena can start on a huge page boundary */
+    size_t mapped = size + POOL_ARENA_ALIGN;
+    uint8_t *raw = (uint8_t*)mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ((void*)raw == MAP_FAILED) {
+        return -1;
+    }
+    uint8_t *base = (uint8_t*)(((uintptr_t)raw + POOL_ARENA_ALIGN - 1) & ~(uintptr_t)(POOL_ARENA_ALIGN - 1));
+    if (base > raw) {
+        munmap(raw, (size_t)(base - raw));
+    }
+    if (base + size < raw + mapped) {
+        munmap(base + size, (size_t)(raw + mapped - (base + size)));
+    }
+    g_pool.base = base;
+    g_pool.backing = "default";
+#ifdef MADV_HUGEPAGE
+    if (hugepages && madvise(base, size, MADV_HUGEPAGE) == 0) {
+        g_pool.backing = "thp";
+    }
+#endif
+    return 0;
+#endif
+}
+
+/* Make a span usable */
+static int span_commit(uint32_t span) {
+#ifdef FT_PLATFORM_WINDOWS
+    return VirtualAlloc(g_pool.base + (size_t)span * POOL_SPAN, POOL_SPAN, MEM_COMMIT, PAGE_READWRITE) != NULL ? 0 : -1;
+#else
+    (void)span;
+    return 0;
+#endif
+}
+
+/* Give a span's pages back to the OS */
+static void span_decommit(uint32_t span) {
+    uint8_t *start = g_pool.base + (size_t)span * POOL_SPAN;
+#ifdef FT_PLATFORM_WINDOWS
+    VirtualFree(start, POOL_SPAN, MEM_DECOMMIT);
+#elif defined(FT_PLATFORM_LINUX) || !defined(MADV_FREE)
+    madvise(start, POOL_SPAN, MADV_DONTNEED);
+#else
+    madvise(start, POOL_SPAN, MADV_FREE);
+#endif
+}
+
+/* Node whose region holds a block */
+static int block_node(uint32_t block) {
+    uint32_t span = block >> POOL_MAX_ORDER;
+    int node = 0;
+    while (node + 1 < g_pool.nodes && span >= g_pool.node_start[node + 1]) {
+        node++;
+    }
+    return node;
+}
+
+/* Put a block at the head of a free list */
+static void list_push(uint32_t *head, uint32_t block) {
+    g_pool.prev[block] = POOL_NONE;
+    g_pool.next[block] = *head;
+    if (*head != POOL_NONE) {
+        g_pool.prev[*head] = block;
+    }
+    *head = block;
+}
+
+/* Take a block off its free list */
+static void list_remove(uint32_t *head, uint32_t block) {
+    if (g_pool.prev[block] != POOL_NONE) {
+        g_pool.next[g_pool.prev[block]] = g_pool.next[block];
+    } else {
+        *head = g_pool.next[block];
+    }
+    if (g_pool.next[block] != POOL_NONE) {
+        g_pool.prev[g_pool.next[block]] = g_pool.prev[block];
+    }
+}
+
+/* Smallest order holding size bytes, or -1 */
+static int size_order(size_t size) {
+    int order = 0;
+    while (((size_t)POOL_BLOCK << order) < size) {
+        if (++order > POOL_MAX_ORDER) {
+            return -1;
+        }
+    }
+    return order;
+}
+
+/* Take a block of the given order from a node's region (caller holds lock) */
+static uint32_t node_alloc(int node, int order) {
+    uint32_t *heads = g_pool.heads[node];
+    int from = order;
+
+    while (from <= POOL_MAX_ORDER && heads[from] == POOL_NONE) {
+        from++;
+    }
+
+    uint32_t block;
+    if (from <= POOL_MAX_ORDER) {
+        block = heads[from];
+        list_remove(&heads[from], block);
+        if (from == POOL_MAX_ORDER) {
+            g_pool.idle_spans--;
+        }
+    } else {
+        /* Committed memory is used up first */
+        block = heads[POOL_UNCOMMITTED];
+        if (block == POOL_NONE || span_commit(block >> POOL_MAX_ORDER) != 0) {
+            return POOL_NONE;
+        }
+        list_remove(&heads[POOL_UNCOMMITTED], block);
+        g_pool.committed[block >> POOL_MAX_ORDER] = 1;
+        g_pool.generation++;
+        from = POOL_MAX_ORDER;
+    }
+
+    /* Split, keeping the lower half each time */
+    while (from > order) {
+        from--;
+        uint32_t buddy = block + (1u << from);
+        g_pool.order[buddy] = (uint8_t)from;
+        g_pool.state[buddy] = BLOCK_FREE;
+        list_push(&heads[from], buddy);
+    }
+    g_pool.order[block] = (uint8_t)order;
+    g_pool.state[block] = BLOCK_USED;
+    g_pool.refs[block] = 1;
+    return block;
+}
+
+/* Acquire one buffer without waiting (caller holds lock) */
+static uint8_t* pool_alloc(int order) {
+    int home = current_node();
+
+    for (int i = 0; i < g_pool.nodes; i++) {
+        uint32_t block = node_alloc((home + i) % g_pool.nodes, order);
+        if (block != POOL_NONE) {
+            g_pool.in_use += (uint64_t)POOL_BLOCK << order;
+            if (g_pool.in_use > g_pool.peak) {
+                g_pool.peak = g_pool.in_use;
+            }
+            return g_pool.base + (size_t)block * POOL_BLOCK;
+        }
+    }
+    return NULL;
+}
+
+/* Return a block, merging it with free buddies (caller holds lock) */
+static void pool_free(uint32_t block) {
+    int order = g_pool.order[block];
+    uint32_t *heads = g_pool.heads[block_node(block)];
+
+    g_pool.in_use -= (uint64_t)POOL_BLOCK << order;
+    g_pool.state[block] = BLOCK_INSIDE;
+    while (order < POOL_MAX_ORDER) {
+        uint32_t buddy = block ^ (1u << order);
+        if (g_pool.state[buddy] != BLOCK_FREE || g_pool.order[buddy] != order) {
+            break;
+        }
+        list_remove(&heads[order], buddy);
+        g_pool.state[buddy] = BLOCK_INSIDE;
+        block &= ~(1u << order);
+        order++;
+    }
+
+    g_pool.order[block] = (uint8_t)order;
+    g_pool.state[block] = BLOCK_FREE;
+    if (order < POOL_MAX_ORDER) {
+        list_push(&heads[order], block);
+        return;
+    }
+
+    /* A wholly free span beyond the reserve goes back to the OS, unless
+     * io_uring has its pages pinned */
+    uint32_t span = block >> POOL_MAX_ORDER;
+    if (g_pool.pins == 0 && g_pool.idle_spans >= POOL_KEEP_SPANS) {
+        span_decommit(span);
+        g_pool.committed[span] = 0;
+        list_push(&heads[POOL_UNCOMMITTED], block);
+    } else {
+        g_pool.idle_spans++;
+        list_push(&heads[POOL_MAX_ORDER], block);
+    }
+}
+
+/* Set up the pool (g_pool is zeroed) */
+static int pool_setup(const BufferPoolConfig *config, FTErrorCode *error) {
+    uint64_t budget = config->budget;
+    if (budget < (uint64_t)FT_POOL_MIN_MB * 1024 * 1024) {
+        budget = (uint64_t)FT_POOL_MIN_MB * 1024 * 1024;
+    }
+    if (budget > (uint64_t)(POOL_NONE / POOL_SPAN_BLOCKS) * POOL_SPAN || budget > (uint64_t)SIZE_MAX / 2) {
+        LOG_ERROR("Buffer pool budget too large");
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    g_pool.spans = (uint32_t)((budget + POOL_SPAN - 1) / POOL_SPAN);
+    g_pool.blocks = g_pool.spans * POOL_SPAN_BLOCKS;
+    g_pool.size = (size_t)g_pool.spans * POOL_SPAN;
+    g_pool.order = (uint8_t*)calloc(g_pool.blocks, 1);
+    g_pool.state = (uint8_t*)calloc(g_pool.blocks, 1);
+    g_pool.next = (uint32_t*)calloc(g_pool.blocks, sizeof(uint32_t));
+    g_pool.prev = (uint32_t*)calloc(g_pool.blocks, sizeof(uint32_t));
+    g_pool.refs = (uint32_t*)calloc(g_pool.blocks, sizeof(uint32_t));
+    g_pool.committed = (uint8_t*)calloc(g_pool.spans, 1);
+    if (g_pool.order == NULL || g_pool.state == NULL || g_pool.next == NULL || g_pool.prev == NULL ||
+        g_pool.refs == NULL || g_pool.committed == NULL) {
+        LOG_ERROR("Failed to allocate buffer pool");
+        goto fail;
+    }
+    if (arena_map(g_pool.size, config->hugepages) != 0) {
+        LOG_ERROR("Failed to reserve %llu MB for the buffer pool",
+                  (unsigned long long)(g_pool.size / (1024 * 1024)));
+        goto fail;
+    }
+
+    /* One region per NUMA node, each preferring its node's memory */
+    g_pool.nodes = count_nodes();
+    if ((uint32_t)g_pool.nodes > g_pool.spans) {
+        g_pool.nodes = 1;
+    }
+    for (int node = 0; node <= g_pool.nodes; node++) {
+        g_pool.node_start[node] = (uint32_t)((uint64_t)g_pool.spans * node / g_pool.nodes);
+    }
+    for (int node = 0; node < g_pool.nodes; node++) {
+        for (int list = 0; list < POOL_LISTS; list++) {
+            g_pool.heads[node][list] = POOL_NONE;
+        }
+        if (g_pool.nodes > 1) {
+            bind_region(g_pool.base + (size_t)g_pool.node_start[node] * POOL_SPAN,
+                        (size_t)(g_pool.node_start[node + 1] - g_pool.node_start[node]) * POOL_SPAN, node);
+        }
+        /* Pushed in reverse so the lowest spans are used first */
+        for (uint32_t span = g_pool.node_start[node + 1]; span-- > g_pool.node_start[node];) {
+            uint32_t block = span << POOL_MAX_ORDER;
+            g_pool.order[block] = POOL_MAX_ORDER;
+            g_pool.state[block] = BLOCK_FREE;
+            list_push(&g_pool.heads[node][POOL_UNCOMMITTED], block);
+        }
+    }
+
+    platform_mutex_init(&g_pool.lock);
+    platform_cond_init(&g_pool.freed);
+    LOG_DEBUG("Buffer pool: %llu MB (%s pages, %d NUMA node%s)",
+              (unsigned long long)(g_pool.size / (1024 * 1024)), g_pool.backing,
+              g_pool.nodes, g_pool.nodes > 1 ? "s" : "");
+    if (error) *error = FT_SUCCESS;
+    return 0;
+
+fail:
+    free(g_pool.order);
+    free(g_pool.state);
+    free(g_pool.next);
+    free(g_pool.prev);
+    free(g_pool.refs);
+    free(g_pool.committed);
+    memset(&g_pool, 0, sizeof(g_pool));
+    if (error) *error = FT_ERR_OUT_OF_MEMORY;
+    return -1;
+}
+
+/* Initialize pool */
+int buffer_pool_init(const BufferPoolConfig *config, FTErrorCode *error) {
+    int expected = POOL_UNSET;
+    if (!__atomic_compare_exchange_n(&pool_state, &expected, POOL_STARTING, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        LOG_ERROR("Buffer pool already initialized");
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+    int result = pool_setup(config, error);
+    __atomic_store_n(&pool_state, result == 0 ? POOL_READY : POOL_FAILED, __ATOMIC_RELEASE);
+    return result;
+}
+
+/* Whether the pool is usable, setting it up with the defaults on first use */
+static int pool_ready(void) {
+    int state = __atomic_load_n(&pool_state, __ATOMIC_ACQUIRE);
+    if (state == POOL_READY) {
+        return 1;
+    }
+    if (state == POOL_UNSET) {
+        BufferPoolConfig config = { (uint64_t)FT_POOL_DEFAULT_MB * 1024 * 1024, 0 };
+        buffer_pool_init(&config, NULL);
+    }
+    while ((state = __atomic_load_n(&pool_state, __ATOMIC_ACQUIRE)) == POOL_STARTING) {
+        platform_sleep_ms(1);
+    }
+    return state == POOL_READY;
+}
+
+/* Block of a buffer, or POOL_NONE if it is not one of the pool's */
+static uint32_t buffer_block(const uint8_t *buffer) {
+    if (buffer < g_pool.base || buffer >= g_pool.base + g_pool.size ||
+        (size_t)(buffer - g_pool.base) % POOL_BLOCK != 0) {
+        LOG_ERROR("Buffer %p is not from the buffer pool", (const void*)buffer);
+        return POOL_NONE;
+    }
+    return (uint32_t)((size_t)(buffer - g_pool.base) / POOL_BLOCK);
+}
+
+/* Acquire buffer, waiting for memory */
+uint8_t* buffer_pool_acquire(size_t size, uint32_t timeout_ms) {
+    int order = size_order(size);
+    if (order < 0 || !pool_ready()) {
+        return NULL;
+    }
+
+    uint64_t deadline = platform_get_monotonic_ms() + timeout_ms;
+    platform_mutex_lock(&g_pool.lock);
+    uint8_t *buffer = pool_alloc(order);
+    if (buffer == NULL) {
+        g_pool.waits++;
+    }
+    while (buffer == NULL && timeout_ms != 0) {
+        g_pool.blocked++;
+        if (timeout_ms == FT_POOL_WAIT_FOREVER) {
+            platform_cond_wait(&g_pool.freed, &g_pool.lock);
+        } else {
+            uint64_t now = platform_get_monotonic_ms();
+            if (now < deadline) {
+                platform_cond_timedwait(&g_pool.freed, &g_pool.lock, (uint32_t)(deadline - now));
+            }
+        }
+        g_pool.blocked--;
+        buffer = pool_alloc(order);
+        if (timeout_ms != FT_POOL_WAIT_FOREVER && platform_get_monotonic_ms() >= deadline) {
+            break;
+        }
+    }
+    platform_mutex_unlock(&g_pool.lock);
+    return buffer;
+}
+
+/* Acquire buffer without waiting */
+uint8_t* buffer_pool_try_acquire(size_t size, PoolWaiter *waiter) {
+    int order = size_order(size);
+    if (order < 0 || !pool_ready()) {
+        return NULL;
+    }
+
+    platform_mutex_lock(&g_pool.lock);
+    uint8_t *buffer = pool_alloc(order);
+    if (buffer == NULL) {
+        g_pool.waits++;
+        if (waiter != NULL && !waiter->queued) {
+            waiter->queued = 1;
+            waiter->next = g_pool.waiters;
+            g_pool.waiters = waiter;
+        }
+    }
+    platform_mutex_unlock(&g_pool.lock);
+    return buffer;
+}
+
+/* Dequeue waiter */
+void buffer_pool_cancel_wait(PoolWaiter *waiter) {
+    if (__atomic_load_n(&pool_state, __ATOMIC_ACQUIRE) != POOL_READY) {
+        return;
+    }
+    platform_mutex_lock(&g_pool.lock);
+    if (waiter->queued) {
+        PoolWaiter **link = &g_pool.waiters;
+        while (*link != waiter) {
+            link = &(*link)->next;
+        }
+        *link = waiter->next;
+        waiter->queued = 0;
+    }
+    platform_mutex_unlock(&g_pool.lock);
+}
+
+/* Add reference */
+void buffer_pool_ref(uint8_t *buffer) {
+    uint32_t block = buffer_block(buffer);
+    if (block != POOL_NONE) {
+        __atomic_fetch_add(&g_pool.refs[block], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Drop reference */
+void buffer_pool_release(uint8_t *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    uint32_t block = buffer_block(buffer);
+    if (block == POOL_NONE || __atomic_sub_fetch(&g_pool.refs[block], 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    platform_mutex_lock(&g_pool.lock);
+    pool_free(block);
+    if (g_pool.blocked > 0) {
+        platform_cond_broadcast(&g_pool.freed);
+    }
+    PoolWaiter *waiter = g_pool.waiters;
+    g_pool.waiters = NULL;
+    while (waiter != NULL) {
+        PoolWaiter *next = waiter->next;
+        waiter->queued = 0;
+        waiter->notify(waiter->context);
+        waiter = next;
+    }
+    platform_mutex_unlock(&g_pool.lock);
+}
+
+/* Get statistics */
+void buffer_pool_get_stats(BufferPoolStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->backing = "none";
+    if (__atomic_load_n(&pool_state, __ATOMIC_ACQUIRE) != POOL_READY) {
+        return;
+    }
+    platform_mutex_lock(&g_pool.lock);
+    stats->budget = g_pool.size;
+    stats->in_use = g_pool.in_use;
+    stats->peak = g_pool.peak;
+    stats->waits = g_pool.waits;
+    stats->nodes = g_pool.nodes;
+    stats->backing = g_pool.backing;
+    platform_mutex_unlock(&g_pool.lock);
+}
+
+#ifdef FT_HAVE_IO_URING
+/* Register committed spans with this thread's ring */
+int buffer_pool_register(void) {
+    uint8_t *spans[POOL_MAX_REGISTER];
+    uint32_t count = 0;
+
+    if (!pool_ready()) {
+        return -1;
+    }
+    platform_mutex_lock(&g_pool.lock);
+    for (uint32_t span = 0; span < g_pool.spans && count < POOL_MAX_REGISTER; span++) {
+        if (g_pool.committed[span]) {
+            spans[count++] = g_pool.base + (size_t)span * POOL_SPAN;
+        }
+    }
+    g_pool.pins++;
+    platform_mutex_unlock(&g_pool.lock);
+
+    /* Nothing in use yet still counts: the caller registers again later */
+    if (count == 0 || uring_register_buffers(spans, POOL_SPAN, count) == 0) {
+        return 0;
+    }
+    platform_mutex_lock(&g_pool.lock);
+    g_pool.pins--;
+    platform_mutex_unlock(&g_pool.lock);
+    return -1;
+}
+
+/* Unregister spans */
+void buffer_pool_unregister(void) {
+    uring_unregister_buffers();
+    platform_mutex_lock(&g_pool.lock);
+    g_pool.pins--;
+    platform_mutex_unlock(&g_pool.lock);
+}
+
+/* Registration generation */
+uint64_t buffer_pool_generation(void) {
+    platform_mutex_lock(&g_pool.lock);
+    uint64_t generation = g_pool.generation;
+    platform_mutex_unlock(&g_pool.lock);
+    return generation;
+}
+#endif
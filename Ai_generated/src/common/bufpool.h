@@ -0,0 +1,91 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+
+/*
+ * Process-wide pool of chunk buffers. One arena the size of the memory
+ * budget is reserved at startup and handed out by a buddy allocator in
+ * powers of two from FT_MIN_CHUNK_SIZE to FT_MAX_CHUNK_SIZE, so every
+ * buffer is aligned for direct I/O and freed ones merge back into blocks
+ * any chunk size can use. A full budget makes acquire wait (or report the
+ * waiter once memory returns) instead of allocating more, which is what
+ * throttles transfers when memory runs short.
+ *
+ * Buffers are reference counted: the stage that acquires one holds the
+ * first reference, a stage it hands the buffer to takes another, and the
+ * buffer returns to the pool when the last one is released. Wholly free
+ * 16 MB blocks beyond a small reserve are given back to the OS while no
+ * io_uring registration pins them. On NUMA machines the arena is split
+ * per node and a thread is served from its own node first.
+ */
+
+#define FT_POOL_DEFAULT_MB    1024        /* Default memory budget */
+#define FT_POOL_MIN_MB        64
+#define FT_POOL_WAIT_FOREVER  UINT32_MAX
+
+/* Pool settings (see buffer_pool_init) */
+typedef struct {
+    uint64_t budget;              /* Bytes of buffers at most */
+    int      hugepages;           /* Back the arena with huge pages where possible */
+} BufferPoolConfig;
+
+/* Callback for try_acquire() callers: run once (with the pool locked, so it
+ * must not call back into the pool) when memory is released after a failed
+ * attempt. Owned by the caller; cancel it before freeing. */
+typedef struct PoolWaiter {
+    void             (*notify)(void *context);
+    void              *context;
+    struct PoolWaiter *next;
+    int                queued;
+} PoolWaiter;
+
+/* Pool statistics */
+typedef struct {
+    uint64_t    budget;
+    uint64_t    in_use;           /* Bytes in acquired buffers */
+    uint64_t    peak;
+    uint64_t    waits;            /* Acquires that found the budget used up */
+    int         nodes;            /* NUMA nodes the arena is split across */
+    const char *backing;          /* "hugetlb", "thp" or "default" */
+} BufferPoolStats;
+
+/* Reserve the arena; call once at startup, before any buffer is acquired
+ * (otherwise the first acquire sets the pool up with the defaults) */
+int buffer_pool_init(const BufferPoolConfig *config, FTErrorCode *error);
+
+/* Buffer of at least size bytes with one reference, waiting up to
+ * timeout_ms (FT_POOL_WAIT_FOREVER, or 0 not at all) for memory; NULL on
+ * timeout or if size exceeds FT_MAX_CHUNK_SIZE */
+uint8_t* buffer_pool_acquire(size_t size, uint32_t timeout_ms);
+
+/* Non-blocking acquire; when the budget is used up, waiter (optional) is
+ * queued to be notified once memory is released */
+uint8_t* buffer_pool_try_acquire(size_t size, PoolWaiter *waiter);
+
+/* Dequeue a waiter if queued; no notification runs once this returns */
+void buffer_pool_cancel_wait(PoolWaiter *waiter);
+
+/* Take another reference to a buffer */
+void buffer_pool_ref(uint8_t *buffer);
+
+/* Drop a reference; the last returns the buffer to the pool (NULL is ignored) */
+void buffer_pool_release(uint8_t *buffer);
+
+/* Current statistics */
+void buffer_pool_get_stats(BufferPoolStats *stats);
+
+#ifdef FT_HAVE_IO_URING
+/* Register the arena's blocks in use with the calling thread's io_uring so
+ * I/O on pool buffers uses fixed buffers; the registered blocks stay
+ * committed until buffer_pool_unregister(). Blocks touched later are only
+ * covered after registering again, which a caller can detect from
+ * buffer_pool_generation(). */
+int buffer_pool_register(void);
+void buffer_pool_unregister(void);
+uint64_t buffer_pool_generation(void);
+#endif
+
+#endif /* BUFPOOL_H */
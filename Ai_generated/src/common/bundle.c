@@ -0,0 +1,212 @@
+#include "bundle.h"
+#include "platform.h"
+#include "checksum.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Store 64-bit value in network byte order */
+static void put_u64(uint8_t *buffer, uint64_t value) {
+    value = htonll(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Load 64-bit value in network byte order */
+static uint64_t get_u64(const uint8_t *buffer) {
+    uint64_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohll(value);
+}
+
+/* Store 32-bit value in network byte order */
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Load 32-bit value in network byte order */
+static uint32_t get_u32(const uint8_t *buffer) {
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohl(value);
+}
+
+/* Serialize manifest entry */
+static void serialize_entry(const BundleEntry *entry, uint8_t *buffer) {
+    uint16_t flags = htons(entry->flags);
+
+    memset(buffer, 0, FT_BUNDLE_ENTRY_SIZE);
+    put_u64(buffer, entry->offset);
+    put_u64(buffer + 8, entry->size);
+    put_u64(buffer + 16, entry->timestamp);
+    put_u32(buffer + 24, entry->mode);
+    memcpy(buffer + 28, &flags, sizeof(flags));
+    memcpy(buffer + 32, entry->name, strnlen(entry->name, FT_MAX_FILENAME_LEN - 1));
+}
+
+/* Deserialize manifest entry */
+static void deserialize_entry(const uint8_t *buffer, BundleEntry *entry) {
+    uint16_t flags;
+
+    entry->offset = get_u64(buffer);
+    entry->size = get_u64(buffer + 8);
+    entry->timestamp = get_u64(buffer + 16);
+    entry->mode = get_u32(buffer + 24);
+    memcpy(&flags, buffer + 28, sizeof(flags));
+    entry->flags = ntohs(flags);
+    memcpy(entry->name, buffer + 32, FT_MAX_FILENAME_LEN);
+    entry->name[FT_MAX_FILENAME_LEN - 1] = '\0';
+}
+
+/* Data offset */
+uint64_t bundle_data_offset(uint32_t count) {
+    return FT_BUNDLE_HEADER_SIZE + (uint64_t)count * FT_BUNDLE_ENTRY_SIZE;
+}
+
+/* Create bundle */
+int bundle_create(const char *dir, BundleEntry *entries, const char *const *sources, uint32_t count,
+                  char *name, size_t name_size, char *path, size_t path_size, FTErrorCode *error) {
+    size_t manifest_size = (size_t)bundle_data_offset(count);
+    uint8_t digest[FT_SHA256_DIGEST_SIZE];
+    char hex[FT_SHA256_DIGEST_SIZE * 2 + 1];
+    WritePolicy policy;
+    OutputFile out;
+
+    uint8_t *manifest = (uint8_t*)calloc(1, manifest_size);
+    if (manifest == NULL) {
+        LOG_ERROR("Failed to allocate bundle manifest");
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    put_u32(manifest, FT_BUNDLE_MAGIC);
+    put_u32(manifest + 4, count);
+    uint64_t offset = manifest_size;
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].offset = offset;
+        offset += entries[i].size;
+        serialize_entry(&entries[i], manifest + FT_BUNDLE_HEADER_SIZE + (size_t)i * FT_BUNDLE_ENTRY_SIZE);
+    }
+
+    sha256_compute(manifest, manifest_size, digest);
+    sha256_to_hex(digest, hex);
+    snprintf(name, name_size, "ftbundle-%.16s", hex);
+
+    /* Only read back to be sent, so nothing is synced */
+    memset(&policy, 0, sizeof(policy));
+    policy.durability = DURABILITY_NONE;
+    if (file_output_open(&out, dir, name, offset, &policy, 0, path, path_size, error) != 0) {
+        LOG_ERROR("Failed to create bundle in %s", dir);
+        free(manifest);
+        return -1;
+    }
+    if (file_output_write(&out, 0, manifest, manifest_size, error) != 0) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        /* The kernel copies the data where it can; an empty range would mean "to the end" to a reflink */
+        if (entries[i].size > 0 &&
+            file_output_copy(&out, entries[i].offset, sources[i], 0, (size_t)entries[i].size, NULL, error) != 0) {
+            LOG_ERROR("Failed to add %s to bundle", sources[i]);
+            goto fail;
+        }
+    }
+    free(manifest);
+    if (file_output_close(&out, 0, error) != 0) {
+        file_delete(path);
+        return -1;
+    }
+    return 0;
+
+fail:
+    free(manifest);
+    file_output_close(&out, 0, NULL);
+    file_delete(path);
+    return -1;
+}
+
+/* Unpack one file */
+static int extract_entry(const char *path, const BundleEntry *entry, const char *name,
+                         const char *output_dir, const WritePolicy *policy) {
+    char temp_path[1024];
+    char final_path[1024];
+    FTErrorCode error;
+
+    file_temp_path(output_dir, name, temp_path, sizeof(temp_path));
+    file_build_path(output_dir, name, final_path, sizeof(final_path));
+    if (file_copy_range(path, entry->offset, (size_t)entry->size, temp_path,
+                        policy->durability != DURABILITY_NONE, NULL, &error) != 0) {
+        LOG_ERROR("Failed to unpack %s: %s", name, protocol_get_error_string(error));
+        file_delete(temp_path);
+        return -1;
+    }
+    if (entry->flags & FT_BUNDLE_ENTRY_ATTRS) {
+        file_set_attributes(temp_path, entry->mode, entry->timestamp);
+    }
+    if (file_create_parents(output_dir, name) != 0 || file_finalize_write(temp_path, final_path) != 0) {
+        file_delete(temp_path);
+        return -1;
+    }
+    LOG_DEBUG("Unpacked %s (%llu bytes)", final_path, (unsigned long long)entry->size);
+    return 0;
+}
+
+/* Unpack bundle entries */
+uint32_t bundle_extract(const char *path, uint64_t bundle_size, uint32_t entry_count, uint32_t first,
+                        uint32_t count, const char *output_dir, const WritePolicy *policy) {
+    uint64_t data_offset = bundle_data_offset(entry_count);
+    uint8_t header[FT_BUNDLE_HEADER_SIZE];
+    uint8_t *manifest = NULL;
+    uint32_t extracted = 0;
+    size_t bytes_read;
+    FTErrorCode error;
+
+    if (first > entry_count || count > entry_count - first || bundle_size < data_offset) {
+        LOG_ERROR("Bundle entries %u+%u out of range", first, count);
+        return 0;
+    }
+    FILE *bundle = file_open_read(path, &error);
+    if (bundle == NULL) {
+        return 0;
+    }
+
+    /* This worker's part of the manifest */
+    size_t manifest_size = (size_t)count * FT_BUNDLE_ENTRY_SIZE;
+    manifest = (uint8_t*)malloc(manifest_size > 0 ? manifest_size : 1);
+    if (manifest == NULL ||
+        file_read_chunk(bundle, 0, header, sizeof(header), &bytes_read, &error) != 0 ||
+        bytes_read != sizeof(header) ||
+        file_read_chunk(bundle, FT_BUNDLE_HEADER_SIZE + (uint64_t)first * FT_BUNDLE_ENTRY_SIZE, manifest,
+                        manifest_size, &bytes_read, &error) != 0 ||
+        bytes_read != manifest_size) {
+        LOG_ERROR("Failed to read bundle manifest");
+        goto done;
+    }
+    if (get_u32(header) != FT_BUNDLE_MAGIC || get_u32(header + 4) != entry_count) {
+        LOG_ERROR("Not a bundle of %u files", entry_count);
+        goto done;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        BundleEntry entry;
+        char name[FT_MAX_FILENAME_LEN];
+
+        deserialize_entry(manifest + (size_t)i * FT_BUNDLE_ENTRY_SIZE, &entry);
+        if (file_sanitize_path(entry.name, name, sizeof(name)) != 0) {
+            LOG_ERROR("Invalid filename in bundle: %s", entry.name);
+            continue;
+        }
+        if (entry.offset < data_offset || entry.offset > bundle_size || entry.size > bundle_size - entry.offset) {
+            LOG_ERROR("Bundle entry %s lies outside the bundle", name);
+            continue;
+        }
+        if (extract_entry(path, &entry, name, output_dir, policy) == 0) {
+            extracted++;
+        }
+    }
+
+done:
+    free(manifest);
+    fclose(bundle);
+    return extracted;
+}
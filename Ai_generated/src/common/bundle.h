@@ -0,0 +1,63 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+#include "fileio.h"
+
+/*
+ * Small files of a batch (FT_CAP_BATCH) packed into one file that is sent
+ * like any other and unpacked by the server once verified (FT_FILE_BUNDLE).
+ * Their data fills whole chunks, and the round trips of announcing and
+ * verifying a file are paid once per bundle instead of once per file.
+ *
+ *   header  magic(4) entry_count(4) reserved(8)
+ *   entry   offset(8) size(8) timestamp(8) mode(4) flags(2) reserved(2) name(256)
+ *
+ * The manifest of fixed-size entries follows the header, then the files'
+ * data back to back. Fixed-size entries let the server split a bundle
+ * between workers without reading the manifest first. Fields are in
+ * network byte order.
+ */
+
+#define FT_BUNDLE_MAGIC        0x46544231          /* "FTB1" */
+#define FT_BUNDLE_HEADER_SIZE  16
+#define FT_BUNDLE_ENTRY_SIZE   (32 + FT_MAX_FILENAME_LEN)
+#define FT_BUNDLE_FILE_MAX     (1024 * 1024)       /* Files smaller than this are bundled by default */
+#define FT_BUNDLE_MAX_BYTES    (64ULL * 1024 * 1024)  /* A bundle is closed once its data reaches this... */
+#define FT_BUNDLE_MAX_ENTRIES  4096                /* ...or it holds this many files */
+
+/* Bundle entry flags (BundleEntry.flags) */
+#define FT_BUNDLE_ENTRY_ATTRS  0x0001              /* Give the file its mode and timestamp, like FT_FILE_ATTRS */
+
+/* One file of a bundle */
+typedef struct {
+    uint64_t offset;                      /* Of its data in the bundle */
+    uint64_t size;
+    uint64_t timestamp;
+    uint32_t mode;
+    uint16_t flags;                       /* FT_BUNDLE_ENTRY_* bits */
+    char     name[FT_MAX_FILENAME_LEN];   /* Relative path */
+} BundleEntry;
+
+/* Offset of the data of a bundle of count files */
+uint64_t bundle_data_offset(uint32_t count);
+
+/* Write a bundle of count files into dir, entry i holding the data of
+ * sources[i] (its offset is filled in). The bundle is named after its
+ * manifest, so the same files sent again make the same name and an
+ * interrupted upload of it can resume; name gets the name to announce,
+ * path the file written. */
+int bundle_create(const char *dir, BundleEntry *entries, const char *const *sources, uint32_t count,
+                  char *name, size_t name_size, char *path, size_t path_size, FTErrorCode *error);
+
+/* Unpack entries [first, first + count) of the bundle at path, which holds
+ * entry_count entries in bundle_size bytes, into output_dir. Each file is
+ * written to a temp file, synced as policy asks, given its attributes and
+ * renamed into place like a received file. Returns how many were; bad
+ * entries are skipped. */
+uint32_t bundle_extract(const char *path, uint64_t bundle_size, uint32_t entry_count, uint32_t first,
+                        uint32_t count, const char *output_dir, const WritePolicy *policy);
+
+#endif /* BUNDLE_H */
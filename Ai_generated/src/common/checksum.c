@@ -1,6 +1,26 @@
 #include "checksum.h"
+#include <stdlib.h>
+#include <string.h>
 
-/* CRC32 lookup table */
+#if defined(__x86_64__) || defined(__i386__)
+    #define FT_ARCH_X86
+    #include <immintrin.h>
+    #include <cpuid.h>
+#elif defined(__aarch64__)
+    #define FT_ARCH_ARM64
+    #include <arm_acle.h>
+    #include <arm_neon.h>
+    #if defined(__linux__)
+        #include <sys/auxv.h>
+        #include <asm/hwcap.h>
+    #elif defined(__APPLE__)
+        #include <sys/sysctl.h>
+    #elif defined(_WIN32)
+        #include <windows.h>
+    #endif
+#endif
+
+/* CRC32 lookup table (IEEE 802.3, reflected polynomial 0xEDB88320) */
 static const uint32_t crc32_table[256] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -47,14 +67,741 @@ static const uint32_t crc32_table[256] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-/* Compute CRC32 checksum */
-uint32_t crc32_compute(const uint8_t *data, size_t length) {
-    uint32_t crc = 0xFFFFFFFF;
+/*
+ * All kernels operate on the raw CRC register (pre-inverted by the caller)
+ * and return the updated register, so they can be chained across buffers
+ * and mixed freely: every tier produces bit-identical results.
+ */
+typedef uint32_t (*crc32_kernel_fn)(uint32_t crc, const uint8_t *data, size_t length);
+
+/* Slicing-by-16 tables; crc32_slice_tables[0] equals crc32_table */
+static uint32_t crc32_slice_tables[16][256];
+
+/* Byte-at-a-time reference kernel */
+static uint32_t crc32_kernel_byte(uint32_t crc, const uint8_t *data, size_t length) {
     for (size_t i = 0; i < length; i++) {
         uint8_t index = (crc ^ data[i]) & 0xFF;
         crc = (crc >> 8) ^ crc32_table[index];
     }
-    return crc ^ 0xFFFFFFFF;
+    return crc;
+}
+
+/* Build slicing tables from the byte table */
+static void crc32_build_slice_tables(void) {
+    for (int i = 0; i < 256; i++) {
+        crc32_slice_tables[0][i] = crc32_table[i];
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int k = 1; k < 16; k++) {
+            uint32_t prev = crc32_slice_tables[k - 1][i];
+            crc32_slice_tables[k][i] = (prev >> 8) ^ crc32_table[prev & 0xFF];
+        }
+    }
+}
+
+/* Load 32-bit little-endian word */
+static inline uint32_t load_le32(const uint8_t *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+#else
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+#endif
+}
+
+/* Portable slicing-by-16 kernel (16 bytes per iteration) */
+static uint32_t crc32_kernel_slice16(uint32_t crc, const uint8_t *data, size_t length) {
+    const uint32_t (*t)[256] = crc32_slice_tables;
+
+    while (length >= 16) {
+        uint32_t w0 = load_le32(data) ^ crc;
+        uint32_t w1 = load_le32(data + 4);
+        uint32_t w2 = load_le32(data + 8);
+        uint32_t w3 = load_le32(data + 12);
+
+        crc = t[15][w0 & 0xFF] ^ t[14][(w0 >> 8) & 0xFF] ^
+              t[13][(w0 >> 16) & 0xFF] ^ t[12][w0 >> 24] ^
+              t[11][w1 & 0xFF] ^ t[10][(w1 >> 8) & 0xFF] ^
+              t[9][(w1 >> 16) & 0xFF] ^ t[8][w1 >> 24] ^
+              t[7][w2 & 0xFF] ^ t[6][(w2 >> 8) & 0xFF] ^
+              t[5][(w2 >> 16) & 0xFF] ^ t[4][w2 >> 24] ^
+              t[3][w3 & 0xFF] ^ t[2][(w3 >> 8) & 0xFF] ^
+              t[1][(w3 >> 16) & 0xFF] ^ t[0][w3 >> 24];
+
+        data += 16;
+        length -= 16;
+    }
+
+    return crc32_kernel_byte(crc, data, length);
+}
+
+#ifdef FT_ARCH_X86
+/*
+ * Carry-less multiplication folding (Intel, "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction"). Fold constants are
+ * x^(D+32) and x^(D-32) mod P, bit-reflected and shifted left by one, for a
+ * fold distance of D bits.
+ */
+#define CRC32_K_FOLD_512_LO   0x154442bd4ULL   /* 4 x 128-bit lanes */
+#define CRC32_K_FOLD_512_HI   0x1c6e41596ULL
+#define CRC32_K_FOLD_128_LO   0x1751997d0ULL   /* 1 x 128-bit lane */
+#define CRC32_K_FOLD_128_HI   0x0ccaa009eULL
+#define CRC32_K_FOLD_64       0x163cd6124ULL   /* 128 -> 64 bits */
+#define CRC32_BARRETT_MU      0x1f7011641ULL   /* floor(x^64 / P), reflected */
+#define CRC32_BARRETT_POLY    0x1db710641ULL   /* P, reflected */
+
+/* Fold one 128-bit accumulator into the next block */
+#define CRC32_FOLD128(acc, k, next) \
+    _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((acc), (k), 0x00), \
+                                _mm_clmulepi64_si128((acc), (k), 0x11)), (next))
+
+/* Reduce a 128-bit accumulator to the 32-bit CRC register */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_reduce128(__m128i x1) {
+    const __m128i k128 = _mm_set_epi64x(CRC32_K_FOLD_128_HI, CRC32_K_FOLD_128_LO);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x2;
+
+    /* Fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, k128, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_set_epi64x(0, CRC32_K_FOLD_64);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_set_epi64x(CRC32_BARRETT_MU, CRC32_BARRETT_POLY);
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+/* PCLMULQDQ kernel: folds 64 bytes per iteration */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_kernel_pclmul(uint32_t crc, const uint8_t *data, size_t length) {
+    if (length < 64) {
+        return crc32_kernel_slice16(crc, data, length);
+    }
+
+    const __m128i k512 = _mm_set_epi64x(CRC32_K_FOLD_512_HI, CRC32_K_FOLD_512_LO);
+    const __m128i k128 = _mm_set_epi64x(CRC32_K_FOLD_128_HI, CRC32_K_FOLD_128_LO);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    length -= 64;
+
+    /* Parallel fold of four 128-bit lanes */
+    while (length >= 64) {
+        x1 = CRC32_FOLD128(x1, k512, _mm_loadu_si128((const __m128i*)(data + 0x00)));
+        x2 = CRC32_FOLD128(x2, k512, _mm_loadu_si128((const __m128i*)(data + 0x10)));
+        x3 = CRC32_FOLD128(x3, k512, _mm_loadu_si128((const __m128i*)(data + 0x20)));
+        x4 = CRC32_FOLD128(x4, k512, _mm_loadu_si128((const __m128i*)(data + 0x30)));
+        data += 64;
+        length -= 64;
+    }
+
+    /* Fold lanes into one */
+    x1 = CRC32_FOLD128(x1, k128, x2);
+    x1 = CRC32_FOLD128(x1, k128, x3);
+    x1 = CRC32_FOLD128(x1, k128, x4);
+
+    /* Single 128-bit folds */
+    while (length >= 16) {
+        x1 = CRC32_FOLD128(x1, k128, _mm_loadu_si128((const __m128i*)data));
+        data += 16;
+        length -= 16;
+    }
+
+    return crc32_kernel_slice16(crc32_reduce128(x1), data, length);
+}
+
+#define CRC32_K_FOLD_2048_LO  0x11542778aULL   /* 4 x 512-bit registers */
+#define CRC32_K_FOLD_2048_HI  0x1322d1430ULL
+#define CRC32_K_FOLD_384_LO   0x03db1ecdcULL   /* Lane 0 of a 512-bit register */
+#define CRC32_K_FOLD_384_HI   0x174359406ULL
+#define CRC32_K_FOLD_256_LO   0x0f1da05aaULL   /* Lane 1 */
+#define CRC32_K_FOLD_256_HI   0x15a546366ULL
+
+/* Fold one 512-bit accumulator (four independent 128-bit lanes) into the next block */
+#define CRC32_FOLD512(acc, k, next) \
+    _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128((acc), (k), 0x00), \
+                              _mm512_clmulepi64_epi128((acc), (k), 0x11), (next), 0x96)
+
+/* VPCLMULQDQ (AVX-512) kernel: folds 256 bytes per iteration */
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.1")))
+static uint32_t crc32_kernel_vpclmul(uint32_t crc, const uint8_t *data, size_t length) {
+    if (length < 256) {
+        return crc32_kernel_pclmul(crc, data, length);
+    }
+
+    const __m512i k2048 = _mm512_broadcast_i32x4(_mm_set_epi64x(CRC32_K_FOLD_2048_HI, CRC32_K_FOLD_2048_LO));
+    const __m512i k512 = _mm512_broadcast_i32x4(_mm_set_epi64x(CRC32_K_FOLD_512_HI, CRC32_K_FOLD_512_LO));
+
+    __m512i z0 = _mm512_loadu_si512((const void*)(data + 0x00));
+    __m512i z1 = _mm512_loadu_si512((const void*)(data + 0x40));
+    __m512i z2 = _mm512_loadu_si512((const void*)(data + 0x80));
+    __m512i z3 = _mm512_loadu_si512((const void*)(data + 0xC0));
+    z0 = _mm512_xor_si512(z0, _mm512_zextsi128_si512(_mm_cvtsi32_si128((int)crc)));
+    data += 256;
+    length -= 256;
+
+    /* Parallel fold of four 512-bit registers */
+    while (length >= 256) {
+        z0 = CRC32_FOLD512(z0, k2048, _mm512_loadu_si512((const void*)(data + 0x00)));
+        z1 = CRC32_FOLD512(z1, k2048, _mm512_loadu_si512((const void*)(data + 0x40)));
+        z2 = CRC32_FOLD512(z2, k2048, _mm512_loadu_si512((const void*)(data + 0x80)));
+        z3 = CRC32_FOLD512(z3, k2048, _mm512_loadu_si512((const void*)(data + 0xC0)));
+        data += 256;
+        length -= 256;
+    }
+
+    /* Fold registers into one */
+    z0 = CRC32_FOLD512(z0, k512, z1);
+    z0 = CRC32_FOLD512(z0, k512, z2);
+    z0 = CRC32_FOLD512(z0, k512, z3);
+
+    while (length >= 64) {
+        z0 = CRC32_FOLD512(z0, k512, _mm512_loadu_si512((const void*)data));
+        data += 64;
+        length -= 64;
+    }
+
+    /* Fold the four lanes of the register into 128 bits */
+    const __m128i k384 = _mm_set_epi64x(CRC32_K_FOLD_384_HI, CRC32_K_FOLD_384_LO);
+    const __m128i k256 = _mm_set_epi64x(CRC32_K_FOLD_256_HI, CRC32_K_FOLD_256_LO);
+    const __m128i k128 = _mm_set_epi64x(CRC32_K_FOLD_128_HI, CRC32_K_FOLD_128_LO);
+    __m128i x0 = _mm512_extracti32x4_epi32(z0, 0);
+    __m128i x1 = _mm512_extracti32x4_epi32(z0, 1);
+    __m128i x2 = _mm512_extracti32x4_epi32(z0, 2);
+    __m128i x3 = _mm512_extracti32x4_epi32(z0, 3);
+    x3 = CRC32_FOLD128(x0, k384, x3);
+    x3 = CRC32_FOLD128(x1, k256, x3);
+    x3 = CRC32_FOLD128(x2, k128, x3);
+
+    /* Single 128-bit folds */
+    while (length >= 16) {
+        x3 = CRC32_FOLD128(x3, k128, _mm_loadu_si128((const __m128i*)data));
+        data += 16;
+        length -= 16;
+    }
+
+    return crc32_kernel_slice16(crc32_reduce128(x3), data, length);
+}
+#endif /* FT_ARCH_X86 */
+
+#ifdef FT_ARCH_ARM64
+#if defined(__clang__)
+    #define FT_TARGET_CRC __attribute__((target("crc")))
+#else
+    #define FT_TARGET_CRC __attribute__((target("+crc")))
+#endif
+
+/* ARMv8 CRC32 instructions (IEEE polynomial, not the CRC32C variants) */
+FT_TARGET_CRC
+static uint32_t crc32_kernel_armv8(uint32_t crc, const uint8_t *data, size_t length) {
+    /* Align to 8 bytes so the main loop issues aligned loads */
+    while (length > 0 && ((uintptr_t)data & 7) != 0) {
+        crc = __crc32b(crc, *data++);
+        length--;
+    }
+
+    /* Four independent-ish loads per iteration keep the CRC unit busy */
+    while (length >= 32) {
+        uint64_t w0, w1, w2, w3;
+        memcpy(&w0, data, 8);
+        memcpy(&w1, data + 8, 8);
+        memcpy(&w2, data + 16, 8);
+        memcpy(&w3, data + 24, 8);
+        crc = __crc32d(crc, w0);
+        crc = __crc32d(crc, w1);
+        crc = __crc32d(crc, w2);
+        crc = __crc32d(crc, w3);
+        data += 32;
+        length -= 32;
+    }
+    while (length >= 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        crc = __crc32d(crc, w);
+        data += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = __crc32b(crc, *data++);
+        length--;
+    }
+    return crc;
+}
+
+/* Runtime detection of the ARMv8 CRC32 extension */
+static int arm_has_crc32(void) {
+#if defined(__ARM_FEATURE_CRC32)
+    return 1;  /* Guaranteed by the compilation target */
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname("hw.optional.armv8_crc32", &value, &size, NULL, 0) == 0 && value != 0;
+#elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+    return 0;
+#endif
+}
+#endif /* FT_ARCH_ARM64 */
+
+/* Kernel registry, fastest first */
+typedef struct {
+    const char *name;
+    crc32_kernel_fn kernel;
+    int (*supported)(void);
+} Crc32Impl;
+
+static int always_supported(void) {
+    return 1;
+}
+
+#ifdef FT_ARCH_X86
+static int x86_has_pclmul(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+static int x86_has_vpclmul(void) {
+    __builtin_cpu_init();
+    return x86_has_pclmul() && __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("vpclmulqdq");
+}
+#endif
+
+static const Crc32Impl crc32_impls[] = {
+#ifdef FT_ARCH_X86
+    { "vpclmulqdq", crc32_kernel_vpclmul, x86_has_vpclmul },
+    { "pclmulqdq",  crc32_kernel_pclmul,  x86_has_pclmul },
+#endif
+#ifdef FT_ARCH_ARM64
+    { "armv8-crc32", crc32_kernel_armv8, arm_has_crc32 },
+#endif
+    { "slice16", crc32_kernel_slice16, always_supported },
+    { "byte",    crc32_kernel_byte,    always_supported },
+};
+
+#define CRC32_NUM_IMPLS (sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+
+static const Crc32Impl *crc32_active = NULL;
+
+/* Select the fastest supported kernel (idempotent) */
+void crc32_init(void) {
+    if (__atomic_load_n(&crc32_active, __ATOMIC_ACQUIRE) != NULL) {
+        return;
+    }
+
+    crc32_build_slice_tables();
+    const char *forced = getenv("FT_CRC32_IMPL");
+    const Crc32Impl *chosen = NULL;
+    for (size_t i = 0; i < CRC32_NUM_IMPLS && chosen == NULL; i++) {
+        if (forced != NULL && strcmp(forced, crc32_impls[i].name) != 0) {
+            continue;
+        }
+        if (crc32_impls[i].supported()) {
+            chosen = &crc32_impls[i];
+        }
+    }
+    if (chosen == NULL) {
+        /* Unknown or unsupported override: fall back to autodetection */
+        for (size_t i = 0; i < CRC32_NUM_IMPLS && chosen == NULL; i++) {
+            if (crc32_impls[i].supported()) {
+                chosen = &crc32_impls[i];
+            }
+        }
+    }
+
+    /* Tables are published before the kernel pointer (release/acquire) */
+    __atomic_store_n(&crc32_active, chosen, __ATOMIC_RELEASE);
+}
+
+/* Select kernel by name */
+int crc32_set_implementation(const char *name) {
+    crc32_init();
+    for (size_t i = 0; i < CRC32_NUM_IMPLS; i++) {
+        if (strcmp(name, crc32_impls[i].name) == 0 && crc32_impls[i].supported()) {
+            __atomic_store_n(&crc32_active, &crc32_impls[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Name of the active kernel */
+const char* crc32_implementation(void) {
+    crc32_init();
+    return crc32_active->name;
+}
+
+/* Incremental CRC32 update */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+    const Crc32Impl *impl = __atomic_load_n(&crc32_active, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        crc32_init();
+        impl = crc32_active;
+    }
+    return impl->kernel(crc ^ 0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+}
+
+/* Compute CRC32 checksum */
+uint32_t crc32_compute(const uint8_t *data, size_t length) {
+    return crc32_update(0, data, length);
+}
+
+/* ------------------------------------------------------------------------
+ * SHA-256 (FIPS 180-4)
+ * ------------------------------------------------------------------------ */
+
+/* Compress `blocks` 64-byte blocks into state */
+typedef void (*sha256_compress_fn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_initial_state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Portable compression function */
+static void sha256_compress_generic(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    while (blocks--) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+            uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef FT_ARCH_X86
+
+/* SHA extensions (SHA-NI): 4 rounds per pair of SHA256RNDS2 */
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, msg, tmp;
+
+    /* Reorder state words into the ABEF/CDGH layout the instructions expect */
+    tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);              /* CDAB */
+    state1 = _mm_shuffle_epi32(state1, 0x1B);        /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);        /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);     /* CDGH */
+
+    while (blocks--) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i w[4];
+
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + g * 16)), byte_swap);
+            } else {
+                /* W[g] from W[g-4], W[g-3], W[g-2], W[g-1] */
+                tmp = _mm_alignr_epi8(w[(g + 3) % 4], w[(g + 2) % 4], 4);
+                w[g % 4] = _mm_add_epi32(_mm_sha256msg1_epu32(w[g % 4], w[(g + 1) % 4]), tmp);
+                w[g % 4] = _mm_sha256msg2_epu32(w[g % 4], w[(g + 3) % 4]);
+            }
+
+            msg = _mm_add_epi32(w[g % 4], _mm_loadu_si128((const __m128i*)&sha256_k[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);           /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);        /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);     /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        /* HGFE */
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static int x86_has_sha(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & bit_SHA) != 0;
+}
+#endif /* FT_ARCH_X86 */
+
+#ifdef FT_ARCH_ARM64
+#if defined(__clang__)
+    #define FT_TARGET_SHA2 __attribute__((target("sha2")))
+#else
+    #define FT_TARGET_SHA2 __attribute__((target("+crypto")))
+#endif
+
+/* ARMv8 cryptography extensions */
+FT_TARGET_SHA2
+static void sha256_compress_armv8(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    while (blocks--) {
+        uint32x4_t abcd_save = state0;
+        uint32x4_t efgh_save = state1;
+        uint32x4_t w[4];
+
+        for (int i = 0; i < 4; i++) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+        }
+
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            uint32x4_t wk = vaddq_u32(w[g % 4], vld1q_u32(&sha256_k[g * 4]));
+            if (g < 12) {
+                /* W[g+4] from W[g], W[g+1], W[g+2], W[g+3] */
+                w[g % 4] = vsha256su1q_u32(vsha256su0q_u32(w[g % 4], w[(g + 1) % 4]),
+                                           w[(g + 2) % 4], w[(g + 3) % 4]);
+            }
+            uint32x4_t abcd = state0;
+            state0 = vsha256hq_u32(state0, state1, wk);
+            state1 = vsha256h2q_u32(state1, abcd, wk);
+        }
+
+        state0 = vaddq_u32(state0, abcd_save);
+        state1 = vaddq_u32(state1, efgh_save);
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+
+static int arm_has_sha2(void) {
+#if defined(__ARM_FEATURE_SHA2)
+    return 1;
+#elif defined(__linux__) && defined(HWCAP_SHA2)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname("hw.optional.arm.FEAT_SHA256", &value, &size, NULL, 0) == 0 && value != 0;
+#elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+    return 0;
+#endif
+}
+#endif /* FT_ARCH_ARM64 */
+
+/* Kernel registry, fastest first */
+typedef struct {
+    const char *name;
+    sha256_compress_fn compress;
+    int (*supported)(void);
+} Sha256Impl;
+
+static const Sha256Impl sha256_impls[] = {
+#ifdef FT_ARCH_X86
+    { "sha-ni", sha256_compress_shani, x86_has_sha },
+#endif
+#ifdef FT_ARCH_ARM64
+    { "armv8-sha2", sha256_compress_armv8, arm_has_sha2 },
+#endif
+    { "generic", sha256_compress_generic, always_supported },
+};
+
+#define SHA256_NUM_IMPLS (sizeof(sha256_impls) / sizeof(sha256_impls[0]))
+
+static const Sha256Impl *sha256_active = NULL;
+
+/* Active compression function, selecting one on first use */
+static sha256_compress_fn sha256_get_compress(void) {
+    const Sha256Impl *impl = __atomic_load_n(&sha256_active, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        sha256_init_dispatch();
+        impl = sha256_active;
+    }
+    return impl->compress;
+}
+
+/* Select the fastest supported SHA-256 kernel (idempotent) */
+void sha256_init_dispatch(void) {
+    if (__atomic_load_n(&sha256_active, __ATOMIC_ACQUIRE) != NULL) {
+        return;
+    }
+
+    const char *forced = getenv("FT_SHA256_IMPL");
+    const Sha256Impl *chosen = NULL;
+    for (size_t i = 0; i < SHA256_NUM_IMPLS && chosen == NULL; i++) {
+        if (forced != NULL && strcmp(forced, sha256_impls[i].name) != 0) {
+            continue;
+        }
+        if (sha256_impls[i].supported()) {
+            chosen = &sha256_impls[i];
+        }
+    }
+    if (chosen == NULL) {
+        /* Unknown or unsupported override: fall back to autodetection */
+        for (size_t i = 0; i < SHA256_NUM_IMPLS && chosen == NULL; i++) {
+            if (sha256_impls[i].supported()) {
+                chosen = &sha256_impls[i];
+            }
+        }
+    }
+    __atomic_store_n(&sha256_active, chosen, __ATOMIC_RELEASE);
+}
+
+/* Select SHA-256 kernel by name */
+int sha256_set_implementation(const char *name) {
+    for (size_t i = 0; i < SHA256_NUM_IMPLS; i++) {
+        if (strcmp(name, sha256_impls[i].name) == 0 && sha256_impls[i].supported()) {
+            __atomic_store_n(&sha256_active, &sha256_impls[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Name of the active SHA-256 kernel */
+const char* sha256_implementation(void) {
+    sha256_get_compress();
+    return sha256_active->name;
+}
+
+/* Initialize SHA-256 context */
+void sha256_init(Sha256Context *ctx) {
+    memcpy(ctx->state, sha256_initial_state, sizeof(ctx->state));
+    ctx->total_bytes = 0;
+    ctx->buffer_len = 0;
 }
 
-/* TODO: Implement SHA-256 and incremental checksum contexts */
+/* Feed data into SHA-256 context */
+void sha256_update(Sha256Context *ctx, const uint8_t *data, size_t length) {
+    sha256_compress_fn compress = sha256_get_compress();
+    ctx->total_bytes += length;
+
+    /* Complete a partially filled block first */
+    if (ctx->buffer_len > 0) {
+        size_t take = FT_SHA256_BLOCK_SIZE - ctx->buffer_len;
+        if (take > length) {
+            take = length;
+        }
+        memcpy(ctx->buffer + ctx->buffer_len, data, take);
+        ctx->buffer_len += take;
+        data += take;
+        length -= take;
+        if (ctx->buffer_len < FT_SHA256_BLOCK_SIZE) {
+            return;
+        }
+        compress(ctx->state, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    /* Whole blocks straight from the input */
+    size_t blocks = length / FT_SHA256_BLOCK_SIZE;
+    if (blocks > 0) {
+        compress(ctx->state, data, blocks);
+        data += blocks * FT_SHA256_BLOCK_SIZE;
+        length -= blocks * FT_SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buffer, data, length);
+    ctx->buffer_len = length;
+}
+
+/* Finish SHA-256 and write the digest */
+void sha256_final(Sha256Context *ctx, uint8_t digest[FT_SHA256_DIGEST_SIZE]) {
+    sha256_compress_fn compress = sha256_get_compress();
+    uint64_t total_bits = ctx->total_bytes * 8;
+
+    /* Padding: 0x80, zeros, 64-bit big-endian message length */
+    ctx->buffer[ctx->buffer_len++] = 0x80;
+    if (ctx->buffer_len > FT_SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->buffer + ctx->buffer_len, 0, FT_SHA256_BLOCK_SIZE - ctx->buffer_len);
+        compress(ctx->state, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+    memset(ctx->buffer + ctx->buffer_len, 0, FT_SHA256_BLOCK_SIZE - 8 - ctx->buffer_len);
+    for (int i = 0; i < 8; i++) {
+        ctx->buffer[FT_SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(total_bits >> (i * 8));
+    }
+    compress(ctx->state, ctx->buffer, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+/* One-shot SHA-256 */
+void sha256_compute(const uint8_t *data, size_t length, uint8_t digest[FT_SHA256_DIGEST_SIZE]) {
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, length);
+    sha256_final(&ctx, digest);
+}
+
+/* Format digest as hex */
+void sha256_to_hex(const uint8_t digest[FT_SHA256_DIGEST_SIZE], char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < FT_SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0F];
+    }
+    hex[FT_SHA256_DIGEST_SIZE * 2] = '\0';
+}
@@ -4,10 +4,58 @@
 #include <stdint.h>
 #include <stddef.h>
 
-/* CRC32 Functions (minimal implementation for protocol) */
+/* CRC32 Functions (IEEE 802.3 polynomial) */
+
+/* Select the fastest kernel for this CPU (called once at startup; the
+ * FT_CRC32_IMPL environment variable may force a kernel by name) */
+void crc32_init(void);
+
+/* Force a kernel by name ("vpclmulqdq", "pclmulqdq", "armv8-crc32",
+ * "slice16", "byte"); returns -1 if unknown or unsupported on this CPU */
+int crc32_set_implementation(const char *name);
+
+/* Name of the active kernel */
+const char* crc32_implementation(void);
+
+/* Compute CRC32 of a buffer */
 uint32_t crc32_compute(const uint8_t *data, size_t length);
 
-/* TODO: Implement SHA-256 for file integrity checking */
-/* TODO: Implement incremental checksum contexts */
+/* Continue a CRC32 across buffers: crc32_update(crc32_compute(a), b) equals
+ * the CRC32 of a followed by b (start from 0) */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+
+/* SHA-256 Functions */
+
+#define FT_SHA256_DIGEST_SIZE  32
+#define FT_SHA256_BLOCK_SIZE   64
+
+/* Incremental SHA-256 context */
+typedef struct {
+    uint32_t state[8];
+    uint64_t total_bytes;
+    uint8_t  buffer[FT_SHA256_BLOCK_SIZE];
+    size_t   buffer_len;
+} Sha256Context;
+
+/* Select the fastest SHA-256 kernel (SHA-NI, ARMv8 crypto or portable);
+ * called once at startup, FT_SHA256_IMPL may force one by name */
+void sha256_init_dispatch(void);
+
+/* Force a kernel by name ("sha-ni", "armv8-sha2", "generic");
+ * returns -1 if unknown or unsupported on this CPU */
+int sha256_set_implementation(const char *name);
+
+/* Name of the active kernel */
+const char* sha256_implementation(void);
+
+void sha256_init(Sha256Context *ctx);
+void sha256_update(Sha256Context *ctx, const uint8_t *data, size_t length);
+void sha256_final(Sha256Context *ctx, uint8_t digest[FT_SHA256_DIGEST_SIZE]);
+
+/* One-shot SHA-256 of a buffer */
+void sha256_compute(const uint8_t *data, size_t length, uint8_t digest[FT_SHA256_DIGEST_SIZE]);
+
+/* Format digest as lowercase hex (hex must hold 2 * FT_SHA256_DIGEST_SIZE + 1 bytes) */
+void sha256_to_hex(const uint8_t digest[FT_SHA256_DIGEST_SIZE], char *hex);
 
 #endif /* CHECKSUM_H */
@@ -0,0 +1,210 @@
+#include "chunkring.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* How often a producer waiting for the buffer pool checks for failure */
+#define RING_POOL_POLL_MS 100
+
+/* Allocate ring */
+int chunk_ring_init(ChunkRing *ring, uint32_t capacity, size_t chunk_size) {
+    memset(ring, 0, sizeof(ChunkRing));
+    if (capacity == 0) {
+        return FT_ERR_INVALID_ARG;
+    }
+
+    ring->entries = (RingEntry*)calloc(capacity, sizeof(RingEntry));
+    if (ring->entries == NULL) {
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    ring->capacity = capacity;
+    ring->limit = capacity;
+    ring->chunk_size = chunk_size;
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        wait_group_init(&ring->entries[i].pending);
+    }
+    platform_mutex_init(&ring->lock);
+    platform_cond_init(&ring->not_empty);
+    platform_cond_init(&ring->not_full);
+    return FT_SUCCESS;
+}
+
+/* Free ring */
+void chunk_ring_destroy(ChunkRing *ring) {
+    if (ring->entries == NULL) {
+        return;
+    }
+
+    buffer_pool_cancel_wait(&ring->waiter);
+    for (uint32_t i = 0; i < ring->capacity; i++) {
+        buffer_pool_release(ring->entries[i].data);
+        wait_group_destroy(&ring->entries[i].pending);
+    }
+    platform_cond_destroy(&ring->not_full);
+    platform_cond_destroy(&ring->not_empty);
+    platform_mutex_destroy(&ring->lock);
+    free(ring->entries);
+    ring->entries = NULL;
+    ring->capacity = 0;
+}
+
+/* Get next free entry */
+RingEntry* chunk_ring_acquire(ChunkRing *ring) {
+    platform_mutex_lock(&ring->lock);
+    while (ring->count >= ring->limit && !ring->failed) {
+        platform_cond_wait(&ring->not_full, &ring->lock);
+    }
+    if (ring->failed) {
+        platform_mutex_unlock(&ring->lock);
+        return NULL;
+    }
+    RingEntry *entry = &ring->entries[(ring->head + ring->count) % ring->capacity];
+    platform_mutex_unlock(&ring->lock);
+
+    /* The consumer may have handed the entry to background work */
+    wait_group_wait(&entry->pending);
+
+    /* Wait for the pool, checking now and then whether the ring failed */
+    while (entry->data == NULL) {
+        entry->data = buffer_pool_acquire(ring->chunk_size, RING_POOL_POLL_MS);
+        if (entry->data == NULL) {
+            platform_mutex_lock(&ring->lock);
+            int failed = ring->failed;
+            platform_mutex_unlock(&ring->lock);
+            if (failed) {
+                return NULL;
+            }
+        }
+    }
+    return entry;
+}
+
+/* Get next free entry without waiting */
+int chunk_ring_try_acquire(ChunkRing *ring, RingEntry **entry) {
+    int result = 0;
+
+    platform_mutex_lock(&ring->lock);
+    if (ring->failed) {
+        result = -1;
+    } else if (ring->count < ring->limit) {
+        RingEntry *next = &ring->entries[(ring->head + ring->count) % ring->capacity];
+        if (wait_group_idle(&next->pending) && next->data == NULL) {
+            next->data = buffer_pool_try_acquire(ring->chunk_size,
+                                                 ring->waiter.notify != NULL ? &ring->waiter : NULL);
+        }
+        if (next->data != NULL && wait_group_idle(&next->pending)) {
+            *entry = next;
+            result = 1;
+        }
+    }
+    platform_mutex_unlock(&ring->lock);
+    return result;
+}
+
+/* Set queue depth limit */
+void chunk_ring_set_limit(ChunkRing *ring, uint32_t limit) {
+    if (limit < 1) {
+        limit = 1;
+    }
+    if (limit > ring->capacity) {
+        limit = ring->capacity;
+    }
+
+    platform_mutex_lock(&ring->lock);
+    if (limit > ring->limit) {
+        platform_cond_signal(&ring->not_full);
+    }
+    ring->limit = limit;
+    platform_mutex_unlock(&ring->lock);
+}
+
+/* Queue acquired entry */
+void chunk_ring_publish(ChunkRing *ring) {
+    platform_mutex_lock(&ring->lock);
+    ring->count++;
+    platform_cond_signal(&ring->not_empty);
+    platform_mutex_unlock(&ring->lock);
+}
+
+/* Mark producer done */
+void chunk_ring_close(ChunkRing *ring) {
+    platform_mutex_lock(&ring->lock);
+    ring->closed = 1;
+    platform_cond_broadcast(&ring->not_empty);
+    platform_mutex_unlock(&ring->lock);
+}
+
+/* Wait for oldest entry */
+int chunk_ring_peek(ChunkRing *ring, uint32_t timeout_ms, RingEntry **entry) {
+    return chunk_ring_peek_batch(ring, timeout_ms, entry, 1);
+}
+
+/* Wait for oldest entries */
+int chunk_ring_peek_batch(ChunkRing *ring, uint32_t timeout_ms, RingEntry **entries, uint32_t max) {
+    int result;
+
+    platform_mutex_lock(&ring->lock);
+    while (ring->count == 0 && !ring->closed && !ring->failed) {
+        if (timeout_ms == FT_RING_WAIT_FOREVER) {
+            platform_cond_wait(&ring->not_empty, &ring->lock);
+        } else if (platform_cond_timedwait(&ring->not_empty, &ring->lock, timeout_ms) != 0) {
+            break;
+        }
+    }
+
+    if (ring->failed || (ring->count == 0 && ring->closed)) {
+        result = -1;
+    } else if (ring->count == 0) {
+        result = 0;
+    } else {
+        uint32_t count = ring->count < max ? ring->count : max;
+        for (uint32_t i = 0; i < count; i++) {
+            entries[i] = &ring->entries[(ring->head + i) % ring->capacity];
+        }
+        result = (int)count;
+    }
+    platform_mutex_unlock(&ring->lock);
+    return result;
+}
+
+/* Release oldest entry */
+void chunk_ring_consume(ChunkRing *ring) {
+    RingEntry *entry = &ring->entries[ring->head];
+    uint8_t *data = entry->data;
+    entry->data = NULL;
+
+    platform_mutex_lock(&ring->lock);
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    platform_cond_signal(&ring->not_full);
+    platform_mutex_unlock(&ring->lock);
+
+    buffer_pool_release(data);
+}
+
+/* Pause consumer */
+int chunk_ring_pause(ChunkRing *ring, uint32_t timeout_ms) {
+    uint64_t deadline = platform_get_monotonic_ms() + timeout_ms;
+
+    platform_mutex_lock(&ring->lock);
+    /* Woken by every publish too, so wait out the rest after each */
+    for (uint64_t now = platform_get_monotonic_ms(); !ring->failed && now < deadline;
+         now = platform_get_monotonic_ms()) {
+        platform_cond_timedwait(&ring->not_empty, &ring->lock, (uint32_t)(deadline - now));
+    }
+    int failed = ring->failed;
+    platform_mutex_unlock(&ring->lock);
+    return failed ? -1 : 0;
+}
+
+/* Abort ring */
+void chunk_ring_fail(ChunkRing *ring, FTErrorCode error) {
+    platform_mutex_lock(&ring->lock);
+    if (!ring->failed) {
+        ring->failed = 1;
+        ring->error = error;
+    }
+    platform_cond_broadcast(&ring->not_empty);
+    platform_cond_broadcast(&ring->not_full);
+    platform_mutex_unlock(&ring->lock);
+}
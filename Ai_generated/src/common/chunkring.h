@@ -0,0 +1,106 @@
+#ifndef CHUNKRING_H
+#define CHUNKRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+#include "threadpool.h"
+#include "bufpool.h"
+
+/* Wait forever in chunk_ring_peek() */
+#define FT_RING_WAIT_FOREVER UINT32_MAX
+
+/* What the consumer should do with an entry */
+typedef enum {
+    RING_CHUNK = 0,       /* Chunk payload to store */
+    RING_REJECT = 1,      /* Chunk failed its CRC; only the header is valid */
+    RING_DELTA = 2,       /* DELTA_DATA instructions (FT_CAP_DELTA) */
+    RING_HOLE = 3         /* Chunk of zeros (FT_FLAG_ZERO): only the header is valid */
+} RingEntryKind;
+
+/* One received chunk */
+typedef struct {
+    RingEntryKind kind;
+    ChunkHeader   header;
+    uint64_t      sequence_num;   /* Sequence number of the CHUNK_DATA message */
+    uint8_t      *data;           /* Chunk buffer from the buffer pool, taken when the entry
+                                   * is acquired and released when it is consumed (NULL
+                                   * when a consumer took it first) */
+    uint8_t      *mapped;         /* Set by the producer: the chunk was received into this
+                                   * place in a file mapping instead of data */
+    WaitGroup     pending;        /* Background work still reading data */
+} RingEntry;
+
+/*
+ * Fixed ring of chunk buffers between one producer (network receive) and
+ * one consumer (disk writer). Entries are used in order; the producer
+ * blocks while every entry is queued or still has pending work, which is
+ * what throttles the socket when the disk falls behind. Buffers come from
+ * the shared buffer pool only while an entry is in use, so the producer
+ * also waits while the pool's budget is spent.
+ */
+typedef struct {
+    RingEntry  *entries;
+    uint32_t    capacity;
+    uint32_t    head;             /* Oldest queued entry */
+    uint32_t    count;            /* Queued entries */
+    uint32_t    limit;            /* Producer waits while count reaches this (<= capacity) */
+    size_t      chunk_size;       /* Bytes per entry buffer */
+    PoolWaiter  waiter;           /* Producer's notification for chunk_ring_try_acquire()
+                                   * failing on the pool (optional: set notify) */
+    int         closed;           /* Producer is done */
+    int         failed;
+    FTErrorCode error;
+    ft_mutex_t  lock;
+    ft_cond_t   not_empty;
+    ft_cond_t   not_full;
+} ChunkRing;
+
+/* Allocate capacity entries for chunk_size buffers */
+int chunk_ring_init(ChunkRing *ring, uint32_t capacity, size_t chunk_size);
+
+/* Free ring and release its buffers; all background work must be finished */
+void chunk_ring_destroy(ChunkRing *ring);
+
+/* Producer: return the next entry to fill, blocking until it is neither
+ * queued nor read by background work and has a buffer. NULL if the ring
+ * failed. */
+RingEntry* chunk_ring_acquire(ChunkRing *ring);
+
+/* Producer: non-blocking chunk_ring_acquire(). Returns 1 with *entry set,
+ * 0 if the next entry is still queued or read by background work or no
+ * buffer is free (the waiter is then notified once one is), -1 if the
+ * ring failed. */
+int chunk_ring_try_acquire(ChunkRing *ring, RingEntry **entry);
+
+/* Change how many entries the producer may queue ahead (1..capacity) */
+void chunk_ring_set_limit(ChunkRing *ring, uint32_t limit);
+
+/* Producer: queue the entry returned by chunk_ring_acquire() */
+void chunk_ring_publish(ChunkRing *ring);
+
+/* Producer: no more entries will be published */
+void chunk_ring_close(ChunkRing *ring);
+
+/* Consumer: wait for the oldest queued entry. Returns 1 with *entry set,
+ * 0 on timeout, -1 once the ring is closed and drained or has failed. */
+int chunk_ring_peek(ChunkRing *ring, uint32_t timeout_ms, RingEntry **entry);
+
+/* Consumer: like chunk_ring_peek(), but return up to max queued entries
+ * oldest first; the count is returned. Each is released with
+ * chunk_ring_consume() in the same order. */
+int chunk_ring_peek_batch(ChunkRing *ring, uint32_t timeout_ms, RingEntry **entries, uint32_t max);
+
+/* Consumer: release the oldest entry returned by chunk_ring_peek() and
+ * its buffer; background work still reading it must hold a reference */
+void chunk_ring_consume(ChunkRing *ring);
+
+/* Consumer: wait timeout_ms without taking entries, as when pacing
+ * writes. Returns 0, or -1 early if the ring fails meanwhile. */
+int chunk_ring_pause(ChunkRing *ring, uint32_t timeout_ms);
+
+/* Abort and wake both sides; the first error is kept */
+void chunk_ring_fail(ChunkRing *ring, FTErrorCode error);
+
+#endif /* CHUNKRING_H */
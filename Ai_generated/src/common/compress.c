@@ -0,0 +1,304 @@
+#include "compress.h"
+#include <string.h>
+
+#define LZ4_HASH_LOG       12
+#define LZ4_MIN_MATCH      4
+#define LZ4_MF_LIMIT       12         /* The last match starts this far from the end or more */
+#define LZ4_LAST_LITERALS  5          /* ...and ends this far from it */
+#define LZ4_MAX_DISTANCE   65535
+#define LZ4_MAX_INPUT      0x7E000000
+#define LZ4_SKIP_TRIGGER   6          /* Search step grows every 2^this misses */
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash4(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Length of the common prefix of a and b, not reaching past limit */
+static size_t common_length(const uint8_t *a, const uint8_t *b, const uint8_t *limit) {
+    const uint8_t *start = a;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (limit - a >= 8) {
+        uint64_t x, y;
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        if (x != y) {
+            return (size_t)(a - start) + (size_t)(__builtin_ctzll(x ^ y) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return (size_t)(a - start);
+}
+
+/* Append the 255-byte continuation of a length */
+static uint8_t* write_length(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/* Compress block */
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+    uint32_t table[1 << LZ4_HASH_LOG];
+    const uint8_t *end = src + size;
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    uint8_t *op = dst;
+    uint8_t *op_end = dst + capacity;
+
+    if (size > LZ4_MAX_INPUT) {
+        return 0;
+    }
+
+    /* Shorter blocks are all literals */
+    if (size > LZ4_MF_LIMIT) {
+        const uint8_t *match_limit = end - LZ4_MF_LIMIT;
+        uint32_t misses = 1u << LZ4_SKIP_TRIGGER;
+
+        memset(table, 0, sizeof(table));
+        table[hash4(read32(ip))] = 0;
+        ip++;
+
+        while (ip < match_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash4(sequence);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            /* Step further the longer nothing matches */
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || read32(ref) != sequence) {
+                ip += misses++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1u << LZ4_SKIP_TRIGGER;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *match_end = ip + LZ4_MIN_MATCH +
+                common_length(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, end - LZ4_LAST_LITERALS);
+
+            size_t literals = (size_t)(ip - anchor);
+            size_t match_length = (size_t)(match_end - ip) - LZ4_MIN_MATCH;
+            if ((size_t)(op_end - op) < 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1) {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op = write_length(op, literals - 15);
+            } else {
+                *token = (uint8_t)(literals << 4);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            if (match_length >= 15) {
+                *token |= 15;
+                op = write_length(op, match_length - 15);
+            } else {
+                *token |= (uint8_t)match_length;
+            }
+
+            ip = match_end;
+            anchor = ip;
+            if (ip < match_limit) {
+                table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+
+    /* Final sequence: the remaining literals, no match */
+    size_t literals = (size_t)(end - anchor);
+    if ((size_t)(op_end - op) < 1 + literals + literals / 255 + 1) {
+        return 0;
+    }
+    uint8_t *token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, literals - 15);
+    } else {
+        *token = (uint8_t)(literals << 4);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (size_t)(op - dst);
+}
+
+/* Add the 255-byte continuation of a length; -1 past the input or output */
+static int read_length(const uint8_t **ip, const uint8_t *end, size_t *length, size_t limit) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+        if (*length > limit) {
+            return -1;
+        }
+    } while (byte == 255);
+    return 0;
+}
+
+/* Decompress block */
+int lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + src_size;
+    uint8_t *op = dst;
+    uint8_t *op_end = dst + dst_size;
+
+    for (;;) {
+        if (ip >= end) {
+            return -1;
+        }
+        uint8_t token = *ip++;
+
+        /* Short literal runs are copied 16 bytes at once where both
+         * buffers have room; bytes past the run are overwritten later */
+        size_t literals = token >> 4;
+        if (literals < 15 && end - ip >= 16 && op_end - op >= 16) {
+            memcpy(op, ip, 16);
+        } else {
+            if (literals == 15 && read_length(&ip, end, &literals, dst_size) != 0) {
+                return -1;
+            }
+            if ((size_t)(end - ip) < literals || (size_t)(op_end - op) < literals) {
+                return -1;
+            }
+            memcpy(op, ip, literals);
+        }
+        op += literals;
+        ip += literals;
+
+        /* The last sequence has no match */
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && read_length(&ip, end, &match_length, dst_size) != 0) {
+            return -1;
+        }
+        match_length += LZ4_MIN_MATCH;
+        if ((size_t)(op_end - op) < match_length) {
+            return -1;
+        }
+
+        /* Overlapping copies repeat the last offset bytes; from 8 bytes
+         * back, each 8-byte step reads only bytes already written */
+        const uint8_t *ref = op - offset;
+        if (offset >= 8 && (size_t)(op_end - op) >= match_length + 8) {
+            for (size_t i = 0; i < match_length; i += 8) {
+                memcpy(op + i, ref + i, 8);
+            }
+            op += match_length;
+        } else if (offset >= match_length) {
+            memcpy(op, ref, match_length);
+            op += match_length;
+        } else {
+            for (size_t i = 0; i < match_length; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == op_end ? 0 : -1;
+}
+
+/* Initialize compressor */
+void compressor_init(Compressor *compressor) {
+    memset(compressor, 0, sizeof(*compressor));
+    compressor->backoff = 1;
+    platform_mutex_init(&compressor->lock);
+}
+
+/* Destroy compressor */
+void compressor_destroy(Compressor *compressor) {
+    platform_mutex_destroy(&compressor->lock);
+}
+
+/* Decide on the next chunk */
+int compressor_admit(Compressor *compressor) {
+    platform_mutex_lock(&compressor->lock);
+    compressor->stats.chunks++;
+    int admit = (compressor->bypass == 0);
+    if (!admit) {
+        compressor->bypass--;
+        compressor->stats.bypassed++;
+    }
+    platform_mutex_unlock(&compressor->lock);
+    return admit;
+}
+
+/* Record the outcome of a probe or compression */
+static void compressor_record(Compressor *compressor, size_t size, size_t packed_size) {
+    platform_mutex_lock(&compressor->lock);
+    if (packed_size > 0) {
+        compressor->backoff = 1;
+        compressor->stats.packed++;
+        compressor->stats.raw_bytes += size;
+        compressor->stats.wire_bytes += packed_size;
+    } else {
+        compressor->bypass = compressor->backoff;
+        if (compressor->backoff < FT_COMPRESS_MAX_BYPASS) {
+            compressor->backoff *= 2;
+        }
+    }
+    platform_mutex_unlock(&compressor->lock);
+}
+
+/* Compress chunk */
+size_t compressor_pack(Compressor *compressor, const uint8_t *data, size_t size, uint8_t *packed) {
+    size_t packed_size = 0;
+
+    /* Probe the middle of the chunk; headers at the start compress better than the rest */
+    if (size >= 2 * FT_COMPRESS_SAMPLE_SIZE) {
+        const uint8_t *sample = data + (size - FT_COMPRESS_SAMPLE_SIZE) / 2;
+        if (lz4_compress(sample, FT_COMPRESS_SAMPLE_SIZE, packed,
+                         FT_COMPRESS_SAMPLE_SIZE - FT_COMPRESS_SAMPLE_SIZE / 16) == 0) {
+            compressor_record(compressor, size, 0);
+            return 0;
+        }
+    }
+
+    packed_size = lz4_compress(data, size, packed, size - size / 16);
+    compressor_record(compressor, size, packed_size);
+    return packed_size;
+}
+
+/* Read counters */
+void compressor_get_stats(Compressor *compressor, CompressStats *stats) {
+    platform_mutex_lock(&compressor->lock);
+    *stats = compressor->stats;
+    platform_mutex_unlock(&compressor->lock);
+}
@@ -0,0 +1,58 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+
+#define FT_COMPRESS_SAMPLE_SIZE 16384      /* Bytes of a chunk compressed to probe it */
+#define FT_COMPRESS_MAX_BYPASS  64         /* Most chunks sent raw after a failed probe */
+
+/* Compress src into an LZ4 block (the LZ4 block format, no frame) of at
+ * most capacity bytes. Returns the block size, or 0 if it does not fit. */
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+
+/* Decompress an LZ4 block that must expand to exactly dst_size bytes.
+ * Malformed input is rejected without reading or writing out of bounds. */
+int lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+/* Counters of one transfer */
+typedef struct {
+    uint64_t chunks;           /* Chunks offered for compression */
+    uint64_t packed;           /* ...sent compressed */
+    uint64_t bypassed;         /* ...sent raw without a probe */
+    uint64_t raw_bytes;        /* Size of the packed chunks before compression */
+    uint64_t wire_bytes;       /* ...and after */
+} CompressStats;
+
+/*
+ * Adaptive chunk compression shared by the stripes of a transfer. Each
+ * chunk is probed by compressing a sample of it first, and only a chunk
+ * whose sample shrinks is compressed whole; one that does not save at
+ * least 1/16 of its size goes out raw. Every failure doubles the number of
+ * following chunks sent raw without a probe (up to FT_COMPRESS_MAX_BYPASS),
+ * so media and archives cost a probe now and then rather than a pass over
+ * every byte. A success clears the backoff.
+ */
+typedef struct {
+    ft_mutex_t    lock;
+    uint32_t      backoff;     /* Chunks to bypass after the next failure */
+    uint32_t      bypass;      /* Chunks still to bypass */
+    CompressStats stats;
+} Compressor;
+
+void compressor_init(Compressor *compressor);
+void compressor_destroy(Compressor *compressor);
+
+/* Whether to try compressing the next chunk, in send order */
+int compressor_admit(Compressor *compressor);
+
+/* Compress an admitted chunk of size bytes into packed (size bytes).
+ * Returns the compressed size, or 0 to send the chunk raw. Safe to call
+ * from several threads. */
+size_t compressor_pack(Compressor *compressor, const uint8_t *data, size_t size, uint8_t *packed);
+
+/* Snapshot of the counters */
+void compressor_get_stats(Compressor *compressor, CompressStats *stats);
+
+#endif /* COMPRESS_H */
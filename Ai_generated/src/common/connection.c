@@ -0,0 +1,515 @@
+#include "connection.h"
+#include "network.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef FT_PLATFORM_WINDOWS
+#include <sys/uio.h>
+#endif
+
+#ifdef FT_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+#ifdef FT_HAVE_TLS
+#include "tls.h"
+#define SEALED(conn) ((conn)->tls != NULL && tls_seals((conn)->tls))
+#define OPENED(conn) ((conn)->tls != NULL && tls_opens((conn)->tls))
+#else
+#define SEALED(conn) 0
+#define OPENED(conn) 0
+#endif
+
+/* Failed sends on a closed peer return EPIPE instead of raising SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#ifdef FT_PLATFORM_WINDOWS
+typedef WSABUF IoVec;
+#define IOV_BASE(v) ((v).buf)
+#define IOV_LEN(v)  ((v).len)
+#else
+typedef struct iovec IoVec;
+#define IOV_BASE(v) ((v).iov_base)
+#define IOV_LEN(v)  ((v).iov_len)
+#endif
+
+/* Wrap socket */
+int connection_init(Connection *conn, socket_t sock) {
+    memset(conn, 0, sizeof(Connection));
+    conn->sock = sock;
+    conn->version = FT_PROTOCOL_V1;
+    conn->recv_buf = (uint8_t*)malloc(FT_RECV_BUFFER_SIZE);
+    if (conn->recv_buf == NULL) {
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    conn->recv_capacity = FT_RECV_BUFFER_SIZE;
+    return FT_SUCCESS;
+}
+
+/* Free connection buffers */
+void connection_free(Connection *conn) {
+#ifdef FT_HAVE_TLS
+    tls_session_free(conn->tls);
+    conn->tls = NULL;
+#endif
+    if (conn->queued) {
+        platform_mutex_destroy(&conn->send_lock);
+        free(conn->send_buf);
+        conn->send_buf = NULL;
+        conn->queued = 0;
+    }
+    free(conn->recv_buf);
+    conn->recv_buf = NULL;
+    conn->recv_capacity = 0;
+    conn->recv_pos = 0;
+    conn->recv_len = 0;
+}
+
+/* Turn segments into an iovec, skipping empty ones; returns the count */
+static int build_iov(const FrameSegment *segments, int count, IoVec *iov) {
+    int iov_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (segments[i].len == 0) {
+            continue;
+        }
+#ifdef FT_PLATFORM_WINDOWS
+        iov[iov_count].buf = (CHAR*)segments[i].data;
+        iov[iov_count].len = (ULONG)segments[i].len;
+#else
+        iov[iov_count].iov_base = (void*)segments[i].data;
+        iov[iov_count].iov_len = segments[i].len;
+#endif
+        iov_count++;
+    }
+    return iov_count;
+}
+
+/* One gathered write; returns bytes written or -1 with socket_errno set */
+static long send_iov(socket_t sock, IoVec *iov, int count, int use_uring) {
+#ifdef FT_PLATFORM_WINDOWS
+    (void)use_uring;
+    DWORD sent_bytes = 0;
+    if (WSASend(sock, iov, (DWORD)count, &sent_bytes, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+    return (long)sent_bytes;
+#else
+#ifdef FT_HAVE_IO_URING
+    if (use_uring) {
+        return (long)uring_sendmsg(sock, iov, count, 0);
+    }
+#else
+    (void)use_uring;
+#endif
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)count;
+    ssize_t rc;
+    do {
+        rc = sendmsg(sock, &msg, SEND_FLAGS);
+    } while (rc < 0 && errno == EINTR);
+    return (long)rc;
+#endif
+}
+
+/* Make room for needed more bytes in the send buffer (send lock held) */
+static int reserve_queue(Connection *conn, size_t needed, FTErrorCode *error) {
+    if (conn->send_pos > 0) {
+        memmove(conn->send_buf, conn->send_buf + conn->send_pos, conn->send_len - conn->send_pos);
+        conn->send_len -= conn->send_pos;
+        conn->send_pos = 0;
+    }
+    if (conn->send_len + needed > conn->send_capacity) {
+        size_t capacity = conn->send_capacity;
+        while (capacity < conn->send_len + needed) {
+            capacity *= 2;
+        }
+        uint8_t *grown = (capacity <= FT_SEND_QUEUE_MAX) ? (uint8_t*)realloc(conn->send_buf, capacity) : NULL;
+        if (grown == NULL) {
+            LOG_ERROR("Send queue full (peer is not reading)");
+            conn->send_failed = 1;
+            if (error) *error = FT_ERR_SEND;
+            return -1;
+        }
+        conn->send_buf = grown;
+        conn->send_capacity = capacity;
+    }
+    return 0;
+}
+
+/* Write queued data until the socket would block; a fatal error sets
+ * send_failed (send lock held) */
+static void drain_queue(Connection *conn) {
+    while (conn->send_pos < conn->send_len && !conn->send_failed) {
+        int sent = send(conn->sock, (const char*)(conn->send_buf + conn->send_pos),
+                        (int)(conn->send_len - conn->send_pos), SEND_FLAGS);
+        if (sent < 0) {
+            int err = socket_errno;
+#ifndef FT_PLATFORM_WINDOWS
+            if (err == EINTR) {
+                continue;
+            }
+#endif
+            if (!platform_is_fatal_socket_error(err)) {
+                break;
+            }
+            LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
+            conn->send_failed = 1;
+            break;
+        }
+        conn->send_pos += (size_t)sent;
+    }
+}
+
+/* Queue a frame behind unsent data, or write as much as the socket takes
+ * and queue the rest (send lock held) */
+static int queue_frame(Connection *conn, const FrameSegment *segments, int count, FTErrorCode *error) {
+    IoVec iov[FT_MAX_FRAME_SEGMENTS];
+    int iov_count = build_iov(segments, count, iov);
+    size_t total = 0;
+    for (int i = 0; i < iov_count; i++) {
+        total += IOV_LEN(iov[i]);
+    }
+
+    int was_empty = (conn->send_pos == conn->send_len);
+    size_t skip = 0;
+    if (was_empty && iov_count > 0) {
+        conn->send_pos = 0;
+        conn->send_len = 0;
+        long sent = send_iov(conn->sock, iov, iov_count, 0);
+        if (sent < 0) {
+            int err = socket_errno;
+            if (platform_is_fatal_socket_error(err)) {
+                LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
+                conn->send_failed = 1;
+                if (error) *error = FT_ERR_SEND;
+                return -1;
+            }
+            sent = 0;
+        }
+        skip = (size_t)sent;
+    }
+    if (skip == total) {
+        return 0;
+    }
+    if (reserve_queue(conn, total - skip, error) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < iov_count; i++) {
+        const uint8_t *data = (const uint8_t*)IOV_BASE(iov[i]);
+        size_t len = IOV_LEN(iov[i]);
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        memcpy(conn->send_buf + conn->send_len, data + skip, len - skip);
+        conn->send_len += len - skip;
+        skip = 0;
+    }
+
+    if (was_empty && conn->on_pending != NULL) {
+        conn->on_pending(conn->pending_context);
+    }
+    return 0;
+}
+
+#ifdef FT_HAVE_TLS
+/* Queue a frame as records sealed here and write what the socket takes
+ * (send lock held) */
+static int queue_sealed(Connection *conn, const FrameSegment *segments, int count, FTErrorCode *error) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += segments[i].len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    int was_empty = (conn->send_pos == conn->send_len);
+    if (reserve_queue(conn, tls_sealed_size(total), error) != 0) {
+        return -1;
+    }
+    conn->send_len += tls_seal(conn->tls, segments, count, conn->send_buf + conn->send_len);
+
+    if (was_empty) {
+        drain_queue(conn);
+        if (conn->send_failed) {
+            if (error) *error = FT_ERR_SEND;
+            return -1;
+        }
+        if (conn->send_pos < conn->send_len && conn->on_pending != NULL) {
+            conn->on_pending(conn->pending_context);
+        }
+    }
+    return 0;
+}
+#endif
+
+/* Send gathered frame, resuming after partial writes */
+int connection_send_frame(Connection *conn, const FrameSegment *segments, int count, FTErrorCode *error) {
+    IoVec iov[FT_MAX_FRAME_SEGMENTS];
+
+    if (count > FT_MAX_FRAME_SEGMENTS) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    if (conn->queued) {
+        platform_mutex_lock(&conn->send_lock);
+        int result = -1;
+        if (conn->send_failed) {
+            if (error) *error = FT_ERR_SEND;
+        } else {
+#ifdef FT_HAVE_TLS
+            result = SEALED(conn) ? queue_sealed(conn, segments, count, error) :
+                                    queue_frame(conn, segments, count, error);
+#else
+            result = queue_frame(conn, segments, count, error);
+#endif
+        }
+        platform_mutex_unlock(&conn->send_lock);
+        if (result == 0 && error) *error = FT_SUCCESS;
+        return result;
+    }
+
+#ifdef FT_HAVE_TLS
+    if (SEALED(conn)) {
+        return tls_send(conn->tls, conn->sock, segments, count, error);
+    }
+#endif
+
+#ifdef FT_HAVE_IO_URING
+    int use_uring = uring_available();
+#else
+    int use_uring = 0;
+#endif
+    int iov_count = build_iov(segments, count, iov);
+    int first = 0;
+    while (first < iov_count) {
+        long rc = send_iov(conn->sock, &iov[first], iov_count - first, use_uring);
+#ifndef FT_PLATFORM_WINDOWS
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (rc <= 0) {
+            int err = socket_errno;
+            LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
+            if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
+            return -1;
+        }
+
+        /* Skip fully written segments, trim a partially written one */
+        size_t sent = (size_t)rc;
+        while (first < iov_count) {
+            size_t seg_len = IOV_LEN(iov[first]);
+            if (sent < seg_len) {
+#ifdef FT_PLATFORM_WINDOWS
+                iov[first].buf += sent;
+                iov[first].len -= (ULONG)sent;
+#else
+                iov[first].iov_base = (uint8_t*)iov[first].iov_base + sent;
+                iov[first].iov_len -= sent;
+#endif
+                break;
+            }
+            sent -= seg_len;
+            first++;
+        }
+    }
+
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Enable queued sending */
+int connection_enable_queue(Connection *conn, void (*on_pending)(void *context), void *context) {
+    conn->send_buf = (uint8_t*)malloc(FT_SEND_QUEUE_INITIAL);
+    if (conn->send_buf == NULL) {
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    conn->send_capacity = FT_SEND_QUEUE_INITIAL;
+    conn->send_pos = 0;
+    conn->send_len = 0;
+    conn->send_failed = 0;
+    conn->on_pending = on_pending;
+    conn->pending_context = context;
+    platform_mutex_init(&conn->send_lock);
+    conn->queued = 1;
+    return FT_SUCCESS;
+}
+
+/* Write out queued data */
+int connection_flush(Connection *conn, FTErrorCode *error) {
+    int result = 1;
+
+    platform_mutex_lock(&conn->send_lock);
+    drain_queue(conn);
+
+    if (conn->send_failed) {
+        if (error) *error = FT_ERR_SEND;
+        result = -1;
+    } else if (conn->send_pos < conn->send_len) {
+        result = 0;
+    } else {
+        conn->send_pos = 0;
+        conn->send_len = 0;
+    }
+    platform_mutex_unlock(&conn->send_lock);
+    return result;
+}
+
+/* recv() of the plaintext stream, through the TLS session when
+ * receiving is decrypted here */
+static int recv_plain(Connection *conn, uint8_t *buffer, size_t length) {
+#ifdef FT_HAVE_TLS
+    if (OPENED(conn)) {
+        return tls_recv(conn->tls, conn->sock, buffer, length);
+    }
+#endif
+    return recv(conn->sock, (char*)buffer, (int)length, 0);
+}
+
+/* Read more data into the receive buffer */
+static int fill_buffer(Connection *conn, FTErrorCode *error) {
+    /* Compact unread bytes to the front */
+    if (conn->recv_pos > 0) {
+        memmove(conn->recv_buf, conn->recv_buf + conn->recv_pos, conn->recv_len - conn->recv_pos);
+        conn->recv_len -= conn->recv_pos;
+        conn->recv_pos = 0;
+    }
+
+#ifdef FT_HAVE_IO_URING
+    int received = (uring_available() && !OPENED(conn)) ?
+                   (int)uring_recv(conn->sock, conn->recv_buf + conn->recv_len,
+                                   conn->recv_capacity - conn->recv_len, 0) :
+                   recv_plain(conn, conn->recv_buf + conn->recv_len, conn->recv_capacity - conn->recv_len);
+#else
+    int received = recv_plain(conn, conn->recv_buf + conn->recv_len, conn->recv_capacity - conn->recv_len);
+#endif
+    if (received == 0) {
+        LOG_ERROR("Connection closed by peer");
+        if (error) *error = FT_ERR_RECV;
+        return -1;
+    }
+    if (received < 0) {
+        int err = socket_errno;
+        LOG_ERROR("Receive failed: %s", platform_get_socket_error(err));
+        if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_RECV : FT_ERR_TIMEOUT;
+        return -1;
+    }
+
+    conn->recv_len += (size_t)received;
+    return 0;
+}
+
+/* Receive exact byte count */
+int connection_recv_exact(Connection *conn, uint8_t *buffer, size_t length, FTErrorCode *error) {
+    while (length > 0) {
+        size_t buffered = conn->recv_len - conn->recv_pos;
+        if (buffered > 0) {
+            size_t take = buffered < length ? buffered : length;
+            memcpy(buffer, conn->recv_buf + conn->recv_pos, take);
+            conn->recv_pos += take;
+            buffer += take;
+            length -= take;
+            continue;
+        }
+
+        /* Buffer is empty: large remainders go straight to the destination
+         * (decrypted records are copied out of the session either way) */
+        conn->recv_pos = 0;
+        conn->recv_len = 0;
+        if (length >= FT_RECV_DIRECT_MIN && !OPENED(conn)) {
+            return socket_recv_all(conn->sock, buffer, length, error);
+        }
+        if (fill_buffer(conn, error) != 0) {
+            return -1;
+        }
+    }
+
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Resumable non-blocking receive */
+int connection_recv_partial(Connection *conn, uint8_t *buffer, size_t length, size_t *done,
+                            FTErrorCode *error) {
+    while (*done < length) {
+        size_t wanted = length - *done;
+        size_t buffered = conn->recv_len - conn->recv_pos;
+        if (buffered > 0) {
+            size_t take = buffered < wanted ? buffered : wanted;
+            memcpy(buffer + *done, conn->recv_buf + conn->recv_pos, take);
+            conn->recv_pos += take;
+            *done += take;
+            continue;
+        }
+
+        /* As in connection_recv_exact(), large remainders skip the buffer */
+        conn->recv_pos = 0;
+        conn->recv_len = 0;
+        int direct = (wanted >= FT_RECV_DIRECT_MIN);
+        int received = direct ?
+                       recv_plain(conn, buffer + *done, wanted) :
+                       recv_plain(conn, conn->recv_buf, conn->recv_capacity);
+        if (received == 0) {
+            LOG_ERROR("Connection closed by peer");
+            if (error) *error = FT_ERR_RECV;
+            return -1;
+        }
+        if (received < 0) {
+            int err = socket_errno;
+#ifndef FT_PLATFORM_WINDOWS
+            if (err == EINTR) {
+                continue;
+            }
+#endif
+            if (!platform_is_fatal_socket_error(err)) {
+                return 0;
+            }
+            LOG_ERROR("Receive failed: %s", platform_get_socket_error(err));
+            if (error) *error = FT_ERR_RECV;
+            return -1;
+        }
+
+        if (direct) {
+            *done += (size_t)received;
+        } else {
+            conn->recv_len = (size_t)received;
+        }
+    }
+
+    if (error) *error = FT_SUCCESS;
+    return 1;
+}
+
+/* Raw writes allowed */
+int connection_raw_send(const Connection *conn) {
+#ifdef FT_HAVE_TLS
+    return !SEALED(conn);
+#else
+    (void)conn;
+    return 1;
+#endif
+}
+
+/* Wait for data */
+int connection_wait_readable(Connection *conn, uint32_t timeout_ms) {
+    if (conn->recv_len > conn->recv_pos) {
+        return 1;
+    }
+#ifdef FT_HAVE_TLS
+    if (OPENED(conn) && tls_pending(conn->tls)) {
+        return 1;
+    }
+#endif
+    return socket_wait_readable(conn->sock, timeout_ms);
+}
@@ -0,0 +1,98 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+
+#define FT_RECV_BUFFER_SIZE    (256 * 1024)  /* One recv() may deliver many frames */
+#define FT_RECV_DIRECT_MIN     (64 * 1024)   /* Reads this large bypass the buffer */
+#define FT_MAX_FRAME_SEGMENTS  8
+#define FT_SEND_QUEUE_INITIAL  (16 * 1024)   /* Queued-mode send buffer, grown on demand... */
+#define FT_SEND_QUEUE_MAX      (1024 * 1024) /* ...up to this much unsent data */
+
+/* One piece of an outgoing frame */
+typedef struct {
+    const void *data;
+    size_t      len;
+} FrameSegment;
+
+/*
+ * Framed connection: a socket plus a receive buffer. Small messages
+ * (headers, ACKs, SACKs) are parsed out of one large recv() instead of
+ * costing a syscall each; large payloads are received straight into the
+ * caller's buffer. Frames are sent with a single writev()/WSASend().
+ *
+ * Receiving is single-consumer; sending does not touch the receive side,
+ * so one thread may send while another receives. The connection does not
+ * own the socket.
+ *
+ * Event loops put the socket in non-blocking mode and switch the
+ * connection to queued sending: frames go out as far as the socket takes
+ * them and the rest waits in a send buffer for connection_flush().
+ *
+ * The framing of messages on the connection (network.h) follows `version`,
+ * which the handshake sets once, before any other thread uses it.
+ *
+ * With TLS (tls.h) the keys normally live in the kernel and nothing here
+ * changes; `tls` is only set while a direction is encrypted in user
+ * space, which then seals whole frames and reads through the session.
+ */
+typedef struct {
+    socket_t sock;
+    uint8_t  version;         /* Protocol version in use (FT_PROTOCOL_V1 until the handshake) */
+    struct TlsSession *tls;   /* User-space TLS, or a handshake in progress (NULL if neither) */
+    uint8_t *recv_buf;
+    size_t   recv_capacity;
+    size_t   recv_pos;        /* Next unread byte */
+    size_t   recv_len;        /* End of buffered data */
+
+    /* Queued sending (connection_enable_queue) */
+    int         queued;
+    uint8_t    *send_buf;
+    size_t      send_capacity;
+    size_t      send_pos;     /* Next unsent byte */
+    size_t      send_len;     /* End of queued data */
+    int         send_failed;  /* The socket failed; later sends fail too */
+    ft_mutex_t  send_lock;    /* Senders may be on other threads than the flusher */
+    void      (*on_pending)(void *context);
+    void       *pending_context;
+} Connection;
+
+/* Wrap a connected socket */
+int connection_init(Connection *conn, socket_t sock);
+
+/* Free receive buffer (the socket is left open) */
+void connection_free(Connection *conn);
+
+/* Send all segments as one gathered write */
+int connection_send_frame(Connection *conn, const FrameSegment *segments, int count, FTErrorCode *error);
+
+/* Receive exactly length bytes */
+int connection_recv_exact(Connection *conn, uint8_t *buffer, size_t length, FTErrorCode *error);
+
+/* Switch a non-blocking socket to queued sending. on_pending is called
+ * (with the send lock held) whenever the send buffer stops being empty. */
+int connection_enable_queue(Connection *conn, void (*on_pending)(void *context), void *context);
+
+/* Write queued data the socket accepts without blocking. Returns 1 once
+ * the queue is empty, 0 if data is left, -1 on error. */
+int connection_flush(Connection *conn, FTErrorCode *error);
+
+/* Non-blocking counterpart of connection_recv_exact(): receive into buffer
+ * until length bytes are there, with *done counting the bytes received
+ * across calls. Returns 1 when complete, 0 when the socket has no more data
+ * for now, -1 on error or end of stream. */
+int connection_recv_partial(Connection *conn, uint8_t *buffer, size_t length, size_t *done,
+                            FTErrorCode *error);
+
+/* Whether frames may be written to the socket directly, as sendfile()
+ * does: false while TLS records are sealed in user space */
+int connection_raw_send(const Connection *conn);
+
+/* Wait until data is buffered or the socket is readable;
+ * returns 1 if readable, 0 on timeout, -1 on error */
+int connection_wait_readable(Connection *conn, uint32_t timeout_ms);
+
+#endif /* CONNECTION_H */
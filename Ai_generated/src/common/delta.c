@@ -0,0 +1,227 @@
+#include "delta.h"
+#include "platform.h"
+#include "checksum.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Block size for the existing file */
+uint32_t delta_block_size(uint64_t basis_size) {
+    uint32_t block = FT_DELTA_MIN_BLOCK;
+    while (block < FT_DELTA_MAX_BLOCK && (uint64_t)block * block < basis_size) {
+        block *= 2;
+    }
+    return block;
+}
+
+/* Start rolling checksum */
+void rolling_init(RollingSum *sum, const uint8_t *data, size_t length) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < length; i++) {
+        a += data[i];
+        b += a;
+    }
+    sum->a = a;
+    sum->b = b;
+    sum->length = length;
+}
+
+/* Move window by one byte */
+void rolling_rotate(RollingSum *sum, uint8_t out, uint8_t in) {
+    sum->a += (uint32_t)in - out;
+    sum->b += sum->a - (uint32_t)sum->length * out;
+}
+
+/* Weak checksum */
+uint32_t rolling_digest(const RollingSum *sum) {
+    return (sum->a & 0xFFFF) | (sum->b << 16);
+}
+
+/* Strong hash of a block */
+void delta_strong_hash(const uint8_t *data, size_t length, uint8_t strong[FT_BLOCK_SIG_STRONG_SIZE]) {
+    uint8_t digest[FT_SHA256_DIGEST_SIZE];
+    sha256_compute(data, length, digest);
+    memcpy(strong, digest, FT_BLOCK_SIG_STRONG_SIZE);
+}
+
+/* Encode signature */
+void delta_put_signature(uint8_t *buffer, const uint8_t *data, size_t length) {
+    RollingSum sum;
+    rolling_init(&sum, data, length);
+    uint32_t weak = htonl(rolling_digest(&sum));
+    memcpy(buffer, &weak, sizeof(weak));
+    delta_strong_hash(data, length, buffer + sizeof(weak));
+}
+
+/* Weak checksum of a stored signature */
+static uint32_t signature_weak(const SignatureIndex *index, uint64_t block) {
+    uint32_t weak;
+    memcpy(&weak, index->entries + block * FT_BLOCK_SIG_SIZE, sizeof(weak));
+    return ntohl(weak);
+}
+
+/* Bucket of a weak checksum (Fibonacci hashing of both halves) */
+static uint32_t signature_bucket(const SignatureIndex *index, uint32_t weak) {
+    return ((weak ^ (weak >> 16)) * 0x9E3779B1u) >> index->bucket_shift;
+}
+
+/* Allocate index */
+int signature_index_init(SignatureIndex *index, uint64_t block_count, uint32_t block_size,
+                         uint64_t basis_size) {
+    memset(index, 0, sizeof(*index));
+    if (block_count == 0 || block_count >= UINT32_MAX || block_size == 0 ||
+        basis_size > block_count * block_size || basis_size <= (block_count - 1) * block_size) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    /* About four buckets per block, so the window at most offsets (matching
+     * nothing) lands in an empty bucket */
+    uint32_t bits = 4;
+    while (bits < 31 && ((uint64_t)1 << bits) < block_count * 4) {
+        bits++;
+    }
+    index->block_count = block_count;
+    index->block_size = block_size;
+    index->basis_size = basis_size;
+    index->bucket_shift = 32 - bits;
+    index->entries = (uint8_t*)malloc((size_t)block_count * FT_BLOCK_SIG_SIZE);
+    index->buckets = (uint32_t*)calloc((size_t)1 << bits, sizeof(uint32_t));
+    index->chain = (uint32_t*)calloc((size_t)block_count, sizeof(uint32_t));
+    if (index->entries == NULL || index->buckets == NULL || index->chain == NULL) {
+        signature_index_free(index);
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    return FT_SUCCESS;
+}
+
+/* Free index */
+void signature_index_free(SignatureIndex *index) {
+    free(index->entries);
+    free(index->buckets);
+    free(index->chain);
+    memset(index, 0, sizeof(*index));
+}
+
+/* Store signatures */
+void signature_index_add(SignatureIndex *index, uint64_t first_block, const uint8_t *entries, uint32_t count) {
+    memcpy(index->entries + first_block * FT_BLOCK_SIG_SIZE, entries, (size_t)count * FT_BLOCK_SIG_SIZE);
+
+    /* Identical blocks share a chain; whichever is found copies the same bytes */
+    for (uint64_t block = first_block; block < first_block + count; block++) {
+        uint32_t bucket = signature_bucket(index, signature_weak(index, block));
+        index->chain[block] = index->buckets[bucket];
+        index->buckets[bucket] = (uint32_t)block + 1;
+    }
+}
+
+/* Length of one block */
+size_t signature_index_block_length(const SignatureIndex *index, uint64_t block) {
+    uint64_t offset = block * index->block_size;
+    uint64_t rest = index->basis_size - offset;
+    return rest < index->block_size ? (size_t)rest : index->block_size;
+}
+
+/* Compare the strong hash of block with data's, computed on first use */
+static int signature_strong_match(const SignatureIndex *index, uint64_t block, const uint8_t *data,
+                                  size_t length, uint8_t *strong, int *have_strong) {
+    if (signature_index_block_length(index, block) != length) {
+        return 0;
+    }
+    if (!*have_strong) {
+        delta_strong_hash(data, length, strong);
+        *have_strong = 1;
+    }
+    return memcmp(index->entries + block * FT_BLOCK_SIG_SIZE + 4, strong, FT_BLOCK_SIG_STRONG_SIZE) == 0;
+}
+
+/* Look up a window */
+int64_t signature_index_find(const SignatureIndex *index, uint32_t weak, const uint8_t *data,
+                             size_t length, uint64_t hint) {
+    uint8_t strong[FT_BLOCK_SIG_STRONG_SIZE];
+    int have_strong = 0;
+
+    if (hint < index->block_count && signature_weak(index, hint) == weak &&
+        signature_strong_match(index, hint, data, length, strong, &have_strong)) {
+        return (int64_t)hint;
+    }
+
+    for (uint32_t link = index->buckets[signature_bucket(index, weak)]; link != 0;
+         link = index->chain[link - 1]) {
+        uint64_t block = link - 1;
+        if (signature_weak(index, block) == weak &&
+            signature_strong_match(index, block, data, length, strong, &have_strong)) {
+            return (int64_t)block;
+        }
+    }
+    return -1;
+}
+
+/* Store 64-bit value in network byte order */
+static void put_u64(uint8_t *buffer, uint64_t value) {
+    value = htonll(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Store 32-bit value in network byte order */
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Encode copy instruction */
+size_t delta_put_copy(uint8_t *buffer, uint64_t block, uint32_t count) {
+    buffer[0] = DELTA_OP_COPY;
+    put_u64(buffer + 1, block);
+    put_u32(buffer + 9, count);
+    return DELTA_COPY_SIZE;
+}
+
+/* Encode literal instruction */
+size_t delta_put_literal(uint8_t *buffer, const uint8_t *data, uint32_t length) {
+    buffer[0] = DELTA_OP_LITERAL;
+    put_u32(buffer + 1, length);
+    memcpy(buffer + DELTA_LITERAL_HEADER, data, length);
+    return DELTA_LITERAL_HEADER + (size_t)length;
+}
+
+/* Decode instruction */
+int delta_next_op(const uint8_t *frame, size_t size, size_t *pos, DeltaOp *op) {
+    size_t at = *pos;
+    uint64_t block;
+    uint32_t value;
+
+    if (at >= size) {
+        return -1;
+    }
+    op->kind = frame[at];
+    switch (op->kind) {
+    case DELTA_OP_COPY:
+        if (size - at < DELTA_COPY_SIZE) {
+            return -1;
+        }
+        memcpy(&block, frame + at + 1, sizeof(block));
+        memcpy(&value, frame + at + 9, sizeof(value));
+        op->block = ntohll(block);
+        op->count = ntohl(value);
+        op->data = NULL;
+        *pos = at + DELTA_COPY_SIZE;
+        return op->count > 0 ? 0 : -1;
+
+    case DELTA_OP_LITERAL:
+        if (size - at < DELTA_LITERAL_HEADER) {
+            return -1;
+        }
+        memcpy(&value, frame + at + 1, sizeof(value));
+        op->count = ntohl(value);
+        if (op->count == 0 || op->count > size - at - DELTA_LITERAL_HEADER) {
+            return -1;
+        }
+        op->block = 0;
+        op->data = frame + at + DELTA_LITERAL_HEADER;
+        *pos = at + DELTA_LITERAL_HEADER + op->count;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
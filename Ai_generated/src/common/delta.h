@@ -0,0 +1,100 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+
+/*
+ * Delta upload against a copy of the file the server already has
+ * (FT_CAP_DELTA), the rsync way. The server cuts its copy into fixed-size
+ * blocks and sends a weak rolling checksum and a strong hash of each. The
+ * client slides a block-sized window over its file one byte at a time,
+ * updating the weak checksum in constant time; where it finds a block of
+ * the old copy it sends "copy block k" and jumps past it, and everything
+ * in between goes as literal bytes.
+ *
+ *   weak   = a | b << 16, a = sum of bytes, b = sum of running a (mod 2^16)
+ *   strong = first FT_BLOCK_SIG_STRONG_SIZE bytes of SHA-256(block)
+ *
+ * A false strong match would corrupt the rebuilt file, but the tree root
+ * compared at verification still catches it.
+ */
+
+/* Weak checksum of a window that can be moved by one byte */
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+    size_t   length;
+} RollingSum;
+
+/* Block size for an existing file of basis_size bytes: about its square
+ * root, a power of two within [FT_DELTA_MIN_BLOCK, FT_DELTA_MAX_BLOCK] */
+uint32_t delta_block_size(uint64_t basis_size);
+
+/* Start the checksum over data */
+void rolling_init(RollingSum *sum, const uint8_t *data, size_t length);
+
+/* Move the window one byte: drop out, append in */
+void rolling_rotate(RollingSum *sum, uint8_t out, uint8_t in);
+
+/* Current weak checksum */
+uint32_t rolling_digest(const RollingSum *sum);
+
+/* Strong hash of one block */
+void delta_strong_hash(const uint8_t *data, size_t length, uint8_t strong[FT_BLOCK_SIG_STRONG_SIZE]);
+
+/* Encode one signature (weak, then strong) as sent in BLOCK_SIGNATURES */
+void delta_put_signature(uint8_t *buffer, const uint8_t *data, size_t length);
+
+/* Signatures of the server's copy, looked up by weak checksum */
+typedef struct {
+    uint8_t  *entries;             /* block_count signatures in wire form */
+    uint64_t  block_count;
+    uint32_t  block_size;
+    uint64_t  basis_size;
+    uint32_t *buckets;             /* Head of each chain + 1 (0 = empty) */
+    uint32_t *chain;               /* Next block with the same bucket + 1 */
+    uint32_t  bucket_shift;        /* 32 - log2(bucket count) */
+} SignatureIndex;
+
+/* Allocate an index for block_count blocks of block_size bytes */
+int signature_index_init(SignatureIndex *index, uint64_t block_count, uint32_t block_size,
+                         uint64_t basis_size);
+
+/* Free index storage */
+void signature_index_free(SignatureIndex *index);
+
+/* Store count signatures in wire form starting at first_block */
+void signature_index_add(SignatureIndex *index, uint64_t first_block, const uint8_t *entries, uint32_t count);
+
+/* Length of block k of the server's copy */
+size_t signature_index_block_length(const SignatureIndex *index, uint64_t block);
+
+/* Find a block whose checksums match data (length bytes, weak checksum
+ * weak). The hint block is tried first, so a run of unchanged blocks is
+ * found without walking chains. Returns the block or -1. */
+int64_t signature_index_find(const SignatureIndex *index, uint32_t weak, const uint8_t *data,
+                             size_t length, uint64_t hint);
+
+/* Encoded size of the instructions */
+#define DELTA_COPY_SIZE        13
+#define DELTA_LITERAL_HEADER   5
+
+/* One decoded DELTA_DATA instruction */
+typedef struct {
+    uint8_t        kind;           /* DELTA_OP_* */
+    uint64_t       block;          /* COPY: first block */
+    uint32_t       count;          /* COPY: blocks; LITERAL: bytes */
+    const uint8_t *data;           /* LITERAL: the bytes, inside the frame */
+} DeltaOp;
+
+/* Encode instructions; each returns the bytes written */
+size_t delta_put_copy(uint8_t *buffer, uint64_t block, uint32_t count);
+size_t delta_put_literal(uint8_t *buffer, const uint8_t *data, uint32_t length);
+
+/* Decode the instruction at *pos of a frame's size bytes and advance *pos;
+ * -1 if it is truncated or unknown */
+int delta_next_op(const uint8_t *frame, size_t size, size_t *pos, DeltaOp *op);
+
+#endif /* DELTA_H */
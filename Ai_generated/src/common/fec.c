@@ -0,0 +1,376 @@
+#include "fec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define FT_ARCH_X86
+    #include <immintrin.h>
+#elif defined(__aarch64__)
+    #define FT_ARCH_ARM64
+    #include <arm_neon.h>
+#endif
+
+/* GF(2^8) arithmetic tables (polynomial x^8 + x^4 + x^3 + x^2 + 1, generator 2) */
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_table[256][256];
+
+/* Build the log, antilog and product tables */
+static void gf_build_tables(void) {
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = (uint8_t)x;
+        gf_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11D;
+        }
+    }
+    for (int i = 255; i < 512; i++) {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+    for (int a = 1; a < 256; a++) {
+        for (int b = 1; b < 256; b++) {
+            gf_mul_table[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+        }
+    }
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return gf_mul_table[a][b];
+}
+
+/* Multiplicative inverse of a nonzero element */
+static uint8_t gf_inv(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+/* dst ^= c * src over length bytes (c is neither 0 nor 1) */
+typedef void (*fec_kernel_fn)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length);
+
+/* Portable kernel: one table row per coefficient */
+static void fec_kernel_table(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) {
+    const uint8_t *row = gf_mul_table[c];
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        dst[i]     ^= row[src[i]];
+        dst[i + 1] ^= row[src[i + 1]];
+        dst[i + 2] ^= row[src[i + 2]];
+        dst[i + 3] ^= row[src[i + 3]];
+    }
+    for (; i < length; i++) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+/* Products of c with every low nibble and every high nibble: c * x is
+ * lo[x & 15] ^ hi[x >> 4], which is what the shuffle kernels look up */
+static void fec_nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16]) {
+    for (int x = 0; x < 16; x++) {
+        lo[x] = gf_mul_table[c][x];
+        hi[x] = gf_mul_table[c][x << 4];
+    }
+}
+
+#ifdef FT_ARCH_X86
+/* SSSE3 kernel: PSHUFB looks up 16 products at once */
+__attribute__((target("ssse3")))
+static void fec_kernel_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) {
+    uint8_t lo_bytes[16], hi_bytes[16];
+    fec_nibble_tables(c, lo_bytes, hi_bytes);
+    const __m128i lo = _mm_loadu_si128((const __m128i*)lo_bytes);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)hi_bytes);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i l = _mm_and_si128(v, mask);
+        __m128i h = _mm_and_si128(_mm_srli_epi64(v, 4), mask);
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, l), _mm_shuffle_epi8(hi, h));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, p));
+    }
+    fec_kernel_table(dst + i, src + i, c, length - i);
+}
+
+/* AVX2 kernel: the same lookups 32 bytes at a time */
+__attribute__((target("avx2")))
+static void fec_kernel_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) {
+    uint8_t lo_bytes[16], hi_bytes[16];
+    fec_nibble_tables(c, lo_bytes, hi_bytes);
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo_bytes));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hi_bytes));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i l = _mm256_and_si256(v, mask);
+        __m256i h = _mm256_and_si256(_mm256_srli_epi64(v, 4), mask);
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, l), _mm256_shuffle_epi8(hi, h));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, p));
+    }
+    fec_kernel_table(dst + i, src + i, c, length - i);
+}
+
+static int x86_has_ssse3(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int x86_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif /* FT_ARCH_X86 */
+
+#ifdef FT_ARCH_ARM64
+/* NEON kernel: TBL looks up 16 products at once (NEON is baseline on ARMv8) */
+static void fec_kernel_neon(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) {
+    uint8_t lo_bytes[16], hi_bytes[16];
+    fec_nibble_tables(c, lo_bytes, hi_bytes);
+    const uint8x16_t lo = vld1q_u8(lo_bytes);
+    const uint8x16_t hi = vld1q_u8(hi_bytes);
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(lo, vandq_u8(v, mask)), vqtbl1q_u8(hi, vshrq_n_u8(v, 4)));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+    }
+    fec_kernel_table(dst + i, src + i, c, length - i);
+}
+#endif /* FT_ARCH_ARM64 */
+
+/* Kernel registry, fastest first */
+typedef struct {
+    const char *name;
+    fec_kernel_fn kernel;
+    int (*supported)(void);
+} FecImpl;
+
+static int always_supported(void) {
+    return 1;
+}
+
+static const FecImpl fec_impls[] = {
+#ifdef FT_ARCH_X86
+    { "avx2",  fec_kernel_avx2,  x86_has_avx2 },
+    { "ssse3", fec_kernel_ssse3, x86_has_ssse3 },
+#endif
+#ifdef FT_ARCH_ARM64
+    { "neon",  fec_kernel_neon,  always_supported },
+#endif
+    { "table", fec_kernel_table, always_supported },
+};
+
+#define FEC_NUM_IMPLS (sizeof(fec_impls) / sizeof(fec_impls[0]))
+
+static const FecImpl *fec_active = NULL;
+
+/* Select the fastest supported kernel (idempotent) */
+void fec_init_dispatch(void) {
+    if (__atomic_load_n(&fec_active, __ATOMIC_ACQUIRE) != NULL) {
+        return;
+    }
+
+    gf_build_tables();
+    const char *forced = getenv("FT_FEC_IMPL");
+    const FecImpl *chosen = NULL;
+    for (size_t i = 0; i < FEC_NUM_IMPLS && chosen == NULL; i++) {
+        if (forced != NULL && strcmp(forced, fec_impls[i].name) != 0) {
+            continue;
+        }
+        if (fec_impls[i].supported()) {
+            chosen = &fec_impls[i];
+        }
+    }
+    for (size_t i = 0; i < FEC_NUM_IMPLS && chosen == NULL; i++) {
+        if (fec_impls[i].supported()) {
+            chosen = &fec_impls[i];
+        }
+    }
+
+    /* Tables are published before the kernel pointer (release/acquire) */
+    __atomic_store_n(&fec_active, chosen, __ATOMIC_RELEASE);
+}
+
+/* Select kernel by name */
+int fec_set_implementation(const char *name) {
+    fec_init_dispatch();
+    for (size_t i = 0; i < FEC_NUM_IMPLS; i++) {
+        if (strcmp(name, fec_impls[i].name) == 0 && fec_impls[i].supported()) {
+            __atomic_store_n(&fec_active, &fec_impls[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Name of the active kernel */
+const char* fec_implementation(void) {
+    fec_init_dispatch();
+    return fec_active->name;
+}
+
+/* dst ^= c * src */
+static void fec_mul_add(const FecImpl *impl, uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) {
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (size_t i = 0; i < length; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    impl->kernel(dst, src, c, length);
+}
+
+/* Build the Cauchy matrix of a code */
+int fec_init(FecCode *code, uint32_t k, uint32_t m) {
+    if (k == 0 || k > FT_FEC_MAX_DATA || m == 0 || m > FT_FEC_MAX_PARITY) {
+        return -1;
+    }
+    fec_init_dispatch();
+
+    memset(code, 0, sizeof(FecCode));
+    code->k = k;
+    code->m = m;
+    for (uint32_t j = 0; j < m; j++) {
+        for (uint32_t i = 0; i < k; i++) {
+            /* Row and column labels are distinct, so the sum is never zero */
+            code->matrix[j][i] = gf_inv((uint8_t)(j ^ (m + i)));
+        }
+    }
+    return 0;
+}
+
+/* Compute parity shards */
+void fec_encode(const FecCode *code, uint32_t k, const uint8_t *const *data, uint8_t *const *parity,
+                size_t size) {
+    const FecImpl *impl = __atomic_load_n(&fec_active, __ATOMIC_ACQUIRE);
+
+    for (uint32_t j = 0; j < code->m; j++) {
+        memset(parity[j], 0, size);
+        for (uint32_t i = 0; i < k && i < code->k; i++) {
+            fec_mul_add(impl, parity[j], data[i], code->matrix[j][i], size);
+        }
+    }
+}
+
+/* Invert an n x n matrix in place by Gauss-Jordan elimination; -1 if singular */
+static int gf_invert(uint8_t matrix[FT_FEC_MAX_PARITY][FT_FEC_MAX_PARITY], uint32_t n) {
+    uint8_t inverse[FT_FEC_MAX_PARITY][FT_FEC_MAX_PARITY];
+    memset(inverse, 0, sizeof(inverse));
+    for (uint32_t i = 0; i < n; i++) {
+        inverse[i][i] = 1;
+    }
+
+    for (uint32_t col = 0; col < n; col++) {
+        uint32_t pivot = col;
+        while (pivot < n && matrix[pivot][col] == 0) {
+            pivot++;
+        }
+        if (pivot == n) {
+            return -1;
+        }
+        if (pivot != col) {
+            for (uint32_t j = 0; j < n; j++) {
+                uint8_t t = matrix[col][j]; matrix[col][j] = matrix[pivot][j]; matrix[pivot][j] = t;
+                t = inverse[col][j]; inverse[col][j] = inverse[pivot][j]; inverse[pivot][j] = t;
+            }
+        }
+
+        uint8_t scale = gf_inv(matrix[col][col]);
+        for (uint32_t j = 0; j < n; j++) {
+            matrix[col][j] = gf_mul(matrix[col][j], scale);
+            inverse[col][j] = gf_mul(inverse[col][j], scale);
+        }
+        for (uint32_t row = 0; row < n; row++) {
+            uint8_t factor = matrix[row][col];
+            if (row == col || factor == 0) {
+                continue;
+            }
+            for (uint32_t j = 0; j < n; j++) {
+                matrix[row][j] ^= gf_mul(factor, matrix[col][j]);
+                inverse[row][j] ^= gf_mul(factor, inverse[col][j]);
+            }
+        }
+    }
+
+    memcpy(matrix, inverse, sizeof(inverse));
+    return 0;
+}
+
+/* Rebuild missing data shards */
+int fec_decode(const FecCode *code, uint32_t k, uint8_t *const *data, uint64_t data_present,
+               const uint8_t *const *parity, uint32_t parity_present, size_t size) {
+    const FecImpl *impl = __atomic_load_n(&fec_active, __ATOMIC_ACQUIRE);
+    uint32_t missing[FT_FEC_MAX_PARITY];
+    uint32_t rows[FT_FEC_MAX_PARITY];
+    uint32_t lost = 0;
+    uint32_t used = 0;
+
+    if (k > code->k) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < k; i++) {
+        if ((data_present >> i) & 1) {
+            continue;
+        }
+        if (lost == code->m) {
+            return -1;
+        }
+        missing[lost++] = i;
+    }
+    if (lost == 0) {
+        return 0;
+    }
+    for (uint32_t j = 0; j < code->m && used < lost; j++) {
+        if ((parity_present >> j) & 1) {
+            rows[used++] = j;
+        }
+    }
+    if (used < lost) {
+        return -1;
+    }
+
+    /* Each parity row, less the data shards that are present, is a sum
+     * over the missing ones only: solve those lost equations */
+    uint8_t matrix[FT_FEC_MAX_PARITY][FT_FEC_MAX_PARITY];
+    for (uint32_t a = 0; a < lost; a++) {
+        for (uint32_t b = 0; b < lost; b++) {
+            matrix[a][b] = code->matrix[rows[a]][missing[b]];
+        }
+    }
+    if (gf_invert(matrix, lost) != 0) {
+        return -1;
+    }
+
+    uint8_t *syndromes = (uint8_t*)malloc(lost * size);
+    if (syndromes == NULL) {
+        return -1;
+    }
+    for (uint32_t a = 0; a < lost; a++) {
+        uint8_t *s = syndromes + a * size;
+        memcpy(s, parity[rows[a]], size);
+        for (uint32_t i = 0; i < k; i++) {
+            if ((data_present >> i) & 1) {
+                fec_mul_add(impl, s, data[i], code->matrix[rows[a]][i], size);
+            }
+        }
+    }
+    for (uint32_t b = 0; b < lost; b++) {
+        uint8_t *out = data[missing[b]];
+        memset(out, 0, size);
+        for (uint32_t a = 0; a < lost; a++) {
+            fec_mul_add(impl, out, syndromes + a * size, matrix[b][a], size);
+        }
+    }
+    free(syndromes);
+    return (int)lost;
+}
@@ -0,0 +1,57 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FT_FEC_MAX_DATA    64       /* Data shards in one group */
+#define FT_FEC_MAX_PARITY  8        /* Parity shards in one group */
+
+/*
+ * Reed-Solomon erasure code over GF(2^8) (polynomial 0x11D). A group of k
+ * equal-sized data shards gets m parity shards, and any k of the k + m
+ * recover the data. The code is systematic: the data shards go out as
+ * they are, and parity shard j is the sum over i of C[j][i] * data[i],
+ * where C is the Cauchy matrix 1 / (j + (m + i)). Every square submatrix
+ * of a Cauchy matrix is invertible, so a shorter group uses the first
+ * columns of the same code, and repairing e lost shards takes e parity
+ * rows and an e x e inverse rather than a k x k one.
+ *
+ * The shard arithmetic is one multiply-accumulate kernel, dst ^= c * src,
+ * done with 4-bit table lookups in SIMD registers (AVX2, SSSE3, NEON)
+ * where the CPU has them and with a full 256-entry table row otherwise.
+ */
+typedef struct {
+    uint32_t k;                                       /* Data shards of a full group */
+    uint32_t m;
+    uint8_t  matrix[FT_FEC_MAX_PARITY][FT_FEC_MAX_DATA];
+} FecCode;
+
+/* Select the fastest kernel for this CPU (idempotent; the FT_FEC_IMPL
+ * environment variable may force a kernel by name) */
+void fec_init_dispatch(void);
+
+/* Force a kernel by name ("avx2", "ssse3", "neon", "table"); returns -1
+ * if unknown or unsupported on this CPU */
+int fec_set_implementation(const char *name);
+
+/* Name of the active kernel */
+const char* fec_implementation(void);
+
+/* Set up a code of k data and m parity shards per group; -1 if out of
+ * range (1..FT_FEC_MAX_DATA, 1..FT_FEC_MAX_PARITY) */
+int fec_init(FecCode *code, uint32_t k, uint32_t m);
+
+/* Compute the m parity shards of a group of k <= code->k data shards,
+ * each size bytes */
+void fec_encode(const FecCode *code, uint32_t k, const uint8_t *const *data, uint8_t *const *parity,
+                size_t size);
+
+/* Rebuild the data shards of a group of k missing from data_present (bit
+ * i: data[i] holds its shard) from the parity shards in parity_present
+ * (bit j: parity[j]). Missing data shards are written in place. Returns
+ * the shards rebuilt, or -1 if fewer than k shards are present. */
+int fec_decode(const FecCode *code, uint32_t k, uint8_t *const *data, uint64_t data_present,
+               const uint8_t *const *parity, uint32_t parity_present, size_t size);
+
+#endif /* FEC_H */
@@ -1,15 +1,22 @@
 #include "fileio.h"
 #include "platform.h"
 #include "logger.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
 
 #ifdef FT_PLATFORM_WINDOWS
 #include <windows.h>
+#include <winioctl.h>
 #include <direct.h>
+#include <malloc.h>
+#include <io.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/utime.h>
 #define mkdir(path, mode) _mkdir(path)
 typedef struct __stat64 stat_t;
 #define stat_func _stat64
@@ -18,6 +25,18 @@ typedef struct __stat64 stat_t;
 typedef struct stat stat_t;
 #define stat_func stat
 #include <sys/statvfs.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef FT_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+#ifdef FT_PLATFORM_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #endif
 
 /* Open file for reading */
@@ -31,34 +50,921 @@ FILE* file_open_read(const char *filepath, FTErrorCode *error) {
         }
         return NULL;
     }
+
+    /* Files are read front to back: let the OS use a larger read-ahead window */
+#if defined(FT_PLATFORM_MACOS)
+    fcntl(fileno(file), F_RDAHEAD, 1);
+#elif !defined(FT_PLATFORM_WINDOWS)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
     if (error) *error = FT_SUCCESS;
     return file;
 }
 
-/* Open file for writing (creates temp file) */
-FILE* file_open_write(const char *output_dir, const char *filename,
-                      char *temp_path, size_t temp_path_size, FTErrorCode *error) {
-    /* Build temp file path */
-    snprintf(temp_path, temp_path_size, "%s%c.%s.tmp",
-             output_dir, PATH_SEPARATOR, filename);
+/* Advise upcoming read */
+void file_advise_willneed(FILE *file, uint64_t offset, size_t length) {
+#if defined(FT_PLATFORM_MACOS)
+    struct radvisory advice;
+    advice.ra_offset = (off_t)offset;
+    advice.ra_count = (int)length;
+    fcntl(fileno(file), F_RDADVISE, &advice);
+#elif !defined(FT_PLATFORM_WINDOWS)
+    posix_fadvise(fileno(file), (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#else
+    (void)file;
+    (void)offset;
+    (void)length;
+#endif
+}
 
-    FILE *file = fopen(temp_path, "wb");
-    if (file == NULL) {
-        LOG_ERROR("Failed to open file for writing: %s - %s", temp_path, strerror(errno));
-        if (error) {
-            *error = (errno == ENOSPC) ? FT_ERR_DISK_FULL :
-                     (errno == EACCES) ? FT_ERR_PERMISSION : FT_ERR_FILE_OPEN;
+#ifdef FT_PLATFORM_WINDOWS
+
+/* Map GetLastError() from a failed file call to an error code */
+static FTErrorCode win_error_code(DWORD err, FTErrorCode fallback) {
+    return (err == ERROR_DISK_FULL || err == ERROR_HANDLE_DISK_FULL) ? FT_ERR_DISK_FULL :
+           (err == ERROR_ACCESS_DENIED) ? FT_ERR_PERMISSION : fallback;
+}
+
+/* Open temp file, or reopen it to resume; FILE_FLAG_NO_BUFFERING when
+ * direct I/O is requested */
+static int output_open_handle(OutputFile *out, const char *path, int resume, FTErrorCode *error) {
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (out->policy.direct_io) {
+        flags |= FILE_FLAG_NO_BUFFERING;
+    }
+    out->handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              resume ? OPEN_EXISTING : CREATE_ALWAYS, flags, NULL);
+    if (out->handle == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        LOG_ERROR("Failed to open file for writing: %s (error %lu)", path, (unsigned long)err);
+        if (error) *error = win_error_code(err, FT_ERR_FILE_OPEN);
+        return -1;
+    }
+    out->direct_io = out->policy.direct_io;
+    return 0;
+}
+
+/* Reserve space for the whole file so it is laid out in one piece; a
+ * sparse file is only marked sparse and sized */
+static int output_preallocate(OutputFile *out, FTErrorCode *error) {
+    if (out->policy.sparse) {
+        DWORD returned;
+        FILE_END_OF_FILE_INFO end;
+        if (!DeviceIoControl(out->handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL)) {
+            LOG_DEBUG("Sparse files not supported (error %lu)", (unsigned long)GetLastError());
         }
-        return NULL;
+        end.EndOfFile.QuadPart = (LONGLONG)out->file_size;
+        if (!SetFileInformationByHandle(out->handle, FileEndOfFileInfo, &end, sizeof(end))) {
+            DWORD err = GetLastError();
+            LOG_ERROR("Failed to set output file size (error %lu)", (unsigned long)err);
+            if (error) *error = win_error_code(err, FT_ERR_FILE_WRITE);
+            return -1;
+        }
+        return 0;
+    }
+
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)out->file_size;
+    if (!SetFileInformationByHandle(out->handle, FileAllocationInfo, &info, sizeof(info))) {
+        DWORD err = GetLastError();
+        if (err == ERROR_DISK_FULL || err == ERROR_HANDLE_DISK_FULL) {
+            LOG_ERROR("Failed to preallocate %llu bytes: disk full", (unsigned long long)out->file_size);
+            if (error) *error = FT_ERR_DISK_FULL;
+            return -1;
+        }
+        LOG_DEBUG("Preallocation not supported (error %lu)", (unsigned long)err);
+    }
+    return 0;
+}
+
+/* Positional write of the whole buffer */
+static int output_pwrite(OutputFile *out, uint64_t offset, const uint8_t *buffer,
+                         size_t size, FTErrorCode *error) {
+    while (size > 0) {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFFu);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD request = size > 0x40000000u ? 0x40000000u : (DWORD)size;
+        DWORD written = 0;
+        if (!WriteFile(out->handle, buffer, request, &written, &ov) || written == 0) {
+            DWORD err = GetLastError();
+            LOG_ERROR("Failed to write at offset %llu (error %lu)",
+                      (unsigned long long)offset, (unsigned long)err);
+            if (error) *error = win_error_code(err, FT_ERR_FILE_WRITE);
+            return -1;
+        }
+        buffer += written;
+        offset += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/* Flush file data to disk */
+static int output_datasync(OutputFile *out) {
+    return FlushFileBuffers(out->handle) ? 0 : -1;
+}
+
+/* Cut the file to its real size (direct writes pad the last chunk) */
+static int output_truncate(OutputFile *out) {
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = (LONGLONG)out->file_size;
+    return SetFileInformationByHandle(out->handle, FileEndOfFileInfo, &info, sizeof(info)) ? 0 : -1;
+}
+
+/* Deallocate a range (zeros are written instead on a file not marked sparse) */
+static int output_deallocate(OutputFile *out, uint64_t offset, uint64_t size) {
+    FILE_ZERO_DATA_INFORMATION zero;
+    DWORD returned;
+    zero.FileOffset.QuadPart = (LONGLONG)offset;
+    zero.BeyondFinalZero.QuadPart = (LONGLONG)(offset + size);
+    return DeviceIoControl(out->handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0,
+                           &returned, NULL) ? 0 : -1;
+}
+
+/* Close file handle */
+static void output_close_handle(OutputFile *out) {
+    CloseHandle(out->handle);
+    out->handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+/* Map errno from a failed open/write to an error code */
+static FTErrorCode errno_error_code(int err, FTErrorCode fallback) {
+    return (err == ENOSPC) ? FT_ERR_DISK_FULL :
+           (err == EACCES) ? FT_ERR_PERMISSION : fallback;
+}
+
+/* Open temp file, or reopen it to resume; O_DIRECT (F_NOCACHE on macOS)
+ * when direct I/O is requested */
+static int output_open_handle(OutputFile *out, const char *path, int resume, FTErrorCode *error) {
+    /* Readable too, so the file can be mapped to receive into */
+    int flags = resume ? O_RDWR : (O_RDWR | O_CREAT | O_TRUNC);
+    out->direct_io = 0;
+
+#ifdef O_DIRECT
+    if (out->policy.direct_io) {
+        out->fd = open(path, flags | O_DIRECT, 0644);
+        if (out->fd >= 0) {
+            out->direct_io = 1;
+            return 0;
+        }
+        if (errno != EINVAL) {
+            LOG_ERROR("Failed to open file for writing: %s - %s", path, strerror(errno));
+            if (error) *error = errno_error_code(errno, FT_ERR_FILE_OPEN);
+            return -1;
+        }
+        LOG_WARN("File system does not support direct I/O, using buffered writes");
+    }
+#endif
+
+    out->fd = open(path, flags, 0644);
+    if (out->fd < 0) {
+        LOG_ERROR("Failed to open file for writing: %s - %s", path, strerror(errno));
+        if (error) *error = errno_error_code(errno, FT_ERR_FILE_OPEN);
+        return -1;
+    }
+
+#if defined(FT_PLATFORM_MACOS)
+    if (out->policy.direct_io && fcntl(out->fd, F_NOCACHE, 1) == 0) {
+        out->direct_io = 1;
+    }
+#endif
+    return 0;
+}
+
+/* Reserve space for the whole file so it is laid out in one piece; a
+ * sparse file is only sized */
+static int output_preallocate(OutputFile *out, FTErrorCode *error) {
+    int err = 0;
+    if (out->policy.sparse) {
+        if (ftruncate(out->fd, (off_t)out->file_size) != 0) {
+            LOG_ERROR("Failed to set output file size: %s", strerror(errno));
+            if (error) *error = errno_error_code(errno, FT_ERR_FILE_WRITE);
+            return -1;
+        }
+        return 0;
+    }
+#if defined(FT_PLATFORM_LINUX)
+    /* fallocate, not posix_fallocate: glibc emulates the latter by writing
+     * zeros over the whole file when the file system lacks support */
+    if (fallocate(out->fd, 0, 0, (off_t)out->file_size) != 0) {
+        err = errno;
+    }
+#elif defined(FT_PLATFORM_MACOS)
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)out->file_size, 0};
+    if (fcntl(out->fd, F_PREALLOCATE, &store) != 0) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(out->fd, F_PREALLOCATE, &store) != 0) {
+            err = errno;
+        }
+    }
+    if (err == 0 && ftruncate(out->fd, (off_t)out->file_size) != 0) {
+        err = errno;
+    }
+#else
+    err = posix_fallocate(out->fd, 0, (off_t)out->file_size);
+#endif
+
+    if (err == ENOSPC) {
+        LOG_ERROR("Failed to preallocate %llu bytes: %s", (unsigned long long)out->file_size, strerror(err));
+        if (error) *error = FT_ERR_DISK_FULL;
+        return -1;
+    }
+    if (err != 0) {
+        LOG_DEBUG("Preallocation not supported: %s", strerror(err));
+    }
+    return 0;
+}
+
+/* Positional write of the whole buffer */
+static int output_pwrite(OutputFile *out, uint64_t offset, const uint8_t *buffer,
+                         size_t size, FTErrorCode *error) {
+    while (size > 0) {
+#ifdef FT_HAVE_IO_URING
+        ssize_t written = uring_available() ? uring_pwrite(out->fd, buffer, size, offset) :
+                          pwrite(out->fd, buffer, size, (off_t)offset);
+#else
+        ssize_t written = pwrite(out->fd, buffer, size, (off_t)offset);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Failed to write at offset %llu: %s", (unsigned long long)offset, strerror(errno));
+            if (error) *error = errno_error_code(errno, FT_ERR_FILE_WRITE);
+            return -1;
+        }
+        if (written == 0) {
+            LOG_ERROR("Failed to write at offset %llu: no progress", (unsigned long long)offset);
+            if (error) *error = FT_ERR_FILE_WRITE;
+            return -1;
+        }
+        buffer += written;
+        offset += (uint64_t)written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Flush file data (not metadata other than size) to disk */
+static int output_datasync(OutputFile *out) {
+#if defined(FT_PLATFORM_MACOS)
+    return fsync(out->fd);
+#elif defined(FT_HAVE_IO_URING)
+    return uring_available() ? uring_fdatasync(out->fd) : fdatasync(out->fd);
+#else
+    return fdatasync(out->fd);
+#endif
+}
+
+/* Cut the file to its real size (direct writes pad the last chunk) */
+static int output_truncate(OutputFile *out) {
+    return ftruncate(out->fd, (off_t)out->file_size);
+}
+
+/* Deallocate a range; -1 where the file system cannot */
+static int output_deallocate(OutputFile *out, uint64_t offset, uint64_t size) {
+#if defined(FT_PLATFORM_LINUX)
+    return fallocate(out->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)size);
+#elif defined(FT_PLATFORM_MACOS) && defined(F_PUNCHHOLE)
+    struct fpunchhole punch = {0, 0, (off_t)offset, (off_t)size};
+    return fcntl(out->fd, F_PUNCHHOLE, &punch);
+#else
+    (void)out;
+    (void)offset;
+    (void)size;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+/* Close file descriptor */
+static void output_close_handle(OutputFile *out) {
+    close(out->fd);
+    out->fd = -1;
+}
+
+#endif
+
+/* Flatten a relative path into one directory entry name */
+void file_flatten_name(const char *name, char *flat, size_t size) {
+    size_t i = 0;
+    for (; name[i] != '\0' && i < size - 1; i++) {
+        flat[i] = (name[i] == '/') ? FT_FLAT_SEPARATOR : name[i];
+    }
+    flat[i] = '\0';
+
+    /* Long paths sharing a prefix must not share an entry */
+    if (name[i] != '\0' && size > 10) {
+        snprintf(flat + size - 10, 10, "~%08x", crc32_compute((const uint8_t*)name, strlen(name)));
+    }
+}
+
+/* Build temp file path */
+void file_temp_path(const char *output_dir, const char *filename, char *path, size_t size) {
+    char flat[FT_FLAT_NAME_MAX + 1];
+    file_flatten_name(filename, flat, sizeof(flat));
+    snprintf(path, size, "%s%c.%s.tmp", output_dir, PATH_SEPARATOR, flat);
+}
+
+/* Open output file (creates temp file) */
+int file_output_open(OutputFile *out, const char *output_dir, const char *filename,
+                     uint64_t file_size, const WritePolicy *policy, int resume,
+                     char *temp_path, size_t temp_path_size, FTErrorCode *error) {
+    memset(out, 0, sizeof(OutputFile));
+    out->file_size = file_size;
+    out->policy = *policy;
+
+    file_temp_path(output_dir, filename, temp_path, temp_path_size);
+    if (output_open_handle(out, temp_path, resume, error) != 0) {
+        return -1;
+    }
+
+    if (file_size > 0 && output_preallocate(out, error) != 0) {
+        output_close_handle(out);
+        return -1;
     }
 
+    LOG_DEBUG("Output file: %s I/O, durability %s", out->direct_io ? "direct" : "buffered",
+              policy->durability == DURABILITY_NONE ? "none" :
+              policy->durability == DURABILITY_PERIODIC ? "periodic" : "finalize");
     if (error) *error = FT_SUCCESS;
-    return file;
+    return 0;
+}
+
+/* Bytes actually written for a chunk: direct I/O moves whole blocks, and
+ * the padding past the end of the file is cut off again on close */
+static int output_write_size(const OutputFile *out, uint64_t offset, const uint8_t *buffer,
+                             size_t size, size_t *write_size, FTErrorCode *error) {
+    *write_size = size;
+    if (out->direct_io) {
+        if (offset % FT_IO_ALIGNMENT != 0 || (uintptr_t)buffer % FT_IO_ALIGNMENT != 0) {
+            LOG_ERROR("Unaligned direct write at offset %llu", (unsigned long long)offset);
+            if (error) *error = FT_ERR_INVALID_ARG;
+            return -1;
+        }
+        *write_size = (size + FT_IO_ALIGNMENT - 1) & ~(size_t)(FT_IO_ALIGNMENT - 1);
+    }
+    return 0;
+}
+
+/* Write chunk at offset */
+int file_output_write(OutputFile *out, uint64_t offset, const uint8_t *buffer,
+                      size_t size, FTErrorCode *error) {
+    size_t write_size;
+
+    if (output_write_size(out, offset, buffer, size, &write_size, error) != 0) {
+        return -1;
+    }
+
+    if (output_pwrite(out, offset, buffer, write_size, error) != 0) {
+        return -1;
+    }
+
+    if (out->policy.durability == DURABILITY_PERIODIC) {
+        out->unsynced_bytes += size;
+        if (out->unsynced_bytes >= out->policy.sync_interval &&
+            file_output_sync(out, error) != 0) {
+            return -1;
+        }
+    }
+
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Write several chunks */
+int file_output_write_batch(OutputFile *out, const OutputWrite *writes, int count,
+                            FTErrorCode *error) {
+#ifdef FT_HAVE_IO_URING
+    if (uring_available() && count > 1 && count <= FT_URING_MAX_BATCH) {
+        UringWrite batch[FT_URING_MAX_BATCH];
+        uint64_t batch_bytes = 0;
+        for (int i = 0; i < count; i++) {
+            if (output_write_size(out, writes[i].offset, writes[i].buffer, writes[i].size,
+                                  &batch[i].len, error) != 0) {
+                return -1;
+            }
+            batch[i].buf = writes[i].buffer;
+            batch[i].offset = writes[i].offset;
+            batch_bytes += writes[i].size;
+        }
+
+        /* A periodic sync that falls due rides on the end of the same submission */
+        int sync = out->policy.durability == DURABILITY_PERIODIC &&
+                   out->unsynced_bytes + batch_bytes >= out->policy.sync_interval;
+        if (uring_pwrite_batch(out->fd, batch, count, sync) != 0) {
+            LOG_ERROR("Failed to write %d chunks from offset %llu: %s", count,
+                      (unsigned long long)writes[0].offset, strerror(errno));
+            if (error) *error = errno_error_code(errno, FT_ERR_FILE_WRITE);
+            return -1;
+        }
+        if (out->policy.durability == DURABILITY_PERIODIC) {
+            out->unsynced_bytes = sync ? 0 : out->unsynced_bytes + batch_bytes;
+        }
+
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        if (file_output_write(out, writes[i].offset, writes[i].buffer, writes[i].size, error) != 0) {
+            return -1;
+        }
+    }
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Punch a hole, or write zeros */
+int file_output_punch(OutputFile *out, uint64_t offset, uint64_t size, FTErrorCode *error) {
+    if (size == 0 || output_deallocate(out, offset, size) == 0) {
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+
+    /* Direct writes need an aligned buffer, and a whole block past the end */
+    size_t block = size < FT_PUNCH_ZERO_BUFFER ? (size_t)size : FT_PUNCH_ZERO_BUFFER;
+    uint8_t *zeros = file_alloc_buffer(block);
+    if (zeros == NULL) {
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    memset(zeros, 0, (block + FT_IO_ALIGNMENT - 1) & ~(size_t)(FT_IO_ALIGNMENT - 1));
+    int result = 0;
+    while (size > 0 && result == 0) {
+        size_t length = size < block ? (size_t)size : block;
+        result = file_output_write(out, offset, zeros, length, error);
+        offset += length;
+        size -= length;
+    }
+    file_free_buffer(zeros);
+    return result;
+}
+
+/* Flush written data to stable storage */
+int file_output_sync(OutputFile *out, FTErrorCode *error) {
+    if (output_datasync(out) != 0) {
+        LOG_ERROR("Failed to sync output file: %s", strerror(errno));
+        if (error) *error = FT_ERR_FILE_WRITE;
+        return -1;
+    }
+    out->unsynced_bytes = 0;
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Close output file */
+int file_output_close(OutputFile *out, int commit, FTErrorCode *error) {
+    int result = 0;
+
+    if (commit) {
+        if (out->direct_io && output_truncate(out) != 0) {
+            LOG_ERROR("Failed to set output file size: %s", strerror(errno));
+            if (error) *error = FT_ERR_FILE_WRITE;
+            result = -1;
+        } else if (out->policy.durability != DURABILITY_NONE &&
+                   file_output_sync(out, error) != 0) {
+            result = -1;
+        }
+    }
+
+    output_close_handle(out);
+    if (result == 0 && error) *error = FT_SUCCESS;
+    return result;
+}
+
+#ifndef FT_PLATFORM_WINDOWS
+
+/* Copy a range between descriptors without bringing it into user space:
+ * share the source's extents where the file system has reflinks (btrfs,
+ * XFS), else let the kernel copy. -1 if neither applies here. */
+static int copy_fd_range(int src_fd, uint64_t src_offset, int dst_fd, uint64_t dst_offset,
+                         size_t size, int direct_io, CopyMethod *method) {
+#if defined(FT_PLATFORM_LINUX)
+#ifdef FICLONERANGE
+    /* A length that is not block-aligned must end at both files' ends,
+     * which holds for the last chunk of a file */
+    struct file_clone_range range;
+    range.src_fd = src_fd;
+    range.src_offset = src_offset;
+    range.src_length = size;
+    range.dest_offset = dst_offset;
+    if (ioctl(dst_fd, FICLONERANGE, &range) == 0) {
+        *method = COPY_SHARED;
+        return 0;
+    }
+#endif
+    /* The in-kernel copy may go through the page cache, which direct I/O
+     * descriptors refuse */
+    if (!direct_io) {
+        loff_t in = (loff_t)src_offset;
+        loff_t out = (loff_t)dst_offset;
+        size_t left = size;
+        while (left > 0) {
+            ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, left, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                /* The buffered copy starts over; rewriting the same bytes is harmless */
+                return -1;
+            }
+            left -= (size_t)n;
+        }
+        *method = COPY_KERNEL;
+        return 0;
+    }
+#else
+    (void)src_fd;
+    (void)src_offset;
+    (void)dst_fd;
+    (void)dst_offset;
+    (void)size;
+    (void)direct_io;
+    (void)method;
+#endif
+    return -1;
+}
+
+#endif
+
+/* Read size bytes at src_offset of src_path into a buffer from
+ * file_alloc_buffer(), zero-padded to the direct I/O alignment */
+static uint8_t* copy_read_source(const char *src_path, uint64_t src_offset, size_t size, FTErrorCode *error) {
+    FILE *src = file_open_read(src_path, error);
+    if (src == NULL) {
+        return NULL;
+    }
+    uint8_t *buffer = file_alloc_buffer(size);
+    if (buffer == NULL) {
+        fclose(src);
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    size_t rounded = (size + FT_IO_ALIGNMENT - 1) & ~(size_t)(FT_IO_ALIGNMENT - 1);
+    size_t bytes_read = 0;
+    int result = file_read_chunk(src, src_offset, buffer, size, &bytes_read, error);
+    fclose(src);
+    if (result != 0 || bytes_read != size) {
+        LOG_ERROR("Failed to read %zu bytes at offset %llu of %s", size,
+                  (unsigned long long)src_offset, src_path);
+        file_free_buffer(buffer);
+        if (error) *error = FT_ERR_FILE_READ;
+        return NULL;
+    }
+    memset(buffer + size, 0, rounded - size);
+    return buffer;
+}
+
+/* Copy a range of a file into the output file */
+int file_output_copy(OutputFile *out, uint64_t offset, const char *src_path, uint64_t src_offset,
+                     size_t size, CopyMethod *method, FTErrorCode *error) {
+    CopyMethod how = COPY_BUFFERED;
+
+#ifndef FT_PLATFORM_WINDOWS
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd < 0) {
+        LOG_ERROR("Failed to open file for reading: %s - %s", src_path, strerror(errno));
+        if (error) *error = (errno == ENOENT) ? FT_ERR_FILE_NOT_FOUND : FT_ERR_FILE_OPEN;
+        return -1;
+    }
+    int copied = copy_fd_range(src_fd, src_offset, out->fd, offset, size, out->direct_io, &how);
+    close(src_fd);
+    if (copied == 0) {
+        if (out->policy.durability == DURABILITY_PERIODIC) {
+            out->unsynced_bytes += size;
+            if (out->unsynced_bytes >= out->policy.sync_interval && file_output_sync(out, error) != 0) {
+                return -1;
+            }
+        }
+        if (method) *method = how;
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+#endif
+
+    uint8_t *buffer = copy_read_source(src_path, src_offset, size, error);
+    if (buffer == NULL) {
+        return -1;
+    }
+    int result = file_output_write(out, offset, buffer, size, error);
+    file_free_buffer(buffer);
+    if (result == 0 && method) *method = how;
+    return result;
+}
+
+/* Copy a range of a file into a file of its own */
+int file_copy_range(const char *src_path, uint64_t src_offset, size_t size, const char *dst_path,
+                    int sync, CopyMethod *method, FTErrorCode *error) {
+    CopyMethod how = COPY_BUFFERED;
+    int result = -1;
+
+#ifndef FT_PLATFORM_WINDOWS
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd < 0) {
+        LOG_ERROR("Failed to open file for reading: %s - %s", src_path, strerror(errno));
+        if (error) *error = (errno == ENOENT) ? FT_ERR_FILE_NOT_FOUND : FT_ERR_FILE_OPEN;
+        return -1;
+    }
+    int dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst_fd < 0) {
+        LOG_ERROR("Failed to open file for writing: %s - %s", dst_path, strerror(errno));
+        if (error) *error = errno_error_code(errno, FT_ERR_FILE_OPEN);
+        close(src_fd);
+        return -1;
+    }
+
+    /* An empty clone range would mean "to the end of the source" */
+    int copied = (size == 0) ? 0 : copy_fd_range(src_fd, src_offset, dst_fd, 0, size, 0, &how);
+    close(src_fd);
+    if (copied != 0) {
+        uint8_t *buffer = copy_read_source(src_path, src_offset, size, error);
+        if (buffer == NULL) {
+            goto done;
+        }
+        OutputFile dst;
+        memset(&dst, 0, sizeof(dst));
+        dst.fd = dst_fd;
+        copied = output_pwrite(&dst, 0, buffer, size, error);
+        file_free_buffer(buffer);
+        if (copied != 0) {
+            goto done;
+        }
+    }
+    if (sync && fsync(dst_fd) != 0) {
+        LOG_ERROR("Failed to sync %s: %s", dst_path, strerror(errno));
+        if (error) *error = FT_ERR_FILE_WRITE;
+        goto done;
+    }
+    result = 0;
+
+done:
+    /* A close error on a file just written means the data may be lost */
+    if (close(dst_fd) != 0 && result == 0) {
+        LOG_ERROR("Failed to write %s: %s", dst_path, strerror(errno));
+        if (error) *error = FT_ERR_FILE_WRITE;
+        result = -1;
+    }
+#else
+    uint8_t *buffer = copy_read_source(src_path, src_offset, size, error);
+    if (buffer == NULL) {
+        return -1;
+    }
+    FILE *dst = fopen(dst_path, "wb");
+    if (dst == NULL) {
+        LOG_ERROR("Failed to open file for writing: %s - %s", dst_path, strerror(errno));
+        if (error) *error = FT_ERR_FILE_OPEN;
+        file_free_buffer(buffer);
+        return -1;
+    }
+    int written = fwrite(buffer, 1, size, dst) == size && fflush(dst) == 0 &&
+                  (!sync || FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(dst))));
+    if (fclose(dst) == 0 && written) {
+        result = 0;
+    } else {
+        LOG_ERROR("Failed to write %s", dst_path);
+        if (error) *error = FT_ERR_FILE_WRITE;
+    }
+    file_free_buffer(buffer);
+#endif
+
+    if (result == 0) {
+        if (method) *method = how;
+        if (error) *error = FT_SUCCESS;
+    }
+    return result;
+}
+
+/* Window size for a file of file_size bytes read in chunks of align */
+static int map_init(MappedFile *map, uint64_t file_size, uint32_t align, int writable, FTErrorCode *error) {
+    memset(map, 0, sizeof(*map));
+    map->file_size = file_size;
+    map->writable = writable;
+    if (file_size == 0 || align == 0) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+    if (file_size <= FT_MAP_BUDGET) {
+        map->window_size = file_size;
+    } else {
+        map->window_size = (FT_MAP_BUDGET / FT_MAP_WINDOWS - FT_MAP_GRANULARITY) / align * align;
+    }
+    return 0;
+}
+
+#ifdef FT_PLATFORM_WINDOWS
+
+/* Create the file mapping object */
+static int map_create(MappedFile *map, HANDLE handle, FTErrorCode *error) {
+    map->mapping = CreateFileMappingA(handle, NULL, map->writable ? PAGE_READWRITE : PAGE_READONLY,
+                                      (DWORD)(map->file_size >> 32), (DWORD)(map->file_size & 0xFFFFFFFFu), NULL);
+    if (map->mapping == NULL) {
+        LOG_ERROR("Failed to map file (error %lu)", (unsigned long)GetLastError());
+        if (error) *error = FT_ERR_FILE_READ;
+        return -1;
+    }
+    return 0;
+}
+
+/* Open map */
+int file_map_open(MappedFile *map, const char *filepath, uint32_t align, FTErrorCode *error) {
+    uint64_t size;
+    if (file_get_size(filepath, &size, error) != 0 || map_init(map, size, align, 0, error) != 0) {
+        return -1;
+    }
+    map->file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Failed to open %s (error %lu)", filepath, (unsigned long)GetLastError());
+        if (error) *error = FT_ERR_FILE_NOT_FOUND;
+        return -1;
+    }
+    if (map_create(map, map->file, error) != 0) {
+        CloseHandle(map->file);
+        return -1;
+    }
+    return 0;
+}
+
+/* Map output file */
+int file_map_output(MappedFile *map, const OutputFile *out, uint32_t align, FTErrorCode *error) {
+    if (map_init(map, out->file_size, align, 1, error) != 0) {
+        return -1;
+    }
+    map->file = INVALID_HANDLE_VALUE;
+    return map_create(map, out->handle, error);
+}
+
+/* Map one window */
+static uint8_t* map_view(MappedFile *map, uint64_t offset, size_t size) {
+    return (uint8_t*)MapViewOfFile(map->mapping, map->writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                   (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFFu), size);
+}
+
+/* Unmap one window */
+static void map_unview(MappedFile *map, MapWindow *window) {
+    /* Start writing the pages back; the file's own flush waits for them */
+    if (map->writable) {
+        FlushViewOfFile(window->base, 0);
+    }
+    UnmapViewOfFile(window->base);
+}
+
+/* Close map */
+void file_map_close(MappedFile *map) {
+    for (int i = 0; i < FT_MAP_WINDOWS; i++) {
+        if (map->windows[i].base != NULL) {
+            map_unview(map, &map->windows[i]);
+            map->windows[i].base = NULL;
+        }
+    }
+    if (map->mapping != NULL) {
+        CloseHandle(map->mapping);
+        map->mapping = NULL;
+    }
+    if (map->file != INVALID_HANDLE_VALUE && map->file != NULL) {
+        CloseHandle(map->file);
+        map->file = NULL;
+    }
+}
+
+#else
+
+/* Open map */
+int file_map_open(MappedFile *map, const char *filepath, uint32_t align, FTErrorCode *error) {
+    uint64_t size;
+    if (file_get_size(filepath, &size, error) != 0 || map_init(map, size, align, 0, error) != 0) {
+        return -1;
+    }
+    map->fd = open(filepath, O_RDONLY);
+    if (map->fd < 0) {
+        LOG_ERROR("Failed to open %s: %s", filepath, strerror(errno));
+        if (error) *error = errno_error_code(errno, FT_ERR_FILE_NOT_FOUND);
+        return -1;
+    }
+    map->own_fd = 1;
+    return 0;
+}
+
+/* Map output file */
+int file_map_output(MappedFile *map, const OutputFile *out, uint32_t align, FTErrorCode *error) {
+    struct stat st;
+    if (map_init(map, out->file_size, align, 1, error) != 0) {
+        return -1;
+    }
+    map->fd = out->fd;
+
+    /* Pages past the end of the file cannot be touched, and preallocation
+     * does not always set the size */
+    if (fstat(map->fd, &st) != 0 ||
+        ((uint64_t)st.st_size < map->file_size && ftruncate(map->fd, (off_t)map->file_size) != 0)) {
+        LOG_ERROR("Failed to size output file for mapping: %s", strerror(errno));
+        if (error) *error = errno_error_code(errno, FT_ERR_FILE_WRITE);
+        return -1;
+    }
+    return 0;
+}
+
+/* Map one window */
+static uint8_t* map_view(MappedFile *map, uint64_t offset, size_t size) {
+    void *base = mmap(NULL, size, map->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                      map->fd, (off_t)offset);
+    if (base == MAP_FAILED) {
+        LOG_DEBUG("Failed to map %zu bytes at %llu: %s", size, (unsigned long long)offset, strerror(errno));
+        return NULL;
+    }
+    if (!map->writable) {
+        posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+    }
+    return (uint8_t*)base;
+}
+
+/* Unmap one window; the pages stay in the page cache, where the output
+ * file's syncs find them */
+static void map_unview(MappedFile *map, MapWindow *window) {
+    (void)map;
+    munmap(window->base, window->size);
+}
+
+/* Close map */
+void file_map_close(MappedFile *map) {
+    for (int i = 0; i < FT_MAP_WINDOWS; i++) {
+        if (map->windows[i].base != NULL) {
+            map_unview(map, &map->windows[i]);
+            map->windows[i].base = NULL;
+        }
+    }
+    if (map->own_fd) {
+        close(map->fd);
+        map->own_fd = 0;
+    }
+}
+
+#endif
+
+/* Map chunk */
+uint8_t* file_map_chunk(MappedFile *map, uint64_t offset, size_t size, MapWindow **window) {
+    MapWindow *victim = NULL;
+
+    if (offset >= map->file_size || size > map->file_size - offset) {
+        return NULL;
+    }
+    for (int i = 0; i < FT_MAP_WINDOWS; i++) {
+        MapWindow *w = &map->windows[i];
+        if (w->base != NULL && offset >= w->offset && offset + size <= w->offset + w->size) {
+            w->refs++;
+            *window = w;
+            return w->base + (offset - w->offset);
+        }
+        /* Replace an unmapped window, or else the unused one furthest back */
+        if (w->refs == 0 && (victim == NULL || w->base == NULL ||
+                             (victim->base != NULL && w->offset < victim->offset))) {
+            victim = w;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    uint64_t start = offset / map->window_size * map->window_size;
+    uint64_t end = start + map->window_size < map->file_size ? start + map->window_size : map->file_size;
+    start -= start % FT_MAP_GRANULARITY;
+    if (offset + size > end) {
+        /* Chunks straddling windows are not aligned to the size given */
+        return NULL;
+    }
+    if (victim->base != NULL) {
+        map_unview(map, victim);
+        victim->base = NULL;
+    }
+    victim->base = map_view(map, start, (size_t)(end - start));
+    if (victim->base == NULL) {
+        return NULL;
+    }
+    victim->offset = start;
+    victim->size = (size_t)(end - start);
+    victim->refs = 1;
+    *window = victim;
+    return victim->base + (offset - start);
+}
+
+/* Release chunk */
+void file_map_release(MapWindow *window) {
+    if (window != NULL && window->refs > 0) {
+        window->refs--;
+    }
 }
 
 /* Finalize write (atomic rename) */
 int file_finalize_write(const char *temp_path, const char *final_path) {
-    /* Close any open handles first (caller should close the FILE*) */
+    /* Close any open handles first (caller should close the output file) */
 
 #ifdef FT_PLATFORM_WINDOWS
     /* On Windows, need to delete target if it exists */
@@ -74,13 +980,133 @@ int file_finalize_write(const char *temp_path, const char *final_path) {
         return FT_ERR_FILE_WRITE;
     }
 
-    LOG_INFO("File successfully written: %s", final_path);
+    LOG_DEBUG("File successfully written: %s", final_path);
     return FT_SUCCESS;
 }
 
+/* Sync the directory holding path */
+int file_sync_parent(const char *path, FTErrorCode *error) {
+#ifdef FT_PLATFORM_WINDOWS
+    (void)path;
+#else
+    char dir[1024];
+    const char *slash = strrchr(path, '/');
+    size_t length = slash == NULL ? 0 : (slash == path ? 1 : (size_t)(slash - path));
+
+    if (length >= sizeof(dir)) {
+        if (error) *error = FT_ERR_FILENAME_TOO_LONG;
+        return -1;
+    }
+    if (length == 0) {
+        strcpy(dir, ".");
+    } else {
+        memcpy(dir, path, length);
+        dir[length] = '\0';
+    }
+
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        LOG_ERROR("Failed to sync directory %s: %s", dir, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (error) *error = FT_ERR_FILE_WRITE;
+        return -1;
+    }
+    close(fd);
+#endif
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Start at the beginning of the file */
+void file_extents_init(FileExtents *extents, FILE *file, uint64_t file_size) {
+    extents->file = file;
+    extents->file_size = file_size;
+    extents->from = 0;
+    extents->data_start = 0;
+    extents->data_end = 0;
+}
+
+/* Find the first data extent at or after offset */
+static void extents_lookup(FileExtents *extents, uint64_t offset) {
+    uint64_t start = offset;
+    uint64_t end = extents->file_size;
+#if defined(FT_PLATFORM_WINDOWS)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(extents->file));
+    FILE_ALLOCATED_RANGE_BUFFER query, range;
+    DWORD returned = 0;
+    query.FileOffset.QuadPart = (LONGLONG)offset;
+    query.Length.QuadPart = (LONGLONG)(extents->file_size - offset);
+    if (DeviceIoControl(handle, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), &range, sizeof(range),
+                        &returned, NULL) || GetLastError() == ERROR_MORE_DATA) {
+        if (returned < sizeof(range)) {
+            start = extents->file_size;
+        } else {
+            start = (uint64_t)range.FileOffset.QuadPart;
+            end = start + (uint64_t)range.Length.QuadPart;
+        }
+    }
+#elif defined(SEEK_DATA) && defined(SEEK_HOLE)
+    /* The stream's own idea of the position must survive the probes */
+    int fd = fileno(extents->file);
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    off_t data = lseek(fd, (off_t)offset, SEEK_DATA);
+    if (data >= 0) {
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        start = (uint64_t)data;
+        if (hole >= 0) {
+            end = (uint64_t)hole;
+        }
+    } else if (errno == ENXIO) {
+        start = extents->file_size;   /* Nothing but a hole to the end */
+    }
+    if (position >= 0) {
+        lseek(fd, position, SEEK_SET);
+    }
+#endif
+    extents->from = offset;
+    extents->data_start = start < extents->file_size ? start : extents->file_size;
+    extents->data_end = end < extents->file_size ? end : extents->file_size;
+}
+
+/* Check a range against the current extent, moving on past it */
+int file_extents_hole(FileExtents *extents, uint64_t offset, size_t size) {
+    if (offset < extents->from || offset >= extents->data_end) {
+        extents_lookup(extents, offset);
+    }
+    return offset + size <= extents->data_start;
+}
+
 /* Read chunk from file */
 int file_read_chunk(FILE *file, uint64_t offset, uint8_t *buffer,
                     size_t chunk_size, size_t *bytes_read, FTErrorCode *error) {
+#ifdef FT_HAVE_IO_URING
+    /* Positional reads on the descriptor; callers never mix them with
+     * buffered reads on the same handle */
+    if (uring_available()) {
+        size_t total = 0;
+        while (total < chunk_size) {
+            ssize_t n = uring_pread(fileno(file), buffer + total, chunk_size - total, offset + total);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG_ERROR("Failed to read from file: %s", strerror(errno));
+                if (error) *error = FT_ERR_FILE_READ;
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            total += (size_t)n;
+        }
+        *bytes_read = total;
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+#endif
+
     /* Seek to offset */
     if (fseeko(file, (off_t)offset, SEEK_SET) != 0) {
         LOG_ERROR("Failed to seek to offset %llu: %s", (unsigned long long)offset, strerror(errno));
@@ -101,36 +1127,30 @@ int file_read_chunk(FILE *file, uint64_t offset, uint8_t *buffer,
     return 0;
 }
 
-/* Write chunk to file */
-int file_write_chunk(FILE *file, uint64_t offset, const uint8_t *buffer,
-                     size_t chunk_size, FTErrorCode *error) {
-    /* Seek to offset */
-    if (fseeko(file, (off_t)offset, SEEK_SET) != 0) {
-        LOG_ERROR("Failed to seek to offset %llu: %s", (unsigned long long)offset, strerror(errno));
-        if (error) *error = FT_ERR_FILE_SEEK;
-        return -1;
-    }
-
-    /* Write data */
-    size_t written = fwrite(buffer, 1, chunk_size, file);
-    if (written != chunk_size) {
-        LOG_ERROR("Failed to write chunk (wrote %zu of %zu bytes): %s",
-                  written, chunk_size, strerror(errno));
-        if (error) {
-            *error = (errno == ENOSPC) ? FT_ERR_DISK_FULL : FT_ERR_FILE_WRITE;
-        }
-        return -1;
+/* Allocate I/O buffer */
+uint8_t* file_alloc_buffer(size_t size) {
+    size_t rounded = (size + FT_IO_ALIGNMENT - 1) & ~(size_t)(FT_IO_ALIGNMENT - 1);
+    if (rounded == 0) {
+        rounded = FT_IO_ALIGNMENT;
     }
-
-    /* Flush to ensure data is written */
-    if (fflush(file) != 0) {
-        LOG_ERROR("Failed to flush file: %s", strerror(errno));
-        if (error) *error = FT_ERR_FILE_WRITE;
-        return -1;
+#ifdef FT_PLATFORM_WINDOWS
+    return (uint8_t*)_aligned_malloc(rounded, FT_IO_ALIGNMENT);
+#else
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, FT_IO_ALIGNMENT, rounded) != 0) {
+        return NULL;
     }
+    return (uint8_t*)buffer;
+#endif
+}
 
-    if (error) *error = FT_SUCCESS;
-    return 0;
+/* Free I/O buffer */
+void file_free_buffer(uint8_t *buffer) {
+#ifdef FT_PLATFORM_WINDOWS
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
 }
 
 /* Get file metadata */
@@ -259,6 +1279,67 @@ int file_sanitize_filename(const char *filename, char *sanitized, size_t size) {
     return FT_SUCCESS;
 }
 
+/* Copy one path component, replacing dangerous characters; 0 if nothing is left */
+static size_t sanitize_component(const char *component, size_t length, char *out, size_t room) {
+    size_t j = 0;
+    for (size_t i = 0; i < length && j < room; i++) {
+        char c = component[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.') {
+            out[j++] = c;
+        }
+    }
+    return j;
+}
+
+/* Sanitize relative path */
+int file_sanitize_path(const char *filepath, char *sanitized, size_t size) {
+    if (filepath == NULL || sanitized == NULL || size == 0) {
+        return FT_ERR_INVALID_ARG;
+    }
+    if (strstr(filepath, "..") != NULL) {
+        LOG_ERROR("Path contains '..' - potential path traversal: %s", filepath);
+        return FT_ERR_INVALID_ARG;
+    }
+    if (filepath[0] == '/' || filepath[0] == '\\' ||
+        (filepath[1] == ':' && (filepath[0] >= 'A' && filepath[0] <= 'Z'))) {
+        LOG_ERROR("Absolute path not allowed: %s", filepath);
+        return FT_ERR_INVALID_ARG;
+    }
+
+    size_t j = 0;
+    const char *p = filepath;
+    while (*p != '\0') {
+        size_t length = strcspn(p, "/\\");
+        /* Empty and "." components add nothing */
+        if (length > 0 && !(length == 1 && p[0] == '.')) {
+            if (j > 0) {
+                if (j >= size - 1) {
+                    break;
+                }
+                sanitized[j++] = '/';
+            }
+            size_t kept = sanitize_component(p, length, sanitized + j, size - 1 - j);
+            if (kept == 0) {
+                LOG_ERROR("Path component sanitization resulted in empty string: %s", filepath);
+                return FT_ERR_INVALID_ARG;
+            }
+            j += kept;
+        }
+        p += length;
+        if (*p != '\0') {
+            p++;
+        }
+    }
+    sanitized[j] = '\0';
+
+    if (j == 0) {
+        LOG_ERROR("Path sanitization resulted in empty string");
+        return FT_ERR_INVALID_ARG;
+    }
+    return FT_SUCCESS;
+}
+
 /* Build file path */
 int file_build_path(const char *dir, const char *filename, char *path, size_t size) {
     if (dir == NULL || filename == NULL || path == NULL || size == 0) {
@@ -270,13 +1351,14 @@ int file_build_path(const char *dir, const char *filename, char *path, size_t si
     int has_separator = (dir_len > 0 &&
                         (dir[dir_len - 1] == '/' || dir[dir_len - 1] == '\\'));
 
+    int length;
     if (has_separator) {
-        snprintf(path, size, "%s%s", dir, filename);
+        length = snprintf(path, size, "%s%s", dir, filename);
     } else {
-        snprintf(path, size, "%s%c%s", dir, PATH_SEPARATOR, filename);
+        length = snprintf(path, size, "%s%c%s", dir, PATH_SEPARATOR, filename);
     }
 
-    return FT_SUCCESS;
+    return (length < 0 || (size_t)length >= size) ? FT_ERR_FILENAME_TOO_LONG : FT_SUCCESS;
 }
 
 /* Delete file */
@@ -289,6 +1371,40 @@ int file_delete(const char *filepath) {
     return 0;
 }
 
+/* List directory entries */
+int file_list_directory(const char *dirpath, file_visit_func visit, void *context) {
+#ifdef FT_PLATFORM_WINDOWS
+    char pattern[1024];
+    WIN32_FIND_DATAA data;
+    snprintf(pattern, sizeof(pattern), "%s%c*", dirpath, PATH_SEPARATOR);
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Failed to list directory %s (error %lu)", dirpath, (unsigned long)GetLastError());
+        return -1;
+    }
+    do {
+        if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0) {
+            visit(data.cFileName, context);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(dirpath);
+    if (dir == NULL) {
+        LOG_ERROR("Failed to list directory %s: %s", dirpath, strerror(errno));
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            visit(entry->d_name, context);
+        }
+    }
+    closedir(dir);
+#endif
+    return 0;
+}
+
 /* Create directory */
 int file_create_directory(const char *dirpath) {
     if (file_exists(dirpath)) {
@@ -303,3 +1419,60 @@ int file_create_directory(const char *dirpath) {
     LOG_INFO("Created directory: %s", dirpath);
     return 0;
 }
+
+/* Create parent directories */
+int file_create_parents(const char *dir, const char *name) {
+    char path[1024];
+    if (file_build_path(dir, name, path, sizeof(path)) != FT_SUCCESS || strlen(path) < strlen(name)) {
+        return FT_ERR_INVALID_ARG;
+    }
+
+    /* Each separator of name ends a directory; another worker may be
+     * creating the same one */
+    size_t start = strlen(path) - strlen(name);
+    for (size_t i = start; path[i] != '\0'; i++) {
+        if (path[i] != '/') {
+            continue;
+        }
+        path[i] = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            LOG_ERROR("Failed to create directory %s: %s", path, strerror(errno));
+            return FT_ERR_PERMISSION;
+        }
+        path[i] = '/';
+    }
+    return 0;
+}
+
+/* Check for directory */
+int file_is_directory(const char *filepath) {
+    stat_t st;
+    return stat_func(filepath, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Set permissions and modification time */
+int file_set_attributes(const char *filepath, uint32_t mode, uint64_t timestamp) {
+    int result = 0;
+
+#ifdef FT_PLATFORM_WINDOWS
+    struct _utimbuf times;
+    times.actime = (time_t)timestamp;
+    times.modtime = (time_t)timestamp;
+    if (_utime(filepath, &times) != 0) {
+        result = -1;
+    }
+    (void)mode;
+#else
+    struct utimbuf times;
+    times.actime = (time_t)timestamp;
+    times.modtime = (time_t)timestamp;
+    if (chmod(filepath, (mode_t)(mode & 0777)) != 0 || utime(filepath, &times) != 0) {
+        result = -1;
+    }
+#endif
+
+    if (result != 0) {
+        LOG_WARN("Failed to set attributes of %s: %s", filepath, strerror(errno));
+    }
+    return result;
+}
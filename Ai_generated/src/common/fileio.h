@@ -4,8 +4,23 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "platform.h"
 #include "protocol.h"
 
+/* Alignment of buffers, offsets and sizes for direct (unbuffered) writes */
+#define FT_IO_ALIGNMENT 4096
+
+/* Zeros written at a time where a hole cannot be punched */
+#define FT_PUNCH_ZERO_BUFFER (1024 * 1024)
+
+/* Stands for '/' where a relative path names a single directory entry;
+ * sanitized paths never contain it */
+#define FT_FLAT_SEPARATOR '+'
+
+/* Longest flattened name, leaving room for the temp and record affixes in
+ * a directory entry */
+#define FT_FLAT_NAME_MAX 240
+
 /* File information structure */
 typedef struct {
     char     filename[FT_MAX_FILENAME_LEN];
@@ -14,26 +29,193 @@ typedef struct {
     uint64_t timestamp;
 } FileMetadata;
 
+/* When received data is forced to stable storage */
+typedef enum {
+    DURABILITY_NONE = 0,        /* Leave write-back to the OS */
+    DURABILITY_PERIODIC = 1,    /* fdatasync every sync_interval bytes, and before rename */
+    DURABILITY_FINALIZE = 2     /* fdatasync once before rename */
+} DurabilityMode;
+
+/* How an output file is written */
+typedef struct {
+    DurabilityMode durability;
+    uint64_t sync_interval;     /* Bytes between syncs (DURABILITY_PERIODIC) */
+    int direct_io;              /* Bypass the page cache if the file system allows it */
+    int sparse;                 /* Holes will be punched: size the file without preallocating it */
+} WritePolicy;
+
+/* Output file written with positional, unbuffered I/O */
+typedef struct {
+#ifdef FT_PLATFORM_WINDOWS
+    HANDLE handle;
+#else
+    int fd;
+#endif
+    uint64_t file_size;
+    uint64_t unsynced_bytes;
+    int direct_io;              /* Direct I/O in effect (may be refused by the file system) */
+    WritePolicy policy;
+} OutputFile;
+
+/* Address space one file mapping may take: a file that fits is mapped
+ * whole, a larger one in FT_MAP_WINDOWS windows of a share of it */
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define FT_MAP_BUDGET          (64ULL * 1024 * 1024 * 1024)
+#else
+#define FT_MAP_BUDGET          (512ULL * 1024 * 1024)
+#endif
+#define FT_MAP_WINDOWS         2
+#define FT_MAP_GRANULARITY     65536       /* Mapping offsets are multiples of this (Windows' allocation granularity) */
+
+/* One mapped stretch of a file */
+typedef struct {
+    uint8_t *base;              /* NULL: not mapped */
+    uint64_t offset;            /* Of base in the file */
+    size_t   size;
+    uint32_t refs;              /* Chunks still using it */
+} MapWindow;
+
+/* File mapped for chunk access: read-only to send from, or read-write over
+ * a preallocated output file to receive into in place. Not thread-safe;
+ * the thread that maps chunks also releases them. */
+typedef struct {
+#ifdef FT_PLATFORM_WINDOWS
+    HANDLE file;                /* Own handle of a file mapped for reading */
+    HANDLE mapping;
+#else
+    int fd;
+    int own_fd;                 /* fd was opened by file_map_open() */
+#endif
+    uint64_t file_size;
+    uint64_t window_size;       /* Windows start at multiples of this */
+    int writable;
+    MapWindow windows[FT_MAP_WINDOWS];
+} MappedFile;
+
+/* One chunk of a batched write */
+typedef struct {
+    uint64_t offset;
+    const uint8_t *buffer;
+    size_t size;
+} OutputWrite;
+
 /* Safe file operations */
 
 /* Open file for reading with error handling */
 FILE* file_open_read(const char *filepath, FTErrorCode *error);
 
-/* Open file for writing (creates temp file for atomic write) */
-FILE* file_open_write(const char *output_dir, const char *filename,
-                      char *temp_path, size_t temp_path_size, FTErrorCode *error);
+/* Name for the directory entry standing for relative path name, '/'
+ * replaced by FT_FLAT_SEPARATOR; a name that does not fit size is cut
+ * short and ends in a hash of the whole */
+void file_flatten_name(const char *name, char *flat, size_t size);
+
+/* Path of the temp file receiving filename in output_dir; one in a
+ * subdirectory is kept in output_dir itself, its name flattened */
+void file_temp_path(const char *output_dir, const char *filename, char *path, size_t size);
+
+/* Create temp file for an atomic write and preallocate file_size bytes.
+ * With resume, the temp file left by an interrupted transfer is reopened
+ * with its contents; it fails if there is none. */
+int file_output_open(OutputFile *out, const char *output_dir, const char *filename,
+                     uint64_t file_size, const WritePolicy *policy, int resume,
+                     char *temp_path, size_t temp_path_size, FTErrorCode *error);
+
+/* Write chunk at offset. With direct I/O the buffer must come from
+ * file_alloc_buffer() and the offset must be FT_IO_ALIGNMENT-aligned. */
+int file_output_write(OutputFile *out, uint64_t offset, const uint8_t *buffer,
+                      size_t size, FTErrorCode *error);
+
+/* Write several chunks; with io_uring they go to the kernel in one
+ * submission, otherwise this is file_output_write() per chunk */
+int file_output_write_batch(OutputFile *out, const OutputWrite *writes, int count,
+                            FTErrorCode *error);
+
+/* Leave [offset, offset + size) of the output file a hole, which reads as
+ * zeros and takes no space; where the file system cannot deallocate the
+ * range, zeros are written over it */
+int file_output_punch(OutputFile *out, uint64_t offset, uint64_t size, FTErrorCode *error);
+
+/* Flush written data to stable storage */
+int file_output_sync(OutputFile *out, FTErrorCode *error);
+
+/* Close output file; on commit, apply the finalize sync first */
+int file_output_close(OutputFile *out, int commit, FTErrorCode *error);
+
+/* How a copy moved its data */
+typedef enum {
+    COPY_SHARED = 0,            /* Extents shared with the source (reflink): nothing copied */
+    COPY_KERNEL,                /* Copied inside the kernel (copy_file_range) */
+    COPY_BUFFERED               /* Read and written through a buffer */
+} CopyMethod;
+
+/* Copy size bytes at src_offset of src_path into the output file at
+ * offset, sharing the source's blocks where the file system can */
+int file_output_copy(OutputFile *out, uint64_t offset, const char *src_path, uint64_t src_offset,
+                     size_t size, CopyMethod *method, FTErrorCode *error);
+
+/* Create (or replace) dst_path holding size bytes at src_offset of
+ * src_path, the same way; with sync, flush it to stable storage */
+int file_copy_range(const char *src_path, uint64_t src_offset, size_t size, const char *dst_path,
+                    int sync, CopyMethod *method, FTErrorCode *error);
+
+/* Map filepath for reading chunks of align bytes (a chunk never spans two
+ * windows); the OS is told it is read sequentially */
+int file_map_open(MappedFile *map, const char *filepath, uint32_t align, FTErrorCode *error);
+
+/* Map out, holding out->file_size bytes, for writing chunks in place. Its
+ * syncs and close cover what is written through the mapping. */
+int file_map_output(MappedFile *map, const OutputFile *out, uint32_t align, FTErrorCode *error);
+
+/* Address of [offset, offset + size), mapping its window if needed, and
+ * a reference on the window in *window. NULL if the range is outside the
+ * file or every window that could be replaced is still referenced; the
+ * caller then reads or writes a copy instead. */
+uint8_t* file_map_chunk(MappedFile *map, uint64_t offset, size_t size, MapWindow **window);
+
+/* Drop a reference taken by file_map_chunk() */
+void file_map_release(MapWindow *window);
+
+/* Unmap every window and close the mapping */
+void file_map_close(MappedFile *map);
 
 /* Finalize file write (atomic rename from temp to final) */
 int file_finalize_write(const char *temp_path, const char *final_path);
 
+/* Sync the directory holding path, so a rename into it survives a crash
+ * (NTFS journals renames itself, so a no-op on Windows) */
+int file_sync_parent(const char *path, FTErrorCode *error);
+
+/* Allocate I/O buffer usable for direct writes (size is rounded up to
+ * FT_IO_ALIGNMENT); release with file_free_buffer() */
+uint8_t* file_alloc_buffer(size_t size);
+void file_free_buffer(uint8_t *buffer);
+
+/* Hint that [offset, offset + length) will be read soon so the OS can
+ * start reading it in the background (no-op where unsupported) */
+void file_advise_willneed(FILE *file, uint64_t offset, size_t length);
+
+/* Data extents of a file being read, found with SEEK_DATA/SEEK_HOLE
+ * (FSCTL_QUERY_ALLOCATED_RANGES on Windows) one extent at a time as the
+ * reader moves through it. Where the file system cannot tell, the whole
+ * file is data. */
+typedef struct {
+    FILE    *file;
+    uint64_t file_size;
+    uint64_t from;              /* Offset the extent was looked up from... */
+    uint64_t data_start;        /* ...and the first extent of data at or after it */
+    uint64_t data_end;
+} FileExtents;
+
+void file_extents_init(FileExtents *extents, FILE *file, uint64_t file_size);
+
+/* Whether [offset, offset + size) lies wholly in a hole; ranges are asked
+ * about front to back */
+int file_extents_hole(FileExtents *extents, uint64_t offset, size_t size);
+
 /* Read chunk from file at specified offset */
 int file_read_chunk(FILE *file, uint64_t offset, uint8_t *buffer,
                     size_t chunk_size, size_t *bytes_read, FTErrorCode *error);
 
-/* Write chunk to file at specified offset */
-int file_write_chunk(FILE *file, uint64_t offset, const uint8_t *buffer,
-                     size_t chunk_size, FTErrorCode *error);
-
 /* Get file metadata */
 int file_get_metadata(const char *filepath, FileMetadata *metadata, FTErrorCode *error);
 
@@ -49,13 +231,30 @@ int file_check_disk_space(const char *path, uint64_t required_bytes, FTErrorCode
 /* Sanitize filename (remove dangerous characters and paths) */
 int file_sanitize_filename(const char *filename, char *sanitized, size_t size);
 
-/* Build file path (handles path separators correctly) */
+/* Sanitize a relative path component by component, the way
+ * file_sanitize_filename() does a name, joining them with '/' */
+int file_sanitize_path(const char *filepath, char *sanitized, size_t size);
+
+/* Build file path (handles path separators correctly); FT_ERR_FILENAME_TOO_LONG if it does not fit */
 int file_build_path(const char *dir, const char *filename, char *path, size_t size);
 
 /* Delete file */
 int file_delete(const char *filepath);
 
+/* Call visit with the name of each entry in a directory but "." and ".." */
+typedef void (*file_visit_func)(const char *name, void *context);
+int file_list_directory(const char *dirpath, file_visit_func visit, void *context);
+
 /* Create directory if it doesn't exist */
 int file_create_directory(const char *dirpath);
 
+/* Create the directories in dir leading to relative path name */
+int file_create_parents(const char *dir, const char *name);
+
+/* Check if path is a directory */
+int file_is_directory(const char *filepath);
+
+/* Set a file's permission bits and modification time */
+int file_set_attributes(const char *filepath, uint32_t mode, uint64_t timestamp);
+
 #endif /* FILEIO_H */
@@ -1,5 +1,6 @@
 #include "logger.h"
 #include "platform.h"
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -11,6 +12,64 @@ Logger g_logger = {
     .use_colors = 1
 };
 
+/*
+ * Records are buffered in a ring per logging thread and written by a
+ * background flusher, so a LOG_* call costs one vsnprintf into the ring and
+ * never waits on the console or the log file. Each ring has one producer
+ * (its thread) and one consumer (the flusher), so head and tail need no
+ * lock. Records are numbered as they are published and the flusher merges
+ * the rings by that number: each thread's records are written in call order,
+ * and records are approximately ordered across threads (one published while
+ * a flush pass runs can follow a later one).
+ * Before logger_init and after logger_close, records are written directly.
+ */
+#define LOG_RING_RECORDS   64           /* Per thread; a power of two */
+#define LOG_MESSAGE_MAX    1024
+#define LOG_LINE_MAX       (LOG_MESSAGE_MAX + 128)
+#define LOG_FLUSH_MS       50           /* Longest an INFO or DEBUG record waits */
+#define LOG_BATCH_BYTES    (64 * 1024)
+
+typedef struct {
+    uint64_t    seq;                    /* Publication order across threads */
+    time_t      time;
+    const char *file;
+    int         line;
+    LogLevel    level;
+    char        message[LOG_MESSAGE_MAX];
+} LogRecord;
+
+typedef struct LogRing {
+    LogRecord       records[LOG_RING_RECORDS];
+    uint32_t        head;               /* Next record to write; advanced by the flusher */
+    uint32_t        tail;               /* Next free record; advanced by the owning thread */
+    int             owned;              /* A live thread logs into it */
+    struct LogRing *next;
+} LogRing;
+
+/* Output of the flusher, written with one call per batch */
+typedef struct {
+    FILE  *stream;
+    int    colors;
+    size_t length;
+    char   data[LOG_BATCH_BYTES];
+} LogBatch;
+
+static LogRing *log_rings = NULL;       /* Newest first; rings are reused, never unlinked */
+static uint64_t log_next_seq = 0;
+static int log_async = 0;               /* The flusher is running */
+static int flusher_stop = 0;
+static int flusher_woken = 0;
+static ft_thread_t flusher_thread;
+static ft_mutex_t log_mutex;
+static ft_cond_t flusher_cond;
+static LogBatch console_batch;
+static LogBatch file_batch;
+#ifdef FT_PLATFORM_WINDOWS
+static DWORD ring_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t ring_key;
+#endif
+
 /* ANSI color codes */
 #define COLOR_RESET   "\x1b[0m"
 #define COLOR_DEBUG   "\x1b[36m"  /* Cyan */
@@ -30,8 +89,8 @@ static const char* get_level_string(LogLevel level) {
 }
 
 /* Get log level color */
-static const char* get_level_color(LogLevel level) {
-    if (!g_logger.use_colors) {
+static const char* get_level_color(LogLevel level, int colors) {
+    if (!colors) {
         return "";
     }
     switch (level) {
@@ -43,6 +102,188 @@ static const char* get_level_color(LogLevel level) {
     }
 }
 
+/* Format timestamp */
+static void format_timestamp(time_t when, char *buffer, size_t size) {
+    struct tm *tm_info = localtime(&when);
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
+}
+
+/* Extract filename from full path */
+static const char* extract_filename(const char *path) {
+    const char *filename = strrchr(path, '/');
+    if (filename == NULL) {
+        filename = strrchr(path, '\\');
+    }
+    return (filename != NULL) ? (filename + 1) : path;
+}
+
+/* Format one record as a line of output */
+static size_t format_record(const LogRecord *record, int colors, char *line, size_t size) {
+    const char *level_str = get_level_string(record->level);
+    const char *level_color = get_level_color(record->level, colors);
+    const char *color_reset = colors ? COLOR_RESET : "";
+    const char *filename = extract_filename(record->file);
+    int length;
+
+    if (g_logger.use_timestamp) {
+        char timestamp[64];
+        format_timestamp(record->time, timestamp, sizeof(timestamp));
+        length = snprintf(line, size, "[%s] %s%s%s [%s:%d] %s\n",
+                          timestamp, level_color, level_str, color_reset, filename, record->line, record->message);
+    } else {
+        length = snprintf(line, size, "%s%s%s [%s:%d] %s\n",
+                          level_color, level_str, color_reset, filename, record->line, record->message);
+    }
+    if (length < 0) {
+        return 0;
+    }
+    return (size_t)length < size ? (size_t)length : size - 1;
+}
+
+/* Write a record straight to the console and log file (no colors there) */
+static void write_record(const LogRecord *record) {
+    char line[LOG_LINE_MAX];
+
+    format_record(record, g_logger.use_colors, line, sizeof(line));
+    fputs(line, stderr);
+    if (g_logger.log_file != NULL) {
+        format_record(record, 0, line, sizeof(line));
+        fputs(line, g_logger.log_file);
+        fflush(g_logger.log_file);
+    }
+}
+
+/* Write out a batch */
+static void batch_flush(LogBatch *batch) {
+    if (batch->length > 0) {
+        fwrite(batch->data, 1, batch->length, batch->stream);
+        fflush(batch->stream);
+        batch->length = 0;
+    }
+}
+
+/* Add a record to a batch, writing the batch out first if it is full */
+static void batch_add(LogBatch *batch, const LogRecord *record) {
+    if (batch->length + LOG_LINE_MAX > sizeof(batch->data)) {
+        batch_flush(batch);
+    }
+    batch->length += format_record(record, batch->colors, batch->data + batch->length,
+                                   sizeof(batch->data) - batch->length);
+}
+
+/* Write every buffered record, oldest first */
+static void flush_rings(void) {
+    console_batch.stream = stderr;
+    console_batch.colors = g_logger.use_colors;
+    file_batch.stream = g_logger.log_file;
+    file_batch.colors = 0;
+
+    for (;;) {
+        LogRing *oldest = NULL;
+        uint64_t oldest_seq = 0;
+
+        for (LogRing *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+            uint32_t head = ring->head;
+            if (head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+                uint64_t seq = ring->records[head % LOG_RING_RECORDS].seq;
+                if (oldest == NULL || seq < oldest_seq) {
+                    oldest = ring;
+                    oldest_seq = seq;
+                }
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+
+        const LogRecord *record = &oldest->records[oldest->head % LOG_RING_RECORDS];
+        batch_add(&console_batch, record);
+        if (file_batch.stream != NULL) {
+            batch_add(&file_batch, record);
+        }
+        __atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+    }
+
+    batch_flush(&console_batch);
+    if (file_batch.stream != NULL) {
+        batch_flush(&file_batch);
+    }
+}
+
+/* Flusher: write records every LOG_FLUSH_MS, or sooner when woken */
+static void flusher_run(void *arg) {
+    (void)arg;
+
+    platform_mutex_lock(&log_mutex);
+    while (!flusher_stop) {
+        if (!flusher_woken) {
+            platform_cond_timedwait(&flusher_cond, &log_mutex, LOG_FLUSH_MS);
+        }
+        flusher_woken = 0;
+        platform_mutex_unlock(&log_mutex);
+        flush_rings();
+        platform_mutex_lock(&log_mutex);
+    }
+    platform_mutex_unlock(&log_mutex);
+    flush_rings();
+}
+
+/* Have the flusher write now */
+static void flusher_wake(void) {
+    platform_mutex_lock(&log_mutex);
+    flusher_woken = 1;
+    platform_cond_signal(&flusher_cond);
+    platform_mutex_unlock(&log_mutex);
+}
+
+/* Thread exit: hand the ring on; the flusher still writes what is left in it */
+#ifdef FT_PLATFORM_WINDOWS
+static VOID NTAPI ring_release(PVOID arg) {
+#else
+static void ring_release(void *arg) {
+#endif
+    LogRing *ring = (LogRing*)arg;
+    if (ring != NULL) {
+        __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Ring of the calling thread, taken over from an exited thread or created on first use */
+static LogRing* thread_ring(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    LogRing *ring = (LogRing*)FlsGetValue(ring_key);
+#else
+    LogRing *ring = (LogRing*)pthread_getspecific(ring_key);
+#endif
+    if (ring != NULL) {
+        return ring;
+    }
+
+    platform_mutex_lock(&log_mutex);
+    for (ring = log_rings; ring != NULL; ring = ring->next) {
+        if (!__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = (LogRing*)calloc(1, sizeof(LogRing));
+        if (ring != NULL) {
+            ring->next = log_rings;
+            __atomic_store_n(&log_rings, ring, __ATOMIC_RELEASE);
+        }
+    }
+    if (ring != NULL) {
+        ring->owned = 1;
+#ifdef FT_PLATFORM_WINDOWS
+        FlsSetValue(ring_key, ring);
+#else
+        pthread_setspecific(ring_key, ring);
+#endif
+    }
+    platform_mutex_unlock(&log_mutex);
+    return ring;
+}
+
 /* Initialize logger */
 void logger_init(LogLevel level, const char *log_file_path) {
     g_logger.level = level;
@@ -61,10 +302,42 @@ void logger_init(LogLevel level, const char *log_file_path) {
             fprintf(stderr, "Warning: Could not open log file %s\n", log_file_path);
         }
     }
+
+    if (log_async) {
+        return;
+    }
+#ifdef FT_PLATFORM_WINDOWS
+    ring_key = FlsAlloc(ring_release);
+    if (ring_key == FLS_OUT_OF_INDEXES) {
+        return;
+    }
+#else
+    if (pthread_key_create(&ring_key, ring_release) != 0) {
+        return;
+    }
+#endif
+    platform_mutex_init(&log_mutex);
+    platform_cond_init(&flusher_cond);
+    flusher_stop = 0;
+    if (platform_thread_create(&flusher_thread, flusher_run, NULL) != 0) {
+        fprintf(stderr, "Warning: Could not start log writer, logging synchronously\n");
+        return;
+    }
+    __atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
 }
 
 /* Close logger */
 void logger_close(void) {
+    /* Records logged from here on are written directly; the rings stay
+     * allocated for threads that may still hold theirs */
+    if (__atomic_exchange_n(&log_async, 0, __ATOMIC_ACQ_REL)) {
+        platform_mutex_lock(&log_mutex);
+        flusher_stop = 1;
+        platform_cond_signal(&flusher_cond);
+        platform_mutex_unlock(&log_mutex);
+        platform_thread_join(flusher_thread);
+    }
+
     if (g_logger.log_file != NULL) {
         fclose(g_logger.log_file);
         g_logger.log_file = NULL;
@@ -86,20 +359,14 @@ void logger_set_colors(int enable) {
     g_logger.use_colors = enable;
 }
 
-/* Format timestamp */
-static void format_timestamp(char *buffer, size_t size) {
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
-}
-
-/* Extract filename from full path */
-static const char* extract_filename(const char *path) {
-    const char *filename = strrchr(path, '/');
-    if (filename == NULL) {
-        filename = strrchr(path, '\\');
-    }
-    return (filename != NULL) ? (filename + 1) : path;
+/* Fill in a record */
+static void fill_record(LogRecord *record, LogLevel level, const char *file, int line,
+                        const char *format, va_list args) {
+    record->time = time(NULL);
+    record->file = file;
+    record->line = line;
+    record->level = level;
+    vsnprintf(record->message, sizeof(record->message), format, args);
 }
 
 /* Log function */
@@ -108,41 +375,37 @@ void logger_log(LogLevel level, const char *file, int line, const char *format,
         return;
     }
 
-    char timestamp[64] = "";
-    if (g_logger.use_timestamp) {
-        format_timestamp(timestamp, sizeof(timestamp));
-    }
-
-    const char *level_str = get_level_string(level);
-    const char *level_color = get_level_color(level);
-    const char *color_reset = g_logger.use_colors ? COLOR_RESET : "";
-    const char *filename = extract_filename(file);
-
-    /* Format the user message */
-    char message[1024];
     va_list args;
     va_start(args, format);
-    vsnprintf(message, sizeof(message), format, args);
-    va_end(args);
+    LogRing *ring = __atomic_load_n(&log_async, __ATOMIC_ACQUIRE) ? thread_ring() : NULL;
+    uint32_t tail = ring != NULL ? ring->tail : 0;
 
-    /* Log to console */
-    if (g_logger.use_timestamp) {
-        fprintf(stderr, "[%s] %s%s%s [%s:%d] %s\n",
-                timestamp, level_color, level_str, color_reset, filename, line, message);
-    } else {
-        fprintf(stderr, "%s%s%s [%s:%d] %s\n",
-                level_color, level_str, color_reset, filename, line, message);
+    /* A full ring waits for the flusher rather than dropping the record */
+    while (ring != NULL && tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= LOG_RING_RECORDS) {
+        if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+            ring = NULL;
+            break;
+        }
+        flusher_wake();
+        platform_sleep_ms(1);
     }
 
-    /* Log to file (no colors) */
-    if (g_logger.log_file != NULL) {
-        if (g_logger.use_timestamp) {
-            fprintf(g_logger.log_file, "[%s] %s [%s:%d] %s\n",
-                    timestamp, level_str, filename, line, message);
-        } else {
-            fprintf(g_logger.log_file, "%s [%s:%d] %s\n",
-                    level_str, filename, line, message);
-        }
-        fflush(g_logger.log_file);
+    if (ring == NULL) {
+        LogRecord record;
+        fill_record(&record, level, file, line, format, args);
+        va_end(args);
+        write_record(&record);
+        return;
+    }
+
+    LogRecord *record = &ring->records[tail % LOG_RING_RECORDS];
+    fill_record(record, level, file, line, format, args);
+    va_end(args);
+    record->seq = __atomic_fetch_add(&log_next_seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* Warnings and errors are written at once, and a ring filling up early */
+    if (level >= LOG_WARN || tail + 1 - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_RECORDS / 2) {
+        flusher_wake();
     }
 }
@@ -38,13 +38,24 @@ void logger_set_timestamp(int enable);
 /* Enable/disable colors */
 void logger_set_colors(int enable);
 
-/* Log functions */
+/* Log functions. Between logger_init and logger_close, records are queued
+ * on the calling thread and written by a background thread in batches. */
 void logger_log(LogLevel level, const char *file, int line, const char *format, ...);
 
+/* Lowest level compiled in (make LOG_LEVEL=<n>); calls below it and their
+ * arguments are removed from the build */
+#ifndef FT_LOG_MIN_LEVEL
+#define FT_LOG_MIN_LEVEL 0
+#endif
+
+/* Whether a level is logged; the macros below check it before evaluating
+ * their arguments */
+#define LOG_ENABLED(lvl) ((lvl) >= FT_LOG_MIN_LEVEL && (lvl) >= g_logger.level)
+
 /* Convenience macros */
-#define LOG_DEBUG(...) logger_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...)  logger_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_WARN(...)  logger_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERROR(...) logger_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_DEBUG(...) (LOG_ENABLED(LOG_DEBUG) ? logger_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__) : (void)0)
+#define LOG_INFO(...)  (LOG_ENABLED(LOG_INFO)  ? logger_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__) : (void)0)
+#define LOG_WARN(...)  (LOG_ENABLED(LOG_WARN)  ? logger_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__) : (void)0)
+#define LOG_ERROR(...) (LOG_ENABLED(LOG_ERROR) ? logger_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__) : (void)0)
 
 #endif /* LOGGER_H */
@@ -0,0 +1,184 @@
+#include "metrics.h"
+#include "platform.h"
+#include "logger.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Prometheus bucket bounds: powers of two from about 1 us to 69 s */
+#define PROM_FIRST_SHIFT  10
+#define PROM_LAST_SHIFT   36
+
+static const char *phase_names[FT_PHASE_COUNT] = {
+    "read", "checksum", "send", "ack_wait", "recv", "write"
+};
+
+static const char *counter_names[FT_COUNT_MAX] = {
+    "bytes", "retransmits", "crc_failures", "transfers", "hole_bytes"
+};
+
+static const char *counter_help[FT_COUNT_MAX] = {
+    "Chunk payload bytes transferred.",
+    "Chunks sent again, or asked for again.",
+    "Chunks received with a bad CRC32.",
+    "Files received and verified.",
+    "Bytes of zeros transferred as holes."
+};
+
+/* Bucket of a value */
+static uint32_t bucket_index(uint64_t value) {
+    if (value < (1u << FT_HIST_SUB_BITS)) {
+        return (uint32_t)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - FT_HIST_SUB_BITS;
+    return ((uint32_t)(shift + 1) << FT_HIST_SUB_BITS) +
+           (uint32_t)((value >> shift) & ((1u << FT_HIST_SUB_BITS) - 1));
+}
+
+/* Largest value of a bucket */
+static uint64_t bucket_max(uint32_t index) {
+    if (index < (1u << FT_HIST_SUB_BITS)) {
+        return index;
+    }
+    int shift = (int)(index >> FT_HIST_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((index & ((1u << FT_HIST_SUB_BITS) - 1)) | (1u << FT_HIST_SUB_BITS)) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+/* Zero metrics */
+void metrics_init(TransferMetrics *metrics) {
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+/* Record duration */
+void metrics_record(TransferMetrics *metrics, MetricsPhase phase, uint64_t ns) {
+    if (metrics == NULL) {
+        return;
+    }
+    Histogram *hist = &metrics->phases[phase];
+    __atomic_fetch_add(&hist->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Record time since start */
+void metrics_record_since(TransferMetrics *metrics, MetricsPhase phase, uint64_t start_ns) {
+    if (metrics != NULL) {
+        metrics_record(metrics, phase, platform_get_monotonic_ns() - start_ns);
+    }
+}
+
+/* Add to counter */
+void metrics_count(TransferMetrics *metrics, MetricsCounter counter, uint64_t value) {
+    if (metrics != NULL) {
+        __atomic_fetch_add(&metrics->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/* Value at percentile */
+uint64_t histogram_percentile(const Histogram *hist, double percentile) {
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    uint64_t rank = (uint64_t)((double)count * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (uint32_t i = 0; i < FT_HIST_BUCKETS && count > 0; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint64_t value = bucket_max(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+/* Log metrics */
+void metrics_log(const TransferMetrics *metrics, const char *label) {
+    for (int phase = 0; phase < FT_PHASE_COUNT; phase++) {
+        const Histogram *hist = &metrics->phases[phase];
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        if (count == 0) {
+            continue;
+        }
+        LOG_INFO("%s %-8s %8llu chunks  avg %9.1f us  p50 %9.1f us  p99 %9.1f us  max %9.1f us",
+                 label, phase_names[phase], (unsigned long long)count,
+                 (double)__atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED) / count / 1000.0,
+                 histogram_percentile(hist, 50.0) / 1000.0,
+                 histogram_percentile(hist, 99.0) / 1000.0,
+                 __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED) / 1000.0);
+    }
+    LOG_INFO("%s %llu bytes, %llu retransmits, %llu CRC failures", label,
+             (unsigned long long)__atomic_load_n(&metrics->counters[FT_COUNT_BYTES], __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&metrics->counters[FT_COUNT_RETRANSMITS], __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&metrics->counters[FT_COUNT_CRC_FAILURES], __ATOMIC_RELAXED));
+}
+
+/* Append to the exposition, keeping the length within size - 1 */
+static void append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+    va_list args;
+
+    if (*length + 1 >= size) {
+        return;
+    }
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
+    if (written > 0) {
+        *length += (size_t)written < size - *length ? (size_t)written : size - *length - 1;
+    }
+}
+
+/* Format metrics for Prometheus */
+size_t metrics_format_prometheus(const TransferMetrics *metrics, char *buffer, size_t size) {
+    size_t length = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    buffer[0] = '\0';
+
+    append(buffer, size, &length,
+           "# HELP ft_chunk_phase_seconds Time a chunk spends in each phase of a transfer.\n"
+           "# TYPE ft_chunk_phase_seconds histogram\n");
+    for (int phase = 0; phase < FT_PHASE_COUNT; phase++) {
+        const Histogram *hist = &metrics->phases[phase];
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        uint64_t cumulative = 0;
+        uint32_t next = 0;
+
+        if (count == 0) {
+            continue;
+        }
+        /* A power of two starts a bucket, so each bound counts whole buckets */
+        for (int shift = PROM_FIRST_SHIFT; shift <= PROM_LAST_SHIFT; shift++) {
+            uint32_t end = bucket_index(1ULL << shift);
+            for (; next < end; next++) {
+                cumulative += __atomic_load_n(&hist->buckets[next], __ATOMIC_RELAXED);
+            }
+            append(buffer, size, &length, "ft_chunk_phase_seconds_bucket{phase=\"%s\",le=\"%.12g\"} %llu\n",
+                   phase_names[phase], (double)(1ULL << shift) / 1e9, (unsigned long long)cumulative);
+        }
+        append(buffer, size, &length,
+               "ft_chunk_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n"
+               "ft_chunk_phase_seconds_sum{phase=\"%s\"} %.9f\n"
+               "ft_chunk_phase_seconds_count{phase=\"%s\"} %llu\n",
+               phase_names[phase], (unsigned long long)count, phase_names[phase],
+               (double)__atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED) / 1e9,
+               phase_names[phase], (unsigned long long)count);
+    }
+
+    for (int counter = 0; counter < FT_COUNT_MAX; counter++) {
+        append(buffer, size, &length, "# HELP ft_%s_total %s\n# TYPE ft_%s_total counter\nft_%s_total %llu\n",
+               counter_names[counter], counter_help[counter], counter_names[counter], counter_names[counter],
+               (unsigned long long)__atomic_load_n(&metrics->counters[counter], __ATOMIC_RELAXED));
+    }
+    return length;
+}
@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Latency histograms of the phases a chunk goes through, and counters of
+ * what had to be redone, for one transfer or a whole process. Values are
+ * bucketed HDR-style: exact below 8 ns, then 8 buckets per power of two,
+ * so every sample is known to within 12.5% in 4 KB per histogram.
+ * Recording is a few relaxed atomic adds, so the threads working on one
+ * transfer share its metrics without a lock.
+ */
+
+#define FT_HIST_SUB_BITS  3
+#define FT_HIST_BUCKETS   ((64 - FT_HIST_SUB_BITS + 1) << FT_HIST_SUB_BITS)
+
+/* Chunk phases */
+typedef enum {
+    FT_PHASE_READ = 0,             /* Reading a chunk from the file (client) */
+    FT_PHASE_CHECKSUM,             /* CRC32 of a chunk */
+    FT_PHASE_SEND,                 /* Handing a chunk to the socket (client) */
+    FT_PHASE_ACK_WAIT,             /* From sending a chunk to its acknowledgment (client) */
+    FT_PHASE_RECV,                 /* From a chunk's header to its last byte (server) */
+    FT_PHASE_WRITE,                /* Writing a chunk to the file (server) */
+    FT_PHASE_COUNT
+} MetricsPhase;
+
+/* Counters */
+typedef enum {
+    FT_COUNT_BYTES = 0,            /* Chunk payload sent or received */
+    FT_COUNT_RETRANSMITS,          /* Chunks sent again (client) or asked for again (server) */
+    FT_COUNT_CRC_FAILURES,         /* Chunks received with a bad CRC32 */
+    FT_COUNT_TRANSFERS,            /* Files received and verified */
+    FT_COUNT_HOLE_BYTES,           /* Zeros sent or received as holes (FT_FLAG_ZERO) */
+    FT_COUNT_MAX
+} MetricsCounter;
+
+/* Distribution of one phase's durations */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[FT_HIST_BUCKETS];
+} Histogram;
+
+/* Metrics of a transfer, or of every transfer of a process */
+typedef struct {
+    Histogram phases[FT_PHASE_COUNT];
+    uint64_t  counters[FT_COUNT_MAX];
+} TransferMetrics;
+
+/* Zero all histograms and counters */
+void metrics_init(TransferMetrics *metrics);
+
+/* Record one duration of phase; metrics may be NULL */
+void metrics_record(TransferMetrics *metrics, MetricsPhase phase, uint64_t ns);
+
+/* Record the time since start_ns (platform_get_monotonic_ns()) */
+void metrics_record_since(TransferMetrics *metrics, MetricsPhase phase, uint64_t start_ns);
+
+/* Add value to a counter; metrics may be NULL */
+void metrics_count(TransferMetrics *metrics, MetricsCounter counter, uint64_t value);
+
+/* Smallest duration at least percentile (0-100) of the samples take */
+uint64_t histogram_percentile(const Histogram *hist, double percentile);
+
+/* Log count, median, p99 and maximum of every phase recorded, and the counters */
+void metrics_log(const TransferMetrics *metrics, const char *label);
+
+/* Prometheus text exposition (version 0.0.4) of the metrics; returns the
+ * length written, truncated to size - 1 */
+size_t metrics_format_prometheus(const TransferMetrics *metrics, char *buffer, size_t size);
+
+#endif /* METRICS_H */
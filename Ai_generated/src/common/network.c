@@ -1,8 +1,32 @@
 #include "network.h"
 #include "logger.h"
 #include "checksum.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+
+#if defined(FT_PLATFORM_LINUX)
+    #include <sys/sendfile.h>
+#elif defined(FT_PLATFORM_MACOS)
+    #include <sys/uio.h>
+#elif defined(FT_PLATFORM_WINDOWS)
+    #include <mswsock.h>
+    #include <io.h>
+#endif
+
+#ifdef FT_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+/* Bounce buffer size for the copying sendfile fallback */
+#define SENDFILE_COPY_BUFFER_SIZE 65536
+
+/* Fast Open requests a listener holds before falling back to the full handshake */
+#define FASTOPEN_QUEUE 256
+
+/* Unanswered keepalive probes before the peer is given up */
+#define KEEPALIVE_PROBES 3
 
 /* Create socket */
 socket_t socket_create(FTErrorCode *error) {
@@ -33,6 +57,10 @@ int socket_set_timeout(socket_t sock, int timeout_seconds, FTErrorCode *error) {
         if (error) *error = FT_ERR_SOCKET;
         return -1;
     }
+#ifdef FT_HAVE_IO_URING
+    /* io_uring operations ignore SO_RCVTIMEO/SO_SNDTIMEO */
+    uring_set_socket_timeout((uint32_t)timeout_seconds * 1000);
+#endif
     if (error) *error = FT_SUCCESS;
     return 0;
 }
@@ -48,6 +76,50 @@ int socket_set_nodelay(socket_t sock, int enable, FTErrorCode *error) {
     return 0;
 }
 
+/* Get SO_SNDBUF / SO_RCVBUF */
+int socket_get_buffer_size(socket_t sock, int send_side, size_t *size, FTErrorCode *error) {
+    int value = 0;
+    socklen_t length = sizeof(value);
+    if (getsockopt(sock, SOL_SOCKET, send_side ? SO_SNDBUF : SO_RCVBUF, (char*)&value, &length) != 0 ||
+        value < 0) {
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    *size = (size_t)value;
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Set SO_SNDBUF / SO_RCVBUF */
+int socket_set_buffer_size(socket_t sock, int send_side, size_t size, FTErrorCode *error) {
+    int value = size < INT_MAX ? (int)size : INT_MAX;
+    if (setsockopt(sock, SOL_SOCKET, send_side ? SO_SNDBUF : SO_RCVBUF, (const char*)&value, sizeof(value)) != 0) {
+        LOG_WARN("Failed to set %s: %s", send_side ? "SO_SNDBUF" : "SO_RCVBUF",
+                 platform_get_socket_error(socket_errno));
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Autotuning ceiling */
+size_t socket_autotune_limit(int send_side) {
+    unsigned long low = 0, initial = 0, high = 0;
+#if defined(FT_PLATFORM_LINUX)
+    FILE *file = fopen(send_side ? "/proc/sys/net/ipv4/tcp_wmem" : "/proc/sys/net/ipv4/tcp_rmem", "r");
+    if (file != NULL) {
+        if (fscanf(file, "%lu %lu %lu", &low, &initial, &high) != 3) {
+            high = 0;
+        }
+        fclose(file);
+    }
+#else
+    (void)send_side;
+#endif
+    return (size_t)high;
+}
+
 /* Set SO_REUSEADDR */
 int socket_set_reuseaddr(socket_t sock, int enable, FTErrorCode *error) {
     int flag = enable ? 1 : 0;
@@ -59,6 +131,127 @@ int socket_set_reuseaddr(socket_t sock, int enable, FTErrorCode *error) {
     return 0;
 }
 
+/* Set SO_REUSEPORT */
+int socket_set_reuseport(socket_t sock, int enable, FTErrorCode *error) {
+#if defined(FT_PLATFORM_LINUX) && defined(SO_REUSEPORT)
+    /* Other systems accept the option without balancing accepts */
+    int flag = enable ? 1 : 0;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&flag, sizeof(flag)) == 0) {
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+    LOG_WARN("Failed to set SO_REUSEPORT: %s", platform_get_socket_error(socket_errno));
+#else
+    (void)sock;
+    (void)enable;
+#endif
+    if (error) *error = FT_ERR_SOCKET;
+    return -1;
+}
+
+/* Set TCP_FASTOPEN (listener) or TCP_FASTOPEN_CONNECT */
+int socket_set_fastopen(socket_t sock, int listener, FTErrorCode *error) {
+#if defined(TCP_FASTOPEN) && (defined(FT_PLATFORM_LINUX) || defined(FT_PLATFORM_MACOS))
+    /* Linux takes the queue of pending Fast Open requests, macOS a flag */
+#ifdef FT_PLATFORM_LINUX
+    int value = listener ? FASTOPEN_QUEUE : 1;
+#else
+    int value = 1;
+#endif
+    int option = TCP_FASTOPEN;
+    if (!listener) {
+#ifdef TCP_FASTOPEN_CONNECT
+        option = TCP_FASTOPEN_CONNECT;
+#else
+        /* Connecting with data needs connectx() here */
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+#endif
+    }
+    if (setsockopt(sock, IPPROTO_TCP, option, (const char*)&value, sizeof(value)) == 0) {
+        if (error) *error = FT_SUCCESS;
+        return 0;
+    }
+    LOG_DEBUG("TCP Fast Open unavailable: %s", platform_get_socket_error(socket_errno));
+#else
+    (void)sock;
+    (void)listener;
+#endif
+    if (error) *error = FT_ERR_SOCKET;
+    return -1;
+}
+
+/* Set SO_KEEPALIVE and its probe timing */
+int socket_set_keepalive(socket_t sock, int idle_seconds, FTErrorCode *error) {
+    int flag = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&flag, sizeof(flag)) != 0) {
+        LOG_WARN("Failed to set SO_KEEPALIVE: %s", platform_get_socket_error(socket_errno));
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    int interval = idle_seconds / KEEPALIVE_PROBES > 0 ? idle_seconds / KEEPALIVE_PROBES : 1;
+    int probes = KEEPALIVE_PROBES;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&idle_seconds, sizeof(idle_seconds)) != 0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&interval, sizeof(interval)) != 0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&probes, sizeof(probes)) != 0) {
+        /* Not fatal: the system's defaults apply */
+        LOG_DEBUG("Failed to set keepalive timing: %s", platform_get_socket_error(socket_errno));
+    }
+#elif defined(TCP_KEEPALIVE)
+    /* macOS names the idle time TCP_KEEPALIVE */
+    if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, (const char*)&idle_seconds, sizeof(idle_seconds)) != 0) {
+        LOG_DEBUG("Failed to set keepalive timing: %s", platform_get_socket_error(socket_errno));
+    }
+#else
+    (void)idle_seconds;
+#endif
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Set O_NONBLOCK / FIONBIO */
+int socket_set_nonblocking(socket_t sock, int enable, FTErrorCode *error) {
+#ifdef FT_PLATFORM_WINDOWS
+    u_long mode = enable ? 1 : 0;
+    if (ioctlsocket(sock, FIONBIO, &mode) != 0) {
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) != 0) {
+#endif
+        LOG_ERROR("Failed to set non-blocking mode: %s", platform_get_socket_error(socket_errno));
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Wait for readability */
+int socket_wait_readable(socket_t sock, uint32_t timeout_ms) {
+    fd_set read_set;
+    struct timeval timeout;
+
+    FD_ZERO(&read_set);
+    FD_SET(sock, &read_set);
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int ready = select((int)sock + 1, &read_set, NULL, NULL, &timeout);
+    if (ready < 0) {
+        LOG_ERROR("select failed: %s", platform_get_socket_error(socket_errno));
+        return -1;
+    }
+    return (ready > 0) ? 1 : 0;
+}
+
+/* Shut down socket */
+void socket_shutdown(socket_t sock) {
+    if (shutdown(sock, SHUT_RDWR) != 0) {
+        LOG_DEBUG("Socket shutdown failed: %s", platform_get_socket_error(socket_errno));
+    }
+}
+
 /* Bind and listen */
 int socket_bind_and_listen(socket_t sock, uint16_t port, int backlog, FTErrorCode *error) {
     struct sockaddr_in addr;
@@ -91,7 +284,13 @@ socket_t socket_accept_connection(socket_t listen_sock, char *client_ip, size_t
 
     socket_t client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &addr_len);
     if (client_sock == INVALID_SOCKET_VALUE) {
-        LOG_ERROR("Failed to accept connection: %s", platform_get_socket_error(socket_errno));
+        int err = socket_errno;
+        if (!platform_is_fatal_socket_error(err)) {
+            /* Non-blocking listener with no pending connection */
+            if (error) *error = FT_ERR_TIMEOUT;
+            return INVALID_SOCKET_VALUE;
+        }
+        LOG_ERROR("Failed to accept connection: %s", platform_get_socket_error(err));
         if (error) *error = FT_ERR_ACCEPT;
         return INVALID_SOCKET_VALUE;
     }
@@ -158,7 +357,12 @@ int socket_connect_with_retry(socket_t sock, const char *host, uint16_t port,
 int socket_send_all(socket_t sock, const uint8_t *buffer, size_t length, FTErrorCode *error) {
     size_t total_sent = 0;
     while (total_sent < length) {
+#ifdef FT_HAVE_IO_URING
+        int sent = uring_available() ? (int)uring_send(sock, buffer + total_sent, length - total_sent, 0) :
+                   send(sock, (const char*)(buffer + total_sent), (int)(length - total_sent), 0);
+#else
         int sent = send(sock, (const char*)(buffer + total_sent), (int)(length - total_sent), 0);
+#endif
         if (sent <= 0) {
             int err = socket_errno;
             LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
@@ -175,7 +379,13 @@ int socket_send_all(socket_t sock, const uint8_t *buffer, size_t length, FTError
 int socket_recv_all(socket_t sock, uint8_t *buffer, size_t length, FTErrorCode *error) {
     size_t total_received = 0;
     while (total_received < length) {
+#ifdef FT_HAVE_IO_URING
+        int received = uring_available() ?
+                       (int)uring_recv(sock, buffer + total_received, length - total_received, MSG_WAITALL) :
+                       recv(sock, (char*)(buffer + total_received), (int)(length - total_received), 0);
+#else
         int received = recv(sock, (char*)(buffer + total_received), (int)(length - total_received), 0);
+#endif
         if (received == 0) {
             LOG_ERROR("Connection closed by peer");
             if (error) *error = FT_ERR_RECV;
@@ -193,51 +403,271 @@ int socket_recv_all(socket_t sock, uint8_t *buffer, size_t length, FTErrorCode *
     return 0;
 }
 
-/* Send message */
-int send_message(socket_t sock, MessageType msg_type, uint64_t sequence_num,
-                 const uint8_t *payload, size_t payload_size, FTErrorCode *error) {
-    /* Initialize header */
-    MessageHeader header;
-    protocol_init_header(&header, msg_type, sequence_num, payload_size);
+#ifndef FT_PLATFORM_WINDOWS
+/* Send with flags, retrying partial sends */
+static int send_all_flags(socket_t sock, const uint8_t *buffer, size_t length, int flags,
+                          FTErrorCode *error) {
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        ssize_t sent = send(sock, buffer + total_sent, length - total_sent, flags);
+        if (sent <= 0) {
+            int err = socket_errno;
+            LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
+            if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
+            return -1;
+        }
+        total_sent += (size_t)sent;
+    }
+    return 0;
+}
 
-    /* Serialize header */
-    uint8_t header_buf[FT_HEADER_SIZE];
-    protocol_serialize_header(&header, header_buf);
+/* Copy file range through a bounce buffer (file systems without sendfile support) */
+static int sendfile_copy(socket_t sock, int fd, uint64_t offset, size_t length, FTErrorCode *error) {
+    uint8_t buffer[SENDFILE_COPY_BUFFER_SIZE];
+
+    while (length > 0) {
+        size_t want = length < sizeof(buffer) ? length : sizeof(buffer);
+        ssize_t got = pread(fd, buffer, want, (off_t)offset);
+        if (got <= 0) {
+            LOG_ERROR("File read failed at offset %llu", (unsigned long long)offset);
+            if (error) *error = FT_ERR_FILE_READ;
+            return -1;
+        }
+        if (socket_send_all(sock, buffer, (size_t)got, error) != 0) {
+            return -1;
+        }
+        offset += (uint64_t)got;
+        length -= (size_t)got;
+    }
+    return 0;
+}
+#endif
 
-    /* Send header */
-    if (socket_send_all(sock, header_buf, FT_HEADER_SIZE, error) != 0) {
+/* Send head followed by a file range */
+int socket_sendfile(socket_t sock, FILE *file, uint64_t offset, size_t length,
+                    const uint8_t *head, size_t head_len, FTErrorCode *error) {
+#if defined(FT_PLATFORM_WINDOWS)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)offset;
+    if (handle == INVALID_HANDLE_VALUE || !SetFilePointerEx(handle, position, NULL, FILE_BEGIN)) {
+        LOG_ERROR("File seek failed: %s", platform_get_last_error());
+        if (error) *error = FT_ERR_FILE_SEEK;
+        return -1;
+    }
+
+    TRANSMIT_FILE_BUFFERS buffers;
+    memset(&buffers, 0, sizeof(buffers));
+    buffers.Head = (PVOID)head;
+    buffers.HeadLength = (DWORD)head_len;
+    if (!TransmitFile(sock, handle, (DWORD)length, 0, NULL, head_len > 0 ? &buffers : NULL, 0)) {
+        int err = socket_errno;
+        LOG_ERROR("TransmitFile failed: %s", platform_get_socket_error(err));
+        if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
         return -1;
     }
+#elif defined(FT_PLATFORM_LINUX)
+    int fd = fileno(file);
 
-    /* Send payload if present */
-    if (payload_size > 0 && payload != NULL) {
-        if (socket_send_all(sock, payload, payload_size, error) != 0) {
+    /* MSG_MORE holds the headers back so they share a segment with the payload */
+    if (head_len > 0 && send_all_flags(sock, head, head_len, length > 0 ? MSG_MORE : 0, error) != 0) {
+        return -1;
+    }
+
+    off_t file_offset = (off_t)offset;
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(sock, fd, &file_offset, remaining);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EINVAL || errno == ENOSYS) && remaining == length) {
+            /* Source does not support sendfile: copy instead */
+            return sendfile_copy(sock, fd, offset, length, error);
+        }
+        if (sent <= 0) {
+            int err = (sent == 0) ? EIO : errno;
+            LOG_ERROR("sendfile failed: %s", platform_get_socket_error(err));
+            if (error) *error = (sent == 0) ? FT_ERR_FILE_READ :
+                                platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
             return -1;
         }
+        remaining -= (size_t)sent;
+    }
+#elif defined(FT_PLATFORM_MACOS)
+    int fd = fileno(file);
+    struct iovec head_iov;
+    struct sf_hdtr hdtr;
+    size_t head_left = head_len;
+
+    if (length == 0) {
+        /* len 0 means "to end of file" for sendfile(2) */
+        return head_len > 0 ? socket_send_all(sock, head, head_len, error) : 0;
     }
 
-    LOG_DEBUG("Sent message type %d, seq %llu, payload %zu bytes",
-              msg_type, (unsigned long long)sequence_num, payload_size);
+    off_t file_offset = (off_t)offset;
+    size_t remaining = length;
+    while (remaining > 0) {
+        off_t sent = (off_t)remaining;
+        head_iov.iov_base = (void*)(head + (head_len - head_left));
+        head_iov.iov_len = head_left;
+        hdtr.headers = &head_iov;
+        hdtr.hdr_cnt = 1;
+        hdtr.trailers = NULL;
+        hdtr.trl_cnt = 0;
+
+        int rc = sendfile(fd, sock, file_offset, &sent, head_left > 0 ? &hdtr : NULL, 0);
+        if (rc != 0 && errno != EINTR && errno != EAGAIN) {
+            if ((errno == ENOTSUP || errno == EOPNOTSUPP) && remaining == length && head_left == head_len) {
+                if (head_len > 0 && socket_send_all(sock, head, head_len, error) != 0) {
+                    return -1;
+                }
+                return sendfile_copy(sock, fd, offset, length, error);
+            }
+            int err = errno;
+            LOG_ERROR("sendfile failed: %s", platform_get_socket_error(err));
+            if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
+            return -1;
+        }
+        if (rc != 0 && errno == EAGAIN && sent == 0) {
+            LOG_ERROR("sendfile timed out");
+            if (error) *error = FT_ERR_TIMEOUT;
+            return -1;
+        }
+
+        /* sent counts header bytes first, then file bytes */
+        size_t head_sent = (size_t)sent < head_left ? (size_t)sent : head_left;
+        head_left -= head_sent;
+        file_offset += sent - (off_t)head_sent;
+        remaining -= (size_t)sent - head_sent;
+    }
+#else
+    int fd = fileno(file);
+    if (head_len > 0 && socket_send_all(sock, head, head_len, error) != 0) {
+        return -1;
+    }
+    if (sendfile_copy(sock, fd, offset, length, error) != 0) {
+        return -1;
+    }
+#endif
+
+    if (error) *error = FT_SUCCESS;
     return 0;
 }
 
-/* Receive message */
-int recv_message(socket_t sock, MessageHeader *header, uint8_t *payload,
-                 size_t max_payload_size, FTErrorCode *error) {
-    /* Receive header */
+/* Serialize a header in the connection's framing; returns its length */
+static size_t frame_header(const Connection *conn, MessageHeader *header, uint8_t buffer[FT_HEADER_SIZE]) {
+    if (conn->version < FT_PROTOCOL_V2) {
+        protocol_serialize_header(header, buffer);
+        return FT_HEADER_SIZE;
+    }
+    /* Chunk and delta payloads carry a CRC32 of their own */
+    if (header->msg_type != MSG_CHUNK_DATA && header->msg_type != MSG_DELTA_DATA) {
+        header->flags |= FT_FLAG_HEADER_CRC;
+    }
+    return protocol_serialize_header_v2(header, buffer);
+}
+
+/* Deserialize and validate a received header */
+static int parse_header(const Connection *conn, const uint8_t *buffer, MessageHeader *header,
+                        FTErrorCode *error) {
+    int result = FT_SUCCESS;
+    if (conn->version < FT_PROTOCOL_V2) {
+        protocol_deserialize_header(buffer, header);
+    } else {
+        result = protocol_deserialize_header_v2(buffer, header);
+    }
+    if (result == FT_SUCCESS) {
+        result = protocol_validate_header(header);
+    }
+    if (result != FT_SUCCESS) {
+        LOG_ERROR("Invalid message header: %s", protocol_get_error_string(result));
+        if (error) *error = (FTErrorCode)result;
+        return -1;
+    }
+    return 0;
+}
+
+/* Length of a v2 header from its first byte */
+static int header_v2_length(const uint8_t *buffer, size_t *length, FTErrorCode *error) {
+    if (buffer[0] < FT_HEADER_V2_MIN || buffer[0] > FT_HEADER_SIZE) {
+        LOG_ERROR("Invalid message header: length %u", buffer[0]);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    *length = buffer[0];
+    return 0;
+}
+
+/* Receive and validate one header */
+static int recv_header(Connection *conn, MessageHeader *header, FTErrorCode *error) {
+    uint8_t buffer[FT_HEADER_SIZE];
+    size_t length = FT_HEADER_SIZE;
+
+    if (conn->version >= FT_PROTOCOL_V2) {
+        if (connection_recv_exact(conn, buffer, 1, error) != 0 ||
+            header_v2_length(buffer, &length, error) != 0 ||
+            connection_recv_exact(conn, buffer + 1, length - 1, error) != 0) {
+            return -1;
+        }
+    } else if (connection_recv_exact(conn, buffer, FT_HEADER_SIZE, error) != 0) {
+        return -1;
+    }
+    return parse_header(conn, buffer, header, error);
+}
+
+/* Receive header without blocking */
+int recv_header_partial(Connection *conn, uint8_t buffer[FT_HEADER_SIZE], size_t *done,
+                        MessageHeader *header, FTErrorCode *error) {
+    size_t length = FT_HEADER_SIZE;
+    int result;
+
+    if (conn->version >= FT_PROTOCOL_V2) {
+        result = connection_recv_partial(conn, buffer, 1, done, error);
+        if (result <= 0) {
+            return result;
+        }
+        if (header_v2_length(buffer, &length, error) != 0) {
+            return -1;
+        }
+    }
+    result = connection_recv_partial(conn, buffer, length, done, error);
+    if (result <= 0) {
+        return result;
+    }
+    return parse_header(conn, buffer, header, error) == 0 ? 1 : -1;
+}
+
+/* Send header and payload in one write */
+static int send_frame(Connection *conn, MessageHeader *header, const uint8_t *payload, FTErrorCode *error) {
     uint8_t header_buf[FT_HEADER_SIZE];
-    if (socket_recv_all(sock, header_buf, FT_HEADER_SIZE, error) != 0) {
+    size_t header_size = frame_header(conn, header, header_buf);
+
+    FrameSegment segments[2] = {
+        { header_buf, header_size },
+        { payload, payload != NULL ? (size_t)header->payload_size : 0 }
+    };
+    return connection_send_frame(conn, segments, 2, error);
+}
+
+/* Send message */
+int send_message(Connection *conn, MessageType msg_type, uint64_t sequence_num,
+                 const uint8_t *payload, size_t payload_size, FTErrorCode *error) {
+    MessageHeader header;
+    protocol_init_header(&header, msg_type, sequence_num, payload_size);
+    if (send_frame(conn, &header, payload, error) != 0) {
         return -1;
     }
 
-    /* Deserialize header */
-    protocol_deserialize_header(header_buf, header);
+    LOG_DEBUG("Sent message type %d, seq %llu, payload %zu bytes",
+              msg_type, (unsigned long long)sequence_num, payload_size);
+    return 0;
+}
 
-    /* Validate header */
-    int validation_result = protocol_validate_header(header);
-    if (validation_result != FT_SUCCESS) {
-        LOG_ERROR("Invalid message header: %s", protocol_get_error_string(validation_result));
-        if (error) *error = validation_result;
+/* Receive message */
+int recv_message(Connection *conn, MessageHeader *header, uint8_t *payload,
+                 size_t max_payload_size, FTErrorCode *error) {
+    if (recv_header(conn, header, error) != 0) {
         return -1;
     }
 
@@ -250,7 +680,7 @@ int recv_message(socket_t sock, MessageHeader *header, uint8_t *payload,
             return -1;
         }
 
-        if (socket_recv_all(sock, payload, (size_t)header->payload_size, error) != 0) {
+        if (connection_recv_exact(conn, payload, (size_t)header->payload_size, error) != 0) {
             return -1;
         }
     }
@@ -261,24 +691,64 @@ int recv_message(socket_t sock, MessageHeader *header, uint8_t *payload,
     return 0;
 }
 
+/* Chunk size limit of a handshake message */
+static uint32_t handshake_chunk_limit(const HandshakePayload *payload) {
+    uint16_t kb = ntohs(payload->max_chunk_kb);
+    return kb != 0 ? (uint32_t)kb * 1024 : FT_DEFAULT_CHUNK_SIZE;
+}
+
+/* Protocol version a handshake message offers or agrees to */
+static uint8_t handshake_version(const MessageHeader *header) {
+    /* Older peers leave the field zero */
+    if (header->reserved <= FT_PROTOCOL_V1) {
+        return FT_PROTOCOL_V1;
+    }
+    return header->reserved < FT_PROTOCOL_VERSION ? (uint8_t)header->reserved : FT_PROTOCOL_VERSION;
+}
+
+/* Priority class of a handshake request */
+uint8_t handshake_priority(const MessageHeader *header) {
+    uint8_t priority = (uint8_t)((header->flags & FT_FLAG_PRIORITY_MASK) >> FT_FLAG_PRIORITY_SHIFT);
+    return priority < FT_PRIORITY_COUNT ? priority : FT_PRIORITY_NORMAL;
+}
+
+/* Send a handshake message (always in v1 framing) */
+static int send_handshake(Connection *conn, MessageType msg_type, uint64_t sequence_num,
+                          const HandshakePayload *payload, uint8_t version, uint16_t flags,
+                          FTErrorCode *error) {
+    MessageHeader header;
+    protocol_init_header(&header, msg_type, sequence_num, sizeof(HandshakePayload));
+    header.flags = flags;
+    header.reserved = version;
+    return send_frame(conn, &header, (const uint8_t*)payload, error);
+}
+
 /* Perform handshake - client side */
-int perform_handshake_client(socket_t sock, FTErrorCode *error) {
+int perform_handshake_client(Connection *conn, uint8_t *capabilities, uint32_t *max_chunk_size,
+                             uint8_t priority, int *session, uint64_t *rtt_us, FTErrorCode *error) {
+    /* The payload's version stays 1, which older servers insist on */
     HandshakePayload payload;
-    payload.protocol_version = FT_PROTOCOL_VERSION;
-    payload.capabilities = 0;
-    payload.reserved = 0;
-
-    /* Send handshake request */
-    if (send_message(sock, MSG_HANDSHAKE_REQ, 0, (uint8_t*)&payload, sizeof(payload), error) != 0) {
+    payload.protocol_version = FT_PROTOCOL_V1;
+    payload.capabilities = *capabilities;
+    payload.max_chunk_kb = htons((uint16_t)(*max_chunk_size / 1024));
+
+    /* Send handshake request; older servers ignore its flags */
+    uint64_t sent_us = platform_get_monotonic_us();
+    uint16_t flags = (uint16_t)((priority << FT_FLAG_PRIORITY_SHIFT) & FT_FLAG_PRIORITY_MASK);
+    if (session != NULL && *session) {
+        flags |= FT_FLAG_SESSION;
+    }
+    if (send_handshake(conn, MSG_HANDSHAKE_REQ, 0, &payload, FT_PROTOCOL_VERSION, flags, error) != 0) {
         return -1;
     }
 
     /* Receive handshake acknowledgment */
     MessageHeader header;
     HandshakePayload ack_payload;
-    if (recv_message(sock, &header, (uint8_t*)&ack_payload, sizeof(ack_payload), error) != 0) {
+    if (recv_message(conn, &header, (uint8_t*)&ack_payload, sizeof(ack_payload), error) != 0) {
         return -1;
     }
+    if (rtt_us) *rtt_us = platform_get_monotonic_us() - sent_us;
 
     if (header.msg_type != MSG_HANDSHAKE_ACK) {
         LOG_ERROR("Expected HANDSHAKE_ACK, got message type %d", header.msg_type);
@@ -286,66 +756,131 @@ int perform_handshake_client(socket_t sock, FTErrorCode *error) {
         return -1;
     }
 
-    if (ack_payload.protocol_version != FT_PROTOCOL_VERSION) {
+    if (ack_payload.protocol_version != FT_PROTOCOL_V1) {
         LOG_ERROR("Protocol version mismatch: expected %d, got %d",
-                  FT_PROTOCOL_VERSION, ack_payload.protocol_version);
+                  FT_PROTOCOL_V1, ack_payload.protocol_version);
         if (error) *error = FT_ERR_VERSION;
         return -1;
     }
 
-    LOG_INFO("Handshake successful");
+    /* Server may only agree to capabilities and chunk sizes we offered */
+    *capabilities &= ack_payload.capabilities;
+    if (handshake_chunk_limit(&ack_payload) < *max_chunk_size) {
+        *max_chunk_size = handshake_chunk_limit(&ack_payload);
+    }
+    conn->version = handshake_version(&header);
+    if (session != NULL) {
+        *session = *session && (header.flags & FT_FLAG_SESSION) != 0;
+    }
+
+    LOG_INFO("Handshake successful (protocol v%u, capabilities 0x%02X, chunks up to %u KB)",
+             conn->version, *capabilities, *max_chunk_size / 1024);
     return 0;
 }
 
 /* Perform handshake - server side */
-int perform_handshake_server(socket_t sock, FTErrorCode *error) {
+int perform_handshake_server(Connection *conn, uint8_t *capabilities, uint32_t *max_chunk_size,
+                             FTErrorCode *error) {
     /* Receive handshake request */
     MessageHeader header;
     HandshakePayload payload;
-    if (recv_message(sock, &header, (uint8_t*)&payload, sizeof(payload), error) != 0) {
+    if (recv_message(conn, &header, (uint8_t*)&payload, sizeof(payload), error) != 0) {
         return -1;
     }
 
-    if (header.msg_type != MSG_HANDSHAKE_REQ) {
-        LOG_ERROR("Expected HANDSHAKE_REQ, got message type %d", header.msg_type);
+    return handshake_server_reply(conn, &header, &payload, capabilities, max_chunk_size, NULL, error);
+}
+
+/* Answer a received handshake request */
+int handshake_server_reply(Connection *conn, const MessageHeader *header, const HandshakePayload *payload,
+                           uint8_t *capabilities, uint32_t *max_chunk_size, int *session,
+                           FTErrorCode *error) {
+    if (header->msg_type != MSG_HANDSHAKE_REQ) {
+        LOG_ERROR("Expected HANDSHAKE_REQ, got message type %d", header->msg_type);
         if (error) *error = FT_ERR_PROTOCOL;
         return -1;
     }
 
-    if (payload.protocol_version != FT_PROTOCOL_VERSION) {
+    if (payload->protocol_version != FT_PROTOCOL_V1) {
         LOG_ERROR("Protocol version mismatch: expected %d, got %d",
-                  FT_PROTOCOL_VERSION, payload.protocol_version);
+                  FT_PROTOCOL_V1, payload->protocol_version);
         if (error) *error = FT_ERR_VERSION;
         return -1;
     }
 
-    /* Send handshake acknowledgment */
-    HandshakePayload ack_payload;
-    ack_payload.protocol_version = FT_PROTOCOL_VERSION;
-    ack_payload.capabilities = 0;
-    ack_payload.reserved = 0;
+    /* Agree to the capabilities and chunk sizes both sides support */
+    *capabilities &= payload->capabilities;
+    if (handshake_chunk_limit(payload) < *max_chunk_size) {
+        *max_chunk_size = handshake_chunk_limit(payload);
+    }
 
-    if (send_message(sock, MSG_HANDSHAKE_ACK, header.sequence_num + 1,
-                     (uint8_t*)&ack_payload, sizeof(ack_payload), error) != 0) {
+    /* Send handshake acknowledgment; what follows is in the agreed version */
+    uint8_t version = handshake_version(header);
+    HandshakePayload ack_payload;
+    ack_payload.protocol_version = FT_PROTOCOL_V1;
+    ack_payload.capabilities = *capabilities;
+    ack_payload.max_chunk_kb = htons((uint16_t)(*max_chunk_size / 1024));
+
+    uint16_t flags = 0;
+    if (session != NULL) {
+        *session = *session && (header->flags & FT_FLAG_SESSION) != 0;
+        flags = *session ? FT_FLAG_SESSION : 0;
+    }
+    if (send_handshake(conn, MSG_HANDSHAKE_ACK, header->sequence_num + 1, &ack_payload, version, flags,
+                       error) != 0) {
         return -1;
     }
+    conn->version = version;
 
-    LOG_INFO("Handshake successful");
+    LOG_INFO("Handshake successful (protocol v%u, capabilities 0x%02X, chunks up to %u KB)",
+             version, *capabilities, *max_chunk_size / 1024);
     return 0;
 }
 
 /* Send file info */
-int send_file_info(socket_t sock, const FileInfo *file_info, uint64_t sequence_num, FTErrorCode *error) {
-    uint8_t buffer[FT_FILE_INFO_SIZE];
-    protocol_serialize_file_info(file_info, buffer);
-    return send_message(sock, MSG_FILE_INFO, sequence_num, buffer, FT_FILE_INFO_SIZE, error);
+int send_file_info(Connection *conn, const FileInfo *file_info, uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_FILE_INFO_MAX_SIZE];
+    size_t size = FT_FILE_INFO_SIZE;
+
+    if (conn->version >= FT_PROTOCOL_V2) {
+        size = protocol_serialize_file_info_v2(file_info, buffer);
+    } else if (strnlen(file_info->filename, FT_MAX_FILENAME_LEN) >= FT_MAX_FILENAME_LEN) {
+        LOG_ERROR("Name too long for a version 1 server: %s", file_info->filename);
+        if (error) *error = FT_ERR_FILENAME_TOO_LONG;
+        return -1;
+    } else {
+        protocol_serialize_file_info(file_info, buffer);
+    }
+    return send_message(conn, MSG_FILE_INFO, sequence_num, buffer, size, error);
+}
+
+/* Largest FILE_INFO payload */
+size_t file_info_max_size(const Connection *conn) {
+    return conn->version >= FT_PROTOCOL_V2 ? FT_FILE_INFO_MAX_SIZE : FT_FILE_INFO_SIZE;
+}
+
+/* Parse FILE_INFO payload */
+int file_info_parse(const Connection *conn, uint8_t *payload, size_t size, FileInfo *file_info,
+                    FTErrorCode *error) {
+    if (conn->version >= FT_PROTOCOL_V2) {
+        if (protocol_deserialize_file_info_v2(payload, size, file_info) != 0) {
+            LOG_ERROR("Malformed FILE_INFO payload");
+            if (error) *error = FT_ERR_PROTOCOL;
+            return -1;
+        }
+        return 0;
+    }
+    /* Older clients may send the fixed fields only */
+    memset(payload + size, 0, FT_FILE_INFO_SIZE - size);
+    protocol_deserialize_file_info(payload, file_info);
+    return 0;
 }
 
 /* Receive file info */
-int recv_file_info(socket_t sock, FileInfo *file_info, FTErrorCode *error) {
+int recv_file_info(Connection *conn, FileInfo *file_info, FTErrorCode *error) {
     MessageHeader header;
-    uint8_t buffer[FT_FILE_INFO_SIZE];
-    if (recv_message(sock, &header, buffer, FT_FILE_INFO_SIZE, error) != 0) {
+    uint8_t buffer[FT_FILE_INFO_MAX_SIZE];
+    if (recv_message(conn, &header, buffer, file_info_max_size(conn), error) != 0) {
         return -1;
     }
 
@@ -355,71 +890,115 @@ int recv_file_info(socket_t sock, FileInfo *file_info, FTErrorCode *error) {
         return -1;
     }
 
-    protocol_deserialize_file_info(buffer, file_info);
-    return 0;
+    return file_info_parse(conn, buffer, (size_t)header.payload_size, file_info, error);
 }
 
-/* Send chunk */
-int send_chunk(socket_t sock, uint64_t chunk_id, uint64_t chunk_offset,
-               const uint8_t *data, size_t data_size, uint64_t sequence_num, FTErrorCode *error) {
-    /* Compute chunk CRC32 */
-    uint32_t chunk_crc = crc32_compute(data, data_size);
-
-    /* Create chunk header */
+/* Serialize message header and chunk header into one buffer; wire_size
+ * bytes of payload data follow them. Returns the length of both. */
+static size_t build_chunk_headers(const Connection *conn, MessageType msg_type, uint16_t flags,
+                                  uint64_t chunk_id, uint64_t chunk_offset, size_t data_size, size_t wire_size,
+                                  uint32_t chunk_crc, uint64_t sequence_num,
+                                  uint8_t buffer[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE]) {
     ChunkHeader chunk_hdr;
     chunk_hdr.chunk_id = chunk_id;
     chunk_hdr.chunk_offset = chunk_offset;
     chunk_hdr.chunk_size = (uint32_t)data_size;
     chunk_hdr.chunk_crc32 = chunk_crc;
 
-    /* Serialize chunk header */
-    uint8_t chunk_hdr_buf[FT_CHUNK_HEADER_SIZE];
-    protocol_serialize_chunk_header(&chunk_hdr, chunk_hdr_buf);
-
-    /* Send message header */
-    size_t total_payload = FT_CHUNK_HEADER_SIZE + data_size;
     MessageHeader msg_hdr;
-    protocol_init_header(&msg_hdr, MSG_CHUNK_DATA, sequence_num, total_payload);
+    protocol_init_header(&msg_hdr, msg_type, sequence_num, FT_CHUNK_HEADER_SIZE + wire_size);
+    msg_hdr.flags = flags;
 
-    uint8_t msg_hdr_buf[FT_HEADER_SIZE];
-    protocol_serialize_header(&msg_hdr, msg_hdr_buf);
+    size_t header_size = frame_header(conn, &msg_hdr, buffer);
+    protocol_serialize_chunk_header(&chunk_hdr, buffer + header_size);
+    return header_size + FT_CHUNK_HEADER_SIZE;
+}
 
-    if (socket_send_all(sock, msg_hdr_buf, FT_HEADER_SIZE, error) != 0) {
+/* Send chunk */
+int send_chunk(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset,
+               const uint8_t *data, size_t data_size, uint64_t sequence_num, FTErrorCode *error) {
+    /* Compute chunk CRC32 */
+    uint32_t chunk_crc = crc32_compute(data, data_size);
+
+    /* Send message header, chunk header and data in one write */
+    uint8_t hdr_buf[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t hdr_size = build_chunk_headers(conn, MSG_CHUNK_DATA, 0, chunk_id, chunk_offset, data_size, data_size,
+                                          chunk_crc, sequence_num, hdr_buf);
+    FrameSegment segments[2] = {
+        { hdr_buf, hdr_size },
+        { data, data_size }
+    };
+    if (connection_send_frame(conn, segments, 2, error) != 0) {
+        return -1;
+    }
+
+    LOG_DEBUG("Sent chunk %llu, %zu bytes, CRC32: 0x%08X",
+              (unsigned long long)chunk_id, data_size, chunk_crc);
+    return 0;
+}
+
+/* Send chunk straight from the file */
+int send_chunk_from_file(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset, FILE *file,
+                         size_t data_size, uint32_t chunk_crc, uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t hdr_buf[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t hdr_size = build_chunk_headers(conn, MSG_CHUNK_DATA, 0, chunk_id, chunk_offset, data_size, data_size,
+                                          chunk_crc, sequence_num, hdr_buf);
+
+    if (socket_sendfile(conn->sock, file, chunk_offset, data_size, hdr_buf, hdr_size, error) != 0) {
         return -1;
     }
 
-    /* Send chunk header */
-    if (socket_send_all(sock, chunk_hdr_buf, FT_CHUNK_HEADER_SIZE, error) != 0) {
+    LOG_DEBUG("Sent chunk %llu from file, %zu bytes, CRC32: 0x%08X",
+              (unsigned long long)chunk_id, data_size, chunk_crc);
+    return 0;
+}
+
+/* Send compressed chunk */
+int send_chunk_packed(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset,
+                      const uint8_t *packed, size_t packed_size, size_t data_size, uint32_t chunk_crc,
+                      uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t hdr_buf[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t hdr_size = build_chunk_headers(conn, MSG_CHUNK_DATA, FT_FLAG_LZ4, chunk_id, chunk_offset, data_size,
+                                          packed_size, chunk_crc, sequence_num, hdr_buf);
+    FrameSegment segments[2] = {
+        { hdr_buf, hdr_size },
+        { packed, packed_size }
+    };
+    if (connection_send_frame(conn, segments, 2, error) != 0) {
         return -1;
     }
 
-    /* Send chunk data */
-    if (socket_send_all(sock, data, data_size, error) != 0) {
+    LOG_DEBUG("Sent chunk %llu, %zu bytes as %zu, CRC32: 0x%08X",
+              (unsigned long long)chunk_id, data_size, packed_size, chunk_crc);
+    return 0;
+}
+
+/* Send hole record: the chunk header alone */
+int send_chunk_zero(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset, size_t data_size,
+                    uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t hdr_buf[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t hdr_size = build_chunk_headers(conn, MSG_CHUNK_DATA, FT_FLAG_ZERO, chunk_id, chunk_offset, data_size,
+                                          0, 0, sequence_num, hdr_buf);
+    FrameSegment segments[1] = {
+        { hdr_buf, hdr_size }
+    };
+    if (connection_send_frame(conn, segments, 1, error) != 0) {
         return -1;
     }
 
-    LOG_DEBUG("Sent chunk %llu, %zu bytes, CRC32: 0x%08X",
-              (unsigned long long)chunk_id, data_size, chunk_crc);
+    LOG_DEBUG("Sent chunk %llu, %zu zero bytes as a hole", (unsigned long long)chunk_id, data_size);
     return 0;
 }
 
 /* Receive chunk */
-int recv_chunk(socket_t sock, ChunkHeader *chunk_hdr, uint8_t *data,
-               size_t max_data_size, FTErrorCode *error) {
+int recv_chunk(Connection *conn, ChunkHeader *chunk_hdr, uint8_t *data,
+               size_t max_data_size, uint64_t *sequence_num, FTErrorCode *error) {
     /* Receive message header */
     MessageHeader msg_hdr;
     uint8_t chunk_hdr_buf[FT_CHUNK_HEADER_SIZE];
 
     /* First receive the message header */
-    uint8_t msg_hdr_buf[FT_HEADER_SIZE];
-    if (socket_recv_all(sock, msg_hdr_buf, FT_HEADER_SIZE, error) != 0) {
-        return -1;
-    }
-
-    protocol_deserialize_header(msg_hdr_buf, &msg_hdr);
-
-    if (protocol_validate_header(&msg_hdr) != FT_SUCCESS) {
-        if (error) *error = FT_ERR_PROTOCOL;
+    if (recv_header(conn, &msg_hdr, error) != 0) {
         return -1;
     }
 
@@ -429,8 +1008,12 @@ int recv_chunk(socket_t sock, ChunkHeader *chunk_hdr, uint8_t *data,
         return -1;
     }
 
+    if (sequence_num != NULL) {
+        *sequence_num = msg_hdr.sequence_num;
+    }
+
     /* Receive chunk header */
-    if (socket_recv_all(sock, chunk_hdr_buf, FT_CHUNK_HEADER_SIZE, error) != 0) {
+    if (connection_recv_exact(conn, chunk_hdr_buf, FT_CHUNK_HEADER_SIZE, error) != 0) {
         return -1;
     }
 
@@ -443,7 +1026,7 @@ int recv_chunk(socket_t sock, ChunkHeader *chunk_hdr, uint8_t *data,
     }
 
     /* Receive chunk data */
-    if (socket_recv_all(sock, data, chunk_hdr->chunk_size, error) != 0) {
+    if (connection_recv_exact(conn, data, chunk_hdr->chunk_size, error) != 0) {
         return -1;
     }
 
@@ -461,8 +1044,95 @@ int recv_chunk(socket_t sock, ChunkHeader *chunk_hdr, uint8_t *data,
     return 0;
 }
 
+/* Log an ERROR payload received in place of an acknowledgment */
+static FTErrorCode log_peer_error(uint8_t *buffer) {
+    FTErrorCode peer_error = (FTErrorCode)(int8_t)buffer[0];
+
+    buffer[sizeof(ErrorMessage) - 1] = '\0';
+    LOG_ERROR("Server error for chunk %llu: %s (%s)",
+              (unsigned long long)load_be64(buffer + 1), (const char*)(buffer + 9),
+              protocol_get_error_string(peer_error));
+    return peer_error;
+}
+
+/* Send file acknowledgment */
+int send_file_ack(Connection *conn, const FileAck *ack, const uint8_t *bitmap, int resume,
+                  uint64_t sequence_num, FTErrorCode *error) {
+    if (!resume) {
+        uint8_t buffer[FT_FILE_ACK_LEGACY_SIZE] = {ack->status, ack->error_code, ack->flags, 0};
+        return send_message(conn, MSG_FILE_ACK, sequence_num, buffer, sizeof(buffer), error);
+    }
+
+    size_t bitmap_bytes = ((size_t)ack->resume_bits + 7) / 8;
+    uint8_t *buffer = (uint8_t*)malloc(FT_FILE_ACK_HEADER_SIZE + bitmap_bytes);
+    if (buffer == NULL) {
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    protocol_serialize_file_ack(ack, buffer);
+    if (bitmap_bytes > 0) {
+        memcpy(buffer + FT_FILE_ACK_HEADER_SIZE, bitmap, bitmap_bytes);
+    }
+    int result = send_message(conn, MSG_FILE_ACK, sequence_num, buffer,
+                              FT_FILE_ACK_HEADER_SIZE + bitmap_bytes, error);
+    free(buffer);
+    return result;
+}
+
+/* Receive file acknowledgment */
+int recv_file_ack(Connection *conn, FileAck *ack, uint8_t *bitmap, uint64_t bitmap_bits,
+                  FTErrorCode *error) {
+    MessageHeader header;
+    size_t bitmap_bytes = (size_t)((bitmap_bits + 7) / 8);
+    size_t max_size = FT_FILE_ACK_HEADER_SIZE + bitmap_bytes;
+    if (max_size < sizeof(ErrorMessage)) {
+        max_size = sizeof(ErrorMessage);
+    }
+    uint8_t *buffer = (uint8_t*)malloc(max_size);
+    int result = -1;
+
+    if (buffer == NULL) {
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    if (recv_message(conn, &header, buffer, max_size, error) != 0) {
+        goto done;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        /* Server rejected the file */
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        goto done;
+    }
+
+    if (header.msg_type != MSG_FILE_ACK) {
+        LOG_ERROR("Expected FILE_ACK, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        goto done;
+    }
+
+    if (protocol_deserialize_file_ack(buffer, (size_t)header.payload_size, ack) != 0 ||
+        (ack->resume_bits != 0 && ack->resume_bits != bitmap_bits)) {
+        LOG_ERROR("Malformed FILE_ACK payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        goto done;
+    }
+
+    memset(bitmap, 0, bitmap_bytes);
+    if (ack->resume_bits != 0) {
+        memcpy(bitmap, buffer + FT_FILE_ACK_HEADER_SIZE, bitmap_bytes);
+    }
+    if (error) *error = FT_SUCCESS;
+    result = 0;
+
+done:
+    free(buffer);
+    return result;
+}
+
 /* Send chunk acknowledgment */
-int send_chunk_ack(socket_t sock, uint64_t chunk_id, uint8_t status,
+int send_chunk_ack(Connection *conn, uint64_t chunk_id, uint8_t status,
                    uint64_t sequence_num, FTErrorCode *error) {
     ChunkAck ack;
     ack.chunk_id = chunk_id;
@@ -471,20 +1141,26 @@ int send_chunk_ack(socket_t sock, uint64_t chunk_id, uint8_t status,
 
     /* Serialize (need to convert to network byte order) */
     uint8_t buffer[16];
-    uint64_t *buf64 = (uint64_t*)buffer;
-    buf64[0] = htonll(ack.chunk_id);
+    store_be64(buffer, ack.chunk_id);
     buffer[8] = ack.status;
     memset(buffer + 9, 0, 3);
 
-    return send_message(sock, MSG_CHUNK_ACK, sequence_num, buffer, sizeof(ack), error);
+    return send_message(conn, MSG_CHUNK_ACK, sequence_num, buffer, sizeof(ack), error);
 }
 
 /* Receive chunk acknowledgment */
-int recv_chunk_ack(socket_t sock, ChunkAck *ack, FTErrorCode *error) {
+int recv_chunk_ack(Connection *conn, ChunkAck *ack, FTErrorCode *error) {
     MessageHeader header;
-    uint8_t buffer[16];
+    uint8_t buffer[sizeof(ErrorMessage)];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
 
-    if (recv_message(sock, &header, buffer, sizeof(buffer), error) != 0) {
+    if (header.msg_type == MSG_ERROR) {
+        /* Receiver aborted the transfer (e.g. write failure) */
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
         return -1;
     }
 
@@ -495,15 +1171,328 @@ int recv_chunk_ack(socket_t sock, ChunkAck *ack, FTErrorCode *error) {
     }
 
     /* Deserialize */
-    const uint64_t *buf64 = (const uint64_t*)buffer;
-    ack->chunk_id = ntohll(buf64[0]);
+    ack->chunk_id = load_be64(buffer);
     ack->status = buffer[8];
 
     return 0;
 }
 
+/* Send selective acknowledgment */
+int send_chunk_sack(Connection *conn, const ChunkSack *sack, uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_SACK_HEADER_SIZE + FT_SACK_MAX_BITS / 8];
+    size_t size = protocol_serialize_chunk_sack(sack, buffer);
+    return send_message(conn, MSG_CHUNK_SACK, sequence_num, buffer, size, error);
+}
+
+/* Receive selective acknowledgment */
+int recv_chunk_sack(Connection *conn, ChunkSack *sack, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[sizeof(ErrorMessage) > FT_SACK_HEADER_SIZE + FT_SACK_MAX_BITS / 8 ?
+                   sizeof(ErrorMessage) : FT_SACK_HEADER_SIZE + FT_SACK_MAX_BITS / 8];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        /* Receiver aborted the transfer (e.g. write failure) */
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        return -1;
+    }
+
+    if (header.msg_type != MSG_CHUNK_SACK) {
+        LOG_ERROR("Expected CHUNK_SACK, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_chunk_sack(buffer, (size_t)header.payload_size, sack) != 0) {
+        LOG_ERROR("Malformed CHUNK_SACK payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Send block signatures */
+int send_block_signatures(Connection *conn, const BlockSignatures *sigs, const uint8_t *entries,
+                          uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_BLOCK_SIGS_HEADER_SIZE + FT_BLOCK_SIGS_PER_MSG * FT_BLOCK_SIG_SIZE];
+
+    if (sigs->count > FT_BLOCK_SIGS_PER_MSG) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    size_t entry_bytes = (size_t)sigs->count * FT_BLOCK_SIG_SIZE;
+    protocol_serialize_block_signatures(sigs, buffer);
+    memcpy(buffer + FT_BLOCK_SIGS_HEADER_SIZE, entries, entry_bytes);
+
+    return send_message(conn, MSG_BLOCK_SIGNATURES, sequence_num, buffer,
+                        FT_BLOCK_SIGS_HEADER_SIZE + entry_bytes, error);
+}
+
+/* Receive block signatures */
+int recv_block_signatures(Connection *conn, BlockSignatures *sigs, uint8_t *entries, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[FT_BLOCK_SIGS_HEADER_SIZE + FT_BLOCK_SIGS_PER_MSG * FT_BLOCK_SIG_SIZE];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        /* Server could not read its copy */
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        return -1;
+    }
+
+    if (header.msg_type != MSG_BLOCK_SIGNATURES) {
+        LOG_ERROR("Expected BLOCK_SIGNATURES, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_block_signatures(buffer, (size_t)header.payload_size, sigs) != 0) {
+        LOG_ERROR("Malformed BLOCK_SIGNATURES payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    memcpy(entries, buffer + FT_BLOCK_SIGS_HEADER_SIZE, (size_t)sigs->count * FT_BLOCK_SIG_SIZE);
+    return 0;
+}
+
+/* Send delta frame */
+int send_delta_data(Connection *conn, uint64_t frame_id, uint64_t output_offset,
+                    const uint8_t *ops, size_t ops_size, uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t hdr_buf[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t hdr_size = build_chunk_headers(conn, MSG_DELTA_DATA, 0, frame_id, output_offset, ops_size, ops_size,
+                                          crc32_compute(ops, ops_size), sequence_num, hdr_buf);
+    FrameSegment segments[2] = {
+        { hdr_buf, hdr_size },
+        { ops, ops_size }
+    };
+    return connection_send_frame(conn, segments, ops_size > 0 ? 2 : 1, error);
+}
+
+/* Send chunk hashes */
+int send_chunk_hashes(Connection *conn, const ChunkHashes *hashes, const uint8_t *leaves,
+                      uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_CHUNK_HASHES_HEADER_SIZE + FT_DEDUP_MAX_HASHES * FT_SHA256_SIZE];
+
+    if (hashes->count > FT_DEDUP_MAX_HASHES) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    size_t leaf_bytes = (size_t)hashes->count * FT_SHA256_SIZE;
+    protocol_serialize_chunk_hashes(hashes, buffer);
+    memcpy(buffer + FT_CHUNK_HASHES_HEADER_SIZE, leaves, leaf_bytes);
+
+    return send_message(conn, MSG_CHUNK_HASHES, sequence_num, buffer,
+                        FT_CHUNK_HASHES_HEADER_SIZE + leaf_bytes, error);
+}
+
+/* Send chunk have */
+int send_chunk_have(Connection *conn, const ChunkHashes *have, const uint8_t *bitmap,
+                    uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_CHUNK_HASHES_HEADER_SIZE + FT_DEDUP_MAX_HASHES / 8];
+
+    if (have->count > FT_DEDUP_MAX_HASHES) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    size_t bitmap_bytes = ((size_t)have->count + 7) / 8;
+    protocol_serialize_chunk_hashes(have, buffer);
+    memcpy(buffer + FT_CHUNK_HASHES_HEADER_SIZE, bitmap, bitmap_bytes);
+
+    return send_message(conn, MSG_CHUNK_HAVE, sequence_num, buffer,
+                        FT_CHUNK_HASHES_HEADER_SIZE + bitmap_bytes, error);
+}
+
+/* Receive chunk have */
+int recv_chunk_have(Connection *conn, ChunkHashes *have, uint8_t *bitmap, FTErrorCode *error) {
+    MessageHeader header;
+    /* An ERROR is larger than a full bitmap */
+    uint8_t buffer[sizeof(ErrorMessage)];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        return -1;
+    }
+
+    if (header.msg_type != MSG_CHUNK_HAVE) {
+        LOG_ERROR("Expected CHUNK_HAVE, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_chunk_have(buffer, (size_t)header.payload_size, have) != 0) {
+        LOG_ERROR("Malformed CHUNK_HAVE payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    memcpy(bitmap, buffer + FT_CHUNK_HASHES_HEADER_SIZE, ((size_t)have->count + 7) / 8);
+    return 0;
+}
+
+/* Send UDP setup */
+int send_udp_setup(Connection *conn, const UdpSetup *setup, uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_UDP_SETUP_SIZE];
+    protocol_serialize_udp_setup(setup, buffer);
+    return send_message(conn, MSG_UDP_SETUP, sequence_num, buffer, sizeof(buffer), error);
+}
+
+/* Receive UDP setup */
+int recv_udp_setup(Connection *conn, UdpSetup *setup, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[sizeof(ErrorMessage)];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        return -1;
+    }
+
+    if (header.msg_type != MSG_UDP_SETUP ||
+        protocol_deserialize_udp_setup(buffer, (size_t)header.payload_size, setup) != 0) {
+        LOG_ERROR("Expected UDP_SETUP, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Send transfer complete */
+int send_transfer_complete(Connection *conn, const TransferComplete *complete,
+                           uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_TRANSFER_COMPLETE_SIZE];
+    protocol_serialize_transfer_complete(complete, buffer);
+    return send_message(conn, MSG_TRANSFER_COMPLETE, sequence_num, buffer, sizeof(buffer), error);
+}
+
+/* Receive transfer complete */
+int recv_transfer_complete(Connection *conn, TransferComplete *complete, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[FT_TRANSFER_COMPLETE_SIZE];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type != MSG_TRANSFER_COMPLETE) {
+        LOG_ERROR("Expected TRANSFER_COMPLETE, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_transfer_complete(buffer, (size_t)header.payload_size, complete) != 0) {
+        LOG_ERROR("Malformed TRANSFER_COMPLETE payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Send verify request */
+int send_verify_request(Connection *conn, const VerifyRequest *request, const uint8_t *digests,
+                        uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_VERIFY_REQUEST_HEADER_SIZE + FT_VERIFY_MAX_DIGESTS * FT_SHA256_SIZE];
+
+    if (request->digest_count > FT_VERIFY_MAX_DIGESTS) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    size_t digest_bytes = (size_t)request->digest_count * FT_SHA256_SIZE;
+    protocol_serialize_verify_request(request, buffer);
+    memcpy(buffer + FT_VERIFY_REQUEST_HEADER_SIZE, digests, digest_bytes);
+
+    return send_message(conn, MSG_VERIFY_REQUEST, sequence_num, buffer,
+                        FT_VERIFY_REQUEST_HEADER_SIZE + digest_bytes, error);
+}
+
+/* Receive verify request */
+int recv_verify_request(Connection *conn, VerifyRequest *request, uint8_t *digests, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[FT_VERIFY_REQUEST_HEADER_SIZE + FT_VERIFY_MAX_DIGESTS * FT_SHA256_SIZE];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type != MSG_VERIFY_REQUEST) {
+        LOG_ERROR("Expected VERIFY_REQUEST, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_verify_request(buffer, (size_t)header.payload_size, request) != 0) {
+        LOG_ERROR("Malformed VERIFY_REQUEST payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    memcpy(digests, buffer + FT_VERIFY_REQUEST_HEADER_SIZE, (size_t)request->digest_count * FT_SHA256_SIZE);
+    return 0;
+}
+
+/* Send verify response */
+int send_verify_response(Connection *conn, const VerifyResponse *response,
+                         uint64_t sequence_num, FTErrorCode *error) {
+    uint8_t buffer[FT_VERIFY_RESPONSE_HEADER_SIZE + FT_VERIFY_MAX_BAD_CHUNKS * 8];
+    size_t size = protocol_serialize_verify_response(response, buffer);
+    return send_message(conn, MSG_VERIFY_RESPONSE, sequence_num, buffer, size, error);
+}
+
+/* Receive verify response */
+int recv_verify_response(Connection *conn, VerifyResponse *response, FTErrorCode *error) {
+    MessageHeader header;
+    uint8_t buffer[FT_VERIFY_RESPONSE_HEADER_SIZE + FT_VERIFY_MAX_BAD_CHUNKS * 8];
+
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
+        return -1;
+    }
+
+    if (header.msg_type == MSG_ERROR) {
+        FTErrorCode peer_error = log_peer_error(buffer);
+        if (error) *error = peer_error;
+        return -1;
+    }
+
+    if (header.msg_type != MSG_VERIFY_RESPONSE) {
+        LOG_ERROR("Expected VERIFY_RESPONSE, got message type %d", header.msg_type);
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (protocol_deserialize_verify_response(buffer, (size_t)header.payload_size, response) != 0) {
+        LOG_ERROR("Malformed VERIFY_RESPONSE payload");
+        if (error) *error = FT_ERR_PROTOCOL;
+        return -1;
+    }
+
+    return 0;
+}
+
 /* Send error */
-int send_error(socket_t sock, FTErrorCode error_code, uint64_t chunk_id,
+int send_error(Connection *conn, FTErrorCode error_code, uint64_t chunk_id,
                const char *message, uint64_t sequence_num, FTErrorCode *send_error) {
     ErrorMessage err_msg;
     err_msg.error_code = (uint8_t)error_code;
@@ -514,19 +1503,18 @@ int send_error(socket_t sock, FTErrorCode error_code, uint64_t chunk_id,
     /* Serialize */
     uint8_t buffer[256];
     buffer[0] = err_msg.error_code;
-    uint64_t *buf64 = (uint64_t*)(buffer + 1);
-    *buf64 = htonll(err_msg.chunk_id);
+    store_be64(buffer + 1, err_msg.chunk_id);
     memcpy(buffer + 9, err_msg.message, sizeof(err_msg.message));
 
-    return send_message(sock, MSG_ERROR, sequence_num, buffer, sizeof(err_msg), send_error);
+    return send_message(conn, MSG_ERROR, sequence_num, buffer, sizeof(err_msg), send_error);
 }
 
 /* Receive error */
-int recv_error(socket_t sock, ErrorMessage *error_msg, FTErrorCode *error) {
+int recv_error(Connection *conn, ErrorMessage *error_msg, FTErrorCode *error) {
     MessageHeader header;
     uint8_t buffer[256];
 
-    if (recv_message(sock, &header, buffer, sizeof(buffer), error) != 0) {
+    if (recv_message(conn, &header, buffer, sizeof(buffer), error) != 0) {
         return -1;
     }
 
@@ -538,8 +1526,7 @@ int recv_error(socket_t sock, ErrorMessage *error_msg, FTErrorCode *error) {
 
     /* Deserialize */
     error_msg->error_code = buffer[0];
-    const uint64_t *buf64 = (const uint64_t*)(buffer + 1);
-    error_msg->chunk_id = ntohll(*buf64);
+    error_msg->chunk_id = load_be64(buffer + 1);
     memcpy(error_msg->message, buffer + 9, sizeof(error_msg->message));
     error_msg->message[sizeof(error_msg->message) - 1] = '\0';
 
@@ -3,16 +3,52 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include "platform.h"
 #include "protocol.h"
+#include "connection.h"
 
 /* Socket creation and configuration */
 socket_t socket_create(FTErrorCode *error);
 int socket_set_timeout(socket_t sock, int timeout_seconds, FTErrorCode *error);
 int socket_set_nodelay(socket_t sock, int enable, FTErrorCode *error);
 int socket_set_reuseaddr(socket_t sock, int enable, FTErrorCode *error);
-
-/* Server-side functions */
+int socket_set_nonblocking(socket_t sock, int enable, FTErrorCode *error);
+
+/* Kernel buffer size of the send (SO_SNDBUF) or receive (SO_RCVBUF)
+ * side. Linux reports twice the size set, counting its bookkeeping, caps
+ * what is set at net.core.wmem_max/rmem_max and stops autotuning a buffer
+ * once it has been set. */
+int socket_get_buffer_size(socket_t sock, int send_side, size_t *size, FTErrorCode *error);
+int socket_set_buffer_size(socket_t sock, int send_side, size_t size, FTErrorCode *error);
+
+/* Largest send or receive buffer the kernel grows a TCP socket to by
+ * itself (Linux net.ipv4.tcp_wmem/tcp_rmem); 0 where unknown */
+size_t socket_autotune_limit(int send_side);
+
+/* Let several sockets bind the same port, with the kernel spreading
+ * incoming connections across them. Linux only; -1 where unsupported. */
+int socket_set_reuseport(socket_t sock, int enable, FTErrorCode *error);
+
+/* TCP Fast Open. On a listener, accept data in the SYN of clients holding
+ * a cookie (Linux also needs net.ipv4.tcp_fastopen & 2); on a socket about
+ * to connect, send the first write in the SYN once the kernel has a cookie
+ * for the server, in which case connect() returns at once and a refused
+ * connection fails that write instead. -1 where unsupported. */
+int socket_set_fastopen(socket_t sock, int listener, FTErrorCode *error);
+
+/* SO_KEEPALIVE, probing after idle_seconds without traffic and giving up
+ * on the peer after a few unanswered probes where the system allows */
+int socket_set_keepalive(socket_t sock, int idle_seconds, FTErrorCode *error);
+
+/* Wait until socket is readable; returns 1 if readable, 0 on timeout, -1 on error */
+int socket_wait_readable(socket_t sock, uint32_t timeout_ms);
+
+/* Shut down both directions (wakes threads blocked in recv/send) */
+void socket_shutdown(socket_t sock);
+
+/* Server-side functions. On a non-blocking listener with nothing to
+ * accept, socket_accept_connection() fails quietly with FT_ERR_TIMEOUT. */
 int socket_bind_and_listen(socket_t sock, uint16_t port, int backlog, FTErrorCode *error);
 socket_t socket_accept_connection(socket_t listen_sock, char *client_ip, size_t ip_size, FTErrorCode *error);
 
@@ -24,39 +60,148 @@ int socket_connect_with_retry(socket_t sock, const char *host, uint16_t port,
 int socket_send_all(socket_t sock, const uint8_t *buffer, size_t length, FTErrorCode *error);
 int socket_recv_all(socket_t sock, uint8_t *buffer, size_t length, FTErrorCode *error);
 
+/* Send head (may be NULL) followed by length bytes of file at offset. File
+ * data goes from the page cache to the socket without a user-space copy
+ * (sendfile on Linux/macOS, TransmitFile on Windows); other systems and
+ * file systems without sendfile support fall back to pread + send. */
+int socket_sendfile(socket_t sock, FILE *file, uint64_t offset, size_t length,
+                    const uint8_t *head, size_t head_len, FTErrorCode *error);
+
 /* Protocol message functions */
-int send_message(socket_t sock, MessageType msg_type, uint64_t sequence_num,
+int send_message(Connection *conn, MessageType msg_type, uint64_t sequence_num,
                  const uint8_t *payload, size_t payload_size, FTErrorCode *error);
 
-int recv_message(socket_t sock, MessageHeader *header, uint8_t *payload,
+int recv_message(Connection *conn, MessageHeader *header, uint8_t *payload,
                  size_t max_payload_size, FTErrorCode *error);
 
-/* Handshake functions */
-int perform_handshake_client(socket_t sock, FTErrorCode *error);
-int perform_handshake_server(socket_t sock, FTErrorCode *error);
+/* Non-blocking header receive in the connection's framing (see
+ * connection_recv_partial()): *done counts the bytes of buffer received,
+ * and is the header's length once it returns 1 with header validated */
+int recv_header_partial(Connection *conn, uint8_t buffer[FT_HEADER_SIZE], size_t *done,
+                        MessageHeader *header, FTErrorCode *error);
+
+/* Handshake functions. *capabilities holds the FT_CAP_* bits offered
+ * (client) or supported (server) and receives the agreed set, and
+ * *max_chunk_size likewise the largest chunk size either side takes.
+ * The client declares its FT_PRIORITY_* class and learns the round trip
+ * time of the exchange in *rtt_us (may be NULL). *session (may be NULL:
+ * 0) asks for (client) or allows (server) a session that stays open
+ * between files with KEEPALIVEs (FT_FLAG_SESSION), and is left 1 only if
+ * both sides agree. Both sides leave the agreed protocol version in
+ * conn->version. */
+int perform_handshake_client(Connection *conn, uint8_t *capabilities, uint32_t *max_chunk_size,
+                             uint8_t priority, int *session, uint64_t *rtt_us, FTErrorCode *error);
+int perform_handshake_server(Connection *conn, uint8_t *capabilities, uint32_t *max_chunk_size,
+                             FTErrorCode *error);
+
+/* Server side of the handshake once the request has been received */
+int handshake_server_reply(Connection *conn, const MessageHeader *header, const HandshakePayload *payload,
+                           uint8_t *capabilities, uint32_t *max_chunk_size, int *session,
+                           FTErrorCode *error);
+
+/* Priority class a handshake request declares */
+uint8_t handshake_priority(const MessageHeader *header);
 
 /* File info exchange */
-int send_file_info(socket_t sock, const FileInfo *file_info, uint64_t sequence_num, FTErrorCode *error);
-int recv_file_info(socket_t sock, FileInfo *file_info, FTErrorCode *error);
+int send_file_info(Connection *conn, const FileInfo *file_info, uint64_t sequence_num, FTErrorCode *error);
+int recv_file_info(Connection *conn, FileInfo *file_info, FTErrorCode *error);
+
+/* FILE_INFO payload limit for the connection's version, and the parser of
+ * a received one (payload must hold FT_FILE_INFO_SIZE bytes: a short v1
+ * payload is zero-padded in place) */
+size_t file_info_max_size(const Connection *conn);
+int file_info_parse(const Connection *conn, uint8_t *payload, size_t size, FileInfo *file_info,
+                    FTErrorCode *error);
+
+/* File acknowledgment. Without resume the legacy 4-byte form is sent and
+ * the bitmap is ignored. The receiver passes a bitmap of bitmap_bits bits
+ * (its stripe's chunk count); it is cleared unless the server resumes. An
+ * ERROR from the server fails with its error code. */
+int send_file_ack(Connection *conn, const FileAck *ack, const uint8_t *bitmap, int resume,
+                  uint64_t sequence_num, FTErrorCode *error);
+int recv_file_ack(Connection *conn, FileAck *ack, uint8_t *bitmap, uint64_t bitmap_bits,
+                  FTErrorCode *error);
 
 /* Chunk transfer */
-int send_chunk(socket_t sock, uint64_t chunk_id, uint64_t chunk_offset,
+int send_chunk(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset,
                const uint8_t *data, size_t data_size, uint64_t sequence_num, FTErrorCode *error);
 
-int recv_chunk(socket_t sock, ChunkHeader *chunk_hdr, uint8_t *data,
-               size_t max_data_size, FTErrorCode *error);
+/* Send chunk whose payload is taken directly from file at chunk_offset
+ * (zero-copy); chunk_crc is the CRC32 of that range */
+int send_chunk_from_file(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset, FILE *file,
+                         size_t data_size, uint32_t chunk_crc, uint64_t sequence_num, FTErrorCode *error);
+
+/* Send chunk compressed into an LZ4 block of packed_size bytes (FT_FLAG_LZ4);
+ * data_size and chunk_crc describe the uncompressed chunk */
+int send_chunk_packed(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset,
+                      const uint8_t *packed, size_t packed_size, size_t data_size, uint32_t chunk_crc,
+                      uint64_t sequence_num, FTErrorCode *error);
+
+/* Send a chunk of data_size zero bytes as its header alone (FT_FLAG_ZERO) */
+int send_chunk_zero(Connection *conn, uint64_t chunk_id, uint64_t chunk_offset, size_t data_size,
+                    uint64_t sequence_num, FTErrorCode *error);
+
+/* Receive chunk. *sequence_num (optional) is set from the message header,
+ * also when the chunk fails its CRC check. */
+int recv_chunk(Connection *conn, ChunkHeader *chunk_hdr, uint8_t *data,
+               size_t max_data_size, uint64_t *sequence_num, FTErrorCode *error);
 
 /* Acknowledgments */
-int send_chunk_ack(socket_t sock, uint64_t chunk_id, uint8_t status,
+int send_chunk_ack(Connection *conn, uint64_t chunk_id, uint8_t status,
                    uint64_t sequence_num, FTErrorCode *error);
 
-int recv_chunk_ack(socket_t sock, ChunkAck *ack, FTErrorCode *error);
+int recv_chunk_ack(Connection *conn, ChunkAck *ack, FTErrorCode *error);
+
+/* Selective acknowledgments (FT_CAP_SACK) */
+int send_chunk_sack(Connection *conn, const ChunkSack *sack, uint64_t sequence_num, FTErrorCode *error);
+
+int recv_chunk_sack(Connection *conn, ChunkSack *sack, FTErrorCode *error);
+
+/* Delta upload (FT_CAP_DELTA): the server's block signatures, then the
+ * client's DELTA_DATA frames. An ERROR instead of signatures fails with
+ * the server's error code. */
+int send_block_signatures(Connection *conn, const BlockSignatures *sigs, const uint8_t *entries,
+                          uint64_t sequence_num, FTErrorCode *error);
+int recv_block_signatures(Connection *conn, BlockSignatures *sigs, uint8_t *entries, FTErrorCode *error);
+int send_delta_data(Connection *conn, uint64_t frame_id, uint64_t output_offset,
+                    const uint8_t *ops, size_t ops_size, uint64_t sequence_num, FTErrorCode *error);
+
+/* Chunk store lookups (FT_CAP_DEDUP): the client's chunk leaves, and the
+ * bitmap of the ones the server holds ((count + 7) / 8 bytes). An ERROR
+ * instead of CHUNK_HAVE fails with the server's error code. */
+int send_chunk_hashes(Connection *conn, const ChunkHashes *hashes, const uint8_t *leaves,
+                      uint64_t sequence_num, FTErrorCode *error);
+int send_chunk_have(Connection *conn, const ChunkHashes *have, const uint8_t *bitmap,
+                    uint64_t sequence_num, FTErrorCode *error);
+int recv_chunk_have(Connection *conn, ChunkHashes *have, uint8_t *bitmap, FTErrorCode *error);
+
+/* UDP data path (FT_FILE_ACK_UDP), right after FILE_ACK. An ERROR instead
+ * fails with the server's error code. */
+int send_udp_setup(Connection *conn, const UdpSetup *setup, uint64_t sequence_num, FTErrorCode *error);
+int recv_udp_setup(Connection *conn, UdpSetup *setup, FTErrorCode *error);
+
+/* End of transfer and tree hash verification (FT_CAP_TREE_HASH) */
+int send_transfer_complete(Connection *conn, const TransferComplete *complete,
+                           uint64_t sequence_num, FTErrorCode *error);
+
+int recv_transfer_complete(Connection *conn, TransferComplete *complete, FTErrorCode *error);
+
+int send_verify_request(Connection *conn, const VerifyRequest *request, const uint8_t *digests,
+                        uint64_t sequence_num, FTErrorCode *error);
+
+/* digests must hold FT_VERIFY_MAX_DIGESTS * FT_SHA256_SIZE bytes */
+int recv_verify_request(Connection *conn, VerifyRequest *request, uint8_t *digests, FTErrorCode *error);
+
+int send_verify_response(Connection *conn, const VerifyResponse *response,
+                         uint64_t sequence_num, FTErrorCode *error);
+
+int recv_verify_response(Connection *conn, VerifyResponse *response, FTErrorCode *error);
 
 /* Error messages */
-int send_error(socket_t sock, FTErrorCode error_code, uint64_t chunk_id,
+int send_error(Connection *conn, FTErrorCode error_code, uint64_t chunk_id,
                const char *message, uint64_t sequence_num, FTErrorCode *send_error);
 
-int recv_error(socket_t sock, ErrorMessage *error_msg, FTErrorCode *error);
+int recv_error(Connection *conn, ErrorMessage *error_msg, FTErrorCode *error);
 
 /* Utility functions */
 int resolve_hostname(const char *hostname, char *ip_address, size_t ip_size);
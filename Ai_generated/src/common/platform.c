@@ -1,12 +1,36 @@
 #include "platform.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef FT_PLATFORM_WINDOWS
 #include <time.h>
+#include <bcrypt.h>
 #pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "bcrypt.lib")
 #else
 #include <sys/time.h>
+#include <fcntl.h>
+#endif
+
+#ifdef FT_PLATFORM_LINUX
+#include <sched.h>
+#include <sys/random.h>
+#endif
+
+/* Poller backend */
+#if defined(FT_PLATFORM_LINUX)
+#define FT_POLLER_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif defined(FT_PLATFORM_MACOS) || defined(__FreeBSD__)
+#define FT_POLLER_KQUEUE
+#include <sys/event.h>
+#else
+#define FT_POLLER_POLL
+#ifndef FT_PLATFORM_WINDOWS
+#include <poll.h>
+#endif
 #endif
 
 /* Cross-platform sleep function */
@@ -88,6 +112,615 @@ uint64_t platform_get_monotonic_ms(void) {
 #endif
 }
 
+/* Get monotonic time in microseconds */
+uint64_t platform_get_monotonic_us(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    static LARGE_INTEGER frequency;
+    static int initialized = 0;
+    LARGE_INTEGER counter;
+
+    if (!initialized) {
+        QueryPerformanceFrequency(&frequency);
+        initialized = 1;
+    }
+
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000 +
+                      (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    #ifdef CLOCK_MONOTONIC
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    #else
+        clock_gettime(CLOCK_REALTIME, &ts);
+    #endif
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* Get monotonic time in nanoseconds */
+uint64_t platform_get_monotonic_ns(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    static LARGE_INTEGER frequency;
+    static int initialized = 0;
+    LARGE_INTEGER counter;
+
+    if (!initialized) {
+        QueryPerformanceFrequency(&frequency);
+        initialized = 1;
+    }
+
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000000 +
+                      (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    #ifdef CLOCK_MONOTONIC
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    #else
+        clock_gettime(CLOCK_REALTIME, &ts);
+    #endif
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Read from the OS CSPRNG */
+int platform_random_bytes(void *buf, size_t len) {
+#if defined(FT_PLATFORM_WINDOWS)
+    return BCryptGenRandom(NULL, (PUCHAR)buf, (ULONG)len, BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0 ? 0 : -1;
+#elif defined(FT_PLATFORM_MACOS) || defined(__FreeBSD__) || defined(__OpenBSD__)
+    arc4random_buf(buf, len);
+    return 0;
+#else
+    uint8_t *out = (uint8_t*)buf;
+    size_t filled = 0;
+#if defined(FT_PLATFORM_LINUX)
+    while (filled < len) {
+        ssize_t n = getrandom(out + filled, len - filled, 0);
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+        filled += n > 0 ? (size_t)n : 0;
+    }
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    while (filled < len) {
+        ssize_t n = read(fd, out + filled, len - filled);
+        if (n <= 0 && !(n < 0 && errno == EINTR)) {
+            close(fd);
+            return -1;
+        }
+        filled += n > 0 ? (size_t)n : 0;
+    }
+    close(fd);
+#endif
+    return 0;
+#endif
+}
+
+/* Trampoline so thread functions share one signature across platforms */
+typedef struct {
+    ft_thread_func func;
+    void *arg;
+} ThreadStart;
+
+#ifdef FT_PLATFORM_WINDOWS
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+#else
+static void* thread_trampoline(void *param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return NULL;
+}
+#endif
+
+/* Create thread */
+int platform_thread_create(ft_thread_t *thread, ft_thread_func func, void *arg) {
+    ThreadStart *start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    if (start == NULL) {
+        return -1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+#ifdef FT_PLATFORM_WINDOWS
+    *thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return -1;
+    }
+#else
+    if (pthread_create(thread, NULL, thread_trampoline, start) != 0) {
+        free(start);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/* Wait for thread to exit */
+int platform_thread_join(ft_thread_t thread) {
+#ifdef FT_PLATFORM_WINDOWS
+    if (WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0) {
+        return -1;
+    }
+    CloseHandle(thread);
+    return 0;
+#else
+    return (pthread_join(thread, NULL) == 0) ? 0 : -1;
+#endif
+}
+
+/* Mutexes */
+void platform_mutex_init(ft_mutex_t *mutex) {
+#ifdef FT_PLATFORM_WINDOWS
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void platform_mutex_lock(ft_mutex_t *mutex) {
+#ifdef FT_PLATFORM_WINDOWS
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void platform_mutex_unlock(ft_mutex_t *mutex) {
+#ifdef FT_PLATFORM_WINDOWS
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void platform_mutex_destroy(ft_mutex_t *mutex) {
+#ifdef FT_PLATFORM_WINDOWS
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+/* Condition variables */
+void platform_cond_init(ft_cond_t *cond) {
+#ifdef FT_PLATFORM_WINDOWS
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+void platform_cond_wait(ft_cond_t *cond, ft_mutex_t *mutex) {
+#ifdef FT_PLATFORM_WINDOWS
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+int platform_cond_timedwait(ft_cond_t *cond, ft_mutex_t *mutex, uint32_t timeout_ms) {
+#ifdef FT_PLATFORM_WINDOWS
+    if (!SleepConditionVariableCS(cond, mutex, timeout_ms)) {
+        return (GetLastError() == ERROR_TIMEOUT) ? 1 : 0;
+    }
+    return 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return (pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT) ? 1 : 0;
+#endif
+}
+
+void platform_cond_signal(ft_cond_t *cond) {
+#ifdef FT_PLATFORM_WINDOWS
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+void platform_cond_broadcast(ft_cond_t *cond) {
+#ifdef FT_PLATFORM_WINDOWS
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+void platform_cond_destroy(ft_cond_t *cond) {
+#ifdef FT_PLATFORM_WINDOWS
+    (void)cond;  /* Windows condition variables need no cleanup */
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+/* Get number of online processors */
+int platform_cpu_count(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/* Pin current thread */
+int platform_pin_thread(int cpu) {
+#if defined(FT_PLATFORM_WINDOWS)
+    if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8)) {
+        return -1;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0 ? 0 : -1;
+#elif defined(FT_PLATFORM_LINUX)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+#else
+    /* Affinity is only a scheduling hint here */
+    (void)cpu;
+    return -1;
+#endif
+}
+
+/* Poller state */
+struct ft_poller {
+#if defined(FT_POLLER_EPOLL)
+    int epoll_fd;
+    int wake_fd;                   /* eventfd */
+#elif defined(FT_POLLER_KQUEUE)
+    int kqueue_fd;                 /* Wakeups are an EVFILT_USER event */
+#else
+    /* Entry 0 is the wake socket: a UDP socket connected to itself */
+#ifdef FT_PLATFORM_WINDOWS
+    WSAPOLLFD *fds;
+#else
+    struct pollfd *fds;
+#endif
+    void   **contexts;
+    size_t   count;
+    size_t   capacity;
+    socket_t wake_sock;
+#endif
+};
+
+#if defined(FT_POLLER_POLL)
+/* Make the wake socket non-blocking */
+static int poller_set_nonblocking(socket_t sock) {
+#ifdef FT_PLATFORM_WINDOWS
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return (flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0) ? 0 : -1;
+#endif
+}
+
+/* Index of sock in the poll set, or 0 if absent */
+static size_t poller_find(ft_poller_t *poller, socket_t sock) {
+    for (size_t i = 1; i < poller->count; i++) {
+        if (poller->fds[i].fd == sock) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* FT_POLL_* to poll() bits */
+static short poller_poll_events(uint32_t events) {
+    short bits = 0;
+    if (events & FT_POLL_READ) {
+        bits |= POLLIN;
+    }
+    if (events & FT_POLL_WRITE) {
+        bits |= POLLOUT;
+    }
+    return bits;
+}
+#endif
+
+/* Create poller */
+ft_poller_t* platform_poller_create(void) {
+    ft_poller_t *poller = (ft_poller_t*)calloc(1, sizeof(ft_poller_t));
+    if (poller == NULL) {
+        return NULL;
+    }
+
+#if defined(FT_POLLER_EPOLL)
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    poller->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = poller;
+    if (poller->epoll_fd < 0 || poller->wake_fd < 0 ||
+        epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, poller->wake_fd, &event) != 0) {
+        if (poller->epoll_fd >= 0) close(poller->epoll_fd);
+        if (poller->wake_fd >= 0) close(poller->wake_fd);
+        free(poller);
+        return NULL;
+    }
+#elif defined(FT_POLLER_KQUEUE)
+    poller->kqueue_fd = kqueue();
+    struct kevent change;
+    EV_SET(&change, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (poller->kqueue_fd < 0 || kevent(poller->kqueue_fd, &change, 1, NULL, 0, NULL) != 0) {
+        if (poller->kqueue_fd >= 0) close(poller->kqueue_fd);
+        free(poller);
+        return NULL;
+    }
+#else
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    poller->capacity = 16;
+    poller->fds = calloc(poller->capacity, sizeof(*poller->fds));
+    poller->contexts = (void**)calloc(poller->capacity, sizeof(void*));
+    poller->wake_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (poller->fds == NULL || poller->contexts == NULL || poller->wake_sock == INVALID_SOCKET_VALUE ||
+        bind(poller->wake_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(poller->wake_sock, (struct sockaddr*)&addr, &addr_len) != 0 ||
+        connect(poller->wake_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        poller_set_nonblocking(poller->wake_sock) != 0) {
+        if (poller->wake_sock != INVALID_SOCKET_VALUE) close_socket(poller->wake_sock);
+        free(poller->fds);
+        free(poller->contexts);
+        free(poller);
+        return NULL;
+    }
+    poller->fds[0].fd = poller->wake_sock;
+    poller->fds[0].events = POLLIN;
+    poller->count = 1;
+#endif
+
+    return poller;
+}
+
+/* Destroy poller (registered sockets are left open) */
+void platform_poller_destroy(ft_poller_t *poller) {
+    if (poller == NULL) {
+        return;
+    }
+#if defined(FT_POLLER_EPOLL)
+    close(poller->wake_fd);
+    close(poller->epoll_fd);
+#elif defined(FT_POLLER_KQUEUE)
+    close(poller->kqueue_fd);
+#else
+    close_socket(poller->wake_sock);
+    free(poller->fds);
+    free(poller->contexts);
+#endif
+    free(poller);
+}
+
+#if defined(FT_POLLER_KQUEUE)
+/* Register or update both filters of a socket */
+static int poller_kqueue_update(ft_poller_t *poller, socket_t sock, uint32_t events, void *context) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], sock, EVFILT_READ, EV_ADD | ((events & FT_POLL_READ) ? EV_ENABLE : EV_DISABLE),
+           0, 0, context);
+    EV_SET(&changes[1], sock, EVFILT_WRITE, EV_ADD | ((events & FT_POLL_WRITE) ? EV_ENABLE : EV_DISABLE),
+           0, 0, context);
+    return kevent(poller->kqueue_fd, changes, 2, NULL, 0, NULL) == 0 ? 0 : -1;
+}
+#endif
+
+/* Start watching socket */
+int platform_poller_add(ft_poller_t *poller, socket_t sock, uint32_t events, void *context) {
+#if defined(FT_POLLER_EPOLL)
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((events & FT_POLL_READ) ? EPOLLIN : 0) | ((events & FT_POLL_WRITE) ? EPOLLOUT : 0);
+    event.data.ptr = context;
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, sock, &event) == 0 ? 0 : -1;
+#elif defined(FT_POLLER_KQUEUE)
+    return poller_kqueue_update(poller, sock, events, context);
+#else
+    if (poller->count == poller->capacity) {
+        size_t capacity = poller->capacity * 2;
+        void *fds = realloc(poller->fds, capacity * sizeof(*poller->fds));
+        if (fds == NULL) {
+            return -1;
+        }
+        poller->fds = fds;
+        void **contexts = (void**)realloc(poller->contexts, capacity * sizeof(void*));
+        if (contexts == NULL) {
+            return -1;
+        }
+        poller->contexts = contexts;
+        poller->capacity = capacity;
+    }
+    poller->fds[poller->count].fd = sock;
+    poller->fds[poller->count].events = poller_poll_events(events);
+    poller->fds[poller->count].revents = 0;
+    poller->contexts[poller->count] = context;
+    poller->count++;
+    return 0;
+#endif
+}
+
+/* Change watched events */
+int platform_poller_modify(ft_poller_t *poller, socket_t sock, uint32_t events, void *context) {
+#if defined(FT_POLLER_EPOLL)
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((events & FT_POLL_READ) ? EPOLLIN : 0) | ((events & FT_POLL_WRITE) ? EPOLLOUT : 0);
+    event.data.ptr = context;
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, sock, &event) == 0 ? 0 : -1;
+#elif defined(FT_POLLER_KQUEUE)
+    return poller_kqueue_update(poller, sock, events, context);
+#else
+    size_t index = poller_find(poller, sock);
+    if (index == 0) {
+        return -1;
+    }
+    poller->fds[index].events = poller_poll_events(events);
+    poller->contexts[index] = context;
+    return 0;
+#endif
+}
+
+/* Stop watching socket */
+void platform_poller_remove(ft_poller_t *poller, socket_t sock) {
+#if defined(FT_POLLER_EPOLL)
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, sock, &event);
+#elif defined(FT_POLLER_KQUEUE)
+    struct kevent changes[2];
+    EV_SET(&changes[0], sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], sock, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(poller->kqueue_fd, changes, 2, NULL, 0, NULL);
+#else
+    size_t index = poller_find(poller, sock);
+    if (index != 0) {
+        /* Move the last entry into the gap */
+        poller->count--;
+        poller->fds[index] = poller->fds[poller->count];
+        poller->contexts[index] = poller->contexts[poller->count];
+    }
+#endif
+}
+
+/* Wait for events */
+int platform_poller_wait(ft_poller_t *poller, ft_poll_event_t *events, int max_events, int timeout_ms) {
+    int count = 0;
+
+#if defined(FT_POLLER_EPOLL)
+    struct epoll_event ready[64];
+    int limit = max_events < 64 ? max_events : 64;
+    int n = epoll_wait(poller->epoll_fd, ready, limit, timeout_ms);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (ready[i].data.ptr == poller) {
+            uint64_t value;
+            ssize_t drained = read(poller->wake_fd, &value, sizeof(value));
+            (void)drained;
+            continue;
+        }
+        uint32_t bits = 0;
+        if (ready[i].events & EPOLLIN) bits |= FT_POLL_READ;
+        if (ready[i].events & EPOLLOUT) bits |= FT_POLL_WRITE;
+        if (ready[i].events & (EPOLLERR | EPOLLHUP)) bits |= FT_POLL_ERROR;
+        events[count].context = ready[i].data.ptr;
+        events[count].events = bits;
+        count++;
+    }
+#elif defined(FT_POLLER_KQUEUE)
+    struct kevent ready[64];
+    int limit = max_events < 64 ? max_events : 64;
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+    int n = kevent(poller->kqueue_fd, NULL, 0, ready, limit, timeout_ms < 0 ? NULL : &timeout);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (ready[i].filter == EVFILT_USER) {
+            continue;
+        }
+        uint32_t bits = (ready[i].filter == EVFILT_READ) ? FT_POLL_READ : FT_POLL_WRITE;
+        if (ready[i].flags & (EV_EOF | EV_ERROR)) bits |= FT_POLL_ERROR;
+        events[count].context = ready[i].udata;
+        events[count].events = bits;
+        count++;
+    }
+#else
+#ifdef FT_PLATFORM_WINDOWS
+    int n = WSAPoll(poller->fds, (ULONG)poller->count, timeout_ms);
+#else
+    int n = poll(poller->fds, (nfds_t)poller->count, timeout_ms);
+#endif
+    if (n < 0) {
+#ifndef FT_PLATFORM_WINDOWS
+        if (errno == EINTR) {
+            return 0;
+        }
+#endif
+        return -1;
+    }
+    if (poller->fds[0].revents != 0) {
+        char drain[64];
+        while (recv(poller->wake_sock, drain, sizeof(drain), 0) > 0) {
+        }
+    }
+    for (size_t i = 1; i < poller->count && count < max_events; i++) {
+        short revents = poller->fds[i].revents;
+        if (revents == 0) {
+            continue;
+        }
+        uint32_t bits = 0;
+        if (revents & POLLIN) bits |= FT_POLL_READ;
+        if (revents & POLLOUT) bits |= FT_POLL_WRITE;
+        if (revents & (POLLERR | POLLHUP | POLLNVAL)) bits |= FT_POLL_ERROR;
+        events[count].context = poller->contexts[i];
+        events[count].events = bits;
+        count++;
+    }
+#endif
+
+    return count;
+}
+
+/* Wake waiting thread */
+void platform_poller_wake(ft_poller_t *poller) {
+#if defined(FT_POLLER_EPOLL)
+    uint64_t one = 1;
+    ssize_t written = write(poller->wake_fd, &one, sizeof(one));
+    (void)written;
+#elif defined(FT_POLLER_KQUEUE)
+    struct kevent change;
+    EV_SET(&change, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    kevent(poller->kqueue_fd, &change, 1, NULL, 0, NULL);
+#else
+    send(poller->wake_sock, "", 1, 0);
+#endif
+}
+
+/* Poller backend name */
+const char* platform_poller_backend(void) {
+#if defined(FT_POLLER_EPOLL)
+    return "epoll";
+#elif defined(FT_POLLER_KQUEUE)
+    return "kqueue";
+#elif defined(FT_PLATFORM_WINDOWS)
+    return "WSAPoll";
+#else
+    return "poll";
+#endif
+}
+
 /* Get human-readable socket error message */
 const char* platform_get_socket_error(int error_code) {
 #ifdef FT_PLATFORM_WINDOWS
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <time.h>
+#include <string.h>
 
 /* Platform detection */
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
@@ -21,6 +22,11 @@
 /* Platform-specific includes and definitions */
 #ifdef FT_PLATFORM_WINDOWS
     #define WIN32_LEAN_AND_MEAN
+    /* WSAPoll needs Windows Vista or later */
+    #if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+        #undef _WIN32_WINNT
+        #define _WIN32_WINNT 0x0600
+    #endif
     #include <winsock2.h>
     #include <ws2tcpip.h>
     #include <windows.h>
@@ -43,10 +49,18 @@
     #define fseeko _fseeki64
     #define ftello _ftelli64
 
+    /* Socket shutdown */
+    #define SHUT_RDWR SD_BOTH
+
     /* Path separator */
     #define PATH_SEPARATOR '\\'
     #define PATH_SEPARATOR_STR "\\"
 
+    /* Threading types */
+    typedef HANDLE ft_thread_t;
+    typedef CRITICAL_SECTION ft_mutex_t;
+    typedef CONDITION_VARIABLE ft_cond_t;
+
 #else
     /* Unix-like systems (Linux, macOS, BSD) */
     #include <sys/types.h>
@@ -59,6 +73,7 @@
     #include <unistd.h>
     #include <fcntl.h>
     #include <errno.h>
+    #include <pthread.h>
 
     /* Socket types */
     typedef int socket_t;
@@ -78,6 +93,11 @@
     #define PATH_SEPARATOR '/'
     #define PATH_SEPARATOR_STR "/"
 
+    /* Threading types */
+    typedef pthread_t ft_thread_t;
+    typedef pthread_mutex_t ft_mutex_t;
+    typedef pthread_cond_t ft_cond_t;
+
     /* Large file support is handled by _FILE_OFFSET_BITS=64 */
 #endif
 
@@ -94,6 +114,75 @@ uint64_t platform_get_time_ms(void);
 /* Get monotonic time in milliseconds (for elapsed time calculations) */
 uint64_t platform_get_monotonic_ms(void);
 
+/* Get monotonic time in microseconds (for timing individual operations) */
+uint64_t platform_get_monotonic_us(void);
+
+/* Get monotonic time in nanoseconds (for latency histograms) */
+uint64_t platform_get_monotonic_ns(void);
+
+/* Fill buf with len bytes from the OS CSPRNG; -1 if it is unavailable */
+int platform_random_bytes(void *buf, size_t len);
+
+/* Thread entry point */
+typedef void (*ft_thread_func)(void *arg);
+
+/* Threads (return 0 on success, -1 on failure) */
+int platform_thread_create(ft_thread_t *thread, ft_thread_func func, void *arg);
+int platform_thread_join(ft_thread_t thread);
+
+/* Mutexes */
+void platform_mutex_init(ft_mutex_t *mutex);
+void platform_mutex_lock(ft_mutex_t *mutex);
+void platform_mutex_unlock(ft_mutex_t *mutex);
+void platform_mutex_destroy(ft_mutex_t *mutex);
+
+/* Condition variables */
+void platform_cond_init(ft_cond_t *cond);
+void platform_cond_wait(ft_cond_t *cond, ft_mutex_t *mutex);
+/* Wait with timeout; returns 0 if signaled, 1 on timeout */
+int platform_cond_timedwait(ft_cond_t *cond, ft_mutex_t *mutex, uint32_t timeout_ms);
+void platform_cond_signal(ft_cond_t *cond);
+void platform_cond_broadcast(ft_cond_t *cond);
+void platform_cond_destroy(ft_cond_t *cond);
+
+/* Number of online processors (at least 1) */
+int platform_cpu_count(void);
+
+/* Pin the calling thread to one processor; -1 where unsupported (macOS) */
+int platform_pin_thread(int cpu);
+
+/* Readiness events (platform_poller_*) */
+#define FT_POLL_READ   0x01
+#define FT_POLL_WRITE  0x02
+#define FT_POLL_ERROR  0x04        /* Hang-up or socket error; reported, never requested */
+
+/* One ready socket */
+typedef struct {
+    void     *context;             /* As registered with the socket */
+    uint32_t  events;              /* FT_POLL_* bits */
+} ft_poll_event_t;
+
+/* Level-triggered socket readiness poller: epoll on Linux, kqueue on
+ * macOS, WSAPoll on Windows and poll() elsewhere. Only the thread calling
+ * platform_poller_wait() may add, modify or remove sockets. */
+typedef struct ft_poller ft_poller_t;
+
+ft_poller_t* platform_poller_create(void);
+void platform_poller_destroy(ft_poller_t *poller);
+int platform_poller_add(ft_poller_t *poller, socket_t sock, uint32_t events, void *context);
+int platform_poller_modify(ft_poller_t *poller, socket_t sock, uint32_t events, void *context);
+void platform_poller_remove(ft_poller_t *poller, socket_t sock);
+
+/* Wait up to timeout_ms (-1 = forever) for ready sockets. Returns the number
+ * of events stored, 0 on timeout, wakeup or signal, -1 on error. */
+int platform_poller_wait(ft_poller_t *poller, ft_poll_event_t *events, int max_events, int timeout_ms);
+
+/* Make a concurrent platform_poller_wait() return; callable from any thread */
+void platform_poller_wake(ft_poller_t *poller);
+
+/* Name of the poller backend ("epoll", "kqueue", "WSAPoll" or "poll") */
+const char* platform_poller_backend(void);
+
 /* Network byte order conversion (these are standard but included for completeness) */
 #ifndef htonll
 #define htonll(x) ((1==htonl(1)) ? (x) : \
@@ -105,6 +194,41 @@ uint64_t platform_get_monotonic_ms(void);
     ((uint64_t)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
 #endif
 
+/* Big-endian loads and stores at any byte offset. Variable-length v2 headers
+ * leave wire fields unaligned, so these go through memcpy rather than a cast. */
+static inline uint16_t load_be16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static inline uint64_t load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohll(v);
+}
+
+static inline void store_be16(uint8_t *p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_be64(uint8_t *p, uint64_t v) {
+    v = htonll(v);
+    memcpy(p, &v, sizeof(v));
+}
+
 /* Error code retrieval and formatting */
 const char* platform_get_socket_error(int error_code);
 const char* platform_get_last_error(void);
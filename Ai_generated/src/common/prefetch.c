@@ -0,0 +1,271 @@
+#include "prefetch.h"
+#include "fileio.h"
+#include "checksum.h"
+#include "logger.h"
+#include "bufpool.h"
+#include "zeroscan.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Exponentially weighted moving average (1/8 weight for new samples) */
+static uint64_t smooth(uint64_t average, uint64_t sample) {
+    return (average == 0) ? sample : (average * 7 + sample) / 8;
+}
+
+/* Compress one chunk */
+static void pack_job_run(void *arg) {
+    PackJob *job = (PackJob*)arg;
+    job->packed_size = compressor_pack(job->compressor, job->entry->data, job->entry->header.chunk_size,
+                                       job->packed);
+    wait_group_done(&job->entry->pending);
+}
+
+/* Reader loop: fill ring entries in chunk order */
+static void prefetch_thread(void *arg) {
+    Prefetcher *pf = (Prefetcher*)arg;
+    FTErrorCode error = FT_SUCCESS;
+
+    platform_mutex_lock(&pf->stats_lock);
+    uint32_t depth = pf->depth;
+    platform_mutex_unlock(&pf->stats_lock);
+    file_advise_willneed(pf->file, pf->first_chunk * pf->chunk_size, (size_t)depth * pf->chunk_size);
+
+    for (uint64_t chunk_id = pf->first_chunk; chunk_id < pf->end_chunk; chunk_id++) {
+        RingEntry *entry = chunk_ring_acquire(&pf->ring);
+        if (entry == NULL) {
+            return;
+        }
+
+        uint64_t offset = chunk_id * pf->chunk_size;
+        size_t size = pf->chunk_size;
+        if (offset + size > pf->file_size) {
+            size = (size_t)(pf->file_size - offset);
+        }
+
+        /* Start the OS on the chunk that is `depth` ahead of this one */
+        uint64_t ahead = offset + (uint64_t)depth * pf->chunk_size;
+        if (ahead < pf->end_chunk * pf->chunk_size && ahead < pf->file_size) {
+            file_advise_willneed(pf->file, ahead, pf->chunk_size);
+        }
+
+        /* A chunk in a hole is not read at all */
+        int zero = pf->sparse && file_extents_hole(&pf->extents, offset, size);
+        uint64_t elapsed_us = 0;
+        if (!zero) {
+            uint64_t start_ns = platform_get_monotonic_ns();
+            size_t bytes_read;
+            if (file_read_chunk(pf->file, offset, entry->data, size, &bytes_read, &error) != 0) {
+                chunk_ring_fail(&pf->ring, error);
+                return;
+            }
+            if (bytes_read != size) {
+                LOG_ERROR("File shrank while reading chunk %llu", (unsigned long long)chunk_id);
+                chunk_ring_fail(&pf->ring, FT_ERR_FILE_READ);
+                return;
+            }
+            uint64_t elapsed_ns = platform_get_monotonic_ns() - start_ns;
+            elapsed_us = elapsed_ns / 1000;
+            metrics_record(pf->metrics, FT_PHASE_READ, elapsed_ns);
+            zero = pf->sparse && zero_check(entry->data, size);
+        }
+
+        entry->kind = zero ? RING_HOLE : RING_CHUNK;
+        entry->header.chunk_id = chunk_id;
+        entry->header.chunk_offset = offset;
+        entry->header.chunk_size = (uint32_t)size;
+        entry->header.chunk_crc32 = 0;
+        if (!zero) {
+            uint64_t start_ns = platform_get_monotonic_ns();
+            entry->header.chunk_crc32 = crc32_compute(entry->data, size);
+            metrics_record_since(pf->metrics, FT_PHASE_CHECKSUM, start_ns);
+        }
+
+        /* The consumer waits for the job before taking the entry */
+        if (pf->compress.compressor != NULL) {
+            PackJob *job = &pf->jobs[entry - pf->ring.entries];
+            uint64_t index = chunk_id - pf->first_chunk;
+            job->entry = entry;
+            job->packed_size = 0;
+            if (job->packed == NULL && !zero) {
+                /* Without a free buffer the chunk is simply sent raw */
+                job->packed = buffer_pool_try_acquire(pf->chunk_size, NULL);
+            }
+            if (job->packed != NULL && !zero &&
+                (pf->compress.skip == NULL || (pf->compress.skip[index / 8] & (1u << (index % 8))) == 0) &&
+                compressor_admit(pf->compress.compressor)) {
+                wait_group_add(&entry->pending, 1);
+                if (threadpool_submit(pf->compress.pool, pack_job_run, job) != 0) {
+                    wait_group_done(&entry->pending);
+                    chunk_ring_fail(&pf->ring, FT_ERR_OUT_OF_MEMORY);
+                    return;
+                }
+            }
+        }
+
+        platform_mutex_lock(&pf->stats_lock);
+        if (!zero) {
+            pf->read_us = smooth(pf->read_us, elapsed_us);
+        }
+        depth = pf->depth;
+        platform_mutex_unlock(&pf->stats_lock);
+
+        chunk_ring_publish(&pf->ring);
+    }
+
+    chunk_ring_close(&pf->ring);
+}
+
+/* Free compression buffers */
+static void free_jobs(Prefetcher *pf) {
+    for (uint32_t i = 0; pf->jobs != NULL && i < pf->ring.capacity; i++) {
+        buffer_pool_release(pf->jobs[i].packed);
+    }
+    free(pf->jobs);
+    pf->jobs = NULL;
+}
+
+/* Start read-ahead */
+int prefetch_start(Prefetcher *pf, const char *filepath, uint64_t file_size, uint32_t chunk_size,
+                   uint64_t first_chunk, uint64_t end_chunk, uint32_t max_depth, int sparse,
+                   const PrefetchCompress *compress, TransferMetrics *metrics, FTErrorCode *error) {
+    memset(pf, 0, sizeof(Prefetcher));
+    pf->sparse = sparse;
+    pf->metrics = metrics;
+    pf->file_size = file_size;
+    pf->chunk_size = chunk_size;
+    pf->first_chunk = first_chunk;
+    pf->end_chunk = end_chunk;
+    uint64_t range_chunks = end_chunk - first_chunk;
+
+    if (max_depth < FT_PREFETCH_MIN_DEPTH) {
+        max_depth = FT_PREFETCH_MIN_DEPTH;
+    }
+    if (range_chunks > 0 && max_depth > range_chunks) {
+        max_depth = (uint32_t)range_chunks;
+    }
+
+    pf->file = file_open_read(filepath, error);
+    if (pf->file == NULL) {
+        return -1;
+    }
+    file_extents_init(&pf->extents, pf->file, file_size);
+
+    if (chunk_ring_init(&pf->ring, max_depth, chunk_size) != FT_SUCCESS) {
+        LOG_ERROR("Failed to allocate read-ahead buffers");
+        fclose(pf->file);
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    if (compress != NULL && compress->compressor != NULL) {
+        pf->compress = *compress;
+        pf->jobs = (PackJob*)calloc(pf->ring.capacity, sizeof(PackJob));
+        if (pf->jobs == NULL) {
+            LOG_ERROR("Failed to allocate compression buffers");
+            chunk_ring_destroy(&pf->ring);
+            fclose(pf->file);
+            if (error) *error = FT_ERR_OUT_OF_MEMORY;
+            return -1;
+        }
+        for (uint32_t i = 0; i < pf->ring.capacity; i++) {
+            pf->jobs[i].compressor = compress->compressor;
+        }
+    }
+
+    /* Start shallow; prefetch_next() deepens it if reads are slow */
+    pf->depth = FT_PREFETCH_MIN_DEPTH < pf->ring.capacity ? FT_PREFETCH_MIN_DEPTH : pf->ring.capacity;
+    chunk_ring_set_limit(&pf->ring, pf->depth);
+    platform_mutex_init(&pf->stats_lock);
+
+    if (platform_thread_create(&pf->thread, prefetch_thread, pf) != 0) {
+        LOG_ERROR("Failed to start read-ahead thread");
+        platform_mutex_destroy(&pf->stats_lock);
+        free_jobs(pf);
+        chunk_ring_destroy(&pf->ring);
+        fclose(pf->file);
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+    pf->running = 1;
+
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Take next chunk */
+int prefetch_next(Prefetcher *pf, uint8_t **buffer, uint8_t **packed, size_t *packed_size,
+                  ChunkHeader *chunk_hdr, int *zero, FTErrorCode *error) {
+    RingEntry *entry = NULL;
+    uint64_t wait_start_us = platform_get_monotonic_us();
+    if (chunk_ring_peek(&pf->ring, FT_RING_WAIT_FOREVER, &entry) != 1) {
+        if (error) *error = pf->ring.failed ? pf->ring.error : FT_ERR_FILE_READ;
+        return -1;
+    }
+
+    if (pf->jobs != NULL) {
+        wait_group_wait(&entry->pending);
+    }
+    buffer_pool_release(*buffer);
+    *buffer = entry->data;
+    entry->data = NULL;
+    *chunk_hdr = entry->header;
+    *zero = (entry->kind == RING_HOLE);
+    if (pf->jobs != NULL) {
+        PackJob *job = &pf->jobs[entry - pf->ring.entries];
+        *packed_size = job->packed_size;
+        if (job->packed_size > 0) {
+            buffer_pool_release(*packed);
+            *packed = job->packed;
+            job->packed = NULL;
+        }
+    }
+    chunk_ring_consume(&pf->ring);
+
+    /* Keep enough reads in flight to cover the sender's own time per
+     * chunk (excluding time spent waiting here), with a factor of two
+     * for jitter */
+    uint64_t now_us = platform_get_monotonic_us();
+    platform_mutex_lock(&pf->stats_lock);
+    if (pf->last_take_us != 0) {
+        uint64_t busy_us = wait_start_us - pf->last_take_us;
+        pf->take_us = smooth(pf->take_us, busy_us > 0 ? busy_us : 1);
+    }
+    pf->last_take_us = now_us;
+    uint64_t take_us = pf->take_us > 0 ? pf->take_us : 1;
+    uint64_t wanted = 2 * ((pf->read_us + take_us - 1) / take_us);
+    uint32_t depth = wanted < FT_PREFETCH_MIN_DEPTH ? FT_PREFETCH_MIN_DEPTH :
+                     wanted > pf->ring.capacity ? pf->ring.capacity : (uint32_t)wanted;
+    int changed = (depth != pf->depth);
+    pf->depth = depth;
+    platform_mutex_unlock(&pf->stats_lock);
+
+    if (changed) {
+        chunk_ring_set_limit(&pf->ring, depth);
+    }
+
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Stop read-ahead */
+void prefetch_stop(Prefetcher *pf) {
+    if (!pf->running) {
+        return;
+    }
+
+    chunk_ring_fail(&pf->ring, FT_SUCCESS);
+    platform_thread_join(pf->thread);
+    pf->running = 0;
+    for (uint32_t i = 0; i < pf->ring.capacity; i++) {
+        wait_group_wait(&pf->ring.entries[i].pending);
+    }
+
+    LOG_DEBUG("Read-ahead: depth %u, %llu us per read, %llu us per send",
+              pf->depth, (unsigned long long)pf->read_us, (unsigned long long)pf->take_us);
+
+    platform_mutex_destroy(&pf->stats_lock);
+    free_jobs(pf);
+    chunk_ring_destroy(&pf->ring);
+    fclose(pf->file);
+    pf->file = NULL;
+}
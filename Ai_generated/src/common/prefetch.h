@@ -0,0 +1,82 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+#include "chunkring.h"
+#include "threadpool.h"
+#include "compress.h"
+#include "metrics.h"
+#include "fileio.h"
+
+#define FT_DEFAULT_PREFETCH_CHUNKS 32    /* Upper bound on read-ahead depth */
+#define FT_PREFETCH_MIN_DEPTH      2
+
+/* Compression of read-ahead chunks on a worker pool */
+typedef struct {
+    Compressor    *compressor;
+    ThreadPool    *pool;
+    const uint8_t *skip;        /* Bit i: chunk first_chunk + i is not sent, so not compressed (optional) */
+} PrefetchCompress;
+
+/* Compression task for one ring entry */
+typedef struct {
+    Compressor *compressor;
+    RingEntry  *entry;
+    uint8_t    *packed;         /* chunk_size bytes from the buffer pool, taken when needed */
+    size_t      packed_size;    /* 0: send the chunk raw */
+} PackJob;
+
+/*
+ * Read-ahead stage for the sender. A reader thread reads chunks in order
+ * into a ring ahead of the send cursor and asks the OS to start on the
+ * chunks after them. How far ahead it runs follows the ratio of chunk read
+ * time to the sender's own time per chunk, so slow storage gets more reads
+ * in flight and a fast one does not waste memory. With compression, each
+ * chunk read is handed to a worker and taken once it has been compressed,
+ * so the workers stay as far ahead of the sender as the reads do.
+ */
+typedef struct {
+    ChunkRing   ring;
+    PrefetchCompress compress;  /* compressor NULL: chunks are sent raw */
+    PackJob    *jobs;           /* One per ring entry */
+    FILE       *file;           /* Own handle: TransmitFile moves the sender's file pointer */
+    uint64_t    file_size;
+    uint32_t    chunk_size;
+    uint64_t    first_chunk;    /* Chunks [first_chunk, end_chunk) are read */
+    uint64_t    end_chunk;
+    int         sparse;         /* Holes are not read, and zero chunks not checksummed */
+    FileExtents extents;
+    ft_thread_t thread;
+    int         running;
+    ft_mutex_t  stats_lock;
+    uint32_t    depth;          /* Current read-ahead target in chunks */
+    uint64_t    read_us;        /* Smoothed time to read one chunk */
+    uint64_t    take_us;        /* Smoothed sender time per chunk, not counting waits for data */
+    uint64_t    last_take_us;   /* When the sender last took a chunk */
+    TransferMetrics *metrics;   /* Read and checksum times are recorded here (optional) */
+} Prefetcher;
+
+/* Open filepath and start reading chunks [first_chunk, end_chunk) ahead,
+ * at most max_depth chunks; with sparse, chunks in holes or all zeros are
+ * only marked so. compress and metrics may be NULL. */
+int prefetch_start(Prefetcher *pf, const char *filepath, uint64_t file_size, uint32_t chunk_size,
+                   uint64_t first_chunk, uint64_t end_chunk, uint32_t max_depth, int sparse,
+                   const PrefetchCompress *compress, TransferMetrics *metrics, FTErrorCode *error);
+
+/* Take the next chunk in file order. Its buffer pool buffer is handed over
+ * in *buffer, releasing the one there (if any); chunk_hdr receives its
+ * position, size and CRC32. With compression, *packed_size is set to the
+ * size of its LZ4 block, which replaces *packed the same way, or to 0 if
+ * the chunk goes out raw (*packed is then left alone). *zero is set if
+ * the chunk is all zeros; its buffer then holds nothing and its CRC32 is 0. */
+int prefetch_next(Prefetcher *pf, uint8_t **buffer, uint8_t **packed, size_t *packed_size,
+                  ChunkHeader *chunk_hdr, int *zero, FTErrorCode *error);
+
+/* Stop the reader and free buffers */
+void prefetch_stop(Prefetcher *pf);
+
+#endif /* PREFETCH_H */
@@ -9,7 +9,7 @@ void protocol_init_header(MessageHeader *header, MessageType msg_type,
                          uint64_t sequence_num, uint64_t payload_size) {
     memset(header, 0, sizeof(MessageHeader));
     header->magic = FT_MAGIC_NUMBER;
-    header->version = FT_PROTOCOL_VERSION;
+    header->version = FT_PROTOCOL_V1;       /* The v1 framing's; v2 headers have no version field */
     header->msg_type = (uint8_t)msg_type;
     header->flags = 0;
     header->sequence_num = sequence_num;
@@ -20,38 +20,30 @@ void protocol_init_header(MessageHeader *header, MessageType msg_type,
 
 /* Serialize header to network byte order */
 void protocol_serialize_header(const MessageHeader *header, uint8_t *buffer) {
-    uint32_t *buf32 = (uint32_t*)buffer;
-    uint16_t *buf16 = (uint16_t*)buffer;
-    uint64_t *buf64 = (uint64_t*)buffer;
-
     /* Layout: magic(4) version(1) msg_type(1) flags(2) seq(8) payload(8) checksum(4) reserved(4) */
-    buf32[0] = htonl(header->magic);                    /* offset 0 */
+    store_be32(buffer, header->magic);                   /* offset 0 */
     buffer[4] = header->version;                         /* offset 4 */
     buffer[5] = header->msg_type;                        /* offset 5 */
-    buf16[3] = htons(header->flags);                    /* offset 6 */
-    buf64[1] = htonll(header->sequence_num);            /* offset 8 */
-    buf64[2] = htonll(header->payload_size);            /* offset 16 */
+    store_be16(buffer + 6, header->flags);               /* offset 6 */
+    store_be64(buffer + 8, header->sequence_num);        /* offset 8 */
+    store_be64(buffer + 16, header->payload_size);       /* offset 16 */
 
     /* Compute checksum of first 24 bytes */
     uint32_t checksum = crc32_compute(buffer, 24);
-    buf32[6] = htonl(checksum);                         /* offset 24 */
-    buf32[7] = htonl(header->reserved);                 /* offset 28 */
+    store_be32(buffer + 24, checksum);                   /* offset 24 */
+    store_be32(buffer + 28, header->reserved);           /* offset 28 */
 }
 
 /* Deserialize header from network byte order */
 int protocol_deserialize_header(const uint8_t *buffer, MessageHeader *header) {
-    const uint32_t *buf32 = (const uint32_t*)buffer;
-    const uint16_t *buf16 = (const uint16_t*)buffer;
-    const uint64_t *buf64 = (const uint64_t*)buffer;
-
-    header->magic = ntohl(buf32[0]);
+    header->magic = load_be32(buffer);
     header->version = buffer[4];
     header->msg_type = buffer[5];
-    header->flags = ntohs(buf16[3]);
-    header->sequence_num = ntohll(buf64[1]);
-    header->payload_size = ntohll(buf64[2]);
-    header->checksum = ntohl(buf32[6]);
-    header->reserved = ntohl(buf32[7]);
+    header->flags = load_be16(buffer + 6);
+    header->sequence_num = load_be64(buffer + 8);
+    header->payload_size = load_be64(buffer + 16);
+    header->checksum = load_be32(buffer + 24);
+    header->reserved = load_be32(buffer + 28);
 
     return 0;
 }
@@ -64,13 +56,13 @@ int protocol_validate_header(const MessageHeader *header) {
     }
 
     /* Check version */
-    if (header->version != FT_PROTOCOL_VERSION) {
+    if (header->version != FT_PROTOCOL_V1 && header->version != FT_PROTOCOL_V2) {
         return FT_ERR_VERSION;
     }
 
     /* Check message type */
     if (header->msg_type < MSG_HANDSHAKE_REQ ||
-        (header->msg_type > MSG_VERIFY_RESPONSE && header->msg_type != MSG_ERROR)) {
+        (header->msg_type > MSG_KEEPALIVE && header->msg_type != MSG_ERROR)) {
         return FT_ERR_INVALID_MSG;
     }
 
@@ -84,34 +76,114 @@ uint32_t protocol_compute_header_checksum(const MessageHeader *header) {
     return crc32_compute(buffer, 24);
 }
 
+/* Append LEB128 varint; returns number of bytes written (at most 10) */
+static size_t put_varint(uint8_t *buffer, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+/* Read LEB128 varint at *offset, stopping at size. At most 10 bytes; the
+ * 10th holds only bit 63, so anything above 0x01 there overflows. */
+static int get_varint(const uint8_t *buffer, size_t size, size_t *offset, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *offset < size; shift += 7) {
+        uint8_t byte = buffer[(*offset)++];
+        if (shift == 63 && byte > 0x01) {
+            return -1;
+        }
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Serialize v2 header */
+size_t protocol_serialize_header_v2(const MessageHeader *header, uint8_t *buffer) {
+    size_t length = 2;
+
+    /* Layout: length(1) msg_type(1) flags seq payload_size [crc32(4)] */
+    buffer[1] = header->msg_type;
+    length += put_varint(buffer + length, header->flags);
+    length += put_varint(buffer + length, header->sequence_num);
+    length += put_varint(buffer + length, header->payload_size);
+    if (header->flags & FT_FLAG_HEADER_CRC) {
+        buffer[0] = (uint8_t)(length + 4);
+        uint32_t checksum = htonl(crc32_compute(buffer, length));
+        memcpy(buffer + length, &checksum, 4);
+        length += 4;
+    } else {
+        buffer[0] = (uint8_t)length;
+    }
+    return length;
+}
+
+/* Deserialize v2 header */
+int protocol_deserialize_header_v2(const uint8_t *buffer, MessageHeader *header) {
+    size_t size = buffer[0];
+    size_t offset = 2;
+    uint64_t flags, sequence_num, payload_size;
+
+    memset(header, 0, sizeof(MessageHeader));
+    if (size < FT_HEADER_V2_MIN || size > FT_HEADER_SIZE ||
+        get_varint(buffer, size, &offset, &flags) != 0 || flags > UINT16_MAX ||
+        get_varint(buffer, size, &offset, &sequence_num) != 0 ||
+        get_varint(buffer, size, &offset, &payload_size) != 0) {
+        return FT_ERR_PROTOCOL;
+    }
+    header->magic = FT_MAGIC_NUMBER;
+    header->version = FT_PROTOCOL_V2;
+    header->msg_type = buffer[1];
+    header->flags = (uint16_t)flags;
+    header->sequence_num = sequence_num;
+    header->payload_size = payload_size;
+
+    if (header->flags & FT_FLAG_HEADER_CRC) {
+        if (offset + 4 != size) {
+            return FT_ERR_PROTOCOL;
+        }
+        uint32_t checksum;
+        memcpy(&checksum, buffer + offset, 4);
+        header->checksum = ntohl(checksum);
+        if (crc32_compute(buffer, offset) != header->checksum) {
+            return FT_ERR_CHECKSUM;
+        }
+    } else if (offset != size) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
 /* Serialize file info */
 void protocol_serialize_file_info(const FileInfo *file_info, uint8_t *buffer) {
-    uint16_t *buf16 = (uint16_t*)buffer;
-    uint32_t *buf32;
-    uint64_t *buf64;
     size_t offset = 0;
 
     /* filename_len (2 bytes) */
-    buf16[0] = htons(file_info->filename_len);
+    store_be16(buffer, file_info->filename_len);
     offset += 2;
 
-    /* filename (256 bytes) */
+    /* filename (256 bytes; longer names need v2) */
     memcpy(buffer + offset, file_info->filename, FT_MAX_FILENAME_LEN);
+    buffer[offset + FT_MAX_FILENAME_LEN - 1] = '\0';
     offset += FT_MAX_FILENAME_LEN;
 
     /* file_size (8 bytes) */
-    buf64 = (uint64_t*)(buffer + offset);
-    *buf64 = htonll(file_info->file_size);
+    store_be64(buffer + offset, file_info->file_size);
     offset += 8;
 
     /* total_chunks (8 bytes) */
-    buf64 = (uint64_t*)(buffer + offset);
-    *buf64 = htonll(file_info->total_chunks);
+    store_be64(buffer + offset, file_info->total_chunks);
     offset += 8;
 
     /* chunk_size (4 bytes) */
-    buf32 = (uint32_t*)(buffer + offset);
-    *buf32 = htonl(file_info->chunk_size);
+    store_be32(buffer + offset, file_info->chunk_size);
     offset += 4;
 
     /* checksum_type (1 byte) */
@@ -122,28 +194,39 @@ void protocol_serialize_file_info(const FileInfo *file_info, uint8_t *buffer) {
     offset += FT_SHA256_SIZE;
 
     /* file_mode (4 bytes) */
-    buf32 = (uint32_t*)(buffer + offset);
-    *buf32 = htonl(file_info->file_mode);
+    store_be32(buffer + offset, file_info->file_mode);
     offset += 4;
 
     /* timestamp (8 bytes) */
-    buf64 = (uint64_t*)(buffer + offset);
-    *buf64 = htonll(file_info->timestamp);
+    store_be64(buffer + offset, file_info->timestamp);
+    offset += 8;
+
+    /* transfer_id (8 bytes) */
+    store_be64(buffer + offset, file_info->transfer_id);
     offset += 8;
 
-    /* reserved (669 bytes) */
-    memset(buffer + offset, 0, 669);
+    /* stripe_index, stripe_count (2 bytes each) */
+    store_be16(buffer + offset, file_info->stripe_index);
+    store_be16(buffer + offset + 2, file_info->stripe_count);
+    offset += 4;
+
+    /* flags (1 byte), bundle_entries (4 bytes) */
+    buffer[offset++] = file_info->flags;
+    store_be32(buffer + offset, file_info->bundle_entries);
+    offset += 4;
+
+    /* reserved (652 bytes) */
+    memset(buffer + offset, 0, FT_FILE_INFO_SIZE - offset);
 }
 
 /* Deserialize file info */
 int protocol_deserialize_file_info(const uint8_t *buffer, FileInfo *file_info) {
-    const uint16_t *buf16 = (const uint16_t*)buffer;
-    const uint32_t *buf32;
-    const uint64_t *buf64;
     size_t offset = 0;
 
+    memset(file_info, 0, sizeof(FileInfo));
+
     /* filename_len */
-    file_info->filename_len = ntohs(buf16[0]);
+    file_info->filename_len = load_be16(buffer);
     offset += 2;
 
     /* filename */
@@ -152,18 +235,15 @@ int protocol_deserialize_file_info(const uint8_t *buffer, FileInfo *file_info) {
     offset += FT_MAX_FILENAME_LEN;
 
     /* file_size */
-    buf64 = (const uint64_t*)(buffer + offset);
-    file_info->file_size = ntohll(*buf64);
+    file_info->file_size = load_be64(buffer + offset);
     offset += 8;
 
     /* total_chunks */
-    buf64 = (const uint64_t*)(buffer + offset);
-    file_info->total_chunks = ntohll(*buf64);
+    file_info->total_chunks = load_be64(buffer + offset);
     offset += 8;
 
     /* chunk_size */
-    buf32 = (const uint32_t*)(buffer + offset);
-    file_info->chunk_size = ntohl(*buf32);
+    file_info->chunk_size = load_be32(buffer + offset);
     offset += 4;
 
     /* checksum_type */
@@ -174,60 +254,478 @@ int protocol_deserialize_file_info(const uint8_t *buffer, FileInfo *file_info) {
     offset += FT_SHA256_SIZE;
 
     /* file_mode */
-    buf32 = (const uint32_t*)(buffer + offset);
-    file_info->file_mode = ntohl(*buf32);
+    file_info->file_mode = load_be32(buffer + offset);
     offset += 4;
 
     /* timestamp */
-    buf64 = (const uint64_t*)(buffer + offset);
-    file_info->timestamp = ntohll(*buf64);
+    file_info->timestamp = load_be64(buffer + offset);
     offset += 8;
 
+    /* transfer_id */
+    file_info->transfer_id = load_be64(buffer + offset);
+    offset += 8;
+
+    /* stripe_index, stripe_count */
+    file_info->stripe_index = load_be16(buffer + offset);
+    file_info->stripe_count = load_be16(buffer + offset + 2);
+    offset += 4;
+
+    /* flags, bundle_entries */
+    file_info->flags = buffer[offset++];
+    file_info->bundle_entries = load_be32(buffer + offset);
+    offset += 4;
+
     /* reserved bytes ignored */
 
     return 0;
 }
 
+/* Append a FILE_INFO field holding raw bytes */
+static size_t put_field(uint8_t *buffer, uint8_t tag, const void *value, size_t size) {
+    size_t length = put_varint(buffer, tag);
+    length += put_varint(buffer + length, size);
+    memcpy(buffer + length, value, size);
+    return length + size;
+}
+
+/* Append a FILE_INFO field holding up to three varints (at most 30 bytes,
+ * so the length is a single byte) */
+static size_t put_number_field(uint8_t *buffer, uint8_t tag, int count, uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t numbers[3] = { a, b, c };
+    size_t length = put_varint(buffer, tag) + 1;
+    size_t start = length;
+
+    for (int i = 0; i < count; i++) {
+        length += put_varint(buffer + length, numbers[i]);
+    }
+    buffer[start - 1] = (uint8_t)(length - start);
+    return length;
+}
+
+/* Serialize file info (v2) */
+size_t protocol_serialize_file_info_v2(const FileInfo *file_info, uint8_t *buffer) {
+    size_t offset = 0;
+    uint8_t checksum[1 + FT_SHA256_SIZE];
+
+    /* Fields that are zero are left out */
+    offset += put_field(buffer + offset, FT_INFO_NAME, file_info->filename,
+                        strnlen(file_info->filename, FT_MAX_PATH_LEN - 1));
+    offset += put_number_field(buffer + offset, FT_INFO_SIZE, 1, file_info->file_size, 0, 0);
+    offset += put_number_field(buffer + offset, FT_INFO_CHUNKS, 1, file_info->total_chunks, 0, 0);
+    offset += put_number_field(buffer + offset, FT_INFO_CHUNK_SIZE, 1, file_info->chunk_size, 0, 0);
+
+    checksum[0] = file_info->checksum_type;
+    memcpy(checksum + 1, file_info->file_checksum, FT_SHA256_SIZE);
+    offset += put_field(buffer + offset, FT_INFO_CHECKSUM, checksum, sizeof(checksum));
+
+    if (file_info->file_mode != 0) {
+        offset += put_number_field(buffer + offset, FT_INFO_MODE, 1, file_info->file_mode, 0, 0);
+    }
+    if (file_info->timestamp != 0) {
+        offset += put_number_field(buffer + offset, FT_INFO_TIMESTAMP, 1, file_info->timestamp, 0, 0);
+    }
+    if (file_info->transfer_id != 0 || file_info->stripe_count != 0) {
+        offset += put_number_field(buffer + offset, FT_INFO_STRIPE, 3, file_info->transfer_id,
+                                   file_info->stripe_index, file_info->stripe_count);
+    }
+    if (file_info->flags != 0) {
+        offset += put_number_field(buffer + offset, FT_INFO_FLAGS, 1, file_info->flags, 0, 0);
+    }
+    if (file_info->bundle_entries != 0) {
+        offset += put_number_field(buffer + offset, FT_INFO_BUNDLE, 1, file_info->bundle_entries, 0, 0);
+    }
+    return offset;
+}
+
+/* Read the varints of a FILE_INFO field; all of value must be used */
+static int get_number_field(const uint8_t *value, size_t size, int count, uint64_t *numbers, uint64_t max) {
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        if (get_varint(value, size, &offset, &numbers[i]) != 0 || numbers[i] > max) {
+            return -1;
+        }
+    }
+    return offset == size ? 0 : -1;
+}
+
+/* Deserialize file info (v2) */
+int protocol_deserialize_file_info_v2(const uint8_t *buffer, size_t size, FileInfo *file_info) {
+    size_t offset = 0;
+    int named = 0;
+
+    memset(file_info, 0, sizeof(FileInfo));
+    while (offset < size) {
+        uint64_t tag, length, numbers[3] = { 0, 0, 0 };
+        if (get_varint(buffer, size, &offset, &tag) != 0 ||
+            get_varint(buffer, size, &offset, &length) != 0 || length > size - offset) {
+            return -1;
+        }
+        const uint8_t *value = buffer + offset;
+        int result = 0;
+        offset += (size_t)length;
+
+        switch (tag) {
+        case FT_INFO_NAME:
+            if (length >= FT_MAX_PATH_LEN || memchr(value, '\0', (size_t)length) != NULL) {
+                return -1;
+            }
+            memcpy(file_info->filename, value, (size_t)length);
+            file_info->filename[length] = '\0';
+            file_info->filename_len = (uint16_t)length;
+            named = 1;
+            break;
+        case FT_INFO_SIZE:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT64_MAX);
+            file_info->file_size = numbers[0];
+            break;
+        case FT_INFO_CHUNKS:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT64_MAX);
+            file_info->total_chunks = numbers[0];
+            break;
+        case FT_INFO_CHUNK_SIZE:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT32_MAX);
+            file_info->chunk_size = (uint32_t)numbers[0];
+            break;
+        case FT_INFO_CHECKSUM:
+            /* Digests shorter than the field are zero-padded */
+            if (length < 1 || length > 1 + FT_SHA256_SIZE) {
+                return -1;
+            }
+            file_info->checksum_type = value[0];
+            memcpy(file_info->file_checksum, value + 1, (size_t)length - 1);
+            break;
+        case FT_INFO_MODE:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT32_MAX);
+            file_info->file_mode = (uint32_t)numbers[0];
+            break;
+        case FT_INFO_TIMESTAMP:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT64_MAX);
+            file_info->timestamp = numbers[0];
+            break;
+        case FT_INFO_STRIPE:
+            result = get_number_field(value, (size_t)length, 3, numbers, UINT64_MAX);
+            if (result == 0 && (numbers[1] > UINT16_MAX || numbers[2] > UINT16_MAX)) {
+                result = -1;
+            }
+            file_info->transfer_id = numbers[0];
+            file_info->stripe_index = (uint16_t)numbers[1];
+            file_info->stripe_count = (uint16_t)numbers[2];
+            break;
+        case FT_INFO_FLAGS:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT8_MAX);
+            file_info->flags = (uint8_t)numbers[0];
+            break;
+        case FT_INFO_BUNDLE:
+            result = get_number_field(value, (size_t)length, 1, numbers, UINT32_MAX);
+            file_info->bundle_entries = (uint32_t)numbers[0];
+            break;
+        default:
+            /* Added by a later version */
+            break;
+        }
+        if (result != 0) {
+            return -1;
+        }
+    }
+    return named ? 0 : -1;
+}
+
+/* Chunk range of a stripe */
+void protocol_stripe_range(uint64_t total_chunks, uint16_t stripe_count, uint16_t stripe_index,
+                           uint64_t *first_chunk, uint64_t *end_chunk) {
+    if (stripe_count <= 1) {
+        *first_chunk = 0;
+        *end_chunk = total_chunks;
+        return;
+    }
+    uint64_t base = total_chunks / stripe_count;
+    uint64_t extra = total_chunks % stripe_count;
+
+    /* The first `extra` stripes carry one chunk more */
+    *first_chunk = base * stripe_index + (stripe_index < extra ? stripe_index : extra);
+    *end_chunk = *first_chunk + base + (stripe_index < extra ? 1 : 0);
+}
+
+/* Serialize file ACK */
+void protocol_serialize_file_ack(const FileAck *ack, uint8_t *buffer) {
+    /* status (1), error_code (1), flags (1), reserved (1), resume_bits (4), resume_chunks (8) */
+    buffer[0] = ack->status;
+    buffer[1] = ack->error_code;
+    buffer[2] = ack->flags;
+    buffer[3] = 0;
+    store_be32(buffer + 4, ack->resume_bits);
+    store_be64(buffer + 8, ack->resume_chunks);
+}
+
+/* Deserialize file ACK */
+int protocol_deserialize_file_ack(const uint8_t *buffer, size_t size, FileAck *ack) {
+    memset(ack, 0, sizeof(FileAck));
+    if (size < FT_FILE_ACK_LEGACY_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    ack->status = buffer[0];
+    ack->error_code = buffer[1];
+    ack->flags = buffer[2];
+    if (size == FT_FILE_ACK_LEGACY_SIZE) {
+        return 0;
+    }
+
+    if (size < FT_FILE_ACK_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    ack->resume_bits = load_be32(buffer + 4);
+    ack->resume_chunks = load_be64(buffer + 8);
+    if (size != FT_FILE_ACK_HEADER_SIZE + ((size_t)ack->resume_bits + 7) / 8 ||
+        ack->resume_chunks > ack->resume_bits) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
 /* Serialize chunk header */
 void protocol_serialize_chunk_header(const ChunkHeader *chunk_hdr, uint8_t *buffer) {
-    uint64_t *buf64 = (uint64_t*)buffer;
-    uint32_t *buf32;
-
     /* chunk_id (8 bytes) */
-    buf64[0] = htonll(chunk_hdr->chunk_id);
+    store_be64(buffer, chunk_hdr->chunk_id);
 
     /* chunk_offset (8 bytes) */
-    buf64[1] = htonll(chunk_hdr->chunk_offset);
+    store_be64(buffer + 8, chunk_hdr->chunk_offset);
 
     /* chunk_size (4 bytes) */
-    buf32 = (uint32_t*)(buffer + 16);
-    buf32[0] = htonl(chunk_hdr->chunk_size);
+    store_be32(buffer + 16, chunk_hdr->chunk_size);
 
     /* chunk_crc32 (4 bytes) */
-    buf32[1] = htonl(chunk_hdr->chunk_crc32);
+    store_be32(buffer + 20, chunk_hdr->chunk_crc32);
 }
 
 /* Deserialize chunk header */
 int protocol_deserialize_chunk_header(const uint8_t *buffer, ChunkHeader *chunk_hdr) {
-    const uint64_t *buf64 = (const uint64_t*)buffer;
-    const uint32_t *buf32;
-
     /* chunk_id */
-    chunk_hdr->chunk_id = ntohll(buf64[0]);
+    chunk_hdr->chunk_id = load_be64(buffer);
 
     /* chunk_offset */
-    chunk_hdr->chunk_offset = ntohll(buf64[1]);
+    chunk_hdr->chunk_offset = load_be64(buffer + 8);
 
     /* chunk_size */
-    buf32 = (const uint32_t*)(buffer + 16);
-    chunk_hdr->chunk_size = ntohl(buf32[0]);
+    chunk_hdr->chunk_size = load_be32(buffer + 16);
 
     /* chunk_crc32 */
-    chunk_hdr->chunk_crc32 = ntohl(buf32[1]);
+    chunk_hdr->chunk_crc32 = load_be32(buffer + 20);
 
     return 0;
 }
 
+/* Serialize block signatures header */
+void protocol_serialize_block_signatures(const BlockSignatures *sigs, uint8_t *buffer) {
+    /* basis_size (8), block_count (8), first_block (8), block_size (4), count (4) */
+    store_be64(buffer, sigs->basis_size);
+    store_be64(buffer + 8, sigs->block_count);
+    store_be64(buffer + 16, sigs->first_block);
+    store_be32(buffer + 24, sigs->block_size);
+    store_be32(buffer + 28, sigs->count);
+}
+
+/* Deserialize block signatures header */
+int protocol_deserialize_block_signatures(const uint8_t *buffer, size_t size, BlockSignatures *sigs) {
+    if (size < FT_BLOCK_SIGS_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    sigs->basis_size = load_be64(buffer);
+    sigs->block_count = load_be64(buffer + 8);
+    sigs->first_block = load_be64(buffer + 16);
+    sigs->block_size = load_be32(buffer + 24);
+    sigs->count = load_be32(buffer + 28);
+
+    if (sigs->count > FT_BLOCK_SIGS_PER_MSG ||
+        size != FT_BLOCK_SIGS_HEADER_SIZE + (size_t)sigs->count * FT_BLOCK_SIG_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
+/* Serialize chunk hashes header */
+void protocol_serialize_chunk_hashes(const ChunkHashes *hashes, uint8_t *buffer) {
+    /* first_chunk (8), count (4), found (4) */
+    store_be64(buffer, hashes->first_chunk);
+    store_be32(buffer + 8, hashes->count);
+    store_be32(buffer + 12, hashes->found);
+}
+
+/* Read chunk hashes header fields */
+static int deserialize_chunk_hashes_header(const uint8_t *buffer, size_t size, ChunkHashes *hashes) {
+    if (size < FT_CHUNK_HASHES_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    hashes->first_chunk = load_be64(buffer);
+    hashes->count = load_be32(buffer + 8);
+    hashes->found = load_be32(buffer + 12);
+    return hashes->count <= FT_DEDUP_MAX_HASHES ? 0 : FT_ERR_PROTOCOL;
+}
+
+/* Deserialize chunk hashes header */
+int protocol_deserialize_chunk_hashes(const uint8_t *buffer, size_t size, ChunkHashes *hashes) {
+    if (deserialize_chunk_hashes_header(buffer, size, hashes) != 0 ||
+        size != FT_CHUNK_HASHES_HEADER_SIZE + (size_t)hashes->count * FT_SHA256_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
+/* Deserialize chunk have header */
+int protocol_deserialize_chunk_have(const uint8_t *buffer, size_t size, ChunkHashes *have) {
+    if (deserialize_chunk_hashes_header(buffer, size, have) != 0 || have->found > have->count ||
+        size != FT_CHUNK_HASHES_HEADER_SIZE + ((size_t)have->count + 7) / 8) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
+/* Serialize UDP setup */
+void protocol_serialize_udp_setup(const UdpSetup *setup, uint8_t *buffer) {
+    /* token (8), port (2), max_datagram (2), max_messages (4) */
+    store_be64(buffer, setup->token);
+    store_be16(buffer + 8, setup->port);
+    store_be16(buffer + 10, setup->max_datagram);
+    store_be32(buffer + 12, setup->max_messages);
+}
+
+/* Deserialize UDP setup */
+int protocol_deserialize_udp_setup(const uint8_t *buffer, size_t size, UdpSetup *setup) {
+    if (size != FT_UDP_SETUP_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    setup->token = load_be64(buffer);
+    setup->port = load_be16(buffer + 8);
+    setup->max_datagram = load_be16(buffer + 10);
+    setup->max_messages = load_be32(buffer + 12);
+    return setup->port != 0 && setup->max_messages != 0 ? 0 : FT_ERR_PROTOCOL;
+}
+
+/* Serialize chunk SACK */
+size_t protocol_serialize_chunk_sack(const ChunkSack *sack, uint8_t *buffer) {
+    size_t bitmap_bytes = (sack->bitmap_bits + 7) / 8;
+
+    /* cumulative (8 bytes), highest_seq (8 bytes) */
+    store_be64(buffer, sack->cumulative);
+    store_be64(buffer + 8, sack->highest_seq);
+
+    /* bitmap_bits (2 bytes), reserved (2 bytes) */
+    store_be16(buffer + 16, sack->bitmap_bits);
+    buffer[18] = 0;
+    buffer[19] = 0;
+
+    /* bitmap (variable) */
+    memcpy(buffer + FT_SACK_HEADER_SIZE, sack->bitmap, bitmap_bytes);
+    return FT_SACK_HEADER_SIZE + bitmap_bytes;
+}
+
+/* Deserialize chunk SACK */
+int protocol_deserialize_chunk_sack(const uint8_t *buffer, size_t size, ChunkSack *sack) {
+    if (size < FT_SACK_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    sack->cumulative = load_be64(buffer);
+    sack->highest_seq = load_be64(buffer + 8);
+    sack->bitmap_bits = load_be16(buffer + 16);
+
+    size_t bitmap_bytes = (sack->bitmap_bits + 7) / 8;
+    if (sack->bitmap_bits > FT_SACK_MAX_BITS || size != FT_SACK_HEADER_SIZE + bitmap_bytes) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    memset(sack->bitmap, 0, sizeof(sack->bitmap));
+    memcpy(sack->bitmap, buffer + FT_SACK_HEADER_SIZE, bitmap_bytes);
+    return 0;
+}
+
+/* Serialize transfer complete */
+void protocol_serialize_transfer_complete(const TransferComplete *complete, uint8_t *buffer) {
+    store_be64(buffer, complete->total_chunks);
+    store_be64(buffer + 8, complete->total_bytes);
+}
+
+/* Deserialize transfer complete */
+int protocol_deserialize_transfer_complete(const uint8_t *buffer, size_t size, TransferComplete *complete) {
+    if (size != FT_TRANSFER_COMPLETE_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    complete->total_chunks = load_be64(buffer);
+    complete->total_bytes = load_be64(buffer + 8);
+    return 0;
+}
+
+/* Serialize verify request header */
+void protocol_serialize_verify_request(const VerifyRequest *request, uint8_t *buffer) {
+    /* checksum_type (1), mode (1), reserved (2) */
+    buffer[0] = request->checksum_type;
+    buffer[1] = request->mode;
+    buffer[2] = 0;
+    buffer[3] = 0;
+
+    /* digest_count (4 bytes), first_leaf (8 bytes) */
+    store_be32(buffer + 4, request->digest_count);
+    store_be64(buffer + 8, request->first_leaf);
+}
+
+/* Deserialize verify request header */
+int protocol_deserialize_verify_request(const uint8_t *buffer, size_t size, VerifyRequest *request) {
+    if (size < FT_VERIFY_REQUEST_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    request->checksum_type = buffer[0];
+    request->mode = buffer[1];
+    request->reserved = 0;
+    request->digest_count = load_be32(buffer + 4);
+    request->first_leaf = load_be64(buffer + 8);
+
+    if (request->digest_count > FT_VERIFY_MAX_DIGESTS ||
+        size != FT_VERIFY_REQUEST_HEADER_SIZE + (size_t)request->digest_count * FT_SHA256_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+    return 0;
+}
+
+/* Serialize verify response */
+size_t protocol_serialize_verify_response(const VerifyResponse *response, uint8_t *buffer) {
+    /* checksum_match (1), error_code (1), bad_listed (2), bad_count (8) */
+    buffer[0] = response->checksum_match;
+    buffer[1] = response->error_code;
+    store_be16(buffer + 2, response->bad_listed);
+    store_be64(buffer + 4, response->bad_count);
+
+    /* bad_chunks (8 bytes each) */
+    for (uint16_t i = 0; i < response->bad_listed; i++) {
+        store_be64(buffer + FT_VERIFY_RESPONSE_HEADER_SIZE + i * 8, response->bad_chunks[i]);
+    }
+    return FT_VERIFY_RESPONSE_HEADER_SIZE + (size_t)response->bad_listed * 8;
+}
+
+/* Deserialize verify response */
+int protocol_deserialize_verify_response(const uint8_t *buffer, size_t size, VerifyResponse *response) {
+    if (size < FT_VERIFY_RESPONSE_HEADER_SIZE) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    response->checksum_match = buffer[0];
+    response->error_code = buffer[1];
+    response->bad_listed = load_be16(buffer + 2);
+    response->bad_count = load_be64(buffer + 4);
+
+    if (response->bad_listed > FT_VERIFY_MAX_BAD_CHUNKS ||
+        size != FT_VERIFY_RESPONSE_HEADER_SIZE + (size_t)response->bad_listed * 8) {
+        return FT_ERR_PROTOCOL;
+    }
+
+    for (uint16_t i = 0; i < response->bad_listed; i++) {
+        response->bad_chunks[i] = load_be64(buffer + FT_VERIFY_RESPONSE_HEADER_SIZE + i * 8);
+    }
+    return 0;
+}
+
 /* Get error message string */
 const char* protocol_get_error_string(FTErrorCode error_code) {
     switch (error_code) {
@@ -254,6 +752,8 @@ const char* protocol_get_error_string(FTErrorCode error_code) {
         case FT_ERR_INVALID_ARG: return "Invalid argument";
         case FT_ERR_FILE_NOT_FOUND: return "File not found";
         case FT_ERR_FILENAME_TOO_LONG: return "Filename too long";
+        case FT_ERR_BUSY: return "Transfer already in progress";
+        case FT_ERR_TLS: return "TLS handshake failed";
         default: return "Unknown error";
     }
 }
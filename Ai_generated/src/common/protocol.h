@@ -5,19 +5,120 @@
 #include <stddef.h>
 
 /* Protocol constants */
-#define FT_PROTOCOL_VERSION    0x01
+#define FT_PROTOCOL_V1         0x01
+#define FT_PROTOCOL_V2         0x02
+#define FT_PROTOCOL_VERSION    FT_PROTOCOL_V2  /* Highest version spoken (see "Protocol versions") */
 #define FT_MAGIC_NUMBER        0x46544350  /* "FTCP" in hex */
 #define FT_DEFAULT_PORT        8080
 #define FT_DEFAULT_CHUNK_SIZE  524288      /* 512 KB */
-#define FT_MAX_FILENAME_LEN    256
+#define FT_MIN_CHUNK_SIZE      65536       /* Chunk size bounds (see HandshakePayload) */
+#define FT_MAX_CHUNK_SIZE      16777216
+#define FT_MAX_FILENAME_LEN    256         /* File name field of a v1 FILE_INFO */
+#define FT_MAX_PATH_LEN        1024        /* File names and relative paths (v2) */
 #define FT_MAX_RETRIES         3
 #define FT_TIMEOUT_SECONDS     60
-#define FT_KEEPALIVE_INTERVAL  30
+#define FT_KEEPALIVE_INTERVAL  30          /* Seconds an idle session waits before a KEEPALIVE */
 #define FT_BACKOFF_MAX_MS      16000
-#define FT_HEADER_SIZE         32
-#define FT_FILE_INFO_SIZE      1024
+#define FT_HEADER_SIZE         32          /* v1 header, and the most a v2 header takes */
+#define FT_HEADER_V2_MIN       5
+#define FT_FILE_INFO_SIZE      1024        /* v1 FILE_INFO payload */
+#define FT_FILE_INFO_MAX_SIZE  (FT_MAX_PATH_LEN + 256)  /* v2 FILE_INFO payload at most */
 #define FT_CHUNK_HEADER_SIZE   24
 #define FT_SHA256_SIZE         32
+#define FT_DEFAULT_WINDOW_SIZE 16          /* Unacknowledged chunks in flight before the path is measured */
+#define FT_DEFAULT_MAX_WINDOW  256         /* ...and at most once it is */
+#define FT_MAX_WINDOW_SIZE     1024
+#define FT_DEFAULT_RING_CHUNKS 32          /* Receiver buffers between network and disk */
+#define FT_SACK_HEADER_SIZE    20          /* Fixed part of CHUNK_SACK payload */
+#define FT_SACK_MAX_BITS       FT_MAX_WINDOW_SIZE
+#define FT_SACK_EVERY_CHUNKS   8           /* Receiver emits a SACK after this many chunks */
+#define FT_SACK_DELAY_MS       5           /* ...or once the oldest unreported chunk is this old */
+#define FT_TRANSFER_COMPLETE_SIZE 16
+#define FT_VERIFY_REQUEST_HEADER_SIZE 16   /* Fixed part of VERIFY_REQUEST payload */
+#define FT_VERIFY_MAX_DIGESTS  1024        /* Leaf digests per VERIFY_REQUEST */
+#define FT_VERIFY_RESPONSE_HEADER_SIZE 12  /* Fixed part of VERIFY_RESPONSE payload */
+#define FT_VERIFY_MAX_BAD_CHUNKS 64        /* Mismatching chunk IDs listed in VERIFY_RESPONSE */
+#define FT_MAX_STREAMS         64          /* Connections one transfer may be striped across */
+#define FT_FILE_ACK_LEGACY_SIZE 4          /* FILE_ACK payload without FT_CAP_RESUME */
+#define FT_FILE_ACK_HEADER_SIZE 16         /* Fixed part of FILE_ACK payload with FT_CAP_RESUME */
+#define FT_BLOCK_SIGS_HEADER_SIZE 32       /* Fixed part of BLOCK_SIGNATURES payload */
+#define FT_BLOCK_SIG_SIZE      20          /* Weak checksum (4) + truncated SHA-256 (16) per block */
+#define FT_BLOCK_SIG_STRONG_SIZE 16
+#define FT_BLOCK_SIGS_PER_MSG  1024        /* Block signatures per BLOCK_SIGNATURES */
+#define FT_DELTA_MIN_BLOCK     2048        /* Delta block size bounds */
+#define FT_DELTA_MAX_BLOCK     131072
+#define FT_CHUNK_HASHES_HEADER_SIZE 16     /* Fixed part of CHUNK_HASHES and CHUNK_HAVE payloads */
+#define FT_DEDUP_MAX_HASHES    1024        /* Chunk hashes per CHUNK_HASHES */
+#define FT_UDP_SETUP_SIZE      16
+
+/* Handshake capability bits (HandshakePayload.capabilities) */
+#define FT_CAP_SACK            0x01        /* Cumulative + selective ACKs (MSG_CHUNK_SACK) */
+#define FT_CAP_TREE_HASH       0x02        /* Merkle root verification after the last chunk */
+#define FT_CAP_STRIPED         0x04        /* One file striped across several connections */
+#define FT_CAP_RESUME          0x08        /* FILE_ACK lists chunks kept from an interrupted upload */
+#define FT_CAP_DELTA           0x10        /* Rebuild from the server's existing copy (MSG_DELTA_DATA) */
+#define FT_CAP_DEDUP           0x20        /* Chunks found in the server's chunk store are not sent */
+#define FT_CAP_COMPRESS        0x40        /* CHUNK_DATA payloads may be LZ4 compressed (FT_FLAG_LZ4) */
+#define FT_CAP_BATCH           0x80        /* Many files over one connection, small ones bundled (FT_FILE_*) */
+#define FT_CAP_SUPPORTED       (FT_CAP_SACK | FT_CAP_TREE_HASH | FT_CAP_STRIPED | FT_CAP_RESUME | \
+                                FT_CAP_DELTA | FT_CAP_DEDUP | FT_CAP_COMPRESS | FT_CAP_BATCH)
+
+/* Message header flags (MessageHeader.flags) */
+#define FT_FLAG_LZ4            0x0001      /* CHUNK_DATA payload is an LZ4 block (see ChunkHeader) */
+#define FT_FLAG_HEADER_CRC     0x0002      /* v2: a CRC32 of the header ends it */
+#define FT_FLAG_ZERO           0x0004      /* CHUNK_DATA: the chunk is all zeros and no data follows
+                                            * its ChunkHeader (FT_FILE_ACK_SPARSE) */
+#define FT_FLAG_PRIORITY_MASK  0x0300      /* HANDSHAKE_REQ: the client's FT_PRIORITY_* class */
+#define FT_FLAG_PRIORITY_SHIFT 8
+#define FT_FLAG_SESSION        0x0400      /* HANDSHAKE_REQ: the client keeps the connection between files,
+                                            * sending KEEPALIVE while idle; HANDSHAKE_ACK: the server agrees */
+
+/* Priority classes a client declares in its handshake; the server's
+ * scheduler shares bandwidth between transfers by their weights. Older
+ * clients send 0, so the default class is 0. */
+#define FT_PRIORITY_NORMAL     0
+#define FT_PRIORITY_BULK       1           /* Background copies: the smallest share */
+#define FT_PRIORITY_INTERACTIVE 2          /* Someone is waiting: the largest share */
+#define FT_PRIORITY_COUNT      3
+
+/*
+ * Protocol versions. A connection starts in v1 framing: the handshake
+ * request's header carries the highest version the client speaks in
+ * `reserved` (0 from older clients, meaning v1), the ack's the version
+ * agreed on, and every later message uses that version's framing.
+ *
+ * v2 header: length(1) msg_type(1) flags seq payload_size [crc32(4)], the
+ * middle three LEB128 varints. length counts the whole header; the CRC32
+ * of the bytes before it is there with FT_FLAG_HEADER_CRC, which senders
+ * leave out of CHUNK_DATA and DELTA_DATA as their payload has a CRC32 of
+ * its own. A v2 FILE_INFO payload is a run of FT_INFO_* fields, each a tag
+ * and a length varint and then the value; unknown tags are skipped, so
+ * fields can be added (other digests, compression, extents) without a new
+ * version. Integers in fields are varints.
+ */
+#define FT_INFO_NAME           0x01        /* UTF-8, shorter than FT_MAX_PATH_LEN */
+#define FT_INFO_SIZE           0x02
+#define FT_INFO_CHUNKS         0x03
+#define FT_INFO_CHUNK_SIZE     0x04
+#define FT_INFO_CHECKSUM       0x05        /* checksum_type(1), then the digest */
+#define FT_INFO_MODE           0x06
+#define FT_INFO_TIMESTAMP      0x07
+#define FT_INFO_STRIPE         0x08        /* transfer_id, stripe_index, stripe_count */
+#define FT_INFO_FLAGS          0x09
+#define FT_INFO_BUNDLE         0x0A        /* bundle_entries */
+
+/* FILE_INFO flags (FileInfo.flags, FT_CAP_BATCH) */
+#define FT_FILE_BUNDLE         0x01        /* A bundle of small files (bundle.h), unpacked once verified */
+#define FT_FILE_ATTRS          0x02        /* Give the received file file_mode and timestamp */
+#define FT_FILE_UDP            0x04        /* Send the chunks over UDP if the server agrees (udp.h) */
+#define FT_FILE_SPARSE         0x08        /* Holes and zero chunks may come as FT_FLAG_ZERO records;
+                                            * the file is kept sparse */
+
+/* FILE_ACK flags (FileAck.flags) */
+#define FT_FILE_ACK_DELTA      0x01        /* BLOCK_SIGNATURES follow; send the file as DELTA_DATA */
+#define FT_FILE_ACK_DEDUP      0x02        /* Send CHUNK_HASHES before the chunks */
+#define FT_FILE_ACK_UDP        0x04        /* UDP_SETUP follows; send CHUNK_DATA over UDP */
+#define FT_FILE_ACK_SPARSE     0x08        /* FT_FLAG_ZERO records are taken */
 
 /* Message types */
 typedef enum {
@@ -27,9 +128,16 @@ typedef enum {
     MSG_FILE_ACK = 0x04,           /* Server ready to receive */
     MSG_CHUNK_DATA = 0x05,         /* File chunk payload */
     MSG_CHUNK_ACK = 0x06,          /* Chunk received confirmation */
-    MSG_TRANSFER_COMPLETE = 0x07,  /* All chunks sent */
+    MSG_TRANSFER_COMPLETE = 0x07,  /* All chunks sent; between files, the end of a batch */
     MSG_VERIFY_REQUEST = 0x08,     /* Request final verification */
     MSG_VERIFY_RESPONSE = 0x09,    /* Verification result */
+    MSG_CHUNK_SACK = 0x0A,         /* Cumulative + selective chunk acknowledgment */
+    MSG_BLOCK_SIGNATURES = 0x0B,   /* Block checksums of the server's existing copy */
+    MSG_DELTA_DATA = 0x0C,         /* Copy and literal instructions rebuilding the file */
+    MSG_CHUNK_HASHES = 0x0D,       /* Tree leaves of chunks about to be sent */
+    MSG_CHUNK_HAVE = 0x0E,         /* Which of them the server's chunk store holds */
+    MSG_UDP_SETUP = 0x0F,          /* Where to send a file's chunks over UDP */
+    MSG_KEEPALIVE = 0x10,          /* Idle session between files (FT_FLAG_SESSION) */
     MSG_ERROR = 0xFF               /* Error condition */
 } MessageType;
 
@@ -57,57 +165,82 @@ typedef enum {
     FT_ERR_OUT_OF_MEMORY = -30,
     FT_ERR_INVALID_ARG = -31,
     FT_ERR_FILE_NOT_FOUND = -32,
-    FT_ERR_FILENAME_TOO_LONG = -33
+    FT_ERR_FILENAME_TOO_LONG = -33,
+    FT_ERR_BUSY = -34,
+    FT_ERR_TLS = -35
 } FTErrorCode;
 
 /* Checksum types */
 typedef enum {
     CHECKSUM_CRC32 = 0,
     CHECKSUM_MD5 = 1,
-    CHECKSUM_SHA256 = 2
+    CHECKSUM_SHA256 = 2,
+    CHECKSUM_MERKLE_SHA256 = 3     /* Root of per-chunk SHA-256 tree (see treehash.h) */
 } ChecksumType;
 
-/* Message header (32 bytes, fixed size) */
+/* Verification request kinds */
+typedef enum {
+    VERIFY_MODE_ROOT = 0,          /* Single digest: tree root */
+    VERIFY_MODE_LEAVES = 1         /* Batch of leaf digests, sent after a root mismatch */
+} VerifyMode;
+
+/* Message header (32 bytes in v1) */
 typedef struct {
     uint32_t magic;           /* Protocol magic number (0x46544350) */
     uint8_t  version;         /* Protocol version */
     uint8_t  msg_type;        /* Message type (MessageType enum) */
-    uint16_t flags;           /* Reserved flags */
+    uint16_t flags;           /* FT_FLAG_* bits */
     uint64_t sequence_num;    /* Packet sequence number */
     uint64_t payload_size;    /* Size of payload following header */
-    uint32_t checksum;        /* CRC32 of header (bytes 0-23) */
-    uint32_t reserved;        /* Reserved for future use */
+    uint32_t checksum;        /* CRC32 of header (bytes 0-23 in v1) */
+    uint32_t reserved;        /* HANDSHAKE_REQ/ACK: protocol version offered/agreed (v1 only) */
 } __attribute__((packed)) MessageHeader;
 
 /* Handshake request/ack payload */
 typedef struct {
     uint8_t protocol_version;
-    uint8_t capabilities;      /* Reserved for future capabilities */
-    uint16_t reserved;
+    uint8_t capabilities;      /* FT_CAP_* bits offered (request) or agreed (ack) */
+    uint16_t max_chunk_kb;     /* Largest chunk size in KB (network order) the sender takes; the
+                                * ack carries the smaller of both sides. 0 (older peers) means
+                                * FT_DEFAULT_CHUNK_SIZE. */
 } __attribute__((packed)) HandshakePayload;
 
-/* File info payload */
+/* File info payload (fixed FT_FILE_INFO_SIZE bytes in v1, FT_INFO_* fields in v2) */
 typedef struct {
     uint16_t filename_len;                /* Length of filename */
-    char     filename[FT_MAX_FILENAME_LEN]; /* Filename (UTF-8) */
+    char     filename[FT_MAX_PATH_LEN];   /* Filename (UTF-8), under FT_MAX_FILENAME_LEN in v1 */
     uint64_t file_size;                   /* Total file size in bytes */
     uint64_t total_chunks;                /* Total number of chunks */
-    uint32_t chunk_size;                  /* Size of each chunk (except last) */
+    uint32_t chunk_size;                  /* Size of each chunk (except last), within the handshake limit */
     uint8_t  checksum_type;               /* Checksum type (ChecksumType enum) */
     uint8_t  file_checksum[FT_SHA256_SIZE]; /* File checksum (zero-padded) */
     uint32_t file_mode;                   /* File permissions (Unix-style) */
     uint64_t timestamp;                   /* File modification time (Unix epoch) */
-    uint8_t  reserved[669];               /* Reserved for future use */
+    uint64_t transfer_id;                 /* Shared by all stripes of a transfer (FT_CAP_STRIPED) */
+    uint16_t stripe_index;                /* This connection's stripe, 0-based */
+    uint16_t stripe_count;                /* Connections in the transfer (0 = not striped) */
+    uint8_t  flags;                       /* FT_FILE_* bits (FT_CAP_BATCH) */
+    uint32_t bundle_entries;              /* Files in a FT_FILE_BUNDLE */
 } __attribute__((packed)) FileInfo;
 
-/* File acknowledgment payload */
+/* File acknowledgment payload. With FT_CAP_RESUME, a bitmap of
+ * (resume_bits + 7) / 8 bytes follows: bit i is set if the server already
+ * holds chunk (first chunk of the stripe + i) and it need not be sent. */
 typedef struct {
-    uint8_t status;           /* 0 = ready, 1 = error */
-    uint8_t error_code;       /* Error code if status != 0 */
-    uint8_t reserved[2];
+    uint8_t  status;          /* 0 = ready, 1 = error */
+    uint8_t  error_code;      /* Error code if status != 0 */
+    uint8_t  flags;           /* FT_FILE_ACK_* bits (in the 4-byte form too) */
+    uint8_t  reserved;
+    uint32_t resume_bits;     /* Chunks covered by the bitmap (0 = send everything) */
+    uint64_t resume_chunks;   /* Bits set in the bitmap */
 } __attribute__((packed)) FileAck;
 
-/* Chunk header (follows message header in CHUNK_DATA messages) */
+/* Chunk header (follows message header in CHUNK_DATA messages). With
+ * FT_FLAG_LZ4 the data following it is an LZ4 block of payload_size -
+ * FT_CHUNK_HEADER_SIZE bytes, smaller than chunk_size; chunk_size and
+ * chunk_crc32 still describe the chunk before compression. With
+ * FT_FLAG_ZERO the payload is the header alone: chunk_size zero bytes the
+ * receiver leaves as a hole, and chunk_crc32 is 0. */
 typedef struct {
     uint64_t chunk_id;        /* Chunk sequence number (0-based) */
     uint64_t chunk_offset;    /* Byte offset in file */
@@ -115,6 +248,49 @@ typedef struct {
     uint32_t chunk_crc32;     /* CRC32 of chunk data */
 } __attribute__((packed)) ChunkHeader;
 
+/* Block signatures payload (FT_CAP_DELTA): checksums of the blocks
+ * [first_block, first_block + count) of the file the server already has,
+ * FT_BLOCK_SIG_SIZE bytes each, follow. Every block is block_size bytes
+ * except the last, which holds the rest of the file. A DELTA_DATA stream
+ * then rebuilds the new file from these blocks: its payload is a
+ * ChunkHeader (chunk_id = frame number, chunk_offset = offset in the new
+ * file the frame's output starts at, chunk_size and chunk_crc32 covering
+ * the instructions) and a run of DELTA_OP_* instructions; a frame with
+ * no instructions ends the stream. */
+typedef struct {
+    uint64_t basis_size;      /* Size of the existing file */
+    uint64_t block_count;     /* Blocks in the existing file */
+    uint64_t first_block;     /* Block of the first signature in this message */
+    uint32_t block_size;
+    uint32_t count;           /* Signatures in this message */
+} __attribute__((packed)) BlockSignatures;
+
+/* Chunk hashes payload (FT_CAP_DEDUP): the tree leaves of chunks
+ * [first_chunk, first_chunk + count) follow, FT_SHA256_SIZE bytes each.
+ * The server answers with the same header in CHUNK_HAVE, `found` set and
+ * a bitmap of (count + 7) / 8 bytes following: bit i is set if its chunk
+ * store holds chunk first_chunk + i, which is then not sent. */
+typedef struct {
+    uint64_t first_chunk;
+    uint32_t count;
+    uint32_t found;           /* CHUNK_HAVE: bits set in the bitmap */
+} __attribute__((packed)) ChunkHashes;
+
+/* UDP setup payload (FT_FILE_ACK_UDP): the server's UDP socket for this
+ * file. The client sends a HELLO datagram with the token from the socket
+ * it will send from, then the chunks (see udp.h); SACKs still come over
+ * TCP. A client that gets no HELLO_ACK sends the chunks over TCP instead. */
+typedef struct {
+    uint64_t token;           /* Names the transfer in HELLO */
+    uint16_t port;            /* On the address the TCP connection reached */
+    uint16_t max_datagram;    /* Largest datagram the server takes */
+    uint32_t max_messages;    /* Chunks the server reassembles at once */
+} __attribute__((packed)) UdpSetup;
+
+/* DELTA_DATA instructions */
+#define DELTA_OP_COPY          0x01        /* block (8), count (4): copy existing blocks */
+#define DELTA_OP_LITERAL       0x02        /* length (4), then that many new bytes */
+
 /* Chunk acknowledgment payload */
 typedef struct {
     uint64_t chunk_id;        /* Chunk ID being acknowledged */
@@ -122,11 +298,42 @@ typedef struct {
     uint8_t  reserved[3];
 } __attribute__((packed)) ChunkAck;
 
-/* Verification response payload */
+/* Selective acknowledgment payload (replaces per-chunk ACKs when FT_CAP_SACK
+ * is negotiated). Bit i of the bitmap covers chunk (cumulative + i). */
+typedef struct {
+    uint64_t cumulative;      /* All chunks below this ID have been received */
+    uint64_t highest_seq;     /* Sequence number of the last CHUNK_DATA processed */
+    uint16_t bitmap_bits;     /* Number of valid bits in bitmap */
+    uint8_t  reserved[2];
+    uint8_t  bitmap[FT_SACK_MAX_BITS / 8];
+} __attribute__((packed)) ChunkSack;
+
+/* Transfer complete payload (sender has no more chunks). Sent instead of
+ * the next FILE_INFO, it ends a FT_CAP_BATCH connection and counts the
+ * files and bytes the connection carried. */
+typedef struct {
+    uint64_t total_chunks;    /* Chunks acknowledged (files, ending a batch) */
+    uint64_t total_bytes;     /* Bytes acknowledged */
+} __attribute__((packed)) TransferComplete;
+
+/* Verification request payload; digest_count 32-byte digests follow */
+typedef struct {
+    uint8_t  checksum_type;   /* ChecksumType of the digests */
+    uint8_t  mode;            /* VerifyMode */
+    uint16_t reserved;
+    uint32_t digest_count;    /* 1 for VERIFY_MODE_ROOT */
+    uint64_t first_leaf;      /* Leaf index of the first digest (VERIFY_MODE_LEAVES) */
+} __attribute__((packed)) VerifyRequest;
+
+/* Verification response payload, sent once a matching file is committed.
+ * After a leaf comparison, bad_chunks lists the first bad_listed of
+ * bad_count mismatching chunk IDs. */
 typedef struct {
-    uint8_t checksum_match;   /* 0 = mismatch, 1 = match */
-    uint8_t error_code;       /* Error code if match failed */
-    uint8_t reserved[2];
+    uint8_t  checksum_match;  /* 0 = mismatch or not committed, 1 = match */
+    uint8_t  error_code;      /* FT_ERR_CHECKSUM on a mismatch, else why the file could not be committed */
+    uint16_t bad_listed;      /* Entries used in bad_chunks */
+    uint64_t bad_count;       /* Total mismatching chunks */
+    uint64_t bad_chunks[FT_VERIFY_MAX_BAD_CHUNKS];
 } __attribute__((packed)) VerifyResponse;
 
 /* Error message payload */
@@ -154,18 +361,90 @@ int protocol_validate_header(const MessageHeader *header);
 /* Compute header checksum (CRC32 of first 24 bytes) */
 uint32_t protocol_compute_header_checksum(const MessageHeader *header);
 
-/* Serialize file info */
+/* Serialize v2 header (with a CRC32 if flags has FT_FLAG_HEADER_CRC) into
+ * at most FT_HEADER_SIZE bytes; returns number of bytes written */
+size_t protocol_serialize_header_v2(const MessageHeader *header, uint8_t *buffer);
+
+/* Deserialize v2 header of buffer[0] bytes; FT_ERR_PROTOCOL if malformed,
+ * FT_ERR_CHECKSUM if its CRC32 does not match */
+int protocol_deserialize_header_v2(const uint8_t *buffer, MessageHeader *header);
+
+/* Serialize file info (v1, FT_FILE_INFO_SIZE bytes) */
 void protocol_serialize_file_info(const FileInfo *file_info, uint8_t *buffer);
 
-/* Deserialize file info */
+/* Deserialize file info (v1) */
 int protocol_deserialize_file_info(const uint8_t *buffer, FileInfo *file_info);
 
+/* Serialize file info (v2) into at most FT_FILE_INFO_MAX_SIZE bytes;
+ * returns number of bytes written */
+size_t protocol_serialize_file_info_v2(const FileInfo *file_info, uint8_t *buffer);
+
+/* Deserialize file info (v2); fails on malformed fields or a missing name */
+int protocol_deserialize_file_info_v2(const uint8_t *buffer, size_t size, FileInfo *file_info);
+
+/* Chunks [*first_chunk, *end_chunk) carried by one stripe: stripes get
+ * contiguous ranges of near-equal size, in stripe order */
+void protocol_stripe_range(uint64_t total_chunks, uint16_t stripe_count, uint16_t stripe_index,
+                           uint64_t *first_chunk, uint64_t *end_chunk);
+
+/* Serialize file ACK (FT_CAP_RESUME form, bitmap appended raw by the caller) */
+void protocol_serialize_file_ack(const FileAck *ack, uint8_t *buffer);
+
+/* Deserialize file ACK; a FT_FILE_ACK_LEGACY_SIZE payload carries no resume
+ * bitmap. Checks that size matches resume_bits. */
+int protocol_deserialize_file_ack(const uint8_t *buffer, size_t size, FileAck *ack);
+
 /* Serialize chunk header */
 void protocol_serialize_chunk_header(const ChunkHeader *chunk_hdr, uint8_t *buffer);
 
 /* Deserialize chunk header */
 int protocol_deserialize_chunk_header(const uint8_t *buffer, ChunkHeader *chunk_hdr);
 
+/* Serialize block signatures header (signatures are appended raw by the caller) */
+void protocol_serialize_block_signatures(const BlockSignatures *sigs, uint8_t *buffer);
+
+/* Deserialize block signatures header; checks that size matches count */
+int protocol_deserialize_block_signatures(const uint8_t *buffer, size_t size, BlockSignatures *sigs);
+
+/* Serialize chunk hashes or chunk have header (leaves or bitmap appended raw by the caller) */
+void protocol_serialize_chunk_hashes(const ChunkHashes *hashes, uint8_t *buffer);
+
+/* Deserialize chunk hashes header; checks that size matches count */
+int protocol_deserialize_chunk_hashes(const uint8_t *buffer, size_t size, ChunkHashes *hashes);
+
+/* Deserialize chunk have header; checks that size matches count and found */
+int protocol_deserialize_chunk_have(const uint8_t *buffer, size_t size, ChunkHashes *have);
+
+/* Serialize UDP setup (FT_UDP_SETUP_SIZE bytes) */
+void protocol_serialize_udp_setup(const UdpSetup *setup, uint8_t *buffer);
+
+/* Deserialize UDP setup */
+int protocol_deserialize_udp_setup(const uint8_t *buffer, size_t size, UdpSetup *setup);
+
+/* Serialize chunk SACK; returns number of bytes written */
+size_t protocol_serialize_chunk_sack(const ChunkSack *sack, uint8_t *buffer);
+
+/* Deserialize chunk SACK (size is the received payload size) */
+int protocol_deserialize_chunk_sack(const uint8_t *buffer, size_t size, ChunkSack *sack);
+
+/* Serialize transfer complete */
+void protocol_serialize_transfer_complete(const TransferComplete *complete, uint8_t *buffer);
+
+/* Deserialize transfer complete */
+int protocol_deserialize_transfer_complete(const uint8_t *buffer, size_t size, TransferComplete *complete);
+
+/* Serialize verify request header (digests are appended raw by the caller) */
+void protocol_serialize_verify_request(const VerifyRequest *request, uint8_t *buffer);
+
+/* Deserialize verify request header; checks that size matches digest_count */
+int protocol_deserialize_verify_request(const uint8_t *buffer, size_t size, VerifyRequest *request);
+
+/* Serialize verify response; returns number of bytes written */
+size_t protocol_serialize_verify_response(const VerifyResponse *response, uint8_t *buffer);
+
+/* Deserialize verify response (size is the received payload size) */
+int protocol_deserialize_verify_response(const uint8_t *buffer, size_t size, VerifyResponse *response);
+
 /* Get error message string from error code */
 const char* protocol_get_error_string(FTErrorCode error_code);
 
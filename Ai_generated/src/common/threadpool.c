@@ -0,0 +1,168 @@
+#include "threadpool.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Worker loop: run tasks until shutdown and the queue is drained */
+static void worker_thread(void *arg) {
+    ThreadPool *pool = (ThreadPool*)arg;
+
+    platform_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->queue_count == 0 && !pool->shutdown) {
+            platform_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->queue_count == 0) {
+            break;
+        }
+
+        ThreadPoolTask task = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->queue_capacity;
+        pool->queue_count--;
+        pool->active++;
+        platform_mutex_unlock(&pool->lock);
+
+        task.func(task.arg);
+
+        platform_mutex_lock(&pool->lock);
+        pool->active--;
+        platform_cond_broadcast(&pool->work_done);
+    }
+    platform_mutex_unlock(&pool->lock);
+}
+
+/* Start worker pool */
+int threadpool_init(ThreadPool *pool, int num_threads, uint32_t queue_capacity) {
+    memset(pool, 0, sizeof(ThreadPool));
+    if (num_threads < 0 || queue_capacity == 0) {
+        return FT_ERR_INVALID_ARG;
+    }
+
+    pool->queue = (ThreadPoolTask*)calloc(queue_capacity, sizeof(ThreadPoolTask));
+    pool->threads = (ft_thread_t*)calloc(num_threads > 0 ? (size_t)num_threads : 1, sizeof(ft_thread_t));
+    if (pool->queue == NULL || pool->threads == NULL) {
+        free(pool->queue);
+        free(pool->threads);
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    pool->queue_capacity = queue_capacity;
+
+    platform_mutex_init(&pool->lock);
+    platform_cond_init(&pool->work_ready);
+    platform_cond_init(&pool->work_done);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (platform_thread_create(&pool->threads[i], worker_thread, pool) != 0) {
+            LOG_ERROR("Failed to start worker thread %d", i);
+            threadpool_destroy(pool);
+            return FT_ERR_OUT_OF_MEMORY;
+        }
+        pool->num_threads++;
+    }
+
+    return FT_SUCCESS;
+}
+
+/* Stop workers */
+void threadpool_destroy(ThreadPool *pool) {
+    if (pool->queue == NULL) {
+        return;
+    }
+
+    platform_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    platform_cond_broadcast(&pool->work_ready);
+    platform_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        platform_thread_join(pool->threads[i]);
+    }
+
+    platform_cond_destroy(&pool->work_done);
+    platform_cond_destroy(&pool->work_ready);
+    platform_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->queue);
+    pool->threads = NULL;
+    pool->queue = NULL;
+}
+
+/* Queue task */
+int threadpool_submit(ThreadPool *pool, threadpool_task_fn func, void *arg) {
+    if (pool->num_threads == 0) {
+        func(arg);
+        return 0;
+    }
+
+    platform_mutex_lock(&pool->lock);
+    while (pool->queue_count == pool->queue_capacity && !pool->shutdown) {
+        platform_cond_wait(&pool->work_done, &pool->lock);
+    }
+    if (pool->shutdown) {
+        platform_mutex_unlock(&pool->lock);
+        return -1;
+    }
+
+    uint32_t tail = (pool->queue_head + pool->queue_count) % pool->queue_capacity;
+    pool->queue[tail].func = func;
+    pool->queue[tail].arg = arg;
+    pool->queue_count++;
+    platform_cond_signal(&pool->work_ready);
+    platform_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* Wait for all tasks */
+void threadpool_wait(ThreadPool *pool) {
+    platform_mutex_lock(&pool->lock);
+    while (pool->queue_count > 0 || pool->active > 0) {
+        platform_cond_wait(&pool->work_done, &pool->lock);
+    }
+    platform_mutex_unlock(&pool->lock);
+}
+
+/* Initialize wait group */
+void wait_group_init(WaitGroup *group) {
+    group->pending = 0;
+    platform_mutex_init(&group->lock);
+    platform_cond_init(&group->done);
+}
+
+/* Destroy wait group */
+void wait_group_destroy(WaitGroup *group) {
+    platform_cond_destroy(&group->done);
+    platform_mutex_destroy(&group->lock);
+}
+
+/* Register outstanding tasks */
+void wait_group_add(WaitGroup *group, uint32_t count) {
+    platform_mutex_lock(&group->lock);
+    group->pending += count;
+    platform_mutex_unlock(&group->lock);
+}
+
+/* Mark one task finished */
+void wait_group_done(WaitGroup *group) {
+    platform_mutex_lock(&group->lock);
+    if (--group->pending == 0) {
+        platform_cond_broadcast(&group->done);
+    }
+    platform_mutex_unlock(&group->lock);
+}
+
+/* Wait until no tasks are outstanding */
+void wait_group_wait(WaitGroup *group) {
+    platform_mutex_lock(&group->lock);
+    while (group->pending > 0) {
+        platform_cond_wait(&group->done, &group->lock);
+    }
+    platform_mutex_unlock(&group->lock);
+}
+
+/* Check for outstanding tasks */
+int wait_group_idle(WaitGroup *group) {
+    platform_mutex_lock(&group->lock);
+    int idle = (group->pending == 0);
+    platform_mutex_unlock(&group->lock);
+    return idle;
+}
@@ -0,0 +1,66 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+
+/* Task entry point */
+typedef void (*threadpool_task_fn)(void *arg);
+
+/* Queued task */
+typedef struct {
+    threadpool_task_fn func;
+    void              *arg;
+} ThreadPoolTask;
+
+/*
+ * Fixed-size worker pool with a bounded FIFO queue. submit() blocks while
+ * the queue is full, which throttles producers to the workers' pace.
+ * A pool with zero threads runs every task inline in submit().
+ */
+typedef struct {
+    ft_thread_t    *threads;
+    int             num_threads;
+    ThreadPoolTask *queue;
+    uint32_t        queue_capacity;
+    uint32_t        queue_head;
+    uint32_t        queue_count;
+    uint32_t        active;         /* Tasks currently running */
+    int             shutdown;
+    ft_mutex_t      lock;
+    ft_cond_t       work_ready;     /* Queue became non-empty, or shutdown */
+    ft_cond_t       work_done;      /* Queue slot freed or task finished */
+} ThreadPool;
+
+/* Counter of outstanding tasks that a caller can wait on */
+typedef struct {
+    uint32_t   pending;
+    ft_mutex_t lock;
+    ft_cond_t  done;
+} WaitGroup;
+
+/* Start num_threads workers (0 = run tasks inline) */
+int threadpool_init(ThreadPool *pool, int num_threads, uint32_t queue_capacity);
+
+/* Wait for queued tasks to finish, then stop and join all workers */
+void threadpool_destroy(ThreadPool *pool);
+
+/* Queue a task, blocking while the queue is full */
+int threadpool_submit(ThreadPool *pool, threadpool_task_fn func, void *arg);
+
+/* Block until the queue is empty and no task is running */
+void threadpool_wait(ThreadPool *pool);
+
+/* Wait groups */
+void wait_group_init(WaitGroup *group);
+void wait_group_destroy(WaitGroup *group);
+void wait_group_add(WaitGroup *group, uint32_t count);
+void wait_group_done(WaitGroup *group);
+void wait_group_wait(WaitGroup *group);
+
+/* Whether nothing is outstanding, without waiting */
+int wait_group_idle(WaitGroup *group);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,737 @@
+#include "tls.h"
+
+#ifdef FT_HAVE_TLS
+
+#include "logger.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Kernel TLS: Linux with TLS 1.3 support in its headers */
+#ifdef FT_PLATFORM_LINUX
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#ifdef TLS_1_3_VERSION
+#define FT_KTLS 1
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+#endif
+
+/* Failed sends on a closed peer return EPIPE instead of raising SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#define TLS_SUITES          "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+#define TLS_SUITE_AES128    0x1301
+#define TLS_SUITE_AES256    0x1302
+#define TLS_SECRET_MAX      48                         /* SHA-384 */
+#define TLS_CIPHERTEXT_MAX  (FT_TLS_RECORD_MAX + 256)  /* Largest record body a peer may send */
+#define TLS_RX_BUFFER       (4 * (5 + TLS_CIPHERTEXT_MAX))
+#define TLS_TX_RECORDS      4                          /* Records sealed ahead of one send() */
+#define TLS_TAG_SIZE        16
+
+#define TLS_TYPE_ALERT        21
+#define TLS_TYPE_HANDSHAKE    22
+#define TLS_TYPE_APPLICATION  23
+#define TLS_NEW_SESSION_TICKET 4
+
+/* Cipher and nonce of one direction of the user-space record layer */
+typedef struct {
+    EVP_CIPHER_CTX *ctx;
+    uint8_t         iv[12];
+    uint64_t        seq;
+} RecordKey;
+
+struct TlsSession {
+    int         server;
+    SSL        *ssl;                                 /* Until the handshake completes */
+    uint8_t     secrets[2][TLS_SECRET_MAX];          /* Client, server application traffic secrets */
+    size_t      secret_len[2];
+
+    int         seals;                               /* Sending is encrypted here, not by the kernel */
+    int         opens;                               /* Receiving is decrypted here */
+    RecordKey   tx;
+    RecordKey   rx;
+    ft_mutex_t  tx_lock;                             /* tls_send() callers */
+    uint8_t    *tx_buf;
+
+    uint8_t    *rx_buf;                              /* Received records */
+    size_t      rx_start;                            /* Next record not yet opened */
+    size_t      rx_end;                              /* End of received data */
+    size_t      plain_pos;                           /* Unread plaintext of the last record opened, */
+    size_t      plain_end;                           /* decrypted in place in rx_buf */
+    int         rx_eof;                              /* close_notify received */
+};
+
+/* Walks the segments of a frame */
+typedef struct {
+    const FrameSegment *segments;
+    int                 count;
+    int                 index;
+    size_t              offset;
+} SegmentCursor;
+
+static SSL_CTX *tls_ctx = NULL;
+
+/* Most recent OpenSSL error, for logs */
+static const char* openssl_reason(char *buffer, size_t size) {
+    unsigned long code = ERR_get_error();
+    if (code == 0) {
+        return "no further detail";
+    }
+    ERR_error_string_n(code, buffer, size);
+    ERR_clear_error();
+    return buffer;
+}
+
+/* Value of a hex digit, or -1 */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Key log callback: keep the application traffic secrets, which the keys
+ * for the kernel (or the record layer here) are derived from */
+static void capture_secret(const SSL *ssl, const char *line) {
+    struct TlsSession *session = (struct TlsSession*)SSL_get_app_data(ssl);
+    int side;
+
+    if (strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0) {
+        side = 0;
+    } else if (strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0) {
+        side = 1;
+    } else {
+        return;
+    }
+
+    const char *hex = strrchr(line, ' ') + 1;
+    size_t length = strlen(hex) / 2;
+    if (session == NULL || length > TLS_SECRET_MAX) {
+        return;
+    }
+    for (size_t i = 0; i < length; i++) {
+        int high = hex_value(hex[2 * i]);
+        int low = hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return;
+        }
+        session->secrets[side][i] = (uint8_t)(high << 4 | low);
+    }
+    session->secret_len[side] = length;
+}
+
+/* HKDF-Expand-Label of RFC 8446 with an empty context */
+static int expand_label(const EVP_MD *md, const uint8_t *secret, size_t secret_len, const char *label,
+                        uint8_t *out, size_t out_len) {
+    uint8_t info[32];
+    size_t label_len = strlen(label);
+    size_t info_len = 0;
+
+    info[info_len++] = (uint8_t)(out_len >> 8);
+    info[info_len++] = (uint8_t)out_len;
+    info[info_len++] = (uint8_t)(6 + label_len);
+    memcpy(info + info_len, "tls13 ", 6);
+    info_len += 6;
+    memcpy(info + info_len, label, label_len);
+    info_len += label_len;
+    info[info_len++] = 0;
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    int ok = pctx != NULL &&
+             EVP_PKEY_derive_init(pctx) > 0 &&
+             EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+             EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, (int)secret_len) > 0 &&
+             EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int)info_len) > 0 &&
+             EVP_PKEY_derive(pctx, out, &out_len) > 0;
+    EVP_PKEY_CTX_free(pctx);
+    return ok ? 0 : -1;
+}
+
+#ifdef FT_KTLS
+/* Hand one direction's key to the kernel; returns 1 if it took it */
+static int ktls_install(socket_t sock, int direction, const uint8_t *key, size_t key_len, const uint8_t *iv) {
+    int result;
+
+    if (key_len == 16) {
+        struct tls12_crypto_info_aes_gcm_128 info;
+        memset(&info, 0, sizeof(info));
+        info.info.version = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(info.key, key, sizeof(info.key));
+        memcpy(info.salt, iv, sizeof(info.salt));
+        memcpy(info.iv, iv + sizeof(info.salt), sizeof(info.iv));
+        result = setsockopt(sock, SOL_TLS, direction, &info, sizeof(info));
+        OPENSSL_cleanse(&info, sizeof(info));
+    } else {
+        struct tls12_crypto_info_aes_gcm_256 info;
+        memset(&info, 0, sizeof(info));
+        info.info.version = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(info.key, key, sizeof(info.key));
+        memcpy(info.salt, iv, sizeof(info.salt));
+        memcpy(info.iv, iv + sizeof(info.salt), sizeof(info.iv));
+        result = setsockopt(sock, SOL_TLS, direction, &info, sizeof(info));
+        OPENSSL_cleanse(&info, sizeof(info));
+    }
+    if (result != 0) {
+        LOG_DEBUG("Kernel TLS %s not available: %s", direction == TLS_TX ? "TX" : "RX", strerror(errno));
+        return 0;
+    }
+
+    /* Best effort: with NIC offload, sendfile() is encrypted straight from
+     * the page cache (a file changed meanwhile fails the record, and with
+     * it the connection, which a resume recovers from); on receive, our
+     * peer never pads records, so the kernel may decrypt in place */
+    int one = 1;
+#ifdef TLS_TX_ZEROCOPY_RO
+    if (direction == TLS_TX) {
+        setsockopt(sock, SOL_TLS, TLS_TX_ZEROCOPY_RO, &one, sizeof(one));
+    }
+#endif
+#ifdef TLS_RX_EXPECT_NO_PAD
+    if (direction == TLS_RX) {
+        setsockopt(sock, SOL_TLS, TLS_RX_EXPECT_NO_PAD, &one, sizeof(one));
+    }
+#endif
+    (void)one;
+    return 1;
+}
+#endif
+
+/* Set up one direction of the user-space record layer */
+static int key_setup(RecordKey *key, const EVP_CIPHER *cipher, const uint8_t *secret, const uint8_t *iv,
+                     int encrypt) {
+    key->ctx = EVP_CIPHER_CTX_new();
+    if (key->ctx == NULL || EVP_CipherInit_ex(key->ctx, cipher, NULL, secret, NULL, encrypt) != 1) {
+        return -1;
+    }
+    memcpy(key->iv, iv, sizeof(key->iv));
+    key->seq = 0;
+    return 0;
+}
+
+/* Per-record nonce: the IV with the sequence number XORed into its end */
+static void record_nonce(RecordKey *key, uint8_t nonce[12]) {
+    memcpy(nonce, key->iv, 12);
+    for (int i = 0; i < 8; i++) {
+        nonce[11 - i] ^= (uint8_t)(key->seq >> (8 * i));
+    }
+    key->seq++;
+}
+
+/* Seal the next take bytes of the cursor's segments into one record at
+ * out; returns its size. AES-GCM on a set-up context has no failure mode
+ * short of misuse, so results are not checked. */
+static size_t seal_record(RecordKey *key, SegmentCursor *cursor, size_t take, uint8_t *out) {
+    uint8_t nonce[12];
+    size_t body = take + 1 + TLS_TAG_SIZE;
+    uint8_t type = TLS_TYPE_APPLICATION;
+    uint8_t *p = out + 5;
+    int n;
+
+    out[0] = TLS_TYPE_APPLICATION;
+    out[1] = 0x03;
+    out[2] = 0x03;
+    out[3] = (uint8_t)(body >> 8);
+    out[4] = (uint8_t)body;
+
+    record_nonce(key, nonce);
+    EVP_EncryptInit_ex(key->ctx, NULL, NULL, NULL, nonce);
+    EVP_EncryptUpdate(key->ctx, NULL, &n, out, 5);
+    while (take > 0) {
+        const FrameSegment *segment = &cursor->segments[cursor->index];
+        size_t piece = segment->len - cursor->offset;
+        if (piece > take) {
+            piece = take;
+        }
+        EVP_EncryptUpdate(key->ctx, p, &n, (const uint8_t*)segment->data + cursor->offset, (int)piece);
+        p += n;
+        take -= piece;
+        cursor->offset += piece;
+        if (cursor->offset == segment->len) {
+            cursor->index++;
+            cursor->offset = 0;
+        }
+    }
+    EVP_EncryptUpdate(key->ctx, p, &n, &type, 1);
+    p += n;
+    EVP_EncryptFinal_ex(key->ctx, p, &n);
+    p += n;
+    EVP_CIPHER_CTX_ctrl(key->ctx, EVP_CTRL_GCM_GET_TAG, TLS_TAG_SIZE, p);
+    return 5 + body;
+}
+
+/* Total length of segments, with a cursor at their start */
+static size_t cursor_start(SegmentCursor *cursor, const FrameSegment *segments, int count) {
+    size_t total = 0;
+    cursor->segments = segments;
+    cursor->count = count;
+    cursor->index = 0;
+    cursor->offset = 0;
+    for (int i = 0; i < count; i++) {
+        total += segments[i].len;
+    }
+    return total;
+}
+
+/* Make a failed record read as a fatal socket error */
+static void set_record_error(void) {
+#ifdef FT_PLATFORM_WINDOWS
+    WSASetLastError(WSAECONNABORTED);
+#else
+    errno = EBADMSG;
+#endif
+}
+
+/* Open the record at rx_start if it is all there. Returns 1 if one was
+ * consumed (leaving its plaintext, if any, at plain_pos), 0 if more data
+ * is needed, -1 if the stream is broken. */
+static int open_record(struct TlsSession *session) {
+    size_t available = session->rx_end - session->rx_start;
+    uint8_t *record = session->rx_buf + session->rx_start;
+    uint8_t nonce[12];
+    int n;
+
+    if (available < 5) {
+        return 0;
+    }
+    size_t body = (size_t)record[3] << 8 | record[4];
+    if (record[0] != TLS_TYPE_APPLICATION || record[1] != 0x03 || record[2] != 0x03 ||
+        body <= TLS_TAG_SIZE || body > TLS_CIPHERTEXT_MAX) {
+        LOG_ERROR("Malformed TLS record");
+        return -1;
+    }
+    if (available < 5 + body) {
+        return 0;
+    }
+
+    uint8_t *plain = record + 5;
+    size_t length = body - TLS_TAG_SIZE;
+    record_nonce(&session->rx, nonce);
+    EVP_DecryptInit_ex(session->rx.ctx, NULL, NULL, NULL, nonce);
+    EVP_DecryptUpdate(session->rx.ctx, NULL, &n, record, 5);
+    EVP_DecryptUpdate(session->rx.ctx, plain, &n, plain, (int)length);
+    EVP_CIPHER_CTX_ctrl(session->rx.ctx, EVP_CTRL_GCM_SET_TAG, TLS_TAG_SIZE, plain + length);
+    if (EVP_DecryptFinal_ex(session->rx.ctx, plain + length, &n) != 1) {
+        LOG_ERROR("TLS record failed authentication");
+        return -1;
+    }
+    session->rx_start += 5 + body;
+
+    /* The real content type is the last non-zero byte */
+    while (length > 0 && plain[length - 1] == 0) {
+        length--;
+    }
+    if (length == 0) {
+        LOG_ERROR("TLS record without a content type");
+        return -1;
+    }
+    uint8_t type = plain[--length];
+
+    switch (type) {
+    case TLS_TYPE_APPLICATION:
+        session->plain_pos = (size_t)(plain - session->rx_buf);
+        session->plain_end = session->plain_pos + length;
+        return 1;
+    case TLS_TYPE_ALERT:
+        if (length >= 2 && plain[1] == 0) {
+            session->rx_eof = 1;
+            return 1;
+        }
+        LOG_ERROR("TLS alert %u from peer", length >= 2 ? plain[1] : 0);
+        return -1;
+    case TLS_TYPE_HANDSHAKE:
+        if (length >= 1 && plain[0] == TLS_NEW_SESSION_TICKET) {
+            return 1;
+        }
+        LOG_ERROR("Unsupported TLS handshake message %u after the handshake", length >= 1 ? plain[0] : 0);
+        return -1;
+    default:
+        LOG_ERROR("Unexpected TLS content type %u", type);
+        return -1;
+    }
+}
+
+/* Write all of a blocking send */
+static int send_all(socket_t sock, const uint8_t *data, size_t length, FTErrorCode *error) {
+    while (length > 0) {
+        int sent = send(sock, (const char*)data, (int)length, SEND_FLAGS);
+        if (sent <= 0) {
+            int err = socket_errno;
+#ifndef FT_PLATFORM_WINDOWS
+            if (sent < 0 && err == EINTR) {
+                continue;
+            }
+#endif
+            LOG_ERROR("Send failed: %s", platform_get_socket_error(err));
+            if (error) *error = platform_is_fatal_socket_error(err) ? FT_ERR_SEND : FT_ERR_TIMEOUT;
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/* Set up the context */
+int tls_init(const TlsConfig *config, int server, FTErrorCode *error) {
+    char reason[256];
+    SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+
+    if (ctx == NULL ||
+        SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION) != 1 ||
+        SSL_CTX_set_ciphersuites(ctx, TLS_SUITES) != 1) {
+        LOG_ERROR("Failed to set up TLS: %s", openssl_reason(reason, sizeof(reason)));
+        goto fail;
+    }
+    SSL_CTX_set_keylog_callback(ctx, capture_secret);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    if (server) {
+        if (SSL_CTX_use_certificate_chain_file(ctx, config->cert_file) != 1 ||
+            SSL_CTX_use_PrivateKey_file(ctx, config->key_file, SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(ctx) != 1) {
+            LOG_ERROR("Failed to load TLS certificate %s and key %s: %s",
+                      config->cert_file, config->key_file, openssl_reason(reason, sizeof(reason)));
+            goto fail;
+        }
+        /* Tickets would arrive after the handshake, once the keys are gone */
+        SSL_CTX_set_num_tickets(ctx, 0);
+    } else if (config->insecure) {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    } else {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        int loaded = (config->ca_file != NULL) ?
+                     SSL_CTX_load_verify_locations(ctx, config->ca_file, NULL) :
+                     SSL_CTX_set_default_verify_paths(ctx);
+        if (loaded != 1) {
+            LOG_ERROR("Failed to load CA certificates%s%s: %s", config->ca_file != NULL ? " from " : "",
+                      config->ca_file != NULL ? config->ca_file : "", openssl_reason(reason, sizeof(reason)));
+            goto fail;
+        }
+    }
+
+    tls_ctx = ctx;
+    return 0;
+
+fail:
+    SSL_CTX_free(ctx);
+    if (error) *error = FT_ERR_TLS;
+    return -1;
+}
+
+/* Free the context */
+void tls_cleanup(void) {
+    SSL_CTX_free(tls_ctx);
+    tls_ctx = NULL;
+}
+
+/* Session for a handshake on conn */
+static struct TlsSession* session_create(Connection *conn, int server) {
+    struct TlsSession *session = (struct TlsSession*)calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    platform_mutex_init(&session->tx_lock);
+    session->server = server;
+    session->ssl = SSL_new(tls_ctx);
+    if (session->ssl == NULL || SSL_set_fd(session->ssl, (int)conn->sock) != 1) {
+        tls_session_free(session);
+        return NULL;
+    }
+    SSL_set_app_data(session->ssl, session);
+    return session;
+}
+
+/* Log why a handshake failed */
+static void log_handshake_failure(struct TlsSession *session, int rc) {
+    char reason[256];
+    long verify = SSL_get_verify_result(session->ssl);
+
+    if (!session->server && verify != X509_V_OK) {
+        LOG_ERROR("TLS handshake failed: server certificate: %s", X509_verify_cert_error_string(verify));
+    } else if (SSL_get_error(session->ssl, rc) == SSL_ERROR_SYSCALL && ERR_peek_error() == 0) {
+        int err = socket_errno;
+        LOG_ERROR("TLS handshake failed: %s", err != 0 ? platform_get_socket_error(err) : "connection closed");
+    } else {
+        LOG_ERROR("TLS handshake failed: %s", openssl_reason(reason, sizeof(reason)));
+    }
+}
+
+/* Turn a completed handshake into keys for the kernel or the record layer */
+static int session_finish(Connection *conn, FTErrorCode *error) {
+    struct TlsSession *session = conn->tls;
+    SSL *ssl = session->ssl;
+    const SSL_CIPHER *suite = SSL_get_current_cipher(ssl);
+    uint16_t suite_id = suite != NULL ? SSL_CIPHER_get_protocol_id(suite) : 0;
+    const char *suite_name = suite != NULL ? SSL_CIPHER_get_name(suite) : "none";
+    uint8_t keys[2][32];
+    uint8_t ivs[2][12];
+    int result = -1;
+
+    if (SSL_version(ssl) != TLS1_3_VERSION || (suite_id != TLS_SUITE_AES128 && suite_id != TLS_SUITE_AES256) ||
+        session->secret_len[0] == 0 || session->secret_len[1] == 0) {
+        LOG_ERROR("TLS session keys unavailable (%s)", suite_name);
+        goto done;
+    }
+    /* The handshake must not have read past its own records */
+    if (SSL_has_pending(ssl)) {
+        LOG_ERROR("Unexpected data after the TLS handshake");
+        goto done;
+    }
+
+    const EVP_MD *md = (suite_id == TLS_SUITE_AES128) ? EVP_sha256() : EVP_sha384();
+    const EVP_CIPHER *cipher = (suite_id == TLS_SUITE_AES128) ? EVP_aes_128_gcm() : EVP_aes_256_gcm();
+    size_t key_len = (suite_id == TLS_SUITE_AES128) ? 16 : 32;
+    for (int side = 0; side < 2; side++) {
+        if (expand_label(md, session->secrets[side], session->secret_len[side], "key", keys[side], key_len) != 0 ||
+            expand_label(md, session->secrets[side], session->secret_len[side], "iv", ivs[side], 12) != 0) {
+            LOG_ERROR("Failed to derive TLS keys");
+            goto done;
+        }
+    }
+    int tx = session->server ? 1 : 0;
+    int rx = 1 - tx;
+
+    int kernel_tx = 0;
+    int kernel_rx = 0;
+#ifdef FT_KTLS
+    if (setsockopt(conn->sock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0) {
+        kernel_tx = ktls_install(conn->sock, TLS_TX, keys[tx], key_len, ivs[tx]);
+        kernel_rx = ktls_install(conn->sock, TLS_RX, keys[rx], key_len, ivs[rx]);
+    } else {
+        LOG_DEBUG("Kernel TLS not available: %s", strerror(errno));
+    }
+#endif
+
+    session->seals = !kernel_tx;
+    session->opens = !kernel_rx;
+    if (session->seals) {
+        session->tx_buf = (uint8_t*)malloc(TLS_TX_RECORDS * (FT_TLS_RECORD_MAX + FT_TLS_RECORD_OVERHEAD));
+        if (session->tx_buf == NULL || key_setup(&session->tx, cipher, keys[tx], ivs[tx], 1) != 0) {
+            LOG_ERROR("Failed to set up TLS encryption");
+            goto done;
+        }
+    }
+    if (session->opens) {
+        session->rx_buf = (uint8_t*)malloc(TLS_RX_BUFFER);
+        if (session->rx_buf == NULL || key_setup(&session->rx, cipher, keys[rx], ivs[rx], 0) != 0) {
+            LOG_ERROR("Failed to set up TLS decryption");
+            goto done;
+        }
+    }
+
+    LOG_INFO("TLS established (%s, sending %s, receiving %s)", suite_name,
+             kernel_tx ? "in the kernel" : "in user space", kernel_rx ? "in the kernel" : "in user space");
+    SSL_free(ssl);
+    session->ssl = NULL;
+    if (!session->seals && !session->opens) {
+        /* The kernel does it all: the connection goes on as if unencrypted */
+        tls_session_free(session);
+        conn->tls = NULL;
+    }
+    result = 0;
+
+done:
+    OPENSSL_cleanse(keys, sizeof(keys));
+    OPENSSL_cleanse(ivs, sizeof(ivs));
+    OPENSSL_cleanse(session->secrets, sizeof(session->secrets));
+    if (result != 0 && error) *error = FT_ERR_TLS;
+    return result;
+}
+
+/* Client handshake */
+int tls_connect(Connection *conn, const char *host, FTErrorCode *error) {
+    conn->tls = session_create(conn, 0);
+    if (conn->tls == NULL) {
+        LOG_ERROR("Failed to set up TLS session");
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    SSL *ssl = conn->tls->ssl;
+    if (X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host) != 1) {
+        SSL_set_tlsext_host_name(ssl, host);
+        SSL_set1_host(ssl, host);
+    }
+
+    ERR_clear_error();
+    int rc = SSL_connect(ssl);
+    if (rc != 1) {
+        log_handshake_failure(conn->tls, rc);
+        if (error) *error = FT_ERR_TLS;
+        goto fail;
+    }
+    if (session_finish(conn, error) != 0) {
+        goto fail;
+    }
+    if (error) *error = FT_SUCCESS;
+    return 0;
+
+fail:
+    tls_session_free(conn->tls);
+    conn->tls = NULL;
+    return -1;
+}
+
+/* Server handshake step. The server's flight is a few KB, so the socket
+ * always takes it: only reads are waited for. */
+int tls_accept(Connection *conn, FTErrorCode *error) {
+    if (conn->tls == NULL) {
+        conn->tls = session_create(conn, 1);
+        if (conn->tls == NULL) {
+            LOG_ERROR("Failed to set up TLS session");
+            if (error) *error = FT_ERR_OUT_OF_MEMORY;
+            return -1;
+        }
+    }
+
+    ERR_clear_error();
+    int rc = SSL_accept(conn->tls->ssl);
+    if (rc != 1) {
+        int reason = SSL_get_error(conn->tls->ssl, rc);
+        if (reason == SSL_ERROR_WANT_READ || reason == SSL_ERROR_WANT_WRITE) {
+            return 0;
+        }
+        log_handshake_failure(conn->tls, rc);
+        if (error) *error = FT_ERR_TLS;
+        return -1;
+    }
+    return session_finish(conn, error) == 0 ? 1 : -1;
+}
+
+/* Free session */
+void tls_session_free(struct TlsSession *session) {
+    if (session == NULL) {
+        return;
+    }
+    SSL_free(session->ssl);
+    EVP_CIPHER_CTX_free(session->tx.ctx);
+    EVP_CIPHER_CTX_free(session->rx.ctx);
+    platform_mutex_destroy(&session->tx_lock);
+    free(session->tx_buf);
+    free(session->rx_buf);
+    OPENSSL_cleanse(session, sizeof(*session));
+    free(session);
+}
+
+/* Sending in user space */
+int tls_seals(const struct TlsSession *session) {
+    return session->ssl == NULL && session->seals;
+}
+
+/* Receiving in user space */
+int tls_opens(const struct TlsSession *session) {
+    return session->ssl == NULL && session->opens;
+}
+
+/* Sealed size */
+size_t tls_sealed_size(size_t length) {
+    size_t records = (length + FT_TLS_RECORD_MAX - 1) / FT_TLS_RECORD_MAX;
+    return length + records * FT_TLS_RECORD_OVERHEAD;
+}
+
+/* Seal into a caller's buffer */
+size_t tls_seal(struct TlsSession *session, const FrameSegment *segments, int count, uint8_t *out) {
+    SegmentCursor cursor;
+    size_t remaining = cursor_start(&cursor, segments, count);
+    size_t written = 0;
+
+    while (remaining > 0) {
+        size_t take = remaining < FT_TLS_RECORD_MAX ? remaining : FT_TLS_RECORD_MAX;
+        written += seal_record(&session->tx, &cursor, take, out + written);
+        remaining -= take;
+    }
+    return written;
+}
+
+/* Seal and send, a few records per send() */
+int tls_send(struct TlsSession *session, socket_t sock, const FrameSegment *segments, int count,
+             FTErrorCode *error) {
+    SegmentCursor cursor;
+    size_t remaining = cursor_start(&cursor, segments, count);
+    int result = 0;
+
+    platform_mutex_lock(&session->tx_lock);
+    while (remaining > 0 && result == 0) {
+        size_t sealed = 0;
+        for (int i = 0; i < TLS_TX_RECORDS && remaining > 0; i++) {
+            size_t take = remaining < FT_TLS_RECORD_MAX ? remaining : FT_TLS_RECORD_MAX;
+            sealed += seal_record(&session->tx, &cursor, take, session->tx_buf + sealed);
+            remaining -= take;
+        }
+        result = send_all(sock, session->tx_buf, sealed, error);
+    }
+    platform_mutex_unlock(&session->tx_lock);
+
+    if (result == 0 && error) *error = FT_SUCCESS;
+    return result;
+}
+
+/* Receive plaintext */
+int tls_recv(struct TlsSession *session, socket_t sock, uint8_t *buffer, size_t length) {
+    for (;;) {
+        size_t plain = session->plain_end - session->plain_pos;
+        if (plain > 0) {
+            size_t take = plain < length ? plain : length;
+            memcpy(buffer, session->rx_buf + session->plain_pos, take);
+            session->plain_pos += take;
+            return (int)take;
+        }
+        if (session->rx_eof) {
+            return 0;
+        }
+
+        int opened = open_record(session);
+        if (opened < 0) {
+            set_record_error();
+            return -1;
+        }
+        if (opened > 0) {
+            continue;
+        }
+
+        /* Keep the partial record and read more after it */
+        if (session->rx_start > 0) {
+            memmove(session->rx_buf, session->rx_buf + session->rx_start, session->rx_end - session->rx_start);
+            session->rx_end -= session->rx_start;
+            session->rx_start = 0;
+            session->plain_pos = 0;
+            session->plain_end = 0;
+        }
+        int received = recv(sock, (char*)(session->rx_buf + session->rx_end),
+                            (int)(TLS_RX_BUFFER - session->rx_end), 0);
+        if (received <= 0) {
+            return received;
+        }
+        session->rx_end += (size_t)received;
+    }
+}
+
+/* Plaintext, a whole record or the end of the stream waiting */
+int tls_pending(const struct TlsSession *session) {
+    if (!tls_opens(session)) {
+        return 0;
+    }
+    if (session->plain_pos < session->plain_end || session->rx_eof) {
+        return 1;
+    }
+    size_t available = session->rx_end - session->rx_start;
+    const uint8_t *record = session->rx_buf + session->rx_start;
+    return available >= 5 && available >= 5 + ((size_t)record[3] << 8 | record[4]);
+}
+
+#endif /* FT_HAVE_TLS */
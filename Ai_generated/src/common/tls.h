@@ -0,0 +1,89 @@
+#ifndef TLS_H
+#define TLS_H
+
+#ifdef FT_HAVE_TLS
+
+#include <stdint.h>
+#include <stddef.h>
+#include "connection.h"
+
+/*
+ * TLS 1.3 for connections (make TLS=1, OpenSSL). OpenSSL runs the
+ * handshake in user space and is done with the connection once it
+ * completes: the traffic secrets become AES-GCM keys that are installed
+ * into the socket with Linux kernel TLS (TLS_TX/TLS_RX, offloaded to the
+ * NIC where the driver supports it), so sendfile(), writev() and the
+ * connection's buffered reads keep working on plain data while the kernel
+ * handles the records. A direction the kernel does not take (no tls
+ * module, or not Linux) is sealed or opened in tls.c's own record layer,
+ * with OpenSSL's AES-GCM (AES-NI/VAES where the CPU has them); the
+ * connection then routes that direction through tls_send()/tls_seal()
+ * and tls_recv(), and sendfile() is off for a connection whose sending
+ * is not in the kernel.
+ *
+ * Only AES-GCM suites are offered, the server issues no session tickets
+ * and key updates are not supported, so both sides' record sequences run
+ * from zero for the life of the connection. No close_notify is sent: the
+ * protocol ends transfers explicitly, so a truncated stream is already
+ * caught by it.
+ */
+
+#define FT_TLS_RECORD_MAX       16384              /* Plaintext bytes in one record */
+#define FT_TLS_RECORD_OVERHEAD  (5 + 1 + 16)       /* Header, content type, GCM tag */
+
+/* Certificates and verification (see tls_init) */
+typedef struct {
+    const char *cert_file;   /* Server: certificate chain (PEM) */
+    const char *key_file;    /* Server: private key (PEM) */
+    const char *ca_file;     /* Client: CAs to verify the server with (NULL = system store) */
+    int         insecure;    /* Client: accept any server certificate */
+} TlsConfig;
+
+struct TlsSession;
+
+/* Set up the process-wide context for a server or a client; call once at
+ * startup, before any connection uses TLS */
+int tls_init(const TlsConfig *config, int server, FTErrorCode *error);
+
+/* Free the context */
+void tls_cleanup(void);
+
+/* Client handshake on a blocking connection, verifying the server as
+ * host (unless insecure); the connection is encrypted once it returns 0 */
+int tls_connect(Connection *conn, const char *host, FTErrorCode *error);
+
+/* Server handshake on a non-blocking connection, one step per call as the
+ * socket becomes readable. Returns 1 once encrypted, 0 to wait for more
+ * data, -1 on failure. */
+int tls_accept(Connection *conn, FTErrorCode *error);
+
+/* Free a connection's session (NULL is ignored) */
+void tls_session_free(struct TlsSession *session);
+
+/* Whether this process seals (tls_seals) or opens (tls_opens) a session's
+ * records itself, as opposed to the kernel */
+int tls_seals(const struct TlsSession *session);
+int tls_opens(const struct TlsSession *session);
+
+/* Bytes of records sealing length bytes of plaintext takes */
+size_t tls_sealed_size(size_t length);
+
+/* Seal segments into records at out (tls_sealed_size() of their total);
+ * returns the bytes written. Callers serialize sealing. */
+size_t tls_seal(struct TlsSession *session, const FrameSegment *segments, int count, uint8_t *out);
+
+/* Seal segments and write them to a blocking socket */
+int tls_send(struct TlsSession *session, socket_t sock, const FrameSegment *segments, int count,
+             FTErrorCode *error);
+
+/* recv() counterpart for a session: plaintext bytes received, 0 at the
+ * end of the stream, or -1 with socket_errno set (a record that fails
+ * authentication reads as a fatal error) */
+int tls_recv(struct TlsSession *session, socket_t sock, uint8_t *buffer, size_t length);
+
+/* Whether tls_recv() can return data without reading the socket */
+int tls_pending(const struct TlsSession *session);
+
+#endif /* FT_HAVE_TLS */
+
+#endif /* TLS_H */
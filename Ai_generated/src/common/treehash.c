@@ -0,0 +1,110 @@
+#include "treehash.h"
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TREE_LEAF_PREFIX  0x00
+#define TREE_NODE_PREFIX  0x01
+
+/* Allocate tree */
+int treehash_init(TreeHash *tree, uint64_t num_leaves) {
+    tree->leaves = NULL;
+    tree->num_leaves = num_leaves;
+
+    if (num_leaves > 0) {
+        tree->leaves = calloc((size_t)num_leaves, FT_SHA256_DIGEST_SIZE);
+        if (tree->leaves == NULL) {
+            tree->num_leaves = 0;
+            return FT_ERR_OUT_OF_MEMORY;
+        }
+    }
+    return FT_SUCCESS;
+}
+
+/* Free tree */
+void treehash_free(TreeHash *tree) {
+    free(tree->leaves);
+    tree->leaves = NULL;
+    tree->num_leaves = 0;
+}
+
+/* Hash chunk into leaf */
+void treehash_set_leaf(TreeHash *tree, uint64_t index, const uint8_t *data, size_t size) {
+    if (index >= tree->num_leaves) {
+        return;
+    }
+
+    const uint8_t prefix = TREE_LEAF_PREFIX;
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, 1);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, tree->leaves[index]);
+}
+
+/* Hash zeros into a leaf, one block of them at a time */
+void treehash_zero_leaf(size_t size, uint8_t leaf[FT_SHA256_DIGEST_SIZE]) {
+    static const uint8_t zeros[4096];
+    const uint8_t prefix = TREE_LEAF_PREFIX;
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, 1);
+    while (size > 0) {
+        size_t length = size < sizeof(zeros) ? size : sizeof(zeros);
+        sha256_update(&ctx, zeros, length);
+        size -= length;
+    }
+    sha256_final(&ctx, leaf);
+}
+
+/* Copy in a leaf */
+void treehash_put_leaf(TreeHash *tree, uint64_t index, const uint8_t leaf[FT_SHA256_DIGEST_SIZE]) {
+    if (index < tree->num_leaves) {
+        memcpy(tree->leaves[index], leaf, FT_SHA256_DIGEST_SIZE);
+    }
+}
+
+/* Compute root */
+int treehash_root(const TreeHash *tree, uint8_t root[FT_SHA256_DIGEST_SIZE]) {
+    if (tree->num_leaves == 0) {
+        const uint8_t prefix = TREE_LEAF_PREFIX;
+        sha256_compute(&prefix, 1, root);
+        return FT_SUCCESS;
+    }
+    if (tree->num_leaves == 1) {
+        memcpy(root, tree->leaves[0], FT_SHA256_DIGEST_SIZE);
+        return FT_SUCCESS;
+    }
+
+    /* Reduce a copy of the leaf level in place, one level per pass */
+    uint64_t count = (tree->num_leaves + 1) / 2;
+    uint8_t (*level)[FT_SHA256_DIGEST_SIZE] = malloc((size_t)count * FT_SHA256_DIGEST_SIZE);
+    if (level == NULL) {
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+
+    const uint8_t (*src)[FT_SHA256_DIGEST_SIZE] = (const uint8_t (*)[FT_SHA256_DIGEST_SIZE])tree->leaves;
+    uint64_t src_count = tree->num_leaves;
+    while (src_count > 1) {
+        uint64_t dst_count = 0;
+        for (uint64_t i = 0; i < src_count; i += 2, dst_count++) {
+            if (i + 1 == src_count) {
+                memmove(level[dst_count], src[i], FT_SHA256_DIGEST_SIZE);
+                continue;
+            }
+            const uint8_t prefix = TREE_NODE_PREFIX;
+            Sha256Context ctx;
+            sha256_init(&ctx);
+            sha256_update(&ctx, &prefix, 1);
+            sha256_update(&ctx, src[i], FT_SHA256_DIGEST_SIZE);
+            sha256_update(&ctx, src[i + 1], FT_SHA256_DIGEST_SIZE);
+            sha256_final(&ctx, level[dst_count]);
+        }
+        src = (const uint8_t (*)[FT_SHA256_DIGEST_SIZE])level;
+        src_count = dst_count;
+    }
+
+    memcpy(root, level[0], FT_SHA256_DIGEST_SIZE);
+    free(level);
+    return FT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "checksum.h"
+
+/*
+ * Chunk-aligned SHA-256 Merkle tree (CHECKSUM_MERKLE_SHA256).
+ *
+ *   leaf = SHA-256(0x00 || chunk data)
+ *   node = SHA-256(0x01 || left || right)
+ *
+ * Levels are built pairwise; an odd last node is promoted unchanged.
+ * The root of a tree with a single leaf is that leaf; an empty file has
+ * the root SHA-256(0x00). Leaves are independent, so they can be filled
+ * from any thread in any order.
+ */
+typedef struct {
+    uint8_t (*leaves)[FT_SHA256_DIGEST_SIZE];
+    uint64_t num_leaves;
+} TreeHash;
+
+/* Allocate tree for num_leaves chunks (all leaves zero) */
+int treehash_init(TreeHash *tree, uint64_t num_leaves);
+
+/* Free tree storage */
+void treehash_free(TreeHash *tree);
+
+/* Hash one chunk into leaf index (ignored if out of range) */
+void treehash_set_leaf(TreeHash *tree, uint64_t index, const uint8_t *data, size_t size);
+
+/* Leaf of a chunk of size zero bytes (a hole), hashed without the zeros
+ * being in memory; callers keep it for their full-sized chunks */
+void treehash_zero_leaf(size_t size, uint8_t leaf[FT_SHA256_DIGEST_SIZE]);
+
+/* Set leaf index to a digest computed elsewhere (ignored if out of range) */
+void treehash_put_leaf(TreeHash *tree, uint64_t index, const uint8_t leaf[FT_SHA256_DIGEST_SIZE]);
+
+/* Combine all leaves into the root digest */
+int treehash_root(const TreeHash *tree, uint8_t root[FT_SHA256_DIGEST_SIZE]);
+
+#endif /* TREEHASH_H */
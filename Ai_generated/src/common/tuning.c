@@ -0,0 +1,97 @@
+#include "tuning.h"
+#include <string.h>
+
+/* Pick chunk size */
+uint32_t tune_chunk_size(uint64_t file_size, uint32_t max_chunk_size, uint64_t rtt_us, uint32_t max_window) {
+    uint64_t bdp = rtt_us * FT_TUNE_LINK_RATE / 1000000;
+    uint64_t chunk = FT_DEFAULT_CHUNK_SIZE;
+
+    while (chunk * 2 <= max_chunk_size &&
+           (chunk * (max_window / 2 + 1) < bdp || file_size / chunk > FT_TUNE_MAX_CHUNKS)) {
+        chunk *= 2;
+    }
+    while (chunk > FT_MIN_CHUNK_SIZE && file_size < chunk * FT_TUNE_MIN_CHUNKS) {
+        chunk /= 2;
+    }
+    if (chunk > max_chunk_size) {
+        chunk = max_chunk_size;
+    }
+    return (uint32_t)chunk;
+}
+
+/* Scale buffer count to chunk size */
+uint32_t tune_scale_depth(uint32_t chunks, uint32_t chunk_size) {
+    uint64_t depth = ((uint64_t)chunks * FT_DEFAULT_CHUNK_SIZE + chunk_size - 1) / chunk_size;
+    uint32_t floor = chunks < FT_TUNE_MIN_DEPTH ? chunks : FT_TUNE_MIN_DEPTH;
+
+    if (depth < floor) {
+        depth = floor;
+    }
+    if (depth > FT_MAX_WINDOW_SIZE) {
+        depth = FT_MAX_WINDOW_SIZE;
+    }
+    return (uint32_t)depth;
+}
+
+/* Initialize estimator */
+void path_estimator_init(PathEstimator *est) {
+    memset(est, 0, sizeof(*est));
+}
+
+/* Record RTT sample */
+void path_estimator_rtt(PathEstimator *est, uint64_t rtt_us) {
+    if (rtt_us > 0 && (est->min_rtt_us == 0 || rtt_us < est->min_rtt_us)) {
+        est->min_rtt_us = rtt_us;
+    }
+}
+
+/* Record acknowledged bytes */
+int path_estimator_update(PathEstimator *est, uint64_t acked_bytes, uint64_t now_us) {
+    /* Samples start at the first ACK, not while the pipe fills */
+    if (est->sample_start_us == 0) {
+        est->sample_start_us = now_us;
+        est->sample_start_bytes = acked_bytes;
+        return 0;
+    }
+
+    uint64_t elapsed_us = now_us - est->sample_start_us;
+    if (elapsed_us < FT_TUNE_SAMPLE_US || elapsed_us < est->min_rtt_us) {
+        return 0;
+    }
+
+    est->bw_samples[est->next_sample] = (acked_bytes - est->sample_start_bytes) * 1000000 / elapsed_us;
+    est->next_sample = (est->next_sample + 1) % FT_TUNE_BW_SAMPLES;
+    est->sample_start_us = now_us;
+    est->sample_start_bytes = acked_bytes;
+    return 1;
+}
+
+/* Windowed maximum delivery rate */
+uint64_t path_estimator_bandwidth(const PathEstimator *est) {
+    uint64_t bandwidth = 0;
+    for (uint32_t i = 0; i < FT_TUNE_BW_SAMPLES; i++) {
+        if (est->bw_samples[i] > bandwidth) {
+            bandwidth = est->bw_samples[i];
+        }
+    }
+    return bandwidth;
+}
+
+/* Bandwidth-delay product */
+uint64_t path_estimator_bdp(const PathEstimator *est) {
+    return path_estimator_bandwidth(est) * est->min_rtt_us / 1000000;
+}
+
+/* Window for the path */
+uint32_t path_estimator_window(const PathEstimator *est, uint32_t chunk_size,
+                               uint32_t min_window, uint32_t max_window) {
+    uint64_t window = (2 * path_estimator_bdp(est) + chunk_size - 1) / chunk_size + FT_SACK_EVERY_CHUNKS;
+
+    if (window < min_window) {
+        window = min_window;
+    }
+    if (window > max_window) {
+        window = max_window;
+    }
+    return (uint32_t)window;
+}
@@ -0,0 +1,63 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+
+#define FT_TUNE_LINK_RATE    1250000000ULL  /* Bytes/s (10 Gbit/s) assumed when only the RTT is known */
+#define FT_TUNE_MIN_CHUNKS   16             /* Files are cut into at least this many chunks... */
+#define FT_TUNE_MAX_CHUNKS   65536          /* ...and at most about this many */
+#define FT_TUNE_MIN_DEPTH    4              /* Fewest buffers a scaled depth keeps */
+#define FT_TUNE_SAMPLE_US    10000          /* Shortest delivery rate sample */
+#define FT_TUNE_BW_SAMPLES   8              /* Bandwidth is the best of this many recent samples */
+
+/* Chunk size for a file of file_size bytes: FT_DEFAULT_CHUNK_SIZE, doubled
+ * while half of max_window chunks would not cover the bandwidth-delay
+ * product of a FT_TUNE_LINK_RATE link with round trip rtt_us, or the file
+ * would have more than FT_TUNE_MAX_CHUNKS chunks, and halved while it
+ * would have fewer than FT_TUNE_MIN_CHUNKS; always within
+ * [FT_MIN_CHUNK_SIZE, max_chunk_size]. */
+uint32_t tune_chunk_size(uint64_t file_size, uint32_t max_chunk_size, uint64_t rtt_us, uint32_t max_window);
+
+/* Convert a buffer count given in FT_DEFAULT_CHUNK_SIZE chunks to chunks
+ * of chunk_size keeping about the same bytes, but no fewer than
+ * FT_TUNE_MIN_DEPTH (or chunks, if less) nor more than FT_MAX_WINDOW_SIZE */
+uint32_t tune_scale_depth(uint32_t chunks, uint32_t chunk_size);
+
+/*
+ * Bandwidth-delay product of a path, from the sender's acknowledgments.
+ * The RTT is the shortest time from sending a chunk to its ACK; the
+ * bandwidth the best delivery rate among the last FT_TUNE_BW_SAMPLES
+ * intervals of at least an RTT (and FT_TUNE_SAMPLE_US). Sizing the window
+ * at twice their product lets it grow while the window is what limits the
+ * rate, and stop once the link is: then the RTT of later chunks grows with
+ * the queue, but its minimum does not.
+ */
+typedef struct {
+    uint64_t min_rtt_us;                 /* 0 until measured */
+    uint64_t bw_samples[FT_TUNE_BW_SAMPLES];  /* Bytes/s */
+    uint32_t next_sample;
+    uint64_t sample_start_us;            /* 0 until the first ACK */
+    uint64_t sample_start_bytes;
+} PathEstimator;
+
+void path_estimator_init(PathEstimator *est);
+
+/* Record one chunk's round trip */
+void path_estimator_rtt(PathEstimator *est, uint64_t rtt_us);
+
+/* Record acked_bytes acknowledged in total by now_us. Returns 1 when a
+ * rate sample completed, so the estimate may have changed. */
+int path_estimator_update(PathEstimator *est, uint64_t acked_bytes, uint64_t now_us);
+
+/* Estimated bandwidth in bytes/s and bandwidth-delay product in bytes */
+uint64_t path_estimator_bandwidth(const PathEstimator *est);
+uint64_t path_estimator_bdp(const PathEstimator *est);
+
+/* Chunks of chunk_size to keep in flight: twice the BDP plus a SACK's
+ * worth, within [min_window, max_window] */
+uint32_t path_estimator_window(const PathEstimator *est, uint32_t chunk_size,
+                               uint32_t min_window, uint32_t max_window);
+
+#endif /* TUNING_H */
@@ -0,0 +1,470 @@
+#include "udp.h"
+#include "network.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FT_PLATFORM_LINUX
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+/* Big-endian field access */
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)(v >> 16));
+    put16(p + 2, (uint16_t)v);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, (uint32_t)(v >> 32));
+    put32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+/* Serialize datagram header */
+void udp_serialize_header(const UdpHeader *header, uint8_t *buffer) {
+    buffer[0] = header->type;
+    buffer[1] = header->fec_k;
+    buffer[2] = header->fec_m;
+    buffer[3] = header->flags;
+    put16(buffer + 4, header->fragment_size);
+    put16(buffer + 6, 0);
+    put64(buffer + 8, header->packet_number);
+    put64(buffer + 16, header->sequence);
+    put64(buffer + 24, header->chunk_id);
+    put32(buffer + 32, header->chunk_size);
+    put32(buffer + 36, header->chunk_crc);
+    put32(buffer + 40, header->wire_size);
+    put32(buffer + 44, header->index);
+}
+
+/* Parse datagram header */
+int udp_parse_header(const uint8_t *buffer, size_t size, UdpHeader *header) {
+    if (size < FT_UDP_HEADER_SIZE || buffer[0] < UDP_DATA || buffer[0] > UDP_REPORT) {
+        return -1;
+    }
+    header->type = buffer[0];
+    header->fec_k = buffer[1];
+    header->fec_m = buffer[2];
+    header->flags = buffer[3];
+    header->fragment_size = get16(buffer + 4);
+    header->packet_number = get64(buffer + 8);
+    header->sequence = get64(buffer + 16);
+    header->chunk_id = get64(buffer + 24);
+    header->chunk_size = get32(buffer + 32);
+    header->chunk_crc = get32(buffer + 36);
+    header->wire_size = get32(buffer + 40);
+    header->index = get32(buffer + 44);
+    return 0;
+}
+
+/* Serialize report */
+size_t udp_serialize_report(const UdpReport *report, uint8_t *buffer) {
+    uint32_t count = report->count < FT_UDP_REPORT_RANGES ? report->count : FT_UDP_REPORT_RANGES;
+    uint64_t below = report->largest + 1;
+    uint8_t *p = buffer + FT_UDP_REPORT_HEADER_SIZE;
+
+    buffer[0] = UDP_REPORT;
+    buffer[1] = buffer[2] = buffer[3] = 0;
+    put32(buffer + 4, count);
+    put64(buffer + 8, report->largest);
+    put32(buffer + 16, report->ack_delay_us);
+    put32(buffer + 20, 0);
+    for (uint32_t i = 0; i < count; i++, p += 8) {
+        put32(p, (uint32_t)(below - 1 - report->ranges[i].last));
+        put32(p + 4, (uint32_t)(report->ranges[i].last - report->ranges[i].first + 1));
+        below = report->ranges[i].first;
+    }
+    return (size_t)(p - buffer);
+}
+
+/* Parse report; ranges must descend and stay above packet number 0 */
+int udp_parse_report(const uint8_t *buffer, size_t size, UdpReport *report) {
+    if (size < FT_UDP_REPORT_HEADER_SIZE || buffer[0] != UDP_REPORT) {
+        return -1;
+    }
+    report->count = get32(buffer + 4);
+    report->largest = get64(buffer + 8);
+    report->ack_delay_us = get32(buffer + 16);
+    if (report->count > FT_UDP_REPORT_RANGES || size != FT_UDP_REPORT_HEADER_SIZE + (size_t)report->count * 8) {
+        return -1;
+    }
+
+    uint64_t below = report->largest + 1;
+    const uint8_t *p = buffer + FT_UDP_REPORT_HEADER_SIZE;
+    for (uint32_t i = 0; i < report->count; i++, p += 8) {
+        uint32_t gap = get32(p);
+        uint32_t length = get32(p + 4);
+        if (length == 0 || (uint64_t)gap + length > below) {
+            return -1;
+        }
+        report->ranges[i].last = below - 1 - gap;
+        report->ranges[i].first = report->ranges[i].last - (length - 1);
+        below = report->ranges[i].first;
+    }
+    return 0;
+}
+
+/* Fragments of a message */
+uint32_t udp_fragment_count(uint32_t wire_size) {
+    return (wire_size + FT_UDP_FRAGMENT_SIZE - 1) / FT_UDP_FRAGMENT_SIZE;
+}
+
+/* FEC groups of a message */
+uint32_t udp_group_count(uint32_t fragments, uint32_t fec_k) {
+    return fec_k == 0 ? 0 : (fragments + fec_k - 1) / fec_k;
+}
+
+/* Create a non-blocking UDP socket with large buffers */
+static int udp_socket(UdpSocket *udp, FTErrorCode *error) {
+    memset(udp, 0, sizeof(UdpSocket));
+    udp->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp->sock == INVALID_SOCKET_VALUE) {
+        LOG_ERROR("Failed to create UDP socket: %s", platform_get_socket_error(socket_errno));
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    if (socket_set_nonblocking(udp->sock, 1, error) != 0) {
+        close_socket(udp->sock);
+        udp->sock = INVALID_SOCKET_VALUE;
+        return -1;
+    }
+
+    /* A burst at the path's rate must fit while the other side is busy;
+     * the kernel caps these at net.core.rmem_max/wmem_max */
+    socket_set_buffer_size(udp->sock, 0, FT_UDP_SOCKET_BUFFER, NULL);
+    socket_set_buffer_size(udp->sock, 1, FT_UDP_SOCKET_BUFFER, NULL);
+    return 0;
+}
+
+/* Open server socket */
+int udp_open_server(UdpSocket *udp, socket_t tcp_sock, uint16_t *port, FTErrorCode *error) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getsockname(tcp_sock, (struct sockaddr*)&addr, &addr_len) != 0 || addr.sin_family != AF_INET) {
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    if (udp_socket(udp, error) != 0) {
+        return -1;
+    }
+
+    addr.sin_port = 0;
+    addr_len = sizeof(addr);
+    if (bind(udp->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(udp->sock, (struct sockaddr*)&addr, &addr_len) != 0) {
+        LOG_ERROR("Failed to bind UDP socket: %s", platform_get_socket_error(socket_errno));
+        udp_close(udp);
+        if (error) *error = FT_ERR_BIND;
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+
+#ifdef FT_PLATFORM_LINUX
+    /* Receive runs of datagrams from the client as one (Linux 5.0+) */
+    int enable = 1;
+    udp->gro = setsockopt(udp->sock, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+#endif
+    return 0;
+}
+
+/* Open client socket */
+int udp_open_client(UdpSocket *udp, socket_t tcp_sock, uint16_t port, FTErrorCode *error) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getpeername(tcp_sock, (struct sockaddr*)&addr, &addr_len) != 0 || addr.sin_family != AF_INET) {
+        if (error) *error = FT_ERR_SOCKET;
+        return -1;
+    }
+    if (udp_socket(udp, error) != 0) {
+        return -1;
+    }
+
+    addr.sin_port = htons(port);
+    if (udp_connect(udp, &addr, error) != 0) {
+        udp_close(udp);
+        return -1;
+    }
+
+#ifdef FT_PLATFORM_LINUX
+    /* Segmentation offload is per send (a UDP_SEGMENT message); see
+     * whether the kernel knows the option at all (Linux 4.18+) */
+    int size = 0;
+    socklen_t size_len = sizeof(size);
+    udp->gso = getsockopt(udp->sock, SOL_UDP, UDP_SEGMENT, &size, &size_len) == 0;
+#endif
+    return 0;
+}
+
+/* Connect to the peer */
+int udp_connect(UdpSocket *udp, const struct sockaddr_in *peer, FTErrorCode *error) {
+    if (connect(udp->sock, (const struct sockaddr*)peer, sizeof(*peer)) != 0) {
+        LOG_ERROR("Failed to connect UDP socket: %s", platform_get_socket_error(socket_errno));
+        if (error) *error = FT_ERR_CONNECT;
+        return -1;
+    }
+    return 0;
+}
+
+/* Close socket */
+void udp_close(UdpSocket *udp) {
+    if (udp->sock != INVALID_SOCKET_VALUE) {
+        close_socket(udp->sock);
+        udp->sock = INVALID_SOCKET_VALUE;
+    }
+}
+
+/* A full socket buffer is not an error: the caller sends the rest later */
+static int udp_would_block(int code) {
+#ifdef FT_PLATFORM_WINDOWS
+    return code == WSAEWOULDBLOCK;
+#else
+    return code == EAGAIN || code == EWOULDBLOCK || code == ENOBUFS;
+#endif
+}
+
+#ifdef FT_PLATFORM_LINUX
+/* Send with sendmmsg(), equal datagrams batched with UDP_SEGMENT */
+int udp_send(UdpSocket *udp, const UdpOut *packets, int count, FTErrorCode *error) {
+    struct mmsghdr msgs[FT_UDP_BATCH];
+    struct iovec iovs[FT_UDP_SEND_MAX * 2];
+    int first[FT_UDP_BATCH + 1];     /* Packet each message starts at */
+    union {
+        char           space[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } controls[FT_UDP_BATCH];
+    int sent = 0;
+
+    while (sent < count) {
+        int msg_count = 0;
+        int iov_count = 0;
+        int next = sent;
+
+        /* A batch takes datagrams of the size of its first; a shorter one ends it */
+        while (next < count && msg_count < FT_UDP_BATCH && iov_count + 2 <= FT_UDP_SEND_MAX * 2) {
+            size_t size = packets[next].head_len + packets[next].payload_len;
+            int batch = 0;
+            struct msghdr *msg = &msgs[msg_count].msg_hdr;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_iov = &iovs[iov_count];
+            first[msg_count] = next;
+            while (next < count && iov_count + 2 <= FT_UDP_SEND_MAX * 2 &&
+                   (batch == 0 || (udp->gso && batch < FT_UDP_GSO_MAX &&
+                                   packets[next].head_len + packets[next].payload_len <= size))) {
+                size_t this_size = packets[next].head_len + packets[next].payload_len;
+                iovs[iov_count].iov_base = (void*)packets[next].head;
+                iovs[iov_count++].iov_len = packets[next].head_len;
+                if (packets[next].payload_len > 0) {
+                    iovs[iov_count].iov_base = (void*)packets[next].payload;
+                    iovs[iov_count++].iov_len = packets[next].payload_len;
+                }
+                next++;
+                batch++;
+                if (this_size < size) {
+                    break;
+                }
+            }
+            msg->msg_iovlen = (size_t)(&iovs[iov_count] - msg->msg_iov);
+            if (batch > 1) {
+                memset(&controls[msg_count], 0, sizeof(controls[msg_count]));
+                msg->msg_control = controls[msg_count].space;
+                msg->msg_controllen = sizeof(controls[msg_count].space);
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = (uint16_t)size;
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+            msg_count++;
+        }
+        first[msg_count] = next;
+
+        int done = sendmmsg(udp->sock, msgs, (unsigned int)msg_count, 0);
+        if (done < 0) {
+            int code = errno;
+            if (udp_would_block(code) || code == ECONNREFUSED) {
+                /* Refused: an ICMP error for an earlier datagram; the loss shows in the reports */
+                return sent;
+            }
+            if (udp->gso && (code == EIO || code == EINVAL)) {
+                /* No segmentation offload on this route's device */
+                LOG_DEBUG("UDP segmentation offload unavailable, sending datagrams one by one");
+                udp->gso = 0;
+                continue;
+            }
+            LOG_ERROR("Failed to send datagrams: %s", platform_get_socket_error(code));
+            if (error) *error = FT_ERR_SEND;
+            return -1;
+        }
+        sent = first[done];
+        if (done < msg_count) {
+            return sent;
+        }
+    }
+    return sent;
+}
+#else
+/* Send one datagram at a time */
+int udp_send(UdpSocket *udp, const UdpOut *packets, int count, FTErrorCode *error) {
+    uint8_t datagram[FT_UDP_DATAGRAM_SIZE];
+
+    for (int i = 0; i < count; i++) {
+        size_t length = packets[i].head_len + packets[i].payload_len;
+        if (length > sizeof(datagram)) {
+            if (error) *error = FT_ERR_INVALID_ARG;
+            return -1;
+        }
+        memcpy(datagram, packets[i].head, packets[i].head_len);
+        if (packets[i].payload_len > 0) {
+            memcpy(datagram + packets[i].head_len, packets[i].payload, packets[i].payload_len);
+        }
+        if (send(udp->sock, (const char*)datagram, (int)length, 0) < 0) {
+            int code = socket_errno;
+#ifdef FT_PLATFORM_WINDOWS
+            if (udp_would_block(code) || code == WSAECONNRESET) {
+#else
+            if (udp_would_block(code) || code == ECONNREFUSED) {
+#endif
+                return i;
+            }
+            LOG_ERROR("Failed to send datagram: %s", platform_get_socket_error(code));
+            if (error) *error = FT_ERR_SEND;
+            return -1;
+        }
+    }
+    return count;
+}
+#endif
+
+/* Allocate receive buffers */
+int udp_recv_batch_init(UdpRecvBatch *batch, const UdpSocket *udp) {
+    memset(batch, 0, sizeof(UdpRecvBatch));
+    batch->buffer_size = udp->gro ? FT_UDP_GRO_BUFFER : FT_UDP_DATAGRAM_SIZE + 64;
+    batch->buffer_count = udp->gro ? FT_UDP_GRO_BATCH : FT_UDP_BATCH;
+    batch->buffers = (uint8_t*)malloc(batch->buffer_size * (size_t)batch->buffer_count);
+    return batch->buffers != NULL ? 0 : -1;
+}
+
+/* Free receive buffers */
+void udp_recv_batch_free(UdpRecvBatch *batch) {
+    free(batch->buffers);
+    batch->buffers = NULL;
+}
+
+/* Add a received buffer's datagrams: a GRO batch is equal datagrams of
+ * segment bytes, the last maybe shorter */
+static void batch_add(UdpRecvBatch *batch, int buffer, size_t length, size_t segment) {
+    const uint8_t *data = batch->buffers + (size_t)buffer * batch->buffer_size;
+    if (segment == 0) {
+        segment = length;
+    }
+    for (size_t offset = 0; offset < length && batch->count < FT_UDP_RECV_MAX; offset += segment) {
+        batch->data[batch->count] = data + offset;
+        batch->length[batch->count] = (uint16_t)(length - offset < segment ? length - offset : segment);
+        batch->source[batch->count] = (uint8_t)buffer;
+        batch->count++;
+    }
+}
+
+#ifdef FT_PLATFORM_LINUX
+/* Receive with recvmmsg(), splitting GRO batches */
+int udp_recv(UdpSocket *udp, UdpRecvBatch *batch, FTErrorCode *error) {
+    struct mmsghdr msgs[FT_UDP_BATCH];
+    struct iovec iovs[FT_UDP_BATCH];
+    union {
+        char           space[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controls[FT_UDP_BATCH];
+
+    memset(msgs, 0, sizeof(msgs[0]) * (size_t)batch->buffer_count);
+    for (int i = 0; i < batch->buffer_count; i++) {
+        iovs[i].iov_base = batch->buffers + (size_t)i * batch->buffer_size;
+        iovs[i].iov_len = batch->buffer_size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &batch->sources[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(batch->sources[i]);
+        msgs[i].msg_hdr.msg_control = controls[i].space;
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].space);
+    }
+
+    batch->count = 0;
+    int received = recvmmsg(udp->sock, msgs, (unsigned int)batch->buffer_count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (udp_would_block(errno) || errno == ECONNREFUSED) {
+            return 0;
+        }
+        LOG_ERROR("Failed to receive datagrams: %s", platform_get_socket_error(errno));
+        if (error) *error = FT_ERR_RECV;
+        return -1;
+    }
+
+    for (int i = 0; i < received; i++) {
+        size_t segment = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                segment = (size_t)size;
+            }
+        }
+        batch_add(batch, i, msgs[i].msg_len, segment);
+    }
+    return batch->count;
+}
+#else
+/* Receive one datagram at a time */
+int udp_recv(UdpSocket *udp, UdpRecvBatch *batch, FTErrorCode *error) {
+    batch->count = 0;
+    for (int i = 0; i < batch->buffer_count; i++) {
+        socklen_t source_len = sizeof(batch->sources[i]);
+        int received = (int)recvfrom(udp->sock, (char*)(batch->buffers + (size_t)i * batch->buffer_size),
+                                     (int)batch->buffer_size, 0, (struct sockaddr*)&batch->sources[i],
+                                     &source_len);
+        if (received < 0) {
+            int code = socket_errno;
+#ifdef FT_PLATFORM_WINDOWS
+            if (udp_would_block(code) || code == WSAECONNRESET) {
+#else
+            if (udp_would_block(code) || code == ECONNREFUSED) {
+#endif
+                break;
+            }
+            LOG_ERROR("Failed to receive datagram: %s", platform_get_socket_error(code));
+            if (error) *error = FT_ERR_RECV;
+            return -1;
+        }
+        batch_add(batch, i, (size_t)received, 0);
+    }
+    return batch->count;
+}
+#endif
@@ -0,0 +1,155 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+
+/*
+ * UDP data path (FT_FILE_UDP). Control messages, SACKs and verification
+ * stay on the TCP connection; only the chunks go over UDP, as messages of
+ * FT_UDP_FRAGMENT_SIZE fragments carried by datagrams with a
+ * FT_UDP_HEADER_SIZE header (big-endian):
+ *
+ *   type(1) fec_k(1) fec_m(1) flags(1) fragment_size(2) reserved(2)
+ *   packet_number(8) sequence(8) chunk_id(8) chunk_size(4) chunk_crc(4)
+ *   wire_size(4) index(4)
+ *
+ * Every datagram a sender sends takes the next packet number, also when
+ * it carries a fragment again, so the receiver's REPORTs (the packet
+ * numbers received, as ranges) tell exactly which transmissions arrived:
+ * the gaps are the NACKs. A message is the CHUNK_DATA it stands for, with
+ * its sequence number; chunk_offset is chunk_id * the file's chunk size.
+ *
+ * With FEC the fragments are grouped fec_k at a time (the last group may
+ * be shorter) and each group gets fec_m Reed-Solomon parity fragments
+ * (fec.h), index group * fec_m + j; the short last fragment counts as
+ * zero-padded. Any fec_k of a group's fragments rebuild it, so the sender
+ * only resends a fragment once fewer than that can still arrive.
+ */
+
+#define FT_UDP_DATAGRAM_SIZE   1472        /* Fits a 1500-byte MTU after the IPv4 and UDP headers */
+#define FT_UDP_HEADER_SIZE     48
+#define FT_UDP_FRAGMENT_SIZE   (FT_UDP_DATAGRAM_SIZE - FT_UDP_HEADER_SIZE)
+#define FT_UDP_REPORT_HEADER_SIZE 24
+#define FT_UDP_REPORT_RANGES   64          /* Packet number ranges per REPORT */
+#define FT_UDP_REPORT_SPAN     8192        /* ...below the largest packet number received */
+#define FT_UDP_REPORT_SIZE     (FT_UDP_REPORT_HEADER_SIZE + FT_UDP_REPORT_RANGES * 8)
+#define FT_UDP_BATCH           64          /* Datagrams (or GSO batches) per system call */
+#define FT_UDP_SEND_MAX        512         /* Datagrams per udp_send() system call */
+#define FT_UDP_GSO_MAX         44          /* Datagrams in one GSO or GRO batch (64 KB) */
+#define FT_UDP_GRO_BATCH       16          /* GRO batches per recvmmsg() */
+#define FT_UDP_GRO_BUFFER      65536
+#define FT_UDP_RECV_MAX        (FT_UDP_GRO_BATCH * FT_UDP_GSO_MAX)
+#define FT_UDP_SOCKET_BUFFER   (8 * 1024 * 1024)
+#define FT_UDP_HELLO_INTERVAL_MS 200
+#define FT_UDP_HELLO_ATTEMPTS  10
+
+/* Datagram types */
+typedef enum {
+    UDP_DATA = 1,                  /* A fragment of a message */
+    UDP_PARITY = 2,                /* A parity fragment of an FEC group */
+    UDP_HELLO = 3,                 /* Client: sequence = the UDP_SETUP token */
+    UDP_HELLO_ACK = 4,             /* Server: the socket is connected to the client's */
+    UDP_REPORT = 5                 /* Server: packet numbers received (UdpReport) */
+} UdpPacketType;
+
+#define FT_UDP_FLAG_LZ4        0x01        /* The message is an LZ4 block of the chunk */
+
+/* Datagram header */
+typedef struct {
+    uint8_t  type;                 /* UdpPacketType */
+    uint8_t  fec_k;                /* Data fragments per FEC group (0 = no FEC) */
+    uint8_t  fec_m;                /* Parity fragments per group */
+    uint8_t  flags;                /* FT_UDP_FLAG_* */
+    uint16_t fragment_size;
+    uint64_t packet_number;
+    uint64_t sequence;             /* Message sequence number (HELLO: token) */
+    uint64_t chunk_id;
+    uint32_t chunk_size;
+    uint32_t chunk_crc;
+    uint32_t wire_size;            /* Bytes of the message */
+    uint32_t index;
+} UdpHeader;
+
+/* A REPORT: type(1) reserved(3) count(4) largest(8) ack_delay_us(4)
+ * reserved(4), then count ranges of gap(4) length(4), newest first. A
+ * range ends gap packet numbers below where the previous one started (the
+ * first: below largest + 1). */
+typedef struct {
+    uint64_t largest;              /* Largest packet number received */
+    uint32_t ack_delay_us;         /* How long after receiving it this was sent */
+    uint32_t count;
+    struct {
+        uint64_t first;
+        uint64_t last;
+    } ranges[FT_UDP_REPORT_RANGES];
+} UdpReport;
+
+void udp_serialize_header(const UdpHeader *header, uint8_t *buffer);
+int udp_parse_header(const uint8_t *buffer, size_t size, UdpHeader *header);
+
+/* Serialize a report; returns bytes written (at most FT_UDP_REPORT_SIZE) */
+size_t udp_serialize_report(const UdpReport *report, uint8_t *buffer);
+int udp_parse_report(const uint8_t *buffer, size_t size, UdpReport *report);
+
+/* Fragments of a wire_size message, and the FEC groups they form */
+uint32_t udp_fragment_count(uint32_t wire_size);
+uint32_t udp_group_count(uint32_t fragments, uint32_t fec_k);
+
+/* A UDP socket and the batching the kernel offers for it */
+typedef struct {
+    socket_t sock;
+    int      gso;                  /* Send batches of equal datagrams as one (UDP_SEGMENT) */
+    int      gro;                  /* Receive them likewise (UDP_GRO) */
+} UdpSocket;
+
+/* Server: non-blocking socket on the address tcp_sock was reached at, any
+ * port (returned in *port) */
+int udp_open_server(UdpSocket *udp, socket_t tcp_sock, uint16_t *port, FTErrorCode *error);
+
+/* Client: non-blocking socket connected to port on tcp_sock's peer */
+int udp_open_client(UdpSocket *udp, socket_t tcp_sock, uint16_t port, FTErrorCode *error);
+
+/* Connect the server's socket to the client's once its HELLO arrives */
+int udp_connect(UdpSocket *udp, const struct sockaddr_in *peer, FTErrorCode *error);
+
+void udp_close(UdpSocket *udp);
+
+/* One datagram to send: head and payload are sent back to back */
+typedef struct {
+    const uint8_t *head;
+    size_t         head_len;
+    const uint8_t *payload;
+    size_t         payload_len;
+} UdpOut;
+
+/* Send up to count datagrams on a connected socket, runs of equal ones as
+ * GSO batches, many batches per sendmmsg() on Linux (FT_UDP_SEND_MAX
+ * datagrams per call). Returns the number sent (fewer once the socket
+ * buffer is full), -1 on error. */
+int udp_send(UdpSocket *udp, const UdpOut *packets, int count, FTErrorCode *error);
+
+/* Datagrams received by one udp_recv(): with GRO, FT_UDP_GRO_BATCH
+ * buffers of a GRO batch each, otherwise FT_UDP_BATCH of a datagram */
+typedef struct {
+    uint8_t            *buffers;
+    size_t              buffer_size;
+    int                 buffer_count;
+    struct sockaddr_in  sources[FT_UDP_BATCH];
+    int                 count;       /* Datagrams below */
+    const uint8_t      *data[FT_UDP_RECV_MAX];
+    uint16_t            length[FT_UDP_RECV_MAX];
+    uint8_t             source[FT_UDP_RECV_MAX];   /* Index into sources */
+} UdpRecvBatch;
+
+/* Buffers for receiving on sockets like udp */
+int udp_recv_batch_init(UdpRecvBatch *batch, const UdpSocket *udp);
+void udp_recv_batch_free(UdpRecvBatch *batch);
+
+/* Receive what the socket holds, up to a batch (GRO batches split into
+ * their datagrams). Returns the datagram count, 0 if none, -1 on error. */
+int udp_recv(UdpSocket *udp, UdpRecvBatch *batch, FTErrorCode *error);
+
+#endif /* UDP_H */
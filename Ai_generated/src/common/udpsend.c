@@ -0,0 +1,1077 @@
+#include "udpsend.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE               UINT32_MAX
+#define SENT_MASK          (FT_UDP_SENT_RING - 1)
+
+#define LOSS_PACKETS       3             /* A packet this many numbers below one received is lost */
+#define LOSS_MIN_DELAY_US  1000          /* ...as is one this much older, at the least */
+#define PTO_MIN_US         10000
+#define PTO_MAX_BACKOFF    6
+#define PUMP_MAX_WAIT_MS   100           /* The window is checked for ended chunks this often */
+#define RECV_ROUNDS        16            /* udp_recv() calls per pump iteration */
+
+#define CC_STARTUP_GAIN    2.885         /* 2 / ln 2: the rate doubles every round */
+#define CC_MIN_RTT_WINDOW_US 10000000ULL
+#define CC_PROBE_RTT_US    200000ULL
+#define CC_INITIAL_PACKETS 32
+#define CC_MIN_PACKETS     4
+#define CC_BURST_US        2000          /* Pacing lets this much of the rate out at once */
+
+/* Unit states */
+enum {
+    FRAG_UNSENT = 0,
+    FRAG_INFLIGHT,
+    FRAG_LOST,                           /* Its group may still arrive whole without it */
+    FRAG_QUEUED,                         /* To be sent again */
+    FRAG_ACKED
+};
+
+/* Sent packet states */
+enum {
+    SENT_FREE = 0,
+    SENT_INFLIGHT,
+    SENT_ACKED,
+    SENT_LOST
+};
+
+/* A datagram handed to udp_send(), and what to restore if it did not go out */
+struct UdpEmitted {
+    uint32_t message;
+    uint32_t unit;
+    uint32_t position;                   /* Send order position of a first transmission */
+    uint8_t  prev_state;
+    uint64_t prev_packet;
+};
+
+static const double probe_bw_gains[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/* Data fragments per group */
+static uint32_t group_k(const UdpSender *s) {
+    return s->fec_k > 0 ? s->fec_k : 1;
+}
+
+/* Data fragments of a group */
+static uint32_t group_size(const UdpSender *s, const UdpMessage *msg, uint32_t group) {
+    uint32_t k = group_k(s);
+    uint32_t rest = msg->fragments - group * k;
+    return rest < k ? rest : k;
+}
+
+/* Group of a unit */
+static uint32_t unit_group(const UdpSender *s, const UdpMessage *msg, uint32_t unit) {
+    return unit < msg->fragments ? unit / group_k(s) : (unit - msg->fragments) / s->fec_m;
+}
+
+/* Payload bytes of a unit */
+static size_t unit_size(const UdpMessage *msg, uint32_t unit) {
+    if (unit + 1 == msg->fragments) {
+        return msg->header.wire_size - (size_t)unit * FT_UDP_FRAGMENT_SIZE;
+    }
+    return FT_UDP_FRAGMENT_SIZE;
+}
+
+/* Payload of a unit */
+static const uint8_t* unit_payload(const UdpMessage *msg, uint32_t unit) {
+    if (unit < msg->fragments) {
+        return msg->wire + (size_t)unit * FT_UDP_FRAGMENT_SIZE;
+    }
+    return msg->parity + (size_t)(unit - msg->fragments) * FT_UDP_FRAGMENT_SIZE;
+}
+
+/* Group counter of a unit state */
+static uint16_t* state_counter(UdpMessage *msg, uint32_t group, uint8_t state) {
+    switch (state) {
+    case FRAG_UNSENT:   return &msg->group_unsent[group];
+    case FRAG_INFLIGHT: return &msg->group_inflight[group];
+    case FRAG_QUEUED:   return &msg->group_queued[group];
+    case FRAG_ACKED:    return &msg->group_acked[group];
+    default:            return NULL;
+    }
+}
+
+/* Move a unit to another state, keeping the counts */
+static void set_state(UdpSender *s, UdpMessage *msg, uint32_t unit, uint8_t state) {
+    uint32_t group = unit_group(s, msg, unit);
+    uint16_t *counter = state_counter(msg, group, msg->state[unit]);
+    if (counter != NULL) {
+        (*counter)--;
+    }
+    if (msg->state[unit] == FRAG_QUEUED) {
+        s->queued--;
+    }
+    counter = state_counter(msg, group, state);
+    if (counter != NULL) {
+        (*counter)++;
+    }
+    if (state == FRAG_QUEUED) {
+        s->queued++;
+    }
+    msg->state[unit] = state;
+}
+
+/* Queue a unit to be sent again */
+static void queue_push(UdpMessage *msg, uint32_t unit, int front) {
+    if (msg->queue_head == NONE) {
+        msg->queue_next[unit] = NONE;
+        msg->queue_head = msg->queue_tail = unit;
+    } else if (front) {
+        msg->queue_next[unit] = msg->queue_head;
+        msg->queue_head = unit;
+    } else {
+        msg->queue_next[unit] = NONE;
+        msg->queue_next[msg->queue_tail] = unit;
+        msg->queue_tail = unit;
+    }
+}
+
+static void queue_pop(UdpMessage *msg) {
+    msg->queue_head = msg->queue_next[msg->queue_head];
+    if (msg->queue_head == NONE) {
+        msg->queue_tail = NONE;
+    }
+}
+
+/* End a message and release its hold on the window slot */
+static void message_end(UdpSender *s, UdpMessage *msg) {
+    if (msg->prev != NONE) {
+        s->messages[msg->prev].next = msg->next;
+    } else {
+        s->active_head = msg->next;
+    }
+    if (msg->next != NONE) {
+        s->messages[msg->next].prev = msg->prev;
+    } else {
+        s->active_tail = msg->prev;
+    }
+
+    for (uint32_t g = 0; g < msg->groups; g++) {
+        s->queued -= msg->group_queued[g];
+    }
+    msg->active = 0;
+    free(msg->parity);
+    msg->parity = NULL;
+    send_window_release(s->window, msg->slot);
+}
+
+/* Send as many more of a group's lost units as it takes for the group to
+ * be able to arrive whole again, data before parity */
+static void requeue_group(UdpSender *s, UdpMessage *msg, uint32_t group) {
+    int need = (int)group_size(s, msg, group) - msg->group_acked[group] - msg->group_inflight[group] -
+               msg->group_unsent[group] - msg->group_queued[group];
+    if (need <= 0) {
+        return;
+    }
+
+    uint32_t first = group * group_k(s);
+    uint32_t count = group_size(s, msg, group);
+    for (uint32_t i = 0; i < count + s->fec_m && need > 0; i++) {
+        uint32_t unit = i < count ? first + i : msg->fragments + group * s->fec_m + (i - count);
+        if (msg->state[unit] == FRAG_LOST) {
+            set_state(s, msg, unit, FRAG_QUEUED);
+            queue_push(msg, unit, 0);
+            need--;
+        }
+    }
+}
+
+/* Message a sent packet belongs to, if it is still being sent */
+static UdpMessage* packet_message(UdpSender *s, const UdpSentPacket *packet) {
+    UdpMessage *msg = &s->messages[packet->message];
+    return msg->active && msg->sequence == packet->sequence ? msg : NULL;
+}
+
+/* A packet was lost */
+static void declare_lost(UdpSender *s, UdpSentPacket *packet) {
+    packet->state = SENT_LOST;
+    s->bytes_in_flight -= packet->size;
+    s->cc.round_lost += packet->size;
+    s->lost++;
+
+    UdpMessage *msg = packet_message(s, packet);
+    if (msg != NULL && msg->state[packet->unit] == FRAG_INFLIGHT &&
+        msg->last_packet[packet->unit] == packet->packet_number) {
+        set_state(s, msg, packet->unit, FRAG_LOST);
+        requeue_group(s, msg, unit_group(s, msg, packet->unit));
+    }
+}
+
+/* A packet's unit arrived (possibly through an earlier transmission) */
+static void unit_acked(UdpSender *s, const UdpSentPacket *packet) {
+    UdpMessage *msg = packet_message(s, packet);
+    if (msg == NULL || msg->state[packet->unit] == FRAG_ACKED) {
+        return;
+    }
+
+    uint32_t group = unit_group(s, msg, packet->unit);
+    set_state(s, msg, packet->unit, FRAG_ACKED);
+    if (msg->group_acked[group] == group_size(s, msg, group) && ++msg->groups_done == msg->groups) {
+        message_end(s, msg);
+    }
+}
+
+/* Skip past packets no longer in flight */
+static void advance_oldest(UdpSender *s) {
+    while (s->oldest_inflight < s->next_packet) {
+        const UdpSentPacket *packet = &s->sent[s->oldest_inflight & SENT_MASK];
+        if (packet->packet_number == s->oldest_inflight && packet->state == SENT_INFLIGHT) {
+            break;
+        }
+        s->oldest_inflight++;
+    }
+}
+
+/* Best delivery rate of the recent rounds */
+static uint64_t cc_bandwidth(const UdpCongestion *cc) {
+    uint64_t best = 0;
+    for (int i = 0; i < FT_UDP_BW_ROUNDS; i++) {
+        if (cc->bw_rounds[i] > best) {
+            best = cc->bw_rounds[i];
+        }
+    }
+    return best;
+}
+
+/* Bandwidth-delay product in bytes */
+static uint64_t cc_bdp(const UdpCongestion *cc) {
+    return cc_bandwidth(cc) * cc->min_rtt_us / 1000000;
+}
+
+/* Pacing rate and congestion window of the current mode */
+static void cc_update_rates(UdpCongestion *cc) {
+    static const double gains[][2] = {
+        [UDP_CC_STARTUP]   = { CC_STARTUP_GAIN, CC_STARTUP_GAIN },
+        [UDP_CC_DRAIN]     = { 1.0 / CC_STARTUP_GAIN, CC_STARTUP_GAIN },
+        [UDP_CC_PROBE_BW]  = { 1.0, 2.0 },
+        [UDP_CC_PROBE_RTT] = { 1.0, 1.0 },
+    };
+    cc->pacing_gain = cc->mode == UDP_CC_PROBE_BW ? probe_bw_gains[cc->cycle] : gains[cc->mode][0];
+    cc->cwnd_gain = gains[cc->mode][1];
+
+    uint64_t bw = cc_bandwidth(cc);
+    uint64_t rate, cwnd;
+    if (bw == 0) {
+        /* Nothing measured yet: an initial window per handshake RTT */
+        uint64_t rtt_us = cc->min_rtt_us > 0 ? cc->min_rtt_us : 1000;
+        rate = (uint64_t)(cc->pacing_gain * CC_INITIAL_PACKETS * FT_UDP_DATAGRAM_SIZE * 1e6 / rtt_us);
+        cwnd = CC_INITIAL_PACKETS * FT_UDP_DATAGRAM_SIZE;
+    } else {
+        rate = (uint64_t)(cc->pacing_gain * bw);
+        cwnd = (uint64_t)(cc->cwnd_gain * cc_bdp(cc)) + 3 * FT_UDP_GSO_MAX * FT_UDP_DATAGRAM_SIZE;
+    }
+
+    /* Startup only speeds up */
+    if (cc->mode == UDP_CC_STARTUP && rate < cc->pacing_rate) {
+        rate = cc->pacing_rate;
+    }
+    if (cc->mode == UDP_CC_PROBE_RTT || cwnd < CC_MIN_PACKETS * FT_UDP_DATAGRAM_SIZE) {
+        cwnd = CC_MIN_PACKETS * FT_UDP_DATAGRAM_SIZE;
+    }
+    cc->pacing_rate = rate;
+    cc->cwnd = cwnd;
+}
+
+/* Enter PROBE_BW */
+static void cc_probe_bw(UdpCongestion *cc, uint64_t now_us) {
+    cc->mode = UDP_CC_PROBE_BW;
+    cc->cycle = 2 + (int)(cc->round % 6);     /* Not on the phases that move the rate */
+    cc->cycle_stamp_us = now_us;
+}
+
+/* Record an RTT sample (0: none) */
+static void cc_rtt(UdpCongestion *cc, uint64_t rtt_us, uint64_t ack_delay_us, uint64_t now_us) {
+    if (rtt_us == 0) {
+        return;
+    }
+    if (cc->min_rtt_us == 0 || rtt_us <= cc->min_rtt_us || now_us - cc->min_rtt_stamp_us > CC_MIN_RTT_WINDOW_US) {
+        if (cc->mode != UDP_CC_PROBE_RTT && cc->min_rtt_us != 0 &&
+            now_us - cc->min_rtt_stamp_us > CC_MIN_RTT_WINDOW_US && rtt_us > cc->min_rtt_us) {
+            /* The estimate is stale and nothing since matched it: drain the queue to measure again */
+            cc->mode = UDP_CC_PROBE_RTT;
+            cc->probe_rtt_done_us = 0;
+        }
+        cc->min_rtt_us = rtt_us;
+        cc->min_rtt_stamp_us = now_us;
+    }
+
+    /* The server's delay in reporting is not the path's */
+    uint64_t adjusted = rtt_us >= cc->min_rtt_us + ack_delay_us ? rtt_us - ack_delay_us : rtt_us;
+    if (cc->srtt_us == 0) {
+        cc->srtt_us = adjusted;
+        cc->rttvar_us = adjusted / 2;
+    } else {
+        uint64_t deviation = cc->srtt_us > adjusted ? cc->srtt_us - adjusted : adjusted - cc->srtt_us;
+        cc->rttvar_us = (3 * cc->rttvar_us + deviation) / 4;
+        cc->srtt_us = (7 * cc->srtt_us + adjusted) / 8;
+    }
+    cc->latest_rtt_us = adjusted;
+}
+
+/* Update the model after a REPORT acknowledged data; sample is the newest
+ * packet it acknowledged */
+static void cc_on_ack(UdpSender *s, const UdpSentPacket *sample, uint64_t now_us) {
+    UdpCongestion *cc = &s->cc;
+    int round_start = 0;
+
+    if (sample->delivered >= cc->next_round_delivered) {
+        cc->next_round_delivered = s->delivered;
+        cc->round++;
+        round_start = 1;
+
+        /* A round that lost over a fifth of what it sent: the path is
+         * slower than the estimate */
+        uint64_t total = cc->round_delivered + cc->round_lost;
+        if (total > 0 && cc->round_lost * 5 > total) {
+            for (int i = 0; i < FT_UDP_BW_ROUNDS; i++) {
+                cc->bw_rounds[i] = cc->bw_rounds[i] / 100 * 85;
+            }
+            if (cc->mode == UDP_CC_STARTUP) {
+                cc->filled = 1;
+            }
+        }
+        cc->round_delivered = 0;
+        cc->round_lost = 0;
+        cc->bw_rounds[cc->round % FT_UDP_BW_ROUNDS] = 0;
+    }
+
+    /* Delivery rate since the sample was sent, over at least its flight */
+    uint64_t send_us = sample->sent_us - sample->first_sent_us;
+    uint64_t ack_us = now_us - sample->delivered_us;
+    uint64_t interval = send_us > ack_us ? send_us : ack_us;
+    if (interval > 0 && interval >= cc->min_rtt_us && s->delivered > sample->delivered) {
+        uint64_t rate = (s->delivered - sample->delivered) * 1000000 / interval;
+        uint64_t *best = &cc->bw_rounds[cc->round % FT_UDP_BW_ROUNDS];
+        if ((!sample->app_limited || rate > cc_bandwidth(cc)) && rate > *best) {
+            *best = rate;
+        }
+    }
+
+    uint64_t bw = cc_bandwidth(cc);
+    if (round_start && !cc->filled && !sample->app_limited) {
+        if (bw >= cc->full_bw / 4 * 5) {
+            cc->full_bw = bw;
+            cc->full_bw_rounds = 0;
+        } else if (++cc->full_bw_rounds >= 3) {
+            cc->filled = 1;
+        }
+    }
+
+    uint64_t bdp = cc_bdp(cc);
+    switch (cc->mode) {
+    case UDP_CC_STARTUP:
+        if (cc->filled) {
+            cc->mode = UDP_CC_DRAIN;
+        }
+        break;
+    case UDP_CC_DRAIN:
+        if (s->bytes_in_flight <= bdp) {
+            cc_probe_bw(cc, now_us);
+        }
+        break;
+    case UDP_CC_PROBE_BW: {
+        int elapsed = now_us - cc->cycle_stamp_us > cc->min_rtt_us;
+        double gain = probe_bw_gains[cc->cycle];
+        int advance = elapsed;
+        if (gain > 1.0) {
+            advance = elapsed && (s->bytes_in_flight >= bdp / 4 * 5 || cc->round_lost > 0 || s->app_limited);
+        } else if (gain < 1.0) {
+            advance = elapsed || s->bytes_in_flight <= bdp;
+        }
+        if (advance) {
+            cc->cycle = (cc->cycle + 1) % 8;
+            cc->cycle_stamp_us = now_us;
+        }
+        break;
+    }
+    case UDP_CC_PROBE_RTT:
+        if (cc->probe_rtt_done_us == 0 && s->bytes_in_flight <= CC_MIN_PACKETS * FT_UDP_DATAGRAM_SIZE) {
+            cc->probe_rtt_done_us = now_us + CC_PROBE_RTT_US;
+            cc->probe_rtt_round = cc->round;
+        } else if (cc->probe_rtt_done_us != 0 && now_us >= cc->probe_rtt_done_us &&
+                   cc->round > cc->probe_rtt_round) {
+            cc->min_rtt_stamp_us = now_us;
+            if (cc->filled) {
+                cc_probe_bw(cc, now_us);
+            } else {
+                cc->mode = UDP_CC_STARTUP;
+            }
+        }
+        break;
+    }
+    cc_update_rates(cc);
+}
+
+/* Take a REPORT */
+static void on_report(UdpSender *s, const UdpReport *report, uint64_t now_us) {
+    UdpSentPacket sample;
+    int have_sample = 0;
+    uint64_t rtt_us = 0;
+
+    s->last_report_us = now_us;
+    for (uint32_t r = 0; r < report->count; r++) {
+        uint64_t first = report->ranges[r].first > s->oldest_inflight ? report->ranges[r].first : s->oldest_inflight;
+        uint64_t last = report->ranges[r].last < s->next_packet ? report->ranges[r].last : s->next_packet - 1;
+        if (s->next_packet == 0) {
+            break;
+        }
+        for (uint64_t pn = first; pn <= last && last >= first; pn++) {
+            UdpSentPacket *packet = &s->sent[pn & SENT_MASK];
+            if (packet->packet_number != pn || packet->state == SENT_FREE || packet->state == SENT_ACKED) {
+                continue;
+            }
+            if (packet->state == SENT_INFLIGHT) {
+                s->bytes_in_flight -= packet->size;
+            }
+            packet->state = SENT_ACKED;
+            s->delivered += packet->size;
+            s->cc.round_delivered += packet->size;
+            if (packet->sent_us > s->first_sent_us) {
+                s->first_sent_us = packet->sent_us;
+            }
+            if (!have_sample || pn > sample.packet_number) {
+                sample = *packet;
+                have_sample = 1;
+            }
+            if (pn == report->largest) {
+                rtt_us = now_us - packet->sent_us;
+            }
+            unit_acked(s, packet);
+        }
+    }
+    if (!have_sample) {
+        return;
+    }
+
+    s->delivered_us = now_us;
+    s->last_progress_us = now_us;
+    s->pto_count = 0;
+    if (!s->any_acked || report->largest > s->largest_acked) {
+        s->largest_acked = report->largest < s->next_packet ? report->largest : s->next_packet - 1;
+        s->any_acked = 1;
+    }
+    cc_rtt(&s->cc, rtt_us, report->ack_delay_us, now_us);
+    cc_on_ack(s, &sample, now_us);
+    advance_oldest(s);
+}
+
+/* Declare packets lost by packet number and time thresholds */
+static void detect_losses(UdpSender *s, uint64_t now_us) {
+    s->loss_time_us = 0;
+    if (!s->any_acked) {
+        return;
+    }
+
+    uint64_t rtt_us = s->cc.srtt_us > s->cc.latest_rtt_us ? s->cc.srtt_us : s->cc.latest_rtt_us;
+    uint64_t delay_us = rtt_us / 8 * 9;
+    if (delay_us < LOSS_MIN_DELAY_US) {
+        delay_us = LOSS_MIN_DELAY_US;
+    }
+    for (uint64_t pn = s->oldest_inflight; pn <= s->largest_acked && pn < s->next_packet; pn++) {
+        UdpSentPacket *packet = &s->sent[pn & SENT_MASK];
+        if (packet->packet_number != pn || packet->state != SENT_INFLIGHT) {
+            continue;
+        }
+        if (s->largest_acked - pn >= LOSS_PACKETS || now_us - packet->sent_us >= delay_us) {
+            declare_lost(s, packet);
+        } else if (s->loss_time_us == 0) {
+            s->loss_time_us = packet->sent_us + delay_us;
+        }
+    }
+    advance_oldest(s);
+}
+
+/* Probe timeout: with nothing acknowledged for long enough, whatever is
+ * in flight is taken as lost (the timeout doubles each time) */
+static uint64_t probe_timeout(const UdpSender *s) {
+    uint64_t pto_us = s->cc.srtt_us + (4 * s->cc.rttvar_us > 1000 ? 4 * s->cc.rttvar_us : 1000);
+    if (pto_us < PTO_MIN_US) {
+        pto_us = PTO_MIN_US;
+    }
+    return pto_us << s->pto_count;
+}
+
+static void check_timers(UdpSender *s, uint64_t now_us) {
+    if (s->bytes_in_flight > 0 && now_us - s->last_progress_us >= probe_timeout(s)) {
+        for (uint64_t pn = s->oldest_inflight; pn < s->next_packet; pn++) {
+            UdpSentPacket *packet = &s->sent[pn & SENT_MASK];
+            if (packet->packet_number == pn && packet->state == SENT_INFLIGHT) {
+                declare_lost(s, packet);
+            }
+        }
+        advance_oldest(s);
+        if (s->pto_count < PTO_MAX_BACKOFF) {
+            s->pto_count++;
+        }
+        s->last_progress_us = now_us;
+    }
+
+    if (s->active_head != NONE && now_us - s->last_report_us > FT_UDP_IDLE_TIMEOUT_MS * 1000ULL) {
+        LOG_ERROR("No UDP reports from the server in %d s", FT_UDP_IDLE_TIMEOUT_MS / 1000);
+        s->failed = 1;
+        send_window_fail(s->window, FT_ERR_TIMEOUT);
+    }
+}
+
+/* End the messages whose chunks the window no longer sends under their
+ * sequence number: acknowledged over TCP, or sent again as a new message */
+static void check_window(UdpSender *s) {
+    uint32_t count = 0;
+
+    platform_mutex_lock(&s->window->lock);
+    for (uint32_t i = s->active_head; i != NONE; i = s->messages[i].next) {
+        const WindowSlot *slot = s->messages[i].slot;
+        if (slot->state == SLOT_FREE || slot->state == SLOT_ACKED || slot->sent_seq != s->messages[i].sequence) {
+            s->ending[count++] = i;
+        }
+    }
+    platform_mutex_unlock(&s->window->lock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        message_end(s, &s->messages[s->ending[i]]);
+    }
+}
+
+/* Whether one more datagram of size bytes may go out now */
+static int can_send(const UdpSender *s, size_t size, int count) {
+    return count < FT_UDP_SEND_MAX && s->tokens > 0 && s->bytes_in_flight + size <= s->cc.cwnd &&
+           s->sent[s->next_packet & SENT_MASK].state != SENT_INFLIGHT;
+}
+
+/* Add a unit to the datagrams being sent */
+static void emit(UdpSender *s, uint32_t index, uint32_t unit, uint32_t position, int n, uint64_t now_us) {
+    UdpMessage *msg = &s->messages[index];
+    uint64_t pn = s->next_packet++;
+    size_t payload_size = unit_size(msg, unit);
+    size_t size = FT_UDP_HEADER_SIZE + payload_size;
+    struct UdpEmitted *emitted = &s->emitted[n];
+
+    emitted->message = index;
+    emitted->unit = unit;
+    emitted->position = position;
+    emitted->prev_state = msg->state[unit];
+    emitted->prev_packet = msg->last_packet[unit];
+    if (emitted->prev_state != FRAG_UNSENT) {
+        s->resent++;
+    }
+    set_state(s, msg, unit, FRAG_INFLIGHT);
+    msg->last_packet[unit] = pn;
+
+    UdpHeader header = msg->header;
+    header.type = unit < msg->fragments ? UDP_DATA : UDP_PARITY;
+    header.index = unit < msg->fragments ? unit : unit - msg->fragments;
+    header.packet_number = pn;
+    udp_serialize_header(&header, s->heads[n]);
+    s->outs[n].head = s->heads[n];
+    s->outs[n].head_len = FT_UDP_HEADER_SIZE;
+    s->outs[n].payload = unit_payload(msg, unit);
+    s->outs[n].payload_len = payload_size;
+
+    if (s->bytes_in_flight == 0) {
+        /* A new flight: rate samples start here */
+        s->first_sent_us = now_us;
+        s->delivered_us = now_us;
+        s->last_progress_us = now_us;
+    }
+    UdpSentPacket *packet = &s->sent[pn & SENT_MASK];
+    packet->packet_number = pn;
+    packet->sequence = msg->sequence;
+    packet->sent_us = now_us;
+    packet->delivered = s->delivered;
+    packet->delivered_us = s->delivered_us;
+    packet->first_sent_us = s->first_sent_us;
+    packet->message = index;
+    packet->unit = unit;
+    packet->size = (uint16_t)size;
+    packet->state = SENT_INFLIGHT;
+    packet->app_limited = (uint8_t)s->app_limited;
+    s->bytes_in_flight += size;
+    s->tokens -= (double)size;
+}
+
+/* Take back datagrams [from, count) that udp_send() did not send; they
+ * were the last packet numbers handed out */
+static void unemit(UdpSender *s, int from, int count) {
+    for (int n = count - 1; n >= from; n--) {
+        const struct UdpEmitted *emitted = &s->emitted[n];
+        UdpMessage *msg = &s->messages[emitted->message];
+        UdpSentPacket *packet = &s->sent[--s->next_packet & SENT_MASK];
+
+        s->bytes_in_flight -= packet->size;
+        s->tokens += packet->size;
+        packet->state = SENT_FREE;
+        if (emitted->prev_state != FRAG_UNSENT) {
+            s->resent--;
+        }
+        set_state(s, msg, emitted->unit, emitted->prev_state);
+        msg->last_packet[emitted->unit] = emitted->prev_packet;
+        if (emitted->prev_state == FRAG_QUEUED) {
+            queue_push(msg, emitted->unit, 1);
+        } else {
+            msg->cursor = emitted->position;
+        }
+    }
+}
+
+/* Pick datagrams while the rate and window allow: first units queued to
+ * be sent again, oldest message first, then new ones */
+static int fill(UdpSender *s, uint64_t now_us, int *starved) {
+    uint32_t k = group_k(s);
+    uint32_t stride = k + s->fec_m;
+    int n = 0;
+
+    *starved = 0;
+    for (uint32_t i = s->active_head; i != NONE && s->queued > 0; i = s->messages[i].next) {
+        UdpMessage *msg = &s->messages[i];
+        while (msg->queue_head != NONE) {
+            uint32_t unit = msg->queue_head;
+            if (msg->state[unit] != FRAG_QUEUED) {
+                queue_pop(msg);
+                continue;
+            }
+            uint32_t group = unit_group(s, msg, unit);
+            if (msg->group_acked[group] >= group_size(s, msg, group)) {
+                queue_pop(msg);
+                set_state(s, msg, unit, FRAG_LOST);
+                continue;
+            }
+            if (!can_send(s, FT_UDP_HEADER_SIZE + unit_size(msg, unit), n)) {
+                return n;
+            }
+            queue_pop(msg);
+            emit(s, i, unit, 0, n++, now_us);
+        }
+    }
+
+    for (uint32_t i = s->active_head; i != NONE; i = s->messages[i].next) {
+        UdpMessage *msg = &s->messages[i];
+        uint32_t end = msg->groups * stride;
+        while (msg->cursor < end) {
+            uint32_t position = msg->cursor;
+            uint32_t group = position / stride;
+            uint32_t offset = position % stride;
+            uint32_t count = group_size(s, msg, group);
+            if (offset >= count + s->fec_m) {
+                msg->cursor = (group + 1) * stride;
+                continue;
+            }
+            uint32_t unit = offset < count ? group * k + offset : msg->fragments + group * s->fec_m + (offset - count);
+            if (msg->group_acked[group] >= count || msg->state[unit] != FRAG_UNSENT) {
+                msg->cursor++;
+                continue;
+            }
+            if (!can_send(s, FT_UDP_HEADER_SIZE + unit_size(msg, unit), n)) {
+                return n;
+            }
+            msg->cursor++;
+            emit(s, i, unit, position, n++, now_us);
+        }
+    }
+    *starved = 1;
+    return n;
+}
+
+/* Send what pacing allows */
+static int pump_send(UdpSender *s, uint64_t now_us, FTErrorCode *error) {
+    double burst = (double)s->cc.pacing_rate * CC_BURST_US / 1e6;
+    if (burst < 10.0 * FT_UDP_DATAGRAM_SIZE) {
+        burst = 10.0 * FT_UDP_DATAGRAM_SIZE;
+    }
+    s->tokens += (double)s->cc.pacing_rate * (double)(now_us - s->tokens_time_us) / 1e6;
+    if (s->tokens > burst) {
+        s->tokens = burst;
+    }
+    s->tokens_time_us = now_us;
+
+    while (!s->blocked) {
+        int starved;
+        int count = fill(s, now_us, &starved);
+        s->starved = starved;
+        if (count == 0) {
+            break;
+        }
+        int sent = udp_send(&s->udp, s->outs, count, error);
+        if (sent < 0) {
+            unemit(s, 0, count);
+            return -1;
+        }
+        s->datagrams += (uint64_t)sent;
+        if (sent < count) {
+            unemit(s, sent, count);
+            s->blocked = 1;
+            s->starved = 0;
+        }
+        if (count < FT_UDP_SEND_MAX) {
+            break;
+        }
+    }
+
+    /* Rate samples taken while there was nothing to send understate the path */
+    s->app_limited = s->starved && s->bytes_in_flight < s->cc.cwnd;
+    return 0;
+}
+
+/* Read REPORTs */
+static int pump_receive(UdpSender *s, uint64_t now_us, FTErrorCode *error) {
+    for (int round = 0; round < RECV_ROUNDS; round++) {
+        int count = udp_recv(&s->udp, &s->batch, error);
+        if (count <= 0) {
+            return count;
+        }
+        for (int i = 0; i < count; i++) {
+            UdpReport report;
+            if (udp_parse_report(s->batch.data[i], s->batch.length[i], &report) == 0) {
+                on_report(s, &report, now_us);
+            }
+        }
+    }
+    return 0;
+}
+
+/* Milliseconds until the pump has work again */
+static int pump_timeout(const UdpSender *s, uint64_t now_us) {
+    uint64_t wait_us = PUMP_MAX_WAIT_MS * 1000ULL;
+
+    if (s->failed) {
+        return -1;
+    }
+    if (!s->starved && !s->blocked && s->tokens <= 0 && s->cc.pacing_rate > 0) {
+        uint64_t pace_us = (uint64_t)((1.0 - s->tokens) * 1e6 / (double)s->cc.pacing_rate);
+        if (pace_us < wait_us) {
+            wait_us = pace_us;
+        }
+    }
+    if (s->bytes_in_flight > 0) {
+        uint64_t deadline = s->last_progress_us + probe_timeout(s);
+        uint64_t pto_us = deadline > now_us ? deadline - now_us : 0;
+        if (pto_us < wait_us) {
+            wait_us = pto_us;
+        }
+    }
+    if (s->loss_time_us != 0) {
+        uint64_t loss_us = s->loss_time_us > now_us ? s->loss_time_us - now_us : 0;
+        if (loss_us < wait_us) {
+            wait_us = loss_us;
+        }
+    }
+    return (int)((wait_us + 999) / 1000);
+}
+
+/* Pump thread */
+static void pump_thread(void *arg) {
+    UdpSender *s = (UdpSender*)arg;
+    ft_poll_event_t events[2];
+    uint32_t interest = FT_POLL_READ;
+
+    platform_mutex_lock(&s->lock);
+    while (!s->stopping) {
+        if (!s->failed) {
+            FTErrorCode error = FT_SUCCESS;
+            uint64_t now_us = platform_get_monotonic_us();
+            if (pump_receive(s, now_us, &error) < 0) {
+                s->failed = 1;
+            } else {
+                check_window(s);
+                detect_losses(s, now_us);
+                check_timers(s, now_us);
+                if (!s->failed && pump_send(s, now_us, &error) != 0) {
+                    s->failed = 1;
+                }
+            }
+            if (s->failed && error != FT_SUCCESS) {
+                send_window_fail(s->window, error);
+            }
+        }
+
+        uint32_t events_wanted = FT_POLL_READ | (s->blocked ? FT_POLL_WRITE : 0);
+        if (events_wanted != interest &&
+            platform_poller_modify(s->poller, s->udp.sock, events_wanted, s) == 0) {
+            interest = events_wanted;
+        }
+        int timeout_ms = pump_timeout(s, platform_get_monotonic_us());
+        platform_mutex_unlock(&s->lock);
+
+        int count = platform_poller_wait(s->poller, events, 2, timeout_ms);
+
+        platform_mutex_lock(&s->lock);
+        for (int i = 0; i < count; i++) {
+            if (events[i].events & (FT_POLL_WRITE | FT_POLL_ERROR)) {
+                s->blocked = 0;
+            }
+        }
+    }
+    platform_mutex_unlock(&s->lock);
+}
+
+/* Free what start() allocated */
+static void sender_free(UdpSender *s) {
+    if (s->messages != NULL) {
+        for (uint32_t i = 0; i < s->capacity; i++) {
+            UdpMessage *msg = &s->messages[i];
+            free(msg->parity);
+            free(msg->state);
+            free(msg->last_packet);
+            free(msg->queue_next);
+            free(msg->group_acked);
+            free(msg->group_inflight);
+            free(msg->group_unsent);
+            free(msg->group_queued);
+        }
+        free(s->messages);
+        s->messages = NULL;
+    }
+    free(s->ending);
+    free(s->outs);
+    free(s->heads);
+    free(s->emitted);
+    free(s->sent);
+    udp_recv_batch_free(&s->batch);
+    if (s->poller != NULL) {
+        platform_poller_destroy(s->poller);
+        s->poller = NULL;
+    }
+    udp_close(&s->udp);
+}
+
+/* Say HELLO until the server answers; returns the round trip, 0 if it never does */
+static uint64_t say_hello(UdpSender *s, uint64_t token, FTErrorCode *error) {
+    uint8_t hello[FT_UDP_HEADER_SIZE];
+    UdpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = UDP_HELLO;
+    header.sequence = token;
+    udp_serialize_header(&header, hello);
+    UdpOut out = { hello, sizeof(hello), NULL, 0 };
+
+    for (int attempt = 0; attempt < FT_UDP_HELLO_ATTEMPTS; attempt++) {
+        uint64_t sent_us = platform_get_monotonic_us();
+        uint64_t deadline_us = sent_us + FT_UDP_HELLO_INTERVAL_MS * 1000ULL;
+        if (udp_send(&s->udp, &out, 1, error) < 0) {
+            return 0;
+        }
+        for (uint64_t now_us = sent_us; now_us < deadline_us; now_us = platform_get_monotonic_us()) {
+            ft_poll_event_t events[2];
+            platform_poller_wait(s->poller, events, 2, (int)((deadline_us - now_us + 999) / 1000));
+            int count = udp_recv(&s->udp, &s->batch, error);
+            for (int i = 0; i < count; i++) {
+                UdpHeader reply;
+                if (udp_parse_header(s->batch.data[i], s->batch.length[i], &reply) == 0 &&
+                    reply.type == UDP_HELLO_ACK && reply.sequence == token) {
+                    uint64_t rtt_us = platform_get_monotonic_us() - sent_us;
+                    return rtt_us > 0 ? rtt_us : 1;
+                }
+            }
+        }
+    }
+    if (error) *error = FT_ERR_TIMEOUT;
+    return 0;
+}
+
+/* Start sender */
+int udp_sender_start(UdpSender *s, socket_t tcp_sock, const UdpSetup *setup, SendWindow *window,
+                     uint32_t chunk_size, uint32_t fec_k, uint32_t fec_m, FTErrorCode *error) {
+    memset(s, 0, sizeof(UdpSender));
+    s->udp.sock = INVALID_SOCKET_VALUE;
+    s->window = window;
+    s->capacity = window->capacity;
+    s->fec_k = fec_k;
+    s->fec_m = fec_k > 0 ? fec_m : 0;
+    s->max_fragments = udp_fragment_count(chunk_size);
+    s->active_head = s->active_tail = NONE;
+    if (fec_k > 0 && fec_init(&s->fec, fec_k, fec_m) != 0) {
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+
+    if (udp_open_client(&s->udp, tcp_sock, setup->port, error) != 0) {
+        return -1;
+    }
+    s->poller = platform_poller_create();
+    if (s->poller == NULL || platform_poller_add(s->poller, s->udp.sock, FT_POLL_READ, s) != 0 ||
+        udp_recv_batch_init(&s->batch, &s->udp) != 0) {
+        goto oom;
+    }
+
+    uint32_t groups = udp_group_count(s->max_fragments, group_k(s));
+    uint32_t units = s->max_fragments + groups * s->fec_m;
+    s->messages = (UdpMessage*)calloc(s->capacity, sizeof(UdpMessage));
+    s->ending = (uint32_t*)malloc(s->capacity * sizeof(uint32_t));
+    s->outs = (UdpOut*)malloc(FT_UDP_SEND_MAX * sizeof(UdpOut));
+    s->heads = (uint8_t(*)[FT_UDP_HEADER_SIZE])malloc(FT_UDP_SEND_MAX * FT_UDP_HEADER_SIZE);
+    s->emitted = (struct UdpEmitted*)malloc(FT_UDP_SEND_MAX * sizeof(struct UdpEmitted));
+    s->sent = (UdpSentPacket*)calloc(FT_UDP_SENT_RING, sizeof(UdpSentPacket));
+    if (s->messages == NULL || s->ending == NULL || s->outs == NULL || s->heads == NULL ||
+        s->emitted == NULL || s->sent == NULL) {
+        goto oom;
+    }
+    for (uint32_t i = 0; i < s->capacity; i++) {
+        UdpMessage *msg = &s->messages[i];
+        msg->state = (uint8_t*)malloc(units);
+        msg->last_packet = (uint64_t*)malloc(units * sizeof(uint64_t));
+        msg->queue_next = (uint32_t*)malloc(units * sizeof(uint32_t));
+        msg->group_acked = (uint16_t*)malloc(groups * sizeof(uint16_t));
+        msg->group_inflight = (uint16_t*)malloc(groups * sizeof(uint16_t));
+        msg->group_unsent = (uint16_t*)malloc(groups * sizeof(uint16_t));
+        msg->group_queued = (uint16_t*)malloc(groups * sizeof(uint16_t));
+        if (msg->state == NULL || msg->last_packet == NULL || msg->queue_next == NULL ||
+            msg->group_acked == NULL || msg->group_inflight == NULL || msg->group_unsent == NULL ||
+            msg->group_queued == NULL) {
+            goto oom;
+        }
+    }
+
+    uint64_t rtt_us = say_hello(s, setup->token, error);
+    if (rtt_us == 0) {
+        LOG_WARN("Server's UDP port %u does not answer", setup->port);
+        sender_free(s);
+        return -1;
+    }
+
+    uint64_t now_us = platform_get_monotonic_us();
+    s->cc.mode = UDP_CC_STARTUP;
+    s->cc.min_rtt_us = rtt_us;
+    s->cc.min_rtt_stamp_us = now_us;
+    s->cc.srtt_us = rtt_us;
+    s->cc.rttvar_us = rtt_us / 2;
+    s->cc.latest_rtt_us = rtt_us;
+    cc_update_rates(&s->cc);
+    s->tokens = 10.0 * FT_UDP_DATAGRAM_SIZE;
+    s->tokens_time_us = now_us;
+    s->last_report_us = now_us;
+    s->last_progress_us = now_us;
+    LOG_DEBUG("UDP data path to port %u: RTT %.2f ms, %s%s", setup->port, rtt_us / 1000.0,
+              s->udp.gso ? "segmentation offload" : "no segmentation offload",
+              fec_k > 0 ? ", FEC" : "");
+
+    platform_mutex_init(&s->lock);
+    if (platform_thread_create(&s->thread, pump_thread, s) != 0) {
+        platform_mutex_destroy(&s->lock);
+        goto oom;
+    }
+    s->running = 1;
+    return 0;
+
+oom:
+    LOG_ERROR("Failed to set up the UDP data path");
+    sender_free(s);
+    if (error) *error = FT_ERR_OUT_OF_MEMORY;
+    return -1;
+}
+
+/* Queue a chunk */
+int udp_sender_submit(UdpSender *s, WindowSlot *slot, uint64_t sequence_num, FTErrorCode *error) {
+    const uint8_t *wire = slot->packed_size > 0 ? slot->packed : slot->payload;
+    uint32_t wire_size = (uint32_t)(slot->packed_size > 0 ? slot->packed_size : slot->data_size);
+    uint32_t fragments = udp_fragment_count(wire_size);
+    uint32_t groups = udp_group_count(fragments, group_k(s));
+    uint8_t *parity = NULL;
+
+    /* Parity is computed here, on the sending thread, not on the pump */
+    if (s->fec_k > 0) {
+        parity = (uint8_t*)malloc((size_t)groups * s->fec_m * FT_UDP_FRAGMENT_SIZE);
+        if (parity == NULL) {
+            if (error) *error = FT_ERR_OUT_OF_MEMORY;
+            return -1;
+        }
+        uint8_t tail[FT_UDP_FRAGMENT_SIZE];
+        uint32_t last = fragments - 1;
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, wire + (size_t)last * FT_UDP_FRAGMENT_SIZE, wire_size - (size_t)last * FT_UDP_FRAGMENT_SIZE);
+        for (uint32_t g = 0; g < groups; g++) {
+            const uint8_t *data[FT_FEC_MAX_DATA];
+            uint8_t *shards[FT_FEC_MAX_PARITY];
+            uint32_t first = g * s->fec_k;
+            uint32_t count = fragments - first < s->fec_k ? fragments - first : s->fec_k;
+            for (uint32_t i = 0; i < count; i++) {
+                data[i] = first + i == last ? tail : wire + (size_t)(first + i) * FT_UDP_FRAGMENT_SIZE;
+            }
+            for (uint32_t j = 0; j < s->fec_m; j++) {
+                shards[j] = parity + ((size_t)g * s->fec_m + j) * FT_UDP_FRAGMENT_SIZE;
+            }
+            fec_encode(&s->fec, count, data, shards, FT_UDP_FRAGMENT_SIZE);
+        }
+    }
+
+    platform_mutex_lock(&s->lock);
+    uint32_t index = (uint32_t)(slot - s->window->slots);
+    UdpMessage *msg = &s->messages[index];
+    if (msg->active) {
+        message_end(s, msg);
+    }
+
+    msg->active = 1;
+    msg->slot = slot;
+    msg->sequence = sequence_num;
+    memset(&msg->header, 0, sizeof(msg->header));
+    msg->header.fec_k = (uint8_t)s->fec_k;
+    msg->header.fec_m = (uint8_t)s->fec_m;
+    msg->header.flags = slot->packed_size > 0 ? FT_UDP_FLAG_LZ4 : 0;
+    msg->header.fragment_size = FT_UDP_FRAGMENT_SIZE;
+    msg->header.sequence = sequence_num;
+    msg->header.chunk_id = slot->chunk_id;
+    msg->header.chunk_size = (uint32_t)slot->data_size;
+    msg->header.chunk_crc = slot->data_crc;
+    msg->header.wire_size = wire_size;
+    msg->wire = wire;
+    msg->fragments = fragments;
+    msg->groups = groups;
+    msg->units = fragments + groups * s->fec_m;
+    msg->parity = parity;
+    memset(msg->state, FRAG_UNSENT, msg->units);
+    msg->queue_head = msg->queue_tail = NONE;
+    for (uint32_t g = 0; g < groups; g++) {
+        msg->group_acked[g] = 0;
+        msg->group_inflight[g] = 0;
+        msg->group_queued[g] = 0;
+        msg->group_unsent[g] = (uint16_t)(group_size(s, msg, g) + s->fec_m);
+    }
+    msg->groups_done = 0;
+    msg->cursor = 0;
+
+    msg->next = NONE;
+    msg->prev = s->active_tail;
+    if (s->active_tail != NONE) {
+        s->messages[s->active_tail].next = index;
+    } else {
+        /* Idle until now: the REPORT timeout starts over */
+        s->active_head = index;
+        s->last_report_us = platform_get_monotonic_us();
+    }
+    s->active_tail = index;
+    platform_mutex_unlock(&s->lock);
+
+    platform_poller_wake(s->poller);
+    return 0;
+}
+
+/* Whether the slot's message is still being sent */
+int udp_sender_pending(UdpSender *s, const WindowSlot *slot) {
+    platform_mutex_lock(&s->lock);
+    const UdpMessage *msg = &s->messages[slot - s->window->slots];
+    int pending = msg->active && msg->sequence == slot->sent_seq;
+    platform_mutex_unlock(&s->lock);
+    return pending;
+}
+
+/* Stop sender */
+void udp_sender_stop(UdpSender *s) {
+    if (!s->running) {
+        return;
+    }
+    platform_mutex_lock(&s->lock);
+    s->stopping = 1;
+    platform_mutex_unlock(&s->lock);
+    platform_poller_wake(s->poller);
+    platform_thread_join(s->thread);
+    s->running = 0;
+
+    while (s->active_head != NONE) {
+        message_end(s, &s->messages[s->active_head]);
+    }
+    LOG_DEBUG("UDP: %llu datagrams, %llu sent again, %llu lost; %.2f MB/s, RTT %.2f ms",
+              (unsigned long long)s->datagrams, (unsigned long long)s->resent, (unsigned long long)s->lost,
+              cc_bandwidth(&s->cc) / 1e6, s->cc.min_rtt_us / 1000.0);
+    platform_mutex_destroy(&s->lock);
+    sender_free(s);
+}
@@ -0,0 +1,177 @@
+#ifndef UDPSEND_H
+#define UDPSEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+#include "window.h"
+#include "udp.h"
+#include "fec.h"
+
+#define FT_UDP_SENT_RING       65536       /* Datagrams tracked in flight (a power of two) */
+#define FT_UDP_IDLE_TIMEOUT_MS (FT_TIMEOUT_SECONDS * 1000)  /* No REPORT this long: the path is gone */
+#define FT_UDP_BW_ROUNDS       10          /* Bandwidth is the best delivery rate of this many rounds */
+
+/* One datagram sent */
+typedef struct {
+    uint64_t packet_number;
+    uint64_t sequence;             /* Of its message */
+    uint64_t sent_us;
+    uint64_t delivered;            /* Bytes delivered when it was sent... */
+    uint64_t delivered_us;         /* ...and when the latest of them was */
+    uint64_t first_sent_us;        /* Sent time of that latest one */
+    uint32_t message;              /* Message table index */
+    uint32_t unit;                 /* Fragment of the message */
+    uint16_t size;
+    uint8_t  state;
+    uint8_t  app_limited;          /* Sent with nothing more to send: its rate sample may be low */
+} UdpSentPacket;
+
+/* A chunk (the CHUNK_DATA payload of the window slot it stands for) being
+ * sent as fragments; units are its data fragments, then its parity */
+typedef struct {
+    int            active;
+    WindowSlot    *slot;
+    uint64_t       sequence;
+    UdpHeader      header;         /* Common fields of its datagrams */
+    const uint8_t *wire;
+    uint32_t       fragments;
+    uint32_t       groups;         /* FEC groups (each fragment is one without FEC) */
+    uint32_t       units;
+    uint8_t       *parity;         /* groups * fec_m fragments */
+    uint8_t       *state;          /* Per unit */
+    uint64_t      *last_packet;    /* Per unit: packet number of its latest transmission */
+    uint32_t      *queue_next;     /* Units queued to be sent again, oldest first */
+    uint32_t       queue_head;
+    uint32_t       queue_tail;
+    uint16_t      *group_acked;    /* Per group: units the receiver holds... */
+    uint16_t      *group_inflight; /* ...might still get... */
+    uint16_t      *group_unsent;   /* ...never sent... */
+    uint16_t      *group_queued;   /* ...and queued to be sent again */
+    uint32_t       groups_done;
+    uint32_t       cursor;         /* Next position in send order: each group's data, then its parity */
+    uint32_t       prev;           /* Active messages, oldest first */
+    uint32_t       next;
+} UdpMessage;
+
+/* Congestion control modes */
+typedef enum {
+    UDP_CC_STARTUP,
+    UDP_CC_DRAIN,
+    UDP_CC_PROBE_BW,
+    UDP_CC_PROBE_RTT
+} UdpCcMode;
+
+/* Rate-based congestion control after BBR: the bottleneck bandwidth is
+ * the best delivery rate seen over the last FT_UDP_BW_ROUNDS round trips
+ * and the propagation delay the least RTT of the last 10 seconds (which
+ * PROBE_RTT refreshes by nearly emptying the pipe); the sender paces at a
+ * gain times the bandwidth and keeps about twice their product in flight */
+typedef struct {
+    UdpCcMode mode;
+    uint64_t  bw_rounds[FT_UDP_BW_ROUNDS];  /* Bytes/s, best of each round */
+    uint64_t  round;
+    uint64_t  next_round_delivered;
+    uint64_t  round_delivered;     /* Bytes delivered and lost in the current round */
+    uint64_t  round_lost;
+    uint64_t  min_rtt_us;
+    uint64_t  min_rtt_stamp_us;
+    uint64_t  srtt_us;
+    uint64_t  rttvar_us;
+    uint64_t  latest_rtt_us;
+    uint64_t  full_bw;             /* Pipe is full once this stops growing by 25% for 3 rounds */
+    int       full_bw_rounds;
+    int       filled;
+    int       cycle;               /* PROBE_BW gain phase */
+    uint64_t  cycle_stamp_us;
+    uint64_t  probe_rtt_done_us;
+    uint64_t  probe_rtt_round;
+    double    pacing_gain;
+    double    cwnd_gain;
+    uint64_t  pacing_rate;         /* Bytes/s */
+    uint64_t  cwnd;                /* Bytes */
+} UdpCongestion;
+
+/*
+ * Client end of a file's UDP data path. The sending thread queues each
+ * chunk the window marks sent; a pump thread then sends its fragments as
+ * the pacing rate and congestion window allow, reads the server's REPORTs,
+ * and sends again what they show lost (a packet 3 packet numbers older
+ * than one received, or 9/8 of an RTT older, or everything once a probe
+ * timeout passes without a REPORT), but only as many fragments of a group
+ * as it takes for the group to still arrive whole. A message ends once
+ * every group is received, or when the window no longer holds the chunk
+ * under its sequence number; its hold on the window slot is then
+ * released.
+ */
+typedef struct {
+    UdpSocket      udp;
+    SendWindow    *window;
+    ft_poller_t   *poller;
+    ft_thread_t    thread;
+    int            running;
+    int            stopping;
+    int            failed;         /* The window was failed; the pump only waits to be stopped */
+    int            blocked;        /* Socket buffer full: waiting for it to drain */
+    int            starved;        /* The latest send ran out of fragments, not of rate or window */
+    uint32_t       fec_k;          /* 0: no FEC */
+    uint32_t       fec_m;
+    FecCode        fec;
+    uint32_t       max_fragments;
+    UdpMessage    *messages;       /* Indexed like window slots */
+    uint32_t       capacity;
+    uint32_t       active_head;
+    uint32_t       active_tail;
+    uint32_t       queued;         /* Units queued to be sent again, in every message */
+    uint32_t      *ending;         /* Scratch list of messages to end */
+    UdpOut        *outs;           /* Datagrams of one udp_send() */
+    uint8_t      (*heads)[FT_UDP_HEADER_SIZE];
+    struct UdpEmitted *emitted;    /* ...and what sending them changed, to undo what did not go out */
+    UdpSentPacket *sent;           /* FT_UDP_SENT_RING entries, by packet number */
+    uint64_t       next_packet;
+    uint64_t       oldest_inflight; /* No packet below this is still in flight */
+    uint64_t       largest_acked;
+    uint64_t       loss_time_us;   /* When the oldest packet in flight below it times out (0: none) */
+    int            any_acked;
+    uint64_t       bytes_in_flight;
+    uint64_t       delivered;
+    uint64_t       delivered_us;
+    uint64_t       first_sent_us;
+    int            app_limited;
+    uint64_t       tokens_time_us; /* Pacing: bytes that may go out now */
+    double         tokens;
+    uint64_t       last_report_us;
+    uint64_t       last_progress_us;
+    uint32_t       pto_count;
+    UdpCongestion  cc;
+    UdpRecvBatch   batch;
+    ft_mutex_t     lock;
+
+    uint64_t       datagrams;      /* Statistics */
+    uint64_t       resent;
+    uint64_t       lost;
+} UdpSender;
+
+/* Open the socket to the server's UDP_SETUP, say HELLO until the server
+ * answers, and start the pump for window's chunks; fec_k 0 sends no
+ * parity. -1 if the server cannot be reached (the chunks can still go
+ * over TCP). */
+int udp_sender_start(UdpSender *s, socket_t tcp_sock, const UdpSetup *setup, SendWindow *window,
+                     uint32_t chunk_size, uint32_t fec_k, uint32_t fec_m, FTErrorCode *error);
+
+/* Send slot's chunk, which was just marked sent with sequence_num. The
+ * caller's hold on the slot (taken before marking it) is the message's,
+ * released when it ends. */
+int udp_sender_submit(UdpSender *s, WindowSlot *slot, uint64_t sequence_num, FTErrorCode *error);
+
+/* Whether the slot's latest message is still being sent: a retransmit
+ * request for it is one of the rest of the window whose message merely
+ * has not arrived yet, and needs no new copy */
+int udp_sender_pending(UdpSender *s, const WindowSlot *slot);
+
+/* Stop the pump, release the holds of the messages still being sent, and
+ * close the socket */
+void udp_sender_stop(UdpSender *s);
+
+#endif /* UDPSEND_H */
@@ -0,0 +1,531 @@
+#include "uring.h"
+
+#ifdef FT_HAVE_IO_URING
+
+#include "logger.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 64
+
+/* Submission/completion rings of one thread */
+typedef struct {
+    int                   fd;
+    unsigned              sq_entries;
+    unsigned             *sq_head;
+    unsigned             *sq_tail;
+    unsigned             *sq_mask;
+    unsigned             *sq_array;
+    unsigned              sqe_tail;     /* Next SQE to fill (published on submit) */
+    struct io_uring_sqe  *sqes;
+    unsigned             *cq_head;
+    unsigned             *cq_tail;
+    unsigned             *cq_mask;
+    struct io_uring_cqe  *cqes;
+    void                 *sq_ptr;
+    void                 *cq_ptr;
+    size_t                sq_len;
+    size_t                cq_len;
+    size_t                sqes_len;
+    uint8_t             **fixed;        /* Registered buffers */
+    uint32_t              fixed_count;
+    size_t                fixed_size;
+} UringRing;
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static int uring_usable = 0;
+static uint32_t socket_timeout_ms = 0;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Unmap and close ring */
+static void ring_close(UringRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->fixed);
+    memset(ring, 0, sizeof(UringRing));
+    ring->fd = -1;
+}
+
+/* Create ring and map its queues */
+static int ring_open(UringRing *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(UringRing));
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring_close(ring);
+        return -1;
+    }
+    ring->cq_ptr = single_mmap ? ring->sq_ptr :
+                   mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring_close(ring);
+        return -1;
+    }
+
+    uint8_t *sq = (uint8_t*)ring->sq_ptr;
+    uint8_t *cq = (uint8_t*)ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+    return 0;
+}
+
+/* Thread exit: release that thread's ring */
+static void ring_destructor(void *arg) {
+    UringRing *ring = (UringRing*)arg;
+    ring_close(ring);
+    free(ring);
+}
+
+/* Probe kernel support once */
+static void probe_uring(void) {
+    const char *env = getenv("FT_IO_URING");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        LOG_DEBUG("io_uring disabled by FT_IO_URING=0");
+        return;
+    }
+
+    UringRing ring;
+    if (ring_open(&ring, 2) != 0) {
+        LOG_WARN("io_uring unavailable (%s), using blocking I/O", strerror(errno));
+        return;
+    }
+    ring_close(&ring);
+
+    if (pthread_key_create(&ring_key, ring_destructor) != 0) {
+        return;
+    }
+    uring_usable = 1;
+    LOG_DEBUG("I/O engine: io_uring");
+}
+
+/* Ring of the calling thread, created on first use */
+static UringRing* thread_ring(void) {
+    UringRing *ring = (UringRing*)pthread_getspecific(ring_key);
+    if (ring != NULL) {
+        return ring;
+    }
+
+    ring = (UringRing*)malloc(sizeof(UringRing));
+    if (ring == NULL || ring_open(ring, URING_ENTRIES) != 0) {
+        free(ring);
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+/* Next free SQE, zeroed; NULL if the queue is full */
+static struct io_uring_sqe* ring_get_sqe(UringRing *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/* Submit queued SQEs and collect count completions; results[user_data] = res */
+static int ring_run(UringRing *ring, int *results, unsigned count) {
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned completed = 0;
+    while (completed < count) {
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != cq_tail && completed < count) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data < count) {
+                results[cqe->user_data] = cqe->res;
+            }
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if (completed == count) {
+            break;
+        }
+
+        int rc = sys_io_uring_enter(ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        to_submit -= ((unsigned)rc < to_submit) ? (unsigned)rc : to_submit;
+    }
+    return 0;
+}
+
+/* Index of the registered buffer containing [buf, buf + len), or -1 */
+static int fixed_index(const UringRing *ring, const void *buf, size_t len) {
+    const uint8_t *p = (const uint8_t*)buf;
+    for (uint32_t i = 0; i < ring->fixed_count; i++) {
+        if (p >= ring->fixed[i] && p + len <= ring->fixed[i] + ring->fixed_size) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Fill a read/write SQE, using the fixed-buffer opcode when possible */
+static void prep_rw(UringRing *ring, struct io_uring_sqe *sqe, int fd, const void *buf, size_t len,
+                    uint64_t offset, int is_write) {
+    int index = fixed_index(ring, buf, len);
+    if (index >= 0) {
+        sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t)index;
+    } else {
+        sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = offset;
+}
+
+/* Convert a completion to the syscall convention */
+static ssize_t complete(int res) {
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+/* Run one socket SQE (user_data 0) with the socket timeout linked behind it */
+static ssize_t run_socket_op(UringRing *ring, struct io_uring_sqe *sqe) {
+    struct __kernel_timespec timeout;
+    int results[2] = {0, 0};
+    unsigned count = 1;
+
+    sqe->user_data = 0;
+    if (socket_timeout_ms > 0) {
+        struct io_uring_sqe *link = ring_get_sqe(ring);
+        if (link != NULL) {
+            timeout.tv_sec = socket_timeout_ms / 1000;
+            timeout.tv_nsec = (long long)(socket_timeout_ms % 1000) * 1000000;
+            sqe->flags |= IOSQE_IO_LINK;
+            link->opcode = IORING_OP_LINK_TIMEOUT;
+            link->fd = -1;
+            link->addr = (uint64_t)(uintptr_t)&timeout;
+            link->len = 1;
+            link->user_data = 1;
+            count = 2;
+        }
+    }
+
+    if (ring_run(ring, results, count) != 0) {
+        return -1;
+    }
+    if (count == 2 && results[0] == -ECANCELED && results[1] == -ETIME) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return complete(results[0]);
+}
+
+/* Probe support */
+int uring_available(void) {
+    pthread_once(&probe_once, probe_uring);
+    return uring_usable;
+}
+
+/* Set socket operation bound */
+void uring_set_socket_timeout(uint32_t timeout_ms) {
+    socket_timeout_ms = timeout_ms;
+}
+
+/* Send */
+ssize_t uring_send(int fd, const void *buf, size_t len, int flags) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = (uint32_t)(flags | MSG_NOSIGNAL);
+    return run_socket_op(ring, sqe);
+}
+
+/* Gathered send */
+ssize_t uring_sendmsg(int fd, const struct iovec *iov, int iovcnt, int flags) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = (size_t)iovcnt;
+
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t)(flags | MSG_NOSIGNAL);
+    return run_socket_op(ring, sqe);
+}
+
+/* Receive */
+ssize_t uring_recv(int fd, void *buf, size_t len, int flags) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = (uint32_t)flags;
+    return run_socket_op(ring, sqe);
+}
+
+/* Positional read */
+ssize_t uring_pread(int fd, void *buf, size_t len, uint64_t offset) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    int result = 0;
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    prep_rw(ring, sqe, fd, buf, len, offset, 0);
+    if (ring_run(ring, &result, 1) != 0) {
+        return -1;
+    }
+    return complete(result);
+}
+
+/* Positional write */
+ssize_t uring_pwrite(int fd, const void *buf, size_t len, uint64_t offset) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    int result = 0;
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    prep_rw(ring, sqe, fd, buf, len, offset, 1);
+    if (ring_run(ring, &result, 1) != 0) {
+        return -1;
+    }
+    return complete(result);
+}
+
+/* Flush file data */
+int uring_fdatasync(int fd) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+    int result = 0;
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    if (ring_run(ring, &result, 1) != 0) {
+        return -1;
+    }
+    return (int)complete(result);
+}
+
+/* Finish a write the batch did not complete (short, or cancelled by a broken link) */
+static int finish_write(int fd, const uint8_t *buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t written = uring_pwrite(fd, buf, len, offset);
+        if (written < 0) {
+            return -1;
+        }
+        if (written == 0) {
+            errno = EIO;
+            return -1;
+        }
+        buf += written;
+        offset += (uint64_t)written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Batched writes */
+int uring_pwrite_batch(int fd, const UringWrite *writes, int count, int datasync) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL) {
+        return -1;
+    }
+
+    int results[FT_URING_MAX_BATCH + 1];
+    int done = 0;
+    while (done < count) {
+        int batch = count - done;
+        if (batch > FT_URING_MAX_BATCH) {
+            batch = FT_URING_MAX_BATCH;
+        }
+        int sync = datasync && done + batch == count;
+
+        for (int i = 0; i < batch; i++) {
+            const UringWrite *w = &writes[done + i];
+            struct io_uring_sqe *sqe = ring_get_sqe(ring);
+            prep_rw(ring, sqe, fd, w->buf, w->len, w->offset, 1);
+            sqe->user_data = (uint64_t)i;
+            if (sync) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+        }
+        if (sync) {
+            struct io_uring_sqe *sqe = ring_get_sqe(ring);
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = fd;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            sqe->user_data = (uint64_t)batch;
+        }
+
+        if (ring_run(ring, results, (unsigned)(batch + sync)) != 0) {
+            return -1;
+        }
+
+        /* Real errors fail the batch; short or cancelled writes are redone */
+        int redone = 0;
+        for (int i = 0; i < batch; i++) {
+            const UringWrite *w = &writes[done + i];
+            int res = results[i];
+            if (res < 0 && res != -ECANCELED) {
+                errno = -res;
+                return -1;
+            }
+            size_t written = res > 0 ? (size_t)res : 0;
+            if (written < w->len) {
+                if (finish_write(fd, (const uint8_t*)w->buf + written, w->len - written,
+                                 w->offset + written) != 0) {
+                    return -1;
+                }
+                redone = 1;
+            }
+        }
+        if (sync && (redone || results[batch] < 0) && uring_fdatasync(fd) != 0) {
+            return -1;
+        }
+        done += batch;
+    }
+    return 0;
+}
+
+/* Register buffers */
+int uring_register_buffers(uint8_t *const *buffers, size_t size, uint32_t count) {
+    UringRing *ring = thread_ring();
+    if (ring == NULL || ring->fixed != NULL) {
+        errno = ring == NULL ? ENOMEM : EBUSY;
+        return -1;
+    }
+
+    struct iovec *iov = (struct iovec*)calloc(count, sizeof(struct iovec));
+    ring->fixed = (uint8_t**)calloc(count, sizeof(uint8_t*));
+    if (iov == NULL || ring->fixed == NULL) {
+        free(iov);
+        free(ring->fixed);
+        ring->fixed = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = size;
+        ring->fixed[i] = buffers[i];
+    }
+
+    int rc = sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, count);
+    free(iov);
+    if (rc != 0) {
+        free(ring->fixed);
+        ring->fixed = NULL;
+        return -1;
+    }
+    ring->fixed_count = count;
+    ring->fixed_size = size;
+    return 0;
+}
+
+/* Unregister buffers */
+void uring_unregister_buffers(void) {
+    UringRing *ring = (UringRing*)pthread_getspecific(ring_key);
+    if (ring == NULL || ring->fixed == NULL) {
+        return;
+    }
+    sys_io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    free(ring->fixed);
+    ring->fixed = NULL;
+    ring->fixed_count = 0;
+    ring->fixed_size = 0;
+}
+
+#endif /* FT_HAVE_IO_URING */
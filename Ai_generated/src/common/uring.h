@@ -0,0 +1,59 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+ * Optional io_uring engine (Linux, built with `make IO_URING=1`).
+ *
+ * Each thread gets its own ring on first use. The single operations below
+ * mirror the syscalls they replace -- a byte count, or -1 with errno set --
+ * so callers keep their error handling and simply switch to them while
+ * uring_available() is true. Socket operations are bounded by a linked
+ * timeout (see uring_set_socket_timeout) and fail with EAGAIN the way
+ * SO_RCVTIMEO/SO_SNDTIMEO do in the blocking paths.
+ */
+
+#ifdef FT_HAVE_IO_URING
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Largest batch handed to the kernel in one submission */
+#define FT_URING_MAX_BATCH 32
+
+/* One positional write of a batch */
+typedef struct {
+    const void *buf;
+    size_t      len;
+    uint64_t    offset;
+} UringWrite;
+
+/* Whether the kernel supports io_uring; probed once (FT_IO_URING=0 disables) */
+int uring_available(void);
+
+/* Bound for socket operations in milliseconds (0 = wait forever) */
+void uring_set_socket_timeout(uint32_t timeout_ms);
+
+/* Socket operations */
+ssize_t uring_send(int fd, const void *buf, size_t len, int flags);
+ssize_t uring_sendmsg(int fd, const struct iovec *iov, int iovcnt, int flags);
+ssize_t uring_recv(int fd, void *buf, size_t len, int flags);
+
+/* File operations; buffers registered by this thread use fixed-buffer I/O */
+ssize_t uring_pread(int fd, void *buf, size_t len, uint64_t offset);
+ssize_t uring_pwrite(int fd, const void *buf, size_t len, uint64_t offset);
+int uring_fdatasync(int fd);
+
+/* Submit all writes with one syscall. With datasync, the writes are linked
+ * in a chain ending in an fdatasync that only runs if every write
+ * succeeded. Returns 0, or -1 with errno set. */
+int uring_pwrite_batch(int fd, const UringWrite *writes, int count, int datasync);
+
+/* Register count buffers of size bytes with the calling thread's ring */
+int uring_register_buffers(uint8_t *const *buffers, size_t size, uint32_t count);
+void uring_unregister_buffers(void);
+
+#endif /* FT_HAVE_IO_URING */
+
+#endif /* URING_H */
@@ -0,0 +1,290 @@
+#include "window.h"
+#include "logger.h"
+#include "bufpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* How often a sender waiting for the buffer pool checks for failure */
+#define WINDOW_POOL_POLL_MS 100
+
+/* Allocate window */
+int send_window_init(SendWindow *window, uint32_t capacity, uint32_t limit, size_t chunk_size, int packed) {
+    memset(window, 0, sizeof(SendWindow));
+
+    /* Before the slots: send_window_destroy() tears these down whenever
+     * slots is set */
+    platform_mutex_init(&window->lock);
+    platform_cond_init(&window->changed);
+
+    window->slots = (WindowSlot*)calloc(capacity, sizeof(WindowSlot));
+    if (window->slots == NULL) {
+        platform_cond_destroy(&window->changed);
+        platform_mutex_destroy(&window->lock);
+        return FT_ERR_OUT_OF_MEMORY;
+    }
+    window->capacity = capacity;
+    window->limit = limit < 1 ? 1 : limit > capacity ? capacity : limit;
+    window->chunk_size = chunk_size;
+    window->packed = packed;
+    return FT_SUCCESS;
+}
+
+/* Free window */
+void send_window_destroy(SendWindow *window) {
+    if (window->slots == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < window->capacity; i++) {
+        buffer_pool_release(window->slots[i].data);
+        buffer_pool_release(window->slots[i].packed);
+    }
+    free(window->slots);
+    window->slots = NULL;
+
+    platform_cond_destroy(&window->changed);
+    platform_mutex_destroy(&window->lock);
+}
+
+/* Change slot limit */
+void send_window_set_limit(SendWindow *window, uint32_t limit) {
+    platform_mutex_lock(&window->lock);
+    window->limit = limit < 1 ? 1 : limit > window->capacity ? window->capacity : limit;
+    platform_cond_broadcast(&window->changed);
+    platform_mutex_unlock(&window->lock);
+}
+
+/* Return a slot that no longer holds a chunk, and its buffers (caller holds lock) */
+static void slot_free(SendWindow *window, WindowSlot *slot) {
+    slot->state = SLOT_FREE;
+    window->in_flight--;
+    buffer_pool_release(slot->data);
+    buffer_pool_release(slot->packed);
+    slot->data = NULL;
+    slot->packed = NULL;
+}
+
+/* Give a slot its data buffer */
+int send_window_alloc(SendWindow *window, WindowSlot *slot) {
+    while (slot->data == NULL) {
+        slot->data = buffer_pool_acquire(window->chunk_size, WINDOW_POOL_POLL_MS);
+        if (slot->data == NULL) {
+            platform_mutex_lock(&window->lock);
+            int failed = window->failed;
+            platform_mutex_unlock(&window->lock);
+            if (failed) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Give a slot a compression buffer if one is free */
+int send_window_alloc_packed(SendWindow *window, WindowSlot *slot) {
+    if (slot->packed == NULL && window->packed) {
+        slot->packed = buffer_pool_try_acquire(window->chunk_size, NULL);
+    }
+    return slot->packed != NULL ? 0 : -1;
+}
+
+/* Find a slot awaiting retransmission (caller holds lock) */
+static WindowSlot* find_retransmit_slot(SendWindow *window) {
+    for (uint32_t i = 0; i < window->capacity; i++) {
+        if (window->slots[i].state == SLOT_RETRANSMIT) {
+            return &window->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Wait for sender work */
+WindowEvent send_window_wait(SendWindow *window, uint64_t next_chunk_id,
+                             uint64_t total_chunks, WindowSlot **slot) {
+    WindowEvent event;
+
+    platform_mutex_lock(&window->lock);
+    for (;;) {
+        if (window->failed) {
+            event = WINDOW_FAILED;
+            break;
+        }
+
+        /* Retransmissions take priority over new data */
+        if (window->retransmit_pending > 0) {
+            *slot = find_retransmit_slot(window);
+            event = WINDOW_RETRANSMIT;
+            break;
+        }
+
+        if (next_chunk_id < total_chunks) {
+            WindowSlot *candidate = &window->slots[next_chunk_id % window->capacity];
+            if (candidate->state == SLOT_FREE && window->in_flight < window->limit) {
+                candidate->chunk_id = next_chunk_id;
+                candidate->retry_count = 0;
+                candidate->zero = 0;
+                *slot = candidate;
+                event = WINDOW_SEND_NEW;
+                break;
+            }
+        } else if (window->in_flight == 0) {
+            event = WINDOW_DRAINED;
+            break;
+        }
+
+        platform_cond_wait(&window->changed, &window->lock);
+    }
+    platform_mutex_unlock(&window->lock);
+
+    return event;
+}
+
+/* Mark slot as sent */
+void send_window_mark_sent(SendWindow *window, WindowSlot *slot, uint64_t sequence_num) {
+    platform_mutex_lock(&window->lock);
+    if (slot->state == SLOT_FREE) {
+        window->in_flight++;
+    } else if (slot->state == SLOT_RETRANSMIT) {
+        window->retransmit_pending--;
+        slot->retry_count++;
+    }
+    slot->state = SLOT_INFLIGHT;
+    slot->sent_seq = sequence_num;
+    slot->sent_time_us = platform_get_monotonic_us();
+    platform_mutex_unlock(&window->lock);
+}
+
+/* Release acknowledged slot (caller holds lock). Only chunks sent once
+ * give RTT samples: an ACK of a retransmitted one may be for either copy. */
+static void release_slot(SendWindow *window, WindowSlot *slot, uint64_t now_us) {
+    if (slot->state == SLOT_INFLIGHT) {
+        uint64_t rtt_us = now_us - slot->sent_time_us;
+        metrics_record(window->metrics, FT_PHASE_ACK_WAIT, rtt_us * 1000);
+        if (slot->retry_count == 0 && (window->rtt_us == 0 || rtt_us < window->rtt_us)) {
+            window->rtt_us = rtt_us;
+        }
+    }
+    if (slot->state == SLOT_RETRANSMIT) {
+        window->retransmit_pending--;
+    }
+    if (slot->holds > 0) {
+        slot->state = SLOT_ACKED;
+    } else {
+        slot_free(window, slot);
+    }
+    window->acked_chunks++;
+    window->acked_bytes += slot->data_size;
+}
+
+/* Queue slot for retransmission (caller holds lock); -1 if retries exhausted */
+static int request_retransmit(SendWindow *window, WindowSlot *slot) {
+    if (slot->retry_count + 1 >= FT_MAX_RETRIES) {
+        LOG_ERROR("Max retries exceeded for chunk %llu", (unsigned long long)slot->chunk_id);
+        window->failed = 1;
+        window->error = FT_ERR_CHECKSUM;
+        return -1;
+    }
+
+    LOG_WARN("Server requested retransmit of chunk %llu (%d/%d)",
+             (unsigned long long)slot->chunk_id, slot->retry_count + 1, FT_MAX_RETRIES - 1);
+    slot->state = SLOT_RETRANSMIT;
+    window->retransmit_pending++;
+    metrics_count(window->metrics, FT_COUNT_RETRANSMITS, 1);
+    return 0;
+}
+
+/* Process acknowledgment */
+int send_window_ack(SendWindow *window, uint64_t chunk_id, uint8_t status) {
+    int result = 0;
+
+    platform_mutex_lock(&window->lock);
+    WindowSlot *slot = &window->slots[chunk_id % window->capacity];
+    window->rtt_us = 0;
+
+    if (slot->state != SLOT_INFLIGHT || slot->chunk_id != chunk_id) {
+        /* Duplicate or stale ACK for a chunk no longer outstanding */
+        LOG_DEBUG("Ignoring ACK for chunk %llu (not in flight)", (unsigned long long)chunk_id);
+    } else if (status == 0) {
+        release_slot(window, slot, platform_get_monotonic_us());
+    } else {
+        result = request_retransmit(window, slot);
+    }
+
+    platform_cond_broadcast(&window->changed);
+    platform_mutex_unlock(&window->lock);
+    return result;
+}
+
+/* Process selective acknowledgment */
+int send_window_sack(SendWindow *window, const ChunkSack *sack) {
+    int result = 0;
+    uint64_t now_us = platform_get_monotonic_us();
+
+    platform_mutex_lock(&window->lock);
+    window->rtt_us = 0;
+    for (uint32_t i = 0; i < window->capacity && result == 0; i++) {
+        WindowSlot *slot = &window->slots[i];
+        if (slot->state == SLOT_FREE || slot->state == SLOT_ACKED) {
+            continue;
+        }
+
+        int received = (slot->chunk_id < sack->cumulative);
+        if (!received && slot->chunk_id - sack->cumulative < sack->bitmap_bits) {
+            uint64_t bit = slot->chunk_id - sack->cumulative;
+            received = (sack->bitmap[bit / 8] >> (bit % 8)) & 1;
+        }
+
+        if (received) {
+            release_slot(window, slot, now_us);
+        } else if (slot->state == SLOT_INFLIGHT && slot->sent_seq <= sack->highest_seq) {
+            /* Receiver processed this transmission but did not accept it */
+            result = request_retransmit(window, slot);
+        }
+    }
+
+    platform_cond_broadcast(&window->changed);
+    platform_mutex_unlock(&window->lock);
+    return result;
+}
+
+/* Skip chunk held by the receiver */
+void send_window_skip(SendWindow *window, WindowSlot *slot) {
+    platform_mutex_lock(&window->lock);
+    if (slot->holds > 0) {
+        slot->state = SLOT_ACKED;
+        window->in_flight++;
+    } else {
+        buffer_pool_release(slot->data);
+        buffer_pool_release(slot->packed);
+        slot->data = NULL;
+        slot->packed = NULL;
+    }
+    platform_mutex_unlock(&window->lock);
+}
+
+/* Take hold on slot data */
+void send_window_hold(SendWindow *window, WindowSlot *slot) {
+    platform_mutex_lock(&window->lock);
+    slot->holds++;
+    platform_mutex_unlock(&window->lock);
+}
+
+/* Drop hold; frees the slot if it was already acknowledged */
+void send_window_release(SendWindow *window, WindowSlot *slot) {
+    platform_mutex_lock(&window->lock);
+    if (--slot->holds == 0 && slot->state == SLOT_ACKED) {
+        slot_free(window, slot);
+        platform_cond_broadcast(&window->changed);
+    }
+    platform_mutex_unlock(&window->lock);
+}
+
+/* Abort transfer */
+void send_window_fail(SendWindow *window, FTErrorCode error) {
+    platform_mutex_lock(&window->lock);
+    if (!window->failed) {
+        window->failed = 1;
+        window->error = error;
+    }
+    platform_cond_broadcast(&window->changed);
+    platform_mutex_unlock(&window->lock);
+}
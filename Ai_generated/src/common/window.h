@@ -0,0 +1,124 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "protocol.h"
+#include "metrics.h"
+
+/* Window slot states */
+typedef enum {
+    SLOT_FREE = 0,        /* Available for the next chunk */
+    SLOT_INFLIGHT = 1,    /* Sent, awaiting acknowledgment */
+    SLOT_RETRANSMIT = 2,  /* Receiver requested retransmission */
+    SLOT_ACKED = 3        /* Acknowledged, data still held by background work */
+} SlotState;
+
+/* One unacknowledged chunk */
+typedef struct {
+    SlotState state;
+    uint64_t  chunk_id;
+    uint64_t  chunk_offset;
+    size_t    data_size;
+    uint32_t  data_crc;       /* CRC32 of data (zero-copy sends) */
+    uint8_t  *data;           /* Chunk payload, kept until acknowledged and released (buffer pool;
+                               * taken by send_window_alloc() or handed over by read-ahead) */
+    const uint8_t *payload;   /* The chunk's bytes: data, or its place in a file mapping */
+    uint8_t  *packed;         /* LZ4 block of data, if the window was made with compression
+                               * (buffer pool, like data) */
+    size_t    packed_size;    /* 0: data is sent uncompressed */
+    int       zero;           /* All zeros: sent as a hole record (FT_FLAG_ZERO), data unused */
+    uint32_t  holds;          /* Background tasks still reading data */
+    int       retry_count;    /* Retransmissions so far */
+    uint64_t  sent_seq;       /* Message sequence number of most recent transmission */
+    uint64_t  sent_time_us;   /* Time of most recent transmission */
+} WindowSlot;
+
+/* Events returned to the sending thread */
+typedef enum {
+    WINDOW_SEND_NEW = 0,      /* Slot is free for the next chunk */
+    WINDOW_RETRANSMIT = 1,    /* Slot must be sent again */
+    WINDOW_DRAINED = 2,       /* All chunks sent and acknowledged */
+    WINDOW_FAILED = 3         /* Transfer aborted (see window error) */
+} WindowEvent;
+
+/*
+ * Sliding send window. Chunk N occupies slot N % capacity, so at most
+ * `capacity` chunks starting at the oldest unacknowledged one are in flight,
+ * and no more than `limit` slots are in use at a time. The limit follows
+ * the path (see PathEstimator). Slots take buffers from the buffer pool
+ * for each chunk and return them once it is acknowledged, so a spent pool
+ * budget holds the sender back as well. The sending thread and the ACK reader synchronize
+ * through `lock`/`changed`.
+ */
+typedef struct {
+    WindowSlot *slots;
+    uint32_t    capacity;
+    uint32_t    limit;
+    size_t      chunk_size;
+    int         packed;               /* Slots get compression buffers */
+    uint32_t    in_flight;            /* Slots not FREE */
+    uint32_t    retransmit_pending;   /* Slots in RETRANSMIT state */
+    uint64_t    acked_chunks;
+    uint64_t    acked_bytes;
+    uint64_t    rtt_us;               /* Shortest round trip of the chunks released by the latest ACK
+                                       * that were sent only once (0: none) */
+    int         failed;
+    FTErrorCode error;
+    TransferMetrics *metrics;         /* ACK waits and retransmissions are recorded here (optional) */
+    ft_mutex_t  lock;
+    ft_cond_t   changed;
+} SendWindow;
+
+/* Allocate window with capacity slots for chunks of chunk_size bytes, and
+ * as much again per slot for compressed copies if packed is set; the limit
+ * starts at limit slots */
+int send_window_init(SendWindow *window, uint32_t capacity, uint32_t limit, size_t chunk_size, int packed);
+
+/* Change the number of slots in use at once (1 to capacity) */
+void send_window_set_limit(SendWindow *window, uint32_t limit);
+
+/* Free window resources */
+void send_window_destroy(SendWindow *window);
+
+/* Block until the sender has work: a free slot for next_chunk_id, a
+ * retransmission, completion, or failure. Returns the slot in *slot. */
+WindowEvent send_window_wait(SendWindow *window, uint64_t next_chunk_id,
+                             uint64_t total_chunks, WindowSlot **slot);
+
+/* Give a new slot a data buffer, waiting for the buffer pool if need be.
+ * Returns 0, or -1 if the window failed meanwhile. */
+int send_window_alloc(SendWindow *window, WindowSlot *slot);
+
+/* Give a new slot a compression buffer if the pool has one free; -1 if
+ * not (the chunk is then sent raw) */
+int send_window_alloc_packed(SendWindow *window, WindowSlot *slot);
+
+/* Mark slot as (re)transmitted with sequence_num; must be called before the chunk is sent */
+void send_window_mark_sent(SendWindow *window, WindowSlot *slot, uint64_t sequence_num);
+
+/* Process acknowledgment from the receiver (status 0 = OK, else retransmit).
+ * Returns 0 on success, -1 if the chunk exceeded its retry limit. */
+int send_window_ack(SendWindow *window, uint64_t chunk_id, uint8_t status);
+
+/* Process a selective acknowledgment. In-flight chunks not covered by it
+ * whose last transmission was already processed by the receiver
+ * (sent_seq <= highest_seq) were rejected and are queued for retransmission.
+ * Returns 0 on success, -1 if a chunk exceeded its retry limit. */
+int send_window_sack(SendWindow *window, const ChunkSack *sack);
+
+/* Give back a slot taken for a chunk the receiver already holds, without
+ * sending it; it stays occupied until background holds are released.
+ * Skipped chunks do not count as acknowledged. */
+void send_window_skip(SendWindow *window, WindowSlot *slot);
+
+/* Keep slot data alive past its acknowledgment until send_window_release()
+ * is called; take holds before send_window_mark_sent() */
+void send_window_hold(SendWindow *window, WindowSlot *slot);
+void send_window_release(SendWindow *window, WindowSlot *slot);
+
+/* Abort the transfer and wake all waiters */
+void send_window_fail(SendWindow *window, FTErrorCode error);
+
+#endif /* WINDOW_H */
@@ -0,0 +1,180 @@
+#include "zeroscan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define FT_ARCH_X86
+    #include <immintrin.h>
+#elif defined(__aarch64__)
+    #define FT_ARCH_ARM64
+    #include <arm_neon.h>
+#endif
+
+/* Bytes ORed together between tests */
+#define ZERO_STEP 128
+
+typedef int (*zero_kernel_fn)(const uint8_t *data, size_t length);
+
+/* Portable kernel: 64-bit words, then the bytes left over */
+static int zero_kernel_word(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    for (; i + ZERO_STEP <= length; i += ZERO_STEP) {
+        uint64_t acc = 0;
+        for (size_t j = 0; j < ZERO_STEP; j += 8) {
+            uint64_t word;
+            memcpy(&word, data + i + j, sizeof(word));
+            acc |= word;
+        }
+        if (acc != 0) {
+            return 0;
+        }
+    }
+    uint8_t acc = 0;
+    for (; i < length; i++) {
+        acc |= data[i];
+    }
+    return acc == 0;
+}
+
+#ifdef FT_ARCH_X86
+/* SSE2 kernel: eight 16-byte loads per test */
+__attribute__((target("sse2")))
+static int zero_kernel_sse2(const uint8_t *data, size_t length) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + ZERO_STEP <= length; i += ZERO_STEP) {
+        const __m128i *p = (const __m128i*)(data + i);
+        __m128i a = _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+        __m128i b = _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+        __m128i c = _mm_or_si128(_mm_loadu_si128(p + 4), _mm_loadu_si128(p + 5));
+        __m128i d = _mm_or_si128(_mm_loadu_si128(p + 6), _mm_loadu_si128(p + 7));
+        __m128i v = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            return 0;
+        }
+    }
+    return zero_kernel_word(data + i, length - i);
+}
+
+/* AVX2 kernel: four 32-byte loads per test */
+__attribute__((target("avx2")))
+static int zero_kernel_avx2(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    for (; i + ZERO_STEP <= length; i += ZERO_STEP) {
+        const __m256i *p = (const __m256i*)(data + i);
+        __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+                                    _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+        if (!_mm256_testz_si256(v, v)) {
+            return 0;
+        }
+    }
+    return zero_kernel_word(data + i, length - i);
+}
+
+static int x86_has_sse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static int x86_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif /* FT_ARCH_X86 */
+
+#ifdef FT_ARCH_ARM64
+/* NEON kernel: eight 16-byte loads per test (NEON is baseline on ARMv8) */
+static int zero_kernel_neon(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    for (; i + ZERO_STEP <= length; i += ZERO_STEP) {
+        const uint8_t *p = data + i;
+        uint8x16_t a = vorrq_u8(vld1q_u8(p), vld1q_u8(p + 16));
+        uint8x16_t b = vorrq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48));
+        uint8x16_t c = vorrq_u8(vld1q_u8(p + 64), vld1q_u8(p + 80));
+        uint8x16_t d = vorrq_u8(vld1q_u8(p + 96), vld1q_u8(p + 112));
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) != 0) {
+            return 0;
+        }
+    }
+    return zero_kernel_word(data + i, length - i);
+}
+#endif /* FT_ARCH_ARM64 */
+
+/* Kernel registry, fastest first */
+typedef struct {
+    const char *name;
+    zero_kernel_fn kernel;
+    int (*supported)(void);
+} ZeroImpl;
+
+static int always_supported(void) {
+    return 1;
+}
+
+static const ZeroImpl zero_impls[] = {
+#ifdef FT_ARCH_X86
+    { "avx2", zero_kernel_avx2, x86_has_avx2 },
+    { "sse2", zero_kernel_sse2, x86_has_sse2 },
+#endif
+#ifdef FT_ARCH_ARM64
+    { "neon", zero_kernel_neon, always_supported },
+#endif
+    { "word", zero_kernel_word, always_supported },
+};
+
+#define ZERO_NUM_IMPLS (sizeof(zero_impls) / sizeof(zero_impls[0]))
+
+static const ZeroImpl *zero_active = NULL;
+
+/* Select the fastest supported kernel (idempotent) */
+void zero_init_dispatch(void) {
+    if (__atomic_load_n(&zero_active, __ATOMIC_ACQUIRE) != NULL) {
+        return;
+    }
+
+    const char *forced = getenv("FT_ZERO_IMPL");
+    const ZeroImpl *chosen = NULL;
+    for (size_t i = 0; i < ZERO_NUM_IMPLS && chosen == NULL; i++) {
+        if (forced != NULL && strcmp(forced, zero_impls[i].name) != 0) {
+            continue;
+        }
+        if (zero_impls[i].supported()) {
+            chosen = &zero_impls[i];
+        }
+    }
+    for (size_t i = 0; i < ZERO_NUM_IMPLS && chosen == NULL; i++) {
+        if (zero_impls[i].supported()) {
+            chosen = &zero_impls[i];
+        }
+    }
+
+    __atomic_store_n(&zero_active, chosen, __ATOMIC_RELEASE);
+}
+
+/* Select kernel by name */
+int zero_set_implementation(const char *name) {
+    zero_init_dispatch();
+    for (size_t i = 0; i < ZERO_NUM_IMPLS; i++) {
+        if (strcmp(name, zero_impls[i].name) == 0 && zero_impls[i].supported()) {
+            __atomic_store_n(&zero_active, &zero_impls[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Name of the active kernel */
+const char* zero_implementation(void) {
+    zero_init_dispatch();
+    return zero_active->name;
+}
+
+/* Test data for zeros */
+int zero_check(const uint8_t *data, size_t length) {
+    const ZeroImpl *impl = __atomic_load_n(&zero_active, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        zero_init_dispatch();
+        impl = __atomic_load_n(&zero_active, __ATOMIC_ACQUIRE);
+    }
+    return impl->kernel(data, length);
+}
@@ -0,0 +1,29 @@
+#ifndef ZEROSCAN_H
+#define ZEROSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * All-zero test for chunks about to be sent, so zero-filled stretches of
+ * files go out as holes (FT_FLAG_ZERO). The kernels OR 128 bytes at a time
+ * together in SIMD registers (AVX2, SSE2, NEON) or in 64-bit words and
+ * test the result once per step; real data usually fails within the first
+ * step, so the test costs little on chunks that are not zero.
+ */
+
+/* Select the fastest kernel for this CPU (idempotent; the FT_ZERO_IMPL
+ * environment variable may force a kernel by name) */
+void zero_init_dispatch(void);
+
+/* Force a kernel by name ("avx2", "sse2", "neon", "word"); returns -1 if
+ * unknown or unsupported on this CPU */
+int zero_set_implementation(const char *name);
+
+/* Name of the active kernel */
+const char* zero_implementation(void);
+
+/* Whether every byte of data is zero (1) or not (0) */
+int zero_check(const uint8_t *data, size_t length);
+
+#endif /* ZEROSCAN_H */
@@ -0,0 +1,149 @@
+#include "chunkstore.h"
+#include "../common/checksum.h"
+#include "../common/logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHUNK_TEMP_SUFFIX   ".tmp"
+
+/* Path of the chunk with this leaf */
+static void chunk_path(const ChunkStore *store, const uint8_t leaf[FT_SHA256_SIZE], char *path, size_t size) {
+    char hex[FT_SHA256_DIGEST_SIZE * 2 + 1];
+    sha256_to_hex(leaf, hex);
+    snprintf(path, size, "%s%c%s", store->dir, PATH_SEPARATOR, hex);
+}
+
+/* Remove a chunk file left half written */
+static void remove_temp(const char *name, void *context) {
+    ChunkStore *store = (ChunkStore*)context;
+    size_t length = strlen(name);
+    size_t suffix = strlen(CHUNK_TEMP_SUFFIX);
+    char path[1024];
+
+    if (name[0] == '.' && length > suffix && strcmp(name + length - suffix, CHUNK_TEMP_SUFFIX) == 0) {
+        snprintf(path, sizeof(path), "%s%c%s", store->dir, PATH_SEPARATOR, name);
+        file_delete(path);
+    }
+}
+
+/* Open store */
+int chunk_store_open(ChunkStore *store, const char *dir, int sync, FTErrorCode *error) {
+    memset(store, 0, sizeof(*store));
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    store->sync = sync;
+
+    if (file_create_directory(dir) != 0 || file_list_directory(dir, remove_temp, store) != 0) {
+        LOG_ERROR("Failed to open chunk store %s", dir);
+        if (error) *error = FT_ERR_FILE_OPEN;
+        return -1;
+    }
+    platform_mutex_init(&store->lock);
+    if (error) *error = FT_SUCCESS;
+    return 0;
+}
+
+/* Close store */
+void chunk_store_close(ChunkStore *store) {
+    platform_mutex_destroy(&store->lock);
+}
+
+/* Look up chunk */
+int chunk_store_contains(ChunkStore *store, const uint8_t leaf[FT_SHA256_SIZE], uint32_t size) {
+    char path[1024];
+    uint64_t stored_size;
+
+    chunk_path(store, leaf, path, sizeof(path));
+    return file_exists(path) && file_get_size(path, &stored_size, NULL) == 0 && stored_size == size;
+}
+
+/* Count lookups */
+void chunk_store_count_lookups(ChunkStore *store, uint64_t lookups, uint64_t hits, uint64_t saved_bytes) {
+    platform_mutex_lock(&store->lock);
+    store->stats.lookups += lookups;
+    store->stats.hits += hits;
+    store->stats.saved_bytes += saved_bytes;
+    platform_mutex_unlock(&store->lock);
+}
+
+/* Copy chunk out */
+int chunk_store_fetch(ChunkStore *store, const uint8_t leaf[FT_SHA256_SIZE], uint32_t size,
+                      OutputFile *out, uint64_t offset, FTErrorCode *error) {
+    char path[1024];
+    CopyMethod method;
+
+    chunk_path(store, leaf, path, sizeof(path));
+    if (file_output_copy(out, offset, path, 0, size, &method, error) != 0) {
+        return -1;
+    }
+    if (method == COPY_SHARED) {
+        platform_mutex_lock(&store->lock);
+        store->stats.shared++;
+        platform_mutex_unlock(&store->lock);
+    }
+    return 0;
+}
+
+/* Add a committed file's chunks */
+void chunk_store_add_file(ChunkStore *store, const char *path, const FileInfo *file_info,
+                          const TreeHash *tree) {
+    uint64_t added = 0;
+    uint64_t added_bytes = 0;
+    char final_path[1024];
+    char temp_path[1100];
+
+    for (uint64_t i = 0; i < file_info->total_chunks && i < tree->num_leaves; i++) {
+        uint64_t offset = i * file_info->chunk_size;
+        uint32_t size = file_info->file_size - offset < file_info->chunk_size ?
+                        (uint32_t)(file_info->file_size - offset) : file_info->chunk_size;
+        if (chunk_store_contains(store, tree->leaves[i], size)) {
+            continue;
+        }
+
+        /* Written aside and renamed, so a lookup never finds a partial chunk */
+        platform_mutex_lock(&store->lock);
+        uint64_t serial = store->temp_serial++;
+        platform_mutex_unlock(&store->lock);
+        chunk_path(store, tree->leaves[i], final_path, sizeof(final_path));
+        snprintf(temp_path, sizeof(temp_path), "%s%c.%s.%llu" CHUNK_TEMP_SUFFIX, store->dir, PATH_SEPARATOR,
+                 final_path + strlen(store->dir) + 1, (unsigned long long)serial);
+
+        FTErrorCode error;
+        if (file_copy_range(path, offset, size, temp_path, store->sync, NULL, &error) != 0) {
+            LOG_WARN("Failed to add chunk %llu of %s to the chunk store: %s", (unsigned long long)i,
+                     path, protocol_get_error_string(error));
+            file_delete(temp_path);
+            break;
+        }
+#ifdef FT_PLATFORM_WINDOWS
+        /* Another upload may have stored the same chunk meanwhile */
+        if (file_exists(final_path)) {
+            file_delete(temp_path);
+            continue;
+        }
+#endif
+        if (rename(temp_path, final_path) != 0) {
+            LOG_WARN("Failed to rename %s to %s: %s", temp_path, final_path, strerror(errno));
+            file_delete(temp_path);
+            break;
+        }
+        added++;
+        added_bytes += size;
+    }
+
+    if (added > 0) {
+        LOG_INFO("Added %llu chunk(s) (%llu bytes) to the chunk store",
+                 (unsigned long long)added, (unsigned long long)added_bytes);
+    }
+    platform_mutex_lock(&store->lock);
+    store->stats.added += added;
+    store->stats.added_bytes += added_bytes;
+    platform_mutex_unlock(&store->lock);
+}
+
+/* Read counters */
+void chunk_store_get_stats(ChunkStore *store, ChunkStoreStats *stats) {
+    platform_mutex_lock(&store->lock);
+    *stats = store->stats;
+    platform_mutex_unlock(&store->lock);
+}
@@ -0,0 +1,61 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <stdint.h>
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/fileio.h"
+#include "../common/treehash.h"
+
+/*
+ * Content-addressed store of received chunks (-S), shared by every upload
+ * so a chunk the server has seen in any file need not be sent again. Each
+ * chunk is a file in the store directory named by the hex of its tree
+ * leaf. Chunks enter the store from files that passed verification and
+ * are copied out into the temp file of a new upload; on file systems with
+ * reflinks both copies share their blocks instead. Nothing is evicted.
+ */
+
+/* Counters since the server started */
+typedef struct {
+    uint64_t lookups;          /* Chunk leaves looked up */
+    uint64_t hits;             /* ...found in the store */
+    uint64_t saved_bytes;      /* Chunk bytes the hits kept off the network */
+    uint64_t shared;           /* Hits placed without copying their data */
+    uint64_t added;            /* Chunks stored from committed files */
+    uint64_t added_bytes;
+} ChunkStoreStats;
+
+typedef struct {
+    char            dir[512];
+    int             sync;          /* Sync chunk files before they become visible */
+    uint64_t        temp_serial;   /* Names chunk files being written */
+    ChunkStoreStats stats;
+    ft_mutex_t      lock;          /* Guards temp_serial and stats */
+} ChunkStore;
+
+/* Open the store in dir, creating it and removing chunk files left half
+ * written by an earlier run */
+int chunk_store_open(ChunkStore *store, const char *dir, int sync, FTErrorCode *error);
+
+void chunk_store_close(ChunkStore *store);
+
+/* Whether the store holds the chunk with this leaf, of size bytes */
+int chunk_store_contains(ChunkStore *store, const uint8_t leaf[FT_SHA256_SIZE], uint32_t size);
+
+/* Count a batch of lookups, hits of them, and the bytes they saved */
+void chunk_store_count_lookups(ChunkStore *store, uint64_t lookups, uint64_t hits, uint64_t saved_bytes);
+
+/* Copy the stored chunk with this leaf into out at offset */
+int chunk_store_fetch(ChunkStore *store, const uint8_t leaf[FT_SHA256_SIZE], uint32_t size,
+                      OutputFile *out, uint64_t offset, FTErrorCode *error);
+
+/* Store every chunk of the committed file at path that the store lacks;
+ * tree holds the file's verified leaves */
+void chunk_store_add_file(ChunkStore *store, const char *path, const FileInfo *file_info,
+                          const TreeHash *tree);
+
+/* Snapshot of the counters */
+void chunk_store_get_stats(ChunkStore *store, ChunkStoreStats *stats);
+
+#endif /* CHUNKSTORE_H */
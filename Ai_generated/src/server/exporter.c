@@ -0,0 +1,150 @@
+#include "exporter.h"
+#include "../common/network.h"
+#include "../common/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPORTER_POLL_MS      200         /* How often the thread checks for exporter_stop() */
+#define EXPORTER_IO_SECONDS   2           /* A scraper gets this long to send its request and read the reply */
+#define EXPORTER_REQUEST_MAX  2048
+#define EXPORTER_BODY_MAX     (64 * 1024)
+
+/* Bound the time a blocking send may take on a scraper's socket */
+static void set_send_timeout(socket_t sock) {
+#ifdef FT_PLATFORM_WINDOWS
+    DWORD timeout_ms = EXPORTER_IO_SECONDS * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout_ms, sizeof(timeout_ms));
+#else
+    struct timeval timeout;
+    timeout.tv_sec = EXPORTER_IO_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+/* Send all of text; plain send() so the timeout holds with io_uring builds too */
+static int send_text(socket_t sock, const char *text, size_t length) {
+    while (length > 0) {
+        int sent = send(sock, text, (int)length, 0);
+        if (sent <= 0) {
+            return -1;
+        }
+        text += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/* Send an HTTP/1.0 response and its body */
+static void send_response(socket_t sock, const char *status, const char *body, size_t length) {
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 %s\r\n"
+                                 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: close\r\n\r\n",
+                                 status, length);
+    if (send_text(sock, header, (size_t)header_length) == 0) {
+        send_text(sock, body, length);
+    }
+}
+
+/* Read one request and answer it */
+static void serve_request(MetricsExporter *exporter, socket_t sock, char *body) {
+    char request[EXPORTER_REQUEST_MAX];
+    size_t length = 0;
+
+    /* Only the request line matters, but the headers are read so closing
+     * the socket does not reset the connection before the reply */
+    for (;;) {
+        if (length + 1 >= sizeof(request) || socket_wait_readable(sock, EXPORTER_IO_SECONDS * 1000) <= 0) {
+            return;
+        }
+        int received = recv(sock, request + length, (int)(sizeof(request) - 1 - length), 0);
+        if (received <= 0) {
+            return;
+        }
+        length += (size_t)received;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0) {
+        size_t body_length = metrics_format_prometheus(exporter->metrics, body, EXPORTER_BODY_MAX);
+        body_length = scheduler_format_prometheus(exporter->scheduler, body, EXPORTER_BODY_MAX, body_length);
+        send_response(sock, "200 OK", body, body_length);
+    } else {
+        static const char not_found[] = "Metrics are served at /metrics\n";
+        send_response(sock, "404 Not Found", not_found, sizeof(not_found) - 1);
+    }
+}
+
+/* Exporter thread: accept scrapers until stopped */
+static void exporter_thread(void *arg) {
+    MetricsExporter *exporter = (MetricsExporter*)arg;
+    char *body = (char*)malloc(EXPORTER_BODY_MAX);
+
+    if (body == NULL) {
+        LOG_ERROR("Failed to allocate metrics buffer");
+        return;
+    }
+    while (!__atomic_load_n(&exporter->stop, __ATOMIC_ACQUIRE)) {
+        if (socket_wait_readable(exporter->listen_sock, EXPORTER_POLL_MS) <= 0) {
+            continue;
+        }
+        socket_t sock = socket_accept_connection(exporter->listen_sock, NULL, 0, NULL);
+        if (sock == INVALID_SOCKET_VALUE) {
+            continue;
+        }
+        set_send_timeout(sock);
+        serve_request(exporter, sock, body);
+        close_socket(sock);
+    }
+    free(body);
+}
+
+/* Start exporter */
+int exporter_start(MetricsExporter *exporter, uint16_t port, const TransferMetrics *metrics,
+                   Scheduler *scheduler, FTErrorCode *error) {
+    memset(exporter, 0, sizeof(*exporter));
+    exporter->metrics = metrics;
+    exporter->scheduler = scheduler;
+
+    exporter->listen_sock = socket_create(error);
+    if (exporter->listen_sock == INVALID_SOCKET_VALUE) {
+        return -1;
+    }
+    socket_set_reuseaddr(exporter->listen_sock, 1, NULL);
+    if (socket_bind_and_listen(exporter->listen_sock, port, 16, error) != 0) {
+        goto fail;
+    }
+    if (platform_thread_create(&exporter->thread, exporter_thread, exporter) != 0) {
+        LOG_ERROR("Failed to start metrics exporter thread");
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        goto fail;
+    }
+    exporter->running = 1;
+    LOG_INFO("Serving metrics at http://0.0.0.0:%u/metrics", port);
+    return 0;
+
+fail:
+    close_socket(exporter->listen_sock);
+    exporter->listen_sock = INVALID_SOCKET_VALUE;
+    return -1;
+}
+
+/* Stop exporter */
+void exporter_stop(MetricsExporter *exporter) {
+    if (exporter->running) {
+        __atomic_store_n(&exporter->stop, 1, __ATOMIC_RELEASE);
+        platform_thread_join(exporter->thread);
+        exporter->running = 0;
+    }
+    if (exporter->listen_sock != INVALID_SOCKET_VALUE) {
+        close_socket(exporter->listen_sock);
+        exporter->listen_sock = INVALID_SOCKET_VALUE;
+    }
+}
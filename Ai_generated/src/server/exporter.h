@@ -0,0 +1,33 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <stdint.h>
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/metrics.h"
+#include "scheduler.h"
+
+/*
+ * Optional HTTP endpoint (-M) serving the server's metrics and the
+ * scheduler's allocations in the Prometheus text format at /metrics. A
+ * thread of its own answers one request per connection, so a slow scraper
+ * never holds up the event loops; the metrics are read with relaxed loads
+ * while they are updated, the allocations under the scheduler's lock.
+ */
+typedef struct {
+    socket_t               listen_sock;
+    const TransferMetrics *metrics;
+    Scheduler             *scheduler;
+    ft_thread_t            thread;
+    int                    running;
+    int                    stop;
+} MetricsExporter;
+
+/* Listen on port and start serving metrics */
+int exporter_start(MetricsExporter *exporter, uint16_t port, const TransferMetrics *metrics,
+                   Scheduler *scheduler, FTErrorCode *error);
+
+/* Stop serving and close the listener */
+void exporter_stop(MetricsExporter *exporter);
+
+#endif /* EXPORTER_H */
@@ -0,0 +1,200 @@
+#include "partial.h"
+#include "../common/platform.h"
+#include "../common/checksum.h"
+#include "../common/fileio.h"
+#include "../common/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define PARTIAL_MAGIC       "FTPART01"
+#define PARTIAL_SUFFIX      ".part"
+
+/* magic(8) file_size(8) timestamp(8) total_chunks(8) held(8) chunk_size(4)
+ * checksum_type(1) reserved(3) filename(256); then the chunk bitmap, one
+ * leaf per held chunk in chunk order, and a CRC32 of everything before it */
+#define PARTIAL_HEADER_SIZE (48 + FT_MAX_FILENAME_LEN)
+
+/* Build record path */
+void partial_build_path(const char *output_dir, const char *name, char *path, size_t size) {
+    char flat[FT_FLAT_NAME_MAX + 1];
+    file_flatten_name(name, flat, sizeof(flat));
+    snprintf(path, size, "%s%c.%s" PARTIAL_SUFFIX, output_dir, PATH_SEPARATOR, flat);
+}
+
+/* Parse record name */
+int partial_parse_name(const char *entry, char *name, size_t size) {
+    size_t length = strlen(entry);
+    size_t suffix = strlen(PARTIAL_SUFFIX);
+
+    if (entry[0] != '.' || length <= suffix + 1 ||
+        strcmp(entry + length - suffix, PARTIAL_SUFFIX) != 0 || length - suffix - 1 >= size) {
+        return -1;
+    }
+    /* Records of files in subdirectories sit in output_dir too */
+    for (size_t i = 0; i < length - suffix - 1; i++) {
+        name[i] = (entry[i + 1] == FT_FLAT_SEPARATOR) ? '/' : entry[i + 1];
+    }
+    name[length - suffix - 1] = '\0';
+    return 0;
+}
+
+/* Store 64-bit value in network byte order */
+static void put_u64(uint8_t *buffer, uint64_t value) {
+    value = htonll(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Load 64-bit value in network byte order */
+static uint64_t get_u64(const uint8_t *buffer) {
+    uint64_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohll(value);
+}
+
+/* Store 32-bit value in network byte order */
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+/* Load 32-bit value in network byte order */
+static uint32_t get_u32(const uint8_t *buffer) {
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohl(value);
+}
+
+/* Fill the header fields that identify the file */
+static void partial_write_header(uint8_t *buffer, const FileInfo *file_info, uint64_t held) {
+    memset(buffer, 0, PARTIAL_HEADER_SIZE);
+    memcpy(buffer, PARTIAL_MAGIC, 8);
+    put_u64(buffer + 8, file_info->file_size);
+    put_u64(buffer + 16, file_info->timestamp);
+    put_u64(buffer + 24, file_info->total_chunks);
+    put_u64(buffer + 32, held);
+    put_u32(buffer + 40, file_info->chunk_size);
+    buffer[44] = file_info->checksum_type;
+    memcpy(buffer + 48, file_info->filename, FT_MAX_FILENAME_LEN);
+    buffer[48 + FT_MAX_FILENAME_LEN - 1] = '\0';
+}
+
+/* Load record */
+uint64_t partial_load(const char *path, const FileInfo *file_info, ChunkBitmap *held, TreeHash *tree) {
+    uint8_t header[PARTIAL_HEADER_SIZE];
+    uint8_t expected[PARTIAL_HEADER_SIZE];
+    uint8_t *buffer = NULL;
+    uint64_t size;
+    uint64_t count = 0;
+
+    if (!file_exists(path) || file_get_size(path, &size, NULL) != 0) {
+        return 0;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_WARN("Failed to open upload record %s: %s", path, strerror(errno));
+        return 0;
+    }
+
+    /* A record for another version of the file (or a torn write) is ignored */
+    size_t bitmap_bytes = (size_t)((file_info->total_chunks + 7) / 8);
+    uint64_t stored = 0;
+    if (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        stored = get_u64(header + 32);
+        partial_write_header(expected, file_info, stored);
+    }
+    if (stored == 0 || stored > file_info->total_chunks ||
+        memcmp(header, expected, PARTIAL_HEADER_SIZE) != 0 ||
+        size != PARTIAL_HEADER_SIZE + bitmap_bytes + stored * FT_SHA256_DIGEST_SIZE + 4) {
+        LOG_INFO("Upload record %s does not match this file, starting over", path);
+        goto done;
+    }
+
+    size_t rest = (size_t)size - PARTIAL_HEADER_SIZE;
+    buffer = (uint8_t*)malloc((size_t)size);
+    if (buffer == NULL) {
+        goto done;
+    }
+    memcpy(buffer, header, PARTIAL_HEADER_SIZE);
+    if (fread(buffer + PARTIAL_HEADER_SIZE, 1, rest, file) != rest ||
+        get_u32(buffer + size - 4) != crc32_compute(buffer, (size_t)size - 4)) {
+        LOG_WARN("Upload record %s is damaged, starting over", path);
+        goto done;
+    }
+
+    const uint8_t *bitmap = buffer + PARTIAL_HEADER_SIZE;
+    const uint8_t *leaf = bitmap + bitmap_bytes;
+    for (uint64_t i = 0; i < file_info->total_chunks && count < stored; i++) {
+        if (bitmap[i / 8] & (1u << (i % 8))) {
+            bitmap_set(held, i);
+            memcpy(tree->leaves[i], leaf, FT_SHA256_DIGEST_SIZE);
+            leaf += FT_SHA256_DIGEST_SIZE;
+            count++;
+        }
+    }
+
+done:
+    fclose(file);
+    free(buffer);
+    return count;
+}
+
+/* Save record */
+int partial_save(const char *path, const FileInfo *file_info, const ChunkBitmap *held,
+                 const TreeHash *tree, FTErrorCode *error) {
+    size_t bitmap_bytes = (size_t)((file_info->total_chunks + 7) / 8);
+    size_t size = PARTIAL_HEADER_SIZE + bitmap_bytes + (size_t)held->num_set * FT_SHA256_DIGEST_SIZE + 4;
+    char temp_path[1100];
+    int result = -1;
+
+    uint8_t *buffer = (uint8_t*)calloc(1, size);
+    if (buffer == NULL) {
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    partial_write_header(buffer, file_info, held->num_set);
+    uint8_t *bitmap = buffer + PARTIAL_HEADER_SIZE;
+    uint8_t *leaf = bitmap + bitmap_bytes;
+    for (uint64_t i = 0; i < file_info->total_chunks; i++) {
+        if (bitmap_test(held, i)) {
+            bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+            memcpy(leaf, tree->leaves[i], FT_SHA256_DIGEST_SIZE);
+            leaf += FT_SHA256_DIGEST_SIZE;
+        }
+    }
+    put_u32(buffer + size - 4, crc32_compute(buffer, size - 4));
+
+    /* Written aside and renamed over the old record, so a crash leaves one or the other */
+    snprintf(temp_path, sizeof(temp_path), "%s.new", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        LOG_ERROR("Failed to create upload record %s: %s", temp_path, strerror(errno));
+        if (error) *error = FT_ERR_FILE_OPEN;
+        goto done;
+    }
+    int written = fwrite(buffer, 1, size, file) == size;
+    if (fclose(file) != 0 || !written) {
+        LOG_ERROR("Failed to write upload record %s", temp_path);
+        file_delete(temp_path);
+        if (error) *error = FT_ERR_FILE_WRITE;
+        goto done;
+    }
+
+#ifdef FT_PLATFORM_WINDOWS
+    remove(path);
+#endif
+    if (rename(temp_path, path) != 0) {
+        LOG_ERROR("Failed to rename %s to %s: %s", temp_path, path, strerror(errno));
+        file_delete(temp_path);
+        if (error) *error = FT_ERR_FILE_WRITE;
+        goto done;
+    }
+    if (error) *error = FT_SUCCESS;
+    result = 0;
+
+done:
+    free(buffer);
+    return result;
+}
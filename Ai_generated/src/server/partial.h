@@ -0,0 +1,35 @@
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../common/protocol.h"
+#include "../common/bitmap.h"
+#include "../common/treehash.h"
+
+/*
+ * Record of an interrupted upload, kept next to its temp file so a later
+ * transfer of the same file can skip the chunks already written. It names
+ * the file by its announced name, size, modification time and chunk
+ * layout, and stores the tree leaf of every chunk it lists: the resumed
+ * chunks are not hashed again, and the tree root compared at verification
+ * covers them like the chunks sent again.
+ */
+
+/* Path of the record for the (sanitized) file name in output_dir, which
+ * holds the records of files in its subdirectories too */
+void partial_build_path(const char *output_dir, const char *name, char *path, size_t size);
+
+/* Extract the file name from a directory entry that is a record; -1 if it is not one */
+int partial_parse_name(const char *entry, char *name, size_t size);
+
+/* Load the record at path if it describes file_info's file, setting the
+ * chunks it lists in held (num_bits = total_chunks) and their leaves in
+ * tree. Returns the number of chunks, 0 if there is no matching record. */
+uint64_t partial_load(const char *path, const FileInfo *file_info, ChunkBitmap *held, TreeHash *tree);
+
+/* Write the record for the chunks set in held, replacing any earlier one */
+int partial_save(const char *path, const FileInfo *file_info, const ChunkBitmap *held,
+                 const TreeHash *tree, FTErrorCode *error);
+
+#endif /* PARTIAL_H */
@@ -0,0 +1,643 @@
+#include "scheduler.h"
+#include "../common/logger.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_LIMIT        UINT64_MAX          /* Unlimited share while allocating */
+#define MIN_DEMAND      (64 * 1024)         /* Bytes per second an idle flow keeps, to start again from */
+#define USED_FULLY(used, rate) ((used) >= (rate) / 10 * 9)
+
+/* Transfers of one client address */
+typedef struct SchedClient {
+    char                address[64];
+    uint32_t            flows;
+    uint64_t            allocation[SCHED_RESOURCES];   /* NO_LIMIT = unlimited */
+    struct SchedClient *next;
+} SchedClient;
+
+static const char *resource_names[SCHED_RESOURCES] = {"recv", "disk"};
+static const char *priority_names[FT_PRIORITY_COUNT] = {"normal", "bulk", "interactive"};
+
+/* Share weight of a priority class */
+static uint32_t priority_weight(uint8_t priority) {
+    switch (priority) {
+    case FT_PRIORITY_BULK:        return 1;
+    case FT_PRIORITY_INTERACTIVE: return 16;
+    default:                      return 4;
+    }
+}
+
+/* a + b, saturating at NO_LIMIT */
+static uint64_t add_capped(uint64_t a, uint64_t b) {
+    return a > NO_LIMIT - b ? NO_LIMIT : a + b;
+}
+
+/*
+ * Weighted max-min fair split of total between n shares: each gets total in
+ * proportion to its weight, except that none gets more than its cap, and
+ * what capped shares leave is split the same way between the rest. A total
+ * of NO_LIMIT gives every share its cap.
+ */
+static void water_fill(uint64_t total, size_t n, const uint32_t *weight, const uint64_t *cap, uint64_t *out) {
+    uint64_t left = total;
+
+    /* 0 marks a share not fixed yet; fixed ones get at least 1 */
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (total == NO_LIMIT || weight[i] == 0) ? cap[i] : 0;
+    }
+    if (total == NO_LIMIT) {
+        return;
+    }
+
+    /* Fix the shares whose cap is below their fair share until none is */
+    for (;;) {
+        uint64_t weights = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] == 0) {
+                weights += weight[i];
+            }
+        }
+        if (weights == 0) {
+            return;
+        }
+
+        uint64_t fixed = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] == 0 && (double)cap[i] <= (double)left * weight[i] / (double)weights) {
+                out[i] = cap[i] > 0 ? cap[i] : 1;
+                fixed += out[i];
+            }
+        }
+        if (fixed == 0) {
+            /* The rest split what is left by weight */
+            for (size_t i = 0; i < n; i++) {
+                if (out[i] == 0) {
+                    uint64_t share = (uint64_t)((double)left * weight[i] / (double)weights);
+                    out[i] = share > 0 ? share : 1;
+                }
+            }
+            return;
+        }
+        left = fixed < left ? left - fixed : 0;
+    }
+}
+
+/* Add tokens for the time since the last refill, up to one period's worth */
+static void bucket_refill(SchedBucket *bucket, uint64_t now_ns) {
+    if (bucket->rate == SCHED_UNLIMITED) {
+        bucket->tokens = 0;
+        bucket->refill_ns = now_ns;
+        return;
+    }
+
+    uint64_t depth = bucket->rate * SCHED_PERIOD_MS / 1000;
+    uint64_t elapsed_ns = now_ns - bucket->refill_ns;
+    if (elapsed_ns > (uint64_t)SCHED_PERIOD_MS * 1000000) {
+        elapsed_ns = (uint64_t)SCHED_PERIOD_MS * 1000000;
+    }
+    bucket->tokens += (int64_t)(bucket->rate / 1000 * elapsed_ns / 1000000 +
+                                bucket->rate % 1000 * elapsed_ns / 1000000000);
+    if (bucket->tokens > (int64_t)depth) {
+        bucket->tokens = (int64_t)depth;
+    }
+    bucket->refill_ns = now_ns;
+}
+
+/* Estimate what each flow would use from what it used over the period
+ * just ended: all it can get if it used its allocation or ran out, else
+ * half as much again as it used */
+static void update_demands(Scheduler *scheduler, uint64_t now_ms) {
+    uint64_t elapsed_ms = now_ms + SCHED_PERIOD_MS - scheduler->next_period_ms;
+    if (elapsed_ms == 0) {
+        elapsed_ms = 1;
+    }
+
+    for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+        for (int r = 0; r < SCHED_RESOURCES; r++) {
+            SchedBucket *bucket = &flow->buckets[r];
+            uint64_t used_rate = bucket->used * 1000 / elapsed_ms;
+            if (bucket->held || bucket->rate == SCHED_UNLIMITED || USED_FULLY(used_rate, bucket->rate)) {
+                bucket->demand = NO_LIMIT;
+            } else {
+                bucket->demand = used_rate / 2 * 3 > MIN_DEMAND ? used_rate / 2 * 3 : MIN_DEMAND;
+            }
+            bucket->used = 0;
+            bucket->held = 0;
+        }
+    }
+    scheduler->next_period_ms = now_ms + SCHED_PERIOD_MS;
+}
+
+/* Reallocate every flow's rates: between clients within the global
+ * limits, then between each client's flows within its allocation */
+static void allocate(Scheduler *scheduler) {
+    size_t client_count = 0;
+    size_t most_flows = 0;
+    for (SchedClient *client = scheduler->clients; client != NULL; client = client->next) {
+        client_count++;
+        if (client->flows > most_flows) {
+            most_flows = client->flows;
+        }
+    }
+    if (client_count == 0) {
+        return;
+    }
+
+    size_t slots = client_count > most_flows ? client_count : most_flows;
+    uint32_t *weight = (uint32_t*)malloc(slots * sizeof(uint32_t));
+    uint64_t *cap = (uint64_t*)malloc(slots * sizeof(uint64_t));
+    uint64_t *share = (uint64_t*)malloc(slots * sizeof(uint64_t));
+    SchedFlow **members = (SchedFlow**)malloc(slots * sizeof(SchedFlow*));
+    if (weight == NULL || cap == NULL || share == NULL || members == NULL) {
+        /* Keep the current rates until the next period */
+        LOG_WARN("Out of memory reallocating bandwidth");
+        goto cleanup;
+    }
+
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        uint64_t global = scheduler->config.rate[r] != SCHED_UNLIMITED ? scheduler->config.rate[r] : NO_LIMIT;
+        uint64_t per_client = scheduler->config.client_rate[r] != SCHED_UNLIMITED ?
+                              scheduler->config.client_rate[r] : NO_LIMIT;
+
+        /* A client weighs what its flows weigh and needs what they need */
+        size_t i = 0;
+        for (SchedClient *client = scheduler->clients; client != NULL; client = client->next, i++) {
+            uint64_t demand = 0;
+            weight[i] = 0;
+            for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+                if (flow->client == client) {
+                    weight[i] += flow->weight;
+                    demand = add_capped(demand, flow->buckets[r].demand);
+                }
+            }
+            cap[i] = demand < per_client ? demand : per_client;
+        }
+        water_fill(global, client_count, weight, cap, share);
+
+        i = 0;
+        for (SchedClient *client = scheduler->clients; client != NULL; client = client->next, i++) {
+            client->allocation[r] = share[i];
+        }
+
+        for (SchedClient *client = scheduler->clients; client != NULL; client = client->next) {
+            size_t n = 0;
+            for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+                if (flow->client == client) {
+                    members[n] = flow;
+                    weight[n] = flow->weight;
+                    cap[n] = flow->buckets[r].demand;
+                    n++;
+                }
+            }
+            water_fill(client->allocation[r], n, weight, cap, share);
+            for (size_t j = 0; j < n; j++) {
+                members[j]->buckets[r].rate = share[j] == NO_LIMIT ? SCHED_UNLIMITED : share[j];
+            }
+        }
+    }
+
+cleanup:
+    free(weight);
+    free(cap);
+    free(share);
+    free(members);
+}
+
+/* Find or add the record of a client address */
+static SchedClient* client_get(Scheduler *scheduler, const char *address) {
+    for (SchedClient *client = scheduler->clients; client != NULL; client = client->next) {
+        if (strcmp(client->address, address) == 0) {
+            return client;
+        }
+    }
+
+    SchedClient *client = (SchedClient*)calloc(1, sizeof(SchedClient));
+    if (client == NULL) {
+        return NULL;
+    }
+    snprintf(client->address, sizeof(client->address), "%s", address);
+    client->next = scheduler->clients;
+    scheduler->clients = client;
+    return client;
+}
+
+/* Whether a transfer of this client already has a flow */
+static int transfer_active(Scheduler *scheduler, const SchedClient *client, uint64_t transfer_id) {
+    if (transfer_id == 0) {
+        return 0;
+    }
+    for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+        if (flow->client == client && flow->transfer_id == transfer_id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Create the flow of an admitted stripe (lock held); NULL if out of memory */
+static SchedFlow* flow_create(Scheduler *scheduler, const SchedWaiter *waiter) {
+    SchedClient *client = client_get(scheduler, waiter->client);
+    SchedFlow *flow = (SchedFlow*)calloc(1, sizeof(SchedFlow));
+    if (client == NULL || flow == NULL) {
+        if (client != NULL && client->flows == 0) {
+            scheduler->clients = client->next;  /* Just added at the head */
+            free(client);
+        }
+        free(flow);
+        return NULL;
+    }
+
+    if (!transfer_active(scheduler, client, waiter->transfer_id)) {
+        scheduler->stats.active++;
+        scheduler->stats.admitted++;
+    }
+    flow->scheduler = scheduler;
+    flow->client = client;
+    flow->id = ++scheduler->next_flow_id;
+    flow->transfer_id = waiter->transfer_id;
+    flow->stripe_index = waiter->stripe_index;
+    flow->priority = waiter->priority;
+    flow->weight = priority_weight(waiter->priority);
+    uint64_t now_ns = platform_get_monotonic_ns();
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        flow->buckets[r].demand = NO_LIMIT;
+        flow->buckets[r].refill_ns = now_ns;
+    }
+    client->flows++;
+    flow->next = scheduler->flows;
+    scheduler->flows = flow;
+
+    if (scheduler->metered) {
+        allocate(scheduler);
+        /* Start with a period's worth rather than an empty bucket */
+        for (int r = 0; r < SCHED_RESOURCES; r++) {
+            flow->buckets[r].tokens = (int64_t)(flow->buckets[r].rate * SCHED_PERIOD_MS / 1000);
+        }
+    }
+    return flow;
+}
+
+/* Admit queued transfers while there is room (lock held) */
+static void admit_queued(Scheduler *scheduler) {
+    while (scheduler->queue != NULL &&
+           (scheduler->config.max_transfers == 0 || scheduler->stats.active < scheduler->config.max_transfers)) {
+        SchedWaiter *waiter = scheduler->queue;
+        SchedFlow *flow = flow_create(scheduler, waiter);
+        if (flow == NULL) {
+            /* Tried again when the next transfer is released */
+            LOG_WARN("Out of memory admitting a queued transfer");
+            return;
+        }
+        scheduler->queue = waiter->next;
+        scheduler->stats.queued--;
+        waiter->queued = 0;
+        waiter->flow = flow;
+        LOG_DEBUG("Transfer from %s admitted after %llu ms in the queue", waiter->client,
+                  (unsigned long long)(platform_get_monotonic_ms() - waiter->queued_ms));
+        waiter->notify(waiter->context);
+    }
+}
+
+/* Initialize scheduler */
+int scheduler_init(Scheduler *scheduler, const SchedulerConfig *config) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->config = *config;
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        if (config->rate[r] != SCHED_UNLIMITED || config->client_rate[r] != SCHED_UNLIMITED) {
+            scheduler->metered = 1;
+        }
+    }
+    scheduler->next_period_ms = platform_get_monotonic_ms() + SCHED_PERIOD_MS;
+    platform_mutex_init(&scheduler->lock);
+    return 0;
+}
+
+/* Destroy scheduler; every flow must be released and every waiter cancelled */
+void scheduler_destroy(Scheduler *scheduler) {
+    while (scheduler->clients != NULL) {
+        SchedClient *client = scheduler->clients;
+        scheduler->clients = client->next;
+        free(client);
+    }
+    platform_mutex_destroy(&scheduler->lock);
+}
+
+/* Admit or queue a transfer */
+SchedFlow* scheduler_admit(Scheduler *scheduler, SchedWaiter *waiter) {
+    SchedFlow *flow = NULL;
+
+    platform_mutex_lock(&scheduler->lock);
+    waiter->flow = NULL;
+    waiter->queued = 0;
+
+    SchedClient *client = NULL;
+    for (client = scheduler->clients; client != NULL; client = client->next) {
+        if (strcmp(client->address, waiter->client) == 0) {
+            break;
+        }
+    }
+    if (scheduler->config.max_transfers == 0 || scheduler->stats.active < scheduler->config.max_transfers ||
+        (client != NULL && transfer_active(scheduler, client, waiter->transfer_id))) {
+        flow = flow_create(scheduler, waiter);
+    } else {
+        /* Behind every queued transfer of the same class or a higher one */
+        SchedWaiter **link = &scheduler->queue;
+        while (*link != NULL && priority_weight((*link)->priority) >= priority_weight(waiter->priority)) {
+            link = &(*link)->next;
+        }
+        waiter->next = *link;
+        *link = waiter;
+        waiter->queued = 1;
+        waiter->queued_ms = platform_get_monotonic_ms();
+        scheduler->stats.queued++;
+        scheduler->stats.waited++;
+        LOG_INFO("%u transfer(s) in progress, transfer from %s queued (%u waiting)",
+                 scheduler->stats.active, waiter->client, scheduler->stats.queued);
+    }
+    platform_mutex_unlock(&scheduler->lock);
+    return flow;
+}
+
+/* Leave the queue (lock held) */
+static SchedFlow* dequeue(Scheduler *scheduler, SchedWaiter *waiter) {
+    if (waiter->queued) {
+        for (SchedWaiter **link = &scheduler->queue; *link != NULL; link = &(*link)->next) {
+            if (*link == waiter) {
+                *link = waiter->next;
+                break;
+            }
+        }
+        waiter->queued = 0;
+        scheduler->stats.queued--;
+    }
+    SchedFlow *flow = waiter->flow;
+    waiter->flow = NULL;
+    return flow;
+}
+
+/* Cancel a wait for admission */
+SchedFlow* scheduler_cancel(Scheduler *scheduler, SchedWaiter *waiter) {
+    platform_mutex_lock(&scheduler->lock);
+    SchedFlow *flow = dequeue(scheduler, waiter);
+    platform_mutex_unlock(&scheduler->lock);
+    return flow;
+}
+
+/* Turn a queued transfer away */
+SchedFlow* scheduler_turn_away(Scheduler *scheduler, SchedWaiter *waiter) {
+    platform_mutex_lock(&scheduler->lock);
+    if (waiter->queued) {
+        scheduler->stats.turned_away++;
+    }
+    SchedFlow *flow = dequeue(scheduler, waiter);
+    platform_mutex_unlock(&scheduler->lock);
+    return flow;
+}
+
+/* Release flow */
+void scheduler_release(SchedFlow *flow) {
+    if (flow == NULL) {
+        return;
+    }
+    Scheduler *scheduler = flow->scheduler;
+
+    platform_mutex_lock(&scheduler->lock);
+    for (SchedFlow **link = &scheduler->flows; *link != NULL; link = &(*link)->next) {
+        if (*link == flow) {
+            *link = flow->next;
+            break;
+        }
+    }
+    SchedClient *client = flow->client;
+    if (!transfer_active(scheduler, client, flow->transfer_id)) {
+        scheduler->stats.active--;
+    }
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        scheduler->stats.held_ms[r] += flow->buckets[r].held_ms;
+    }
+    if (--client->flows == 0) {
+        for (SchedClient **link = &scheduler->clients; *link != NULL; link = &(*link)->next) {
+            if (*link == client) {
+                *link = client->next;
+                break;
+            }
+        }
+        free(client);
+    }
+    free(flow);
+
+    if (scheduler->metered) {
+        allocate(scheduler);
+    }
+    admit_queued(scheduler);
+    platform_mutex_unlock(&scheduler->lock);
+}
+
+/* Charge bytes against a flow's allocation */
+uint32_t scheduler_throttle(SchedFlow *flow, SchedResource resource, uint64_t bytes) {
+    Scheduler *scheduler = flow->scheduler;
+    uint32_t wait_ms = 0;
+
+    if (!scheduler->metered) {
+        return 0;
+    }
+
+    platform_mutex_lock(&scheduler->lock);
+    uint64_t now_ns = platform_get_monotonic_ns();
+    uint64_t now_ms = now_ns / 1000000;
+    if (now_ms >= scheduler->next_period_ms) {
+        update_demands(scheduler, now_ms);
+        allocate(scheduler);
+    }
+
+    SchedBucket *bucket = &flow->buckets[resource];
+    bucket_refill(bucket, now_ns);
+    if (bucket->rate == SCHED_UNLIMITED || bucket->tokens > 0) {
+        if (bucket->rate != SCHED_UNLIMITED) {
+            bucket->tokens -= (int64_t)bytes;
+        }
+        bucket->used += bytes;
+    } else {
+        /* Until the bucket has tokens again, but no longer than the period,
+         * after which the rate may have changed */
+        uint64_t deficit = (uint64_t)(-bucket->tokens) + 1;
+        uint64_t until_ms = deficit * 1000 / bucket->rate + 1;
+        wait_ms = until_ms < SCHED_PERIOD_MS ? (uint32_t)until_ms : SCHED_PERIOD_MS;
+        bucket->held = 1;
+        bucket->held_ms += wait_ms;
+    }
+    platform_mutex_unlock(&scheduler->lock);
+    return wait_ms;
+}
+
+/* Bytes to charge at once */
+uint64_t scheduler_burst(SchedFlow *flow, SchedResource resource) {
+    Scheduler *scheduler = flow->scheduler;
+
+    if (!scheduler->metered) {
+        return UINT64_MAX;
+    }
+    platform_mutex_lock(&scheduler->lock);
+    uint64_t rate = flow->buckets[resource].rate;
+    platform_mutex_unlock(&scheduler->lock);
+    return rate == SCHED_UNLIMITED ? UINT64_MAX : rate * SCHED_PERIOD_MS / 1000;
+}
+
+/* Copy statistics */
+void scheduler_get_stats(Scheduler *scheduler, SchedulerStats *stats) {
+    platform_mutex_lock(&scheduler->lock);
+    *stats = scheduler->stats;
+    for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+        for (int r = 0; r < SCHED_RESOURCES; r++) {
+            stats->held_ms[r] += flow->buckets[r].held_ms;
+        }
+    }
+    platform_mutex_unlock(&scheduler->lock);
+}
+
+/* Append to the exposition, keeping the length within size - 1 */
+static void append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+    va_list args;
+
+    if (*length + 1 >= size) {
+        return;
+    }
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
+    if (written > 0) {
+        *length += (size_t)written < size - *length ? (size_t)written : size - *length - 1;
+    }
+}
+
+/* A rate as a sample value; unlimited is +Inf */
+static const char* rate_text(uint64_t rate, int unlimited, char *text, size_t size) {
+    if (unlimited) {
+        return "+Inf";
+    }
+    snprintf(text, size, "%llu", (unsigned long long)rate);
+    return text;
+}
+
+/* Format scheduler state for Prometheus */
+size_t scheduler_format_prometheus(Scheduler *scheduler, char *buffer, size_t size, size_t length) {
+    char text[32];
+
+    if (size == 0) {
+        return 0;
+    }
+
+    platform_mutex_lock(&scheduler->lock);
+    const SchedulerStats *stats = &scheduler->stats;
+    uint64_t held_ms[SCHED_RESOURCES];
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        held_ms[r] = stats->held_ms[r];
+        for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+            held_ms[r] += flow->buckets[r].held_ms;
+        }
+    }
+
+    append(buffer, size, &length,
+           "# HELP ft_sched_transfers Transfers being received, and ones waiting for admission.\n"
+           "# TYPE ft_sched_transfers gauge\n"
+           "ft_sched_transfers{state=\"active\"} %u\n"
+           "ft_sched_transfers{state=\"queued\"} %u\n"
+           "# HELP ft_sched_transfers_max Transfers received at once (+Inf = no cap).\n"
+           "# TYPE ft_sched_transfers_max gauge\n"
+           "ft_sched_transfers_max %s\n"
+           "# HELP ft_sched_admitted_total Transfers admitted.\n"
+           "# TYPE ft_sched_admitted_total counter\n"
+           "ft_sched_admitted_total %llu\n"
+           "# HELP ft_sched_queued_total Transfers that waited for admission.\n"
+           "# TYPE ft_sched_queued_total counter\n"
+           "ft_sched_queued_total %llu\n"
+           "# HELP ft_sched_turned_away_total Queued transfers told to retry after waiting too long.\n"
+           "# TYPE ft_sched_turned_away_total counter\n"
+           "ft_sched_turned_away_total %llu\n",
+           stats->active, stats->queued,
+           rate_text(scheduler->config.max_transfers, scheduler->config.max_transfers == 0, text, sizeof(text)),
+           (unsigned long long)stats->admitted, (unsigned long long)stats->waited,
+           (unsigned long long)stats->turned_away);
+
+    append(buffer, size, &length,
+           "# HELP ft_sched_limit_bytes_per_second Configured bandwidth limits (+Inf = none).\n"
+           "# TYPE ft_sched_limit_bytes_per_second gauge\n");
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        uint64_t global = scheduler->config.rate[r];
+        uint64_t client = scheduler->config.client_rate[r];
+        append(buffer, size, &length, "ft_sched_limit_bytes_per_second{resource=\"%s\",scope=\"global\"} %s\n",
+               resource_names[r], rate_text(global, global == SCHED_UNLIMITED, text, sizeof(text)));
+        append(buffer, size, &length, "ft_sched_limit_bytes_per_second{resource=\"%s\",scope=\"client\"} %s\n",
+               resource_names[r], rate_text(client, client == SCHED_UNLIMITED, text, sizeof(text)));
+    }
+
+    append(buffer, size, &length,
+           "# HELP ft_sched_throttled_seconds_total Time transfers waited for their bandwidth allocation.\n"
+           "# TYPE ft_sched_throttled_seconds_total counter\n");
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        append(buffer, size, &length, "ft_sched_throttled_seconds_total{resource=\"%s\"} %.3f\n",
+               resource_names[r], (double)held_ms[r] / 1000.0);
+    }
+
+    if (scheduler->metered && scheduler->clients != NULL) {
+        append(buffer, size, &length,
+               "# HELP ft_sched_client_allocation_bytes_per_second Bandwidth currently allocated to each client.\n"
+               "# TYPE ft_sched_client_allocation_bytes_per_second gauge\n");
+        for (SchedClient *client = scheduler->clients; client != NULL; client = client->next) {
+            for (int r = 0; r < SCHED_RESOURCES; r++) {
+                append(buffer, size, &length,
+                       "ft_sched_client_allocation_bytes_per_second{client=\"%s\",resource=\"%s\"} %s\n",
+                       client->address, resource_names[r],
+                       rate_text(client->allocation[r], client->allocation[r] == NO_LIMIT, text, sizeof(text)));
+            }
+        }
+    }
+
+    if (scheduler->flows != NULL) {
+        append(buffer, size, &length,
+               "# HELP ft_sched_flow_weight Fair share weight of each transfer stripe, from its priority class.\n"
+               "# TYPE ft_sched_flow_weight gauge\n");
+        for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+            append(buffer, size, &length,
+                   "ft_sched_flow_weight{flow=\"%llu\",client=\"%s\",transfer=\"%016llx\",stripe=\"%u\","
+                   "priority=\"%s\"} %u\n",
+                   (unsigned long long)flow->id, flow->client->address, (unsigned long long)flow->transfer_id, flow->stripe_index,
+                   priority_names[flow->priority], flow->weight);
+        }
+    }
+
+    if (scheduler->metered && scheduler->flows != NULL) {
+        append(buffer, size, &length,
+               "# HELP ft_sched_flow_allocation_bytes_per_second Bandwidth currently allocated to each transfer stripe.\n"
+               "# TYPE ft_sched_flow_allocation_bytes_per_second gauge\n");
+        for (SchedFlow *flow = scheduler->flows; flow != NULL; flow = flow->next) {
+            for (int r = 0; r < SCHED_RESOURCES; r++) {
+                uint64_t rate = flow->buckets[r].rate;
+                append(buffer, size, &length,
+                       "ft_sched_flow_allocation_bytes_per_second{flow=\"%llu\",client=\"%s\",transfer=\"%016llx\","
+                       "stripe=\"%u\",resource=\"%s\"} %s\n",
+                       (unsigned long long)flow->id, flow->client->address, (unsigned long long)flow->transfer_id, flow->stripe_index,
+                       resource_names[r], rate_text(rate, rate == SCHED_UNLIMITED, text, sizeof(text)));
+            }
+        }
+    }
+
+    if (scheduler->queue != NULL) {
+        uint64_t now_ms = platform_get_monotonic_ms();
+        append(buffer, size, &length,
+               "# HELP ft_sched_queue_wait_seconds How long each queued transfer has waited for admission.\n"
+               "# TYPE ft_sched_queue_wait_seconds gauge\n");
+        uint32_t position = 0;
+        for (SchedWaiter *waiter = scheduler->queue; waiter != NULL; waiter = waiter->next) {
+            append(buffer, size, &length,
+                   "ft_sched_queue_wait_seconds{position=\"%u\",client=\"%s\",transfer=\"%016llx\","
+                   "priority=\"%s\"} %.3f\n",
+                   ++position, waiter->client, (unsigned long long)waiter->transfer_id,
+                   priority_names[waiter->priority], (double)(now_ms - waiter->queued_ms) / 1000.0);
+        }
+    }
+    platform_mutex_unlock(&scheduler->lock);
+    return length;
+}
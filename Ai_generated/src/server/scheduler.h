@@ -0,0 +1,147 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../common/platform.h"
+#include "../common/protocol.h"
+
+/*
+ * Bandwidth scheduling and admission control across the server's
+ * transfers. Each stripe of an admitted transfer is a flow with a token
+ * bucket per resource: bytes received off the network and bytes written to
+ * disk. Every SCHED_PERIOD_MS the buckets' rates are reallocated by
+ * weighted max-min fair sharing, first between clients (by address, within
+ * the global limit and each client's own) and then between a client's
+ * flows, weighted by the priority class declared in the handshake. A flow
+ * that did not use its share last period only keeps what it used plus
+ * headroom, so what it leaves goes to the flows that are being held back.
+ *
+ * Nothing is dropped to enforce a rate: a receiver over its allocation
+ * stops reading, so TCP's receive window closes on the client, and a
+ * writer over its allocation waits, so the ring fills and reading stops in
+ * turn. Transfers beyond the concurrency cap wait in a queue, by priority
+ * and then in arrival order, before their FILE_ACK.
+ */
+
+#define SCHED_UNLIMITED        0           /* Rate of a resource without a limit */
+#define SCHED_PERIOD_MS        100         /* Reallocation interval, and the bucket depth */
+#define SCHED_QUEUE_TIMEOUT_MS (FT_TIMEOUT_SECONDS * 1000 / 2)  /* Queued this long: told to retry */
+
+/* Metered resources */
+typedef enum {
+    SCHED_RECV = 0,                /* Chunk payload off the network */
+    SCHED_DISK = 1,                /* Chunk data written to the file */
+    SCHED_RESOURCES
+} SchedResource;
+
+/* Limits, in bytes per second (SCHED_UNLIMITED = none) */
+typedef struct {
+    uint64_t rate[SCHED_RESOURCES];          /* All transfers together */
+    uint64_t client_rate[SCHED_RESOURCES];   /* The transfers of one client address */
+    uint32_t max_transfers;                  /* Transfers served at once (0 = no cap) */
+} SchedulerConfig;
+
+struct Scheduler;
+struct SchedClient;
+
+/* One token bucket; tokens go negative by the last charge's overshoot */
+typedef struct {
+    uint64_t rate;                 /* Allocated bytes per second (SCHED_UNLIMITED = none) */
+    int64_t  tokens;
+    uint64_t refill_ns;            /* When tokens were last added */
+    uint64_t used;                 /* Bytes charged this period */
+    int      held;                 /* Ran out of tokens this period */
+    uint64_t demand;               /* What the flow may use, from last period's use */
+    uint64_t held_ms;              /* Total time spent waiting for tokens */
+} SchedBucket;
+
+/* One stripe of an admitted transfer */
+typedef struct SchedFlow {
+    struct Scheduler   *scheduler;
+    struct SchedClient *client;
+    uint64_t            id;            /* Numbered in admission order, to label metrics */
+    uint64_t            transfer_id;   /* Stripes sharing a nonzero ID count as one transfer */
+    uint16_t            stripe_index;
+    uint8_t             priority;
+    uint32_t            weight;
+    SchedBucket         buckets[SCHED_RESOURCES];
+    struct SchedFlow   *next;
+} SchedFlow;
+
+/* A transfer waiting for admission, owned by the caller. notify runs once
+ * (with the scheduler locked, so it must not call back into it) when the
+ * transfer is admitted, with `flow` set. */
+typedef struct SchedWaiter {
+    void              (*notify)(void *context);
+    void               *context;
+    char                client[64];
+    uint64_t            transfer_id;
+    uint16_t            stripe_index;
+    uint8_t             priority;
+    uint64_t            queued_ms;     /* When it joined the queue */
+    SchedFlow          *flow;          /* Set once admitted */
+    int                 queued;
+    struct SchedWaiter *next;
+} SchedWaiter;
+
+/* Scheduler statistics */
+typedef struct {
+    uint32_t active;               /* Transfers admitted and not yet released */
+    uint32_t queued;
+    uint64_t admitted;             /* Transfers admitted since startup */
+    uint64_t waited;               /* ...of which had to queue */
+    uint64_t turned_away;          /* Queued too long and told to retry */
+    uint64_t held_ms[SCHED_RESOURCES];   /* Time flows spent waiting for tokens */
+} SchedulerStats;
+
+typedef struct Scheduler {
+    SchedulerConfig     config;
+    int                 metered;       /* Any rate limit is set */
+    ft_mutex_t          lock;
+    struct SchedClient *clients;
+    SchedFlow          *flows;
+    SchedWaiter        *queue;         /* By priority, then arrival */
+    uint64_t            next_flow_id;
+    uint64_t            next_period_ms;
+    SchedulerStats      stats;
+} Scheduler;
+
+int scheduler_init(Scheduler *scheduler, const SchedulerConfig *config);
+void scheduler_destroy(Scheduler *scheduler);
+
+/* Admit the waiter's stripe of a transfer, whose client, transfer_id,
+ * stripe_index and priority are filled in. Returns its flow, or NULL with
+ * the waiter queued (or if out of memory, with the waiter not queued).
+ * Later stripes of an admitted transfer are admitted right away. */
+SchedFlow* scheduler_admit(Scheduler *scheduler, SchedWaiter *waiter);
+
+/* Leave the queue; a flow admitted before this returns is handed back to
+ * release (NULL otherwise), and no notification runs once it returns */
+SchedFlow* scheduler_cancel(Scheduler *scheduler, SchedWaiter *waiter);
+
+/* Turn a queued waiter away for having waited too long (see
+ * SCHED_QUEUE_TIMEOUT_MS); same result as scheduler_cancel() */
+SchedFlow* scheduler_turn_away(Scheduler *scheduler, SchedWaiter *waiter);
+
+/* Release a flow (NULL is ignored); a transfer's last flow frees its slot
+ * for the next queued one */
+void scheduler_release(SchedFlow *flow);
+
+/* Charge bytes of a resource to a flow. Returns 0 if they may go ahead,
+ * otherwise the milliseconds to wait before asking again (nothing is
+ * charged then). */
+uint32_t scheduler_throttle(SchedFlow *flow, SchedResource resource, uint64_t bytes);
+
+/* Most bytes worth charging at once: a period of the flow's allocation
+ * (UINT64_MAX without a limit), so batching does not overshoot the rate */
+uint64_t scheduler_burst(SchedFlow *flow, SchedResource resource);
+
+/* Current statistics */
+void scheduler_get_stats(Scheduler *scheduler, SchedulerStats *stats);
+
+/* Append the limits, current allocations and queue in the Prometheus text
+ * format to buffer (of size bytes, length used); returns the new length */
+size_t scheduler_format_prometheus(Scheduler *scheduler, char *buffer, size_t size, size_t length);
+
+#endif /* SCHEDULER_H */
@@ -3,23 +3,425 @@
 #include "../common/network.h"
 #include "../common/logger.h"
 #include "../common/fileio.h"
+#include "../common/checksum.h"
+#include "../common/bitmap.h"
+#include "../common/threadpool.h"
+#include "../common/treehash.h"
+#include "../common/chunkring.h"
+#include "../common/delta.h"
+#include "session.h"
+#include "chunkstore.h"
+#include "../common/compress.h"
+#include "../common/tuning.h"
+#include "../common/bundle.h"
+#include "../common/metrics.h"
+#include "../common/bufpool.h"
+#include "exporter.h"
+#include "scheduler.h"
+#include "udprecv.h"
+#ifdef FT_HAVE_IO_URING
+#include "../common/uring.h"
+#endif
+#ifdef FT_HAVE_TLS
+#include "../common/tls.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+
+/* Most queued chunks the writer hands to the disk at once */
+#define WRITER_BATCH_CHUNKS 32
+
+/* Receive steps one connection may take per wakeup, so a fast sender
+ * cannot starve the other connections */
+#define CONN_READ_BUDGET 64
+
+/* Readiness events taken from the poller at once */
+#define EVENT_BATCH 64
+
+/* Longest the event loop sleeps, so it notices a shutdown request */
+#define EVENT_LOOP_MAX_WAIT_MS 1000
+
+/* udp_recv() calls per UDP readiness event, each followed by a REPORT */
+#define UDP_READ_BUDGET 16
+
+/* Most event loop threads (-e) */
+#define MAX_EVENT_LOOPS 256
+
+/* Pause before accepting again after accept() failed (e.g. out of descriptors) */
+#define ACCEPT_RETRY_MS 100
+
+/* How often expired partial uploads are looked for */
+#define PARTIAL_COLLECT_INTERVAL_MS (10 * 60 * 1000)
+
+/* Bundle entries one worker unpacks */
+#define EXTRACT_JOB_ENTRIES 256
+
+/* Largest control message payload: a full batch of leaf digests
+ * (VERIFY_REQUEST or CHUNK_HASHES) */
+#define CONTROL_PAYLOAD_MAX (FT_VERIFY_REQUEST_HEADER_SIZE + FT_VERIFY_MAX_DIGESTS * FT_SHA256_SIZE)
+
+/* Cross-thread notifications for the event loop (ClientConn.notify) */
+#define NOTIFY_OUTPUT   0x01    /* Queued output waits for the socket */
+#define NOTIFY_SPACE    0x02    /* A ring entry was freed while the receiver waited for one */
+#define NOTIFY_WRITER   0x04    /* The writer thread has exited */
+#define NOTIFY_ROUTED   0x08    /* Handed over by another loop */
+#define NOTIFY_SIGNED   0x10    /* The writer sent the existing file's block signatures */
+#define NOTIFY_ADMITTED 0x20    /* The scheduler admitted the queued transfer */
+#define NOTIFY_COMMITTED 0x40   /* The verified file was committed, or failed to be (commit_error) */
 
 /* Server configuration */
 typedef struct {
     uint16_t port;
     char output_dir[512];
+    int hash_threads;              /* Leaf hash workers (-1 = one per CPU) */
+    int event_loops;               /* Event loop threads (-1 = one per CPU) */
+    int pin_loops;                 /* Pin each event loop to a CPU */
+    WritePolicy write_policy;      /* Direct I/O and durability of received files */
+    uint32_t ring_chunks;          /* Chunk buffers between receive and write, in FT_DEFAULT_CHUNK_SIZE chunks */
+    uint32_t max_chunk_size;       /* Largest chunk size agreed to in the handshake */
+    BufferPoolConfig pool;         /* Memory budget of chunk buffers */
+    int ack_durable;               /* Acknowledge chunks once written, not once received */
+    int keep_hours;                /* Keep interrupted uploads to resume (0 = never) */
+    int map_output;                /* Receive chunks in place into a mapping of the file */
+    char store_dir[512];           /* Chunk store for deduplication ("" = none) */
+    uint16_t metrics_port;         /* Serve metrics over HTTP (0 = off) */
+    SchedulerConfig sched;         /* Bandwidth limits and the cap on concurrent transfers */
+    int tls;                       /* Connections start with a TLS handshake */
+#ifdef FT_HAVE_TLS
+    TlsConfig tls_config;          /* Certificate and key */
+#endif
     int verbose;
     char *log_file;
 } ServerConfig;
 
+/* Acknowledgment state for SACK mode */
+typedef struct {
+    uint64_t cumulative;           /* Lowest chunk ID not yet acknowledged */
+    uint64_t highest_seq;          /* Sequence number of the last CHUNK_DATA acknowledged */
+    uint32_t unreported;           /* Chunk frames processed since the last SACK */
+    uint64_t first_unreported_ms;  /* When the oldest unreported frame arrived */
+    int      unordered;            /* Chunks complete out of sequence (UDP): only NAKs set highest_seq */
+} SackState;
+
+/* Chunk acknowledgments. With durable ACKs the writer thread acknowledges
+ * while the event loop still sends NAKs and errors, so every message
+ * sent during the chunk phase goes out under `lock`. */
+typedef struct {
+    Connection *conn;
+    ChunkBitmap acked;             /* Chunks acknowledged to the client */
+    uint64_t    first_chunk;       /* This connection's stripe: [first_chunk, end_chunk) */
+    uint64_t    end_chunk;
+    SackState   sack;
+    int         use_sack;
+    uint64_t    sequence_num;
+    ft_mutex_t  lock;
+} AckState;
+
+
+struct ClientConn;
+
+/* Leaf hash of a ring entry; it may still run after the chunk is written */
+typedef struct {
+    RingEntry         *entry;
+    uint8_t           *buffer;    /* Reference to the entry's buffer, which the ring releases */
+    TreeHash          *tree;
+    struct ClientConn *client;
+} HashJob;
+
+/* Where a connection is in its transfer */
+typedef enum {
+    CONN_TLS,                      /* TLS handshake (-T) */
+    CONN_HANDSHAKE,                /* Waiting for HANDSHAKE_REQ */
+    CONN_FILE_INFO,                /* Waiting for FILE_INFO */
+    CONN_QUEUED,                   /* FILE_INFO received, waiting for the scheduler to admit it */
+    CONN_CHUNKS,                   /* Receiving this stripe's chunks */
+    CONN_DRAINING,                 /* All chunks received, writer still flushing them */
+    CONN_STRIPES,                  /* Stripe 0 waiting for the other stripes */
+    CONN_VERIFY,                   /* Stripe 0 comparing tree hashes with the client */
+    CONN_COMMITTING,               /* Verified file being synced and renamed (or unpacked) before the reply */
+    CONN_CLOSING                   /* Flushing output before the socket is closed */
+} ConnState;
+
+/* Part of the current frame being received */
+typedef enum {
+    RECV_HEADER,
+    RECV_PAYLOAD,                  /* Control message payload */
+    RECV_CHUNK_HEADER,
+    RECV_CHUNK_DATA                /* Straight into a ring entry */
+} RecvStep;
+
+/* Verification messages expected from stripe 0 */
+typedef enum {
+    VERIFY_COMPLETE,               /* TRANSFER_COMPLETE */
+    VERIFY_ROOT,                   /* VERIFY_REQUEST with the tree root */
+    VERIFY_LEAVES                  /* Leaf batches after a root mismatch */
+} VerifyStep;
+
+struct Server;
+struct EventLoop;
+
+/*
+ * One client connection. Its event loop owns it and moves it through its
+ * transfer one message at a time; only the per-connection writer thread
+ * and leaf hash jobs touch it from elsewhere, through the ring, the ACK
+ * lock and the notification flags.
+ */
+typedef struct ClientConn {
+    struct EventLoop *loop;
+    Connection   conn;
+    char         client_ip[64];
+    ConnState    state;
+    uint32_t     interest;         /* FT_POLL_* bits registered with the poller */
+    uint64_t     deadline_ms;      /* Idle timeout (0 = none) */
+    int          output_pending;   /* Queued output not yet flushed */
+    int          output_abandoned; /* Closing without waiting for output */
+    int          result;           /* 0 once this connection's part succeeded */
+    int          closed;           /* Destroyed or handed over; skipped for the rest of the event batch */
+    struct EventLoop *route;       /* Hand over to this loop once the current event is handled */
+
+    /* Frame being received */
+    RecvStep     step;
+    uint8_t      frame[FT_HEADER_SIZE + FT_CHUNK_HEADER_SIZE];
+    size_t       frame_done;
+    size_t       header_size;      /* Of the message header at the start of frame */
+    MessageHeader header;
+    uint8_t     *payload;          /* CONTROL_PAYLOAD_MAX bytes */
+    size_t       payload_done;
+    RingEntry   *entry;            /* Entry receiving CHUNK_DATA */
+    ChunkHeader  chunk_hdr;
+    size_t       chunk_done;
+    uint64_t     chunk_start_ns;   /* When the chunk's data started arriving */
+    int          waiting_entry;    /* Every ring entry is busy; reading paused */
+    int          recv_charged;     /* The chunk being received is charged to the flow */
+    uint64_t     throttle_ms;      /* Over the receive allocation: reading paused until then */
+
+    /* Transfer */
+    uint8_t      capabilities;
+    uint8_t      priority;         /* FT_PRIORITY_* class from the handshake */
+    int          persistent;       /* Kept open between files, with KEEPALIVEs while idle (FT_FLAG_SESSION) */
+    SchedWaiter  admission;        /* Queued for admission in CONN_QUEUED */
+    SchedFlow   *flow;             /* The scheduler's record of the admitted stripe */
+    uint32_t     max_chunk_size;   /* Agreed in the handshake */
+    FileInfo     file_info;
+    TransferSession *session;
+    int          stripe_reported;
+    int          use_tree_hash;
+    OutputFile   stripe_file;
+    ChunkRing    ring;
+    HashJob     *hash_jobs;        /* Indexed like ring entries */
+    WaitGroup    hashing;          /* Hash and chunk store jobs still using the transfer */
+    ft_thread_t  writer_thread;
+    int          writer_running;   /* Started and not yet joined */
+    AckState     acks;
+    ChunkBitmap  received_map;
+    ChunkBitmap *received;         /* Chunks handed to the writer */
+    uint64_t     stripe_chunks;
+    uint64_t     received_bytes;
+
+    /* Sparse files (FT_FILE_SPARSE) */
+    int          sparse;           /* Zero chunks may come as hole records (FT_FLAG_ZERO) */
+    uint64_t     hole_bytes;       /* ...this many bytes of them so far */
+    uint8_t      zero_leaf[FT_SHA256_DIGEST_SIZE];  /* Writer: leaf of a full-sized zero chunk, */
+    int          zero_leaf_ready;                   /* once hashed */
+
+    /* Delta upload (FT_CAP_DELTA) */
+    int          delta;            /* Rebuilding from the existing file out of DELTA_DATA */
+    int          signing;          /* The writer is still sending block signatures */
+    FILE        *basis;            /* The existing file; the writer's while it runs */
+    uint64_t     basis_size;
+    uint32_t     block_size;
+    uint64_t     delta_frames;     /* DELTA_DATA frames received */
+
+    /* Chunk store lookups (FT_CAP_DEDUP) */
+    int          dedup;            /* CHUNK_HASHES may come before the chunks */
+    uint64_t     stored_chunks;    /* Chunks found in the chunk store */
+    uint64_t     stored_bytes;
+
+    /* Receiving in place (-m) */
+    MappedFile   map;
+    int          mapped;
+    MapWindow  **entry_maps;       /* Window each ring entry's chunk was received into */
+
+    /* Compressed chunks (FT_CAP_COMPRESS) */
+    uint8_t     *packed;           /* LZ4 block being received, chunk_size bytes */
+    uint64_t     packed_chunks;    /* Chunks that arrived compressed */
+    uint64_t     packed_raw_bytes; /* ...their size, and their size on the wire */
+    uint64_t     packed_wire_bytes;
+
+    /* UDP data path (FT_FILE_UDP): registered with the poller tagged with
+     * bit 0 of its context */
+    UdpReceiver *udp;
+
+    /* Verification */
+    VerifyStep   verify_step;
+    VerifyResponse response;
+    uint64_t     compared;         /* Leaves compared so far */
+    int          committing;       /* A commit job reports back before the connection may go */
+    FTErrorCode  commit_error;     /* Its result; guarded by EventLoop.notify_lock until reported */
+
+    /* Batch (FT_CAP_BATCH): files committed over this connection */
+    uint64_t     batch_files;
+    uint64_t     batch_bytes;
+
+    /* Guarded by EventLoop.notify_lock */
+    uint32_t     notify;           /* NOTIFY_* bits not yet handled */
+    int          stalled;          /* The writer or a hash job should report free entries */
+    struct ClientConn *notify_next;
+
+    /* Event loop lists */
+    struct ClientConn *prev;
+    struct ClientConn *next;
+    int          ready;            /* On EventLoop.ready */
+    struct ClientConn *ready_next;
+    struct ClientConn *closed_next;
+} ClientConn;
+
+/* Connection counters of one event loop, to show how evenly load spreads */
+typedef struct {
+    uint64_t accepted;             /* Accepted from the listener */
+    uint64_t routed_in;            /* Stripes handed over by other loops */
+    uint64_t routed_out;           /* Stripes handed to the loop owning their transfer */
+    uint64_t completed;            /* Closed after their part of a transfer succeeded */
+    uint64_t failed;
+    size_t   peak;                 /* Most connections served at once */
+} LoopStats;
+
+/* One event loop thread, by default one per CPU */
+typedef struct EventLoop {
+    struct Server *server;
+    uint32_t      index;
+    ft_thread_t   thread;
+    int           thread_running;
+    int           result;
+    ft_poller_t  *poller;
+    socket_t      listen_sock;
+    int           owns_listener;   /* Own SO_REUSEPORT socket, closed when shutting down */
+    int           accepting;       /* Listener registered with the poller */
+    uint64_t      accept_resume_ms;
+    ClientConn   *conns;
+    size_t        conn_count;
+    ClientConn   *ready;           /* Input may be buffered past the read budget */
+    ClientConn   *closed;          /* Destroyed during this batch of events */
+    ClientConn   *handed_over;     /* To pass to other loops after this batch */
+    ft_mutex_t    notify_lock;
+    ClientConn   *notified;
+    LoopStats     stats;           /* Only touched by the loop's own thread */
+    UdpRecvBatch *udp_batch;       /* Shared by the loop's UDP sockets */
+} EventLoop;
+
+/* State shared by the event loops */
+typedef struct Server {
+    const ServerConfig *config;
+    SessionTable  sessions;
+    ThreadPool    workers;         /* Leaf hashes and file commits */
+    EventLoop    *loops;
+    uint32_t      loop_count;
+    socket_t      shared_listener; /* Watched by every loop without SO_REUSEPORT */
+    ft_mutex_t    lock;
+    size_t        live_conns;      /* On any loop, including ones being handed over */
+    int           failed;          /* A loop failed: the others stop without draining */
+    uint64_t      collect_ms;      /* Next partial upload collection (loop 0 only) */
+    ChunkStore   *store;           /* NULL without -S */
+    Scheduler     scheduler;       /* Bandwidth shares and admission of every loop's transfers */
+    TransferMetrics metrics;       /* Of every transfer since the server started */
+} Server;
+
+/* Chunks of one CHUNK_HASHES batch found in the chunk store, copied into
+ * the file on a worker */
+typedef struct {
+    struct ClientConn *client;
+    OutputFile         file;       /* Own copy, like each stripe's */
+    uint32_t           count;
+    uint64_t           chunks[FT_DEDUP_MAX_HASHES];
+} StoreJob;
+
+/* Drops a connection's session reference off the event loop, since closing
+ * the file may sync it: after verification to rename it into place, or
+ * when a resumable upload is interrupted to keep it */
+typedef struct {
+    SessionTable    *sessions;
+    ChunkStore      *store;
+    TransferMetrics *totals;
+    TransferSession *session;
+    int              commit;
+    struct ClientConn *client;     /* Told the commit's result (NULL: nobody waits for it) */
+} CommitJob;
+
+/* A verified bundle unpacked by several workers, a slice of its manifest
+ * each; the last one to finish deletes it and drops the session */
+typedef struct {
+    SessionTable      *sessions;
+    TransferSession   *session;
+    const WritePolicy *policy;
+    struct ClientConn *client;     /* Told once every slice is done */
+    struct ExtractJob *jobs;
+    ft_mutex_t         lock;
+    uint32_t           pending;    /* Slices still being unpacked */
+    uint32_t           extracted;  /* Files in place */
+} BundleCommit;
+
+/* One worker's slice of a bundle */
+typedef struct ExtractJob {
+    BundleCommit *bundle;
+    uint32_t      first;
+    uint32_t      count;
+} ExtractJob;
+
+/* Set by SIGINT/SIGTERM: stop accepting and exit once transfers finish */
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Parse a bandwidth limit: "<MB/s>" for all clients together, optionally
+ * followed by ":<MB/s>" for each client; 0 leaves either unlimited */
+static int parse_rate(const char *text, uint64_t *rate, uint64_t *client_rate) {
+    char *end;
+    double global = strtod(text, &end);
+    double client = 0.0;
+
+    if (end == text || global < 0.0) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char *next = end + 1;
+        client = strtod(next, &end);
+        if (end == next || client < 0.0) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    *rate = (uint64_t)(global * 1024 * 1024);
+    *client_rate = (uint64_t)(client * 1024 * 1024);
+    return 0;
+}
+
 /* Parse command-line arguments */
 static int parse_args(int argc, char *argv[], ServerConfig *config) {
     /* Set defaults */
     config->port = FT_DEFAULT_PORT;
     strcpy(config->output_dir, ".");
+    config->hash_threads = -1;
+    config->event_loops = -1;
+    config->pin_loops = 0;
+    config->write_policy.durability = DURABILITY_FINALIZE;
+    config->write_policy.sync_interval = 0;
+    config->write_policy.direct_io = 0;
+    config->ring_chunks = FT_DEFAULT_RING_CHUNKS;
+    config->max_chunk_size = FT_MAX_CHUNK_SIZE;
+    config->pool.budget = (uint64_t)FT_POOL_DEFAULT_MB * 1024 * 1024;
+    config->pool.hugepages = 0;
+    config->ack_durable = 0;
+    config->keep_hours = 24;
+    config->map_output = 0;
+    config->store_dir[0] = '\0';
+    config->metrics_port = 0;
+    memset(&config->sched, 0, sizeof(config->sched));
+    config->tls = 0;
+#ifdef FT_HAVE_TLS
+    memset(&config->tls_config, 0, sizeof(config->tls_config));
+#endif
     config->verbose = 0;
     config->log_file = NULL;
 
@@ -28,6 +430,105 @@ static int parse_args(int argc, char *argv[], ServerConfig *config) {
             config->port = (uint16_t)atoi(argv[++i]);
         } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
             strncpy(config->output_dir, argv[++i], sizeof(config->output_dir) - 1);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            config->hash_threads = atoi(argv[++i]);
+            if (config->hash_threads < 0) {
+                fprintf(stderr, "Error: Hash thread count must not be negative\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            config->event_loops = atoi(argv[++i]);
+            if (config->event_loops < 1 || config->event_loops > MAX_EVENT_LOOPS) {
+                fprintf(stderr, "Error: Event loop count must be between 1 and %d\n", MAX_EVENT_LOOPS);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-P") == 0) {
+            config->pin_loops = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "none") == 0) {
+                config->write_policy.durability = DURABILITY_NONE;
+            } else if (strcmp(policy, "finalize") == 0) {
+                config->write_policy.durability = DURABILITY_FINALIZE;
+            } else if (atoi(policy) > 0) {
+                config->write_policy.durability = DURABILITY_PERIODIC;
+                config->write_policy.sync_interval = (uint64_t)atoi(policy) * 1024 * 1024;
+            } else {
+                fprintf(stderr, "Error: Sync policy must be none, finalize or a size in MB\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            int chunks = atoi(argv[++i]);
+            if (chunks < 1 || chunks > FT_MAX_WINDOW_SIZE) {
+                fprintf(stderr, "Error: Ring size must be between 1 and %d chunks\n", FT_MAX_WINDOW_SIZE);
+                return -1;
+            }
+            config->ring_chunks = (uint32_t)chunks;
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            int kb = atoi(argv[++i]);
+            if (kb < FT_MIN_CHUNK_SIZE / 1024 || kb > FT_MAX_CHUNK_SIZE / 1024) {
+                fprintf(stderr, "Error: Chunk size limit must be between %d and %d KB\n",
+                        FT_MIN_CHUNK_SIZE / 1024, FT_MAX_CHUNK_SIZE / 1024);
+                return -1;
+            }
+            config->max_chunk_size = (uint32_t)kb * 1024;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            if (mb < FT_POOL_MIN_MB) {
+                fprintf(stderr, "Error: Buffer memory must be at least %d MB\n", FT_POOL_MIN_MB);
+                return -1;
+            }
+            config->pool.budget = (uint64_t)mb * 1024 * 1024;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            config->pool.hugepages = 1;
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "received") == 0) {
+                config->ack_durable = 0;
+            } else if (strcmp(mode, "durable") == 0) {
+                config->ack_durable = 1;
+            } else {
+                fprintf(stderr, "Error: ACK mode must be received or durable\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            config->keep_hours = atoi(argv[++i]);
+            if (config->keep_hours < 0) {
+                fprintf(stderr, "Error: Hours to keep partial uploads must not be negative\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            strncpy(config->store_dir, argv[++i], sizeof(config->store_dir) - 1);
+        } else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            config->metrics_port = (uint16_t)atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "-W") == 0) && i + 1 < argc) {
+            SchedResource resource = strcmp(argv[i], "-R") == 0 ? SCHED_RECV : SCHED_DISK;
+            if (parse_rate(argv[++i], &config->sched.rate[resource], &config->sched.client_rate[resource]) != 0) {
+                fprintf(stderr, "Error: Bandwidth limit must be <MB/s> or <MB/s>:<MB/s per client>\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            int transfers = atoi(argv[++i]);
+            if (transfers < 0) {
+                fprintf(stderr, "Error: Transfer limit must not be negative\n");
+                return -1;
+            }
+            config->sched.max_transfers = (uint32_t)transfers;
+        } else if ((strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "-K") == 0) && i + 1 < argc) {
+#ifdef FT_HAVE_TLS
+            if (strcmp(argv[i], "-T") == 0) {
+                config->tls_config.cert_file = argv[++i];
+            } else {
+                config->tls_config.key_file = argv[++i];
+            }
+#else
+            fprintf(stderr, "Error: Built without TLS support (make TLS=1)\n");
+            return -1;
+#endif
+        } else if (strcmp(argv[i], "-D") == 0) {
+            config->write_policy.direct_io = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            config->map_output = 1;
         } else if (strcmp(argv[i], "-v") == 0) {
             config->verbose = 1;
         } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
@@ -38,6 +539,28 @@ static int parse_args(int argc, char *argv[], ServerConfig *config) {
             printf("\nOptions:\n");
             printf("  -p <port>      Port to listen on (default: %d)\n", FT_DEFAULT_PORT);
             printf("  -d <dir>       Output directory for received files (default: current)\n");
+            printf("  -t <threads>   Hash worker threads, 0 = hash inline (default: CPU count)\n");
+            printf("  -e <loops>     Event loop threads serving connections (default: CPU count)\n");
+            printf("  -P             Pin each event loop thread to its own CPU\n");
+            printf("  -s <policy>    Sync received data: none, finalize, or every <MB> (default: finalize)\n");
+            printf("  -D             Write with direct I/O, bypassing the page cache\n");
+            printf("  -m             Receive chunks straight into a memory mapping of the file\n");
+            printf("  -r <chunks>    Chunk buffers between network and disk, in %d KB chunks (default: %d)\n",
+                   FT_DEFAULT_CHUNK_SIZE / 1024, FT_DEFAULT_RING_CHUNKS);
+            printf("  -C <KB>        Largest chunk size clients may use (default: %d)\n", FT_MAX_CHUNK_SIZE / 1024);
+            printf("  -b <MB>        Memory for chunk buffers of all transfers (default: %d)\n", FT_POOL_DEFAULT_MB);
+            printf("  -H             Back chunk buffers with huge pages\n");
+            printf("  -a <mode>      Acknowledge chunks once received or durable (default: received)\n");
+            printf("  -k <hours>     Keep interrupted uploads to resume, 0 = never (default: 24)\n");
+            printf("  -S <dir>       Keep received chunks in a store and skip sending ones it holds\n");
+            printf("  -M <port>      Serve metrics for Prometheus at http://<host>:<port>/metrics\n");
+            printf("  -R <MB/s>[:<MB/s>]  Receive bandwidth of all clients[:of each client] (default: unlimited)\n");
+            printf("  -W <MB/s>[:<MB/s>]  Disk write bandwidth of all clients[:of each client] (default: unlimited)\n");
+            printf("  -n <transfers> Transfers received at once; more wait their turn, 0 = no cap (default: 0)\n");
+#ifdef FT_HAVE_TLS
+            printf("  -T <file>      Require TLS, with this certificate chain (PEM)\n");
+            printf("  -K <file>      Private key of the -T certificate (PEM, default: the -T file)\n");
+#endif
             printf("  -v             Verbose logging\n");
             printf("  -l <file>      Log to file\n");
             printf("  -h, --help     Show this help message\n");
@@ -48,255 +571,3247 @@ static int parse_args(int argc, char *argv[], ServerConfig *config) {
         }
     }
 
+#ifdef FT_HAVE_TLS
+    if (config->tls_config.key_file != NULL && config->tls_config.cert_file == NULL) {
+        fprintf(stderr, "Error: A private key (-K) needs a certificate (-T)\n");
+        return -1;
+    }
+    if (config->tls_config.cert_file != NULL) {
+        config->tls = 1;
+        if (config->tls_config.key_file == NULL) {
+            config->tls_config.key_file = config->tls_config.cert_file;
+        }
+    }
+#endif
     return 0;
 }
 
-/* Receive file from client */
-static int receive_file(socket_t client_sock, const char *output_dir) {
-    FTErrorCode error;
-    FILE *file = NULL;
-    uint8_t *chunk_buffer = NULL;
-    char temp_path[1024];
-    char final_path[1024];
-    uint64_t sequence_num = 2;
-    int result = -1;
+/* Send a SACK covering everything acknowledged so far (lock held) */
+static int flush_sack(AckState *acks, FTErrorCode *error) {
+    SackState *state = &acks->sack;
+    ChunkSack sack;
+    memset(&sack, 0, sizeof(sack));
 
-    /* Perform handshake */
-    LOG_INFO("Performing handshake...");
-    if (perform_handshake_server(client_sock, &error) != 0) {
-        LOG_ERROR("Handshake failed: %s", protocol_get_error_string(error));
-        return -1;
-    }
+    state->cumulative = bitmap_next_clear(&acks->acked, state->cumulative);
+    sack.cumulative = state->cumulative;
+    sack.highest_seq = state->highest_seq;
 
-    /* Receive file info */
-    LOG_INFO("Receiving file info...");
-    FileInfo file_info;
-    if (recv_file_info(client_sock, &file_info, &error) != 0) {
-        LOG_ERROR("Failed to receive file info: %s", protocol_get_error_string(error));
-        return -1;
+    uint64_t remaining = acks->end_chunk - state->cumulative;
+    sack.bitmap_bits = (uint16_t)(remaining < FT_SACK_MAX_BITS ? remaining : FT_SACK_MAX_BITS);
+    for (uint16_t i = 0; i < sack.bitmap_bits; i++) {
+        if (bitmap_test(&acks->acked, state->cumulative + i)) {
+            sack.bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
     }
 
-    LOG_INFO("File: %s, Size: %llu bytes, Chunks: %llu",
-             file_info.filename, (unsigned long long)file_info.file_size,
-             (unsigned long long)file_info.total_chunks);
+    state->unreported = 0;
+    return send_chunk_sack(acks->conn, &sack, acks->sequence_num++, error);
+}
 
-    /* Sanitize filename */
-    char sanitized_name[FT_MAX_FILENAME_LEN];
-    if (file_sanitize_filename(file_info.filename, sanitized_name, sizeof(sanitized_name)) != 0) {
-        LOG_ERROR("Invalid filename: %s", file_info.filename);
-        send_error(client_sock, FT_ERR_INVALID_ARG, 0, "Invalid filename", sequence_num++, NULL);
-        return -1;
+/* Acknowledge a chunk; *is_new is 0 if it was already acknowledged */
+static int ack_chunk(AckState *acks, uint64_t chunk_id, uint64_t chunk_seq, int *is_new,
+                     FTErrorCode *error) {
+    int result = 0;
+
+    platform_mutex_lock(&acks->lock);
+    *is_new = bitmap_set(&acks->acked, chunk_id);
+    if (acks->use_sack) {
+        SackState *state = &acks->sack;
+        if (!state->unordered) {
+            state->highest_seq = chunk_seq;
+        }
+        if (state->unreported++ == 0) {
+            state->first_unreported_ms = platform_get_monotonic_ms();
+        }
+        if (state->unreported >= FT_SACK_EVERY_CHUNKS ||
+            acks->acked.num_set == acks->end_chunk - acks->first_chunk) {
+            result = flush_sack(acks, error);
+        }
+    } else {
+        result = send_chunk_ack(acks->conn, chunk_id, 0, acks->sequence_num++, error);
     }
+    platform_mutex_unlock(&acks->lock);
 
-    /* Check disk space */
-    if (file_check_disk_space(output_dir, file_info.file_size, &error) != 0) {
-        LOG_ERROR("Insufficient disk space");
-        send_error(client_sock, FT_ERR_DISK_FULL, 0, "Insufficient disk space", sequence_num++, NULL);
-        return -1;
+    if (result != 0) {
+        LOG_ERROR("Failed to send chunk ACK");
     }
+    return result;
+}
 
-    /* Open file for writing */
-    file = file_open_write(output_dir, sanitized_name, temp_path, sizeof(temp_path), &error);
-    if (file == NULL) {
-        LOG_ERROR("Failed to open output file: %s", protocol_get_error_string(error));
-        send_error(client_sock, error, 0, "Cannot create file", sequence_num++, NULL);
-        return -1;
+/* Re-acknowledge a retransmitted chunk that is already acknowledged; one
+ * still waiting for the writer is acknowledged when it is written */
+static int ack_duplicate(AckState *acks, uint64_t chunk_id, FTErrorCode *error) {
+    int result = 0;
+
+    platform_mutex_lock(&acks->lock);
+    if (bitmap_test(&acks->acked, chunk_id)) {
+        result = acks->use_sack ? flush_sack(acks, error) :
+                 send_chunk_ack(acks->conn, chunk_id, 0, acks->sequence_num++, error);
     }
+    platform_mutex_unlock(&acks->lock);
 
-    /* Send file ACK */
-    FileAck file_ack;
-    file_ack.status = 0;  /* Ready */
-    file_ack.error_code = 0;
-    uint8_t ack_buf[4] = {0};
-    if (send_message(client_sock, MSG_FILE_ACK, sequence_num++, ack_buf, sizeof(file_ack), &error) != 0) {
-        LOG_ERROR("Failed to send file ACK");
-        goto cleanup;
+    if (result != 0) {
+        LOG_ERROR("Failed to send chunk ACK");
     }
+    return result;
+}
 
-    /* Allocate chunk buffer */
-    chunk_buffer = (uint8_t*)malloc(file_info.chunk_size);
-    if (chunk_buffer == NULL) {
-        LOG_ERROR("Failed to allocate chunk buffer");
-        send_error(client_sock, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", sequence_num++, NULL);
-        goto cleanup;
+/* Request retransmission of a chunk that failed its CRC check */
+static int nak_chunk(AckState *acks, uint64_t chunk_id, uint64_t chunk_seq, FTErrorCode *error) {
+    int result;
+
+    LOG_WARN("Requesting retransmit of chunk %llu", (unsigned long long)chunk_id);
+    platform_mutex_lock(&acks->lock);
+    if (acks->use_sack) {
+        /* The hole below highest_seq tells the sender to resend */
+        uint64_t highest_seq = acks->sack.highest_seq;
+        acks->sack.highest_seq = chunk_seq;
+        result = flush_sack(acks, error);
+        if (acks->sack.unordered) {
+            /* Chunks sent before it may still be on their way */
+            acks->sack.highest_seq = highest_seq;
+        }
+    } else {
+        result = send_chunk_ack(acks->conn, chunk_id, 1, acks->sequence_num++, error);
     }
+    platform_mutex_unlock(&acks->lock);
 
-    /* Receive chunks */
-    LOG_INFO("Receiving %llu chunks...", (unsigned long long)file_info.total_chunks);
-    uint64_t received_chunks = 0;
-    uint64_t received_bytes = 0;
+    if (result != 0) {
+        LOG_ERROR("Failed to send chunk NAK");
+    }
+    return result;
+}
 
-    while (received_chunks < file_info.total_chunks) {
-        ChunkHeader chunk_hdr;
+/* Milliseconds until unreported chunks must be flushed (FT_RING_WAIT_FOREVER if none) */
+static uint32_t ack_delay_remaining(AckState *acks) {
+    uint32_t remaining_ms = FT_RING_WAIT_FOREVER;
 
-        /* Receive chunk */
-        if (recv_chunk(client_sock, &chunk_hdr, chunk_buffer, file_info.chunk_size, &error) != 0) {
-            LOG_ERROR("Failed to receive chunk %llu: %s",
-                      (unsigned long long)received_chunks, protocol_get_error_string(error));
+    platform_mutex_lock(&acks->lock);
+    if (acks->use_sack && acks->sack.unreported > 0) {
+        uint64_t waited_ms = platform_get_monotonic_ms() - acks->sack.first_unreported_ms;
+        remaining_ms = (waited_ms < FT_SACK_DELAY_MS) ? (uint32_t)(FT_SACK_DELAY_MS - waited_ms) : 0;
+    }
+    platform_mutex_unlock(&acks->lock);
+    return remaining_ms;
+}
 
-            if (error == FT_ERR_CHECKSUM) {
-                /* Request retransmit */
-                send_chunk_ack(client_sock, chunk_hdr.chunk_id, 1, sequence_num++, NULL);
-                continue;  /* Retry */
-            } else {
-                goto cleanup;
-            }
-        }
+/* Send a SACK for unreported chunks, if any */
+static int ack_flush(AckState *acks, FTErrorCode *error) {
+    int result = 0;
 
-        /* Write chunk to file */
-        if (file_write_chunk(file, chunk_hdr.chunk_offset, chunk_buffer, chunk_hdr.chunk_size, &error) != 0) {
-            LOG_ERROR("Failed to write chunk %llu: %s",
-                      (unsigned long long)chunk_hdr.chunk_id, protocol_get_error_string(error));
-            send_error(client_sock, error, chunk_hdr.chunk_id, "Write failed", sequence_num++, NULL);
-            goto cleanup;
-        }
+    platform_mutex_lock(&acks->lock);
+    if (acks->sack.unreported > 0) {
+        result = flush_sack(acks, error);
+    }
+    platform_mutex_unlock(&acks->lock);
 
-        /* Send chunk ACK */
-        if (send_chunk_ack(client_sock, chunk_hdr.chunk_id, 0, sequence_num++, &error) != 0) {
-            LOG_ERROR("Failed to send chunk ACK");
-            goto cleanup;
-        }
+    if (result != 0) {
+        LOG_ERROR("Failed to send chunk SACK");
+    }
+    return result;
+}
+
+/* Send an error message during the chunk phase */
+static void ack_send_error(AckState *acks, FTErrorCode error_code, uint64_t chunk_id, const char *message) {
+    platform_mutex_lock(&acks->lock);
+    send_error(acks->conn, error_code, chunk_id, message, acks->sequence_num++, NULL);
+    platform_mutex_unlock(&acks->lock);
+}
 
-        received_chunks++;
-        received_bytes += chunk_hdr.chunk_size;
+static void conn_fail(ClientConn *c);
+static void conn_update(ClientConn *c);
+static void conn_detach(ClientConn *c);
+static void conn_hand_over(ClientConn *c);
+static void loop_wake_all(Server *server);
+static void loop_check_stripes(EventLoop *loop, TransferSession *session);
 
-        /* Log progress every 10% */
-        if (received_chunks % (file_info.total_chunks / 10 + 1) == 0) {
-            double progress = (double)received_chunks / file_info.total_chunks * 100.0;
-            LOG_INFO("Progress: %.1f%% (%llu/%llu chunks)",
-                     progress, (unsigned long long)received_chunks,
-                     (unsigned long long)file_info.total_chunks);
-        }
+/* Queue notifications (notify lock held) */
+static void conn_notify_locked(ClientConn *c, uint32_t flags) {
+    EventLoop *loop = c->loop;
+    if (c->notify == 0) {
+        c->notify_next = loop->notified;
+        loop->notified = c;
     }
+    c->notify |= flags;
+}
 
-    LOG_INFO("All chunks received successfully");
+/* Queue notifications for the event loop; callable from any thread. Once
+ * the lock is dropped the loop may free c, so only the loop is used then. */
+static void conn_notify(ClientConn *c, uint32_t flags) {
+    EventLoop *loop = c->loop;
+    platform_mutex_lock(&loop->notify_lock);
+    conn_notify_locked(c, flags);
+    platform_mutex_unlock(&loop->notify_lock);
+    platform_poller_wake(loop->poller);
+}
+
+/* Report how committing the connection's file went; callable from any thread */
+static void conn_report_commit(ClientConn *c, FTErrorCode error) {
+    EventLoop *loop = c->loop;
+    platform_mutex_lock(&loop->notify_lock);
+    c->commit_error = error;
+    conn_notify_locked(c, NOTIFY_COMMITTED);
+    platform_mutex_unlock(&loop->notify_lock);
+    platform_poller_wake(loop->poller);
+}
 
-    /* TODO: Compute and verify SHA-256 checksum */
-    LOG_WARN("Checksum verification not yet implemented");
+/* Send queue became non-empty */
+static void conn_on_output(void *context) {
+    conn_notify((ClientConn*)context, NOTIFY_OUTPUT);
+}
 
-    /* Close file */
-    fclose(file);
-    file = NULL;
+/* A ring entry may have been freed: resume the receiver if it waits for one */
+static void conn_space_freed(ClientConn *c) {
+    EventLoop *loop = c->loop;
+    int wake = 0;
 
-    /* Finalize file (atomic rename) */
-    file_build_path(output_dir, sanitized_name, final_path, sizeof(final_path));
-    if (file_finalize_write(temp_path, final_path) != 0) {
-        LOG_ERROR("Failed to finalize file");
-        goto cleanup;
+    platform_mutex_lock(&loop->notify_lock);
+    if (c->stalled) {
+        c->stalled = 0;
+        conn_notify_locked(c, NOTIFY_SPACE);
+        wake = 1;
     }
+    platform_mutex_unlock(&loop->notify_lock);
 
-    LOG_INFO("File received successfully: %s (%llu bytes)",
-             final_path, (unsigned long long)received_bytes);
+    if (wake) {
+        platform_poller_wake(loop->poller);
+    }
+}
 
-    result = 0;
+/* The buffer pool freed memory after the receiver found it spent */
+static void conn_on_pool_space(void *context) {
+    conn_space_freed((ClientConn*)context);
+}
 
-cleanup:
-    if (file != NULL) {
-        fclose(file);
-        /* Delete temp file on error */
-        if (result != 0) {
-            file_delete(temp_path);
+/* Hash one written chunk into its tree leaf */
+static void hash_job_run(void *arg) {
+    HashJob *job = (HashJob*)arg;
+    RingEntry *entry = job->entry;
+    ClientConn *c = job->client;
+
+    treehash_set_leaf(job->tree, entry->header.chunk_id, entry->mapped != NULL ? entry->mapped : job->buffer,
+                      entry->header.chunk_size);
+    session_chunk_written(c->session, entry->header.chunk_id);
+    buffer_pool_release(job->buffer);
+    wait_group_done(&entry->pending);
+    conn_space_freed(c);
+    wait_group_done(&c->hashing);
+}
+
+/* Copy a batch of chunks found in the chunk store into the file. Their
+ * leaves are already in the tree, taken from CHUNK_HASHES. */
+static void store_job_run(void *arg) {
+    StoreJob *job = (StoreJob*)arg;
+    ClientConn *c = job->client;
+    const FileInfo *file_info = &c->file_info;
+    FTErrorCode error;
+
+    for (uint32_t i = 0; i < job->count; i++) {
+        uint64_t chunk_id = job->chunks[i];
+        uint64_t offset = chunk_id * file_info->chunk_size;
+        uint32_t size = file_info->file_size - offset < file_info->chunk_size ?
+                        (uint32_t)(file_info->file_size - offset) : file_info->chunk_size;
+        if (chunk_store_fetch(c->loop->server->store, c->session->tree.leaves[chunk_id], size,
+                              &job->file, offset, &error) != 0) {
+            LOG_ERROR("Failed to copy chunk %llu from the chunk store: %s",
+                      (unsigned long long)chunk_id, protocol_get_error_string(error));
+            ack_send_error(&c->acks, error, chunk_id, "Chunk store read failed");
+            chunk_ring_fail(&c->ring, error);
+            break;
         }
+        session_chunk_written(c->session, chunk_id);
     }
-    if (chunk_buffer != NULL) {
-        free(chunk_buffer);
-    }
+    free(job);
+    wait_group_done(&c->hashing);
+}
 
-    return result;
+/* Record a phase of this connection's transfer, which counts server-wide too */
+static void conn_record(ClientConn *c, MetricsPhase phase, uint64_t ns) {
+    metrics_record(&c->session->metrics, phase, ns);
+    metrics_record(&c->loop->server->metrics, phase, ns);
 }
 
-int main(int argc, char *argv[]) {
-    ServerConfig config;
-    socket_t listen_sock = INVALID_SOCKET_VALUE;
-    socket_t client_sock = INVALID_SOCKET_VALUE;
-    int exit_code = 1;
+/* Add to a counter of this connection's transfer and the server's */
+static void conn_count(ClientConn *c, MetricsCounter counter, uint64_t value) {
+    metrics_count(&c->session->metrics, counter, value);
+    metrics_count(&c->loop->server->metrics, counter, value);
+}
 
-    /* Parse arguments */
-    if (parse_args(argc, argv, &config) != 0) {
-        return (strcmp(argv[argc-1], "-h") == 0 || strcmp(argv[argc-1], "--help") == 0) ? 0 : 1;
+/* Writer: wait until the transfer's disk allocation covers bytes more,
+ * holding the ring's entries meanwhile so reading stops once it fills.
+ * With durable ACKs what is written already is reported first. Returns 0
+ * to go ahead, 1 if the ring failed meanwhile, -1 on failure. */
+static int conn_pace_disk(ClientConn *c, uint64_t bytes, FTErrorCode *error) {
+    uint32_t wait_ms;
+
+    while ((wait_ms = scheduler_throttle(c->flow, SCHED_DISK, bytes)) > 0) {
+        if (c->loop->server->config->ack_durable && ack_flush(&c->acks, error) != 0) {
+            return -1;
+        }
+        if (chunk_ring_pause(&c->ring, wait_ms) != 0) {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    /* Initialize logger */
-    logger_init(config.verbose ? LOG_DEBUG : LOG_INFO, config.log_file);
+/* Writer: give a punched chunk its leaf; full-sized ones share one hashed once */
+static void writer_zero_leaf(ClientConn *c, const ChunkHeader *chunk_hdr) {
+    uint8_t leaf[FT_SHA256_DIGEST_SIZE];
 
-    /* Initialize platform */
-    if (platform_init() != 0) {
-        LOG_ERROR("Failed to initialize platform");
-        goto cleanup;
+    if (chunk_hdr->chunk_size != c->file_info.chunk_size) {
+        treehash_zero_leaf(chunk_hdr->chunk_size, leaf);
+        treehash_put_leaf(&c->session->tree, chunk_hdr->chunk_id, leaf);
+        return;
+    }
+    if (!c->zero_leaf_ready) {
+        treehash_zero_leaf(chunk_hdr->chunk_size, c->zero_leaf);
+        c->zero_leaf_ready = 1;
     }
+    treehash_put_leaf(&c->session->tree, chunk_hdr->chunk_id, c->zero_leaf);
+}
 
-    LOG_INFO("File Transfer Server starting...");
-    LOG_INFO("Output directory: %s", config.output_dir);
+/* After a chunk is on disk: acknowledge it (durable ACKs), hash it and release it */
+static int writer_finish_chunk(ClientConn *c, RingEntry *entry, FTErrorCode *error) {
+    ChunkHeader *chunk_hdr = &entry->header;
 
-    /* Create output directory if it doesn't exist */
-    if (!file_exists(config.output_dir)) {
-        if (file_create_directory(config.output_dir) != 0) {
-            LOG_ERROR("Failed to create output directory: %s", config.output_dir);
-            goto cleanup;
+    if (c->loop->server->config->ack_durable) {
+        int is_new;
+        if (ack_chunk(&c->acks, chunk_hdr->chunk_id, entry->sequence_num, &is_new, error) != 0) {
+            return -1;
         }
     }
 
-    /* Create server socket */
-    FTErrorCode error;
-    listen_sock = socket_create(&error);
-    if (listen_sock == INVALID_SOCKET_VALUE) {
-        LOG_ERROR("Failed to create socket: %s", protocol_get_error_string(error));
-        goto cleanup;
+    if (c->use_tree_hash && entry->kind == RING_HOLE) {
+        /* Nothing to read back: the leaf of zeros is known */
+        writer_zero_leaf(c, chunk_hdr);
+        session_chunk_written(c->session, chunk_hdr->chunk_id);
+    } else if (c->use_tree_hash) {
+        HashJob *job = &c->hash_jobs[entry - c->ring.entries];
+        job->entry = entry;
+        job->buffer = entry->data;
+        buffer_pool_ref(job->buffer);
+        wait_group_add(&entry->pending, 1);
+        wait_group_add(&c->hashing, 1);
+        if (threadpool_submit(&c->loop->server->workers, hash_job_run, job) != 0) {
+            buffer_pool_release(job->buffer);
+            wait_group_done(&entry->pending);
+            wait_group_done(&c->hashing);
+            *error = FT_ERR_OUT_OF_MEMORY;
+            ack_send_error(&c->acks, *error, chunk_hdr->chunk_id, "Hash failed");
+            return -1;
+        }
     }
 
-    /* Set socket options */
-    socket_set_reuseaddr(listen_sock, 1, NULL);
-    socket_set_timeout(listen_sock, FT_TIMEOUT_SECONDS, NULL);
+    chunk_ring_consume(&c->ring);
+    return 0;
+}
 
-    /* Bind and listen */
-    if (socket_bind_and_listen(listen_sock, config.port, 5, &error) != 0) {
-        LOG_ERROR("Failed to bind and listen: %s", protocol_get_error_string(error));
-        goto cleanup;
-    }
+/* Drain the ring to disk; with durable ACKs, acknowledge chunks once written.
+ * Chunks queued together are written as one batch. */
+static void chunk_writer_thread(void *arg) {
+    ClientConn *c = (ClientConn*)arg;
+    ChunkRing *ring = &c->ring;
+    AckState *acks = &c->acks;
+    int ack_durable = c->loop->server->config->ack_durable;
+    FTErrorCode error = FT_SUCCESS;
+    RingEntry *entries[WRITER_BATCH_CHUNKS];
+    OutputWrite writes[WRITER_BATCH_CHUNKS];
 
-    LOG_INFO("Server listening on port %u", config.port);
-    LOG_INFO("Waiting for connections...");
+#ifdef FT_HAVE_IO_URING
+    /* Pin the buffer pool's memory so batched writes skip per-I/O page
+     * mapping; memory the pool takes into use later needs registering again */
+    int registered = 0;
+    uint64_t generation = 0;
+    if (uring_available()) {
+        generation = buffer_pool_generation();
+        registered = (buffer_pool_register() == 0);
+        if (!registered) {
+            LOG_DEBUG("Chunk buffers not registered with io_uring");
+        }
+    }
+#endif
 
-    /* Accept connections (one at a time for now) */
-    while (1) {
-        char client_ip[64];
-        client_sock = socket_accept_connection(listen_sock, client_ip, sizeof(client_ip), &error);
-        if (client_sock == INVALID_SOCKET_VALUE) {
-            LOG_ERROR("Failed to accept connection: %s", protocol_get_error_string(error));
+    for (;;) {
+        /* Report pending chunks once the SACK delay expires without new writes */
+        uint32_t timeout_ms = ack_durable ? ack_delay_remaining(acks) : FT_RING_WAIT_FOREVER;
+        int ready = (timeout_ms == 0) ? 0 :
+                    chunk_ring_peek_batch(ring, timeout_ms, entries, WRITER_BATCH_CHUNKS);
+        if (ready < 0) {
+            goto done;
+        }
+        if (ready == 0) {
+            if (ack_flush(acks, &error) != 0) {
+                goto fail;
+            }
             continue;
         }
 
-        LOG_INFO("Client connected: %s", client_ip);
+#ifdef FT_HAVE_IO_URING
+        if (registered && buffer_pool_generation() != generation) {
+            buffer_pool_unregister();
+            generation = buffer_pool_generation();
+            registered = (buffer_pool_register() == 0);
+        }
+#endif
 
-        /* Set timeout for client socket */
-        socket_set_timeout(client_sock, FT_TIMEOUT_SECONDS, NULL);
+        int next = 0;
+        while (next < ready) {
+            RingEntry *entry = entries[next];
+            if (entry->kind == RING_REJECT) {
+                /* Queued behind the chunks received before it, so they are acknowledged first */
+                if (nak_chunk(acks, entry->header.chunk_id, entry->sequence_num, &error) != 0) {
+                    goto fail;
+                }
+                chunk_ring_consume(ring);
+                next++;
+                continue;
+            }
 
-        /* Receive file */
-        if (receive_file(client_sock, config.output_dir) == 0) {
-            LOG_INFO("Transfer completed successfully");
-            exit_code = 0;
-        } else {
-            LOG_ERROR("Transfer failed");
+            if (entry->kind == RING_HOLE) {
+                /* Adjacent holes are punched together; the disk is not charged for them */
+                int run = 1;
+                uint64_t end = entry->header.chunk_offset + entry->header.chunk_size;
+                while (next + run < ready && entries[next + run]->kind == RING_HOLE &&
+                       entries[next + run]->header.chunk_offset == end) {
+                    end += entries[next + run]->header.chunk_size;
+                    run++;
+                }
+                uint64_t punch_start = platform_get_monotonic_ns();
+                if (file_output_punch(&c->stripe_file, entry->header.chunk_offset,
+                                      end - entry->header.chunk_offset, &error) != 0) {
+                    LOG_ERROR("Failed to punch chunk %llu: %s",
+                              (unsigned long long)entry->header.chunk_id, protocol_get_error_string(error));
+                    ack_send_error(acks, error, entry->header.chunk_id, "Write failed");
+                    goto fail;
+                }
+                conn_record(c, FT_PHASE_WRITE, platform_get_monotonic_ns() - punch_start);
+                for (int i = 0; i < run; i++) {
+                    if (writer_finish_chunk(c, entries[next + i], &error) != 0) {
+                        goto fail;
+                    }
+                }
+                next += run;
+                continue;
+            }
+
+            /* Write the run of chunks up to the next rejected one, or as
+             * much as the disk allocation takes at once; those received
+             * into the mapping are in place already */
+            int run = 0;
+            int count = 0;
+            uint64_t run_bytes = 0;
+            uint64_t burst = scheduler_burst(c->flow, SCHED_DISK);
+            while (next + run < ready && entries[next + run]->kind == RING_CHUNK) {
+                RingEntry *chunk = entries[next + run];
+                if (run > 0 && run_bytes + chunk->header.chunk_size > burst) {
+                    break;
+                }
+                run++;
+                run_bytes += chunk->header.chunk_size;
+                if (chunk->mapped != NULL) {
+                    continue;
+                }
+                writes[count].offset = chunk->header.chunk_offset;
+                writes[count].buffer = chunk->data;
+                writes[count].size = chunk->header.chunk_size;
+                count++;
+            }
+
+            /* Chunks in the mapping are charged too: the kernel writes them back */
+            int paced = conn_pace_disk(c, run_bytes, &error);
+            if (paced != 0) {
+                if (paced > 0) {
+                    goto done;
+                }
+                goto fail;
+            }
+            uint64_t write_start = platform_get_monotonic_ns();
+            if (count > 0 && file_output_write_batch(&c->stripe_file, writes, count, &error) != 0) {
+                LOG_ERROR("Failed to write chunk %llu: %s",
+                          (unsigned long long)entry->header.chunk_id, protocol_get_error_string(error));
+                ack_send_error(acks, error, entry->header.chunk_id, "Write failed");
+                goto fail;
+            }
+            /* Each chunk of a batch is charged its share of the write */
+            uint64_t write_ns = platform_get_monotonic_ns() - write_start;
+            for (int i = 0; i < count; i++) {
+                conn_record(c, FT_PHASE_WRITE, write_ns / (uint64_t)count);
+            }
+
+            for (int i = 0; i < run; i++) {
+                if (writer_finish_chunk(c, entries[next + i], &error) != 0) {
+                    goto fail;
+                }
+            }
+            next += run;
+        }
+
+        /* The receiver may be waiting for one of the entries just released */
+        conn_space_freed(c);
+    }
+
+fail:
+    chunk_ring_fail(ring, error);
+done:
+#ifdef FT_HAVE_IO_URING
+    if (registered) {
+        buffer_pool_unregister();
+    }
+#endif
+    /* Ring buffers stay allocated until the last leaf hash is done with them */
+    wait_group_wait(&c->hashing);
+    conn_notify(c, NOTIFY_WRITER);
+}
+
+/* New file being assembled from a delta, one chunk at a time so each
+ * written chunk gets its leaf and can be resumed like a received one */
+typedef struct {
+    ClientConn *client;
+    uint8_t    *chunk;             /* Direct I/O buffer of chunk_size bytes */
+    size_t      fill;
+    uint64_t    chunk_id;          /* Chunk being assembled */
+    uint64_t    offset;            /* Bytes of the new file produced */
+    uint64_t    block_count;       /* Blocks of the existing file */
+    uint64_t    copied_bytes;
+    uint64_t    literal_bytes;
+} DeltaBuilder;
+
+/* Read the existing file block by block and send its signatures */
+static int delta_send_signatures(ClientConn *c, uint8_t *block, uint64_t block_count, FTErrorCode *error) {
+    AckState *acks = &c->acks;
+    uint8_t entries[FT_BLOCK_SIGS_PER_MSG * FT_BLOCK_SIG_SIZE];
+    BlockSignatures sigs;
+
+    sigs.basis_size = c->basis_size;
+    sigs.block_count = block_count;
+    sigs.block_size = c->block_size;
+    for (uint64_t first = 0; first < block_count; first += sigs.count) {
+        uint64_t remaining = block_count - first;
+        sigs.first_block = first;
+        sigs.count = (uint32_t)(remaining < FT_BLOCK_SIGS_PER_MSG ? remaining : FT_BLOCK_SIGS_PER_MSG);
+
+        for (uint32_t i = 0; i < sigs.count; i++) {
+            uint64_t offset = (first + i) * c->block_size;
+            size_t length = c->basis_size - offset < c->block_size ?
+                            (size_t)(c->basis_size - offset) : c->block_size;
+            size_t bytes_read;
+            if (file_read_chunk(c->basis, offset, block, length, &bytes_read, error) != 0 ||
+                bytes_read != length) {
+                LOG_ERROR("Failed to read the existing file at offset %llu", (unsigned long long)offset);
+                *error = FT_ERR_FILE_READ;
+                ack_send_error(acks, *error, 0, "Failed to read existing file");
+                return -1;
+            }
+            delta_put_signature(entries + (size_t)i * FT_BLOCK_SIG_SIZE, block, length);
         }
 
-        /* Close client socket */
-        close_socket(client_sock);
-        client_sock = INVALID_SOCKET_VALUE;
+        platform_mutex_lock(&acks->lock);
+        int result = send_block_signatures(acks->conn, &sigs, entries, acks->sequence_num++, error);
+        platform_mutex_unlock(&acks->lock);
+        if (result != 0) {
+            LOG_ERROR("Failed to send block signatures: %s", protocol_get_error_string(*error));
+            return -1;
+        }
+    }
+    return 0;
+}
 
-        LOG_INFO("Client disconnected");
+/* Write the assembled chunk and hash it into its leaf */
+static int delta_flush_chunk(DeltaBuilder *b, FTErrorCode *error) {
+    ClientConn *c = b->client;
+    uint64_t offset = b->chunk_id * c->file_info.chunk_size;
 
-        /* For now, exit after first transfer */
-        /* TODO: Support multiple consecutive transfers */
-        break;
+    if (conn_pace_disk(c, b->fill, error) != 0) {
+        return -1;
     }
 
-cleanup:
-    if (client_sock != INVALID_SOCKET_VALUE) {
-        close_socket(client_sock);
+    uint64_t write_start = platform_get_monotonic_ns();
+    if (file_output_write(&c->stripe_file, offset, b->chunk, b->fill, error) != 0) {
+        LOG_ERROR("Failed to write chunk %llu: %s",
+                  (unsigned long long)b->chunk_id, protocol_get_error_string(*error));
+        ack_send_error(&c->acks, *error, b->chunk_id, "Write failed");
+        return -1;
     }
-    if (listen_sock != INVALID_SOCKET_VALUE) {
-        close_socket(listen_sock);
+    conn_record(c, FT_PHASE_WRITE, platform_get_monotonic_ns() - write_start);
+    treehash_set_leaf(&c->session->tree, b->chunk_id, b->chunk, b->fill);
+    session_chunk_written(c->session, b->chunk_id);
+    b->chunk_id++;
+    b->fill = 0;
+
+    /* Log progress every 10% */
+    if (b->chunk_id % (c->stripe_chunks / 10 + 1) == 0) {
+        LOG_INFO("Progress: %.1f%% (%llu/%llu chunks)",
+                 (double)b->chunk_id / c->stripe_chunks * 100.0,
+                 (unsigned long long)b->chunk_id, (unsigned long long)c->stripe_chunks);
+    }
+    return 0;
+}
+
+/* Room left in the chunk being assembled, or -1 if the new file would overrun */
+static int delta_reserve(DeltaBuilder *b, uint64_t length, size_t *room, FTErrorCode *error) {
+    ClientConn *c = b->client;
+
+    if (length > c->file_info.file_size - b->offset) {
+        LOG_ERROR("Delta runs past the end of the file");
+        *error = FT_ERR_PROTOCOL;
+        ack_send_error(&c->acks, *error, 0, "Invalid delta");
+        return -1;
+    }
+    size_t space = c->file_info.chunk_size - b->fill;
+    *room = length < space ? (size_t)length : space;
+    return 0;
+}
+
+/* Append new bytes */
+static int delta_append(DeltaBuilder *b, const uint8_t *data, uint32_t length, FTErrorCode *error) {
+    while (length > 0) {
+        size_t n;
+        if (delta_reserve(b, length, &n, error) != 0) {
+            return -1;
+        }
+        memcpy(b->chunk + b->fill, data, n);
+        b->fill += n;
+        b->offset += n;
+        data += n;
+        length -= (uint32_t)n;
+        if (b->fill == b->client->file_info.chunk_size && delta_flush_chunk(b, error) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Append a run of blocks of the existing file, read straight into the chunk */
+static int delta_copy(DeltaBuilder *b, uint64_t block, uint32_t count, FTErrorCode *error) {
+    ClientConn *c = b->client;
+
+    if (block >= b->block_count || count > b->block_count - block) {
+        LOG_ERROR("Delta copies blocks %llu+%u of %llu",
+                  (unsigned long long)block, count, (unsigned long long)b->block_count);
+        *error = FT_ERR_PROTOCOL;
+        ack_send_error(&c->acks, *error, 0, "Invalid delta");
+        return -1;
+    }
+
+    uint64_t source = block * c->block_size;
+    uint64_t end = (block + count) * c->block_size;
+    if (end > c->basis_size) {
+        end = c->basis_size;
+    }
+    while (source < end) {
+        size_t n;
+        size_t bytes_read;
+        if (delta_reserve(b, end - source, &n, error) != 0) {
+            return -1;
+        }
+        if (file_read_chunk(c->basis, source, b->chunk + b->fill, n, &bytes_read, error) != 0 ||
+            bytes_read != n) {
+            LOG_ERROR("Failed to read the existing file at offset %llu", (unsigned long long)source);
+            *error = FT_ERR_FILE_READ;
+            ack_send_error(&c->acks, *error, 0, "Failed to read existing file");
+            return -1;
+        }
+        b->fill += n;
+        b->offset += n;
+        b->copied_bytes += n;
+        source += n;
+        if (b->fill == c->file_info.chunk_size && delta_flush_chunk(b, error) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Carry out one DELTA_DATA frame */
+static int delta_apply_frame(DeltaBuilder *b, const RingEntry *entry, FTErrorCode *error) {
+    const ChunkHeader *frame = &entry->header;
+    size_t pos = 0;
+
+    if (frame->chunk_offset != b->offset) {
+        LOG_ERROR("Delta frame %llu starts at offset %llu, expected %llu",
+                  (unsigned long long)frame->chunk_id, (unsigned long long)frame->chunk_offset,
+                  (unsigned long long)b->offset);
+        *error = FT_ERR_PROTOCOL;
+        ack_send_error(&b->client->acks, *error, frame->chunk_id, "Invalid delta");
+        return -1;
+    }
+
+    while (pos < frame->chunk_size) {
+        DeltaOp op;
+        if (delta_next_op(entry->data, frame->chunk_size, &pos, &op) != 0) {
+            LOG_ERROR("Malformed delta frame %llu", (unsigned long long)frame->chunk_id);
+            *error = FT_ERR_PROTOCOL;
+            ack_send_error(&b->client->acks, *error, frame->chunk_id, "Invalid delta");
+            return -1;
+        }
+        int result;
+        if (op.kind == DELTA_OP_COPY) {
+            result = delta_copy(b, op.block, op.count, error);
+        } else {
+            result = delta_append(b, op.data, op.count, error);
+            b->literal_bytes += op.count;
+        }
+        if (result != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Delta upload: send the existing file's block signatures, then rebuild
+ * the new file from the DELTA_DATA frames the event loop queues */
+static void delta_writer_thread(void *arg) {
+    ClientConn *c = (ClientConn*)arg;
+    ChunkRing *ring = &c->ring;
+    FTErrorCode error = FT_ERR_OUT_OF_MEMORY;
+    RingEntry *entries[WRITER_BATCH_CHUNKS];
+    DeltaBuilder builder;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.client = c;
+    builder.block_count = (c->basis_size + c->block_size - 1) / c->block_size;
+    builder.chunk = file_alloc_buffer(c->file_info.chunk_size);
+    uint8_t *block = (uint8_t*)malloc(c->block_size);
+    if (builder.chunk == NULL || block == NULL) {
+        LOG_ERROR("Failed to allocate delta buffers");
+        ack_send_error(&c->acks, error, 0, "Out of memory");
+        goto fail;
+    }
+
+    if (delta_send_signatures(c, block, builder.block_count, &error) != 0) {
+        goto fail;
+    }
+    conn_notify(c, NOTIFY_SIGNED);
+
+    for (;;) {
+        int ready = chunk_ring_peek_batch(ring, FT_RING_WAIT_FOREVER, entries, WRITER_BATCH_CHUNKS);
+        if (ready < 0) {
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            if (delta_apply_frame(&builder, entries[i], &error) != 0) {
+                goto fail;
+            }
+            chunk_ring_consume(ring);
+        }
+        conn_space_freed(c);
+    }
+
+    /* Closed and drained, or stopped by conn_fail() */
+    platform_mutex_lock(&ring->lock);
+    int failed = ring->failed;
+    platform_mutex_unlock(&ring->lock);
+    if (failed) {
+        goto done;
+    }
+    if (builder.fill > 0 && delta_flush_chunk(&builder, &error) != 0) {
+        goto fail;
+    }
+    if (builder.offset != c->file_info.file_size) {
+        LOG_ERROR("Delta rebuilt %llu of %llu bytes",
+                  (unsigned long long)builder.offset, (unsigned long long)c->file_info.file_size);
+        error = FT_ERR_PROTOCOL;
+        ack_send_error(&c->acks, error, 0, "Incomplete delta");
+        goto fail;
+    }
+    LOG_INFO("Rebuilt from the existing file: %llu bytes copied, %llu bytes received",
+             (unsigned long long)builder.copied_bytes, (unsigned long long)builder.literal_bytes);
+
+    /* Read by the event loop once this thread is joined */
+    c->received_bytes = builder.offset;
+    goto done;
+
+fail:
+    chunk_ring_fail(ring, error);
+done:
+    fclose(c->basis);
+    c->basis = NULL;
+    free(block);
+    file_free_buffer(builder.chunk);
+    conn_notify(c, NOTIFY_WRITER);
+}
+
+/* Close and rename a verified file if commit is set, adding its chunks to
+ * the chunk store, then drop the session. Returns the commit's result. */
+static FTErrorCode commit_session(SessionTable *sessions, ChunkStore *store, TransferMetrics *totals,
+                                  TransferSession *session, int commit) {
+    FTErrorCode error = FT_SUCCESS;
+    char final_path[1024];
+
+    if (commit && session_commit(session, final_path, sizeof(final_path), &error) == 0) {
+        LOG_INFO("File received successfully: %s (%llu bytes)",
+                 final_path, (unsigned long long)session->received_bytes);
+        metrics_log(&session->metrics, "Chunk");
+        metrics_count(totals, FT_COUNT_TRANSFERS, 1);
+        if (store != NULL && session->use_tree_hash && !(session->file_info.flags & FT_FILE_BUNDLE)) {
+            chunk_store_add_file(store, final_path, &session->file_info, &session->tree);
+        }
+    } else if (commit && error == FT_SUCCESS) {
+        error = FT_ERR_FILE_WRITE;
+    }
+    session_release(sessions, session);
+    return error;
+}
+
+/* Worker task for commit_session() */
+static void commit_job_run(void *arg) {
+    CommitJob *job = (CommitJob*)arg;
+    FTErrorCode error = commit_session(job->sessions, job->store, job->totals, job->session, job->commit);
+    if (job->client != NULL) {
+        conn_report_commit(job->client, error);
+    }
+    free(job);
+}
+
+/* Hand the session reference to a worker for commit_session(); client, if
+ * given, is told the result */
+static void server_release_session(Server *server, TransferSession *session, int commit,
+                                   struct ClientConn *client) {
+    CommitJob *job = (CommitJob*)malloc(sizeof(CommitJob));
+
+    if (job != NULL) {
+        job->sessions = &server->sessions;
+        job->store = server->store;
+        job->totals = &server->metrics;
+        job->session = session;
+        job->commit = commit;
+        job->client = client;
+        if (threadpool_submit(&server->workers, commit_job_run, job) != 0) {
+            free(job);
+            job = NULL;
+        }
+    }
+    if (job == NULL) {
+        FTErrorCode error = commit_session(&server->sessions, server->store, &server->metrics, session, commit);
+        if (client != NULL) {
+            conn_report_commit(client, error);
+        }
+    }
+}
+
+/* Worker task: unpack a slice of a bundle; the last slice removes it */
+static void extract_job_run(void *arg) {
+    ExtractJob *job = (ExtractJob*)arg;
+    BundleCommit *bundle = job->bundle;
+    TransferSession *session = bundle->session;
+    const FileInfo *file_info = &session->file_info;
+
+    uint32_t extracted = bundle_extract(session->temp_path, file_info->file_size, file_info->bundle_entries,
+                                        job->first, job->count, session->output_dir, bundle->policy);
+    platform_mutex_lock(&bundle->lock);
+    bundle->extracted += extracted;
+    int last = (--bundle->pending == 0);
+    platform_mutex_unlock(&bundle->lock);
+    if (!last) {
+        return;
+    }
+
+    FTErrorCode error = FT_SUCCESS;
+    if (bundle->extracted == file_info->bundle_entries) {
+        LOG_INFO("Bundle %s unpacked: %u files", session->name, bundle->extracted);
+    } else {
+        LOG_ERROR("Bundle %s: only %u of %u files unpacked", session->name, bundle->extracted,
+                  file_info->bundle_entries);
+        error = FT_ERR_FILE_WRITE;
+    }
+    session_remove_file(session);
+    session_release(bundle->sessions, session);
+    if (bundle->client != NULL) {
+        conn_report_commit(bundle->client, error);
+    }
+    platform_mutex_destroy(&bundle->lock);
+    free(bundle->jobs);
+    free(bundle);
+}
+
+/* Hand a verified bundle's session reference to the workers, which unpack
+ * EXTRACT_JOB_ENTRIES files each and then tell client the result */
+static void server_extract_bundle(Server *server, TransferSession *session, struct ClientConn *client) {
+    const FileInfo *file_info = &session->file_info;
+    uint32_t entries = file_info->bundle_entries;
+    uint32_t slices = (entries + EXTRACT_JOB_ENTRIES - 1) / EXTRACT_JOB_ENTRIES;
+    BundleCommit *bundle = (BundleCommit*)calloc(1, sizeof(BundleCommit));
+    ExtractJob *jobs = (ExtractJob*)calloc(slices, sizeof(ExtractJob));
+
+    if (bundle == NULL || jobs == NULL) {
+        /* Unpacked on the event loop instead */
+        free(bundle);
+        free(jobs);
+        uint32_t extracted = bundle_extract(session->temp_path, file_info->file_size, entries, 0, entries,
+                                            session->output_dir, &server->config->write_policy);
+        session_remove_file(session);
+        session_release(&server->sessions, session);
+        conn_report_commit(client, extracted == entries ? FT_SUCCESS : FT_ERR_FILE_WRITE);
+        return;
+    }
+    bundle->sessions = &server->sessions;
+    bundle->session = session;
+    bundle->policy = &server->config->write_policy;
+    bundle->client = client;
+    bundle->jobs = jobs;
+    bundle->pending = slices;
+    platform_mutex_init(&bundle->lock);
+
+    /* The last slice frees the jobs, and it cannot finish before it is submitted */
+    for (uint32_t i = 0; i < slices; i++) {
+        ExtractJob *job = &jobs[i];
+        job->bundle = bundle;
+        job->first = i * EXTRACT_JOB_ENTRIES;
+        job->count = entries - job->first < EXTRACT_JOB_ENTRIES ? entries - job->first : EXTRACT_JOB_ENTRIES;
+        if (threadpool_submit(&server->workers, extract_job_run, job) != 0) {
+            extract_job_run(job);
+        }
+    }
+}
+
+/* Worker task: delete partial uploads older than -k */
+static void collect_job_run(void *arg) {
+    Server *server = (Server*)arg;
+    const ServerConfig *config = server->config;
+    session_collect_partials(&server->sessions, config->output_dir, (uint64_t)config->keep_hours * 3600);
+}
+
+/* Whether the connection waits for client data */
+static int conn_reading(const ClientConn *c) {
+    switch (c->state) {
+    case CONN_TLS:
+    case CONN_HANDSHAKE:
+    case CONN_FILE_INFO:
+    case CONN_CHUNKS:
+    case CONN_VERIFY:
+        return !c->waiting_entry && c->throttle_ms == 0 && c->route == NULL;
+    default:
+        return 0;
+    }
+}
+
+/* Restart the idle timeout; none applies while the transfer waits on its own
+ * disk writes (the final commit too) or bandwidth allocation, or on the
+ * writer reading the existing file for a delta. A queued transfer waits
+ * for admission up to SCHED_QUEUE_TIMEOUT_MS. */
+static void conn_touch(ClientConn *c) {
+    if (c->state == CONN_QUEUED) {
+        c->deadline_ms = c->admission.queued_ms + SCHED_QUEUE_TIMEOUT_MS;
+    } else if (c->state == CONN_DRAINING || c->state == CONN_COMMITTING || c->waiting_entry ||
+               c->throttle_ms != 0 || (c->state == CONN_CHUNKS && c->signing)) {
+        c->deadline_ms = 0;
+    } else {
+        c->deadline_ms = platform_get_monotonic_ms() + FT_TIMEOUT_SECONDS * 1000ULL;
+    }
+}
+
+/* Have the event loop read again without waiting for the socket: input may
+ * already sit in the connection's receive buffer */
+static void conn_mark_ready(ClientConn *c) {
+    if (!c->ready) {
+        c->ready = 1;
+        c->ready_next = c->loop->ready;
+        c->loop->ready = c;
+    }
+}
+
+/* Register the connection's current interest with the poller. A socket is
+ * only watched while the connection waits for it, so a hung-up peer does
+ * not keep waking the loop. */
+static void conn_watch(ClientConn *c) {
+    uint32_t events = 0;
+    if (conn_reading(c)) {
+        events |= FT_POLL_READ;
+    }
+    if (c->output_pending && !c->output_abandoned) {
+        events |= FT_POLL_WRITE;
+    }
+    if (events == c->interest) {
+        return;
+    }
+
+    int result = 0;
+    if (events == 0) {
+        platform_poller_remove(c->loop->poller, c->conn.sock);
+    } else if (c->interest == 0) {
+        result = platform_poller_add(c->loop->poller, c->conn.sock, events, c);
+    } else {
+        result = platform_poller_modify(c->loop->poller, c->conn.sock, events, c);
+    }
+    if (result != 0) {
+        /* Left to the idle timeout */
+        LOG_ERROR("Failed to watch connection from %s", c->client_ip);
+        platform_poller_remove(c->loop->poller, c->conn.sock);
+        events = 0;
+    }
+    c->interest = events;
+}
+
+/* Free the transfer's buffers and drop its session; the writer must be joined */
+static void conn_release_transfer(ClientConn *c) {
+    /* A chunk store job queued after the writer stopped may still run */
+    wait_group_wait(&c->hashing);
+    Scheduler *scheduler = &c->loop->server->scheduler;
+    scheduler_release(scheduler_cancel(scheduler, &c->admission));
+    scheduler_release(c->flow);
+    c->flow = NULL;
+    if (c->session != NULL) {
+        if (!c->stripe_reported) {
+            c->stripe_reported = 1;
+            session_stripe_done(c->session, 0, 0);
+        }
+        server_release_session(c->loop->server, c->session, 0, NULL);
+        c->session = NULL;
+    }
+    if (c->basis != NULL) {
+        fclose(c->basis);
+        c->basis = NULL;
+    }
+    free(c->hash_jobs);
+    c->hash_jobs = NULL;
+    free(c->packed);
+    c->packed = NULL;
+    if (c->mapped) {
+        file_map_close(&c->map);
+        c->mapped = 0;
+    }
+    free(c->entry_maps);
+    c->entry_maps = NULL;
+    if (c->udp != NULL) {
+        platform_poller_remove(c->loop->poller, c->udp->udp.sock);
+        udp_receiver_close(c->udp);
+        free(c->udp);
+        c->udp = NULL;
+    }
+    chunk_ring_destroy(&c->ring);
+    bitmap_free(&c->acks.acked);
+    bitmap_free(&c->received_map);
+}
+
+/* Stop receiving and flush what is queued before closing */
+static void conn_close(ClientConn *c) {
+    c->state = CONN_CLOSING;
+    c->waiting_entry = 0;
+    c->throttle_ms = 0;
+    conn_touch(c);
+}
+
+/* Abandon the transfer: stop the writer, fail the stripe and close */
+static void conn_fail(ClientConn *c) {
+    if (c->state == CONN_CLOSING) {
+        return;
+    }
+    c->result = -1;
+    conn_close(c);
+
+    if (c->writer_running) {
+        /* Stops the writer without draining queued chunks; the transfer is
+         * released once it has exited */
+        chunk_ring_fail(&c->ring, FT_ERR_PROTOCOL);
+    }
+    if (c->session != NULL && !c->stripe_reported) {
+        /* Let stripe 0 of the transfer fail right away */
+        c->stripe_reported = 1;
+        session_stripe_done(c->session, 0, 0);
+        loop_check_stripes(c->loop, c->session);
+    }
+    if (!c->writer_running) {
+        conn_release_transfer(c);
+    }
+}
+
+/* Batch connection: forget the committed file and wait for the next
+ * FILE_INFO, which may already be buffered */
+static void conn_next_file(ClientConn *c) {
+    AckState *acks = &c->acks;
+
+    memset(&c->file_info, 0, sizeof(c->file_info));
+    c->stripe_reported = 0;
+    c->use_tree_hash = 0;
+    c->received = NULL;
+    c->stripe_chunks = 0;
+    c->received_bytes = 0;
+    acks->first_chunk = 0;
+    acks->end_chunk = 0;
+    memset(&acks->sack, 0, sizeof(acks->sack));
+    c->sparse = 0;
+    c->hole_bytes = 0;
+    c->zero_leaf_ready = 0;
+    c->delta = 0;
+    c->signing = 0;
+    c->basis_size = 0;
+    c->block_size = 0;
+    c->delta_frames = 0;
+    c->dedup = 0;
+    c->stored_chunks = 0;
+    c->stored_bytes = 0;
+    c->packed_chunks = 0;
+    c->packed_raw_bytes = 0;
+    c->packed_wire_bytes = 0;
+    c->compared = 0;
+
+    /* Only the end of the batch makes the connection a success */
+    c->result = -1;
+    c->state = CONN_FILE_INFO;
+    conn_touch(c);
+    conn_mark_ready(c);
+}
+
+/* Hand the verified file to a worker for the final sync and rename, or a
+ * bundle to several to unpack. The client hears it verified only once that
+ * is done (conn_committed()). */
+static void conn_commit(ClientConn *c) {
+    TransferSession *session = c->session;
+
+    /* The job takes the session reference; the mapping and buffers go first */
+    c->session = NULL;
+    conn_release_transfer(c);
+    c->state = CONN_COMMITTING;
+    c->committing = 1;
+    conn_touch(c);
+    if (c->file_info.flags & FT_FILE_BUNDLE) {
+        server_extract_bundle(c->loop->server, session, c);
+    } else {
+        server_release_session(c->loop->server, session, 1, c);
+    }
+}
+
+/* The commit job reported: answer the verification with its result */
+static void conn_committed(ClientConn *c) {
+    FTErrorCode error = c->commit_error;
+
+    c->committing = 0;
+    if (c->state != CONN_COMMITTING) {
+        /* Failed meanwhile; the connection can go now */
+        return;
+    }
+
+    /* A client without tree hashes sent no VERIFY_REQUEST to answer */
+    if (c->use_tree_hash) {
+        VerifyResponse *response = &c->response;
+        memset(response, 0, sizeof(*response));
+        response->checksum_match = (error == FT_SUCCESS);
+        if (error != FT_SUCCESS) {
+            response->error_code = (uint8_t)error;
+        }
+        FTErrorCode send_error_code;
+        if (send_verify_response(&c->conn, response, c->acks.sequence_num++, &send_error_code) != 0) {
+            LOG_ERROR("Failed to send VERIFY_RESPONSE: %s", protocol_get_error_string(send_error_code));
+            conn_fail(c);
+            return;
+        }
+    }
+    if (error != FT_SUCCESS) {
+        LOG_ERROR("Failed to commit %s: %s", c->file_info.filename, protocol_get_error_string(error));
+        conn_fail(c);
+        return;
+    }
+
+    c->result = 0;
+    if (c->capabilities & FT_CAP_BATCH) {
+        c->batch_files++;
+        c->batch_bytes += c->file_info.file_size;
+        conn_next_file(c);
+        return;
+    }
+    conn_close(c);
+}
+
+/* TRANSFER_COMPLETE instead of FILE_INFO: the client's batch is done */
+static int conn_end_batch(ClientConn *c) {
+    TransferComplete complete;
+
+    if (protocol_deserialize_transfer_complete(c->payload, (size_t)c->header.payload_size, &complete) != 0) {
+        LOG_ERROR("Malformed TRANSFER_COMPLETE payload");
+        conn_fail(c);
+        return -1;
+    }
+    if (complete.total_chunks != c->batch_files || complete.total_bytes != c->batch_bytes) {
+        LOG_ERROR("Client reports %llu files / %llu bytes, received %llu / %llu",
+                  (unsigned long long)complete.total_chunks, (unsigned long long)complete.total_bytes,
+                  (unsigned long long)c->batch_files, (unsigned long long)c->batch_bytes);
+        conn_fail(c);
+        return -1;
+    }
+
+    LOG_INFO("Batch complete: %llu files, %llu bytes", (unsigned long long)c->batch_files,
+             (unsigned long long)c->batch_bytes);
+    c->result = 0;
+    conn_close(c);
+    return 0;
+}
+
+/* Stripe 0: verify and commit once every stripe is done */
+static void conn_check_stripes(ClientConn *c) {
+    int status = session_stripes_status(c->session);
+    if (status == 0) {
+        /* Another stripe made progress */
+        conn_touch(c);
+        return;
+    }
+    if (status < 0) {
+        LOG_ERROR("Striped transfer failed");
+        send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Stripe failed", c->acks.sequence_num++, NULL);
+        conn_fail(c);
+        return;
+    }
+
+    LOG_INFO("All chunks received successfully");
+
+    if (!c->use_tree_hash) {
+        LOG_WARN("Client did not request tree hash verification, relying on chunk CRC32 only");
+        conn_commit(c);
+        return;
+    }
+
+    c->state = CONN_VERIFY;
+    c->verify_step = VERIFY_COMPLETE;
+    conn_touch(c);
+    conn_mark_ready(c);
+}
+
+/* Re-check stripe 0 of a session after one of its stripes finished or failed */
+static void loop_check_stripes(EventLoop *loop, TransferSession *session) {
+    ClientConn *next;
+    for (ClientConn *other = loop->conns; other != NULL; other = next) {
+        next = other->next;
+        if (!other->closed && other->session == session && other->state == CONN_STRIPES) {
+            conn_check_stripes(other);
+            conn_update(other);
+        }
+    }
+}
+
+/* The writer drained the ring: this stripe's range is on disk and hashed */
+static void conn_stripe_complete(ClientConn *c) {
+    if (c->stored_chunks > 0) {
+        LOG_INFO("%llu of %llu chunks (%llu bytes) taken from the chunk store",
+                 (unsigned long long)c->stored_chunks, (unsigned long long)c->stripe_chunks,
+                 (unsigned long long)c->stored_bytes);
+    }
+    if (c->packed_chunks > 0) {
+        LOG_INFO("%llu of %llu chunks arrived compressed, %llu bytes as %llu",
+                 (unsigned long long)c->packed_chunks, (unsigned long long)c->stripe_chunks,
+                 (unsigned long long)c->packed_raw_bytes, (unsigned long long)c->packed_wire_bytes);
+    }
+    if (c->hole_bytes > 0) {
+        LOG_INFO("%llu bytes arrived as hole records", (unsigned long long)c->hole_bytes);
+    }
+    if (c->udp != NULL) {
+        LOG_INFO("%llu datagrams over UDP, %llu dropped, %llu fragments rebuilt from parity",
+                 (unsigned long long)c->udp->datagrams, (unsigned long long)c->udp->dropped,
+                 (unsigned long long)c->udp->recovered);
+    }
+    session_stripe_done(c->session, 1, c->received_bytes);
+    c->stripe_reported = 1;
+    loop_check_stripes(c->loop, c->session);
+
+    if (c->file_info.stripe_index != 0) {
+        LOG_INFO("Stripe %u complete (%llu bytes)", c->file_info.stripe_index + 1,
+                 (unsigned long long)c->received_bytes);
+        c->result = 0;
+        conn_release_transfer(c);
+        conn_close(c);
+        return;
+    }
+
+    /* Stripe 0 verifies and commits once the others are done too */
+    c->state = CONN_STRIPES;
+    conn_check_stripes(c);
+}
+
+/* The writer thread exited */
+static void conn_writer_exited(ClientConn *c) {
+    platform_thread_join(c->writer_thread);
+    c->writer_running = 0;
+
+    if (c->state == CONN_CLOSING) {
+        /* Stopped by conn_fail() */
+        conn_release_transfer(c);
+    } else if (c->ring.failed) {
+        LOG_ERROR("Writer failed: %s", protocol_get_error_string(c->ring.error));
+        conn_fail(c);
+    } else {
+        conn_stripe_complete(c);
+    }
+}
+
+/* Every chunk of the stripe was handed to the writer */
+static void conn_chunks_done(ClientConn *c) {
+    chunk_ring_close(&c->ring);
+    c->state = CONN_DRAINING;
+    conn_touch(c);
+}
+
+/* Open the existing copy of the file for a delta upload, if one applies:
+ * the transfer resumes nothing and runs over a single connection */
+static int conn_open_basis(ClientConn *c) {
+    const ServerConfig *config = c->loop->server->config;
+    const FileInfo *file_info = &c->file_info;
+    char path[1024];
+
+    if ((c->capabilities & FT_CAP_DELTA) == 0 || !c->use_tree_hash || file_info->stripe_count > 1 ||
+        file_info->file_size == 0 || c->session->resumed_chunks > 0 || (file_info->flags & FT_FILE_BUNDLE)) {
+        return 0;
+    }
+    if (file_build_path(config->output_dir, c->session->name, path, sizeof(path)) != FT_SUCCESS ||
+        !file_exists(path) || file_get_size(path, &c->basis_size, NULL) != 0 || c->basis_size == 0) {
+        return 0;
+    }
+    c->basis = file_open_read(path, NULL);
+    if (c->basis == NULL) {
+        LOG_WARN("Receiving the whole file instead");
+        return 0;
+    }
+
+    c->block_size = delta_block_size(c->basis_size);
+    c->delta = 1;
+    c->signing = 1;
+    LOG_INFO("Existing copy found (%llu bytes), receiving the differences in %u-byte blocks",
+             (unsigned long long)c->basis_size, c->block_size);
+    return 1;
+}
+
+/* Open the UDP data path the client asked for; 0 leaves the chunks on TCP */
+static int conn_open_udp(ClientConn *c, UdpSetup *setup) {
+    const ServerConfig *config = c->loop->server->config;
+    uint32_t chunk_size = c->file_info.chunk_size;
+    FTErrorCode error;
+    uint64_t token;
+
+    /* The token binds the UDP socket to the first peer it hears from, so an
+     * off-path host must not be able to guess it */
+    if (platform_random_bytes(&token, sizeof(token)) != 0) {
+        LOG_WARN("No random source for a UDP token, receiving chunks over TCP");
+        return 0;
+    }
+
+    c->udp = (UdpReceiver*)malloc(sizeof(UdpReceiver));
+    if (c->udp == NULL ||
+        udp_receiver_open(c->udp, c->conn.sock, token, tune_scale_depth(config->ring_chunks * 4, chunk_size),
+                          chunk_size, setup, &error) != 0) {
+        LOG_WARN("Cannot open a UDP socket, receiving chunks over TCP");
+        free(c->udp);
+        c->udp = NULL;
+        return 0;
+    }
+    LOG_INFO("Receiving chunks over UDP on port %u", setup->port);
+    return 1;
+}
+
+/* Set up the stripe announced by FILE_INFO and start its writer */
+static int conn_start_transfer(ClientConn *c) {
+    const ServerConfig *config = c->loop->server->config;
+    FileInfo *file_info = &c->file_info;
+    AckState *acks = &c->acks;
+    FTErrorCode error;
+
+    /* Without the capability the stripe fields are reserved bytes */
+    if ((c->capabilities & FT_CAP_STRIPED) == 0 || file_info->stripe_count <= 1) {
+        file_info->transfer_id = 0;
+        file_info->stripe_index = 0;
+        file_info->stripe_count = 1;
+    }
+    if (file_info->stripe_count > FT_MAX_STREAMS || file_info->stripe_index >= file_info->stripe_count) {
+        LOG_ERROR("Invalid stripe %u of %u", file_info->stripe_index, file_info->stripe_count);
+        send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Invalid stripe", acks->sequence_num++, NULL);
+        goto fail;
+    }
+
+    /* Likewise the batch fields; a bundle's manifest must fit in it */
+    if ((c->capabilities & FT_CAP_BATCH) == 0) {
+        file_info->flags = 0;
+        file_info->bundle_entries = 0;
+    }
+    /* A request answered in FILE_ACK, not a property of the file */
+    int want_udp = (file_info->flags & FT_FILE_UDP) != 0;
+    file_info->flags &= (uint8_t)~FT_FILE_UDP;
+    if ((file_info->flags & FT_FILE_BUNDLE) &&
+        (file_info->bundle_entries == 0 || file_info->bundle_entries > FT_BUNDLE_MAX_ENTRIES ||
+         file_info->file_size < bundle_data_offset(file_info->bundle_entries))) {
+        LOG_ERROR("Invalid bundle of %u files in %llu bytes", file_info->bundle_entries,
+                  (unsigned long long)file_info->file_size);
+        send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Invalid bundle", acks->sequence_num++, NULL);
+        goto fail;
+    }
+
+    /* Every buffer of the transfer is chunk_size bytes, so it must stay
+     * within the size agreed to */
+    if (file_info->chunk_size < FT_MIN_CHUNK_SIZE || file_info->chunk_size > c->max_chunk_size ||
+        file_info->total_chunks != (file_info->file_size + file_info->chunk_size - 1) / file_info->chunk_size) {
+        LOG_ERROR("Invalid chunk size %u (limit %u) for %llu chunks", file_info->chunk_size,
+                  c->max_chunk_size, (unsigned long long)file_info->total_chunks);
+        send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Invalid chunk size", acks->sequence_num++, NULL);
+        goto fail;
+    }
+
+    if (file_info->flags & FT_FILE_BUNDLE) {
+        LOG_INFO("Bundle: %s, %u files, Size: %llu bytes, Chunks: %llu",
+                 file_info->filename, file_info->bundle_entries, (unsigned long long)file_info->file_size,
+                 (unsigned long long)file_info->total_chunks);
+    } else {
+        LOG_INFO("File: %s, Size: %llu bytes, Chunks: %llu",
+                 file_info->filename, (unsigned long long)file_info->file_size,
+                 (unsigned long long)file_info->total_chunks);
+    }
+
+    /* The first stripe to arrive opens and preallocates the file for all of them */
+    c->use_tree_hash = (c->capabilities & FT_CAP_TREE_HASH) != 0 &&
+                       file_info->checksum_type == CHECKSUM_MERKLE_SHA256;
+    int resume = (c->capabilities & FT_CAP_RESUME) != 0;
+    const char *message = NULL;
+    if (session_join(&c->loop->server->sessions, file_info, config->output_dir, &config->write_policy,
+                     c->use_tree_hash, resume, &c->session, &message, &error) != 0) {
+        send_error(&c->conn, error, 0, message, acks->sequence_num++, NULL);
+        goto fail;
+    }
+
+    /* Each stripe writes through its own copy of the output file, so the
+     * periodic sync counter is not shared between writer threads */
+    c->stripe_file = c->session->file;
+    protocol_stripe_range(file_info->total_chunks, file_info->stripe_count, file_info->stripe_index,
+                          &acks->first_chunk, &acks->end_chunk);
+    acks->sack.cumulative = acks->first_chunk;
+    c->stripe_chunks = acks->end_chunk - acks->first_chunk;
+    if (file_info->stripe_count > 1) {
+        LOG_INFO("Stripe %u of %u (transfer %016llx): chunks %llu-%llu",
+                 file_info->stripe_index + 1, file_info->stripe_count,
+                 (unsigned long long)file_info->transfer_id, (unsigned long long)acks->first_chunk,
+                 (unsigned long long)acks->end_chunk - 1);
+    }
+
+    /* Track acknowledged chunks (retransmissions may arrive out of order).
+     * With durable ACKs the event loop keeps its own map of chunks
+     * handed to the writer. */
+    if (bitmap_init(&acks->acked, file_info->total_chunks) != FT_SUCCESS ||
+        (config->ack_durable && bitmap_init(&c->received_map, file_info->total_chunks) != FT_SUCCESS)) {
+        LOG_ERROR("Failed to allocate chunk bitmap");
+        send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+        goto fail;
+    }
+    c->received = config->ack_durable ? &c->received_map : &acks->acked;
+
+    /* Chunks kept from an interrupted upload count as received, and the
+     * client is told not to send them */
+    FileAck file_ack;
+    memset(&file_ack, 0, sizeof(file_ack));
+    file_ack.status = 0;  /* Ready */
+    uint8_t *resumed = NULL;
+    if (c->session->resumed_chunks > 0) {
+        resumed = (uint8_t*)calloc(1, (size_t)((c->stripe_chunks + 7) / 8));
+        if (resumed == NULL) {
+            LOG_ERROR("Failed to allocate resume bitmap");
+            send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+            goto fail;
+        }
+        file_ack.resume_chunks = session_resumed_range(c->session, acks->first_chunk, acks->end_chunk, resumed);
+        file_ack.resume_bits = file_ack.resume_chunks > 0 ? (uint32_t)c->stripe_chunks : 0;
+        for (uint64_t i = 0; i < c->stripe_chunks && file_ack.resume_bits != 0; i++) {
+            if ((resumed[i / 8] & (1u << (i % 8))) == 0) {
+                continue;
+            }
+            uint64_t chunk_id = acks->first_chunk + i;
+            uint64_t offset = chunk_id * file_info->chunk_size;
+            bitmap_set(&acks->acked, chunk_id);
+            if (config->ack_durable) {
+                bitmap_set(&c->received_map, chunk_id);
+            }
+            c->received_bytes += file_info->file_size - offset < file_info->chunk_size ?
+                                 file_info->file_size - offset : file_info->chunk_size;
+        }
+    }
+
+    /* A file already in place is rebuilt from the blocks of it the client
+     * still has */
+    if (conn_open_basis(c)) {
+        file_ack.flags |= FT_FILE_ACK_DELTA;
+    } else if ((c->capabilities & FT_CAP_DEDUP) != 0 && c->use_tree_hash &&
+               c->received->num_set < c->stripe_chunks) {
+        /* Otherwise the client asks the chunk store first */
+        c->dedup = 1;
+        file_ack.flags |= FT_FILE_ACK_DEDUP;
+    }
+
+    /* Zero chunks of a sparse file may come as bare headers, which are
+     * punched out of the file rather than written */
+    if ((file_info->flags & FT_FILE_SPARSE) && !c->delta) {
+        c->sparse = 1;
+        file_ack.flags |= FT_FILE_ACK_SPARSE;
+    }
+
+    /* The chunks may come over UDP instead, which is not encrypted */
+    UdpSetup udp_setup;
+    if (want_udp && !c->delta && !config->tls && conn_open_udp(c, &udp_setup)) {
+        file_ack.flags |= FT_FILE_ACK_UDP;
+    }
+
+    /* Send file ACK */
+    int sent = send_file_ack(&c->conn, &file_ack, resumed, resume, acks->sequence_num++, &error);
+    free(resumed);
+    if (sent != 0) {
+        LOG_ERROR("Failed to send file ACK");
+        goto fail;
+    }
+    if ((file_ack.flags & FT_FILE_ACK_UDP) &&
+        send_udp_setup(&c->conn, &udp_setup, acks->sequence_num++, &error) != 0) {
+        LOG_ERROR("Failed to send UDP setup");
+        goto fail;
+    }
+    if (file_ack.resume_chunks > 0 && file_info->stripe_count > 1) {
+        LOG_INFO("Stripe %u: %llu of %llu chunks already written", file_info->stripe_index + 1,
+                 (unsigned long long)file_ack.resume_chunks, (unsigned long long)c->stripe_chunks);
+    }
+
+    acks->use_sack = (c->capabilities & FT_CAP_SACK) != 0;
+    if (c->udp != NULL) {
+        /* Messages complete in any order, so a SACK's highest sequence
+         * number would make the client resend those still on their way */
+        acks->sack.unordered = 1;
+        if (platform_poller_add(c->loop->poller, c->udp->udp.sock, FT_POLL_READ,
+                                (void*)((uintptr_t)c | 1)) != 0) {
+            LOG_ERROR("Failed to watch UDP socket");
+            goto fail;
+        }
+    }
+
+    /* Allocate the ring between the event loop and the writer thread,
+     * holding about the same bytes whatever the chunk size */
+    if (chunk_ring_init(&c->ring, tune_scale_depth(config->ring_chunks, file_info->chunk_size),
+                        file_info->chunk_size) != FT_SUCCESS) {
+        LOG_ERROR("Failed to allocate chunk buffers");
+        send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+        goto fail;
+    }
+    c->ring.waiter.notify = conn_on_pool_space;
+    c->ring.waiter.context = c;
+    if ((c->capabilities & FT_CAP_COMPRESS) && !c->delta) {
+        c->packed = (uint8_t*)malloc(file_info->chunk_size);
+        if (c->packed == NULL) {
+            LOG_ERROR("Failed to allocate chunk buffers");
+            send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+            goto fail;
+        }
+    }
+
+    /* Chunks are received straight into the file where its pages can be
+     * mapped; direct I/O and periodic syncs need the writes to go through
+     * the writer */
+    if (config->map_output && !c->delta && file_info->file_size > 0 && !c->stripe_file.direct_io &&
+        config->write_policy.durability != DURABILITY_PERIODIC) {
+        c->entry_maps = (MapWindow**)calloc(c->ring.capacity, sizeof(MapWindow*));
+        if (c->entry_maps != NULL &&
+            file_map_output(&c->map, &c->stripe_file, file_info->chunk_size, &error) == 0) {
+            c->mapped = 1;
+            LOG_DEBUG("Receiving into a mapping of %s", c->session->temp_path);
+        } else {
+            LOG_WARN("Cannot map %s, writing chunks instead", c->session->temp_path);
+        }
+    }
+
+    /* Leaf hashes run on the shared workers after each chunk is written;
+     * the delta writer hashes the chunks it assembles itself */
+    if (c->use_tree_hash && !c->delta) {
+        c->hash_jobs = (HashJob*)calloc(c->ring.capacity, sizeof(HashJob));
+        if (c->hash_jobs == NULL) {
+            LOG_ERROR("Failed to start tree hash");
+            send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+            goto fail;
+        }
+        for (uint32_t i = 0; i < c->ring.capacity; i++) {
+            c->hash_jobs[i].tree = &c->session->tree;
+            c->hash_jobs[i].client = c;
+        }
+    }
+
+    /* Start disk writer */
+    if (platform_thread_create(&c->writer_thread, c->delta ? delta_writer_thread : chunk_writer_thread, c) != 0) {
+        LOG_ERROR("Failed to start writer thread");
+        send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", acks->sequence_num++, NULL);
+        goto fail;
+    }
+    c->writer_running = 1;
+
+    if (c->delta) {
+        LOG_INFO("Receiving delta for %llu chunks (%u buffers)...",
+                 (unsigned long long)c->stripe_chunks, c->ring.capacity);
+    } else {
+        LOG_INFO("Receiving %llu chunks (%s acknowledgments once %s, %u buffers)...",
+                 (unsigned long long)c->stripe_chunks,
+                 acks->use_sack ? "selective" : "per-chunk",
+                 config->ack_durable ? "written" : "received", c->ring.capacity);
+    }
+
+    c->state = CONN_CHUNKS;
+    if (c->received->num_set == c->stripe_chunks) {
+        conn_chunks_done(c);
+    }
+    return 0;
+
+fail:
+    conn_fail(c);
+    return -1;
+}
+
+/* The scheduler admitted the queued transfer */
+static void conn_on_admitted(void *context) {
+    conn_notify((ClientConn*)context, NOTIFY_ADMITTED);
+}
+
+/* Start the transfer announced by FILE_INFO once the scheduler admits it;
+ * until then it waits in CONN_QUEUED, and the client for its FILE_ACK */
+static int conn_admit(ClientConn *c) {
+    const FileInfo *file_info = &c->file_info;
+    SchedWaiter *waiter = &c->admission;
+    int striped = (c->capabilities & FT_CAP_STRIPED) != 0 && file_info->stripe_count > 1;
+
+    memset(waiter, 0, sizeof(*waiter));
+    waiter->notify = conn_on_admitted;
+    waiter->context = c;
+    snprintf(waiter->client, sizeof(waiter->client), "%s", c->client_ip);
+    waiter->transfer_id = striped ? file_info->transfer_id : 0;
+    waiter->stripe_index = striped ? file_info->stripe_index : 0;
+    waiter->priority = c->priority;
+
+    c->flow = scheduler_admit(&c->loop->server->scheduler, waiter);
+    if (c->flow != NULL) {
+        return conn_start_transfer(c);
+    }
+    if (!waiter->queued) {
+        LOG_ERROR("Out of memory admitting transfer");
+        send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", c->acks.sequence_num++, NULL);
+        conn_fail(c);
+        return -1;
+    }
+    c->state = CONN_QUEUED;
+    conn_touch(c);
+    return 0;
+}
+
+/* Take the next ring entry for CHUNK_DATA. Returns 1 with c->entry set, 0
+ * if every entry is busy (reading pauses until one is freed), -1 if the
+ * writer failed. */
+static int conn_acquire_entry(ClientConn *c) {
+    EventLoop *loop = c->loop;
+    int result = chunk_ring_try_acquire(&c->ring, &c->entry);
+
+    if (result == 0) {
+        /* Ask for a notification, then look again in case the entry was
+         * freed before the request was visible */
+        platform_mutex_lock(&loop->notify_lock);
+        c->stalled = 1;
+        platform_mutex_unlock(&loop->notify_lock);
+
+        result = chunk_ring_try_acquire(&c->ring, &c->entry);
+        if (result == 0) {
+            c->waiting_entry = 1;
+            conn_touch(c);
+            return 0;
+        }
+        platform_mutex_lock(&loop->notify_lock);
+        c->stalled = 0;
+        platform_mutex_unlock(&loop->notify_lock);
+    }
+
+    if (result < 0) {
+        LOG_ERROR("Writer failed: %s", protocol_get_error_string(c->ring.error));
+        conn_fail(c);
+        return -1;
+    }
+    return 1;
+}
+
+/* Point a newly acquired entry at its chunk's place in the mapped file,
+ * whose window its previous chunk no longer needs. Only a chunk that is
+ * where its header says and not received before goes there: a damaged
+ * copy must not overwrite one already written and hashed. */
+static void conn_place_entry(ClientConn *c) {
+    const ChunkHeader *chunk_hdr = &c->chunk_hdr;
+    const AckState *acks = &c->acks;
+    RingEntry *entry = c->entry;
+
+    entry->mapped = NULL;
+    if (!c->mapped || c->delta) {
+        return;
+    }
+    MapWindow **entry_map = &c->entry_maps[entry - c->ring.entries];
+    file_map_release(*entry_map);
+    *entry_map = NULL;
+
+    if (chunk_hdr->chunk_id < acks->first_chunk || chunk_hdr->chunk_id >= acks->end_chunk ||
+        chunk_hdr->chunk_offset != chunk_hdr->chunk_id * c->file_info.chunk_size ||
+        bitmap_test(c->received, chunk_hdr->chunk_id)) {
+        return;
+    }
+    entry->mapped = file_map_chunk(&c->map, chunk_hdr->chunk_offset, chunk_hdr->chunk_size, entry_map);
+}
+
+/* Hand a fully received DELTA_DATA frame in c->entry to the writer */
+static int conn_handle_delta(ClientConn *c) {
+    ChunkHeader *frame = &c->chunk_hdr;
+    RingEntry *entry = c->entry;
+    c->entry = NULL;
+
+    /* Instructions build on the ones before them, so a damaged frame cannot
+     * be sent again on its own; the transfer fails (and resumes from the
+     * chunks already rebuilt) */
+    uint64_t crc_start = platform_get_monotonic_ns();
+    uint32_t computed_crc = crc32_compute(entry->data, frame->chunk_size);
+    conn_record(c, FT_PHASE_CHECKSUM, platform_get_monotonic_ns() - crc_start);
+    if (computed_crc != frame->chunk_crc32) {
+        conn_count(c, FT_COUNT_CRC_FAILURES, 1);
+    }
+    if (computed_crc != frame->chunk_crc32 || frame->chunk_id != c->delta_frames) {
+        LOG_ERROR("Delta frame %llu damaged or out of order (expected frame %llu)",
+                  (unsigned long long)frame->chunk_id, (unsigned long long)c->delta_frames);
+        ack_send_error(&c->acks, FT_ERR_CHECKSUM, frame->chunk_id, "Damaged delta frame");
+        conn_fail(c);
+        return -1;
+    }
+    c->delta_frames++;
+
+    entry->kind = RING_DELTA;
+    entry->header = *frame;
+    entry->sequence_num = c->header.sequence_num;
+    chunk_ring_publish(&c->ring);
+    return 0;
+}
+
+/* Look up a CHUNK_HASHES batch in the chunk store. The chunks it holds
+ * count as received: CHUNK_HAVE tells the client not to send them, and a
+ * worker copies them into the file. Lookups are metadata reads, cheap
+ * next to the data they stand for, so they run on the event loop. */
+static int conn_handle_hashes(ClientConn *c) {
+    const ServerConfig *config = c->loop->server->config;
+    ChunkStore *store = c->loop->server->store;
+    AckState *acks = &c->acks;
+    const FileInfo *file_info = &c->file_info;
+    ChunkHashes hashes;
+    uint8_t found[FT_DEDUP_MAX_HASHES / 8];
+    FTErrorCode error;
+
+    if (protocol_deserialize_chunk_hashes(c->payload, (size_t)c->header.payload_size, &hashes) != 0 ||
+        hashes.first_chunk < acks->first_chunk || hashes.first_chunk > acks->end_chunk ||
+        hashes.count > acks->end_chunk - hashes.first_chunk) {
+        LOG_ERROR("Invalid chunk hash batch at chunk %llu", (unsigned long long)hashes.first_chunk);
+        ack_send_error(acks, FT_ERR_PROTOCOL, hashes.first_chunk, "Invalid chunk hashes");
+        goto fail;
+    }
+
+    StoreJob *job = (StoreJob*)malloc(sizeof(StoreJob));
+    if (job == NULL) {
+        LOG_ERROR("Failed to allocate chunk store job");
+        ack_send_error(acks, FT_ERR_OUT_OF_MEMORY, hashes.first_chunk, "Out of memory");
+        goto fail;
+    }
+    job->client = c;
+    job->file = c->session->file;
+    job->count = 0;
+
+    /* Chunks already received or resumed are not looked up again */
+    const uint8_t *leaves = c->payload + FT_CHUNK_HASHES_HEADER_SIZE;
+    uint64_t found_bytes = 0;
+    memset(found, 0, sizeof(found));
+    hashes.found = 0;
+    for (uint32_t i = 0; i < hashes.count; i++) {
+        uint64_t chunk_id = hashes.first_chunk + i;
+        uint64_t offset = chunk_id * file_info->chunk_size;
+        uint32_t size = file_info->file_size - offset < file_info->chunk_size ?
+                        (uint32_t)(file_info->file_size - offset) : file_info->chunk_size;
+        const uint8_t *leaf = leaves + (size_t)i * FT_SHA256_SIZE;
+        if (bitmap_test(c->received, chunk_id) || !chunk_store_contains(store, leaf, size)) {
+            continue;
+        }
+        memcpy(c->session->tree.leaves[chunk_id], leaf, FT_SHA256_SIZE);
+        job->chunks[job->count++] = chunk_id;
+        found[i / 8] |= (uint8_t)(1u << (i % 8));
+        found_bytes += size;
+    }
+    hashes.found = job->count;
+    chunk_store_count_lookups(store, hashes.count, hashes.found, found_bytes);
+
+    platform_mutex_lock(&acks->lock);
+    for (uint32_t i = 0; i < job->count; i++) {
+        bitmap_set(&acks->acked, job->chunks[i]);
+        if (config->ack_durable) {
+            bitmap_set(&c->received_map, job->chunks[i]);
+        }
+    }
+    int result = send_chunk_have(acks->conn, &hashes, found, acks->sequence_num++, &error);
+    platform_mutex_unlock(&acks->lock);
+    if (result != 0) {
+        LOG_ERROR("Failed to send CHUNK_HAVE: %s", protocol_get_error_string(error));
+        free(job);
+        goto fail;
+    }
+    c->received_bytes += found_bytes;
+    c->stored_chunks += job->count;
+    c->stored_bytes += found_bytes;
+
+    if (job->count == 0) {
+        free(job);
+    } else {
+        wait_group_add(&c->hashing, 1);
+        if (threadpool_submit(&c->loop->server->workers, store_job_run, job) != 0) {
+            wait_group_done(&c->hashing);
+            free(job);
+            LOG_ERROR("Failed to queue chunk store copy");
+            ack_send_error(acks, FT_ERR_OUT_OF_MEMORY, hashes.first_chunk, "Out of memory");
+            goto fail;
+        }
+    }
+
+    if (c->received->num_set == c->stripe_chunks) {
+        conn_chunks_done(c);
+    }
+    return 0;
+
+fail:
+    conn_fail(c);
+    return -1;
+}
+
+/* Handle a fully received chunk in c->entry */
+static int conn_handle_chunk(ClientConn *c) {
+    const ServerConfig *config = c->loop->server->config;
+    AckState *acks = &c->acks;
+    FileInfo *file_info = &c->file_info;
+    ChunkHeader *chunk_hdr = &c->chunk_hdr;
+    uint64_t chunk_seq = c->header.sequence_num;
+    RingEntry *entry = c->entry;
+    FTErrorCode error;
+
+    /* An entry not published here is acquired again for the next chunk */
+    c->entry = NULL;
+
+    /* Verify CRC32, of a compressed chunk once it is expanded; a hole
+     * record has no data to verify */
+    int intact = 1;
+    int hole = (c->header.flags & FT_FLAG_ZERO) != 0;
+    size_t wire_size = (size_t)c->header.payload_size - FT_CHUNK_HEADER_SIZE;
+    uint8_t *data = entry->mapped != NULL ? entry->mapped : entry->data;
+    if ((c->header.flags & FT_FLAG_LZ4) &&
+        lz4_decompress(c->packed, wire_size, data, chunk_hdr->chunk_size) != 0) {
+        LOG_ERROR("Chunk %llu does not decompress to %u bytes",
+                  (unsigned long long)chunk_hdr->chunk_id, chunk_hdr->chunk_size);
+        intact = 0;
+    }
+    if (intact && !hole) {
+        uint64_t crc_start = platform_get_monotonic_ns();
+        uint32_t computed_crc = crc32_compute(data, chunk_hdr->chunk_size);
+        conn_record(c, FT_PHASE_CHECKSUM, platform_get_monotonic_ns() - crc_start);
+        if (computed_crc != chunk_hdr->chunk_crc32) {
+            conn_count(c, FT_COUNT_CRC_FAILURES, 1);
+            LOG_ERROR("Chunk %llu CRC32 mismatch: expected 0x%08X, got 0x%08X",
+                      (unsigned long long)chunk_hdr->chunk_id, chunk_hdr->chunk_crc32, computed_crc);
+            intact = 0;
+        }
+    }
+    if (!intact) {
+        /* Payload was consumed, so the stream is still in sync: request retransmit */
+        conn_count(c, FT_COUNT_RETRANSMITS, 1);
+        if (config->ack_durable) {
+            entry->kind = RING_REJECT;
+            entry->header = *chunk_hdr;
+            entry->sequence_num = chunk_seq;
+            chunk_ring_publish(&c->ring);
+        } else if (nak_chunk(acks, chunk_hdr->chunk_id, chunk_seq, &error) != 0) {
+            goto fail;
+        }
+        return 0;
+    }
+
+    /* Validate chunk placement */
+    if (chunk_hdr->chunk_id < acks->first_chunk || chunk_hdr->chunk_id >= acks->end_chunk ||
+        chunk_hdr->chunk_offset != chunk_hdr->chunk_id * file_info->chunk_size ||
+        chunk_hdr->chunk_offset + chunk_hdr->chunk_size > file_info->file_size) {
+        LOG_ERROR("Invalid chunk %llu (offset %llu, size %u)",
+                  (unsigned long long)chunk_hdr->chunk_id,
+                  (unsigned long long)chunk_hdr->chunk_offset, chunk_hdr->chunk_size);
+        ack_send_error(acks, FT_ERR_PROTOCOL, chunk_hdr->chunk_id, "Invalid chunk");
+        goto fail;
+    }
+
+    /* Acknowledge chunk now, or leave it to the writer */
+    int is_new;
+    if (config->ack_durable) {
+        is_new = bitmap_set(&c->received_map, chunk_hdr->chunk_id);
+        if (!is_new && ack_duplicate(acks, chunk_hdr->chunk_id, &error) != 0) {
+            goto fail;
+        }
+    } else if (ack_chunk(acks, chunk_hdr->chunk_id, chunk_seq, &is_new, &error) != 0) {
+        goto fail;
+    }
+
+    if (!is_new) {
+        LOG_DEBUG("Duplicate chunk %llu", (unsigned long long)chunk_hdr->chunk_id);
+        return 0;
+    }
+    c->received_bytes += chunk_hdr->chunk_size;
+    if (hole) {
+        c->hole_bytes += chunk_hdr->chunk_size;
+        conn_count(c, FT_COUNT_HOLE_BYTES, chunk_hdr->chunk_size);
+    } else {
+        conn_count(c, FT_COUNT_BYTES, chunk_hdr->chunk_size);
+    }
+    if (c->header.flags & FT_FLAG_LZ4) {
+        c->packed_chunks++;
+        c->packed_raw_bytes += chunk_hdr->chunk_size;
+        c->packed_wire_bytes += wire_size;
+    }
+
+    /* Hand the chunk to the writer */
+    entry->kind = hole ? RING_HOLE : RING_CHUNK;
+    entry->header = *chunk_hdr;
+    entry->sequence_num = chunk_seq;
+    chunk_ring_publish(&c->ring);
+
+    /* Log progress every 10% */
+    uint64_t received_chunks = c->received->num_set;
+    if (received_chunks % (c->stripe_chunks / 10 + 1) == 0) {
+        double progress = (double)received_chunks / c->stripe_chunks * 100.0;
+        LOG_INFO("Progress: %.1f%% (%llu/%llu chunks)",
+                 progress, (unsigned long long)received_chunks,
+                 (unsigned long long)c->stripe_chunks);
+    }
+
+    if (received_chunks == c->stripe_chunks) {
+        conn_chunks_done(c);
+    }
+    return 0;
+
+fail:
+    conn_fail(c);
+    return -1;
+}
+
+/* Check the type of a verification message */
+static int conn_expect(ClientConn *c, MessageType type, const char *name) {
+    if (c->header.msg_type == type) {
+        return 0;
+    }
+    LOG_ERROR("Expected %s, got message type %d", name, c->header.msg_type);
+    conn_fail(c);
+    return -1;
+}
+
+/* Compare the client's tree root (and, on mismatch, its leaves) with ours,
+ * one message at a time */
+static int conn_verify(ClientConn *c) {
+    FileInfo *file_info = &c->file_info;
+    const TreeHash *tree = &c->session->tree;
+    VerifyResponse *response = &c->response;
+    size_t size = (size_t)c->header.payload_size;
+    FTErrorCode error;
+    char root_hex[FT_SHA256_DIGEST_SIZE * 2 + 1];
+
+    if (c->verify_step == VERIFY_COMPLETE) {
+        TransferComplete complete;
+        if (conn_expect(c, MSG_TRANSFER_COMPLETE, "TRANSFER_COMPLETE") != 0) {
+            return -1;
+        }
+        if (protocol_deserialize_transfer_complete(c->payload, size, &complete) != 0) {
+            LOG_ERROR("Malformed TRANSFER_COMPLETE payload");
+            goto fail;
+        }
+        if (complete.total_chunks != file_info->total_chunks || complete.total_bytes != file_info->file_size) {
+            LOG_ERROR("Client reports %llu chunks / %llu bytes, expected %llu / %llu",
+                      (unsigned long long)complete.total_chunks, (unsigned long long)complete.total_bytes,
+                      (unsigned long long)file_info->total_chunks, (unsigned long long)file_info->file_size);
+            send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Transfer size mismatch", c->acks.sequence_num++, NULL);
+            goto fail;
+        }
+        if (treehash_root(tree, file_info->file_checksum) != FT_SUCCESS) {
+            LOG_ERROR("Failed to compute tree root");
+            send_error(&c->conn, FT_ERR_OUT_OF_MEMORY, 0, "Out of memory", c->acks.sequence_num++, NULL);
+            goto fail;
+        }
+        c->verify_step = VERIFY_ROOT;
+        return 0;
+    }
+
+    VerifyRequest request;
+    if (conn_expect(c, MSG_VERIFY_REQUEST, "VERIFY_REQUEST") != 0) {
+        return -1;
+    }
+    if (protocol_deserialize_verify_request(c->payload, size, &request) != 0) {
+        LOG_ERROR("Malformed VERIFY_REQUEST payload");
+        goto fail;
+    }
+    const uint8_t *digests = c->payload + FT_VERIFY_REQUEST_HEADER_SIZE;
+    sha256_to_hex(file_info->file_checksum, root_hex);
+
+    if (c->verify_step == VERIFY_ROOT) {
+        if (request.checksum_type != CHECKSUM_MERKLE_SHA256 || request.mode != VERIFY_MODE_ROOT ||
+            request.digest_count != 1) {
+            LOG_ERROR("Unsupported verification request (type %u, mode %u)",
+                      request.checksum_type, request.mode);
+            send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Unsupported verification", c->acks.sequence_num++, NULL);
+            goto fail;
+        }
+
+        /* A match is answered once the file is committed */
+        if (memcmp(digests, file_info->file_checksum, FT_SHA256_SIZE) == 0) {
+            LOG_INFO("Checksum verified (tree root %s)", root_hex);
+            conn_commit(c);
+            return 0;
+        }
+
+        memset(response, 0, sizeof(*response));
+        response->error_code = (uint8_t)FT_ERR_CHECKSUM;
+        if (send_verify_response(&c->conn, response, c->acks.sequence_num++, &error) != 0) {
+            LOG_ERROR("Failed to send VERIFY_RESPONSE: %s", protocol_get_error_string(error));
+            goto fail;
+        }
+
+        /* Root mismatch: the client follows up with all of its leaves. A
+         * resumed chunk may be the one that differs, so none are kept. */
+        LOG_ERROR("Checksum mismatch (local tree root %s), comparing chunk hashes...", root_hex);
+        session_discard_partial(c->session);
+        c->verify_step = VERIFY_LEAVES;
+        c->compared = 0;
+    } else {
+        if (request.mode != VERIFY_MODE_LEAVES || request.first_leaf != c->compared ||
+            request.digest_count == 0 || request.digest_count > tree->num_leaves - c->compared) {
+            LOG_ERROR("Unexpected chunk hash batch at leaf %llu", (unsigned long long)request.first_leaf);
+            send_error(&c->conn, FT_ERR_PROTOCOL, 0, "Invalid chunk hash batch", c->acks.sequence_num++, NULL);
+            goto fail;
+        }
+
+        for (uint32_t i = 0; i < request.digest_count; i++) {
+            uint64_t chunk_id = c->compared + i;
+            if (memcmp(digests + (size_t)i * FT_SHA256_SIZE, tree->leaves[chunk_id], FT_SHA256_SIZE) == 0) {
+                continue;
+            }
+            LOG_ERROR("Chunk %llu differs", (unsigned long long)chunk_id);
+            if (response->bad_listed < FT_VERIFY_MAX_BAD_CHUNKS) {
+                response->bad_chunks[response->bad_listed++] = chunk_id;
+            }
+            response->bad_count++;
+        }
+        c->compared += request.digest_count;
+    }
+
+    if (c->compared < tree->num_leaves) {
+        return 0;
+    }
+
+    if (send_verify_response(&c->conn, response, c->acks.sequence_num++, &error) != 0) {
+        LOG_ERROR("Failed to send VERIFY_RESPONSE: %s", protocol_get_error_string(error));
+    }
+    LOG_ERROR("%llu chunk(s) differ", (unsigned long long)response->bad_count);
+
+fail:
+    conn_fail(c);
+    return -1;
+}
+
+/* Loop that serves the connection's transfer. Every stripe of a striped
+ * transfer lands on the same loop, so stripe 0 can check on the others
+ * without reaching into another loop. */
+static EventLoop* conn_owner(const ClientConn *c) {
+    const Server *server = c->loop->server;
+    const FileInfo *file_info = &c->file_info;
+
+    if ((c->capabilities & FT_CAP_STRIPED) == 0 || file_info->stripe_count <= 1) {
+        return c->loop;
+    }
+    return &server->loops[file_info->transfer_id % server->loop_count];
+}
+
+/* Handle a complete control message */
+static int conn_dispatch(ClientConn *c) {
+    FTErrorCode error;
+    size_t size = (size_t)c->header.payload_size;
+
+    switch (c->state) {
+    case CONN_HANDSHAKE: {
+        HandshakePayload payload;
+        memset(&payload, 0, sizeof(payload));
+        memcpy(&payload, c->payload, size);
+        c->capabilities = FT_CAP_SUPPORTED;
+        if (c->loop->server->config->keep_hours == 0) {
+            c->capabilities &= (uint8_t)~FT_CAP_RESUME;
+        }
+        if (c->loop->server->store == NULL) {
+            c->capabilities &= (uint8_t)~FT_CAP_DEDUP;
+        }
+        c->max_chunk_size = c->loop->server->config->max_chunk_size;
+        c->priority = handshake_priority(&c->header);
+        c->persistent = 1;
+        if (handshake_server_reply(&c->conn, &c->header, &payload, &c->capabilities, &c->max_chunk_size,
+                                   &c->persistent, &error) != 0) {
+            LOG_ERROR("Handshake failed: %s", protocol_get_error_string(error));
+            conn_fail(c);
+            return -1;
+        }
+        if (c->persistent) {
+            /* The client may idle for long between files; notice when it is gone */
+            socket_set_keepalive(c->conn.sock, FT_KEEPALIVE_INTERVAL, NULL);
+            LOG_DEBUG("Client %s keeps its session open between files", c->client_ip);
+        }
+        c->state = CONN_FILE_INFO;
+        LOG_INFO("Receiving file info...");
+        return 0;
+    }
+
+    case CONN_FILE_INFO:
+        if (c->header.msg_type == MSG_TRANSFER_COMPLETE && (c->capabilities & FT_CAP_BATCH)) {
+            return conn_end_batch(c);
+        }
+        if (c->header.msg_type == MSG_KEEPALIVE && c->persistent) {
+            /* An idle session: only its deadline moves */
+            conn_touch(c);
+            return 0;
+        }
+        if (c->header.msg_type != MSG_FILE_INFO) {
+            LOG_ERROR("Expected FILE_INFO, got message type %d", c->header.msg_type);
+            conn_fail(c);
+            return -1;
+        }
+        if (file_info_parse(&c->conn, c->payload, size, &c->file_info, NULL) != 0) {
+            conn_fail(c);
+            return -1;
+        }
+        c->route = conn_owner(c);
+        if (c->route != c->loop) {
+            return 0;
+        }
+        c->route = NULL;
+        return conn_admit(c);
+
+    case CONN_CHUNKS:
+        return conn_handle_hashes(c);
+
+    case CONN_VERIFY:
+        return conn_verify(c);
+
+    default:
+        LOG_ERROR("Unexpected message type %d", c->header.msg_type);
+        conn_fail(c);
+        return -1;
+    }
+}
+
+/* Largest control payload accepted in the current state */
+static size_t conn_payload_limit(const ClientConn *c) {
+    switch (c->state) {
+    case CONN_HANDSHAKE:
+        return sizeof(HandshakePayload);
+    case CONN_FILE_INFO:
+        return file_info_max_size(&c->conn);
+    case CONN_CHUNKS:
+        return c->dedup ? CONTROL_PAYLOAD_MAX : 0;
+    case CONN_VERIFY:
+        return CONTROL_PAYLOAD_MAX;
+    default:
+        return 0;
+    }
+}
+
+/* Take one receive step. Returns 1 to keep reading, 0 once the socket has
+ * no more data or reading paused, -1 if the connection failed. */
+static int conn_recv_step(ClientConn *c) {
+    FTErrorCode error = FT_ERR_RECV;
+    int result = 0;
+
+#ifdef FT_HAVE_TLS
+    if (c->state == CONN_TLS) {
+        result = tls_accept(&c->conn, &error);
+        if (result < 0) {
+            LOG_ERROR("TLS handshake with %s failed", c->client_ip);
+            conn_fail(c);
+        } else if (result > 0) {
+            c->state = CONN_HANDSHAKE;
+        }
+        return result;
+    }
+#endif
+
+    switch (c->step) {
+    case RECV_HEADER:
+        result = recv_header_partial(&c->conn, c->frame, &c->frame_done, &c->header, &error);
+        if (result <= 0) {
+            break;
+        }
+        c->header_size = c->frame_done;
+
+        if (c->state == CONN_CHUNKS && !(c->dedup && c->header.msg_type == MSG_CHUNK_HASHES)) {
+            if (c->header.msg_type != (c->delta ? MSG_DELTA_DATA : MSG_CHUNK_DATA)) {
+                LOG_ERROR("Expected %s, got message type %d",
+                          c->delta ? "DELTA_DATA" : "CHUNK_DATA", c->header.msg_type);
+                conn_fail(c);
+                return -1;
+            }
+            c->step = RECV_CHUNK_HEADER;
+            return 1;
+        }
+
+        size_t limit = conn_payload_limit(c);
+        if (c->header.payload_size > limit) {
+            LOG_ERROR("Payload size %llu exceeds maximum %zu",
+                      (unsigned long long)c->header.payload_size, limit);
+            conn_fail(c);
+            return -1;
+        }
+        c->payload_done = 0;
+        c->step = RECV_PAYLOAD;
+        return 1;
+
+    case RECV_PAYLOAD:
+        result = connection_recv_partial(&c->conn, c->payload, (size_t)c->header.payload_size,
+                                         &c->payload_done, &error);
+        if (result <= 0) {
+            break;
+        }
+        c->step = RECV_HEADER;
+        c->frame_done = 0;
+        return conn_dispatch(c) == 0 ? 1 : -1;
+
+    case RECV_CHUNK_HEADER:
+        result = connection_recv_partial(&c->conn, c->frame, c->header_size + FT_CHUNK_HEADER_SIZE,
+                                         &c->frame_done, &error);
+        if (result <= 0) {
+            break;
+        }
+        protocol_deserialize_chunk_header(c->frame + c->header_size, &c->chunk_hdr);
+        if (c->chunk_hdr.chunk_size > c->file_info.chunk_size) {
+            LOG_ERROR("Chunk size %u exceeds maximum %u", c->chunk_hdr.chunk_size, c->file_info.chunk_size);
+            conn_fail(c);
+            return -1;
+        }
+        if (c->header.flags & FT_FLAG_ZERO) {
+            /* Nothing follows a hole record's header */
+            if (!c->sparse || (c->header.flags & FT_FLAG_LZ4) || c->header.payload_size != FT_CHUNK_HEADER_SIZE) {
+                LOG_ERROR("Unexpected hole record of %llu bytes for chunk size %u",
+                          (unsigned long long)c->header.payload_size, c->chunk_hdr.chunk_size);
+                conn_fail(c);
+                return -1;
+            }
+        } else if (c->header.flags & FT_FLAG_LZ4) {
+            /* Only worth sending compressed if it got smaller */
+            if (c->packed == NULL || c->header.payload_size <= FT_CHUNK_HEADER_SIZE ||
+                c->header.payload_size >= FT_CHUNK_HEADER_SIZE + (uint64_t)c->chunk_hdr.chunk_size) {
+                LOG_ERROR("Unexpected compressed chunk of %llu bytes for chunk size %u",
+                          (unsigned long long)c->header.payload_size, c->chunk_hdr.chunk_size);
+                conn_fail(c);
+                return -1;
+            }
+        } else if (c->header.payload_size != FT_CHUNK_HEADER_SIZE + (uint64_t)c->chunk_hdr.chunk_size) {
+            LOG_ERROR("CHUNK_DATA payload of %llu bytes does not match chunk size %u",
+                      (unsigned long long)c->header.payload_size, c->chunk_hdr.chunk_size);
+            conn_fail(c);
+            return -1;
+        }
+        if (c->delta && c->chunk_hdr.chunk_size == 0) {
+            /* End of the delta; the writer checks that it covered the file */
+            LOG_DEBUG("Delta complete after %llu frames", (unsigned long long)c->delta_frames);
+            c->step = RECV_HEADER;
+            c->frame_done = 0;
+            conn_chunks_done(c);
+            return 1;
+        }
+        c->chunk_done = 0;
+        c->recv_charged = 0;
+        c->step = RECV_CHUNK_DATA;
+        return 1;
+
+    case RECV_CHUNK_DATA:
+        if (!c->recv_charged) {
+            /* Over the receive allocation: stop reading, so the client's window closes */
+            uint32_t wait_ms = scheduler_throttle(c->flow, SCHED_RECV, c->header.payload_size);
+            if (wait_ms > 0) {
+                c->throttle_ms = platform_get_monotonic_ms() + wait_ms;
+                conn_touch(c);
+                return 0;
+            }
+            c->recv_charged = 1;
+        }
+        if (c->entry == NULL) {
+            /* Blocks reading while every buffer is queued for the writer or being hashed */
+            result = conn_acquire_entry(c);
+            if (result <= 0) {
+                return result;
+            }
+            if (c->header.flags & FT_FLAG_ZERO) {
+                c->entry->mapped = NULL;
+            } else {
+                conn_place_entry(c);
+            }
+            c->chunk_start_ns = platform_get_monotonic_ns();
+        }
+        if (c->header.flags & FT_FLAG_ZERO) {
+            result = 1;
+        } else if (c->header.flags & FT_FLAG_LZ4) {
+            result = connection_recv_partial(&c->conn, c->packed,
+                                             (size_t)c->header.payload_size - FT_CHUNK_HEADER_SIZE,
+                                             &c->chunk_done, &error);
+        } else {
+            result = connection_recv_partial(&c->conn,
+                                             c->entry->mapped != NULL ? c->entry->mapped : c->entry->data,
+                                             c->chunk_hdr.chunk_size, &c->chunk_done, &error);
+        }
+        if (result <= 0) {
+            break;
+        }
+        c->step = RECV_HEADER;
+        c->frame_done = 0;
+        conn_record(c, FT_PHASE_RECV, platform_get_monotonic_ns() - c->chunk_start_ns);
+        if (c->delta) {
+            return conn_handle_delta(c) == 0 ? 1 : -1;
+        }
+        return conn_handle_chunk(c) == 0 ? 1 : -1;
+    }
+
+    if (result < 0) {
+        LOG_ERROR("Failed to receive from %s: %s", c->client_ip, protocol_get_error_string(error));
+        conn_fail(c);
+    }
+    return result;
+}
+
+/* Process input until the socket runs dry, reading pauses or the budget is spent */
+static void conn_read(ClientConn *c) {
+    for (int budget = CONN_READ_BUDGET; conn_reading(c); budget--) {
+        if (budget == 0) {
+            conn_mark_ready(c);
+            return;
+        }
+        if (conn_recv_step(c) <= 0) {
+            return;
+        }
+    }
+}
+
+/* Hand reassembled UDP messages on as if they had come as CHUNK_DATA,
+ * while nothing holds up receiving */
+static void conn_udp_deliver(ClientConn *c) {
+    UdpAssembly *msg;
+
+    while (c->state == CONN_CHUNKS && c->entry == NULL && c->step != RECV_CHUNK_DATA &&
+           !c->waiting_entry && c->throttle_ms == 0 && (msg = udp_receiver_peek(c->udp)) != NULL) {
+        const UdpHeader *header = &msg->header;
+        int packed = (header->flags & FT_UDP_FLAG_LZ4) != 0;
+        if (packed && c->packed == NULL) {
+            LOG_ERROR("Unexpected compressed chunk of %u bytes for chunk size %u",
+                      header->wire_size, header->chunk_size);
+            conn_fail(c);
+            return;
+        }
+        if (!c->recv_charged) {
+            uint32_t wait_ms = scheduler_throttle(c->flow, SCHED_RECV, FT_CHUNK_HEADER_SIZE + header->wire_size);
+            if (wait_ms > 0) {
+                c->throttle_ms = platform_get_monotonic_ms() + wait_ms;
+                conn_touch(c);
+                return;
+            }
+            c->recv_charged = 1;
+        }
+
+        c->chunk_hdr.chunk_id = header->chunk_id;
+        c->chunk_hdr.chunk_offset = header->chunk_id * c->file_info.chunk_size;
+        c->chunk_hdr.chunk_size = header->chunk_size;
+        c->chunk_hdr.chunk_crc32 = header->chunk_crc;
+        if (conn_acquire_entry(c) <= 0) {
+            return;
+        }
+        conn_place_entry(c);
+
+        /* A whole chunk in the right place takes the message's buffer */
+        RingEntry *entry = c->entry;
+        if (packed) {
+            memcpy(c->packed, msg->buffer, header->wire_size);
+        } else if (entry->mapped != NULL) {
+            memcpy(entry->mapped, msg->buffer, header->chunk_size);
+        } else {
+            uint8_t *data = entry->data;
+            entry->data = msg->buffer;
+            msg->buffer = data;
+        }
+
+        MessageHeader frame_header = c->header;
+        c->header.msg_type = MSG_CHUNK_DATA;
+        c->header.flags = packed ? FT_FLAG_LZ4 : 0;
+        c->header.sequence_num = header->sequence;
+        c->header.payload_size = FT_CHUNK_HEADER_SIZE + (uint64_t)header->wire_size;
+        udp_receiver_consume(c->udp);
+        c->recv_charged = 0;
+        int result = conn_handle_chunk(c);
+        c->header = frame_header;
+        if (result != 0) {
+            return;
+        }
+    }
+}
+
+/* Receive buffers for the loop's UDP sockets, large enough for udp's */
+static UdpRecvBatch* loop_udp_batch(EventLoop *loop, const UdpSocket *udp) {
+    UdpRecvBatch *batch = loop->udp_batch;
+    if (batch != NULL && (!udp->gro || batch->buffer_size >= FT_UDP_GRO_BUFFER)) {
+        return batch;
+    }
+    if (batch == NULL) {
+        batch = (UdpRecvBatch*)malloc(sizeof(UdpRecvBatch));
+    } else {
+        udp_recv_batch_free(batch);
+    }
+    if (batch == NULL || udp_recv_batch_init(batch, udp) != 0) {
+        free(batch);
+        batch = NULL;
+    }
+    loop->udp_batch = batch;
+    return batch;
+}
+
+/* Take the datagrams waiting on the connection's UDP socket */
+static void conn_udp_read(ClientConn *c) {
+    UdpReceiver *udp = c->udp;
+    FTErrorCode error = FT_ERR_RECV;
+    UdpRecvBatch *batch = loop_udp_batch(c->loop, &udp->udp);
+    if (batch == NULL) {
+        LOG_ERROR("Failed to allocate UDP receive buffers");
+        conn_fail(c);
+        return;
+    }
+
+    /* Once the stripe is complete, late copies are only reported */
+    udp->discard = c->state != CONN_CHUNKS;
+    for (int budget = UDP_READ_BUDGET; budget > 0; budget--) {
+        int count = udp_recv(&udp->udp, batch, &error);
+        if (count == 0) {
+            break;
+        }
+        if (count < 0 || udp_receiver_input(udp, batch, &error) != 0 ||
+            udp_receiver_report(udp, &error) != 0) {
+            LOG_ERROR("UDP data path from %s failed: %s", c->client_ip, protocol_get_error_string(error));
+            conn_fail(c);
+            return;
+        }
+    }
+    conn_touch(c);
+}
+
+/* Flush output and re-register interest after handling a connection;
+ * a closing connection is destroyed once its writer and output are done */
+static void conn_update(ClientConn *c) {
+    if (c->closed) {
+        return;
+    }
+    if (c->udp != NULL) {
+        conn_udp_deliver(c);
+    }
+
+    if ((c->output_pending || c->state == CONN_CLOSING) && !c->output_abandoned) {
+        FTErrorCode error;
+        int result = connection_flush(&c->conn, &error);
+        c->output_pending = (result == 0);
+        if (result < 0) {
+            c->output_abandoned = 1;
+            conn_fail(c);
+        }
+    }
+
+    if (c->route != NULL) {
+        if (c->state != CONN_CLOSING) {
+            conn_hand_over(c);
+            return;
+        }
+        c->route = NULL;
+    }
+
+    if (c->state == CONN_CLOSING && !c->writer_running && !c->committing &&
+        (!c->output_pending || c->output_abandoned)) {
+        EventLoop *loop = c->loop;
+        Server *server = loop->server;
+
+        conn_release_transfer(c);
+        conn_detach(c);
+        close_socket(c->conn.sock);
+        if (c->result == 0) {
+            LOG_INFO("Transfer completed successfully");
+            loop->stats.completed++;
+        } else {
+            LOG_ERROR("Transfer failed");
+            loop->stats.failed++;
+        }
+        LOG_INFO("Client disconnected: %s", c->client_ip);
+
+        /* Events later in this batch may still point at it */
+        c->closed = 1;
+        c->closed_next = loop->closed;
+        loop->closed = c;
+
+        platform_mutex_lock(&server->lock);
+        size_t live = --server->live_conns;
+        platform_mutex_unlock(&server->lock);
+        if (live == 0 && stop_requested) {
+            /* Let idle loops see that the shutdown can complete */
+            loop_wake_all(server);
+        }
+        return;
+    }
+
+    conn_watch(c);
+}
+
+/* Wake every loop to recheck whether it should stop */
+static void loop_wake_all(Server *server) {
+    for (uint32_t i = 0; i < server->loop_count; i++) {
+        platform_poller_wake(server->loops[i].poller);
+    }
+}
+
+/* Free a destroyed connection */
+static void conn_free(ClientConn *c) {
+    connection_free(&c->conn);
+    wait_group_destroy(&c->hashing);
+    platform_mutex_destroy(&c->acks.lock);
+    free(c->payload);
+    free(c);
+}
+
+/* Add a connection to its loop's list */
+static void conn_attach(ClientConn *c) {
+    EventLoop *loop = c->loop;
+
+    c->prev = NULL;
+    c->next = loop->conns;
+    if (loop->conns != NULL) {
+        loop->conns->prev = c;
+    }
+    loop->conns = c;
+    if (++loop->conn_count > loop->stats.peak) {
+        loop->stats.peak = loop->conn_count;
+    }
+}
+
+/* Take a connection off its loop: the poller and every list. c->next
+ * stays valid for loops walking past it. */
+static void conn_detach(ClientConn *c) {
+    EventLoop *loop = c->loop;
+
+    if (c->interest != 0) {
+        platform_poller_remove(loop->poller, c->conn.sock);
+        c->interest = 0;
+    }
+
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        loop->conns = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    loop->conn_count--;
+
+    platform_mutex_lock(&loop->notify_lock);
+    if (c->notify != 0) {
+        for (ClientConn **link = &loop->notified; *link != NULL; link = &(*link)->notify_next) {
+            if (*link == c) {
+                *link = c->notify_next;
+                break;
+            }
+        }
+        if (c->notify & NOTIFY_OUTPUT) {
+            c->output_pending = 1;
+        }
+        c->notify = 0;
+    }
+    platform_mutex_unlock(&loop->notify_lock);
+
+    if (c->ready) {
+        for (ClientConn **link = &loop->ready; *link != NULL; link = &(*link)->ready_next) {
+            if (*link == c) {
+                *link = c->ready_next;
+                break;
+            }
+        }
+        c->ready = 0;
+    }
+}
+
+/* Take a connection off this loop for the loop that owns its transfer. It
+ * is passed on after the current event batch, which may still name it. */
+static void conn_hand_over(ClientConn *c) {
+    EventLoop *loop = c->loop;
+
+    LOG_DEBUG("Handing stripe %u of transfer %016llx from event loop %u to %u",
+              c->file_info.stripe_index, (unsigned long long)c->file_info.transfer_id,
+              loop->index, c->route->index);
+    conn_detach(c);
+    loop->stats.routed_out++;
+    c->closed = 1;
+    c->closed_next = loop->handed_over;
+    loop->handed_over = c;
+}
+
+/* Pass handed-over connections to their new loops. No writer thread exists
+ * yet, so nothing else refers to them; once the target loop is notified
+ * this thread must not touch them again. */
+static void loop_pass_handovers(EventLoop *loop) {
+    while (loop->handed_over != NULL) {
+        ClientConn *c = loop->handed_over;
+        loop->handed_over = c->closed_next;
+        c->loop = c->route;
+        c->route = NULL;
+        c->closed = 0;
+        conn_notify(c, NOTIFY_ROUTED);
+    }
+}
+
+/* Start serving an accepted socket */
+static ClientConn* conn_create(EventLoop *loop, socket_t sock, const char *client_ip) {
+    ClientConn *c = (ClientConn*)calloc(1, sizeof(ClientConn));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->payload = (uint8_t*)malloc(CONTROL_PAYLOAD_MAX);
+    if (c->payload == NULL || socket_set_nonblocking(sock, 1, NULL) != 0 ||
+        connection_init(&c->conn, sock) != FT_SUCCESS) {
+        free(c->conn.recv_buf);
+        free(c->payload);
+        free(c);
+        return NULL;
+    }
+    if (connection_enable_queue(&c->conn, conn_on_output, c) != FT_SUCCESS) {
+        connection_free(&c->conn);
+        free(c->payload);
+        free(c);
+        return NULL;
+    }
+
+    c->loop = loop;
+    snprintf(c->client_ip, sizeof(c->client_ip), "%s", client_ip);
+    c->state = loop->server->config->tls ? CONN_TLS : CONN_HANDSHAKE;
+    c->step = RECV_HEADER;
+    c->result = -1;
+    c->acks.conn = &c->conn;
+    c->acks.sequence_num = 2;
+    platform_mutex_init(&c->acks.lock);
+    wait_group_init(&c->hashing);
+    conn_touch(c);
+    conn_attach(c);
+
+    platform_mutex_lock(&loop->server->lock);
+    loop->server->live_conns++;
+    platform_mutex_unlock(&loop->server->lock);
+    return c;
+}
+
+/* Accept every pending connection */
+static void loop_accept(EventLoop *loop) {
+    for (;;) {
+        char client_ip[64];
+        FTErrorCode error;
+        socket_t sock = socket_accept_connection(loop->listen_sock, client_ip, sizeof(client_ip), &error);
+        if (sock == INVALID_SOCKET_VALUE) {
+            if (error != FT_ERR_TIMEOUT) {
+                /* Out of descriptors, say: stop watching the listener for a
+                 * while rather than spinning on it */
+                platform_poller_remove(loop->poller, loop->listen_sock);
+                loop->accepting = 0;
+                loop->accept_resume_ms = platform_get_monotonic_ms() + ACCEPT_RETRY_MS;
+            }
+            return;
+        }
+
+        LOG_INFO("Client connected: %s (event loop %u)", client_ip, loop->index);
+        ClientConn *c = conn_create(loop, sock, client_ip);
+        if (c == NULL) {
+            LOG_ERROR("Out of memory accepting connection");
+            close_socket(sock);
+            continue;
+        }
+        loop->stats.accepted++;
+        conn_update(c);
+    }
+}
+
+/* Take over a connection handed over by another loop, which received its
+ * FILE_INFO; input after it may already be buffered */
+static void conn_adopt(ClientConn *c) {
+    conn_attach(c);
+    c->loop->stats.routed_in++;
+    conn_touch(c);
+    if (conn_admit(c) == 0) {
+        conn_mark_ready(c);
+    }
+}
+
+/* Handle notifications from writer threads, hash jobs and other loops */
+static void loop_handle_notifications(EventLoop *loop) {
+    for (;;) {
+        platform_mutex_lock(&loop->notify_lock);
+        ClientConn *c = loop->notified;
+        uint32_t flags = 0;
+        if (c != NULL) {
+            loop->notified = c->notify_next;
+            flags = c->notify;
+            c->notify = 0;
+        }
+        platform_mutex_unlock(&loop->notify_lock);
+        if (c == NULL) {
+            return;
+        }
+
+        if (flags & NOTIFY_ROUTED) {
+            conn_adopt(c);
+        }
+        if ((flags & NOTIFY_ADMITTED) && c->state == CONN_QUEUED) {
+            c->flow = scheduler_cancel(&c->loop->server->scheduler, &c->admission);
+            if (conn_start_transfer(c) == 0) {
+                conn_touch(c);
+                conn_mark_ready(c);
+            }
+        }
+        if (flags & NOTIFY_OUTPUT) {
+            c->output_pending = 1;
+        }
+        if ((flags & NOTIFY_SPACE) && c->waiting_entry) {
+            c->waiting_entry = 0;
+            conn_touch(c);
+            conn_mark_ready(c);
+        }
+        if ((flags & NOTIFY_SIGNED) && c->state == CONN_CHUNKS) {
+            c->signing = 0;
+            conn_touch(c);
+        }
+        if (flags & NOTIFY_WRITER) {
+            conn_writer_exited(c);
+        }
+        if (flags & NOTIFY_COMMITTED) {
+            conn_committed(c);
+        }
+        conn_update(c);
+    }
+}
+
+/* Continue reading connections that may have buffered input */
+static void loop_run_ready(EventLoop *loop) {
+    ClientConn *list = loop->ready;
+    loop->ready = NULL;
+
+    while (list != NULL) {
+        ClientConn *c = list;
+        list = c->ready_next;
+        c->ready = 0;
+        if (!c->closed) {
+            conn_read(c);
+            conn_update(c);
+        }
+    }
+}
+
+/* Expire idle connections and queued transfers, close idle sessions on
+ * shutdown, resume throttled reads and send delayed SACKs; loop 0 also has expired partial uploads collected.
+ * Returns how long the loop may sleep. */
+static int loop_run_timers(EventLoop *loop) {
+    Server *server = loop->server;
+    uint64_t now = platform_get_monotonic_ms();
+    uint64_t wait_ms = EVENT_LOOP_MAX_WAIT_MS;
+
+    if (loop->index == 0 && server->config->keep_hours > 0 && now >= server->collect_ms) {
+        server->collect_ms = now + PARTIAL_COLLECT_INTERVAL_MS;
+        if (threadpool_submit(&server->workers, collect_job_run, server) != 0) {
+            LOG_WARN("Failed to schedule partial upload collection");
+        }
+    }
+
+    if (loop->listen_sock != INVALID_SOCKET_VALUE && !loop->accepting) {
+        if (now >= loop->accept_resume_ms) {
+            if (platform_poller_add(loop->poller, loop->listen_sock, FT_POLL_READ, loop) == 0) {
+                loop->accepting = 1;
+            } else {
+                loop->accept_resume_ms = now + ACCEPT_RETRY_MS;
+            }
+        } else if (loop->accept_resume_ms - now < wait_ms) {
+            wait_ms = loop->accept_resume_ms - now;
+        }
+    }
+
+    ClientConn *next;
+    for (ClientConn *c = loop->conns; c != NULL; c = next) {
+        next = c->next;
+        if (c->closed) {
+            continue;
+        }
+
+        if (stop_requested && c->persistent && c->state == CONN_FILE_INFO && c->step == RECV_HEADER &&
+            c->frame_done == 0) {
+            /* Shutting down: a session between files has nothing in flight,
+             * and would otherwise be kept alive by its keepalives */
+            LOG_INFO("Closing idle session from %s", c->client_ip);
+            c->result = 0;
+            conn_close(c);
+            conn_update(c);
+            continue;
+        }
+        if (c->deadline_ms != 0 && now >= c->deadline_ms && c->state == CONN_QUEUED) {
+            /* The client retries later rather than waiting past its own timeout */
+            LOG_WARN("Transfer from %s not admitted in %d s, telling it to retry", c->client_ip,
+                     SCHED_QUEUE_TIMEOUT_MS / 1000);
+            scheduler_release(scheduler_turn_away(&server->scheduler, &c->admission));
+            send_error(&c->conn, FT_ERR_BUSY, 0, "Server busy", c->acks.sequence_num++, NULL);
+            conn_fail(c);
+            conn_update(c);
+            continue;
+        }
+        if (c->deadline_ms != 0 && now >= c->deadline_ms) {
+            LOG_ERROR("Connection from %s timed out", c->client_ip);
+            if (c->state == CONN_CLOSING) {
+                c->output_abandoned = 1;
+                c->deadline_ms = 0;
+            } else {
+                if (c->state != CONN_TLS) {
+                    send_error(&c->conn, FT_ERR_TIMEOUT, 0, "Timed out", c->acks.sequence_num++, NULL);
+                }
+                conn_fail(c);
+            }
+            conn_update(c);
+            continue;
+        }
+        if (c->deadline_ms != 0 && c->deadline_ms - now < wait_ms) {
+            wait_ms = c->deadline_ms - now;
+        }
+
+        /* Resume reading once the receive allocation has room again */
+        if (c->throttle_ms != 0) {
+            if (now >= c->throttle_ms) {
+                c->throttle_ms = 0;
+                conn_touch(c);
+                conn_mark_ready(c);
+                conn_update(c);
+            } else if (c->throttle_ms - now < wait_ms) {
+                wait_ms = c->throttle_ms - now;
+            }
+        }
+
+        /* Report pending chunks once the SACK delay expires without new data;
+         * with durable ACKs the writer does this */
+        if (c->state == CONN_CHUNKS && !loop->server->config->ack_durable) {
+            uint32_t remaining_ms = ack_delay_remaining(&c->acks);
+            if (remaining_ms == 0) {
+                FTErrorCode error;
+                if (ack_flush(&c->acks, &error) != 0) {
+                    conn_fail(c);
+                }
+                conn_update(c);
+            } else if (remaining_ms < wait_ms) {
+                wait_ms = remaining_ms;
+            }
+        }
+    }
+
+    return loop->ready != NULL ? 0 : (int)wait_ms;
+}
+
+/* Connections open on any loop */
+static size_t loop_server_busy(Server *server) {
+    platform_mutex_lock(&server->lock);
+    size_t live = server->failed ? 0 : server->live_conns;
+    platform_mutex_unlock(&server->lock);
+    return live;
+}
+
+/* Serve connections until a shutdown is requested and the last one closes */
+static int loop_run(EventLoop *loop) {
+    ft_poll_event_t events[EVENT_BATCH];
+    int timeout_ms = 0;
+
+    /* Stripes may still be routed here until every loop's connections are gone */
+    while (!stop_requested || loop_server_busy(loop->server)) {
+        if (stop_requested && loop->listen_sock != INVALID_SOCKET_VALUE) {
+            if (loop->index == 0) {
+                LOG_INFO("Shutting down, waiting for %zu connection(s)", loop_server_busy(loop->server));
+            }
+            if (loop->accepting) {
+                platform_poller_remove(loop->poller, loop->listen_sock);
+            }
+            if (loop->owns_listener) {
+                close_socket(loop->listen_sock);
+            }
+            loop->listen_sock = INVALID_SOCKET_VALUE;
+            loop->accepting = 0;
+        }
+
+        int count = platform_poller_wait(loop->poller, events, EVENT_BATCH, timeout_ms);
+        if (count < 0) {
+            LOG_ERROR("Event loop %u failed", loop->index);
+            platform_mutex_lock(&loop->server->lock);
+            loop->server->failed = 1;
+            platform_mutex_unlock(&loop->server->lock);
+            stop_requested = 1;
+            loop_wake_all(loop->server);
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].context == loop) {
+                loop_accept(loop);
+                continue;
+            }
+
+            if ((uintptr_t)events[i].context & 1) {
+                ClientConn *c = (ClientConn*)((uintptr_t)events[i].context & ~(uintptr_t)1);
+                if (!c->closed && c->udp != NULL) {
+                    conn_udp_read(c);
+                    conn_update(c);
+                }
+                continue;
+            }
+
+            ClientConn *c = (ClientConn*)events[i].context;
+            if (c->closed) {
+                continue;
+            }
+            conn_touch(c);
+            if ((events[i].events & (FT_POLL_READ | FT_POLL_ERROR)) && conn_reading(c)) {
+                conn_read(c);
+            }
+            if (events[i].events & (FT_POLL_WRITE | FT_POLL_ERROR)) {
+                c->output_pending = 1;
+            }
+            conn_update(c);
+        }
+
+        loop_handle_notifications(loop);
+        loop_run_ready(loop);
+        timeout_ms = loop_run_timers(loop);
+        loop_pass_handovers(loop);
+
+        while (loop->closed != NULL) {
+            ClientConn *c = loop->closed;
+            loop->closed = c->closed_next;
+            conn_free(c);
+        }
+    }
+
+    if (loop->udp_batch != NULL) {
+        udp_recv_batch_free(loop->udp_batch);
+        free(loop->udp_batch);
+        loop->udp_batch = NULL;
+    }
+    return 0;
+}
+
+/* First SIGINT/SIGTERM: drain; a second one terminates */
+static void on_stop_signal(int signum) {
+    stop_requested = 1;
+    signal(signum, SIG_DFL);
+}
+
+
+/* Thread body for event loops after the first */
+static void event_loop_thread(void *arg) {
+    EventLoop *loop = (EventLoop*)arg;
+
+    if (loop->server->config->pin_loops) {
+        int cpu = (int)(loop->index % (uint32_t)platform_cpu_count());
+        if (platform_pin_thread(cpu) != 0) {
+            LOG_WARN("Failed to pin event loop %u to CPU %d", loop->index, cpu);
+        }
+    }
+    loop->result = loop_run(loop);
+}
+
+/* Open a listening socket for one loop, with SO_REUSEPORT if requested */
+static socket_t loop_open_listener(uint16_t port, int reuseport, FTErrorCode *error) {
+    socket_t sock = socket_create(error);
+    if (sock == INVALID_SOCKET_VALUE) {
+        return INVALID_SOCKET_VALUE;
+    }
+
+    socket_set_reuseaddr(sock, 1, NULL);
+    socket_set_fastopen(sock, 1, NULL);
+    if ((reuseport && socket_set_reuseport(sock, 1, error) != 0) ||
+        socket_set_nonblocking(sock, 1, error) != 0 ||
+        socket_bind_and_listen(sock, port, SOMAXCONN, error) != 0) {
+        close_socket(sock);
+        return INVALID_SOCKET_VALUE;
+    }
+    return sock;
+}
+
+/* Give every loop a listener: its own SO_REUSEPORT socket where the kernel
+ * spreads accepts across them, otherwise one socket all loops watch */
+static int server_listen(Server *server, FTErrorCode *error) {
+    uint16_t port = server->config->port;
+
+    if (server->loop_count > 1) {
+        for (uint32_t i = 0; i < server->loop_count; i++) {
+            EventLoop *loop = &server->loops[i];
+            loop->listen_sock = loop_open_listener(port, 1, error);
+            if (loop->listen_sock == INVALID_SOCKET_VALUE) {
+                if (i == 0 && *error == FT_ERR_SOCKET) {
+                    break;
+                }
+                return -1;
+            }
+            loop->owns_listener = 1;
+        }
+    }
+
+    if (server->loops[0].listen_sock == INVALID_SOCKET_VALUE) {
+        if (server->loop_count > 1) {
+            LOG_DEBUG("SO_REUSEPORT unavailable, event loops share one listening socket");
+        }
+        server->shared_listener = loop_open_listener(port, 0, error);
+        if (server->shared_listener == INVALID_SOCKET_VALUE) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < server->loop_count; i++) {
+            server->loops[i].listen_sock = server->shared_listener;
+        }
+    }
+
+    for (uint32_t i = 0; i < server->loop_count; i++) {
+        EventLoop *loop = &server->loops[i];
+        if (platform_poller_add(loop->poller, loop->listen_sock, FT_POLL_READ, loop) != 0) {
+            if (error) *error = FT_ERR_SOCKET;
+            return -1;
+        }
+        loop->accepting = 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    ServerConfig config;
+    Server server;
+    ChunkStore chunk_store;
+    MetricsExporter exporter;
+    int exporter_ready = 0;
+    uint32_t loops_ready = 0;
+    int sessions_ready = 0;
+    int workers_ready = 0;
+    int exit_code = 1;
+
+    memset(&server, 0, sizeof(server));
+    server.config = &config;
+    server.shared_listener = INVALID_SOCKET_VALUE;
+
+    /* Parse arguments */
+    if (parse_args(argc, argv, &config) != 0) {
+        return (strcmp(argv[argc-1], "-h") == 0 || strcmp(argv[argc-1], "--help") == 0) ? 0 : 1;
+    }
+
+    /* Initialize logger */
+    logger_init(config.verbose ? LOG_DEBUG : LOG_INFO, config.log_file);
+
+    /* Initialize platform */
+    if (platform_init() != 0) {
+        LOG_ERROR("Failed to initialize platform");
+        goto cleanup;
+    }
+
+    LOG_INFO("File Transfer Server starting...");
+
+    /* Select CRC32, SHA-256 and FEC kernels once, before any worker threads exist */
+    crc32_init();
+    sha256_init_dispatch();
+    fec_init_dispatch();
+    LOG_DEBUG("CRC32 implementation: %s", crc32_implementation());
+    LOG_DEBUG("SHA-256 implementation: %s", sha256_implementation());
+    LOG_INFO("Output directory: %s", config.output_dir);
+
+    /* Chunk buffers of every connection come out of one budget */
+    if (buffer_pool_init(&config.pool, NULL) != 0) {
+        goto cleanup;
+    }
+
+#ifdef FT_HAVE_TLS
+    if (config.tls) {
+        if (tls_init(&config.tls_config, 1, NULL) != 0) {
+            goto cleanup;
+        }
+        LOG_INFO("TLS required, certificate %s", config.tls_config.cert_file);
+    }
+#endif
+
+    /* Create output directory if it doesn't exist */
+    if (!file_exists(config.output_dir)) {
+        if (file_create_directory(config.output_dir) != 0) {
+            LOG_ERROR("Failed to create output directory: %s", config.output_dir);
+            goto cleanup;
+        }
+    }
+
+    /* Chunks of committed files, looked up by later uploads */
+    if (config.store_dir[0] != '\0') {
+        if (chunk_store_open(&chunk_store, config.store_dir,
+                             config.write_policy.durability != DURABILITY_NONE, NULL) != 0) {
+            goto cleanup;
+        }
+        server.store = &chunk_store;
+        LOG_INFO("Chunk store: %s", config.store_dir);
+    }
+
+    /* Leaf hashes of every connection and file commits share one pool */
+    int hash_threads = config.hash_threads >= 0 ? config.hash_threads : platform_cpu_count();
+    if (threadpool_init(&server.workers, hash_threads, FT_MAX_WINDOW_SIZE) != FT_SUCCESS) {
+        LOG_ERROR("Failed to start worker threads");
+        goto cleanup;
+    }
+    workers_ready = 1;
+    LOG_DEBUG("Tree hash: %d worker thread(s)", hash_threads);
+
+    session_table_init(&server.sessions);
+    platform_mutex_init(&server.lock);
+    scheduler_init(&server.scheduler, &config.sched);
+    sessions_ready = 1;
+    if (config.keep_hours > 0) {
+        LOG_INFO("Keeping interrupted uploads for %d hour(s)", config.keep_hours);
+    }
+    for (int r = 0; r < SCHED_RESOURCES; r++) {
+        if (config.sched.rate[r] != SCHED_UNLIMITED || config.sched.client_rate[r] != SCHED_UNLIMITED) {
+            LOG_INFO("%s bandwidth: %.1f MB/s in all, %.1f MB/s per client (0 = unlimited)",
+                     r == SCHED_RECV ? "Receive" : "Disk write", config.sched.rate[r] / (1024.0 * 1024.0),
+                     config.sched.client_rate[r] / (1024.0 * 1024.0));
+        }
+    }
+    if (config.sched.max_transfers > 0) {
+        LOG_INFO("Receiving up to %u transfer(s) at once, queueing the rest", config.sched.max_transfers);
+    }
+
+    /* Event loops */
+    int loop_count = config.event_loops > 0 ? config.event_loops : platform_cpu_count();
+    if (loop_count > MAX_EVENT_LOOPS) {
+        loop_count = MAX_EVENT_LOOPS;
+    }
+    server.loops = (EventLoop*)calloc((size_t)loop_count, sizeof(EventLoop));
+    if (server.loops == NULL) {
+        LOG_ERROR("Out of memory");
+        goto cleanup;
+    }
+    server.loop_count = (uint32_t)loop_count;
+    for (; loops_ready < server.loop_count; loops_ready++) {
+        EventLoop *loop = &server.loops[loops_ready];
+        loop->server = &server;
+        loop->index = loops_ready;
+        loop->listen_sock = INVALID_SOCKET_VALUE;
+        loop->poller = platform_poller_create();
+        if (loop->poller == NULL) {
+            LOG_ERROR("Failed to create event loop");
+            goto cleanup;
+        }
+        platform_mutex_init(&loop->notify_lock);
+    }
+    LOG_DEBUG("Event loops: %u (%s)", server.loop_count, platform_poller_backend());
+
+    /* Create the listening sockets */
+    FTErrorCode error;
+    if (server_listen(&server, &error) != 0) {
+        LOG_ERROR("Failed to bind and listen: %s", protocol_get_error_string(error));
+        goto cleanup;
+    }
+    if (config.metrics_port != 0) {
+        if (exporter_start(&exporter, config.metrics_port, &server.metrics, &server.scheduler, &error) != 0) {
+            LOG_ERROR("Failed to serve metrics: %s", protocol_get_error_string(error));
+            goto cleanup;
+        }
+        exporter_ready = 1;
+    }
+
+    /* Broken connections surface as send errors */
+#ifndef FT_PLATFORM_WINDOWS
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+
+    LOG_INFO("Server listening on port %u", config.port);
+    LOG_INFO("Waiting for connections...");
+
+    /* Loop 0 runs on this thread */
+    for (uint32_t i = 1; i < server.loop_count; i++) {
+        EventLoop *loop = &server.loops[i];
+        if (platform_thread_create(&loop->thread, event_loop_thread, loop) != 0) {
+            LOG_ERROR("Failed to start event loop %u", i);
+            stop_requested = 1;
+            break;
+        }
+        loop->thread_running = 1;
+    }
+    if (config.pin_loops && platform_pin_thread(0) != 0) {
+        LOG_WARN("Failed to pin event loop 0 to CPU 0");
+    }
+    server.loops[0].result = loop_run(&server.loops[0]);
+
+    exit_code = 0;
+    for (uint32_t i = 0; i < server.loop_count; i++) {
+        EventLoop *loop = &server.loops[i];
+        if (loop->thread_running) {
+            platform_thread_join(loop->thread);
+            loop->thread_running = 0;
+        } else if (i > 0) {
+            /* Never started */
+            exit_code = 1;
+            continue;
+        }
+        if (loop->result != 0) {
+            exit_code = 1;
+        }
+        LOG_INFO("Event loop %u: %llu accepted, %llu routed in, %llu routed out, "
+                 "%llu completed, %llu failed, peak %zu connection(s)", i,
+                 (unsigned long long)loop->stats.accepted, (unsigned long long)loop->stats.routed_in,
+                 (unsigned long long)loop->stats.routed_out, (unsigned long long)loop->stats.completed,
+                 (unsigned long long)loop->stats.failed, loop->stats.peak);
+    }
+
+cleanup:
+    if (exporter_ready) {
+        exporter_stop(&exporter);
+    }
+    for (uint32_t i = 0; i < loops_ready; i++) {
+        EventLoop *loop = &server.loops[i];
+        if (loop->owns_listener && loop->listen_sock != INVALID_SOCKET_VALUE) {
+            close_socket(loop->listen_sock);
+        }
+    }
+    if (server.shared_listener != INVALID_SOCKET_VALUE) {
+        close_socket(server.shared_listener);
+    }
+    if (workers_ready) {
+        /* Finishes queued commits */
+        threadpool_destroy(&server.workers);
+    }
+    if (server.store != NULL) {
+        /* Counted once the last commit has added its chunks */
+        ChunkStoreStats stats;
+        chunk_store_get_stats(server.store, &stats);
+        LOG_INFO("Chunk store: %llu of %llu chunks found (%.1f%%), %llu bytes not sent "
+                 "(%llu chunks placed without copying), %llu chunks added (%llu bytes)",
+                 (unsigned long long)stats.hits, (unsigned long long)stats.lookups,
+                 stats.lookups > 0 ? (double)stats.hits / stats.lookups * 100.0 : 0.0,
+                 (unsigned long long)stats.saved_bytes, (unsigned long long)stats.shared,
+                 (unsigned long long)stats.added, (unsigned long long)stats.added_bytes);
+        chunk_store_close(server.store);
+    }
+    BufferPoolStats pool_stats;
+    buffer_pool_get_stats(&pool_stats);
+    if (pool_stats.budget > 0) {
+        LOG_INFO("Buffer pool: %llu MB (%s pages, %d NUMA node(s)), peak %llu MB in use, %llu waits for memory",
+                 (unsigned long long)(pool_stats.budget >> 20), pool_stats.backing, pool_stats.nodes,
+                 (unsigned long long)(pool_stats.peak >> 20), (unsigned long long)pool_stats.waits);
+    }
+    for (uint32_t i = 0; i < loops_ready; i++) {
+        platform_poller_destroy(server.loops[i].poller);
+        platform_mutex_destroy(&server.loops[i].notify_lock);
+    }
+    free(server.loops);
+    if (sessions_ready) {
+        SchedulerStats sched_stats;
+        scheduler_get_stats(&server.scheduler, &sched_stats);
+        if (sched_stats.waited > 0 || server.scheduler.metered) {
+            LOG_INFO("Scheduler: %llu transfer(s) admitted, %llu queued first, %llu turned away; "
+                     "throttled %.1f s receiving, %.1f s writing",
+                     (unsigned long long)sched_stats.admitted, (unsigned long long)sched_stats.waited,
+                     (unsigned long long)sched_stats.turned_away, sched_stats.held_ms[SCHED_RECV] / 1000.0,
+                     sched_stats.held_ms[SCHED_DISK] / 1000.0);
+        }
+        scheduler_destroy(&server.scheduler);
+        platform_mutex_destroy(&server.lock);
+        session_table_destroy(&server.sessions);
     }
+#ifdef FT_HAVE_TLS
+    tls_cleanup();
+#endif
 
     platform_cleanup();
     logger_close();
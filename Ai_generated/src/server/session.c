@@ -0,0 +1,458 @@
+#include "session.h"
+#include "partial.h"
+#include "../common/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initialize table */
+void session_table_init(SessionTable *table) {
+    table->head = NULL;
+    platform_mutex_init(&table->lock);
+}
+
+/* Destroy table; every session must have been released */
+void session_table_destroy(SessionTable *table) {
+    platform_mutex_destroy(&table->lock);
+}
+
+/* Check for open sessions */
+int session_table_empty(SessionTable *table) {
+    platform_mutex_lock(&table->lock);
+    int empty = (table->head == NULL);
+    platform_mutex_unlock(&table->lock);
+    return empty;
+}
+
+/* Free session resources (file already closed) */
+static void session_free(TransferSession *session) {
+    treehash_free(&session->tree);
+    bitmap_free(&session->joined);
+    bitmap_free(&session->written);
+    platform_mutex_destroy(&session->lock);
+    free(session);
+}
+
+/* Take over the temp file of an interrupted upload if its record matches */
+static uint64_t session_resume(TransferSession *session, const WritePolicy *policy, FTErrorCode *error) {
+    const FileInfo *file_info = &session->file_info;
+    char record[1024];
+    uint64_t size;
+
+    partial_build_path(session->output_dir, session->name, record, sizeof(record));
+    uint64_t resumed = partial_load(record, file_info, &session->written, &session->tree);
+    if (resumed == 0) {
+        return 0;
+    }
+
+    /* The record is only written after the temp file was synced; a temp
+     * file that has gone or changed size since means starting over */
+    file_temp_path(session->output_dir, session->name, session->temp_path, sizeof(session->temp_path));
+    if (file_get_size(session->temp_path, &size, NULL) != 0 || size != file_info->file_size ||
+        file_output_open(&session->file, session->output_dir, session->name, file_info->file_size,
+                         policy, 1, session->temp_path, sizeof(session->temp_path), error) != 0) {
+        LOG_WARN("Cannot reopen %s, starting over", session->temp_path);
+        bitmap_free(&session->written);
+        bitmap_init(&session->written, file_info->total_chunks);
+        return 0;
+    }
+
+    LOG_INFO("Resuming %s: %llu of %llu chunks already written", session->name,
+             (unsigned long long)resumed, (unsigned long long)file_info->total_chunks);
+    return resumed;
+}
+
+/* Create session and its output file (caller holds the table lock) */
+static TransferSession* session_create(const FileInfo *file_info, uint16_t stripe_count, const char *name,
+                                       const char *output_dir, const WritePolicy *policy,
+                                       int use_tree_hash, int resume, const char **message, FTErrorCode *error) {
+    TransferSession *session = (TransferSession*)calloc(1, sizeof(TransferSession));
+    if (session == NULL) {
+        *message = "Out of memory";
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    session->transfer_id = file_info->transfer_id;
+    session->file_info = *file_info;
+    strncpy(session->output_dir, output_dir, sizeof(session->output_dir) - 1);
+    snprintf(session->name, sizeof(session->name), "%s", name);
+    session->stripe_count = stripe_count;
+    session->use_tree_hash = use_tree_hash;
+    session->resumable = use_tree_hash && resume;
+    platform_mutex_init(&session->lock);
+
+    if (bitmap_init(&session->joined, stripe_count) != FT_SUCCESS ||
+        (use_tree_hash && treehash_init(&session->tree, file_info->total_chunks) != FT_SUCCESS) ||
+        (session->resumable && bitmap_init(&session->written, file_info->total_chunks) != FT_SUCCESS)) {
+        *message = "Out of memory";
+        if (error) *error = FT_ERR_OUT_OF_MEMORY;
+        goto fail;
+    }
+
+    /* Direct writes need block-aligned chunk offsets */
+    WritePolicy write_policy = *policy;
+    if (write_policy.direct_io && file_info->chunk_size % FT_IO_ALIGNMENT != 0) {
+        LOG_WARN("Chunk size %u is not a multiple of %d, using buffered writes",
+                 file_info->chunk_size, FT_IO_ALIGNMENT);
+        write_policy.direct_io = 0;
+    }
+    /* Holes of a sparse file are punched as they arrive, not preallocated */
+    write_policy.sparse = (file_info->flags & FT_FILE_SPARSE) != 0;
+
+    if (session->resumable) {
+        session->resumed_chunks = session_resume(session, &write_policy, error);
+        if (session->resumed_chunks > 0) {
+            return session;
+        }
+    }
+
+    /* Check disk space (a sparse file may need far less than its size) */
+    if (!write_policy.sparse && file_check_disk_space(output_dir, file_info->file_size, error) != 0) {
+        LOG_ERROR("Insufficient disk space");
+        *message = "Insufficient disk space";
+        if (error) *error = FT_ERR_DISK_FULL;
+        goto fail;
+    }
+
+    /* Open and preallocate file for writing */
+    if (file_output_open(&session->file, output_dir, session->name, file_info->file_size,
+                         &write_policy, 0, session->temp_path, sizeof(session->temp_path), error) != 0) {
+        LOG_ERROR("Failed to open output file: %s", protocol_get_error_string(error ? *error : FT_ERR_FILE_OPEN));
+        *message = "Cannot create file";
+        goto fail;
+    }
+
+    return session;
+
+fail:
+    session_free(session);
+    return NULL;
+}
+
+/* Check that a later stripe describes the session's file */
+static int session_matches(const TransferSession *session, const FileInfo *file_info, uint16_t stripe_count) {
+    const FileInfo *first = &session->file_info;
+    return stripe_count == session->stripe_count &&
+           file_info->file_size == first->file_size &&
+           file_info->total_chunks == first->total_chunks &&
+           file_info->chunk_size == first->chunk_size &&
+           file_info->checksum_type == first->checksum_type &&
+           file_info->flags == first->flags &&
+           strcmp(file_info->filename, first->filename) == 0;
+}
+
+/* Find another session receiving the (sanitized) name (caller holds the table lock) */
+static TransferSession* session_find_name(SessionTable *table, const char *name, const TransferSession *skip) {
+    for (TransferSession *other = table->head; other != NULL; other = other->next) {
+        if (other != skip && strcmp(other->name, name) == 0) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+/* Find or create session */
+int session_join(SessionTable *table, const FileInfo *file_info, const char *output_dir,
+                 const WritePolicy *policy, int use_tree_hash, int resume,
+                 TransferSession **session, const char **message, FTErrorCode *error) {
+    uint16_t stripe_count = file_info->stripe_count > 0 ? file_info->stripe_count : 1;
+    TransferSession *found = NULL;
+    char name[FT_MAX_PATH_LEN];
+    char path[1024];
+    int result = -1;
+
+    /* Sanitize filename; a batch names files by their path in the tree sent */
+    if (file_sanitize_path(file_info->filename, name, sizeof(name)) != 0) {
+        LOG_ERROR("Invalid filename: %s", file_info->filename);
+        *message = "Invalid filename";
+        if (error) *error = FT_ERR_INVALID_ARG;
+        return -1;
+    }
+    if (file_build_path(output_dir, name, path, sizeof(path)) != FT_SUCCESS) {
+        LOG_ERROR("Path too long: %s", name);
+        *message = "Path too long";
+        if (error) *error = FT_ERR_FILENAME_TOO_LONG;
+        return -1;
+    }
+
+    platform_mutex_lock(&table->lock);
+    if (file_info->transfer_id != 0) {
+        for (found = table->head; found != NULL; found = found->next) {
+            if (found->transfer_id == file_info->transfer_id && !found->releasing) {
+                break;
+            }
+        }
+    }
+
+    /* Two transfers of one name would share the temp file */
+    if (session_find_name(table, name, found) != NULL) {
+        LOG_ERROR("File %s is already being received", name);
+        *message = "Transfer already in progress";
+        if (error) *error = FT_ERR_BUSY;
+        goto done;
+    }
+
+    if (found == NULL) {
+        found = session_create(file_info, stripe_count, name, output_dir, policy, use_tree_hash, resume,
+                               message, error);
+        if (found == NULL) {
+            goto done;
+        }
+        found->next = table->head;
+        table->head = found;
+    } else if (!session_matches(found, file_info, stripe_count)) {
+        LOG_ERROR("Stripe %u of transfer %016llx describes a different file",
+                  file_info->stripe_index, (unsigned long long)file_info->transfer_id);
+        *message = "Stripe does not match transfer";
+        if (error) *error = FT_ERR_PROTOCOL;
+        goto done;
+    }
+
+    platform_mutex_lock(&found->lock);
+    int is_new = bitmap_set(&found->joined, file_info->stripe_index);
+    if (is_new && !found->failed) {
+        found->refs++;
+    }
+    platform_mutex_unlock(&found->lock);
+    if (!is_new || found->failed) {
+        LOG_ERROR("Stripe %u of transfer %016llx cannot join", file_info->stripe_index,
+                  (unsigned long long)file_info->transfer_id);
+        *message = is_new ? "Transfer already failed" : "Duplicate stripe";
+        if (error) *error = FT_ERR_PROTOCOL;
+        goto done;
+    }
+
+    *session = found;
+    result = 0;
+
+done:
+    platform_mutex_unlock(&table->lock);
+    return result;
+}
+
+/* Record written chunk */
+void session_chunk_written(TransferSession *session, uint64_t chunk_id) {
+    if (!session->resumable) {
+        return;
+    }
+    platform_mutex_lock(&session->lock);
+    bitmap_set(&session->written, chunk_id);
+    platform_mutex_unlock(&session->lock);
+}
+
+/* Collect resumed chunks of a stripe */
+uint64_t session_resumed_range(TransferSession *session, uint64_t first, uint64_t end, uint8_t *bitmap) {
+    uint64_t count = 0;
+
+    if (session->resumed_chunks == 0) {
+        return 0;
+    }
+    platform_mutex_lock(&session->lock);
+    for (uint64_t i = first; i < end; i++) {
+        if (bitmap_test(&session->written, i)) {
+            bitmap[(i - first) / 8] |= (uint8_t)(1u << ((i - first) % 8));
+            count++;
+        }
+    }
+    platform_mutex_unlock(&session->lock);
+    return count;
+}
+
+/* Drop written chunks */
+void session_discard_partial(TransferSession *session) {
+    platform_mutex_lock(&session->lock);
+    session->discard = 1;
+    platform_mutex_unlock(&session->lock);
+}
+
+/* Report stripe result */
+void session_stripe_done(TransferSession *session, int success, uint64_t bytes) {
+    platform_mutex_lock(&session->lock);
+    if (success) {
+        session->stripes_done++;
+        session->received_bytes += bytes;
+    } else {
+        session->failed = 1;
+    }
+    platform_mutex_unlock(&session->lock);
+}
+
+/* Check stripe progress */
+int session_stripes_status(TransferSession *session) {
+    platform_mutex_lock(&session->lock);
+    int status = session->failed ? -1 : (session->stripes_done == session->stripe_count) ? 1 : 0;
+    platform_mutex_unlock(&session->lock);
+    return status;
+}
+
+/* Close and rename output file */
+int session_commit(TransferSession *session, char *final_path, size_t final_path_size,
+                   FTErrorCode *error) {
+    /* Close file, syncing it first if the durability policy asks for it;
+     * the handle is gone either way */
+    int closed = file_output_close(&session->file, 1, error);
+    session->closed = 1;
+    if (closed != 0) {
+        LOG_ERROR("Failed to flush file: %s", protocol_get_error_string(error ? *error : FT_ERR_FILE_WRITE));
+        file_delete(session->temp_path);
+        return -1;
+    }
+
+    if (session->file_info.flags & FT_FILE_ATTRS) {
+        file_set_attributes(session->temp_path, session->file_info.file_mode, session->file_info.timestamp);
+    }
+
+    /* Finalize file (atomic rename) */
+    if (file_build_path(session->output_dir, session->name, final_path, final_path_size) != FT_SUCCESS ||
+        file_create_parents(session->output_dir, session->name) != 0 ||
+        file_finalize_write(session->temp_path, final_path) != 0) {
+        LOG_ERROR("Failed to finalize file");
+        file_delete(session->temp_path);
+        if (error) *error = FT_ERR_FILE_WRITE;
+        return -1;
+    }
+
+    /* The policy covers the rename too; the file stays, but the client is
+     * told it may not survive a crash */
+    if (session->file.policy.durability != DURABILITY_NONE && file_sync_parent(final_path, error) != 0) {
+        return -1;
+    }
+
+    /* Record of an earlier interrupted upload */
+    char record[1024];
+    partial_build_path(session->output_dir, session->name, record, sizeof(record));
+    if (file_exists(record)) {
+        file_delete(record);
+    }
+    return 0;
+}
+
+/* Close and delete the received file */
+void session_remove_file(TransferSession *session) {
+    char record[1024];
+
+    file_output_close(&session->file, 0, NULL);
+    session->closed = 1;
+    file_delete(session->temp_path);
+    partial_build_path(session->output_dir, session->name, record, sizeof(record));
+    if (file_exists(record)) {
+        file_delete(record);
+    }
+}
+
+/* Keep the temp file of an interrupted upload and record its written chunks */
+static void session_keep_partial(TransferSession *session) {
+    char record[1024];
+    FTErrorCode error;
+
+    partial_build_path(session->output_dir, session->name, record, sizeof(record));
+    if (file_output_sync(&session->file, &error) == 0 &&
+        partial_save(record, &session->file_info, &session->written, &session->tree, &error) == 0) {
+        file_output_close(&session->file, 0, NULL);
+        LOG_INFO("Kept %llu of %llu chunks of %s for a resumed upload",
+                 (unsigned long long)session->written.num_set,
+                 (unsigned long long)session->file_info.total_chunks, session->name);
+        return;
+    }
+
+    LOG_ERROR("Failed to keep %s: %s", session->temp_path, protocol_get_error_string(error));
+    file_output_close(&session->file, 0, NULL);
+    file_delete(session->temp_path);
+    file_delete(record);
+}
+
+/* Drop reference */
+void session_release(SessionTable *table, TransferSession *session) {
+    platform_mutex_lock(&table->lock);
+    platform_mutex_lock(&session->lock);
+    int last = (--session->refs == 0);
+    if (last) {
+        session->releasing = 1;
+    }
+    platform_mutex_unlock(&session->lock);
+    platform_mutex_unlock(&table->lock);
+
+    if (!last) {
+        return;
+    }
+
+    /* Still listed meanwhile, so the name stays busy and the temp file is
+     * not collected */
+    if (!session->closed) {
+        if (session->resumable && !session->discard && session->written.num_set > 0) {
+            session_keep_partial(session);
+        } else {
+            char record[1024];
+            file_output_close(&session->file, 0, NULL);
+            /* Delete temp file on error */
+            file_delete(session->temp_path);
+            partial_build_path(session->output_dir, session->name, record, sizeof(record));
+            if (file_exists(record)) {
+                file_delete(record);
+            }
+        }
+    }
+
+    platform_mutex_lock(&table->lock);
+    TransferSession **link = &table->head;
+    while (*link != session) {
+        link = &(*link)->next;
+    }
+    *link = session->next;
+    platform_mutex_unlock(&table->lock);
+    session_free(session);
+}
+
+/* Directory scan state for session_collect_partials() */
+typedef struct {
+    SessionTable *table;
+    const char   *output_dir;
+    uint64_t      cutoff;               /* Records last written before this are expired */
+    uint32_t      collected;
+} PartialScan;
+
+/* Delete one expired record and its temp file */
+static void collect_partial(const char *entry, void *context) {
+    PartialScan *scan = (PartialScan*)context;
+    char name[FT_MAX_FILENAME_LEN];
+    char path[1024];
+    FileMetadata metadata;
+
+    if (partial_parse_name(entry, name, sizeof(name)) != 0 ||
+        session_find_name(scan->table, name, NULL) != NULL) {
+        return;
+    }
+    partial_build_path(scan->output_dir, name, path, sizeof(path));
+    if (file_get_metadata(path, &metadata, NULL) != 0 || metadata.timestamp >= scan->cutoff) {
+        return;
+    }
+
+    LOG_INFO("Removing expired partial upload of %s", name);
+    file_delete(path);
+    file_temp_path(scan->output_dir, name, path, sizeof(path));
+    if (file_exists(path)) {
+        file_delete(path);
+    }
+    scan->collected++;
+}
+
+/* Garbage-collect interrupted uploads */
+void session_collect_partials(SessionTable *table, const char *output_dir, uint64_t max_age_s) {
+    PartialScan scan;
+    uint64_t now = platform_get_time_ms() / 1000;
+
+    scan.table = table;
+    scan.output_dir = output_dir;
+    scan.cutoff = now > max_age_s ? now - max_age_s : 0;
+    scan.collected = 0;
+
+    /* Sessions are created under the table lock, so none can start on a
+     * file while its record is removed */
+    platform_mutex_lock(&table->lock);
+    file_list_directory(output_dir, collect_partial, &scan);
+    platform_mutex_unlock(&table->lock);
+
+    if (scan.collected > 0) {
+        LOG_INFO("Removed %u expired partial uploads", scan.collected);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/fileio.h"
+#include "../common/bitmap.h"
+#include "../common/treehash.h"
+#include "../common/metrics.h"
+
+/*
+ * One file being received, possibly striped across several connections.
+ * Every stripe writes its chunk range into the same preallocated temp file
+ * and its leaves into the same tree; stripe 0 carries verification and
+ * commits the file once every stripe has reported its range complete.
+ * Sessions are shared between the event loop, writer threads and the
+ * worker that commits the file, so their counters are kept under `lock`.
+ *
+ * With tree hash verification an upload can be resumed: the chunks whose
+ * data and leaf are in place are tracked in `written`, and an interrupted
+ * session leaves its temp file behind with a record of them (partial.h).
+ */
+typedef struct TransferSession {
+    uint64_t    transfer_id;            /* 0 = single connection, never shared */
+    FileInfo    file_info;              /* As announced by the first stripe */
+    char        output_dir[512];
+    char        name[FT_MAX_PATH_LEN];  /* Sanitized file name or relative path */
+    char        temp_path[1024];
+    OutputFile  file;
+    int         use_tree_hash;
+    TreeHash    tree;
+    uint16_t    stripe_count;
+    ChunkBitmap joined;                 /* Stripe indices that have joined */
+    uint16_t    stripes_done;           /* Stripes whose whole range is written */
+    uint64_t    received_bytes;
+    TransferMetrics metrics;            /* Of every stripe, logged once the file is committed */
+    ChunkBitmap written;                /* Chunks written and hashed (resumable only) */
+    uint64_t    resumed_chunks;         /* Taken over from an earlier upload's record */
+    int         resumable;              /* Keep the temp file and a record if interrupted */
+    int         discard;                /* Verification failed: do not keep the written chunks */
+    int         releasing;              /* Last reference dropped, temp file being kept or deleted */
+    int         failed;
+    int         closed;                 /* Output file closed by session_commit() */
+    int         refs;                   /* Connections holding the session */
+    ft_mutex_t  lock;
+    struct TransferSession *next;
+} TransferSession;
+
+/* Open sessions, looked up by transfer ID */
+typedef struct {
+    TransferSession *head;
+    ft_mutex_t       lock;
+} SessionTable;
+
+void session_table_init(SessionTable *table);
+void session_table_destroy(SessionTable *table);
+
+/* Whether no session is open */
+int session_table_empty(SessionTable *table);
+
+/* Join the session for file_info's transfer ID, creating it (and opening
+ * the output file) for the first stripe. Later stripes must describe the
+ * same file. With resume (which needs use_tree_hash), a new session takes
+ * over the chunks recorded by an interrupted upload of the same file. A
+ * file name already being received by another transfer fails with
+ * FT_ERR_BUSY. On failure, *message is the text for the client's ERROR. */
+int session_join(SessionTable *table, const FileInfo *file_info, const char *output_dir,
+                 const WritePolicy *policy, int use_tree_hash, int resume,
+                 TransferSession **session, const char **message, FTErrorCode *error);
+
+/* Record a chunk as written and hashed */
+void session_chunk_written(TransferSession *session, uint64_t chunk_id);
+
+/* Resumed chunks in [first, end); bit i of bitmap (zeroed by the caller)
+ * is set for chunk first + i. Returns their number. */
+uint64_t session_resumed_range(TransferSession *session, uint64_t first, uint64_t end, uint8_t *bitmap);
+
+/* Do not keep the written chunks for a later upload */
+void session_discard_partial(TransferSession *session);
+
+/* Report this connection's stripe finished (bytes written) or failed */
+void session_stripe_done(TransferSession *session, int success, uint64_t bytes);
+
+/* 1 once every stripe is done, 0 while some are still running, -1 if one failed */
+int session_stripes_status(TransferSession *session);
+
+/* Close the output file (applying the finalize sync) and rename it into
+ * place, creating the directories leading to it */
+int session_commit(TransferSession *session, char *final_path, size_t final_path_size,
+                   FTErrorCode *error);
+
+/* Close the output file and delete it instead, with any record of an
+ * earlier upload: a bundle is done with once unpacked */
+void session_remove_file(TransferSession *session);
+
+/* Drop this connection's reference; the last one removes the session and,
+ * unless session_commit() ran, deletes the temp file or, for a resumable
+ * session with chunks written, syncs it and records them */
+void session_release(SessionTable *table, TransferSession *session);
+
+/* Delete the records and temp files of interrupted uploads in output_dir
+ * older than max_age_s seconds, skipping files being received */
+void session_collect_partials(SessionTable *table, const char *output_dir, uint64_t max_age_s);
+
+#endif /* SESSION_H */
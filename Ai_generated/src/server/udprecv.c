@@ -0,0 +1,417 @@
+#include "udprecv.h"
+#include "../common/bufpool.h"
+#include "../common/logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT_TEST(bits, i)  (((bits)[(i) / 8] >> ((i) % 8)) & 1)
+#define BIT_SET(bits, i)   ((bits)[(i) / 8] |= (uint8_t)(1u << ((i) % 8)))
+#define BIT_CLEAR(bits, i) ((bits)[(i) / 8] &= (uint8_t)~(1u << ((i) % 8)))
+
+/* Open receiver */
+int udp_receiver_open(UdpReceiver *r, socket_t tcp_sock, uint64_t token, uint32_t max_messages,
+                      uint32_t chunk_size, UdpSetup *setup, FTErrorCode *error) {
+    memset(r, 0, sizeof(UdpReceiver));
+    r->udp.sock = INVALID_SOCKET_VALUE;
+    r->token = token;
+    r->chunk_size = chunk_size;
+    r->max_fragments = udp_fragment_count(chunk_size);
+    r->capacity = max_messages;
+    r->ready_head = r->ready_tail = max_messages;
+
+    /* Without FEC every fragment is a group; with it a group of one has
+     * the most parity */
+    size_t have_bytes = ((size_t)r->max_fragments * (1 + FT_FEC_MAX_PARITY) + 7) / 8;
+    r->slots = (UdpAssembly*)calloc(max_messages, sizeof(UdpAssembly));
+    if (r->slots == NULL) {
+        goto oom;
+    }
+    for (uint32_t i = 0; i < max_messages; i++) {
+        r->slots[i].have = (uint8_t*)malloc(have_bytes);
+        r->slots[i].group_have = (uint16_t*)malloc(r->max_fragments * sizeof(uint16_t));
+        if (r->slots[i].have == NULL || r->slots[i].group_have == NULL) {
+            goto oom;
+        }
+    }
+
+    uint16_t port;
+    if (udp_open_server(&r->udp, tcp_sock, &port, error) != 0) {
+        udp_receiver_close(r);
+        return -1;
+    }
+    setup->token = token;
+    setup->port = port;
+    setup->max_datagram = FT_UDP_DATAGRAM_SIZE;
+    setup->max_messages = max_messages;
+    return 0;
+
+oom:
+    LOG_ERROR("Failed to allocate UDP reassembly buffers");
+    udp_receiver_close(r);
+    if (error) *error = FT_ERR_OUT_OF_MEMORY;
+    return -1;
+}
+
+/* Close receiver */
+void udp_receiver_close(UdpReceiver *r) {
+    udp_close(&r->udp);
+    if (r->slots != NULL) {
+        for (uint32_t i = 0; i < r->capacity; i++) {
+            buffer_pool_release(r->slots[i].buffer);
+            free(r->slots[i].parity);
+            free(r->slots[i].have);
+            free(r->slots[i].group_have);
+        }
+        free(r->slots);
+        r->slots = NULL;
+    }
+}
+
+/* Whether the message with this sequence number was delivered already */
+static int seq_done(const UdpReceiver *r, uint64_t sequence) {
+    if (sequence > r->done_high) {
+        return 0;
+    }
+    if (r->done_high - sequence >= UDP_RECV_DONE_SPAN) {
+        return 1;
+    }
+    return BIT_TEST(r->done, sequence % UDP_RECV_DONE_SPAN);
+}
+
+/* Note a sequence number seen, forgetting the ones it pushes out of the span */
+static void seq_seen(UdpReceiver *r, uint64_t sequence) {
+    if (sequence <= r->done_high) {
+        return;
+    }
+    uint64_t step = sequence - r->done_high;
+    if (step >= UDP_RECV_DONE_SPAN) {
+        memset(r->done, 0, sizeof(r->done));
+    } else {
+        for (uint64_t s = r->done_high + 1; s <= sequence; s++) {
+            BIT_CLEAR(r->done, s % UDP_RECV_DONE_SPAN);
+        }
+    }
+    r->done_high = sequence;
+}
+
+/* Record a packet number for the next report */
+static void record_packet(UdpReceiver *r, uint64_t packet_number, uint64_t now_us) {
+    if (!r->any_received || packet_number > r->largest) {
+        uint64_t step = r->any_received ? packet_number - r->largest : FT_UDP_REPORT_SPAN;
+        if (step >= FT_UDP_REPORT_SPAN) {
+            memset(r->received, 0, sizeof(r->received));
+        } else {
+            for (uint64_t p = r->largest + 1; p < packet_number; p++) {
+                BIT_CLEAR(r->received, p % FT_UDP_REPORT_SPAN);
+            }
+        }
+        r->any_received = 1;
+        r->largest = packet_number;
+        r->largest_time_us = now_us;
+    } else if (r->largest - packet_number >= FT_UDP_REPORT_SPAN) {
+        return;
+    }
+    BIT_SET(r->received, packet_number % FT_UDP_REPORT_SPAN);
+    r->unreported++;
+}
+
+/* Slot of a message, taking a free one (with a buffer) if it has none */
+static UdpAssembly* find_slot(UdpReceiver *r, const UdpHeader *header) {
+    UdpAssembly *slot = &r->slots[r->last_slot];
+    if (slot->used && slot->header.sequence == header->sequence) {
+        return slot;
+    }
+
+    UdpAssembly *free_slot = NULL;
+    for (uint32_t i = 0; i < r->capacity; i++) {
+        slot = &r->slots[i];
+        if (slot->used && slot->header.sequence == header->sequence) {
+            r->last_slot = i;
+            return slot;
+        }
+        if (!slot->used && (free_slot == NULL || (free_slot->buffer == NULL && slot->buffer != NULL))) {
+            free_slot = slot;
+        }
+    }
+    if (free_slot == NULL) {
+        return NULL;
+    }
+    if (free_slot->buffer == NULL) {
+        free_slot->buffer = buffer_pool_try_acquire(r->chunk_size, NULL);
+        if (free_slot->buffer == NULL) {
+            return NULL;
+        }
+    }
+
+    uint32_t fec_k = header->fec_k > 0 ? header->fec_k : 1;
+    slot = free_slot;
+    slot->used = 1;
+    slot->complete = 0;
+    slot->header = *header;
+    slot->fragments = udp_fragment_count(header->wire_size);
+    slot->groups = udp_group_count(slot->fragments, fec_k);
+    slot->groups_done = 0;
+    memset(slot->have, 0, (slot->fragments + (size_t)slot->groups * header->fec_m + 7) / 8);
+    memset(slot->group_have, 0, slot->groups * sizeof(uint16_t));
+    memset(slot->tail, 0, sizeof(slot->tail));
+    r->last_slot = (uint32_t)(slot - r->slots);
+    seq_seen(r, header->sequence);
+    return slot;
+}
+
+/* Where data fragment index of a slot goes */
+static uint8_t* fragment_place(UdpAssembly *slot, uint32_t index) {
+    return index == slot->fragments - 1 ? slot->tail : slot->buffer + (size_t)index * FT_UDP_FRAGMENT_SIZE;
+}
+
+/* Rebuild a group's missing data fragments from its parity */
+static int decode_group(UdpReceiver *r, UdpAssembly *slot, uint32_t group) {
+    uint32_t fec_k = slot->header.fec_k;
+    uint32_t fec_m = slot->header.fec_m;
+    uint32_t first = group * fec_k;
+    uint32_t count = slot->fragments - first < fec_k ? slot->fragments - first : fec_k;
+    uint8_t *data[FT_FEC_MAX_DATA];
+    const uint8_t *parity[FT_FEC_MAX_PARITY];
+    uint64_t data_present = 0;
+    uint32_t parity_present = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        data[i] = fragment_place(slot, first + i);
+        if (BIT_TEST(slot->have, first + i)) {
+            data_present |= 1ULL << i;
+        }
+    }
+    if (data_present == (count == 64 ? UINT64_MAX : (1ULL << count) - 1)) {
+        return 0;
+    }
+    for (uint32_t j = 0; j < fec_m; j++) {
+        parity[j] = slot->parity + ((size_t)group * fec_m + j) * FT_UDP_FRAGMENT_SIZE;
+        if (BIT_TEST(slot->have, slot->fragments + group * fec_m + j)) {
+            parity_present |= 1u << j;
+        }
+    }
+
+    if (!r->fec_ready || r->fec.k != fec_k || r->fec.m != fec_m) {
+        if (fec_init(&r->fec, fec_k, fec_m) != 0) {
+            return -1;
+        }
+        r->fec_ready = 1;
+    }
+    int rebuilt = fec_decode(&r->fec, count, data, data_present, parity, parity_present, FT_UDP_FRAGMENT_SIZE);
+    if (rebuilt < 0) {
+        return -1;
+    }
+    r->recovered += (uint64_t)rebuilt;
+    return 0;
+}
+
+/* Queue a whole message for delivery */
+static void complete_slot(UdpReceiver *r, UdpAssembly *slot) {
+    uint32_t index = (uint32_t)(slot - r->slots);
+    uint32_t last = slot->fragments - 1;
+
+    memcpy(slot->buffer + (size_t)last * FT_UDP_FRAGMENT_SIZE, slot->tail,
+           slot->header.wire_size - (size_t)last * FT_UDP_FRAGMENT_SIZE);
+    free(slot->parity);
+    slot->parity = NULL;
+    slot->complete = 1;
+    slot->ready_next = r->capacity;
+    if (r->ready_head == r->capacity) {
+        r->ready_head = index;
+    } else {
+        r->slots[r->ready_tail].ready_next = index;
+    }
+    r->ready_tail = index;
+}
+
+/* Take a DATA or PARITY datagram. Returns 1 if it is to be reported as
+ * received, 0 to drop it unseen. */
+static int take_fragment(UdpReceiver *r, const UdpHeader *header, const uint8_t *payload, size_t length) {
+    uint32_t fec_k = header->fec_k;
+    uint32_t fec_m = header->fec_m;
+    uint32_t raw = (header->flags & FT_UDP_FLAG_LZ4) == 0;
+
+    /* The same checks CHUNK_DATA gets before its payload is read */
+    if (fec_k > FT_FEC_MAX_DATA || fec_m > FT_FEC_MAX_PARITY || (fec_k == 0) != (fec_m == 0) ||
+        header->chunk_size == 0 || header->chunk_size > r->chunk_size || header->wire_size == 0 ||
+        (raw ? header->wire_size != header->chunk_size : header->wire_size >= header->chunk_size)) {
+        return 0;
+    }
+    uint32_t fragments = udp_fragment_count(header->wire_size);
+    uint32_t groups = udp_group_count(fragments, fec_k > 0 ? fec_k : 1);
+    size_t expected = FT_UDP_FRAGMENT_SIZE;
+    if (header->type == UDP_DATA) {
+        if (header->index >= fragments) {
+            return 0;
+        }
+        if (header->index == fragments - 1) {
+            expected = header->wire_size - (size_t)(fragments - 1) * FT_UDP_FRAGMENT_SIZE;
+        }
+    } else if (fec_m == 0 || header->index >= groups * fec_m) {
+        return 0;
+    }
+    if (length != expected) {
+        return 0;
+    }
+
+    if (r->discard || seq_done(r, header->sequence)) {
+        return 1;
+    }
+    UdpAssembly *slot = find_slot(r, header);
+    if (slot == NULL) {
+        return 0;
+    }
+    const UdpHeader *first = &slot->header;
+    if (first->chunk_id != header->chunk_id || first->chunk_size != header->chunk_size ||
+        first->chunk_crc != header->chunk_crc || first->wire_size != header->wire_size ||
+        first->flags != header->flags || first->fec_k != fec_k || first->fec_m != fec_m) {
+        return 0;
+    }
+    if (slot->complete) {
+        return 1;
+    }
+
+    uint32_t unit, group;
+    if (header->type == UDP_DATA) {
+        unit = header->index;
+        group = fec_k > 0 ? header->index / fec_k : header->index;
+    } else {
+        unit = fragments + header->index;
+        group = header->index / fec_m;
+    }
+    uint32_t group_size = fec_k == 0 ? 1 : (fragments - group * fec_k < fec_k ? fragments - group * fec_k : fec_k);
+    if (slot->group_have[group] >= group_size || BIT_TEST(slot->have, unit)) {
+        return 1;
+    }
+
+    if (header->type == UDP_DATA) {
+        memcpy(fragment_place(slot, header->index), payload, length);
+    } else {
+        if (slot->parity == NULL) {
+            slot->parity = (uint8_t*)malloc((size_t)groups * fec_m * FT_UDP_FRAGMENT_SIZE);
+            if (slot->parity == NULL) {
+                return 0;
+            }
+        }
+        memcpy(slot->parity + (size_t)header->index * FT_UDP_FRAGMENT_SIZE, payload, length);
+    }
+    BIT_SET(slot->have, unit);
+
+    if (++slot->group_have[group] == group_size) {
+        if (fec_k > 0 && decode_group(r, slot, group) != 0) {
+            /* Cannot happen with group_size shards of a valid code; start the message over */
+            LOG_WARN("FEC group %u of message %llu does not decode", group,
+                     (unsigned long long)header->sequence);
+            slot->used = 0;
+            return 1;
+        }
+        if (++slot->groups_done == slot->groups) {
+            complete_slot(r, slot);
+        }
+    }
+    return 1;
+}
+
+/* Handle one batch */
+int udp_receiver_input(UdpReceiver *r, const UdpRecvBatch *batch, FTErrorCode *error) {
+    uint64_t now_us = platform_get_monotonic_us();
+
+    for (int i = 0; i < batch->count; i++) {
+        UdpHeader header;
+        if (udp_parse_header(batch->data[i], batch->length[i], &header) != 0) {
+            continue;
+        }
+        r->datagrams++;
+
+        if (header.type == UDP_HELLO) {
+            if (header.sequence != r->token) {
+                continue;
+            }
+            if (!r->connected) {
+                if (udp_connect(&r->udp, &batch->sources[batch->source[i]], error) != 0) {
+                    return -1;
+                }
+                r->connected = 1;
+                LOG_DEBUG("UDP data path connected");
+            }
+            uint8_t reply[FT_UDP_HEADER_SIZE];
+            UdpOut out = { reply, sizeof(reply), NULL, 0 };
+            header.type = UDP_HELLO_ACK;
+            udp_serialize_header(&header, reply);
+            if (udp_send(&r->udp, &out, 1, error) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if ((header.type != UDP_DATA && header.type != UDP_PARITY) || !r->connected) {
+            continue;
+        }
+
+        if (take_fragment(r, &header, batch->data[i] + FT_UDP_HEADER_SIZE,
+                          batch->length[i] - FT_UDP_HEADER_SIZE)) {
+            record_packet(r, header.packet_number, now_us);
+        } else {
+            r->dropped++;
+        }
+    }
+    return 0;
+}
+
+/* Whether the bits below packet number p (exclusive) down to lowest all
+ * equal value for a whole byte, so the scan can skip it */
+static int skip_byte(const UdpReceiver *r, uint64_t p, uint64_t lowest, uint8_t value) {
+    return p % 8 == 0 && p >= lowest + 8 && r->received[((p - 1) % FT_UDP_REPORT_SPAN) / 8] == value;
+}
+
+/* Send a report */
+int udp_receiver_report(UdpReceiver *r, FTErrorCode *error) {
+    if (r->unreported == 0 || !r->connected) {
+        return 0;
+    }
+
+    UdpReport report;
+    report.largest = r->largest;
+    report.ack_delay_us = (uint32_t)(platform_get_monotonic_us() - r->largest_time_us);
+    report.count = 0;
+
+    /* Runs of received packet numbers, newest first */
+    uint64_t lowest = r->largest >= FT_UDP_REPORT_SPAN - 1 ? r->largest - (FT_UDP_REPORT_SPAN - 1) : 0;
+    uint64_t p = r->largest + 1;
+    while (p > lowest && report.count < FT_UDP_REPORT_RANGES) {
+        while (p > lowest && !BIT_TEST(r->received, (p - 1) % FT_UDP_REPORT_SPAN)) {
+            p -= skip_byte(r, p, lowest, 0x00) ? 8 : 1;
+        }
+        if (p == lowest) {
+            break;
+        }
+        uint64_t last = p - 1;
+        while (p > lowest && BIT_TEST(r->received, (p - 1) % FT_UDP_REPORT_SPAN)) {
+            p -= skip_byte(r, p, lowest, 0xFF) ? 8 : 1;
+        }
+        report.ranges[report.count].first = p;
+        report.ranges[report.count].last = last;
+        report.count++;
+    }
+
+    uint8_t buffer[FT_UDP_REPORT_SIZE];
+    UdpOut out = { buffer, udp_serialize_report(&report, buffer), NULL, 0 };
+    r->unreported = 0;
+    return udp_send(&r->udp, &out, 1, error) < 0 ? -1 : 0;
+}
+
+/* Oldest complete message */
+UdpAssembly* udp_receiver_peek(UdpReceiver *r) {
+    return r->ready_head == r->capacity ? NULL : &r->slots[r->ready_head];
+}
+
+/* Free the delivered message's slot */
+void udp_receiver_consume(UdpReceiver *r) {
+    UdpAssembly *slot = &r->slots[r->ready_head];
+
+    r->ready_head = slot->ready_next;
+    if (slot->header.sequence + UDP_RECV_DONE_SPAN > r->done_high) {
+        BIT_SET(r->done, slot->header.sequence % UDP_RECV_DONE_SPAN);
+    }
+    slot->used = 0;
+    slot->complete = 0;
+}
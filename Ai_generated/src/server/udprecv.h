@@ -0,0 +1,89 @@
+#ifndef UDPRECV_H
+#define UDPRECV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/udp.h"
+#include "../common/fec.h"
+
+#define UDP_RECV_DONE_SPAN   65536        /* Sequence numbers whose messages are remembered as done */
+
+/* One message being reassembled */
+typedef struct {
+    int       used;
+    int       complete;            /* Whole, waiting to be delivered */
+    UdpHeader header;              /* Of its first datagram; the others must agree */
+    uint32_t  fragments;
+    uint32_t  groups;              /* FEC groups (each fragment is one without FEC) */
+    uint32_t  groups_done;
+    uint8_t  *buffer;              /* chunk_size bytes from the buffer pool, kept for the next message */
+    uint8_t  *parity;              /* groups * fec_m fragments (FEC only) */
+    uint8_t  *have;                /* Bit per fragment received, data then parity */
+    uint16_t *group_have;          /* Fragments of each group received */
+    uint8_t   tail[FT_UDP_FRAGMENT_SIZE];  /* Last data fragment, zero-padded for FEC */
+    uint32_t  ready_next;          /* Next in the ready queue */
+} UdpAssembly;
+
+/*
+ * Server end of a file's UDP data path. Datagrams are reassembled into
+ * messages in one of `capacity` slots, which the event loop delivers in
+ * the order they completed. Every datagram kept, or belonging to a
+ * message already whole, is recorded by packet number and reported back
+ * after each batch; a datagram that finds no slot or buffer is dropped
+ * without a trace, so the sender sends it again.
+ */
+typedef struct {
+    UdpSocket    udp;
+    uint64_t     token;            /* Expected in the client's HELLO */
+    int          connected;
+    int          discard;          /* Record datagrams but keep nothing (the stripe is complete) */
+    uint32_t     chunk_size;
+    uint32_t     max_fragments;
+    UdpAssembly *slots;
+    uint32_t     capacity;
+    uint32_t     last_slot;        /* Datagrams come in runs of one message */
+    uint32_t     ready_head;       /* Completed messages, oldest first (capacity = none) */
+    uint32_t     ready_tail;
+    FecCode      fec;
+    int          fec_ready;
+
+    /* Messages already delivered, by sequence number */
+    uint8_t      done[UDP_RECV_DONE_SPAN / 8];
+    uint64_t     done_high;        /* Highest sequence number seen */
+
+    /* Packet numbers received in the last FT_UDP_REPORT_SPAN */
+    uint8_t      received[FT_UDP_REPORT_SPAN / 8];
+    uint64_t     largest;
+    int          any_received;
+    uint64_t     largest_time_us;
+    uint32_t     unreported;
+
+    uint64_t     datagrams;        /* Statistics */
+    uint64_t     dropped;
+    uint64_t     recovered;        /* Fragments rebuilt by FEC */
+} UdpReceiver;
+
+/* Open the socket on tcp_sock's local address and fill setup; max_messages
+ * is how many messages may be reassembled at once */
+int udp_receiver_open(UdpReceiver *r, socket_t tcp_sock, uint64_t token, uint32_t max_messages,
+                      uint32_t chunk_size, UdpSetup *setup, FTErrorCode *error);
+
+void udp_receiver_close(UdpReceiver *r);
+
+/* Handle the datagrams of one udp_recv(); returns -1 on a socket error */
+int udp_receiver_input(UdpReceiver *r, const UdpRecvBatch *batch, FTErrorCode *error);
+
+/* Send a REPORT if datagrams were recorded since the last one */
+int udp_receiver_report(UdpReceiver *r, FTErrorCode *error);
+
+/* Oldest complete message not yet delivered, or NULL */
+UdpAssembly* udp_receiver_peek(UdpReceiver *r);
+
+/* Done with the message peek() returned; its slot keeps whatever buffer
+ * it holds now for the next message (the caller may swap it for another
+ * chunk_size pool buffer) */
+void udp_receiver_consume(UdpReceiver *r);
+
+#endif /* UDPRECV_H */